@@ -32,6 +32,7 @@ FUZZING_LIBS = \
 	src/common/libor-ctime-testing.a \
 	src/common/libor-event-testing.a \
 	src/trunnel/libor-trunnel-testing.a \
+	src/trace/libor-trace.a \
 	$(rust_ldadd) \
 	@TOR_ZLIB_LIBS@ @TOR_LIB_MATH@ \
 	@TOR_LIBEVENT_LIBS@ \
@@ -49,7 +50,8 @@ oss-fuzz-prereqs: \
 	src/common/libor-testing.a \
 	src/common/libor-ctime-testing.a \
 	src/common/libor-event-testing.a \
-	src/trunnel/libor-trunnel-testing.a
+	src/trunnel/libor-trunnel-testing.a \
+	src/trace/libor-trace.a
 
 noinst_HEADERS += \
 	src/test/fuzz/fuzzing.h
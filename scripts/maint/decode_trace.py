@@ -0,0 +1,177 @@
+#!/usr/bin/python
+# Copyright (c) 2017, The Tor Project, Inc.
+# See LICENSE for licensing information
+
+"""
+Usage: decode_trace.py [--text] trace-dump [output.json]
+
+Convert a trace dump written by a tor built with --enable-event-tracing-ring
+(see src/trace/ring.c) into the Chrome trace event format, which can be
+loaded into chrome://tracing, Perfetto, or any other viewer that reads it.
+
+Events whose names end in "_begin" and "_end" become the start and end of a
+duration; all others become instant events.  With --text, print one line
+per event instead, ordered by time.
+"""
+
+from __future__ import print_function
+
+import json
+import struct
+import sys
+
+MAGIC = b"TORTRACE"
+VERSION = 1
+BOM = 0x01020304
+RECORD = "QII4Q"
+
+
+class DumpError(Exception):
+    pass
+
+
+class Reader(object):
+    """Helper: read fixed-size fields from a buffer."""
+    def __init__(self, data, order):
+        self.data = data
+        self.pos = 0
+        self.order = order
+
+    def take(self, fmt):
+        fmt = self.order + fmt
+        size = struct.calcsize(fmt)
+        if self.pos + size > len(self.data):
+            raise DumpError("Truncated trace dump")
+        values = struct.unpack_from(fmt, self.data, self.pos)
+        self.pos += size
+        return values
+
+    def take_bytes(self, n):
+        if self.pos + n > len(self.data):
+            raise DumpError("Truncated trace dump")
+        s = self.data[self.pos:self.pos+n]
+        self.pos += n
+        return s
+
+
+def parse_dump(data):
+    """Return a list of event types and a list of (thread_num, thread_id,
+       records) tuples from the dump in 'data'."""
+    if data[:len(MAGIC)] != MAGIC:
+        raise DumpError("Not a tor trace dump")
+    for order in "<>":
+        version, bom = struct.unpack_from(order + "II", data, len(MAGIC))
+        if bom == BOM:
+            break
+    else:
+        raise DumpError("Unrecognized byte order")
+    if version != VERSION:
+        raise DumpError("Unsupported trace dump version %d" % version)
+
+    r = Reader(data, order)
+    r.pos = len(MAGIC) + 8
+    n_events, n_rings = r.take("II")
+
+    events = []
+    for _ in range(n_events):
+        (length,) = r.take("I")
+        desc = r.take_bytes(length).decode("ascii")
+        subsystem, name, argnames = desc.split(":", 2)
+        args = [a for a in argnames.split(",") if a]
+        events.append((subsystem, name, args))
+
+    rings = []
+    for _ in range(n_rings):
+        thread_num, n_records, thread_id = r.take("IIQ")
+        records = []
+        for _ in range(n_records):
+            ts, event, _pad, a0, a1, a2, a3 = r.take(RECORD)
+            records.append((ts, event, (a0, a1, a2, a3)))
+        rings.append((thread_num, thread_id, records))
+
+    return events, rings
+
+
+def event_args(events, event, values):
+    """Return a dict mapping the argument names of 'event' to 'values'."""
+    if event >= len(events):
+        return {}
+    return dict(zip(events[event][2], values))
+
+
+def to_chrome(events, rings):
+    out = []
+    for thread_num, thread_id, records in rings:
+        out.append({"name": "thread_name", "ph": "M", "pid": 1,
+                    "tid": thread_num,
+                    "args": {"name": "thread %d (%x)" % (thread_num,
+                                                         thread_id)}})
+        for ts, event, values in records:
+            if event < len(events):
+                subsystem, name, _ = events[event]
+            else:
+                subsystem, name = "unknown", "event%d" % event
+            ev = {"cat": subsystem, "pid": 1, "tid": thread_num,
+                  "ts": ts / 1000.0,
+                  "args": event_args(events, event, values)}
+            if name.endswith("_begin"):
+                ev["name"] = "%s:%s" % (subsystem, name[:-len("_begin")])
+                ev["ph"] = "B"
+            elif name.endswith("_end"):
+                ev["name"] = "%s:%s" % (subsystem, name[:-len("_end")])
+                ev["ph"] = "E"
+            else:
+                ev["name"] = "%s:%s" % (subsystem, name)
+                ev["ph"] = "i"
+                ev["s"] = "t"
+            out.append(ev)
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def to_text(events, rings, f):
+    lines = []
+    for thread_num, _, records in rings:
+        for ts, event, values in records:
+            if event < len(events):
+                label = "%s:%s" % events[event][:2]
+            else:
+                label = "unknown:event%d" % event
+            args = event_args(events, event, values)
+            argstr = " ".join("%s=%d" % (k, args[k]) for k in
+                              events[event][2]) if args else ""
+            lines.append((ts, thread_num, label, argstr))
+    lines.sort()
+    for ts, thread_num, label, argstr in lines:
+        print("%d.%09d [%d] %s %s" % (ts // 1000000000, ts % 1000000000,
+                                      thread_num, label, argstr), file=f)
+
+
+def main(argv):
+    text = False
+    if len(argv) > 1 and argv[1] == "--text":
+        text = True
+        argv = argv[:1] + argv[2:]
+    if len(argv) not in (2, 3):
+        print(__doc__, file=sys.stderr)
+        return 1
+
+    with open(argv[1], "rb") as f:
+        data = f.read()
+    try:
+        events, rings = parse_dump(data)
+    except DumpError as e:
+        print("%s: %s" % (argv[1], e), file=sys.stderr)
+        return 1
+
+    out = open(argv[2], "w") if len(argv) == 3 else sys.stdout
+    if text:
+        to_text(events, rings, out)
+    else:
+        json.dump(to_chrome(events, rings), out)
+    if out is not sys.stdout:
+        out.close()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
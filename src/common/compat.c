@@ -1065,6 +1065,18 @@ tor_ftruncate(int fd)
 #endif
 }
 
+/** Flush everything written to <b>fd</b> through to the underlying storage
+ * device.  Return -1 on error, 0 on success. */
+int
+tor_fsync(int fd)
+{
+#ifdef _WIN32
+  return _commit(fd);
+#else
+  return fsync(fd);
+#endif
+}
+
 #undef DEBUG_SOCKET_COUNTING
 #ifdef DEBUG_SOCKET_COUNTING
 /** A bitarray of all fds that should be passed to tor_socket_close(). Only
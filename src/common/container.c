@@ -7,8 +7,8 @@
  * \file container.c
  * \brief Implements a smartlist (a resizable array) along
  * with helper functions to use smartlists.  Also includes
- * hash table implementations of a string-to-void* map, and of
- * a digest-to-void* map.
+ * open-addressing hash table implementations of a string-to-void* map, and
+ * of digest-to-void* maps.
  **/
 
 #include "compat.h"
@@ -21,8 +21,6 @@
 #include <string.h>
 #include <assert.h>
 
-#include "ht.h"
-
 /** All newly allocated smartlists have this capacity. */
 #define SMARTLIST_DEFAULT_CAPACITY 16
 
@@ -325,16 +323,112 @@ smartlist_contains_digest(const smartlist_t *sl, const char *element)
   return 0;
 }
 
+/** Don't build a hash set for a set operation on two smartlists unless the
+ * product of their lengths is at least this large: below that, calling
+ * smartlist_contains() in a loop is faster. */
+#define SMARTLIST_SET_OP_HASH_THRESHOLD 256
+
+/** A temporary set of pointers, used by the set operations below when both
+ * lists are large.  It's an open-addressing table with linear probing, and
+ * it's never more than half full.  NULL marks an empty slot, so we remember
+ * separately whether NULL is a member. */
+typedef struct ptrset_t {
+  /** The members of the set, or NULL for empty slots. */
+  const void **slots;
+  /** One less than the number of slots, which is a power of two. */
+  unsigned mask;
+  /** 64 minus the log2 of the number of slots. */
+  unsigned shift;
+  /** True iff NULL is a member of the set. */
+  int has_null;
+} ptrset_t;
+
+/** Helper: return the slot where we start looking for <b>p</b> in
+ * <b>set</b>. */
+static inline unsigned
+ptrset_bucket(const ptrset_t *set, const void *p)
+{
+  /* Fibonacci hashing: the low bits of a pointer are usually zero, but the
+   * multiplication mixes every bit into the top bits of the product. */
+  const uint64_t h = (uint64_t)(uintptr_t)p * UINT64_C(0x9e3779b97f4a7c15);
+  return (unsigned)(h >> set->shift);
+}
+
+/** Initialize <b>set</b> to hold every element of <b>sl</b>. */
+static void
+ptrset_init_from_smartlist(ptrset_t *set, const smartlist_t *sl)
+{
+  const int log_slots = tor_log2(sl->num_used) + 2;
+  int i;
+  set->slots = tor_calloc((size_t)1 << log_slots, sizeof(void *));
+  set->mask = (1u << log_slots) - 1;
+  set->shift = 64 - log_slots;
+  set->has_null = 0;
+  for (i = 0; i < sl->num_used; ++i) {
+    const void *p = sl->list[i];
+    unsigned idx;
+    if (!p) {
+      set->has_null = 1;
+      continue;
+    }
+    idx = ptrset_bucket(set, p);
+    while (set->slots[idx] && set->slots[idx] != p)
+      idx = (idx + 1) & set->mask;
+    set->slots[idx] = p;
+  }
+}
+
+/** Return true iff <b>p</b> is a member of <b>set</b>. */
+static inline int
+ptrset_contains(const ptrset_t *set, const void *p)
+{
+  unsigned idx;
+  if (!p)
+    return set->has_null;
+  idx = ptrset_bucket(set, p);
+  while (set->slots[idx]) {
+    if (set->slots[idx] == p)
+      return 1;
+    idx = (idx + 1) & set->mask;
+  }
+  return 0;
+}
+
+/** Release all storage held by <b>set</b>. */
+static void
+ptrset_clear(ptrset_t *set)
+{
+  tor_free(set->slots);
+}
+
+/** Helper: return true iff a set operation that looks up each element of
+ * <b>probe</b> in <b>members</b> should use a ptrset_t. */
+static inline int
+smartlist_set_op_wants_hash(const smartlist_t *probe,
+                            const smartlist_t *members)
+{
+  return (uint64_t)probe->num_used * (uint64_t)members->num_used >=
+    SMARTLIST_SET_OP_HASH_THRESHOLD;
+}
+
 /** Return true iff some element E of sl2 has smartlist_contains(sl1,E).
  */
 int
 smartlist_overlap(const smartlist_t *sl1, const smartlist_t *sl2)
 {
-  int i;
-  for (i=0; i < sl2->num_used; i++)
-    if (smartlist_contains(sl1, sl2->list[i]))
-      return 1;
-  return 0;
+  int i, found = 0;
+  ptrset_t set;
+  if (!smartlist_set_op_wants_hash(sl2, sl1)) {
+    for (i=0; i < sl2->num_used; i++)
+      if (smartlist_contains(sl1, sl2->list[i]))
+        return 1;
+    return 0;
+  }
+  ptrset_init_from_smartlist(&set, sl1);
+  for (i=0; i < sl2->num_used && !found; i++)
+    found = ptrset_contains(&set, sl2->list[i]);
+  ptrset_clear(&set);
+  return found;
 }
 
 /** Remove every element E of sl1 such that !smartlist_contains(sl2,E).
@@ -344,12 +438,24 @@ void
 smartlist_intersect(smartlist_t *sl1, const smartlist_t *sl2)
 {
   int i;
+  ptrset_t set;
+  if (!smartlist_set_op_wants_hash(sl1, sl2)) {
+    for (i=0; i < sl1->num_used; i++)
+      if (!smartlist_contains(sl2, sl1->list[i])) {
+        sl1->list[i] = sl1->list[--sl1->num_used]; /* swap with the end */
+        i--; /* so we process the new i'th element */
+        sl1->list[sl1->num_used] = NULL;
+      }
+    return;
+  }
+  ptrset_init_from_smartlist(&set, sl2);
   for (i=0; i < sl1->num_used; i++)
-    if (!smartlist_contains(sl2, sl1->list[i])) {
+    if (!ptrset_contains(&set, sl1->list[i])) {
       sl1->list[i] = sl1->list[--sl1->num_used]; /* swap with the end */
       i--; /* so we process the new i'th element */
       sl1->list[sl1->num_used] = NULL;
     }
+  ptrset_clear(&set);
 }
 
 /** Remove every element E of sl1 such that smartlist_contains(sl2,E).
@@ -359,8 +465,20 @@ void
 smartlist_subtract(smartlist_t *sl1, const smartlist_t *sl2)
 {
   int i;
-  for (i=0; i < sl2->num_used; i++)
-    smartlist_remove(sl1, sl2->list[i]);
+  ptrset_t set;
+  if (!smartlist_set_op_wants_hash(sl1, sl2)) {
+    for (i=0; i < sl2->num_used; i++)
+      smartlist_remove(sl1, sl2->list[i]);
+    return;
+  }
+  ptrset_init_from_smartlist(&set, sl2);
+  for (i=0; i < sl1->num_used; i++)
+    if (ptrset_contains(&set, sl1->list[i])) {
+      sl1->list[i] = sl1->list[--sl1->num_used]; /* swap with the end */
+      i--; /* so we process the new i'th element */
+      sl1->list[sl1->num_used] = NULL;
+    }
+  ptrset_clear(&set);
 }
 
 /** Remove the <b>idx</b>th element of sl; if idx is not the last
@@ -1085,116 +1203,259 @@ smartlist_uniq_digests256(smartlist_t *sl)
   smartlist_uniq(sl, compare_digests256_, tor_free_);
 }
 
-/** Helper: Declare an entry type and a map type to implement a mapping using
- * ht.h.  The map type will be called <b>maptype</b>.  The key part of each
- * entry is declared using the C declaration <b>keydecl</b>.  All functions
- * and types associated with the map get prefixed with <b>prefix</b> */
+/* The string and digest maps below are open-addressing hash tables in the
+ * style of a "Swiss table".  Every map has an array of slots, each of which
+ * holds a key and a value inline, and a parallel array of one-byte "control"
+ * values.  A control byte is MAP_CTRL_EMPTY for a slot that has never been
+ * used since the last rehash, MAP_CTRL_DELETED for a slot whose entry was
+ * removed, or the low 7 bits of the hash of the slot's key.
+ *
+ * The slots are divided into groups of MAP_GROUP_WIDTH.  To look up a key,
+ * we hash it, pick a starting group from the high bits of the hash, and then
+ * visit groups in a triangular probe sequence.  In each group, we load all
+ * of its control bytes at once into a single word, and use bit tricks to
+ * find the slots whose control byte matches the low 7 bits of the hash: only
+ * those slots' keys need to be compared.  The search stops at the first
+ * group that has an empty slot.
+ *
+ * Removing an entry marks its slot as deleted, unless its group has an empty
+ * slot (in which case no probe sequence can have gone past it), so that the
+ * other entries never move.  That's what lets MAP_FOREACH_MODIFY remove the
+ * current entry and keep going.  Deleted slots are reused by later inserts,
+ * and cleared out whenever the map is rehashed.
+ */
+
+/** Control byte for a slot that is empty. */
+#define MAP_CTRL_EMPTY 0x80
+/** Control byte for a slot whose entry was removed. */
+#define MAP_CTRL_DELETED 0xfe
+/** How many slots are in each group? Capacities are multiples of this. */
+#define MAP_GROUP_WIDTH 8
+/** Helper: the low bit of every byte in a group. */
+#define MAP_LSBS UINT64_C(0x0101010101010101)
+/** Helper: the high bit of every byte in a group. */
+#define MAP_MSBS UINT64_C(0x8080808080808080)
+/** Return the part of <b>hash</b> that chooses where to start probing. */
+#define MAP_H1(hash) ((hash) >> 7)
+/** Return the part of <b>hash</b> that we keep in a slot's control byte. */
+#define MAP_H2(hash) ((uint8_t)((hash) & 0x7f))
+/** Return how many entries a map with <b>capacity</b> slots can hold before
+ * we grow it. */
+#define MAP_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+/** Bookkeeping shared by all of our map types. */
+typedef struct map_table_t {
+  /** One control byte for each slot. */
+  uint8_t *ctrl;
+  /** How many slots are there? Zero, or a power of two that is at least
+   * MAP_GROUP_WIDTH. */
+  unsigned capacity;
+  /** How many slots hold entries? */
+  unsigned size;
+  /** How many more empty slots can we fill before we have to rehash? */
+  unsigned growth_left;
+} map_table_t;
+
+/** Helper: load the control bytes of the group starting at <b>ctrl</b>, so
+ * that the byte for the first slot is the least significant. */
+static inline uint64_t
+map_group_load(const uint8_t *ctrl)
+{
+  uint64_t group;
+#ifdef WORDS_BIGENDIAN
+  int i;
+  group = 0;
+  for (i = MAP_GROUP_WIDTH - 1; i >= 0; --i)
+    group = (group << 8) | ctrl[i];
+#else
+  memcpy(&group, ctrl, sizeof(group));
+#endif
+  return group;
+}
+
+/** Helper: return a mask with the high bit set in the bytes of
+ * <b>group</b> whose slots might hold a key with the control byte
+ * <b>h2</b>.  (There can be false positives, but no false negatives.) */
+static inline uint64_t
+map_group_match(uint64_t group, uint8_t h2)
+{
+  const uint64_t x = group ^ (MAP_LSBS * h2);
+  return (x - MAP_LSBS) & ~x & MAP_MSBS;
+}
+
+/** Helper: return a mask with the high bit set in the bytes of
+ * <b>group</b> that are empty. */
+static inline uint64_t
+map_group_match_empty(uint64_t group)
+{
+  return group & (~group << 6) & MAP_MSBS;
+}
+
+/** Helper: return a mask with the high bit set in the bytes of
+ * <b>group</b> that are empty or deleted. */
+static inline uint64_t
+map_group_match_empty_or_deleted(uint64_t group)
+{
+  return group & ~(group << 7) & MAP_MSBS;
+}
+
+/** Helper: return the index within its group of the first slot set in
+ * the nonzero mask <b>match</b>. */
+static inline unsigned
+map_match_first(uint64_t match)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_ctzll(match) / 8;
+#else
+  unsigned i = 0;
+  while (!(match & 0x80)) {
+    match >>= 8;
+    ++i;
+  }
+  return i;
+#endif /* defined(__GNUC__) || defined(__clang__) */
+}
+
+/** Return the index of the first empty or deleted slot in <b>t</b> along
+ * the probe sequence for <b>hash</b>. There must be one. */
+static unsigned
+map_table_find_insert_slot(const map_table_t *t, uint64_t hash)
+{
+  const unsigned mask = t->capacity / MAP_GROUP_WIDTH - 1;
+  unsigned g = (unsigned)(MAP_H1(hash) & mask), step = 0;
+  for (;;) {
+    const unsigned base = g * MAP_GROUP_WIDTH;
+    const uint64_t match =
+      map_group_match_empty_or_deleted(map_group_load(t->ctrl + base));
+    if (match)
+      return base + map_match_first(match);
+    g = (g + ++step) & mask;
+  }
+}
+
+/** Return the index of the first slot at or after <b>idx</b> in <b>t</b>
+ * that holds an entry, or -1 if there is none. */
+static int
+map_table_next_full(const map_table_t *t, unsigned idx)
+{
+  while (idx < t->capacity) {
+    const unsigned base = idx & ~(MAP_GROUP_WIDTH - 1);
+    uint64_t full = ~map_group_load(t->ctrl + base) & MAP_MSBS;
+    full &= ~UINT64_C(0) << ((idx - base) * 8);
+    if (full)
+      return (int)(base + map_match_first(full));
+    idx = base + MAP_GROUP_WIDTH;
+  }
+  return -1;
+}
+
+/** Mark the slot <b>idx</b> in <b>t</b>, which held an entry, as free. */
+static void
+map_table_erase(map_table_t *t, unsigned idx)
+{
+  const unsigned base = idx & ~(MAP_GROUP_WIDTH - 1);
+  --t->size;
+  if (map_group_match_empty(map_group_load(t->ctrl + base))) {
+    /* A group that has an empty slot has always had one since the last
+     * rehash, so no probe sequence continues past it. */
+    t->ctrl[idx] = MAP_CTRL_EMPTY;
+    ++t->growth_left;
+  } else {
+    t->ctrl[idx] = MAP_CTRL_DELETED;
+  }
+}
+
+/** Return the number of slots that a table should have after a rehash,
+ * given that it holds <b>t</b>'s entries plus one more. */
+static unsigned
+map_table_rehash_capacity(const map_table_t *t)
+{
+  unsigned capacity = t->capacity ? t->capacity : MAP_GROUP_WIDTH;
+  /* Grow if the table would be more than about half full.  Otherwise, most
+   * of its used-up slots are deleted ones, and rehashing it at the same
+   * size will clear them out. */
+  if (t->size + 1 > MAP_MAX_LOAD(capacity) / 2)
+    capacity *= 2;
+  return capacity;
+}
+
+/** Helper: Declare an entry type and a map type to implement a mapping
+ * using an open-addressing table.  The map type will be called
+ * <b>maptype</b>.  The key part of each entry is declared using the C
+ * declaration <b>keydecl</b>.  All functions and types associated with the
+ * map get prefixed with <b>prefix</b> */
 #define DEFINE_MAP_STRUCTS(maptype, keydecl, prefix)      \
   typedef struct prefix ## entry_t {                      \
-    HT_ENTRY(prefix ## entry_t) node;                     \
     void *val;                                            \
     keydecl;                                              \
   } prefix ## entry_t;                                    \
   struct maptype {                                        \
-    HT_HEAD(prefix ## impl, prefix ## entry_t) head;      \
+    map_table_t tbl;                                      \
+    prefix ## entry_t *slots;                             \
   }
 
 DEFINE_MAP_STRUCTS(strmap_t, char *key, strmap_);
 DEFINE_MAP_STRUCTS(digestmap_t, char key[DIGEST_LEN], digestmap_);
 DEFINE_MAP_STRUCTS(digest256map_t, uint8_t key[DIGEST256_LEN], digest256map_);
 
-/** Helper: compare strmap_entry_t objects by key value. */
+/** Helper: return true iff <b>ent</b> has the key <b>key</b>. */
 static inline int
-strmap_entries_eq(const strmap_entry_t *a, const strmap_entry_t *b)
+strmap_key_eq(const strmap_entry_t *ent, const char *key)
 {
-  return !strcmp(a->key, b->key);
+  return !strcmp(ent->key, key);
 }
 
-/** Helper: return a hash value for a strmap_entry_t. */
-static inline unsigned int
-strmap_entry_hash(const strmap_entry_t *a)
+/** Helper: return a hash value for a strmap_t key. */
+static inline uint64_t
+strmap_key_hash(const char *key)
 {
-  return (unsigned) siphash24g(a->key, strlen(a->key));
+  return siphash24g(key, strlen(key));
 }
 
-/** Helper: compare digestmap_entry_t objects by key value. */
+/** Helper: return true iff <b>ent</b> has the key <b>key</b>. */
 static inline int
-digestmap_entries_eq(const digestmap_entry_t *a, const digestmap_entry_t *b)
+digestmap_key_eq(const digestmap_entry_t *ent, const char *key)
 {
-  return tor_memeq(a->key, b->key, DIGEST_LEN);
+  return tor_memeq(ent->key, key, DIGEST_LEN);
 }
 
-/** Helper: return a hash value for a digest_map_t. */
-static inline unsigned int
-digestmap_entry_hash(const digestmap_entry_t *a)
+/** Helper: return a hash value for a digestmap_t key. */
+static inline uint64_t
+digestmap_key_hash(const char *key)
 {
-  return (unsigned) siphash24g(a->key, DIGEST_LEN);
+  return siphash24g(key, DIGEST_LEN);
 }
 
-/** Helper: compare digestmap_entry_t objects by key value. */
+/** Helper: return true iff <b>ent</b> has the key <b>key</b>. */
 static inline int
-digest256map_entries_eq(const digest256map_entry_t *a,
-                        const digest256map_entry_t *b)
+digest256map_key_eq(const digest256map_entry_t *ent, const uint8_t *key)
 {
-  return tor_memeq(a->key, b->key, DIGEST256_LEN);
+  return tor_memeq(ent->key, key, DIGEST256_LEN);
 }
 
-/** Helper: return a hash value for a digest_map_t. */
-static inline unsigned int
-digest256map_entry_hash(const digest256map_entry_t *a)
+/** Helper: return a hash value for a digest256map_t key. */
+static inline uint64_t
+digest256map_key_hash(const uint8_t *key)
 {
-  return (unsigned) siphash24g(a->key, DIGEST256_LEN);
+  return siphash24g(key, DIGEST256_LEN);
 }
 
-HT_PROTOTYPE(strmap_impl, strmap_entry_t, node, strmap_entry_hash,
-             strmap_entries_eq)
-HT_GENERATE2(strmap_impl, strmap_entry_t, node, strmap_entry_hash,
-             strmap_entries_eq, 0.6, tor_reallocarray_, tor_free_)
-
-HT_PROTOTYPE(digestmap_impl, digestmap_entry_t, node, digestmap_entry_hash,
-             digestmap_entries_eq)
-HT_GENERATE2(digestmap_impl, digestmap_entry_t, node, digestmap_entry_hash,
-             digestmap_entries_eq, 0.6, tor_reallocarray_, tor_free_)
-
-HT_PROTOTYPE(digest256map_impl, digest256map_entry_t, node,
-             digest256map_entry_hash,
-             digest256map_entries_eq)
-HT_GENERATE2(digest256map_impl, digest256map_entry_t, node,
-             digest256map_entry_hash,
-             digest256map_entries_eq, 0.6, tor_reallocarray_, tor_free_)
-
 static inline void
-strmap_entry_free(strmap_entry_t *ent)
+strmap_entry_free_key(strmap_entry_t *ent)
 {
   tor_free(ent->key);
-  tor_free(ent);
 }
 static inline void
-digestmap_entry_free(digestmap_entry_t *ent)
+digestmap_entry_free_key(digestmap_entry_t *ent)
 {
-  tor_free(ent);
+  (void)ent;
 }
 static inline void
-digest256map_entry_free(digest256map_entry_t *ent)
+digest256map_entry_free_key(digest256map_entry_t *ent)
 {
-  tor_free(ent);
+  (void)ent;
 }
 
-static inline void
-strmap_assign_tmp_key(strmap_entry_t *ent, const char *key)
-{
-  ent->key = (char*)key;
-}
-static inline void
-digestmap_assign_tmp_key(digestmap_entry_t *ent, const char *key)
-{
-  memcpy(ent->key, key, DIGEST_LEN);
-}
-static inline void
-digest256map_assign_tmp_key(digest256map_entry_t *ent, const uint8_t *key)
-{
-  memcpy(ent->key, key, DIGEST256_LEN);
-}
 static inline void
 strmap_assign_key(strmap_entry_t *ent, const char *key)
 {
@@ -1214,20 +1475,72 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
 /**
  * Macro: implement all the functions for a map that are declared in
  * container.h by the DECLARE_MAP_FNS() macro.  You must additionally define a
- * prefix_entry_free_() function to free entries (and their keys), a
- * prefix_assign_tmp_key() function to temporarily set a stack-allocated
- * entry to hold a key, and a prefix_assign_key() function to set a
- * heap-allocated entry to hold a key.
+ * prefix_key_hash() function to hash a key, a prefix_key_eq() function to
+ * compare an entry's key with a key, a prefix_assign_key() function to set
+ * an entry to hold a copy of a key, and a prefix_entry_free_key() function to
+ * free any storage held by an entry's key.
  */
 #define IMPLEMENT_MAP_FNS(maptype, keytype, prefix)                     \
+  /** Return the entry in <b>map</b> whose key is <b>key</b>, which     \
+   * hashes to <b>hash</b>, or NULL if there is no such entry. */        \
+  static inline prefix##_entry_t *                                      \
+  prefix##_find_entry(const maptype *map, const keytype key,            \
+                      uint64_t hash)                                    \
+  {                                                                     \
+    const map_table_t *t = &map->tbl;                                   \
+    const uint8_t h2 = MAP_H2(hash);                                    \
+    unsigned mask, g, step = 0;                                         \
+    if (PREDICT_UNLIKELY(t->capacity == 0))                             \
+      return NULL;                                                      \
+    mask = t->capacity / MAP_GROUP_WIDTH - 1;                           \
+    g = (unsigned)(MAP_H1(hash) & mask);                                \
+    for (;;) {                                                          \
+      const unsigned base = g * MAP_GROUP_WIDTH;                        \
+      const uint64_t group = map_group_load(t->ctrl + base);            \
+      uint64_t match = map_group_match(group, h2);                      \
+      while (match) {                                                   \
+        prefix##_entry_t *ent =                                         \
+          &map->slots[base + map_match_first(match)];                   \
+        if (prefix##_key_eq(ent, key))                                  \
+          return ent;                                                   \
+        match &= match - 1;                                             \
+      }                                                                 \
+      if (map_group_match_empty(group))                                 \
+        return NULL;                                                    \
+      g = (g + ++step) & mask;                                          \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  /** Move every entry of <b>map</b> into a new table with room for at  \
+   * least one more entry, dropping any deleted slots. */               \
+  static void                                                           \
+  prefix##_rehash(maptype *map)                                         \
+  {                                                                     \
+    map_table_t *t = &map->tbl;                                         \
+    map_table_t old = *t;                                               \
+    prefix##_entry_t *old_slots = map->slots;                           \
+    int i;                                                              \
+    t->capacity = map_table_rehash_capacity(&old);                      \
+    t->ctrl = tor_malloc(t->capacity);                                  \
+    memset(t->ctrl, MAP_CTRL_EMPTY, t->capacity);                       \
+    map->slots = tor_calloc(t->capacity, sizeof(prefix##_entry_t));     \
+    t->growth_left = MAP_MAX_LOAD(t->capacity) - old.size;              \
+    for (i = map_table_next_full(&old, 0); i >= 0;                      \
+         i = map_table_next_full(&old, (unsigned)i + 1)) {              \
+      const uint64_t hash = prefix##_key_hash(old_slots[i].key);        \
+      const unsigned idx = map_table_find_insert_slot(t, hash);         \
+      t->ctrl[idx] = MAP_H2(hash);                                      \
+      map->slots[idx] = old_slots[i];                                   \
+    }                                                                   \
+    tor_free(old.ctrl);                                                 \
+    tor_free(old_slots);                                                \
+  }                                                                     \
+                                                                        \
   /** Create and return a new empty map. */                             \
   MOCK_IMPL(maptype *,                                                  \
   prefix##_new,(void))                                                  \
   {                                                                     \
-    maptype *result;                                                    \
-    result = tor_malloc(sizeof(maptype));                               \
-    HT_INIT(prefix##_impl, &result->head);                              \
-    return result;                                                      \
+    return tor_malloc_zero(sizeof(maptype));                            \
   }                                                                     \
                                                                         \
   /** Return the item from <b>map</b> whose key matches <b>key</b>, or  \
@@ -1235,12 +1548,12 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
   void *                                                                \
   prefix##_get(const maptype *map, const keytype key)                   \
   {                                                                     \
-    prefix ##_entry_t *resolve;                                         \
-    prefix ##_entry_t search;                                           \
+    prefix##_entry_t *resolve;                                          \
     tor_assert(map);                                                    \
     tor_assert(key);                                                    \
-    prefix ##_assign_tmp_key(&search, key);                             \
-    resolve = HT_FIND(prefix ##_impl, &map->head, &search);             \
+    if (map->tbl.size == 0)                                             \
+      return NULL;                                                      \
+    resolve = prefix##_find_entry(map, key, prefix##_key_hash(key));    \
     if (resolve) {                                                      \
       return resolve->val;                                              \
     } else {                                                            \
@@ -1253,36 +1566,37 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
   void *                                                                \
   prefix##_set(maptype *map, const keytype key, void *val)              \
   {                                                                     \
-    prefix##_entry_t search;                                            \
-    void *oldval;                                                       \
+    map_table_t *t;                                                     \
+    prefix##_entry_t *ent;                                              \
+    uint64_t hash;                                                      \
+    unsigned idx;                                                       \
     tor_assert(map);                                                    \
     tor_assert(key);                                                    \
     tor_assert(val);                                                    \
-    prefix##_assign_tmp_key(&search, key);                              \
-    /* We a lot of our time in this function, so the code below is */   \
-    /* meant to optimize the check/alloc/set cycle by avoiding the two */\
-    /* trips to the hash table that we would do in the unoptimized */   \
-    /* version of this code. (Each of HT_INSERT and HT_FIND calls */     \
-    /* HT_SET_HASH and HT_FIND_P.) */                                   \
-    HT_FIND_OR_INSERT_(prefix##_impl, node, prefix##_entry_hash,        \
-                       &(map->head),                                    \
-                       prefix##_entry_t, &search, ptr,                  \
-                       {                                                \
-                         /* we found an entry. */                       \
-                         oldval = (*ptr)->val;                          \
-                         (*ptr)->val = val;                             \
-                         return oldval;                                 \
-                       },                                               \
-                       {                                                \
-                         /* We didn't find the entry. */                \
-                         prefix##_entry_t *newent =                     \
-                           tor_malloc_zero(sizeof(prefix##_entry_t));   \
-                         prefix##_assign_key(newent, key);              \
-                         newent->val = val;                             \
-                         HT_FOI_INSERT_(node, &(map->head),             \
-                            &search, newent, ptr);                      \
-                         return NULL;                                   \
-    });                                                                 \
+    t = &map->tbl;                                                      \
+    hash = prefix##_key_hash(key);                                      \
+    ent = prefix##_find_entry(map, key, hash);                          \
+    if (ent) {                                                          \
+      void *oldval = ent->val;                                          \
+      ent->val = val;                                                   \
+      return oldval;                                                    \
+    }                                                                   \
+    if (t->capacity == 0) {                                             \
+      prefix##_rehash(map);                                             \
+    }                                                                   \
+    idx = map_table_find_insert_slot(t, hash);                          \
+    if (t->ctrl[idx] == MAP_CTRL_EMPTY && t->growth_left == 0) {        \
+      prefix##_rehash(map);                                             \
+      idx = map_table_find_insert_slot(t, hash);                        \
+    }                                                                   \
+    if (t->ctrl[idx] == MAP_CTRL_EMPTY)                                 \
+      --t->growth_left;                                                 \
+    t->ctrl[idx] = MAP_H2(hash);                                        \
+    ++t->size;                                                          \
+    ent = &map->slots[idx];                                             \
+    prefix##_assign_key(ent, key);                                      \
+    ent->val = val;                                                     \
+    return NULL;                                                        \
   }                                                                     \
                                                                         \
   /** Remove the value currently associated with <b>key</b> from the map. \
@@ -1295,15 +1609,16 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
   prefix##_remove(maptype *map, const keytype key)                      \
   {                                                                     \
     prefix##_entry_t *resolve;                                          \
-    prefix##_entry_t search;                                            \
     void *oldval;                                                       \
     tor_assert(map);                                                    \
     tor_assert(key);                                                    \
-    prefix##_assign_tmp_key(&search, key);                              \
-    resolve = HT_REMOVE(prefix##_impl, &map->head, &search);            \
+    if (map->tbl.size == 0)                                             \
+      return NULL;                                                      \
+    resolve = prefix##_find_entry(map, key, prefix##_key_hash(key));    \
     if (resolve) {                                                      \
       oldval = resolve->val;                                            \
-      prefix##_entry_free(resolve);                                     \
+      prefix##_entry_free_key(resolve);                                 \
+      map_table_erase(&map->tbl, (unsigned)(resolve - map->slots));     \
       return oldval;                                                    \
     } else {                                                            \
       return NULL;                                                      \
@@ -1314,21 +1629,42 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
   int                                                                   \
   prefix##_size(const maptype *map)                                     \
   {                                                                     \
-    return HT_SIZE(&map->head);                                         \
+    return (int)map->tbl.size;                                          \
   }                                                                     \
                                                                         \
   /** Return true iff <b>map</b> has no entries. */                     \
   int                                                                   \
   prefix##_isempty(const maptype *map)                                  \
   {                                                                     \
-    return HT_EMPTY(&map->head);                                        \
+    return map->tbl.size == 0;                                          \
   }                                                                     \
                                                                         \
   /** Assert that <b>map</b> is not corrupt. */                         \
   void                                                                  \
   prefix##_assert_ok(const maptype *map)                                \
   {                                                                     \
-    tor_assert(!prefix##_impl_HT_REP_IS_BAD_(&map->head));              \
+    const map_table_t *t = &map->tbl;                                   \
+    unsigned n_full = 0, n_empty = 0;                                   \
+    int i;                                                              \
+    tor_assert((t->capacity & (t->capacity - 1)) == 0);                 \
+    tor_assert(t->capacity % MAP_GROUP_WIDTH == 0);                     \
+    for (i = 0; i < (int)t->capacity; ++i) {                            \
+      if (t->ctrl[i] == MAP_CTRL_EMPTY)                                 \
+        ++n_empty;                                                      \
+      else                                                              \
+        tor_assert(t->ctrl[i] == MAP_CTRL_DELETED || t->ctrl[i] < 0x80); \
+    }                                                                   \
+    for (i = map_table_next_full(t, 0); i >= 0;                         \
+         i = map_table_next_full(t, (unsigned)i + 1)) {                 \
+      const uint64_t hash = prefix##_key_hash(map->slots[i].key);       \
+      tor_assert(t->ctrl[i] == MAP_H2(hash));                           \
+      tor_assert(prefix##_find_entry(map, map->slots[i].key, hash) ==   \
+                 &map->slots[i]);                                       \
+      ++n_full;                                                         \
+    }                                                                   \
+    tor_assert(n_full == t->size);                                      \
+    tor_assert(t->capacity == 0 || n_empty >= t->capacity / 8);         \
+    tor_assert(t->growth_left <= n_empty);                              \
   }                                                                     \
                                                                         \
   /** Remove all entries from <b>map</b>, and deallocate storage for    \
@@ -1337,19 +1673,17 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
   MOCK_IMPL(void,                                                       \
   prefix##_free, (maptype *map, void (*free_val)(void*)))               \
   {                                                                     \
-    prefix##_entry_t **ent, **next, *this;                              \
+    int i;                                                              \
     if (!map)                                                           \
       return;                                                           \
-    for (ent = HT_START(prefix##_impl, &map->head); ent != NULL;        \
-         ent = next) {                                                  \
-      this = *ent;                                                      \
-      next = HT_NEXT_RMV(prefix##_impl, &map->head, ent);               \
+    for (i = map_table_next_full(&map->tbl, 0); i >= 0;                 \
+         i = map_table_next_full(&map->tbl, (unsigned)i + 1)) {         \
       if (free_val)                                                     \
-        free_val(this->val);                                            \
-      prefix##_entry_free(this);                                        \
+        free_val(map->slots[i].val);                                    \
+      prefix##_entry_free_key(&map->slots[i]);                          \
     }                                                                   \
-    tor_assert(HT_EMPTY(&map->head));                                   \
-    HT_CLEAR(prefix##_impl, &map->head);                                \
+    tor_free(map->tbl.ctrl);                                            \
+    tor_free(map->slots);                                               \
     tor_free(map);                                                      \
   }                                                                     \
                                                                         \
@@ -1377,8 +1711,10 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
   prefix##_iter_t *                                                     \
   prefix##_iter_init(maptype *map)                                      \
   {                                                                     \
+    int i;                                                              \
     tor_assert(map);                                                    \
-    return HT_START(prefix##_impl, &map->head);                         \
+    i = map_table_next_full(&map->tbl, 0);                              \
+    return i < 0 ? NULL : &map->slots[i];                               \
   }                                                                     \
                                                                         \
   /** Advance <b>iter</b> a single step to the next entry, and return   \
@@ -1386,23 +1722,29 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
   prefix##_iter_t *                                                     \
   prefix##_iter_next(maptype *map, prefix##_iter_t *iter)               \
   {                                                                     \
+    int i;                                                              \
     tor_assert(map);                                                    \
     tor_assert(iter);                                                   \
-    return HT_NEXT(prefix##_impl, &map->head, iter);                    \
+    i = map_table_next_full(&map->tbl,                                  \
+                            (unsigned)(iter - map->slots) + 1);         \
+    return i < 0 ? NULL : &map->slots[i];                               \
   }                                                                     \
   /** Advance <b>iter</b> a single step to the next entry, removing the \
    * current entry, and return its new value. */                        \
   prefix##_iter_t *                                                     \
   prefix##_iter_next_rmv(maptype *map, prefix##_iter_t *iter)           \
   {                                                                     \
-    prefix##_entry_t *rmv;                                              \
+    unsigned idx;                                                       \
+    int i;                                                              \
     tor_assert(map);                                                    \
     tor_assert(iter);                                                   \
-    tor_assert(*iter);                                                  \
-    rmv = *iter;                                                        \
-    iter = HT_NEXT_RMV(prefix##_impl, &map->head, iter);                \
-    prefix##_entry_free(rmv);                                           \
-    return iter;                                                        \
+    idx = (unsigned)(iter - map->slots);                                \
+    tor_assert(idx < map->tbl.capacity);                                \
+    tor_assert(map->tbl.ctrl[idx] < 0x80);                              \
+    prefix##_entry_free_key(iter);                                      \
+    map_table_erase(&map->tbl, idx);                                    \
+    i = map_table_next_full(&map->tbl, idx + 1);                        \
+    return i < 0 ? NULL : &map->slots[i];                               \
   }                                                                     \
   /** Set *<b>keyp</b> and *<b>valp</b> to the current entry pointed    \
    * to by iter. */                                                     \
@@ -1411,11 +1753,10 @@ digest256map_assign_key(digest256map_entry_t *ent, const uint8_t *key)
                     void **valp)                                        \
   {                                                                     \
     tor_assert(iter);                                                   \
-    tor_assert(*iter);                                                  \
     tor_assert(keyp);                                                   \
     tor_assert(valp);                                                   \
-    *keyp = (*iter)->key;                                               \
-    *valp = (*iter)->val;                                               \
+    *keyp = iter->key;                                                  \
+    *valp = iter->val;                                                  \
   }                                                                     \
   /** Return true iff <b>iter</b> has advanced past the last entry of   \
    * <b>map</b>. */                                                     \
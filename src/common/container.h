@@ -345,7 +345,7 @@ char *smartlist_join_strings2(smartlist_t *sl, const char *join,
 
 #define DECLARE_MAP_FNS(maptype, keytype, prefix)                       \
   typedef struct maptype maptype;                                       \
-  typedef struct prefix##entry_t *prefix##iter_t;                       \
+  typedef struct prefix##entry_t prefix##iter_t;                        \
   MOCK_DECL(maptype*, prefix##new, (void));                             \
   void* prefix##set(maptype *map, keytype key, void *val);              \
   void* prefix##get(const maptype *map, keytype key);                   \
@@ -360,12 +360,14 @@ char *smartlist_join_strings2(smartlist_t *sl, const char *join,
   int prefix##iter_done(prefix##iter_t *iter);                          \
   void prefix##assert_ok(const maptype *map)
 
-/* Map from const char * to void *. Implemented with a hash table. */
+/* Map from const char * to void *. Implemented with an open-addressing hash
+ * table. */
 DECLARE_MAP_FNS(strmap_t, const char *, strmap_);
-/* Map from const char[DIGEST_LEN] to void *. Implemented with a hash table. */
+/* Map from const char[DIGEST_LEN] to void *. Implemented with an
+ * open-addressing hash table. */
 DECLARE_MAP_FNS(digestmap_t, const char *, digestmap_);
-/* Map from const uint8_t[DIGEST256_LEN] to void *. Implemented with a hash
- * table. */
+/* Map from const uint8_t[DIGEST256_LEN] to void *. Implemented with an
+ * open-addressing hash table. */
 DECLARE_MAP_FNS(digest256map_t, const uint8_t *, digest256map_);
 
 #undef DECLARE_MAP_FNS
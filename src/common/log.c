@@ -30,6 +30,9 @@
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 #include "compat.h"
 #include "util.h"
 #define LOG_PRIVATE
@@ -61,6 +64,18 @@ typedef struct logfile_t {
   log_callback callback; /**< If not NULL, send messages to this function. */
   log_severity_list_t *severities; /**< Which severity of messages should we
                                     * log for each log domain? */
+  /** Number of messages for this log that didn't fit in the asynchronous
+   * log buffer and haven't been reported yet.  Protected by
+   * log_async_lock. */
+  uint64_t n_async_dropped;
+  /** Copy of fd that the asynchronous log writer writes to, so that it never
+   * looks at fd itself; or -1 if we haven't made one.  Protected by
+   * log_async_lock. */
+  int async_fd;
+  /** Boolean: true if the asynchronous log writer failed to write to
+   * async_fd.  We set seems_dead when we notice.  Protected by
+   * log_async_lock. */
+  int async_failed;
 } logfile_t;
 
 static void log_free(logfile_t *victim);
@@ -149,6 +164,10 @@ static int pretty_fn_has_parens = 0;
  * logs to get configured. */
 #define MAX_STARTUP_MSG_LEN (1<<16)
 
+/** True iff we hand messages for fd logs to the asynchronous log writer
+ * thread rather than writing them ourselves.  Protected by log_mutex. */
+static int log_async_running = 0;
+
 /** Lock the log_mutex to prevent others from changing the logfile_t list */
 #define LOCK_LOGS() STMT_BEGIN                                          \
   tor_assert(log_mutex_initialized);                                    \
@@ -166,6 +185,10 @@ int log_global_min_severity_ = LOG_NOTICE;
 
 static void delete_log(logfile_t *victim);
 static void close_log(logfile_t *victim);
+static int log_async_deliver(logfile_t *lf, const char *buf, size_t msg_len);
+static void log_async_drain(void);
+static void log_async_forget(logfile_t *lf);
+static void log_async_stop(void);
 
 static char *domain_to_string(log_domain_mask_t domain,
                              char *buf, size_t buflen);
@@ -460,6 +483,13 @@ logfile_deliver(logfile_t *lf, const char *buf, size_t msg_len,
       lf->callback(severity, domain, msg_after_prefix);
     }
   } else {
+    if (log_async_running) {
+      /* Error messages are written before we return, as are messages too
+       * big for the buffer; either way, after everything queued so far. */
+      if (severity != LOG_ERR && log_async_deliver(lf, buf, msg_len) == 0)
+        return;
+      log_async_drain();
+    }
     if (write_all(lf->fd, buf, msg_len, 0) < 0) { /* error */
       /* don't log the error! mark this log entry to be blown away, and
        * continue. */
@@ -725,6 +755,8 @@ log_free(logfile_t *victim)
 {
   if (!victim)
     return;
+  /* The writer thread may still hold messages for this log. */
+  log_async_forget(victim);
   tor_free(victim->severities);
   tor_free(victim->filename);
   tor_free(victim);
@@ -737,6 +769,7 @@ logs_free_all(void)
   logfile_t *victim, *next;
   smartlist_t *messages, *messages2;
   LOCK_LOGS();
+  log_async_stop();
   next = logfiles;
   logfiles = NULL;
   messages = pending_cb_messages;
@@ -798,6 +831,7 @@ delete_log(logfile_t *victim)
 static void
 close_log(logfile_t *victim)
 {
+  log_async_forget(victim);
   if (victim->needs_close && victim->fd >= 0) {
     close(victim->fd);
     victim->fd = -1;
@@ -837,6 +871,7 @@ add_stream_log_impl(const log_severity_list_t *severity,
   logfile_t *lf;
   lf = tor_malloc_zero(sizeof(logfile_t));
   lf->fd = fd;
+  lf->async_fd = -1;
   lf->filename = tor_strdup(name);
   lf->severities = tor_memdup(severity, sizeof(log_severity_list_t));
   lf->next = logfiles;
@@ -913,6 +948,7 @@ add_callback_log(const log_severity_list_t *severity, log_callback cb)
   logfile_t *lf;
   lf = tor_malloc_zero(sizeof(logfile_t));
   lf->fd = -1;
+  lf->async_fd = -1;
   lf->severities = tor_memdup(severity, sizeof(log_severity_list_t));
   lf->filename = tor_strdup("<callback>");
   lf->callback = cb;
@@ -1133,6 +1169,7 @@ add_syslog_log(const log_severity_list_t *severity,
 
   lf = tor_malloc_zero(sizeof(logfile_t));
   lf->fd = -1;
+  lf->async_fd = -1;
   lf->severities = tor_memdup(severity, sizeof(log_severity_list_t));
   lf->filename = tor_strdup("<syslog>");
   lf->is_syslog = 1;
@@ -1384,6 +1421,7 @@ void
 truncate_logs(void)
 {
   logfile_t *lf;
+  log_async_drain();
   for (lf = logfiles; lf; lf = lf->next) {
     if (lf->fd >= 0) {
       tor_ftruncate(lf->fd);
@@ -1391,3 +1429,442 @@ truncate_logs(void)
   }
 }
 
+
+/*
+ * Asynchronous logging.
+ *
+ * When it's enabled, messages for fd logs are copied into a bounded ring
+ * buffer instead of being written by the thread that logged them, and a
+ * dedicated writer thread drains the buffer, batching consecutive messages
+ * for the same log into a single writev() call.  Syslog and callback logs
+ * are unaffected.  Producers already serialize on log_mutex, so the ring has
+ * a single producer at a time; it gets its own lock so that the writer
+ * never has to wait for log_mutex while it's writing.
+ */
+
+/** Size of the header we put in front of each message in a log_ring_t.  All
+ * record sizes are multiples of this, as is the ring capacity, so that there
+ * is always room for a padding header at the end of the buffer. */
+#define LOG_RING_HDR_LEN (sizeof(log_ring_rec_t))
+/** Space that a record holding a <b>len</b>-byte message uses in a ring. */
+#define LOG_RING_REC_LEN(len) \
+  (LOG_RING_HDR_LEN + \
+   (((len) + LOG_RING_HDR_LEN - 1) / LOG_RING_HDR_LEN) * LOG_RING_HDR_LEN)
+
+/** Header of a single record in a log_ring_t. */
+typedef struct log_ring_rec_t {
+  /** Log this message is for, or NULL if this record only pads out the end
+   * of the buffer. */
+  void *target;
+  /** Number of message bytes following this header. */
+  size_t len;
+} log_ring_rec_t;
+
+/** Return true iff a <b>len</b>-byte message can ever fit in <b>ring</b>. */
+STATIC int
+log_ring_can_fit(const log_ring_t *ring, size_t len)
+{
+  return len <= ring->cap && LOG_RING_REC_LEN(len) <= ring->cap;
+}
+
+/** Allocate the buffer for <b>ring</b>, using at most <b>size</b> bytes. */
+STATIC void
+log_ring_init(log_ring_t *ring, size_t size)
+{
+  memset(ring, 0, sizeof(*ring));
+  ring->cap = (size / LOG_RING_HDR_LEN) * LOG_RING_HDR_LEN;
+  ring->buf = tor_malloc(ring->cap);
+}
+
+/** Release the storage held by <b>ring</b>. */
+STATIC void
+log_ring_clear(log_ring_t *ring)
+{
+  tor_free(ring->buf);
+  memset(ring, 0, sizeof(*ring));
+}
+
+/** Append the <b>len</b>-byte message <b>msg</b> for <b>target</b> to
+ * <b>ring</b>.  Return 0 on success, or -1 if there is not enough free
+ * space. */
+STATIC int
+log_ring_push(log_ring_t *ring, void *target, const char *msg, size_t len)
+{
+  log_ring_rec_t rec;
+  size_t need, to_end, pad;
+
+  raw_assert(target);
+  if (!log_ring_can_fit(ring, len))
+    return -1;
+  need = LOG_RING_REC_LEN(len);
+
+  if (ring->used == 0)
+    ring->head = ring->tail = 0;
+  /* If the record doesn't fit before the end of the buffer, pad the end out
+   * and put it at the start.  When the free space is already split this
+   * way, the check below fails on its own. */
+  to_end = ring->cap - ring->head;
+  pad = need > to_end ? to_end : 0;
+  if (ring->used + pad + need > ring->cap)
+    return -1;
+
+  if (pad) {
+    rec.target = NULL;
+    rec.len = pad - LOG_RING_HDR_LEN;
+    memcpy(ring->buf + ring->head, &rec, LOG_RING_HDR_LEN);
+    ring->used += pad;
+    ring->head = 0;
+  }
+  rec.target = target;
+  rec.len = len;
+  memcpy(ring->buf + ring->head, &rec, LOG_RING_HDR_LEN);
+  memcpy(ring->buf + ring->head + LOG_RING_HDR_LEN, msg, len);
+  ring->used += need;
+  ring->head += need;
+  if (ring->head == ring->cap)
+    ring->head = 0;
+  return 0;
+}
+
+/** Look at the oldest messages in <b>ring</b> without removing them: set
+ * *<b>target_out</b> to the log the oldest one is for, and fill
+ * <b>chunks</b> with up to <b>max_chunks</b> consecutive messages for that
+ * log, setting *<b>n_chunks_out</b> to their number.  Return the number of
+ * bytes to pass to log_ring_consume() once they have been handled; this
+ * may be nonzero with no messages if it only covers padding. */
+STATIC size_t
+log_ring_peek(const log_ring_t *ring, void **target_out,
+              log_ring_chunk_t *chunks, int max_chunks, int *n_chunks_out)
+{
+  size_t pos = ring->tail, consumed = 0;
+  int n = 0;
+
+  *target_out = NULL;
+  while (consumed < ring->used && n < max_chunks) {
+    log_ring_rec_t rec;
+    size_t rec_len;
+    memcpy(&rec, ring->buf + pos, LOG_RING_HDR_LEN);
+    if (rec.target == NULL) {
+      consumed += ring->cap - pos;
+      pos = 0;
+      continue;
+    }
+    if (*target_out == NULL)
+      *target_out = rec.target;
+    else if (rec.target != *target_out)
+      break;
+    chunks[n].data = ring->buf + pos + LOG_RING_HDR_LEN;
+    chunks[n].len = rec.len;
+    ++n;
+    rec_len = LOG_RING_REC_LEN(rec.len);
+    consumed += rec_len;
+    pos += rec_len;
+    if (pos == ring->cap)
+      pos = 0;
+  }
+  *n_chunks_out = n;
+  return consumed;
+}
+
+/** Remove the first <b>n_bytes</b> bytes of records, as returned by
+ * log_ring_peek(), from <b>ring</b>. */
+STATIC void
+log_ring_consume(log_ring_t *ring, size_t n_bytes)
+{
+  raw_assert(n_bytes <= ring->used);
+  ring->tail = (ring->tail + n_bytes) % ring->cap;
+  ring->used -= n_bytes;
+}
+
+/** Largest number of messages that the writer thread hands to a single
+ * writev() call. */
+#define LOG_ASYNC_MAX_BATCH 64
+
+/** Lock protecting the asynchronous log state below, and the
+ * n_async_dropped fields of logfile_t.  When both are needed, log_mutex is
+ * taken first. */
+static tor_mutex_t log_async_lock;
+/** True iff we have initialized log_async_lock and its conditions. */
+static int log_async_lock_initialized = 0;
+/** Signaled when there are new messages for the writer thread, or it should
+ * exit. */
+static tor_cond_t log_async_wakeup;
+/** Signaled when the writer thread has removed messages from the ring or
+ * exited. */
+static tor_cond_t log_async_progress;
+/** Messages waiting for the writer thread. */
+static log_ring_t log_async_ring;
+/** What to do with a message when log_async_ring is full. */
+static log_async_overflow_t log_async_on_overflow = LOG_ASYNC_OVERFLOW_DROP;
+/** True iff the writer thread is running. */
+static int log_async_writer_alive = 0;
+/** True iff the writer thread should exit once the ring is empty. */
+static int log_async_stopping = 0;
+/** Total number of messages dropped because the ring was full. */
+static uint64_t log_async_n_dropped = 0;
+
+/** Write the <b>n</b> buffers in <b>chunks</b> to <b>fd</b>, in order,
+ * retrying after short writes.  Return 0 on success, -1 on error. */
+static int
+log_write_chunks(int fd, log_ring_chunk_t *chunks, int n)
+{
+#ifdef HAVE_WRITEV
+  struct iovec iov[LOG_ASYNC_MAX_BATCH + 1];
+  struct iovec *v = iov;
+  int i;
+
+  raw_assert(n <= LOG_ASYNC_MAX_BATCH + 1);
+  for (i = 0; i < n; ++i) {
+    iov[i].iov_base = (void *) chunks[i].data;
+    iov[i].iov_len = chunks[i].len;
+  }
+  while (n > 0) {
+    ssize_t r = writev(fd, v, n);
+    size_t written;
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    written = (size_t) r;
+    while (n > 0 && written >= v->iov_len) {
+      written -= v->iov_len;
+      ++v;
+      --n;
+    }
+    if (n > 0) {
+      v->iov_base = (char *) v->iov_base + written;
+      v->iov_len -= written;
+    }
+  }
+  return 0;
+#else /* !(defined(HAVE_WRITEV)) */
+  int i;
+  for (i = 0; i < n; ++i) {
+    if (write_all(fd, chunks[i].data, chunks[i].len, 0) < 0)
+      return -1;
+  }
+  return 0;
+#endif /* defined(HAVE_WRITEV) */
+}
+
+/** Main function for the asynchronous log writer thread.  This thread must
+ * never log anything itself. */
+static void
+log_async_writer_main(void *arg)
+{
+  log_ring_chunk_t chunks[LOG_ASYNC_MAX_BATCH + 1];
+  char dropped_msg[128];
+  (void) arg;
+
+  tor_mutex_acquire(&log_async_lock);
+  while (1) {
+    logfile_t *lf;
+    void *target;
+    size_t n_bytes;
+    int n_chunks, fd, r = 0;
+
+    while (log_async_ring.used == 0 && !log_async_stopping)
+      tor_cond_wait(&log_async_wakeup, &log_async_lock, NULL);
+    if (log_async_ring.used == 0)
+      break;
+
+    n_bytes = log_ring_peek(&log_async_ring, &target, chunks,
+                            LOG_ASYNC_MAX_BATCH, &n_chunks);
+    lf = target;
+    if (lf && lf->n_async_dropped) {
+      tor_snprintf(dropped_msg, sizeof(dropped_msg),
+                   "[" U64_FORMAT " log messages dropped: asynchronous "
+                   "log buffer was full]\n",
+                   U64_PRINTF_ARG(lf->n_async_dropped));
+      lf->n_async_dropped = 0;
+      chunks[n_chunks].data = dropped_msg;
+      chunks[n_chunks].len = strlen(dropped_msg);
+      ++n_chunks;
+    }
+    /* The logfile_t and its async_fd can't go away while it has messages
+     * in the ring: see log_async_forget(). */
+    fd = (lf && !lf->async_failed) ? lf->async_fd : -1;
+    tor_mutex_release(&log_async_lock);
+
+    if (fd >= 0 && n_chunks)
+      r = log_write_chunks(fd, chunks, n_chunks);
+
+    tor_mutex_acquire(&log_async_lock);
+    if (r < 0) {
+      /* As in logfile_deliver(), don't log the error: log_async_deliver()
+       * will mark the log as dead. */
+      lf->async_failed = 1;
+    }
+    log_ring_consume(&log_async_ring, n_bytes);
+    tor_cond_signal_all(&log_async_progress);
+  }
+  log_async_writer_alive = 0;
+  tor_cond_signal_all(&log_async_progress);
+  tor_mutex_release(&log_async_lock);
+  spawn_exit();
+}
+
+/** Hand the <b>msg_len</b>-byte message in <b>buf</b> for <b>lf</b> to the
+ * writer thread.  Return 0 if it was queued or dropped, and -1 if it's too
+ * big for the buffer, or we couldn't give the writer thread its own copy of
+ * <b>lf</b>'s fd, and the caller should write it itself.  Requires
+ * log_mutex. */
+static int
+log_async_deliver(logfile_t *lf, const char *buf, size_t msg_len)
+{
+  int r;
+
+  tor_mutex_acquire(&log_async_lock);
+  if (lf->async_failed) {
+    /* The writer thread couldn't write to this log: give up on it, as
+     * logfile_deliver() does. */
+    lf->seems_dead = 1;
+    tor_mutex_release(&log_async_lock);
+    return 0;
+  }
+  if (!log_ring_can_fit(&log_async_ring, msg_len)) {
+    tor_mutex_release(&log_async_lock);
+    return -1;
+  }
+  if (lf->async_fd < 0 && (lf->async_fd = dup(lf->fd)) < 0) {
+    tor_mutex_release(&log_async_lock);
+    return -1;
+  }
+  while ((r = log_ring_push(&log_async_ring, lf, buf, msg_len)) < 0 &&
+         log_async_on_overflow == LOG_ASYNC_OVERFLOW_BLOCK &&
+         log_async_writer_alive) {
+    tor_cond_wait(&log_async_progress, &log_async_lock, NULL);
+  }
+  if (r < 0) {
+    ++lf->n_async_dropped;
+    ++log_async_n_dropped;
+  } else {
+    tor_cond_signal_one(&log_async_wakeup);
+  }
+  tor_mutex_release(&log_async_lock);
+  return 0;
+}
+
+/** Wait until the writer thread, if any, has written every message queued
+ * so far. */
+static void
+log_async_drain(void)
+{
+  if (!log_async_lock_initialized)
+    return;
+  tor_mutex_acquire(&log_async_lock);
+  while (log_async_ring.used > 0 && log_async_writer_alive) {
+    tor_cond_signal_one(&log_async_wakeup);
+    tor_cond_wait(&log_async_progress, &log_async_lock, NULL);
+  }
+  tor_mutex_release(&log_async_lock);
+}
+
+/** Wait until the writer thread, if any, has written every message queued
+ * so far, and close its copy of <b>lf</b>'s fd.  Call this before closing
+ * or freeing <b>lf</b>, once no more messages can be queued for it. */
+static void
+log_async_forget(logfile_t *lf)
+{
+  if (!log_async_lock_initialized)
+    return;
+  tor_mutex_acquire(&log_async_lock);
+  while (log_async_ring.used > 0 && log_async_writer_alive) {
+    tor_cond_signal_one(&log_async_wakeup);
+    tor_cond_wait(&log_async_progress, &log_async_lock, NULL);
+  }
+  if (lf->async_fd >= 0) {
+    close(lf->async_fd);
+    lf->async_fd = -1;
+  }
+  tor_mutex_release(&log_async_lock);
+}
+
+/** Write every queued message, stop the writer thread, and go back to
+ * writing messages synchronously.  Requires log_mutex. */
+static void
+log_async_stop(void)
+{
+  if (!log_async_running)
+    return;
+  log_async_running = 0;
+
+  tor_mutex_acquire(&log_async_lock);
+  log_async_stopping = 1;
+  tor_cond_signal_one(&log_async_wakeup);
+  while (log_async_writer_alive)
+    tor_cond_wait(&log_async_progress, &log_async_lock, NULL);
+  log_ring_clear(&log_async_ring);
+  tor_mutex_release(&log_async_lock);
+}
+
+/** Configure asynchronous logging.  If <b>enabled</b>, start a thread that
+ * writes messages for fd logs from a buffer of <b>buffer_size</b> bytes,
+ * with <b>on_overflow</b> telling what to do with messages that don't fit
+ * while it is full.  Otherwise, write everything queued and go back to
+ * writing messages as they are logged.
+ *
+ * Don't enable this before forking into the background: the thread does
+ * not survive fork().  Return 0 on success, -1 on failure.
+ */
+int
+logs_set_async(int enabled, size_t buffer_size,
+               log_async_overflow_t on_overflow)
+{
+  int r = 0;
+
+  raw_assert(log_mutex_initialized);
+  LOCK_LOGS();
+  if (!log_async_lock_initialized) {
+    tor_mutex_init_nonrecursive(&log_async_lock);
+    tor_cond_init(&log_async_wakeup);
+    tor_cond_init(&log_async_progress);
+    log_async_lock_initialized = 1;
+  }
+
+  if (log_async_running &&
+      (!enabled || (buffer_size / LOG_RING_HDR_LEN) * LOG_RING_HDR_LEN !=
+                    log_async_ring.cap)) {
+    log_async_stop();
+  }
+
+  tor_mutex_acquire(&log_async_lock);
+  log_async_on_overflow = on_overflow;
+  /* Wake up anybody waiting for room that shouldn't wait anymore. */
+  tor_cond_signal_all(&log_async_progress);
+  tor_mutex_release(&log_async_lock);
+
+  if (enabled && !log_async_running) {
+    tor_mutex_acquire(&log_async_lock);
+    log_ring_init(&log_async_ring, buffer_size);
+    log_async_stopping = 0;
+    log_async_writer_alive = 1;
+    tor_mutex_release(&log_async_lock);
+    if (spawn_func(log_async_writer_main, NULL) < 0) {
+      tor_mutex_acquire(&log_async_lock);
+      log_async_writer_alive = 0;
+      log_ring_clear(&log_async_ring);
+      tor_mutex_release(&log_async_lock);
+      r = -1;
+    } else {
+      log_async_running = 1;
+    }
+  }
+  UNLOCK_LOGS();
+  return r;
+}
+
+/** Return the number of log messages dropped so far because the
+ * asynchronous log buffer was full. */
+uint64_t
+logs_get_n_async_dropped(void)
+{
+  uint64_t n;
+  if (!log_async_lock_initialized)
+    return 0;
+  tor_mutex_acquire(&log_async_lock);
+  n = log_async_n_dropped;
+  tor_mutex_release(&log_async_lock);
+  return n;
+}
@@ -0,0 +1,457 @@
+/* Copyright (c) 2008-2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file objpool.c
+ * \brief Implementation for objpool_t, a slab allocator for fixed-size
+ * objects that are allocated and freed in large numbers.
+ *
+ * A pool hands out objects of a single size, carved from chunks that each
+ * hold many of them.  Objects of the same type therefore sit next to each
+ * other in memory, and allocating or freeing one never touches the system
+ * allocator unless a chunk has to be created.  Chunks whose objects have all
+ * been freed stay cached in the pool until objpool_trim() or
+ * objpool_trim_all() hands them back, so that the caller decides how much
+ * idle memory to keep around.
+ *
+ * Pools are not thread-safe; use each pool from one thread only.
+ */
+
+#include "orconfig.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "objpool.h"
+#include "util.h"
+#include "compat.h"
+#include "torlog.h"
+#include "container.h"
+
+/** Every object we hand out is aligned to a multiple of this value, which
+ * is at least as strict as anything the system allocator promises for
+ * objects of this size. */
+#define OBJPOOL_ALIGN 16
+
+/** Round <b>n</b> up to the nearest multiple of OBJPOOL_ALIGN. */
+#define OBJPOOL_ROUND_UP(n) \
+  (((n) + OBJPOOL_ALIGN - 1) & ~((size_t)OBJPOOL_ALIGN - 1))
+
+/** If the caller doesn't say how many objects go in a chunk, aim for chunks
+ * of about this many bytes. */
+#define OBJPOOL_DEFAULT_CHUNK_BYTES (32*1024)
+/** Never put fewer than this many objects in a chunk. */
+#define OBJPOOL_MIN_ITEMS_PER_CHUNK 8
+
+struct objpool_chunk_t;
+
+/** Header placed in front of every object a pool hands out. */
+typedef struct objpool_item_hdr_t {
+  /** The chunk that this object came from, or NULL if the object is not
+   * currently allocated. */
+  struct objpool_chunk_t *chunk;
+} objpool_item_hdr_t;
+
+/** Space reserved for an objpool_item_hdr_t in front of each object. */
+#define OBJPOOL_HDR_LEN OBJPOOL_ROUND_UP(sizeof(objpool_item_hdr_t))
+
+/** A contiguous block of memory holding a fixed number of pool objects. */
+typedef struct objpool_chunk_t {
+  /** Next chunk in whichever of the pool's lists this chunk is on. */
+  struct objpool_chunk_t *next;
+  /** Previous chunk in whichever of the pool's lists this chunk is on. */
+  struct objpool_chunk_t *prev;
+  /** The pool that owns this chunk. */
+  objpool_t *pool;
+  /** Most recently freed object in this chunk, or NULL.  Each free object
+   * stores a pointer to the next free object in its first bytes. */
+  void *first_free;
+  /** Number of objects in this chunk that are currently handed out. */
+  int n_allocated;
+  /** Number of objects at the start of mem that have been handed out at
+   * least once since the chunk was last empty.  Objects past this point
+   * are free, but not on first_free. */
+  int n_carved;
+} objpool_chunk_t;
+
+/** Offset from the start of a chunk to its first object. */
+#define OBJPOOL_CHUNK_HDR_LEN OBJPOOL_ROUND_UP(sizeof(objpool_chunk_t))
+
+/** Return a pointer to the <b>idx</b>th object slot (header included) of
+ * <b>chunk</b>. */
+#define CHUNK_SLOT(pool, chunk, idx)                         \
+  ((char*)(chunk) + OBJPOOL_CHUNK_HDR_LEN + (idx)*(pool)->item_stride)
+
+/** A pool of fixed-size objects. */
+struct objpool_t {
+  /** Name of this pool, for statistics. */
+  char *name;
+  /** Size of the objects that the caller asked for. */
+  size_t item_size;
+  /** Distance between consecutive objects in a chunk, header included. */
+  size_t item_stride;
+  /** Number of objects that fit in each chunk. */
+  int items_per_chunk;
+  /** Number of bytes we allocate for each chunk. */
+  size_t chunk_alloc_size;
+
+  /** Chunks with no objects handed out. */
+  objpool_chunk_t *empty_chunks;
+  /** Chunks with some, but not all, objects handed out.  We allocate from
+   * the head of this list first. */
+  objpool_chunk_t *used_chunks;
+  /** Chunks with every object handed out. */
+  objpool_chunk_t *full_chunks;
+
+  /** Total number of chunks on all three lists. */
+  size_t n_chunks;
+  /** Number of chunks on empty_chunks. */
+  size_t n_empty_chunks;
+  /** Number of objects currently handed out. */
+  size_t n_items_in_use;
+  /** Number of objects ever handed out. */
+  uint64_t n_allocs_total;
+  /** Number of chunks ever released to the system allocator. */
+  uint64_t n_chunks_released_total;
+};
+
+/** List of every objpool_t that has been created and not destroyed. */
+static smartlist_t *all_pools = NULL;
+
+/** Remove <b>chunk</b> from the doubly-linked list at *<b>head</b>. */
+static void
+chunk_unlink(objpool_chunk_t **head, objpool_chunk_t *chunk)
+{
+  if (chunk->prev)
+    chunk->prev->next = chunk->next;
+  else
+    *head = chunk->next;
+  if (chunk->next)
+    chunk->next->prev = chunk->prev;
+  chunk->next = chunk->prev = NULL;
+}
+
+/** Add <b>chunk</b> to the front of the doubly-linked list at
+ * *<b>head</b>. */
+static void
+chunk_push(objpool_chunk_t **head, objpool_chunk_t *chunk)
+{
+  chunk->prev = NULL;
+  chunk->next = *head;
+  if (*head)
+    (*head)->prev = chunk;
+  *head = chunk;
+}
+
+/** Release every chunk on the list starting at <b>chunk</b>. */
+static void
+chunk_list_free(objpool_chunk_t *chunk)
+{
+  while (chunk) {
+    objpool_chunk_t *next = chunk->next;
+    tor_free(chunk);
+    chunk = next;
+  }
+}
+
+/** Create and return a new pool handing out objects of <b>item_size</b>
+ * bytes, named <b>name</b> in statistics.  Chunks hold
+ * <b>items_per_chunk</b> objects each; if that is 0, pick a size that
+ * keeps chunks around OBJPOOL_DEFAULT_CHUNK_BYTES. */
+objpool_t *
+objpool_new(const char *name, size_t item_size, size_t items_per_chunk)
+{
+  objpool_t *pool;
+  tor_assert(name);
+  tor_assert(item_size > 0);
+  tor_assert(item_size < SIZE_MAX / 2);
+
+  /* Free objects keep a list pointer in their first bytes. */
+  if (item_size < sizeof(void*))
+    item_size = sizeof(void*);
+
+  pool = tor_malloc_zero(sizeof(objpool_t));
+  pool->name = tor_strdup(name);
+  pool->item_size = item_size;
+  pool->item_stride = OBJPOOL_HDR_LEN + OBJPOOL_ROUND_UP(item_size);
+  if (items_per_chunk == 0)
+    items_per_chunk = OBJPOOL_DEFAULT_CHUNK_BYTES / pool->item_stride;
+  if (items_per_chunk < OBJPOOL_MIN_ITEMS_PER_CHUNK)
+    items_per_chunk = OBJPOOL_MIN_ITEMS_PER_CHUNK;
+  tor_assert(items_per_chunk < INT_MAX);
+  tor_assert(items_per_chunk <
+             (SIZE_MAX - OBJPOOL_CHUNK_HDR_LEN) / pool->item_stride);
+  pool->items_per_chunk = (int) items_per_chunk;
+  pool->chunk_alloc_size = OBJPOOL_CHUNK_HDR_LEN +
+    items_per_chunk * pool->item_stride;
+
+  if (!all_pools)
+    all_pools = smartlist_new();
+  smartlist_add(all_pools, pool);
+
+  return pool;
+}
+
+/** Release all storage held by <b>pool</b>, including every object that
+ * is still handed out. */
+void
+objpool_destroy(objpool_t *pool)
+{
+  if (!pool)
+    return;
+
+  if (pool->n_items_in_use)
+    log_info(LD_GENERAL, "Destroying object pool %s with %lu objects still "
+             "allocated.", pool->name, (unsigned long)pool->n_items_in_use);
+
+  chunk_list_free(pool->empty_chunks);
+  chunk_list_free(pool->used_chunks);
+  chunk_list_free(pool->full_chunks);
+
+  if (all_pools) {
+    smartlist_remove(all_pools, pool);
+    if (smartlist_len(all_pools) == 0) {
+      smartlist_free(all_pools);
+      all_pools = NULL;
+    }
+  }
+
+  tor_free(pool->name);
+  tor_free(pool);
+}
+
+/** Allocate and return a new empty chunk for <b>pool</b>. */
+static objpool_chunk_t *
+objpool_chunk_new(objpool_t *pool)
+{
+  objpool_chunk_t *chunk = tor_malloc(pool->chunk_alloc_size);
+  memset(chunk, 0, sizeof(objpool_chunk_t));
+  chunk->pool = pool;
+  ++pool->n_chunks;
+  return chunk;
+}
+
+/** Return a new zeroed object from <b>pool</b>.  It must be released with
+ * objpool_free() on the same pool, never with tor_free(). */
+void *
+objpool_alloc_zero(objpool_t *pool)
+{
+  objpool_chunk_t *chunk;
+  objpool_item_hdr_t *hdr;
+  char *item;
+
+  tor_assert(pool);
+
+  if (pool->used_chunks) {
+    chunk = pool->used_chunks;
+  } else if (pool->empty_chunks) {
+    chunk = pool->empty_chunks;
+    chunk_unlink(&pool->empty_chunks, chunk);
+    --pool->n_empty_chunks;
+    chunk_push(&pool->used_chunks, chunk);
+  } else {
+    chunk = objpool_chunk_new(pool);
+    chunk_push(&pool->used_chunks, chunk);
+  }
+
+  if (chunk->first_free) {
+    item = chunk->first_free;
+    memcpy(&chunk->first_free, item, sizeof(void*));
+    hdr = (objpool_item_hdr_t *)(item - OBJPOOL_HDR_LEN);
+    tor_assert(hdr->chunk == NULL);
+  } else {
+    tor_assert(chunk->n_carved < pool->items_per_chunk);
+    hdr = (objpool_item_hdr_t *)CHUNK_SLOT(pool, chunk, chunk->n_carved);
+    item = ((char*)hdr) + OBJPOOL_HDR_LEN;
+    ++chunk->n_carved;
+  }
+
+  hdr->chunk = chunk;
+
+  if (++chunk->n_allocated == pool->items_per_chunk) {
+    chunk_unlink(&pool->used_chunks, chunk);
+    chunk_push(&pool->full_chunks, chunk);
+  }
+
+  ++pool->n_items_in_use;
+  ++pool->n_allocs_total;
+
+  memset(item, 0, pool->item_size);
+  return item;
+}
+
+/** Release <b>item</b>, which must have come from objpool_alloc_zero() on
+ * <b>pool</b>, back to <b>pool</b>.  Use objpool_free() instead. */
+void
+objpool_free_(objpool_t *pool, void *item)
+{
+  objpool_item_hdr_t *hdr;
+  objpool_chunk_t *chunk;
+  int was_full;
+
+  if (!item)
+    return;
+  tor_assert(pool);
+
+  hdr = (objpool_item_hdr_t *)(((char*)item) - OBJPOOL_HDR_LEN);
+  chunk = hdr->chunk;
+  /* Catch double frees and objects from some other pool. */
+  tor_assert(chunk);
+  tor_assert(chunk->pool == pool);
+  hdr->chunk = NULL;
+
+  was_full = (chunk->n_allocated == pool->items_per_chunk);
+  --chunk->n_allocated;
+  --pool->n_items_in_use;
+
+  if (chunk->n_allocated == 0) {
+    /* Forget the free list, so that the next user of this chunk carves
+     * objects from the front again. */
+    chunk->first_free = NULL;
+    chunk->n_carved = 0;
+    if (was_full)
+      chunk_unlink(&pool->full_chunks, chunk);
+    else
+      chunk_unlink(&pool->used_chunks, chunk);
+    chunk_push(&pool->empty_chunks, chunk);
+    ++pool->n_empty_chunks;
+    return;
+  }
+
+  memcpy(item, &chunk->first_free, sizeof(void*));
+  chunk->first_free = item;
+
+  if (was_full) {
+    chunk_unlink(&pool->full_chunks, chunk);
+    chunk_push(&pool->used_chunks, chunk);
+  }
+}
+
+/** Release empty chunks from <b>pool</b> until it holds no more than
+ * <b>max_idle_bytes</b> in chunks that have no objects handed out.  Return
+ * the number of bytes released. */
+size_t
+objpool_trim(objpool_t *pool, size_t max_idle_bytes)
+{
+  size_t freed = 0;
+  tor_assert(pool);
+
+  while (pool->empty_chunks &&
+         pool->n_empty_chunks * pool->chunk_alloc_size > max_idle_bytes) {
+    objpool_chunk_t *chunk = pool->empty_chunks;
+    chunk_unlink(&pool->empty_chunks, chunk);
+    --pool->n_empty_chunks;
+    --pool->n_chunks;
+    ++pool->n_chunks_released_total;
+    freed += pool->chunk_alloc_size;
+    tor_free(chunk);
+  }
+
+  return freed;
+}
+
+/** Release empty chunks from every pool until all pools together hold no
+ * more than <b>max_idle_bytes</b> in chunks that have no objects handed
+ * out.  Pools created earlier get the first claim on the budget.  Return
+ * the number of bytes released. */
+size_t
+objpool_trim_all(size_t max_idle_bytes)
+{
+  size_t freed = 0;
+  if (!all_pools)
+    return 0;
+
+  SMARTLIST_FOREACH_BEGIN(all_pools, objpool_t *, pool) {
+    size_t idle;
+    freed += objpool_trim(pool, max_idle_bytes);
+    idle = pool->n_empty_chunks * pool->chunk_alloc_size;
+    max_idle_bytes -= MIN(idle, max_idle_bytes);
+  } SMARTLIST_FOREACH_END(pool);
+
+  return freed;
+}
+
+/** Fill in *<b>stats_out</b> with statistics about <b>pool</b>.  The name
+ * in <b>stats_out</b> is only valid until <b>pool</b> is destroyed. */
+void
+objpool_get_stats(const objpool_t *pool, objpool_stats_t *stats_out)
+{
+  tor_assert(pool);
+  tor_assert(stats_out);
+
+  memset(stats_out, 0, sizeof(*stats_out));
+  stats_out->name = pool->name;
+  stats_out->item_size = pool->item_size;
+  stats_out->n_chunks = pool->n_chunks;
+  stats_out->n_empty_chunks = pool->n_empty_chunks;
+  stats_out->n_items_in_use = pool->n_items_in_use;
+  stats_out->bytes_allocated = pool->n_chunks * pool->chunk_alloc_size;
+  stats_out->bytes_idle = pool->n_empty_chunks * pool->chunk_alloc_size;
+  stats_out->n_allocs_total = pool->n_allocs_total;
+  stats_out->n_chunks_released_total = pool->n_chunks_released_total;
+}
+
+/** Return a list of every pool that currently exists, or NULL if there are
+ * none.  The list must not be modified. */
+const smartlist_t *
+objpool_get_all(void)
+{
+  return all_pools;
+}
+
+/** Helper for objpool_assert_ok(): check every chunk on the list starting
+ * at <b>chunk</b>, and return how many there were.  Add the number of
+ * objects handed out from them to *<b>n_items</b>. */
+static size_t
+objpool_assert_chunk_list_ok(const objpool_t *pool,
+                             const objpool_chunk_t *chunk,
+                             int min_allocated, int max_allocated,
+                             size_t *n_items)
+{
+  size_t n = 0;
+  const objpool_chunk_t *prev = NULL;
+  for (; chunk; prev = chunk, chunk = chunk->next) {
+    int n_free_listed = 0;
+    const char *item;
+    tor_assert(chunk->pool == pool);
+    tor_assert(chunk->prev == prev);
+    tor_assert(chunk->n_allocated >= min_allocated);
+    tor_assert(chunk->n_allocated <= max_allocated);
+    tor_assert(chunk->n_carved >= chunk->n_allocated);
+    tor_assert(chunk->n_carved <= pool->items_per_chunk);
+    for (item = chunk->first_free; item; ) {
+      const objpool_item_hdr_t *hdr =
+        (const objpool_item_hdr_t *)(item - OBJPOOL_HDR_LEN);
+      tor_assert(hdr->chunk == NULL);
+      tor_assert(item > (const char*)chunk);
+      tor_assert(item < CHUNK_SLOT(pool, chunk, chunk->n_carved));
+      ++n_free_listed;
+      memcpy(&item, item, sizeof(void*));
+    }
+    tor_assert(n_free_listed + chunk->n_allocated == chunk->n_carved);
+    *n_items += chunk->n_allocated;
+    ++n;
+  }
+  return n;
+}
+
+/** Assert that <b>pool</b> is internally consistent. */
+void
+objpool_assert_ok(const objpool_t *pool)
+{
+  size_t n_chunks = 0, n_empty, n_items = 0;
+  tor_assert(pool);
+
+  n_empty = objpool_assert_chunk_list_ok(pool, pool->empty_chunks,
+                                         0, 0, &n_items);
+  n_chunks += n_empty;
+  n_chunks += objpool_assert_chunk_list_ok(pool, pool->used_chunks,
+                                           1, pool->items_per_chunk - 1,
+                                           &n_items);
+  n_chunks += objpool_assert_chunk_list_ok(pool, pool->full_chunks,
+                                           pool->items_per_chunk,
+                                           pool->items_per_chunk,
+                                           &n_items);
+  tor_assert(n_empty == pool->n_empty_chunks);
+  tor_assert(n_chunks == pool->n_chunks);
+  tor_assert(n_items == pool->n_items_in_use);
+}
@@ -0,0 +1,56 @@
+/* Copyright (c) 2008-2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file objpool.h
+ * \brief Header for objpool.c
+ **/
+
+#ifndef TOR_OBJPOOL_H
+#define TOR_OBJPOOL_H
+
+#include "torint.h"
+
+typedef struct objpool_t objpool_t;
+
+/** Statistics about a single objpool_t, as returned by
+ * objpool_get_stats(). */
+typedef struct objpool_stats_t {
+  /** Name given to the pool at creation time. */
+  const char *name;
+  /** Size of each object handed out by the pool. */
+  size_t item_size;
+  /** Total number of chunks currently allocated by the pool. */
+  size_t n_chunks;
+  /** Number of those chunks that hold no live objects. */
+  size_t n_empty_chunks;
+  /** Number of objects currently handed out. */
+  size_t n_items_in_use;
+  /** Bytes currently held from the system allocator. */
+  size_t bytes_allocated;
+  /** Bytes held in chunks that hold no live objects. */
+  size_t bytes_idle;
+  /** Number of objects ever handed out by this pool. */
+  uint64_t n_allocs_total;
+  /** Number of chunks ever returned to the system allocator. */
+  uint64_t n_chunks_released_total;
+} objpool_stats_t;
+
+objpool_t *objpool_new(const char *name, size_t item_size,
+                       size_t items_per_chunk);
+void objpool_destroy(objpool_t *pool);
+void *objpool_alloc_zero(objpool_t *pool);
+void objpool_free_(objpool_t *pool, void *item);
+/** Release <b>item</b> back to <b>pool</b>, and set <b>item</b> to NULL. */
+#define objpool_free(pool, item)                \
+  STMT_BEGIN                                    \
+    objpool_free_((pool), (item));              \
+    (item) = NULL;                              \
+  STMT_END
+size_t objpool_trim(objpool_t *pool, size_t max_idle_bytes);
+size_t objpool_trim_all(size_t max_idle_bytes);
+void objpool_get_stats(const objpool_t *pool, objpool_stats_t *stats_out);
+const struct smartlist_t *objpool_get_all(void);
+void objpool_assert_ok(const objpool_t *pool);
+
+#endif /* !defined(TOR_OBJPOOL_H) */
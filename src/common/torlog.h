@@ -166,6 +166,22 @@ void log_set_application_name(const char *name);
 void set_log_time_granularity(int granularity_msec);
 void truncate_logs(void);
 
+/** What to do with a log message when the asynchronous log buffer is
+ * full. */
+typedef enum log_async_overflow_t {
+  /** Discard the message, and say how many we discarded later. */
+  LOG_ASYNC_OVERFLOW_DROP = 0,
+  /** Wait for the writer thread to make room. */
+  LOG_ASYNC_OVERFLOW_BLOCK = 1,
+} log_async_overflow_t;
+
+/** Smallest buffer we accept for asynchronous logging. */
+#define LOG_ASYNC_MIN_BUFFER_SIZE (16*1024)
+
+int logs_set_async(int enabled, size_t buffer_size,
+                   log_async_overflow_t on_overflow);
+uint64_t logs_get_n_async_dropped(void);
+
 void tor_log(int severity, log_domain_mask_t domain, const char *format, ...)
   CHECK_PRINTF(3,4);
 
@@ -248,7 +264,32 @@ void log_fn_ratelim_(struct ratelim_t *ratelim, int severity,
 MOCK_DECL(STATIC void, logv, (int severity, log_domain_mask_t domain,
     const char *funcname, const char *suffix, const char *format,
     va_list ap) CHECK_PRINTF(5,0));
-#endif
+
+/** A bounded FIFO of log messages, each tagged with the log it is for. */
+typedef struct log_ring_t {
+  char *buf; /**< Storage for the records. */
+  size_t cap; /**< Allocated size of buf. */
+  size_t head; /**< Offset in buf where the next record goes. */
+  size_t tail; /**< Offset in buf of the oldest record. */
+  size_t used; /**< Number of bytes of buf holding records or padding. */
+} log_ring_t;
+
+/** A message taken from a log_ring_t. */
+typedef struct log_ring_chunk_t {
+  const char *data;
+  size_t len;
+} log_ring_chunk_t;
+
+STATIC int log_ring_can_fit(const log_ring_t *ring, size_t len);
+STATIC void log_ring_init(log_ring_t *ring, size_t size);
+STATIC void log_ring_clear(log_ring_t *ring);
+STATIC int log_ring_push(log_ring_t *ring, void *target, const char *msg,
+                         size_t len);
+STATIC size_t log_ring_peek(const log_ring_t *ring, void **target_out,
+                            log_ring_chunk_t *chunks, int max_chunks,
+                            int *n_chunks_out);
+STATIC void log_ring_consume(log_ring_t *ring, size_t n_bytes);
+#endif /* defined(LOG_PRIVATE) */
 
 # define TOR_TORLOG_H
 #endif /* !defined(TOR_TORLOG_H) */
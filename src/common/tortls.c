@@ -146,6 +146,8 @@ static int check_cert_lifetime_internal(int severity, const X509 *cert,
  * @{ */
 STATIC tor_tls_context_t *server_tls_context = NULL;
 STATIC tor_tls_context_t *client_tls_context = NULL;
+/** The serial number we gave to the most recently created TLS context. */
+static uint64_t last_tls_context_serial = 0;
 /**@}*/
 
 /** True iff tor_tls_init() has been called. */
@@ -868,6 +870,26 @@ tor_tls_get_my_client_auth_key(void)
   return client_tls_context->auth_key;
 }
 
+/** Return the serial number of the context whose certificates
+ * tor_tls_get_my_certs() would return for <b>server</b>, or 0 if we have no
+ * such context.  The serial changes whenever that context is replaced. */
+uint64_t
+tor_tls_get_my_context_serial(int server)
+{
+  tor_tls_context_t *ctx = server ? server_tls_context : client_tls_context;
+  return ctx ? ctx->serial : 0;
+}
+
+/** Return the serial number of the context that <b>tls</b> was created
+ * with.  Two connections whose contexts have the same serial use the same
+ * certificates. */
+uint64_t
+tor_tls_get_context_serial(const tor_tls_t *tls)
+{
+  tor_assert(tls);
+  return tls->context->serial;
+}
+
 /**
  * Return a newly allocated copy of the public key that a certificate
  * certifies. Watch out! This returns NULL if the cert's key is not RSA.
@@ -1143,6 +1165,7 @@ tor_tls_context_new(crypto_pk_t *identity, unsigned int key_lifetime,
 
   result = tor_malloc_zero(sizeof(tor_tls_context_t));
   result->refcnt = 1;
+  result->serial = ++last_tls_context_serial;
   if (!is_client) {
     result->my_link_cert = tor_x509_cert_new(X509_dup(cert));
     result->my_id_cert = tor_x509_cert_new(X509_dup(idcert));
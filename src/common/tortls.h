@@ -73,6 +73,9 @@ struct ssl_session_st;
  */
 typedef struct tor_tls_context_t {
   int refcnt;
+  /** A number that no other context made by this process has; see
+   * tor_tls_get_context_serial(). */
+  uint64_t serial;
   struct ssl_ctx_st *ctx;
   tor_x509_cert_t *my_link_cert;
   tor_x509_cert_t *my_id_cert;
@@ -276,6 +279,8 @@ int tor_tls_get_my_certs(int server,
                          const tor_x509_cert_t **link_cert_out,
                          const tor_x509_cert_t **id_cert_out);
 crypto_pk_t *tor_tls_get_my_client_auth_key(void);
+uint64_t tor_tls_get_my_context_serial(int server);
+uint64_t tor_tls_get_context_serial(const tor_tls_t *tls);
 crypto_pk_t *tor_tls_cert_get_key(tor_x509_cert_t *cert);
 MOCK_DECL(int,tor_tls_cert_matches_key,(const tor_tls_t *tls,
                                         const tor_x509_cert_t *cert));
@@ -1344,25 +1344,54 @@ esc_for_log_len(const char *chars, size_t n)
   return string_escaped;
 }
 
+/** Per-thread holder for the last value returned by escaped() on threads
+ * other than the main thread.  Only used once escaped_init_threads() has
+ * been called. */
+static tor_threadlocal_t escaped_val_threadlocal;
+/** True iff escaped_val_threadlocal has been initialized. */
+static int escaped_threadlocal_initialized = 0;
+
+/** Make escaped() safe to call from threads other than the main thread.
+ * Must be called from the main thread, before starting any thread that might
+ * call escaped(). */
+void
+escaped_init_threads(void)
+{
+  if (escaped_threadlocal_initialized)
+    return;
+  tor_threadlocal_init(&escaped_val_threadlocal);
+  escaped_threadlocal_initialized = 1;
+}
+
 /** Allocate and return a new string representing the contents of <b>s</b>,
  * surrounded by quotes and using standard C escapes.
  *
  * THIS FUNCTION IS NOT REENTRANT.  Don't call it from outside the main
- * thread.  Also, each call invalidates the last-returned value, so don't
+ * thread unless escaped_init_threads() has been called.  Also, each call
+ * invalidates the last value it returned on the same thread, so don't
  * try log_warn(LD_GENERAL, "%s %s", escaped(a), escaped(b));
  */
 const char *
 escaped(const char *s)
 {
   static char *escaped_val_ = NULL;
-  tor_free(escaped_val_);
+  char **valp = &escaped_val_;
+
+  if (escaped_threadlocal_initialized && !in_main_thread()) {
+    valp = tor_threadlocal_get(&escaped_val_threadlocal);
+    if (PREDICT_UNLIKELY(valp == NULL)) {
+      valp = tor_malloc_zero(sizeof(char *));
+      tor_threadlocal_set(&escaped_val_threadlocal, valp);
+    }
+  }
+  tor_free(*valp);
 
   if (s)
-    escaped_val_ = esc_for_log(s);
+    *valp = esc_for_log(s);
   else
-    escaped_val_ = NULL;
+    *valp = NULL;
 
-  return escaped_val_;
+  return *valp;
 }
 
 /** Return a newly allocated string equal to <b>string</b>, except that every
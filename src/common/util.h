@@ -217,6 +217,7 @@ int tor_digest256_is_zero(const char *digest);
 char *esc_for_log(const char *string) ATTR_MALLOC;
 char *esc_for_log_len(const char *chars, size_t n) ATTR_MALLOC;
 const char *escaped(const char *string);
+void escaped_init_threads(void);
 
 char *tor_escape_str_for_pt_args(const char *string,
                                  const char *chars_to_escape);
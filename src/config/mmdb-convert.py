@@ -32,6 +32,7 @@ import struct
 import bisect
 import socket
 import binascii
+import hashlib
 import sys
 import time
 
@@ -459,8 +460,118 @@ def write_geoip_file(filename, metadata, the_tree, dump_item, fmt_item):
         fobj.write(fmt_item(unwritten))
     fobj.close()
 
-content = open(sys.argv[1], 'rb').read()
-metadata, the_tree, _ = parse_mm_file(content)
+# Binary GeoIP files.  Tor maps these into memory and uses them in place,
+# instead of parsing the text files at startup.  The layout (all integers
+# big-endian) is:
+#
+#   "TORGEOIP"                        magic
+#   u32 version, u32 family (4 or 6), u32 n_countries, u32 n_entries
+#   20 bytes                          SHA1 of the equivalent text file
+#   4 bytes                           zero padding
+#   n_countries * 2 bytes             country codes, zero-padded to 4 bytes
+#   65537 * u32                       index: entry position of the first
+#                                     range whose high address has its first
+#                                     16 bits >= i
+#   n_entries * (lo, hi, u32 country) sorted, disjoint ranges; addresses
+#                                     are 4 or 16 bytes
+#
+# See geoip_table_t in src/or/geoip.c.
+
+BINARY_MAGIC = b'TORGEOIP'
+BINARY_VERSION = 1
+BINARY_INDEX_LEN = (1<<16) + 1
+
+def parse_text_item(line, family):
+    """Parse one line of a text geoip or geoip6 file into a (lo, hi, cc)
+       tuple, or return None for blank and comment lines."""
+    line = line.strip()
+    if not line or line.startswith('#'):
+        return None
+    fields = [f.strip('"') for f in line.split(',')]
+    if family == 4:
+        return (int(fields[0]), int(fields[1]), fields[2])
+    lo, hi = [int(binascii.hexlify(socket.inet_pton(socket.AF_INET6, f)), 16)
+              for f in fields[:2]]
+    return (lo, hi, fields[2])
+
+def write_binary_geoip_file(text_filename, filename, family):
+    """Convert the text geoip file text_filename, for family 4 or 6, into the
+       binary file filename."""
+    text = open(text_filename, 'rb').read()
+    entries = []
+    for line in bytesToStr(text).splitlines():
+        item = parse_text_item(line, family)
+        if item:
+            entries.append(item)
+    entries.sort()
+    for a, b in zip(entries, entries[1:]):
+        if a[1] >= b[0]:
+            raise ValueError("Overlapping ranges in %s" % text_filename)
+
+    countries = sorted(set(e[2] for e in entries))
+    country_idx = dict((cc, i) for i, cc in enumerate(countries))
+    nbits = 32 if family == 4 else 128
+    addr_len = nbits // 8
+
+    out = [BINARY_MAGIC,
+           struct.pack("!IIII", BINARY_VERSION, family, len(countries),
+                       len(entries)),
+           hashlib.sha1(text).digest(),
+           b'\x00' * 4]
+    codes = b''.join(cc.encode('ascii') for cc in countries)
+    out.append(codes + b'\x00' * (-len(codes) % 4))
+
+    index = []
+    i = 0
+    for prefix in range(BINARY_INDEX_LEN):
+        while i < len(entries) and (entries[i][1] >> (nbits-16)) < prefix:
+            i += 1
+        index.append(i)
+    out.append(struct.pack("!%dI" % BINARY_INDEX_LEN, *index))
+
+    for lo, hi, cc in entries:
+        out.append(binascii.unhexlify("%0*x" % (2*addr_len, lo)))
+        out.append(binascii.unhexlify("%0*x" % (2*addr_len, hi)))
+        out.append(struct.pack("!I", country_idx[cc]))
+
+    fobj = open(filename, 'wb')
+    fobj.write(b''.join(out))
+    fobj.close()
+
+def usage():
+    "Explain how to run this script, and exit."
+    sys.stderr.write(
+        "Usage: %s [--binary] GeoLite2-Country.mmdb\n"
+        "       %s --text-to-binary {4|6} TEXTFILE BINARYFILE\n"
+        "With --binary, also write geoip.bin and geoip6.bin.\n"
+        % (sys.argv[0], sys.argv[0]))
+    sys.exit(1)
+
+def main(args):
+    "Run the conversion that args asks for."
+    if args[:1] == ['--text-to-binary']:
+        if len(args) != 4 or args[1] not in ('4', '6'):
+            usage()
+        write_binary_geoip_file(args[2], args[3], int(args[1]))
+        return
 
-write_geoip_file('geoip', metadata, the_tree, dump_item_ipv4, fmt_item_ipv4)
-write_geoip_file('geoip6', metadata, the_tree, dump_item_ipv6, fmt_item_ipv6)
+    binary = False
+    if args[:1] == ['--binary']:
+        binary = True
+        args = args[1:]
+    if len(args) != 1:
+        usage()
+
+    content = open(args[0], 'rb').read()
+    metadata, the_tree, _ = parse_mm_file(content)
+
+    write_geoip_file('geoip', metadata, the_tree, dump_item_ipv4,
+                     fmt_item_ipv4)
+    write_geoip_file('geoip6', metadata, the_tree, dump_item_ipv6,
+                     fmt_item_ipv6)
+    if binary:
+        write_binary_geoip_file('geoip', 'geoip.bin', 4)
+        write_binary_geoip_file('geoip6', 'geoip6.bin', 6)
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -1008,8 +1008,7 @@ channel_free(channel_t *chan)
   }
 
   /* Remove all timers and associated handle entries now */
-  timer_free(chan->padding_timer);
-  channel_handle_free(chan->timer_handle);
+  channelpadding_channel_free(chan);
   channel_handles_clear(chan);
 
   /* Call a free method if there is one */
@@ -1091,8 +1090,7 @@ channel_force_free(channel_t *chan)
   }
 
   /* Remove all timers and associated handle entries now */
-  timer_free(chan->padding_timer);
-  channel_handle_free(chan->timer_handle);
+  channelpadding_channel_free(chan);
   channel_handles_clear(chan);
 
   /* Call a free method if there is one */
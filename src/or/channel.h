@@ -34,6 +34,10 @@ typedef enum {
     CHANNEL_USED_FOR_USER_TRAFFIC,
 } channel_usage_info_t;
 
+/** Number of entries in the per-channel cache of circuits by ID.  Must be a
+ * power of two. */
+#define CHANNEL_CIRCID_CACHE_SIZE 8
+
 /**
  * Channel struct; see the channel_t typedef in or.h.  A channel is an
  * abstract interface for the OR-to-OR connection, similar to connection_or_t,
@@ -97,10 +101,10 @@ struct channel_s {
    *  is scheduled. */
   uint64_t next_padding_time_ms;
 
-  /** The callback pointer for the padding callbacks */
-  tor_timer_t *padding_timer;
-  /** The handle to this channel (to free on canceled timers) */
-  struct channel_handle_t *timer_handle;
+  /** Links in the list of channels whose padding is due in the same slot
+   * of the padding timer wheel.  Only used while pending_padding_callback
+   * is set. */
+  TOR_LIST_ENTRY(channel_s) padding_wheel_link;
 
   /**
    * These two fields specify the minimum and maximum negotiated timeout
@@ -290,6 +294,14 @@ struct channel_s {
   /** For how many circuits are we n_chan?  What about p_chan? */
   unsigned int num_n_circuits, num_p_circuits;
 
+  /** Direct-mapped cache of the circuits most recently looked up by ID on
+   * this channel, indexed by the low bits of the circuit ID.  Only
+   * circuitlist.c uses this; an entry with a NULL circ is empty. */
+  struct {
+    circid_t circ_id;
+    circuit_t *circ;
+  } circid_cache[CHANNEL_CIRCID_CACHE_SIZE];
+
   /** For how many circuits have we ever been n_chan?  What about p_chan? */
   uint64_t total_n_circuits, total_p_circuits;
 
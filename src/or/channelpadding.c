@@ -7,6 +7,7 @@
 /* TOR_CHANNEL_INTERNAL_ define needed for an O(1) implementation of
  * channelpadding_channel_to_channelinfo() */
 #define TOR_CHANNEL_INTERNAL_
+#define CHANNELPADDING_PRIVATE
 
 #include "or.h"
 #include "channel.h"
@@ -407,22 +408,221 @@ channelpadding_send_padding_cell_for_callback(channel_t *chan)
   chan->write_cell(chan, &cell);
 }
 
-/**
- * tor_timer callback function for us to send padding on an idle channel.
+/*
+ * Padding timer wheel.
  *
- * This function just obtains the channel from the callback handle, ensures
- * it is still valid, and then hands it off to
- * channelpadding_send_padding_cell_for_callback(), which checks if
- * the channel is still idle before sending padding.
+ * Rather than giving every channel its own tor_timer_t, we keep channels
+ * with a padding callback pending in a timing wheel of one-millisecond
+ * slots, driven by a single timer that is set for the earliest occupied
+ * slot.  When it fires, we handle every slot that has come due in one
+ * batch.  We only schedule padding when it is due within a little over a
+ * second (see channelpadding_compute_time_until_pad_for_netflow()), so one
+ * level of slots covers every deadline we need; anything further out waits
+ * in the last slot and is put back when that slot comes up.
+ *
+ * Cancellation is lazy: traffic on a channel only clears its
+ * next_padding_time_ms, and we find out that the padding is no longer
+ * needed when its slot comes due.  A channel that is freed is unlinked
+ * from its slot right away.
  */
+
+/** Number of one-millisecond slots in the padding timer wheel.  Must be a
+ * power of two, larger than the longest delay we schedule padding for. */
+#define PADDING_WHEEL_SLOTS 2048
+/** Mask to turn a millisecond count into a padding timer wheel slot. */
+#define PADDING_WHEEL_MASK (PADDING_WHEEL_SLOTS - 1)
+
+TOR_LIST_HEAD(padding_wheel_slot_s, channel_s);
+
+/** The padding timer wheel: slot <b>i</b> holds the channels whose padding
+ * is due at a millisecond congruent to <b>i</b>, within the next
+ * PADDING_WHEEL_SLOTS milliseconds of padding_wheel_next_ms.  NULL until
+ * we first need it. */
+static struct padding_wheel_slot_s *padding_wheel = NULL;
+/** Bitmap of the slots in padding_wheel that may be nonempty. */
+static bitarray_t *padding_wheel_occupied = NULL;
+/** The first millisecond whose slot we haven't yet handled. */
+static uint64_t padding_wheel_next_ms = 0;
+/** Number of channels in padding_wheel. */
+static int padding_wheel_n_pending = 0;
+/** The timer that runs the wheel. */
+static tor_timer_t *padding_wheel_timer = NULL;
+/** The millisecond for which padding_wheel_timer is set, or 0 if it isn't
+ * set. */
+static uint64_t padding_wheel_timer_ms = 0;
+
+static void channelpadding_wheel_timer_cb(tor_timer_t *timer, void *arg,
+                                          const struct monotime_t *when);
+
+/** Make sure padding_wheel_timer will fire no later than the start of
+ * millisecond <b>when_ms</b>. */
+static void
+channelpadding_wheel_set_timer(uint64_t when_ms)
+{
+  struct timeval timeout;
+  uint64_t now_ms = monotime_coarse_absolute_msec();
+  uint64_t delay_ms;
+
+  if (padding_wheel_timer_ms && padding_wheel_timer_ms <= when_ms)
+    return;
+
+  /* Never ask for an immediate callback: the coarse clock may lag behind
+   * the clock that the timers use, and we don't want to spin. */
+  delay_ms = when_ms > now_ms ? when_ms - now_ms : 1;
+  timeout.tv_sec = (time_t)(delay_ms / TOR_MSEC_PER_SEC);
+  timeout.tv_usec = (int)(delay_ms % TOR_MSEC_PER_SEC) * TOR_USEC_PER_MSEC;
+
+  if (!padding_wheel_timer)
+    padding_wheel_timer = timer_new(channelpadding_wheel_timer_cb, NULL);
+  timer_schedule(padding_wheel_timer, &timeout);
+  padding_wheel_timer_ms = when_ms;
+}
+
+/** Return the first millisecond at or after padding_wheel_next_ms whose
+ * slot may hold a channel.  The wheel must not be empty. */
+static uint64_t
+channelpadding_wheel_next_occupied(void)
+{
+  uint64_t ms = padding_wheel_next_ms;
+  int i;
+  for (i = 0; i < PADDING_WHEEL_SLOTS; ++i, ++ms) {
+    const unsigned slot = (unsigned)(ms & PADDING_WHEEL_MASK);
+    /* Skip whole empty words of the bitmap at once. */
+    if ((slot & BITARRAY_MASK) == 0 &&
+        padding_wheel_occupied[slot >> BITARRAY_SHIFT] == 0 &&
+        i + BITARRAY_MASK < PADDING_WHEEL_SLOTS) {
+      i += BITARRAY_MASK;
+      ms += BITARRAY_MASK;
+      continue;
+    }
+    if (bitarray_is_set(padding_wheel_occupied, slot))
+      return ms;
+  }
+  /* LCOV_EXCL_START */
+  tor_assert_nonfatal_unreached();
+  return padding_wheel_next_ms;
+  /* LCOV_EXCL_STOP */
+}
+
+/** Add <b>chan</b>, which must not already be there, to the padding timer
+ * wheel so that channelpadding_padding_due() is called for it at
+ * millisecond <b>when_ms</b> or soon after. */
+STATIC void
+channelpadding_wheel_add(channel_t *chan, uint64_t when_ms)
+{
+  unsigned slot;
+
+  if (!padding_wheel) {
+    padding_wheel = tor_calloc(PADDING_WHEEL_SLOTS,
+                               sizeof(struct padding_wheel_slot_s));
+    padding_wheel_occupied = bitarray_init_zero(PADDING_WHEEL_SLOTS);
+  }
+  if (padding_wheel_n_pending == 0) {
+    /* Nothing to keep track of: start the wheel at the current time. */
+    uint64_t now_ms = monotime_coarse_absolute_msec();
+    if (now_ms > padding_wheel_next_ms)
+      padding_wheel_next_ms = now_ms;
+  }
+
+  /* Keep clear of the last slot in the window: while we're running the
+   * wheel, that's the slot we're emptying. */
+  if (when_ms < padding_wheel_next_ms)
+    when_ms = padding_wheel_next_ms;
+  if (when_ms - padding_wheel_next_ms >= PADDING_WHEEL_SLOTS - 1)
+    when_ms = padding_wheel_next_ms + PADDING_WHEEL_SLOTS - 2;
+
+  slot = (unsigned)(when_ms & PADDING_WHEEL_MASK);
+  TOR_LIST_INSERT_HEAD(&padding_wheel[slot], chan, padding_wheel_link);
+  bitarray_set(padding_wheel_occupied, slot);
+  ++padding_wheel_n_pending;
+
+  channelpadding_wheel_set_timer(when_ms);
+}
+
+/** Remove <b>chan</b> from the padding timer wheel. */
+static void
+channelpadding_wheel_remove(channel_t *chan)
+{
+  TOR_LIST_REMOVE(chan, padding_wheel_link);
+  --padding_wheel_n_pending;
+}
+
+#ifdef TOR_UNIT_TESTS
+/** Return the number of channels in the padding timer wheel. */
+STATIC int
+channelpadding_wheel_n_pending(void)
+{
+  return padding_wheel_n_pending;
+}
+#endif /* defined(TOR_UNIT_TESTS) */
+
+/** Handle every slot of the padding timer wheel up to and including
+ * millisecond <b>now_ms</b>, and set the timer for the next one. */
+STATIC void
+channelpadding_wheel_run(uint64_t now_ms)
+{
+  uint64_t n_slots;
+
+  if (padding_wheel_n_pending == 0 || now_ms < padding_wheel_next_ms)
+    goto done;
+
+  /* If we were held up for longer than the wheel is long, every slot is
+   * due, so look at each of them once. */
+  n_slots = now_ms - padding_wheel_next_ms + 1;
+  if (n_slots > PADDING_WHEEL_SLOTS)
+    n_slots = PADDING_WHEEL_SLOTS;
+
+  while (n_slots-- && padding_wheel_n_pending) {
+    const unsigned slot =
+      (unsigned)(padding_wheel_next_ms & PADDING_WHEEL_MASK);
+    /* Anything added from here on belongs in a later slot. */
+    ++padding_wheel_next_ms;
+    if (!bitarray_is_set(padding_wheel_occupied, slot))
+      continue;
+    bitarray_clear(padding_wheel_occupied, slot);
+
+    while (!TOR_LIST_EMPTY(&padding_wheel[slot])) {
+      channel_t *chan = TOR_LIST_FIRST(&padding_wheel[slot]);
+      channelpadding_wheel_remove(chan);
+      if (chan->next_padding_time_ms > now_ms) {
+        /* It was too far off to fit in the wheel; put it back. */
+        channelpadding_wheel_add(chan, chan->next_padding_time_ms);
+        continue;
+      }
+      total_timers_pending--;
+      channelpadding_padding_due(chan);
+    }
+  }
+  if (padding_wheel_next_ms <= now_ms)
+    padding_wheel_next_ms = now_ms + 1;
+
+ done:
+  padding_wheel_timer_ms = 0;
+  if (padding_wheel_n_pending)
+    channelpadding_wheel_set_timer(channelpadding_wheel_next_occupied());
+}
+
+/** Timer callback: some slots of the padding timer wheel are due. */
 static void
-channelpadding_send_padding_callback(tor_timer_t *timer, void *args,
-                                     const struct monotime_t *when)
+channelpadding_wheel_timer_cb(tor_timer_t *timer, void *arg,
+                              const struct monotime_t *when)
 {
-  channel_t *chan = channel_handle_get((struct channel_handle_t*)args);
-  (void)timer; (void)when;
+  (void)timer; (void)arg; (void)when;
+  padding_wheel_timer_ms = 0;
+  channelpadding_wheel_run(monotime_coarse_absolute_msec());
+}
 
-  if (chan && CHANNEL_CAN_HANDLE_CELLS(chan)) {
+/**
+ * Called when the padding that we scheduled for <b>chan</b> is due.
+ *
+ * This function just ensures the channel is still valid, and then hands it
+ * off to channelpadding_send_padding_cell_for_callback(), which checks if
+ * the channel is still idle before sending padding.
+ */
+MOCK_IMPL(STATIC void,
+channelpadding_padding_due,(channel_t *chan))
+{
+  if (CHANNEL_CAN_HANDLE_CELLS(chan)) {
     /* Hrmm.. It might be nice to have an equivalent to assert_connection_ok
      * for channels. Then we could get rid of the channeltls dependency */
     tor_assert(TO_CONN(BASE_CHAN_TO_TLS(chan)->conn)->magic ==
@@ -431,11 +631,50 @@ channelpadding_send_padding_callback(tor_timer_t *timer, void *args,
 
     channelpadding_send_padding_cell_for_callback(chan);
   } else {
+     chan->pending_padding_callback = 0;
      log_fn(LOG_INFO,LD_OR,
             "Channel closed while waiting for timer.");
   }
+}
 
+/**
+ * Called when <b>chan</b> is about to be freed: forget about any padding
+ * that we scheduled for it.
+ */
+void
+channelpadding_channel_free(channel_t *chan)
+{
+  if (!chan->pending_padding_callback || !padding_wheel)
+    return;
+  channelpadding_wheel_remove(chan);
   total_timers_pending--;
+  chan->pending_padding_callback = 0;
+}
+
+/**
+ * Release all storage held by the padding timer wheel.
+ */
+void
+channelpadding_free_all(void)
+{
+  if (padding_wheel) {
+    int i;
+    for (i = 0; i < PADDING_WHEEL_SLOTS; ++i) {
+      while (!TOR_LIST_EMPTY(&padding_wheel[i])) {
+        channel_t *chan = TOR_LIST_FIRST(&padding_wheel[i]);
+        channelpadding_wheel_remove(chan);
+        chan->pending_padding_callback = 0;
+      }
+    }
+  }
+  tor_free(padding_wheel);
+  bitarray_free(padding_wheel_occupied);
+  padding_wheel_occupied = NULL;
+  timer_free(padding_wheel_timer);
+  padding_wheel_timer = NULL;
+  padding_wheel_timer_ms = 0;
+  padding_wheel_n_pending = 0;
+  total_timers_pending = 0;
 }
 
 /**
@@ -449,7 +688,6 @@ channelpadding_send_padding_callback(tor_timer_t *timer, void *args,
 static channelpadding_decision_t
 channelpadding_schedule_padding(channel_t *chan, int in_ms)
 {
-  struct timeval timeout;
   tor_assert(!chan->pending_padding_callback);
 
   if (in_ms <= 0) {
@@ -458,22 +696,7 @@ channelpadding_schedule_padding(channel_t *chan, int in_ms)
     return CHANNELPADDING_PADDING_SENT;
   }
 
-  timeout.tv_sec = in_ms/TOR_MSEC_PER_SEC;
-  timeout.tv_usec = (in_ms%TOR_USEC_PER_MSEC)*TOR_USEC_PER_MSEC;
-
-  if (!chan->timer_handle) {
-    chan->timer_handle = channel_handle_new(chan);
-  }
-
-  if (chan->padding_timer) {
-    timer_set_cb(chan->padding_timer,
-                 channelpadding_send_padding_callback,
-                 chan->timer_handle);
-  } else {
-    chan->padding_timer = timer_new(channelpadding_send_padding_callback,
-                                    chan->timer_handle);
-  }
-  timer_schedule(chan->padding_timer, &timeout);
+  channelpadding_wheel_add(chan, monotime_coarse_absolute_msec() + in_ms);
 
   rep_hist_padding_count_timers(++total_timers_pending);
 
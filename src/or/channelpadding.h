@@ -40,6 +40,17 @@ int channelpadding_send_enable_command(channel_t *chan, uint16_t low_timeout,
 int channelpadding_get_circuits_available_timeout(void);
 unsigned int channelpadding_get_channel_idle_timeout(const channel_t *, int);
 void channelpadding_new_consensus_params(networkstatus_t *ns);
+void channelpadding_channel_free(channel_t *chan);
+void channelpadding_free_all(void);
+
+#ifdef CHANNELPADDING_PRIVATE
+STATIC void channelpadding_wheel_add(channel_t *chan, uint64_t when_ms);
+STATIC void channelpadding_wheel_run(uint64_t now_ms);
+#ifdef TOR_UNIT_TESTS
+STATIC int channelpadding_wheel_n_pending(void);
+#endif /* defined(TOR_UNIT_TESTS) */
+MOCK_DECL(STATIC void, channelpadding_padding_due, (channel_t *chan));
+#endif /* defined(CHANNELPADDING_PRIVATE) */
 
 #endif /* !defined(TOR_CHANNELPADDING_H) */
 
@@ -49,14 +49,18 @@
 #include "connection.h"
 #include "connection_or.h"
 #include "control.h"
+#include "cpuworker.h"
 #include "entrynodes.h"
 #include "link_handshake.h"
+#include "main.h"
 #include "relay.h"
 #include "rephist.h"
 #include "router.h"
+#include "routerkeys.h"
 #include "routerlist.h"
 #include "scheduler.h"
 #include "torcert.h"
+#include "workqueue.h"
 #include "networkstatus.h"
 #include "channelpadding_negotiation.h"
 #include "channelpadding.h"
@@ -127,6 +131,13 @@ static int enter_v3_handshake_with_cell(var_cell_t *cell,
                                         channel_tls_t *tlschan);
 static void channel_tls_process_padding_negotiate_cell(cell_t *cell,
                                                        channel_tls_t *chan);
+static void channel_tls_certs_cell_checked(channel_tls_t *chan,
+                                   const ed25519_public_key_t *checked_ed_id,
+                                   const common_digests_t *checked_rsa_id);
+static void channel_tls_authenticate_cell_checked(channel_tls_t *chan,
+                                                  int authtype,
+                                                  int sig_is_rsa,
+                                                  const char *err);
 
 /**
  * Do parts of channel_tls_t initialization common to channel_tls_connect()
@@ -1903,6 +1914,406 @@ certs_cell_typenum_to_cert_type(int typenum)
   }
 }
 
+/** What public-key work a handshake_crypto_job_t is for. */
+typedef enum handshake_crypto_op_t {
+  /** Check the certificates in a CERTS cell we got as responder. */
+  HANDSHAKE_CRYPTO_CHECK_CERTS,
+  /** Check the signature on an AUTHENTICATE cell. */
+  HANDSHAKE_CRYPTO_CHECK_AUTHENTICATE,
+  /** Sign an AUTHENTICATE cell that we're about to send. */
+  HANDSHAKE_CRYPTO_SIGN_AUTHENTICATE,
+} handshake_crypto_op_t;
+
+/** A piece of link handshake public-key work that we can hand to a
+ * cpuworker.  Everything a cpuworker looks at belongs to the job, so the
+ * connection is free to go away while the work is pending. */
+typedef struct handshake_crypto_job_t {
+  handshake_crypto_op_t op;
+  /** The connection that wants this work done, or NULL if it has been
+   * closed since. */
+  or_connection_t *conn;
+  /** The work queue entry for this job, if any. */
+  workqueue_entry_t *work;
+  union {
+    /** For HANDSHAKE_CRYPTO_CHECK_CERTS */
+    struct {
+      /** The certificates to check.  We take them out of the handshake
+       * state while the job is pending, and put them back when it's done. */
+      or_handshake_certs_t *certs;
+      int severity;
+      time_t now;
+      /** Output: the identities that <b>certs</b> proved. These point into
+       * <b>certs</b>. */
+      const ed25519_public_key_t *checked_ed_id;
+      const common_digests_t *checked_rsa_id;
+    } check_certs;
+    /** For HANDSHAKE_CRYPTO_CHECK_AUTHENTICATE */
+    struct {
+      int authtype;
+      int sig_is_rsa;
+      /** The authenticator from the cell, signature included. */
+      uint8_t *auth;
+      size_t authlen;
+      /** The key that should have made the signature. */
+      crypto_pk_t *rsa_key;
+      ed25519_public_key_t ed_key;
+      /** Output: NULL if the signature was good, and a description of the
+       * problem otherwise. */
+      const char *err;
+    } check_auth;
+    /** For HANDSHAKE_CRYPTO_SIGN_AUTHENTICATE */
+    struct {
+      /** The unsigned cell. */
+      var_cell_t *cell;
+      crypto_pk_t *rsa_key;
+      int have_ed_key;
+      ed25519_keypair_t ed_key;
+      /** Output: the signed cell, or NULL if we couldn't sign it. */
+      var_cell_t *signed_cell;
+    } sign_auth;
+  } u;
+} handshake_crypto_job_t;
+
+/** Return a new handshake_crypto_job_t to do <b>op</b> for <b>conn</b>. */
+static handshake_crypto_job_t *
+handshake_crypto_job_new(handshake_crypto_op_t op, or_connection_t *conn)
+{
+  handshake_crypto_job_t *job = tor_malloc_zero(sizeof(*job));
+  job->op = op;
+  job->conn = conn;
+  return job;
+}
+
+/** Release all storage held by <b>job</b>. */
+static void
+handshake_crypto_job_free(handshake_crypto_job_t *job)
+{
+  if (!job)
+    return;
+  switch (job->op) {
+    case HANDSHAKE_CRYPTO_CHECK_CERTS:
+      or_handshake_certs_free(job->u.check_certs.certs);
+      break;
+    case HANDSHAKE_CRYPTO_CHECK_AUTHENTICATE:
+      tor_free(job->u.check_auth.auth);
+      crypto_pk_free(job->u.check_auth.rsa_key);
+      break;
+    case HANDSHAKE_CRYPTO_SIGN_AUTHENTICATE:
+      var_cell_free(job->u.sign_auth.cell);
+      var_cell_free(job->u.sign_auth.signed_cell);
+      crypto_pk_free(job->u.sign_auth.rsa_key);
+      memwipe(&job->u.sign_auth.ed_key, 0, sizeof(job->u.sign_auth.ed_key));
+      break;
+  }
+  memwipe(job, 0xf0, sizeof(*job));
+  tor_free(job);
+}
+
+/** Check the signature on the AUTHENTICATE cell in <b>job</b>.  Return NULL
+ * if it's good, and a description of the problem otherwise. */
+static const char *
+authenticate_cell_check_signature(const handshake_crypto_job_t *job)
+{
+  const uint8_t *auth = job->u.check_auth.auth;
+  const size_t authlen = job->u.check_auth.authlen;
+
+  if (job->u.check_auth.sig_is_rsa) {
+    crypto_pk_t *pk = job->u.check_auth.rsa_key;
+    char d[DIGEST256_LEN];
+    char *signed_data;
+    size_t keysize;
+    int signed_len;
+    const char *err = NULL;
+
+    crypto_digest256(d, (char*)auth, V3_AUTH_BODY_LEN, DIGEST_SHA256);
+
+    keysize = crypto_pk_keysize(pk);
+    signed_data = tor_malloc(keysize);
+    signed_len = crypto_pk_public_checksig(pk, signed_data, keysize,
+                                           (char*)auth + V3_AUTH_BODY_LEN,
+                                           authlen - V3_AUTH_BODY_LEN);
+    if (signed_len < 0)
+      err = "RSA signature wasn't valid";
+    else if (signed_len < DIGEST256_LEN)
+      err = "Not enough data was signed";
+    /* Note that we deliberately allow *more* than DIGEST256_LEN bytes here,
+     * in case they're later used to hold a SHA3 digest or something. */
+    else if (tor_memneq(signed_data, d, DIGEST256_LEN))
+      err = "Signature did not match data to be signed.";
+    tor_free(signed_data);
+    return err;
+  } else {
+    ed25519_signature_t sig;
+    tor_assert(authlen > ED25519_SIG_LEN);
+    memcpy(&sig.sig, auth + authlen - ED25519_SIG_LEN, ED25519_SIG_LEN);
+    if (ed25519_checksig(&sig, auth, authlen - ED25519_SIG_LEN,
+                         &job->u.check_auth.ed_key) < 0)
+      return "Ed25519 signature wasn't valid.";
+    return NULL;
+  }
+}
+
+/** Do the public-key work for <b>job</b>.  This function only looks at the
+ * job itself, so it is safe to call from a cpuworker. */
+static void
+handshake_crypto_job_run(handshake_crypto_job_t *job)
+{
+  switch (job->op) {
+    case HANDSHAKE_CRYPTO_CHECK_CERTS:
+      /* Only the initiator's checks look at the TLS connection, and we
+       * never queue those. */
+      tor_assert(! job->u.check_certs.certs->started_here);
+      or_handshake_certs_check_both(job->u.check_certs.severity,
+                                    job->u.check_certs.certs,
+                                    NULL,
+                                    job->u.check_certs.now,
+                                    &job->u.check_certs.checked_ed_id,
+                                    &job->u.check_certs.checked_rsa_id);
+      break;
+    case HANDSHAKE_CRYPTO_CHECK_AUTHENTICATE:
+      job->u.check_auth.err = authenticate_cell_check_signature(job);
+      break;
+    case HANDSHAKE_CRYPTO_SIGN_AUTHENTICATE:
+      job->u.sign_auth.signed_cell =
+        connection_or_sign_authenticate_cell_body(job->u.sign_auth.cell,
+                                job->u.sign_auth.rsa_key,
+                                job->u.sign_auth.have_ed_key ?
+                                  &job->u.sign_auth.ed_key : NULL);
+      break;
+  }
+}
+
+/** Carry on with the handshake on <b>job</b>'s connection now that the
+ * public-key work in <b>job</b> is done. */
+static void
+handshake_crypto_job_finish(handshake_crypto_job_t *job)
+{
+  or_connection_t *conn = job->conn;
+  tor_assert(conn);
+
+  if (conn->base_.marked_for_close || !conn->chan)
+    return;
+
+  switch (job->op) {
+    case HANDSHAKE_CRYPTO_CHECK_CERTS:
+      tor_assert(conn->handshake_state->certs == NULL);
+      conn->handshake_state->certs = job->u.check_certs.certs;
+      job->u.check_certs.certs = NULL;
+      channel_tls_certs_cell_checked(conn->chan,
+                                     job->u.check_certs.checked_ed_id,
+                                     job->u.check_certs.checked_rsa_id);
+      break;
+    case HANDSHAKE_CRYPTO_CHECK_AUTHENTICATE:
+      channel_tls_authenticate_cell_checked(conn->chan,
+                                            job->u.check_auth.authtype,
+                                            job->u.check_auth.sig_is_rsa,
+                                            job->u.check_auth.err);
+      break;
+    case HANDSHAKE_CRYPTO_SIGN_AUTHENTICATE:
+      if (! job->u.sign_auth.signed_cell) {
+        log_warn(LD_OR, "Couldn't send authenticate cell");
+        connection_or_close_for_error(conn, 0);
+        break;
+      }
+      connection_or_write_var_cell_to_buf(job->u.sign_auth.signed_cell, conn);
+      if (connection_or_send_netinfo(conn) < 0) {
+        log_warn(LD_OR, "Couldn't send netinfo cell");
+        connection_or_close_for_error(conn, 0);
+      }
+      break;
+  }
+}
+
+/** Called in a cpuworker to do the work in a handshake_crypto_job_t. */
+static workqueue_reply_t
+handshake_crypto_threadfn(void *state_, void *job_)
+{
+  (void) state_;
+  handshake_crypto_job_run(job_);
+  return WQ_RPL_REPLY;
+}
+
+/** Called in the main thread when a cpuworker is done with a
+ * handshake_crypto_job_t: pick up the handshake where we left it, and
+ * go back to reading from the connection. */
+static void
+handshake_crypto_replyfn(void *job_)
+{
+  handshake_crypto_job_t *job = job_;
+  or_connection_t *conn = job->conn;
+
+  if (conn) {
+    tor_assert(conn->handshake_state);
+    tor_assert(conn->handshake_state->crypto_job == job);
+    conn->handshake_state->crypto_job = NULL;
+    handshake_crypto_job_finish(job);
+    if (! conn->base_.marked_for_close) {
+      if (! conn->base_.read_blocked_on_bw)
+        connection_start_reading(TO_CONN(conn));
+      /* Handle whatever the peer sent while we were waiting. */
+      connection_or_process_inbuf(conn);
+    }
+  }
+  handshake_crypto_job_free(job);
+}
+
+/** Try to hand <b>job</b> to a cpuworker, and stop reading from its
+ * connection until the cpuworker replies.  Return 0 on success, and -1 if
+ * there's no cpuworker to take it. On failure, the caller still owns
+ * <b>job</b>. */
+static int
+handshake_crypto_job_queue(handshake_crypto_job_t *job)
+{
+  or_connection_t *conn = job->conn;
+
+  if (! cpuworker_is_running())
+    return -1;
+
+  job->work = cpuworker_queue_work(WQ_PRI_HIGH,
+                                   handshake_crypto_threadfn,
+                                   handshake_crypto_replyfn,
+                                   job);
+  if (! job->work) {
+    log_warn(LD_BUG, "Couldn't queue link handshake work for a cpuworker.");
+    return -1;
+  }
+
+  conn->handshake_state->crypto_job = job;
+  connection_stop_reading(TO_CONN(conn));
+  return 0;
+}
+
+/** Do the work in <b>job</b> on a cpuworker if we can, or right now if we
+ * can't; either way, carry on with the handshake afterwards and take
+ * ownership of <b>job</b>. */
+static void
+handshake_crypto_job_start(handshake_crypto_job_t *job)
+{
+  if (handshake_crypto_job_queue(job) == 0)
+    return;
+
+  handshake_crypto_job_run(job);
+  handshake_crypto_job_finish(job);
+  handshake_crypto_job_free(job);
+}
+
+/** Called when the handshake state <b>state</b> is about to be freed: if
+ * there is handshake work pending for it, cancel the work if we can, or
+ * tell the cpuworker's reply to throw its result away if we can't. */
+void
+channel_tls_cancel_handshake_crypto(or_handshake_state_t *state)
+{
+  handshake_crypto_job_t *job = state->crypto_job;
+  if (! job)
+    return;
+
+  state->crypto_job = NULL;
+  if (cpuworker_cancel_work(job->work)) {
+    handshake_crypto_job_free(job);
+  } else {
+    /* It's already running; the reply will free it. */
+    job->conn = NULL;
+  }
+}
+
+/** Carry on with a CERTS cell on <b>chan</b> once the certificates in its
+ * handshake state have been checked.  <b>checked_ed_id</b> and
+ * <b>checked_rsa_id</b> are the identities they proved, as set by
+ * or_handshake_certs_check_both(). */
+static void
+channel_tls_certs_cell_checked(channel_tls_t *chan,
+                               const ed25519_public_key_t *checked_ed_id,
+                               const common_digests_t *checked_rsa_id)
+{
+  const int started_here = chan->conn->handshake_state->started_here;
+  tor_x509_cert_t *id_cert = chan->conn->handshake_state->certs->id_cert;
+  int send_netinfo = 0;
+
+#define ERR(s)                                                  \
+  do {                                                          \
+    log_fn(LOG_PROTOCOL_WARN, LD_PROTOCOL,                      \
+           "Received a bad CERTS cell from %s:%d: %s",          \
+           safe_str(chan->conn->base_.address),                 \
+           chan->conn->base_.port, (s));                        \
+    connection_or_close_for_error(chan->conn, 0);               \
+    return;                                                     \
+  } while (0)
+
+  if (!checked_rsa_id)
+    ERR("Invalid certificate chain!");
+
+  if (started_here) {
+    /* No more information is needed. */
+
+    chan->conn->handshake_state->authenticated = 1;
+    chan->conn->handshake_state->authenticated_rsa = 1;
+    {
+      const common_digests_t *id_digests = checked_rsa_id;
+      crypto_pk_t *identity_rcvd;
+      if (!id_digests)
+        ERR("Couldn't compute digests for key in ID cert");
+
+      identity_rcvd = tor_tls_cert_get_key(id_cert);
+      if (!identity_rcvd) {
+        ERR("Couldn't get RSA key from ID cert.");
+      }
+      memcpy(chan->conn->handshake_state->authenticated_rsa_peer_id,
+             id_digests->d[DIGEST_SHA1], DIGEST_LEN);
+      channel_set_circid_type(TLS_CHAN_TO_BASE(chan), identity_rcvd,
+                chan->conn->link_proto < MIN_LINK_PROTO_FOR_WIDE_CIRC_IDS);
+      crypto_pk_free(identity_rcvd);
+    }
+
+    if (checked_ed_id) {
+      chan->conn->handshake_state->authenticated_ed25519 = 1;
+      memcpy(&chan->conn->handshake_state->authenticated_ed25519_peer_id,
+             checked_ed_id, sizeof(ed25519_public_key_t));
+    }
+
+    log_debug(LD_HANDSHAKE, "calling client_learned_peer_id from "
+              "process_certs_cell");
+
+    if (connection_or_client_learned_peer_id(chan->conn,
+                  chan->conn->handshake_state->authenticated_rsa_peer_id,
+                  checked_ed_id) < 0)
+      ERR("Problem setting or checking peer id");
+
+    log_info(LD_HANDSHAKE,
+             "Got some good certificates from %s:%d: Authenticated it with "
+             "RSA%s",
+             safe_str(chan->conn->base_.address), chan->conn->base_.port,
+             checked_ed_id ? " and Ed25519" : "");
+
+    if (!public_server_mode(get_options())) {
+      /* If we initiated the connection and we are not a public server, we
+       * aren't planning to authenticate at all.  At this point we know who we
+       * are talking to, so we can just send a netinfo now. */
+      send_netinfo = 1;
+    }
+  } else {
+    /* We can't call it authenticated till we see an AUTHENTICATE cell. */
+    log_info(LD_OR,
+             "Got some good RSA%s certificates from %s:%d. "
+             "Waiting for AUTHENTICATE.",
+             checked_ed_id ? " and Ed25519" : "",
+             safe_str(chan->conn->base_.address),
+             chan->conn->base_.port);
+    /* XXXX check more stuff? */
+  }
+
+  chan->conn->handshake_state->received_certs_cell = 1;
+
+  if (send_netinfo) {
+    if (connection_or_send_netinfo(chan->conn) < 0) {
+      log_warn(LD_OR, "Couldn't send netinfo cell");
+      connection_or_close_for_error(chan->conn, 0);
+      return;
+    }
+  }
+
+#undef ERR
+}
+
 /**
  * Process a CERTS cell from a channel.
  *
@@ -1932,7 +2343,7 @@ channel_tls_process_certs_cell(var_cell_t *cell, channel_tls_t *chan)
   int n_certs, i;
   certs_cell_t *cc = NULL;
 
-  int send_netinfo = 0, started_here = 0;
+  int started_here = 0;
 
   memset(x509_certs, 0, sizeof(x509_certs));
   memset(ed_certs, 0, sizeof(ed_certs));
@@ -2074,85 +2485,26 @@ channel_tls_process_certs_cell(var_cell_t *cell, channel_tls_t *chan)
   else
     severity = LOG_PROTOCOL_WARN;
 
-  const ed25519_public_key_t *checked_ed_id = NULL;
-  const common_digests_t *checked_rsa_id = NULL;
-  or_handshake_certs_check_both(severity,
-                                chan->conn->handshake_state->certs,
-                                chan->conn->tls,
-                                time(NULL),
-                                &checked_ed_id,
-                                &checked_rsa_id);
-
-  if (!checked_rsa_id)
-    ERR("Invalid certificate chain!");
-
   if (started_here) {
-    /* No more information is needed. */
-
-    chan->conn->handshake_state->authenticated = 1;
-    chan->conn->handshake_state->authenticated_rsa = 1;
-    {
-      const common_digests_t *id_digests = checked_rsa_id;
-      crypto_pk_t *identity_rcvd;
-      if (!id_digests)
-        ERR("Couldn't compute digests for key in ID cert");
-
-      identity_rcvd = tor_tls_cert_get_key(id_cert);
-      if (!identity_rcvd) {
-        ERR("Couldn't get RSA key from ID cert.");
-      }
-      memcpy(chan->conn->handshake_state->authenticated_rsa_peer_id,
-             id_digests->d[DIGEST_SHA1], DIGEST_LEN);
-      channel_set_circid_type(TLS_CHAN_TO_BASE(chan), identity_rcvd,
-                chan->conn->link_proto < MIN_LINK_PROTO_FOR_WIDE_CIRC_IDS);
-      crypto_pk_free(identity_rcvd);
-    }
-
-    if (checked_ed_id) {
-      chan->conn->handshake_state->authenticated_ed25519 = 1;
-      memcpy(&chan->conn->handshake_state->authenticated_ed25519_peer_id,
-             checked_ed_id, sizeof(ed25519_public_key_t));
-    }
-
-    log_debug(LD_HANDSHAKE, "calling client_learned_peer_id from "
-              "process_certs_cell");
-
-    if (connection_or_client_learned_peer_id(chan->conn,
-                  chan->conn->handshake_state->authenticated_rsa_peer_id,
-                  checked_ed_id) < 0)
-      ERR("Problem setting or checking peer id");
-
-    log_info(LD_HANDSHAKE,
-             "Got some good certificates from %s:%d: Authenticated it with "
-             "RSA%s",
-             safe_str(chan->conn->base_.address), chan->conn->base_.port,
-             checked_ed_id ? " and Ed25519" : "");
-
-    if (!public_server_mode(get_options())) {
-      /* If we initiated the connection and we are not a public server, we
-       * aren't planning to authenticate at all.  At this point we know who we
-       * are talking to, so we can just send a netinfo now. */
-      send_netinfo = 1;
-    }
+    const ed25519_public_key_t *checked_ed_id = NULL;
+    const common_digests_t *checked_rsa_id = NULL;
+    or_handshake_certs_check_both(severity,
+                                  chan->conn->handshake_state->certs,
+                                  chan->conn->tls,
+                                  time(NULL),
+                                  &checked_ed_id,
+                                  &checked_rsa_id);
+    channel_tls_certs_cell_checked(chan, checked_ed_id, checked_rsa_id);
   } else {
-    /* We can't call it authenticated till we see an AUTHENTICATE cell. */
-    log_info(LD_OR,
-             "Got some good RSA%s certificates from %s:%d. "
-             "Waiting for AUTHENTICATE.",
-             checked_ed_id ? " and Ed25519" : "",
-             safe_str(chan->conn->base_.address),
-             chan->conn->base_.port);
-    /* XXXX check more stuff? */
-  }
-
-  chan->conn->handshake_state->received_certs_cell = 1;
-
-  if (send_netinfo) {
-    if (connection_or_send_netinfo(chan->conn) < 0) {
-      log_warn(LD_OR, "Couldn't send netinfo cell");
-      connection_or_close_for_error(chan->conn, 0);
-      goto err;
-    }
+    /* As responder, we don't need the TLS connection to check the
+     * certificates, so a cpuworker can do it. */
+    handshake_crypto_job_t *job =
+      handshake_crypto_job_new(HANDSHAKE_CRYPTO_CHECK_CERTS, chan->conn);
+    job->u.check_certs.certs = chan->conn->handshake_state->certs;
+    job->u.check_certs.severity = severity;
+    job->u.check_certs.now = time(NULL);
+    chan->conn->handshake_state->certs = NULL;
+    handshake_crypto_job_start(job);
   }
 
  err:
@@ -2167,6 +2519,42 @@ channel_tls_process_certs_cell(var_cell_t *cell, channel_tls_t *chan)
 #undef ERR
 }
 
+/** If we can, start a cpuworker signing an AUTHENTICATE cell of type
+ * <b>authtype</b> for <b>conn</b>; once it's done, we'll send that cell and
+ * a NETINFO cell.  Return 0 on success, and -1 if the caller should send
+ * the cells itself. */
+static int
+channel_tls_queue_authenticate_cell(or_connection_t *conn, int authtype)
+{
+  crypto_pk_t *pk = tor_tls_get_my_client_auth_key();
+  const ed25519_keypair_t *ed_key = get_current_auth_keypair();
+  handshake_crypto_job_t *job;
+  var_cell_t *cell;
+
+  if (! cpuworker_is_running() || ! pk ||
+      ! authchallenge_type_is_supported(authtype))
+    return -1;
+
+  cell = connection_or_compute_authenticate_cell_body(conn, authtype,
+                                                      NULL, NULL, 0);
+  if (! cell)
+    return -1;
+
+  job = handshake_crypto_job_new(HANDSHAKE_CRYPTO_SIGN_AUTHENTICATE, conn);
+  job->u.sign_auth.cell = cell;
+  job->u.sign_auth.rsa_key = crypto_pk_dup_key(pk);
+  if (ed_key) {
+    job->u.sign_auth.have_ed_key = 1;
+    memcpy(&job->u.sign_auth.ed_key, ed_key, sizeof(*ed_key));
+  }
+
+  if (handshake_crypto_job_queue(job) < 0) {
+    handshake_crypto_job_free(job);
+    return -1;
+  }
+  return 0;
+}
+
 /**
  * Process an AUTH_CHALLENGE cell from a channel_tls_t
  *
@@ -2244,6 +2632,11 @@ channel_tls_process_auth_challenge_cell(var_cell_t *cell, channel_tls_t *chan)
              chan->conn->base_.port,
              use_type);
 
+    if (channel_tls_queue_authenticate_cell(chan->conn, use_type) == 0) {
+      /* We'll send the NETINFO cell once the cpuworker has signed the
+       * AUTHENTICATE cell. */
+      goto done;
+    }
     if (connection_or_send_authenticate_cell(chan->conn, use_type) < 0) {
       log_warn(LD_OR,
                "Couldn't send authenticate cell");
@@ -2270,6 +2663,74 @@ channel_tls_process_auth_challenge_cell(var_cell_t *cell, channel_tls_t *chan)
 #undef ERR
 }
 
+/** Carry on with an AUTHENTICATE cell of type <b>authtype</b> on
+ * <b>chan</b> once its signature has been checked.  <b>err</b> is NULL if
+ * the signature was good, and a description of the problem otherwise. */
+static void
+channel_tls_authenticate_cell_checked(channel_tls_t *chan, int authtype,
+                                      int sig_is_rsa, const char *err)
+{
+  if (err) {
+    log_fn(LOG_PROTOCOL_WARN, LD_PROTOCOL,
+           "Received a bad AUTHENTICATE cell from %s:%d: %s",
+           safe_str(chan->conn->base_.address),
+           chan->conn->base_.port, err);
+    connection_or_close_for_error(chan->conn, 0);
+    return;
+  }
+
+  /* Okay, we are authenticated. */
+  chan->conn->handshake_state->received_authenticate = 1;
+  chan->conn->handshake_state->authenticated = 1;
+  chan->conn->handshake_state->authenticated_rsa = 1;
+  chan->conn->handshake_state->digest_received_data = 0;
+  {
+    tor_x509_cert_t *id_cert = chan->conn->handshake_state->certs->id_cert;
+    crypto_pk_t *identity_rcvd = tor_tls_cert_get_key(id_cert);
+    const common_digests_t *id_digests = tor_x509_cert_get_id_digests(id_cert);
+    const ed25519_public_key_t *ed_identity_received = NULL;
+
+    if (! sig_is_rsa) {
+      chan->conn->handshake_state->authenticated_ed25519 = 1;
+      ed_identity_received =
+        &chan->conn->handshake_state->certs->ed_id_sign->signing_key;
+      memcpy(&chan->conn->handshake_state->authenticated_ed25519_peer_id,
+             ed_identity_received, sizeof(ed25519_public_key_t));
+    }
+
+    /* This must exist; we checked key type when reading the cert. */
+    tor_assert(id_digests);
+
+    memcpy(chan->conn->handshake_state->authenticated_rsa_peer_id,
+           id_digests->d[DIGEST_SHA1], DIGEST_LEN);
+
+    channel_set_circid_type(TLS_CHAN_TO_BASE(chan), identity_rcvd,
+               chan->conn->link_proto < MIN_LINK_PROTO_FOR_WIDE_CIRC_IDS);
+    crypto_pk_free(identity_rcvd);
+
+    log_debug(LD_HANDSHAKE,
+              "Calling connection_or_init_conn_from_address for %s "
+              " from %s, with%s ed25519 id.",
+              safe_str(chan->conn->base_.address),
+              __func__,
+              ed_identity_received ? "" : "out");
+
+    connection_or_init_conn_from_address(chan->conn,
+                  &(chan->conn->base_.addr),
+                  chan->conn->base_.port,
+                  (const char*)(chan->conn->handshake_state->
+                    authenticated_rsa_peer_id),
+                  ed_identity_received,
+                  0);
+
+    log_debug(LD_HANDSHAKE,
+             "Got an AUTHENTICATE cell from %s:%d, type %d: Looks good.",
+             safe_str(chan->conn->base_.address),
+             chan->conn->base_.port,
+             authtype);
+  }
+}
+
 /**
  * Process an AUTHENTICATE cell from a channel_tls_t
  *
@@ -2373,6 +2834,7 @@ channel_tls_process_authenticate_cell(var_cell_t *cell, channel_tls_t *chan)
   if (tor_memneq(expected_cell->payload+4, auth, bodylen-24))
     ERR("Some field in the AUTHENTICATE cell body was not as expected");
 
+  handshake_crypto_job_t *job;
   if (sig_is_rsa) {
     if (chan->conn->handshake_state->certs->ed_id_sign != NULL)
       ERR("RSA-signed AUTHENTICATE response provided with an ED25519 cert");
@@ -2382,105 +2844,31 @@ channel_tls_process_authenticate_cell(var_cell_t *cell, channel_tls_t *chan)
 
     crypto_pk_t *pk = tor_tls_cert_get_key(
                              chan->conn->handshake_state->certs->auth_cert);
-    char d[DIGEST256_LEN];
-    char *signed_data;
-    size_t keysize;
-    int signed_len;
-
     if (! pk) {
       ERR("Couldn't get RSA key from AUTH cert.");
     }
-    crypto_digest256(d, (char*)auth, V3_AUTH_BODY_LEN, DIGEST_SHA256);
-
-    keysize = crypto_pk_keysize(pk);
-    signed_data = tor_malloc(keysize);
-    signed_len = crypto_pk_public_checksig(pk, signed_data, keysize,
-                                           (char*)auth + V3_AUTH_BODY_LEN,
-                                           authlen - V3_AUTH_BODY_LEN);
-    crypto_pk_free(pk);
-    if (signed_len < 0) {
-      tor_free(signed_data);
-      ERR("RSA signature wasn't valid");
-    }
-    if (signed_len < DIGEST256_LEN) {
-      tor_free(signed_data);
-      ERR("Not enough data was signed");
-    }
-    /* Note that we deliberately allow *more* than DIGEST256_LEN bytes here,
-     * in case they're later used to hold a SHA3 digest or something. */
-    if (tor_memneq(signed_data, d, DIGEST256_LEN)) {
-      tor_free(signed_data);
-      ERR("Signature did not match data to be signed.");
-    }
-    tor_free(signed_data);
+    job = handshake_crypto_job_new(HANDSHAKE_CRYPTO_CHECK_AUTHENTICATE,
+                                   chan->conn);
+    job->u.check_auth.rsa_key = pk;
   } else {
     if (chan->conn->handshake_state->certs->ed_id_sign == NULL)
       ERR("We never got an Ed25519 identity certificate.");
     if (chan->conn->handshake_state->certs->ed_sign_auth == NULL)
       ERR("We never got an Ed25519 authentication certificate.");
 
-    const ed25519_public_key_t *authkey =
-      &chan->conn->handshake_state->certs->ed_sign_auth->signed_key;
-    ed25519_signature_t sig;
-    tor_assert(authlen > ED25519_SIG_LEN);
-    memcpy(&sig.sig, auth + authlen - ED25519_SIG_LEN, ED25519_SIG_LEN);
-    if (ed25519_checksig(&sig, auth, authlen - ED25519_SIG_LEN, authkey)<0) {
-      ERR("Ed25519 signature wasn't valid.");
-    }
-  }
-
-  /* Okay, we are authenticated. */
-  chan->conn->handshake_state->received_authenticate = 1;
-  chan->conn->handshake_state->authenticated = 1;
-  chan->conn->handshake_state->authenticated_rsa = 1;
-  chan->conn->handshake_state->digest_received_data = 0;
-  {
-    tor_x509_cert_t *id_cert = chan->conn->handshake_state->certs->id_cert;
-    crypto_pk_t *identity_rcvd = tor_tls_cert_get_key(id_cert);
-    const common_digests_t *id_digests = tor_x509_cert_get_id_digests(id_cert);
-    const ed25519_public_key_t *ed_identity_received = NULL;
-
-    if (! sig_is_rsa) {
-      chan->conn->handshake_state->authenticated_ed25519 = 1;
-      ed_identity_received =
-        &chan->conn->handshake_state->certs->ed_id_sign->signing_key;
-      memcpy(&chan->conn->handshake_state->authenticated_ed25519_peer_id,
-             ed_identity_received, sizeof(ed25519_public_key_t));
-    }
-
-    /* This must exist; we checked key type when reading the cert. */
-    tor_assert(id_digests);
-
-    memcpy(chan->conn->handshake_state->authenticated_rsa_peer_id,
-           id_digests->d[DIGEST_SHA1], DIGEST_LEN);
-
-    channel_set_circid_type(TLS_CHAN_TO_BASE(chan), identity_rcvd,
-               chan->conn->link_proto < MIN_LINK_PROTO_FOR_WIDE_CIRC_IDS);
-    crypto_pk_free(identity_rcvd);
-
-    log_debug(LD_HANDSHAKE,
-              "Calling connection_or_init_conn_from_address for %s "
-              " from %s, with%s ed25519 id.",
-              safe_str(chan->conn->base_.address),
-              __func__,
-              ed_identity_received ? "" : "out");
-
-    connection_or_init_conn_from_address(chan->conn,
-                  &(chan->conn->base_.addr),
-                  chan->conn->base_.port,
-                  (const char*)(chan->conn->handshake_state->
-                    authenticated_rsa_peer_id),
-                  ed_identity_received,
-                  0);
-
-    log_debug(LD_HANDSHAKE,
-             "Got an AUTHENTICATE cell from %s:%d, type %d: Looks good.",
-             safe_str(chan->conn->base_.address),
-             chan->conn->base_.port,
-             authtype);
+    job = handshake_crypto_job_new(HANDSHAKE_CRYPTO_CHECK_AUTHENTICATE,
+                                   chan->conn);
+    memcpy(&job->u.check_auth.ed_key,
+           &chan->conn->handshake_state->certs->ed_sign_auth->signed_key,
+           sizeof(ed25519_public_key_t));
   }
+  job->u.check_auth.authtype = authtype;
+  job->u.check_auth.sig_is_rsa = sig_is_rsa;
+  job->u.check_auth.auth = tor_memdup(auth, authlen);
+  job->u.check_auth.authlen = authlen;
 
   var_cell_free(expected_cell);
+  handshake_crypto_job_start(job);
 
 #undef ERR
 }
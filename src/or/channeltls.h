@@ -49,6 +49,7 @@ void channel_tls_handle_state_change_on_orconn(channel_tls_t *chan,
 void channel_tls_handle_var_cell(var_cell_t *var_cell,
                                  or_connection_t *conn);
 void channel_tls_update_marks(or_connection_t *conn);
+void channel_tls_cancel_handshake_crypto(or_handshake_state_t *state);
 
 /* Cleanup at shutdown */
 void channel_tls_free_all(void);
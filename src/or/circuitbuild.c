@@ -486,6 +486,8 @@ origin_circuit_init(uint8_t purpose, int flags)
   circ->build_state->is_internal =
     ((flags & CIRCLAUNCH_IS_INTERNAL) ? 1 : 0);
   circ->base_.purpose = purpose;
+  circuit_update_purpose_index(circ);
+  circuit_build_deadline_update(circ);
   return circ;
 }
 
@@ -1816,6 +1818,54 @@ node_handles_some_port(const node_t *node, smartlist_t *needed_ports)
   return 0;
 }
 
+/** Return a newly allocated bitarray, indexed by nodelist_idx, of the nodes
+ * that can handle one or more of the ports in <b>needed_ports</b>.  Return
+ * NULL if the nodelist can't tell us about some port; the caller should use
+ * node_handles_some_port() instead. */
+static bitarray_t *
+nodes_handling_some_port(smartlist_t *needed_ports, int n_nodes)
+{
+  const int n_words = (n_nodes + BITARRAY_MASK) >> BITARRAY_SHIFT;
+  bitarray_t *result = bitarray_init_zero(n_nodes);
+  int i;
+
+  SMARTLIST_FOREACH_BEGIN(needed_ports, uint16_t *, cp) {
+    bitarray_t *port_set = nodelist_get_exit_port_set(*cp);
+    if (!port_set) {
+      bitarray_free(result);
+      return NULL;
+    }
+    for (i = 0; i < n_words; ++i)
+      result[i] |= port_set[i];
+  } SMARTLIST_FOREACH_END(cp);
+
+  return result;
+}
+
+/** Return the nodelist's exit port set for the port of <b>conn</b>, if
+ * membership in that set alone tells whether connection_ap_can_use_exit()
+ * would accept a node that choose_good_exit_server_general() is willing to
+ * consider.  Otherwise return NULL.
+ *
+ * That holds for CONNECT streams to a hostname that haven't asked for an
+ * IPv6-only exit: those are checked against each node's policy with no
+ * address at all. */
+static bitarray_t *
+ap_stream_get_exit_port_set(const entry_connection_t *conn)
+{
+  const socks_request_t *req = conn->socks_request;
+  tor_addr_t addr;
+
+  if (req->command != SOCKS_COMMAND_CONNECT || !req->port)
+    return NULL;
+  if (tor_addr_parse(&addr, req->address) == 0)
+    return NULL;
+  if (!conn->entry_cfg.ipv4_traffic && conn->entry_cfg.ipv6_traffic)
+    return NULL;
+
+  return nodelist_get_exit_port_set(req->port);
+}
+
 /** Return true iff <b>conn</b> needs another general circuit to be
  * built. */
 static int
@@ -1851,7 +1901,7 @@ choose_good_exit_server_general(int need_uptime, int need_capacity)
 {
   int *n_supported;
   int n_pending_connections = 0;
-  smartlist_t *connections;
+  smartlist_t *connections, *pending, *pending_port_sets;
   int best_support = -1;
   int n_best_support=0;
   const or_options_t *options = get_options();
@@ -1860,14 +1910,21 @@ choose_good_exit_server_general(int need_uptime, int need_capacity)
 
   connections = get_connection_array();
 
-  /* Count how many connections are waiting for a circuit to be built.
-   * We use this for log messages now, but in the future we may depend on it.
+  /* Find the connections that are waiting for a circuit to be built, and
+   * for each one, the set of nodes that could handle it if its port alone
+   * decides that.
    */
+  pending = smartlist_new();
+  pending_port_sets = smartlist_new();
   SMARTLIST_FOREACH(connections, connection_t *, conn,
   {
-    if (ap_stream_wants_exit_attention(conn))
-      ++n_pending_connections;
+    if (ap_stream_wants_exit_attention(conn)) {
+      smartlist_add(pending, conn);
+      smartlist_add(pending_port_sets,
+                    ap_stream_get_exit_port_set(TO_ENTRY_CONN(conn)));
+    }
   });
+  n_pending_connections = smartlist_len(pending);
 //  log_fn(LOG_DEBUG, "Choosing exit node; %d connections are pending",
 //         n_pending_connections);
   /* Now we count, for each of the routers in the directory, how many
@@ -1939,11 +1996,11 @@ choose_good_exit_server_general(int need_uptime, int need_capacity)
       continue; /* skip routers that reject all */
     }
     n_supported[i] = 0;
-    /* iterate over connections */
-    SMARTLIST_FOREACH_BEGIN(connections, connection_t *, conn) {
-      if (!ap_stream_wants_exit_attention(conn))
-        continue; /* Skip everything but APs in CIRCUIT_WAIT */
-      if (connection_ap_can_use_exit(TO_ENTRY_CONN(conn), node)) {
+    /* iterate over pending connections */
+    SMARTLIST_FOREACH_BEGIN(pending, connection_t *, conn) {
+      bitarray_t *port_set = smartlist_get(pending_port_sets, conn_sl_idx);
+      if (port_set ? bitarray_is_set(port_set, i) != 0 :
+          connection_ap_can_use_exit(TO_ENTRY_CONN(conn), node)) {
         ++n_supported[i];
 //        log_fn(LOG_DEBUG,"%s is supported. n_supported[%d] now %d.",
 //               router->nickname, i, n_supported[i]);
@@ -1993,6 +2050,7 @@ choose_good_exit_server_general(int need_uptime, int need_capacity)
 
     int attempt;
     smartlist_t *needed_ports, *supporting;
+    bitarray_t *handles_needed;
 
     if (best_support == -1) {
       if (need_uptime || need_capacity) {
@@ -2002,6 +2060,8 @@ choose_good_exit_server_general(int need_uptime, int need_capacity)
                  need_capacity?", fast":"",
                  need_uptime?", stable":"");
         tor_free(n_supported);
+        smartlist_free(pending);
+        smartlist_free(pending_port_sets);
         return choose_good_exit_server_general(0, 0);
       }
       log_notice(LD_CIRC, "All routers are down or won't exit%s -- "
@@ -2010,12 +2070,17 @@ choose_good_exit_server_general(int need_uptime, int need_capacity)
     }
     supporting = smartlist_new();
     needed_ports = circuit_get_unhandled_ports(time(NULL));
+    handles_needed = nodes_handling_some_port(needed_ports,
+                                              smartlist_len(the_nodes));
     for (attempt = 0; attempt < 2; attempt++) {
       /* try once to pick only from routers that satisfy a needed port,
        * then if there are none, pick from any that support exiting. */
       SMARTLIST_FOREACH_BEGIN(the_nodes, const node_t *, node) {
         if (n_supported[node_sl_idx] != -1 &&
-            (attempt || node_handles_some_port(node, needed_ports))) {
+            (attempt ||
+             (handles_needed ?
+              bitarray_is_set(handles_needed, node_sl_idx) != 0 :
+              node_handles_some_port(node, needed_ports)))) {
 //          log_fn(LOG_DEBUG,"Try %d: '%s' is a possibility.",
 //                 try, router->nickname);
           smartlist_add(supporting, (void*)node);
@@ -2034,9 +2099,12 @@ choose_good_exit_server_general(int need_uptime, int need_capacity)
     SMARTLIST_FOREACH(needed_ports, uint16_t *, cp, tor_free(cp));
     smartlist_free(needed_ports);
     smartlist_free(supporting);
+    bitarray_free(handles_needed);
   }
 
   tor_free(n_supported);
+  smartlist_free(pending);
+  smartlist_free(pending_port_sets);
   if (selected_node) {
     log_info(LD_CIRC, "Chose exit server '%s'", node_describe(selected_node));
     return selected_node;
@@ -2611,12 +2679,11 @@ onion_extend_cpath(origin_circuit_t *circ)
 static int
 onion_append_hop(crypt_path_t **head_ptr, extend_info_t *choice)
 {
-  crypt_path_t *hop = tor_malloc_zero(sizeof(crypt_path_t));
+  crypt_path_t *hop = crypt_path_new();
 
   /* link hop into the cpath, at the end. */
   onion_append_to_cpath(head_ptr, hop);
 
-  hop->magic = CRYPT_PATH_MAGIC;
   hop->state = CPATH_STATE_CLOSED;
 
   hop->extend_info = extend_info_dup(choice);
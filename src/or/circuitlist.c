@@ -80,6 +80,7 @@
 #include "routerlist.h"
 #include "routerset.h"
 #include "channelpadding.h"
+#include "objpool.h"
 
 #include "ht.h"
 
@@ -92,6 +93,11 @@ static smartlist_t *global_circuitlist = NULL;
  * an element of global_circuitlist. */
 static smartlist_t *global_origin_circuit_list = NULL;
 
+/** For each origin circuit purpose, a list of all the origin circuits in
+ * global_origin_circuit_list with that purpose, in no particular order. */
+static struct origin_circuit_purpose_list_s
+  origin_circuits_by_purpose[CIRCUIT_PURPOSE_MAX_ + 1];
+
 /** A list of all the circuits in CIRCUIT_STATE_CHAN_WAIT. */
 static smartlist_t *circuits_pending_chans = NULL;
 
@@ -103,64 +109,186 @@ static smartlist_t *circuits_pending_other_guards = NULL;
  * circuit_mark_for_close and which are waiting for circuit_about_to_free. */
 static smartlist_t *circuits_pending_close = NULL;
 
-static void circuit_free_cpath_node(crypt_path_t *victim);
+/** Pools for the objects that make up a circuit.  Relays allocate and free
+ * these constantly, so we carve them from chunks instead of the heap.
+ * Each is created on first use. */
+static objpool_t *origin_circuit_pool = NULL;
+static objpool_t *or_circuit_pool = NULL;
+static objpool_t *crypt_path_pool = NULL;
+
+/** Don't keep more than 1/OBJPOOL_IDLE_FRACTION of MaxMemInQueues in pool
+ * chunks that hold no live objects. */
+#define OBJPOOL_IDLE_FRACTION 64
+
 static void cpath_ref_decref(crypt_path_reference_t *cpath_ref);
 static void circuit_about_to_free_atexit(circuit_t *circ);
 static void circuit_about_to_free(circuit_t *circ);
 
 /********* END VARIABLES ************/
 
-/** A map from channel and circuit ID to circuit.  (Lookup performance is
- * very important here, since we need to do it every time a cell arrives.) */
+/** An entry in chan_circid_map: maps a channel and circuit ID to a circuit,
+ * or to nothing while the ID is reserved.  (Lookup performance is very
+ * important here, since we need to do it every time a cell arrives.) */
 typedef struct chan_circid_circuit_map_t {
-  HT_ENTRY(chan_circid_circuit_map_t) node;
-  channel_t *chan;
+  /** Global identifier of the channel. */
+  uint64_t chan_id;
   circid_t circ_id;
+  /** True iff this slot of the table holds an entry. */
+  uint8_t in_use;
   circuit_t *circuit;
   /* For debugging 12184: when was this placeholder item added? */
   time_t made_placeholder_at;
 } chan_circid_circuit_map_t;
 
-/** Helper for hash tables: compare the channel and circuit ID for a and
- * b, and return less than, equal to, or greater than zero appropriately.
- */
-static inline int
-chan_circid_entries_eq_(chan_circid_circuit_map_t *a,
-                        chan_circid_circuit_map_t *b)
+/** Number of slots chan_circid_map starts out with.  Must be a power of
+ * two. */
+#define CHAN_CIRCID_MAP_INITIAL_SLOTS 1024
+
+/** Map from [chan,circid] to circuit: an open-addressing table with linear
+ * probing, whose entries live in the table itself. */
+static struct {
+  /** Array of <b>n_slots</b> entries; n_slots is a power of two. */
+  chan_circid_circuit_map_t *slots;
+  unsigned n_slots;
+  /** How many slots are in use. */
+  unsigned n_used;
+} chan_circid_map = { NULL, 0, 0 };
+
+/** Helper: return the slot where the search for <b>chan_id</b>,
+ * <b>circ_id</b> starts in chan_circid_map. */
+static inline unsigned
+chan_circid_slot_idx(uint64_t chan_id, circid_t circ_id)
+{
+  /* Peers pick their circuit IDs, so keep the hash keyed; but squeeze the
+   * siphash input into 8 bytes to save any extra siphash rounds.  This hash
+   * function is in the critical path. */
+  uint32_t array[2];
+  array[0] = circ_id;
+  array[1] = (uint32_t) chan_id;
+  return (unsigned) siphash24g(array, sizeof(array)) &
+    (chan_circid_map.n_slots - 1);
+}
+
+/** Return the entry for <b>circ_id</b> on <b>chan</b> in chan_circid_map,
+ * or NULL if there is none.  The pointer is good until the next change to
+ * the map. */
+static chan_circid_circuit_map_t *
+chan_circid_map_find(const channel_t *chan, circid_t circ_id)
 {
-  return a->chan == b->chan && a->circ_id == b->circ_id;
+  const unsigned mask = chan_circid_map.n_slots - 1;
+  unsigned idx;
+
+  if (chan_circid_map.n_used == 0)
+    return NULL;
+
+  idx = chan_circid_slot_idx(chan->global_identifier, circ_id);
+  for (;;) {
+    chan_circid_circuit_map_t *ent = &chan_circid_map.slots[idx];
+    if (!ent->in_use)
+      return NULL;
+    if (ent->circ_id == circ_id && ent->chan_id == chan->global_identifier)
+      return ent;
+    idx = (idx + 1) & mask;
+  }
 }
 
-/** Helper: return a hash based on circuit ID and the pointer value of
- * chan in <b>a</b>. */
-static inline unsigned int
-chan_circid_entry_hash_(chan_circid_circuit_map_t *a)
+/** Helper: put <b>ent</b> into the first free slot along its probe
+ * sequence. */
+static void
+chan_circid_map_place(const chan_circid_circuit_map_t *ent)
 {
-  /* Try to squeze the siphash input into 8 bytes to save any extra siphash
-   * rounds.  This hash function is in the critical path. */
-  uintptr_t chan = (uintptr_t) (void*) a->chan;
-  uint32_t array[2];
-  array[0] = a->circ_id;
-  /* The low bits of the channel pointer are uninteresting, since the channel
-   * is a pretty big structure. */
-  array[1] = (uint32_t) (chan >> 6);
-  return (unsigned) siphash24g(array, sizeof(array));
-}
-
-/** Map from [chan,circid] to circuit. */
-static HT_HEAD(chan_circid_map, chan_circid_circuit_map_t)
-     chan_circid_map = HT_INITIALIZER();
-HT_PROTOTYPE(chan_circid_map, chan_circid_circuit_map_t, node,
-             chan_circid_entry_hash_, chan_circid_entries_eq_)
-HT_GENERATE2(chan_circid_map, chan_circid_circuit_map_t, node,
-             chan_circid_entry_hash_, chan_circid_entries_eq_, 0.6,
-             tor_reallocarray_, tor_free_)
-
-/** The most recently returned entry from circuit_get_by_circid_chan;
- * used to improve performance when many cells arrive in a row from the
- * same circuit.
- */
-static chan_circid_circuit_map_t *_last_circid_chan_ent = NULL;
+  const unsigned mask = chan_circid_map.n_slots - 1;
+  unsigned idx = chan_circid_slot_idx(ent->chan_id, ent->circ_id);
+  while (chan_circid_map.slots[idx].in_use)
+    idx = (idx + 1) & mask;
+  chan_circid_map.slots[idx] = *ent;
+}
+
+/** Make chan_circid_map big enough to take one more entry while staying
+ * at most half full. */
+static void
+chan_circid_map_reserve_one(void)
+{
+  chan_circid_circuit_map_t *old_slots = chan_circid_map.slots;
+  unsigned old_n_slots = chan_circid_map.n_slots, i;
+
+  if (old_slots && (chan_circid_map.n_used + 1) * 2 <= old_n_slots)
+    return;
+
+  chan_circid_map.n_slots = old_slots ? old_n_slots * 2
+                                      : CHAN_CIRCID_MAP_INITIAL_SLOTS;
+  chan_circid_map.slots = tor_calloc(chan_circid_map.n_slots,
+                                     sizeof(chan_circid_circuit_map_t));
+  for (i = 0; i < old_n_slots; ++i) {
+    if (old_slots[i].in_use)
+      chan_circid_map_place(&old_slots[i]);
+  }
+  tor_free(old_slots);
+}
+
+/** Return the entry for <b>circ_id</b> on <b>chan</b> in chan_circid_map,
+ * adding an empty one if there is none.  The pointer is good until the next
+ * change to the map. */
+static chan_circid_circuit_map_t *
+chan_circid_map_find_or_add(const channel_t *chan, circid_t circ_id)
+{
+  chan_circid_circuit_map_t *ent = chan_circid_map_find(chan, circ_id);
+  unsigned mask, idx;
+
+  if (ent)
+    return ent;
+
+  chan_circid_map_reserve_one();
+  mask = chan_circid_map.n_slots - 1;
+  idx = chan_circid_slot_idx(chan->global_identifier, circ_id);
+  while (chan_circid_map.slots[idx].in_use)
+    idx = (idx + 1) & mask;
+  ent = &chan_circid_map.slots[idx];
+  memset(ent, 0, sizeof(*ent));
+  ent->chan_id = chan->global_identifier;
+  ent->circ_id = circ_id;
+  ent->in_use = 1;
+  ++chan_circid_map.n_used;
+  return ent;
+}
+
+/** Remove <b>ent</b> from chan_circid_map, moving back any entries whose
+ * probe sequence ran through its slot so that no tombstone is needed. */
+static void
+chan_circid_map_remove(chan_circid_circuit_map_t *ent)
+{
+  const unsigned mask = chan_circid_map.n_slots - 1;
+  unsigned hole = (unsigned) (ent - chan_circid_map.slots);
+  unsigned idx = hole;
+
+  for (;;) {
+    chan_circid_circuit_map_t *next;
+    unsigned home;
+    idx = (idx + 1) & mask;
+    next = &chan_circid_map.slots[idx];
+    if (!next->in_use)
+      break;
+    home = chan_circid_slot_idx(next->chan_id, next->circ_id);
+    /* Leave <b>next</b> alone if its home slot lies cyclically in
+     * (hole, idx]: moving it to the hole would put it before its home. */
+    if (((idx - home) & mask) < ((idx - hole) & mask))
+      continue;
+    chan_circid_map.slots[hole] = *next;
+    hole = idx;
+  }
+  memset(&chan_circid_map.slots[hole], 0, sizeof(chan_circid_circuit_map_t));
+  --chan_circid_map.n_used;
+}
+
+/** Forget anything that the lookup cache of <b>chan</b> remembers about
+ * circuit ID <b>circ_id</b>. */
+static inline void
+channel_circid_cache_clear(channel_t *chan, circid_t circ_id)
+{
+  unsigned idx = circ_id & (CHANNEL_CIRCID_CACHE_SIZE - 1);
+  if (chan->circid_cache[idx].circ_id == circ_id)
+    chan->circid_cache[idx].circ = NULL;
+}
 
 /** Implementation helper for circuit_set_{p,n}_circid_channel: A circuit ID
  * and/or channel for circ has just changed from <b>old_chan, old_id</b>
@@ -171,7 +299,6 @@ circuit_set_circid_chan_helper(circuit_t *circ, int direction,
                                circid_t id,
                                channel_t *chan)
 {
-  chan_circid_circuit_map_t search;
   chan_circid_circuit_map_t *found;
   channel_t *old_chan, **chan_ptr;
   circid_t old_id, *circid_ptr;
@@ -193,13 +320,10 @@ circuit_set_circid_chan_helper(circuit_t *circ, int direction,
   if (id == old_id && chan == old_chan)
     return;
 
-  if (_last_circid_chan_ent &&
-      ((old_id == _last_circid_chan_ent->circ_id &&
-        old_chan == _last_circid_chan_ent->chan) ||
-       (id == _last_circid_chan_ent->circ_id &&
-        chan == _last_circid_chan_ent->chan))) {
-    _last_circid_chan_ent = NULL;
-  }
+  if (old_chan)
+    channel_circid_cache_clear(old_chan, old_id);
+  if (chan)
+    channel_circid_cache_clear(chan, id);
 
   if (old_chan) {
     /*
@@ -215,11 +339,9 @@ circuit_set_circid_chan_helper(circuit_t *circ, int direction,
     }
 
     /* we may need to remove it from the conn-circid map */
-    search.circ_id = old_id;
-    search.chan = old_chan;
-    found = HT_REMOVE(chan_circid_map, &chan_circid_map, &search);
+    found = chan_circid_map_find(old_chan, old_id);
     if (found) {
-      tor_free(found);
+      chan_circid_map_remove(found);
       if (direction == CELL_DIRECTION_OUT) {
         /* One fewer circuits use old_chan as n_chan */
         --(old_chan->num_n_circuits);
@@ -239,19 +361,9 @@ circuit_set_circid_chan_helper(circuit_t *circ, int direction,
     return;
 
   /* now add the new one to the conn-circid map */
-  search.circ_id = id;
-  search.chan = chan;
-  found = HT_FIND(chan_circid_map, &chan_circid_map, &search);
-  if (found) {
-    found->circuit = circ;
-    found->made_placeholder_at = 0;
-  } else {
-    found = tor_malloc_zero(sizeof(chan_circid_circuit_map_t));
-    found->circ_id = id;
-    found->chan = chan;
-    found->circuit = circ;
-    HT_INSERT(chan_circid_map, &chan_circid_map, found);
-  }
+  found = chan_circid_map_find_or_add(chan, id);
+  found->circuit = circ;
+  found->made_placeholder_at = 0;
 
   /*
    * Attach to the circuitmux if we're changing channels or IDs and
@@ -289,14 +401,10 @@ circuit_set_circid_chan_helper(circuit_t *circ, int direction,
 void
 channel_mark_circid_unusable(channel_t *chan, circid_t id)
 {
-  chan_circid_circuit_map_t search;
   chan_circid_circuit_map_t *ent;
 
   /* See if there's an entry there. That wouldn't be good. */
-  memset(&search, 0, sizeof(search));
-  search.chan = chan;
-  search.circ_id = id;
-  ent = HT_FIND(chan_circid_map, &chan_circid_map, &search);
+  ent = chan_circid_map_find(chan, id);
 
   if (ent && ent->circuit) {
     /* we have a problem. */
@@ -307,12 +415,9 @@ channel_mark_circid_unusable(channel_t *chan, circid_t id)
     if (!ent->made_placeholder_at)
       ent->made_placeholder_at = approx_time();
   } else {
-    ent = tor_malloc_zero(sizeof(chan_circid_circuit_map_t));
-    ent->chan = chan;
-    ent->circ_id = id;
+    ent = chan_circid_map_find_or_add(chan, id);
     /* leave circuit at NULL. */
     ent->made_placeholder_at = approx_time();
-    HT_INSERT(chan_circid_map, &chan_circid_map, ent);
   }
 }
 
@@ -322,22 +427,17 @@ channel_mark_circid_unusable(channel_t *chan, circid_t id)
 void
 channel_mark_circid_usable(channel_t *chan, circid_t id)
 {
-  chan_circid_circuit_map_t search;
   chan_circid_circuit_map_t *ent;
 
   /* See if there's an entry there. That wouldn't be good. */
-  memset(&search, 0, sizeof(search));
-  search.chan = chan;
-  search.circ_id = id;
-  ent = HT_REMOVE(chan_circid_map, &chan_circid_map, &search);
+  ent = chan_circid_map_find(chan, id);
   if (ent && ent->circuit) {
     log_warn(LD_BUG, "Tried to mark %u usable on %p, but there was already "
              "a circuit there.", (unsigned)id, chan);
     return;
   }
-  if (_last_circid_chan_ent == ent)
-    _last_circid_chan_ent = NULL;
-  tor_free(ent);
+  if (ent)
+    chan_circid_map_remove(ent);
 }
 
 /** Called to indicate that a DESTROY is pending on <b>chan</b> with
@@ -460,6 +560,8 @@ circuit_set_state(circuit_t *circ, uint8_t state)
   if (state == CIRCUIT_STATE_GUARD_WAIT || state == CIRCUIT_STATE_OPEN)
     tor_assert(!circ->n_chan_create_cell);
   circ->state = state;
+  if (CIRCUIT_IS_ORIGIN(circ))
+    circuit_build_deadline_update(TO_ORIGIN_CIRCUIT(circ));
 }
 
 /** Append to <b>out</b> all circuits in state CHAN_WAIT waiting for
@@ -533,6 +635,8 @@ circuit_remove_from_origin_circuit_list(origin_circuit_t *origin_circ)
     replacement->global_origin_circuit_list_idx = origin_idx;
   }
   origin_circ->global_origin_circuit_list_idx = -1;
+  circuit_update_purpose_index(origin_circ);
+  circuit_build_deadline_update(origin_circ);
 }
 
 /** Add <b>origin_circ</b> to the global list of origin circuits. Called
@@ -544,6 +648,60 @@ circuit_add_to_origin_circuit_list(origin_circuit_t *origin_circ)
   smartlist_t *lst = circuit_get_global_origin_circuit_list();
   smartlist_add(lst, origin_circ);
   origin_circ->global_origin_circuit_list_idx = smartlist_len(lst) - 1;
+  circuit_update_purpose_index(origin_circ);
+}
+
+/** Put <b>circ</b> on the per-purpose list that matches its current
+ * purpose, taking it off any other.  Must be called whenever the purpose
+ * of an origin circuit changes. */
+void
+circuit_update_purpose_index(origin_circuit_t *circ)
+{
+  const uint8_t purpose = TO_CIRCUIT(circ)->purpose;
+
+  if (circ->purpose_link.le_prev) {
+    TOR_LIST_REMOVE(circ, purpose_link);
+    circ->purpose_link.le_prev = NULL;
+  }
+  if (circ->global_origin_circuit_list_idx < 0 ||
+      !CIRCUIT_PURPOSE_IS_ORIGIN(purpose) ||
+      purpose > CIRCUIT_PURPOSE_MAX_)
+    return;
+  TOR_LIST_INSERT_HEAD(&origin_circuits_by_purpose[purpose], circ,
+                       purpose_link);
+}
+
+/** Return the list of all origin circuits whose purpose is <b>purpose</b>,
+ * including those marked for close.  Use
+ * ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN() to walk it. */
+struct origin_circuit_purpose_list_s *
+circuit_get_origin_circuits_with_purpose(uint8_t purpose)
+{
+  tor_assert(CIRCUIT_PURPOSE_IS_ORIGIN(purpose));
+  tor_assert(purpose <= CIRCUIT_PURPOSE_MAX_);
+  return &origin_circuits_by_purpose[purpose];
+}
+
+/** Return the pool at *<b>poolp</b>, creating it with <b>name</b> and
+ * <b>item_size</b> if it doesn't exist yet. */
+static objpool_t *
+circuit_objpool_get(objpool_t **poolp, const char *name, size_t item_size)
+{
+  if (PREDICT_UNLIKELY(*poolp == NULL))
+    *poolp = objpool_new(name, item_size, 0);
+  return *poolp;
+}
+
+/** Hand cached empty chunks from every object pool back to the system
+ * allocator, keeping at most a small fraction of MaxMemInQueues.  If
+ * <b>under_pressure</b>, keep none at all. */
+void
+circuit_trim_objpools(int under_pressure)
+{
+  size_t keep = 0;
+  if (!under_pressure)
+    keep = (size_t)(get_options()->MaxMemInQueues / OBJPOOL_IDLE_FRACTION);
+  objpool_trim_all(keep);
 }
 
 /** Detach from the global circuit list, and deallocate, all
@@ -577,6 +735,8 @@ circuit_close_all_marked(void)
     circuit_free(circ);
   } SMARTLIST_FOREACH_END(circ);
 
+  if (smartlist_len(circuits_pending_close))
+    circuit_trim_objpools(0);
   smartlist_clear(circuits_pending_close);
 }
 
@@ -847,7 +1007,9 @@ origin_circuit_new(void)
    * controller */
   static uint32_t n_circuits_allocated = 1;
 
-  circ = tor_malloc_zero(sizeof(origin_circuit_t));
+  circ = objpool_alloc_zero(circuit_objpool_get(&origin_circuit_pool,
+                                                "origin_circuit",
+                                                sizeof(origin_circuit_t)));
   circ->base_.magic = ORIGIN_CIRCUIT_MAGIC;
 
   circ->next_stream_id = crypto_rand_int(1<<16);
@@ -859,6 +1021,7 @@ origin_circuit_new(void)
 
   /* Add to origin-list. */
   circ->global_origin_circuit_list_idx = -1;
+  circ->build_deadline_idx = -1;
   circuit_add_to_origin_circuit_list(circ);
 
   circuit_build_times_update_last_circ(get_circuit_build_times_mutable());
@@ -909,7 +1072,9 @@ or_circuit_new(circid_t p_circ_id, channel_t *p_chan)
   /* CircIDs */
   or_circuit_t *circ;
 
-  circ = tor_malloc_zero(sizeof(or_circuit_t));
+  circ = objpool_alloc_zero(circuit_objpool_get(&or_circuit_pool,
+                                                "or_circuit",
+                                                sizeof(or_circuit_t)));
   circ->base_.magic = OR_CIRCUIT_MAGIC;
 
   if (p_chan)
@@ -945,6 +1110,7 @@ circuit_free(circuit_t *circ)
   circid_t n_circ_id = 0;
   void *mem;
   size_t memlen;
+  objpool_t *pool;
   int should_free = 1;
   if (!circ)
     return;
@@ -976,6 +1142,7 @@ circuit_free(circuit_t *circ)
     origin_circuit_t *ocirc = TO_ORIGIN_CIRCUIT(circ);
     mem = ocirc;
     memlen = sizeof(origin_circuit_t);
+    pool = origin_circuit_pool;
     tor_assert(circ->magic == ORIGIN_CIRCUIT_MAGIC);
 
     circuit_remove_from_origin_circuit_list(ocirc);
@@ -1020,6 +1187,7 @@ circuit_free(circuit_t *circ)
       rep_hist_buffer_stats_add_circ(circ, time(NULL));
     mem = ocirc;
     memlen = sizeof(or_circuit_t);
+    pool = or_circuit_pool;
     tor_assert(circ->magic == OR_CIRCUIT_MAGIC);
 
     should_free = (ocirc->workqueue_entry == NULL);
@@ -1071,7 +1239,7 @@ circuit_free(circuit_t *circ)
 
   if (should_free) {
     memwipe(mem, 0xAA, memlen); /* poison memory */
-    tor_free(mem);
+    objpool_free(pool, mem);
   } else {
     /* If we made it here, this is an or_circuit_t that still has a pending
      * cpuworker request which we weren't able to cancel.  Instead, set up
@@ -1083,6 +1251,18 @@ circuit_free(circuit_t *circ)
   }
 }
 
+/** Release the memory of <b>circ</b>, which circuit_free() left behind with
+ * DEAD_CIRCUIT_MAGIC because a cpuworker request still referred to it. */
+void
+or_circuit_free_dead(or_circuit_t *circ)
+{
+  if (!circ)
+    return;
+  tor_assert(circ->base_.magic == DEAD_CIRCUIT_MAGIC);
+  circ->base_.magic = 0;
+  objpool_free(or_circuit_pool, circ);
+}
+
 /** Deallocate the linked list circ-><b>cpath</b>, and remove the cpath from
  * <b>circ</b>. */
 void
@@ -1135,6 +1315,7 @@ circuit_free_all(void)
 
   smartlist_free(global_origin_circuit_list);
   global_origin_circuit_list = NULL;
+  circuit_build_deadlines_free_all();
 
   smartlist_free(circuits_pending_chans);
   circuits_pending_chans = NULL;
@@ -1146,22 +1327,36 @@ circuit_free_all(void)
   circuits_pending_other_guards = NULL;
 
   {
-    chan_circid_circuit_map_t **elt, **next, *c;
-    for (elt = HT_START(chan_circid_map, &chan_circid_map);
-         elt;
-         elt = next) {
-      c = *elt;
-      next = HT_NEXT_RMV(chan_circid_map, &chan_circid_map, elt);
-
-      tor_assert(c->circuit == NULL);
-      tor_free(c);
+    unsigned i;
+    for (i = 0; i < chan_circid_map.n_slots; ++i) {
+      tor_assert(chan_circid_map.slots[i].circuit == NULL);
     }
   }
-  HT_CLEAR(chan_circid_map, &chan_circid_map);
+  tor_free(chan_circid_map.slots);
+  chan_circid_map.n_slots = chan_circid_map.n_used = 0;
+
+  objpool_destroy(origin_circuit_pool);
+  origin_circuit_pool = NULL;
+  objpool_destroy(or_circuit_pool);
+  or_circuit_pool = NULL;
+  objpool_destroy(crypt_path_pool);
+  crypt_path_pool = NULL;
+}
+
+/** Allocate and return a new zeroed crypt_path_t, with its magic set.  It
+ * must be released with circuit_free_cpath_node(). */
+crypt_path_t *
+crypt_path_new(void)
+{
+  crypt_path_t *cpath =
+    objpool_alloc_zero(circuit_objpool_get(&crypt_path_pool, "crypt_path",
+                                           sizeof(crypt_path_t)));
+  cpath->magic = CRYPT_PATH_MAGIC;
+  return cpath;
 }
 
 /** Deallocate space associated with the cpath node <b>victim</b>. */
-static void
+void
 circuit_free_cpath_node(crypt_path_t *victim)
 {
   if (!victim)
@@ -1176,7 +1371,7 @@ circuit_free_cpath_node(crypt_path_t *victim)
   extend_info_free(victim->extend_info);
 
   memwipe(victim, 0xBB, sizeof(crypt_path_t)); /* poison memory */
-  tor_free(victim);
+  objpool_free(crypt_path_pool, victim);
 }
 
 /** Release a crypt_path_reference_t*, which may be NULL. */
@@ -1284,25 +1479,27 @@ static inline circuit_t *
 circuit_get_by_circid_channel_impl(circid_t circ_id, channel_t *chan,
                                    int *found_entry_out)
 {
-  chan_circid_circuit_map_t search;
   chan_circid_circuit_map_t *found;
+  unsigned cache_idx = circ_id & (CHANNEL_CIRCID_CACHE_SIZE - 1);
 
-  if (_last_circid_chan_ent &&
-      circ_id == _last_circid_chan_ent->circ_id &&
-      chan == _last_circid_chan_ent->chan) {
-    found = _last_circid_chan_ent;
-  } else {
-    search.circ_id = circ_id;
-    search.chan = chan;
-    found = HT_FIND(chan_circid_map, &chan_circid_map, &search);
-    _last_circid_chan_ent = found;
+  /* Consecutive cells on a channel mostly belong to a handful of circuits,
+   * so try the channel's own cache first. */
+  if (chan->circid_cache[cache_idx].circ &&
+      chan->circid_cache[cache_idx].circ_id == circ_id) {
+    if (found_entry_out)
+      *found_entry_out = 1;
+    return chan->circid_cache[cache_idx].circ;
   }
+
+  found = chan_circid_map_find(chan, circ_id);
   if (found && found->circuit) {
     log_debug(LD_CIRC,
               "circuit_get_by_circid_channel_impl() returning circuit %p for"
               " circ_id %u, channel ID " U64_FORMAT " (%p)",
               found->circuit, (unsigned)circ_id,
               U64_PRINTF_ARG(chan->global_identifier), chan);
+    chan->circid_cache[cache_idx].circ_id = circ_id;
+    chan->circid_cache[cache_idx].circ = found->circuit;
     if (found_entry_out)
       *found_entry_out = 1;
     return found->circuit;
@@ -1393,14 +1590,9 @@ circuit_id_in_use_on_channel(circid_t circ_id, channel_t *chan)
 time_t
 circuit_id_when_marked_unusable_on_channel(circid_t circ_id, channel_t *chan)
 {
-  chan_circid_circuit_map_t search;
   chan_circid_circuit_map_t *found;
 
-  memset(&search, 0, sizeof(search));
-  search.circ_id = circ_id;
-  search.chan = chan;
-
-  found = HT_FIND(chan_circid_map, &chan_circid_map, &search);
+  found = chan_circid_map_find(chan, circ_id);
 
   if (! found || found->circuit)
     return 0;
@@ -1958,6 +2150,8 @@ circuit_mark_for_close_, (circuit_t *circ, int reason, int line,
   circ->marked_for_close_file = file;
   circ->marked_for_close_reason = reason;
   circ->marked_for_close_orig_reason = orig_reason;
+  if (CIRCUIT_IS_ORIGIN(circ))
+    circuit_build_deadline_update(TO_ORIGIN_CIRCUIT(circ));
 
   if (get_options()->EnablePrivCount) {
     /* Make sure we do this after we close, but before we clear rend_splice */
@@ -2482,6 +2676,10 @@ circuits_handle_oom(size_t current_allocation)
              n_circuits_killed,
              smartlist_len(circlist) - n_circuits_killed,
              n_dirconns_killed);
+
+  /* Hand back whatever empty pool chunks we have now; the circuits we just
+   * marked will be trimmed again once they are freed. */
+  circuit_trim_objpools(1);
 }
 
 /** Verify that cpath layer <b>cp</b> has all of its invariants
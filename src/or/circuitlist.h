@@ -17,6 +17,25 @@
 
 MOCK_DECL(smartlist_t *, circuit_get_global_list, (void));
 smartlist_t *circuit_get_global_origin_circuit_list(void);
+TOR_LIST_HEAD(origin_circuit_purpose_list_s, origin_circuit_t);
+struct origin_circuit_purpose_list_s *
+circuit_get_origin_circuits_with_purpose(uint8_t purpose);
+void circuit_update_purpose_index(origin_circuit_t *circ);
+
+/** Iterate over every origin circuit whose purpose is <b>purpose</b>,
+ * including those marked for close, assigning each in turn to <b>var</b>.
+ * The loop body may mark the current circuit for close or change its
+ * purpose, but must not change the purpose of any other circuit. */
+#define ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(purpose, var)          \
+  STMT_BEGIN                                                            \
+    origin_circuit_t *var, *var ## _next;                               \
+    TOR_LIST_FOREACH_SAFE(var,                                          \
+                          circuit_get_origin_circuits_with_purpose(purpose), \
+                          purpose_link, var ## _next) {
+
+#define ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(var)                    \
+    }                                                                   \
+  STMT_END
 const char *circuit_state_to_string(int state);
 const char *circuit_purpose_to_controller_string(uint8_t purpose);
 const char *circuit_purpose_to_controller_hs_state_string(uint8_t purpose);
@@ -59,6 +78,8 @@ MOCK_DECL(void, circuit_mark_for_close_, (circuit_t *circ, int reason,
                                           int line, const char *file));
 int circuit_get_cpath_len(origin_circuit_t *circ);
 void circuit_clear_cpath(origin_circuit_t *circ);
+crypt_path_t *crypt_path_new(void);
+void circuit_free_cpath_node(crypt_path_t *victim);
 crypt_path_t *circuit_get_cpath_hop(origin_circuit_t *circ, int hopnum);
 void circuit_get_all_pending_on_channel(smartlist_t *out,
                                         channel_t *chan);
@@ -70,7 +91,9 @@ int circuit_count_pending_on_channel(channel_t *chan);
 void assert_cpath_layer_ok(const crypt_path_t *cp);
 MOCK_DECL(void, assert_circuit_ok,(const circuit_t *c));
 void circuit_free_all(void);
+void or_circuit_free_dead(or_circuit_t *circ);
 void circuits_handle_oom(size_t current_allocation);
+void circuit_trim_objpools(int under_pressure);
 
 void circuit_clear_testing_cell_stats(circuit_t *circ);
 
@@ -74,6 +74,7 @@
 #include "circuitlist.h"
 #include "circuitmux.h"
 #include "relay.h"
+#include "trace/events.h"
 
 /*
  * Private typedefs for circuitmux.c
@@ -1500,6 +1501,8 @@ circuitmux_get_first_active_circuit(circuitmux_t *cmux,
     tor_assert(cmux->destroy_cell_queue.n == 0);
   }
 
+  tor_trace(circuitmux, pick, cmux->n_active_circuits, cmux->n_cells,
+            *destroy_queue_out != NULL);
   return circ;
 }
 
@@ -46,6 +46,22 @@ static void cbt_control_event_buildtimeout_set(
 
 #define CBT_BIN_TO_MS(bin) ((bin)*CBT_BIN_WIDTH + (CBT_BIN_WIDTH/2))
 
+/** Return the histogram bin for the build time <b>t</b>. */
+#define CBT_MS_TO_BIN(t) \
+  ((int)MIN((t) / CBT_BIN_WIDTH, (build_time_t)(CBT_HISTOGRAM_NBINS-1)))
+
+/** Scale of the fixed-point logarithms we keep in histogram_logsum.  Fixed
+ * point lets us add and subtract them forever without drifting. */
+#define CBT_LOG_SCALE 4294967296.0
+/** Return ln(<b>t</b>) as a fixed-point value with scale CBT_LOG_SCALE. */
+#define CBT_LOG_FIXED(t) ((int64_t)(tor_mathlog(t) * CBT_LOG_SCALE))
+
+/** Version byte at the start of the CircuitBuildTimeHistogram state value. */
+#define CBT_PACKED_HISTOGRAM_VERSION 1
+/** Length of one (bin, count) pair in the CircuitBuildTimeHistogram state
+ * value. */
+#define CBT_PACKED_HISTOGRAM_ENTRY_LEN 4
+
 /** Global list of circuit build times */
 // XXXX: Add this as a member for entry_guard_t instead of global?
 // Then we could do per-guard statistics, as guards are likely to
@@ -540,6 +556,14 @@ circuit_build_times_reset(circuit_build_times_t *cbt)
   cbt->total_build_times = 0;
   cbt->build_times_idx = 0;
   cbt->have_computed_timeout = 0;
+
+  cbt->n_abandoned = 0;
+  memset(cbt->histogram, 0, sizeof(cbt->histogram));
+  memset(cbt->histogram_logsum, 0, sizeof(cbt->histogram_logsum));
+  cbt->histogram_nbins = 0;
+  memset(cbt->bin_first, 0, sizeof(cbt->bin_first));
+  memset(cbt->bin_next, 0, sizeof(cbt->bin_next));
+  memset(cbt->bin_prev, 0, sizeof(cbt->bin_prev));
 }
 
 /**
@@ -615,6 +639,108 @@ circuit_build_times_rewind_history(circuit_build_times_t *cbt, int n)
 }
 #endif /* 0 */
 
+/**
+ * Remove the build time at index <b>idx</b> of cbt->circuit_build_times
+ * from the histogram and the other summaries that we keep of it.
+ */
+static void
+circuit_build_times_forget_slot(circuit_build_times_t *cbt, int idx)
+{
+  build_time_t t = cbt->circuit_build_times[idx];
+  int bin;
+  uint16_t next, prev;
+
+  if (t == 0)
+    return; /* 0 <-> uninitialized */
+  if (t == CBT_BUILD_ABANDONED) {
+    --cbt->n_abandoned;
+    return;
+  }
+
+  bin = CBT_MS_TO_BIN(t);
+  next = cbt->bin_next[idx];
+  prev = cbt->bin_prev[idx];
+  if (prev)
+    cbt->bin_next[prev-1] = next;
+  else
+    cbt->bin_first[bin] = next;
+  if (next)
+    cbt->bin_prev[next-1] = prev;
+  cbt->bin_next[idx] = cbt->bin_prev[idx] = 0;
+
+  tor_assert(cbt->histogram[bin] > 0);
+  --cbt->histogram[bin];
+  cbt->histogram_logsum[bin] -= CBT_LOG_FIXED(t);
+  while (cbt->histogram_nbins > 0 &&
+         cbt->histogram[cbt->histogram_nbins-1] == 0)
+    --cbt->histogram_nbins;
+}
+
+/**
+ * Add the build time at index <b>idx</b> of cbt->circuit_build_times to
+ * the histogram and the other summaries that we keep of it.
+ */
+static void
+circuit_build_times_note_slot(circuit_build_times_t *cbt, int idx)
+{
+  build_time_t t = cbt->circuit_build_times[idx];
+  int bin;
+  uint16_t first;
+
+  if (t == 0)
+    return; /* 0 <-> uninitialized */
+  if (t == CBT_BUILD_ABANDONED) {
+    ++cbt->n_abandoned;
+    return;
+  }
+
+  bin = CBT_MS_TO_BIN(t);
+  first = cbt->bin_first[bin];
+  cbt->bin_prev[idx] = 0;
+  cbt->bin_next[idx] = first;
+  if (first)
+    cbt->bin_prev[first-1] = idx + 1;
+  cbt->bin_first[bin] = idx + 1;
+
+  ++cbt->histogram[bin];
+  cbt->histogram_logsum[bin] += CBT_LOG_FIXED(t);
+  if (bin >= cbt->histogram_nbins)
+    cbt->histogram_nbins = bin + 1;
+}
+
+/**
+ * Replace the build time at index <b>idx</b> of cbt->circuit_build_times
+ * with <b>btime</b>, keeping our summaries of the array up to date.
+ */
+static void
+circuit_build_times_set_slot(circuit_build_times_t *cbt, int idx,
+                             build_time_t btime)
+{
+  circuit_build_times_forget_slot(cbt, idx);
+  cbt->circuit_build_times[idx] = btime;
+  circuit_build_times_note_slot(cbt, idx);
+}
+
+/**
+ * Return true iff every build time in <b>bin</b> is less than
+ * <b>limit</b>.
+ */
+static inline int
+circuit_build_times_bin_below(int bin, double limit)
+{
+  return bin < CBT_HISTOGRAM_NBINS-1 && (bin+1)*CBT_BIN_WIDTH <= limit;
+}
+
+/**
+ * Return true iff every build time in <b>bin</b> is at least
+ * <b>limit</b>.
+ */
+static inline int
+circuit_build_times_bin_at_or_above(int bin, double limit)
+{
+  return bin*CBT_BIN_WIDTH >= limit;
+}
+
 /**
  * Add a new build time value <b>time</b> to the set of build times. Time
  * units are milliseconds.
@@ -634,7 +760,7 @@ circuit_build_times_add_time(circuit_build_times_t *cbt, build_time_t btime)
 
   log_debug(LD_CIRC, "Adding circuit build time %u", btime);
 
-  cbt->circuit_build_times[cbt->build_times_idx] = btime;
+  circuit_build_times_set_slot(cbt, cbt->build_times_idx, btime);
   cbt->build_times_idx = (cbt->build_times_idx + 1) % CBT_NCIRCUITS_TO_OBSERVE;
   if (cbt->total_build_times < CBT_NCIRCUITS_TO_OBSERVE)
     cbt->total_build_times++;
@@ -654,12 +780,13 @@ circuit_build_times_add_time(circuit_build_times_t *cbt, build_time_t btime)
 static build_time_t
 circuit_build_times_max(const circuit_build_times_t *cbt)
 {
-  int i = 0;
+  uint16_t i;
   build_time_t max_build_time = 0;
-  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE; i++) {
-    if (cbt->circuit_build_times[i] > max_build_time
-            && cbt->circuit_build_times[i] != CBT_BUILD_ABANDONED)
-      max_build_time = cbt->circuit_build_times[i];
+  if (cbt->histogram_nbins == 0)
+    return 0;
+  for (i = cbt->bin_first[cbt->histogram_nbins-1]; i; i = cbt->bin_next[i-1]) {
+    if (cbt->circuit_build_times[i-1] > max_build_time)
+      max_build_time = cbt->circuit_build_times[i-1];
   }
   return max_build_time;
 }
@@ -683,39 +810,6 @@ circuit_build_times_min(circuit_build_times_t *cbt)
 }
 #endif /* 0 */
 
-/**
- * Calculate and return a histogram for the set of build times.
- *
- * Returns an allocated array of histrogram bins representing
- * the frequency of index*CBT_BIN_WIDTH millisecond
- * build times. Also outputs the number of bins in nbins.
- *
- * The return value must be freed by the caller.
- */
-static uint32_t *
-circuit_build_times_create_histogram(const circuit_build_times_t *cbt,
-                                     build_time_t *nbins)
-{
-  uint32_t *histogram;
-  build_time_t max_build_time = circuit_build_times_max(cbt);
-  int i, c;
-
-  *nbins = 1 + (max_build_time / CBT_BIN_WIDTH);
-  histogram = tor_calloc(*nbins, sizeof(build_time_t));
-
-  // calculate histogram
-  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE; i++) {
-    if (cbt->circuit_build_times[i] == 0
-            || cbt->circuit_build_times[i] == CBT_BUILD_ABANDONED)
-      continue; /* 0 <-> uninitialized */
-
-    c = (cbt->circuit_build_times[i] / CBT_BIN_WIDTH);
-    histogram[c]++;
-  }
-
-  return histogram;
-}
-
 /**
  * Return the Pareto start-of-curve parameter Xm.
  *
@@ -728,22 +822,23 @@ static build_time_t
 circuit_build_times_get_xm(circuit_build_times_t *cbt)
 {
   build_time_t i, nbins;
-  build_time_t *nth_max_bin;
+  build_time_t nth_max_bin[CBT_MAX_NUM_XM_MODES];
   int32_t bin_counts=0;
   build_time_t ret = 0;
-  uint32_t *histogram = circuit_build_times_create_histogram(cbt, &nbins);
+  const uint16_t *histogram = cbt->histogram;
   int n=0;
   int num_modes = circuit_build_times_default_num_xm_modes();
 
-  tor_assert(nbins > 0);
+  nbins = MAX(cbt->histogram_nbins, 1);
   tor_assert(num_modes > 0);
+  tor_assert(num_modes <= CBT_MAX_NUM_XM_MODES);
 
   // Only use one mode if < 1000 buildtimes. Not enough data
   // for multiple.
   if (cbt->total_build_times < CBT_NCIRCUITS_TO_OBSERVE)
     num_modes = 1;
 
-  nth_max_bin = tor_calloc(num_modes, sizeof(build_time_t));
+  memset(nth_max_bin, 0, sizeof(nth_max_bin));
 
   /* Determine the N most common build times */
   for (i = 0; i < nbins; i++) {
@@ -772,8 +867,6 @@ circuit_build_times_get_xm(circuit_build_times_t *cbt)
   tor_assert(bin_counts > 0);
 
   ret /= bin_counts;
-  tor_free(histogram);
-  tor_free(nth_max_bin);
 
   return ret;
 }
@@ -786,41 +879,45 @@ void
 circuit_build_times_update_state(const circuit_build_times_t *cbt,
                                  or_state_t *state)
 {
-  uint32_t *histogram;
-  build_time_t i = 0;
-  build_time_t nbins = 0;
-  config_line_t **next, *line;
+  uint8_t *packed, *cp;
+  size_t packed_len, encoded_len;
+  int i;
 
-  histogram = circuit_build_times_create_histogram(cbt, &nbins);
-  // write to state
+  // write to state.  We only write the packed form; the older one-line-
+  // per-bin form is still accepted when reading.
   config_free_lines(state->BuildtimeHistogram);
-  next = &state->BuildtimeHistogram;
-  *next = NULL;
+  state->BuildtimeHistogram = NULL;
 
   state->TotalBuildTimes = cbt->total_build_times;
-  state->CircuitBuildAbandonedCount = 0;
+  state->CircuitBuildAbandonedCount = cbt->n_abandoned;
 
-  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE; i++) {
-    if (cbt->circuit_build_times[i] == CBT_BUILD_ABANDONED)
-      state->CircuitBuildAbandonedCount++;
-  }
-
-  for (i = 0; i < nbins; i++) {
+  packed = cp = tor_malloc(1 + cbt->histogram_nbins *
+                           CBT_PACKED_HISTOGRAM_ENTRY_LEN);
+  *cp++ = CBT_PACKED_HISTOGRAM_VERSION;
+  for (i = 0; i < cbt->histogram_nbins; i++) {
     // compress the histogram by skipping the blanks
-    if (histogram[i] == 0) continue;
-    *next = line = tor_malloc_zero(sizeof(config_line_t));
-    line->key = tor_strdup("CircuitBuildTimeBin");
-    tor_asprintf(&line->value, "%d %d",
-            CBT_BIN_TO_MS(i), histogram[i]);
-    next = &(line->next);
+    if (cbt->histogram[i] == 0) continue;
+    set_uint16(cp, htons((uint16_t)i));
+    set_uint16(cp+2, htons(cbt->histogram[i]));
+    cp += CBT_PACKED_HISTOGRAM_ENTRY_LEN;
+  }
+  packed_len = cp - packed;
+
+  tor_free(state->BuildtimeHistogramPacked);
+  encoded_len = base64_encode_size(packed_len, 0) + 1;
+  state->BuildtimeHistogramPacked = tor_malloc(encoded_len);
+  if (base64_encode(state->BuildtimeHistogramPacked, encoded_len,
+                    (const char *)packed, packed_len, 0) < 0) {
+    /* Can't happen: we sized the buffer with base64_encode_size(). */
+    tor_fragile_assert();
+    tor_free(state->BuildtimeHistogramPacked);
   }
+  tor_free(packed);
 
   if (!unit_tests) {
     if (!get_options()->AvoidDiskWrites)
       or_state_mark_dirty(get_or_state(), 0);
   }
-
-  tor_free(histogram);
 }
 
 /**
@@ -885,7 +982,7 @@ circuit_build_times_filter_timeouts(circuit_build_times_t *cbt)
     if (cbt->circuit_build_times[i] > max_timeout) {
       build_time_t replaced = cbt->circuit_build_times[i];
       num_filtered++;
-      cbt->circuit_build_times[i] = CBT_BUILD_ABANDONED;
+      circuit_build_times_set_slot(cbt, i, CBT_BUILD_ABANDONED);
 
       log_debug(LD_CIRC, "Replaced timeout %d with %d", replaced,
                cbt->circuit_build_times[i]);
@@ -901,6 +998,66 @@ circuit_build_times_filter_timeouts(circuit_build_times_t *cbt)
   return num_filtered;
 }
 
+/**
+ * Decode <b>packed</b>, the CircuitBuildTimeHistogram value from the state
+ * file, and append one build time to <b>loaded_times</b> for every circuit
+ * it counts, starting at *<b>loaded_cnt</b> and updating it.  Stop short
+ * if that would leave less than <b>n_abandoned</b> of the
+ * <b>max_times</b> slots in <b>loaded_times</b>.  Set *<b>n_bins_out</b>
+ * to the number of bins read.  Return -1 if <b>packed</b> is malformed.
+ */
+static int
+circuit_build_times_unpack_histogram(const char *packed,
+                                     build_time_t *loaded_times,
+                                     uint32_t max_times,
+                                     uint32_t n_abandoned,
+                                     uint32_t *loaded_cnt,
+                                     uint32_t *n_bins_out)
+{
+  size_t packed_len = strlen(packed);
+  size_t buf_len = (packed_len * 3) / 4 + 3;
+  char *buf = tor_malloc(buf_len);
+  const uint8_t *cp, *end;
+  int len, r = -1;
+
+  len = base64_decode(buf, buf_len, packed, packed_len);
+  if (len < 1 || get_uint8(buf) != CBT_PACKED_HISTOGRAM_VERSION ||
+      (len - 1) % CBT_PACKED_HISTOGRAM_ENTRY_LEN != 0) {
+    log_warn(LD_GENERAL, "Unable to parse circuit build times: "
+                         "Malformed CircuitBuildTimeHistogram");
+    goto done;
+  }
+
+  cp = (const uint8_t *)buf + 1;
+  end = (const uint8_t *)buf + len;
+  for ( ; cp < end; cp += CBT_PACKED_HISTOGRAM_ENTRY_LEN) {
+    uint16_t bin = ntohs(get_uint16(cp));
+    uint16_t count = ntohs(get_uint16(cp+2));
+    uint32_t k;
+    if (bin >= CBT_HISTOGRAM_NBINS) {
+      log_warn(LD_GENERAL, "Unable to parse circuit build times: "
+                           "Bin number %u out of range", bin);
+      goto done;
+    }
+    if (*loaded_cnt + count + n_abandoned > max_times) {
+      log_warn(LD_CIRC,
+               "Too many build times in state file. "
+               "Stopping short before %u",
+               (unsigned)(*loaded_cnt + count));
+      break;
+    }
+    for (k = 0; k < count; k++) {
+      loaded_times[(*loaded_cnt)++] = CBT_BIN_TO_MS(bin);
+    }
+    ++*n_bins_out;
+  }
+  r = 0;
+
+ done:
+  tor_free(buf);
+  return r;
+}
+
 /**
  * Load histogram from <b>state</b>, shuffling the resulting array
  * after we do so. Use this result to estimate parameters and
@@ -927,61 +1084,70 @@ circuit_build_times_parse_state(circuit_build_times_t *cbt,
   /* build_time_t 0 means uninitialized */
   loaded_times = tor_calloc(state->TotalBuildTimes, sizeof(build_time_t));
 
-  for (line = state->BuildtimeHistogram; line; line = line->next) {
-    smartlist_t *args = smartlist_new();
-    smartlist_split_string(args, line->value, " ",
-                           SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
-    if (smartlist_len(args) < 2) {
-      log_warn(LD_GENERAL, "Unable to parse circuit build times: "
-                           "Too few arguments to CircuitBuildTime");
+  if (state->BuildtimeHistogramPacked) {
+    if (circuit_build_times_unpack_histogram(
+                              state->BuildtimeHistogramPacked, loaded_times,
+                              (unsigned)state->TotalBuildTimes,
+                              (unsigned)state->CircuitBuildAbandonedCount,
+                              &loaded_cnt, &N) < 0)
       err = 1;
-      SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
-      smartlist_free(args);
-      break;
-    } else {
-      const char *ms_str = smartlist_get(args,0);
-      const char *count_str = smartlist_get(args,1);
-      uint32_t count, k;
-      build_time_t ms;
-      int ok;
-      ms = (build_time_t)tor_parse_ulong(ms_str, 10, 0,
-                                         CBT_BUILD_TIME_MAX, &ok, NULL);
-      if (!ok) {
-        log_warn(LD_GENERAL, "Unable to parse circuit build times: "
-                             "Unparsable bin number");
-        err = 1;
-        SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
-        smartlist_free(args);
-        break;
-      }
-      count = (uint32_t)tor_parse_ulong(count_str, 10, 0,
-                                        UINT32_MAX, &ok, NULL);
-      if (!ok) {
+  } else {
+    for (line = state->BuildtimeHistogram; line; line = line->next) {
+      smartlist_t *args = smartlist_new();
+      smartlist_split_string(args, line->value, " ",
+                             SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
+      if (smartlist_len(args) < 2) {
         log_warn(LD_GENERAL, "Unable to parse circuit build times: "
-                             "Unparsable bin count");
+                             "Too few arguments to CircuitBuildTime");
         err = 1;
         SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
         smartlist_free(args);
         break;
-      }
+      } else {
+        const char *ms_str = smartlist_get(args,0);
+        const char *count_str = smartlist_get(args,1);
+        uint32_t count, k;
+        build_time_t ms;
+        int ok;
+        ms = (build_time_t)tor_parse_ulong(ms_str, 10, 0,
+                                           CBT_BUILD_TIME_MAX, &ok, NULL);
+        if (!ok) {
+          log_warn(LD_GENERAL, "Unable to parse circuit build times: "
+                               "Unparsable bin number");
+          err = 1;
+          SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
+          smartlist_free(args);
+          break;
+        }
+        count = (uint32_t)tor_parse_ulong(count_str, 10, 0,
+                                          UINT32_MAX, &ok, NULL);
+        if (!ok) {
+          log_warn(LD_GENERAL, "Unable to parse circuit build times: "
+                               "Unparsable bin count");
+          err = 1;
+          SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
+          smartlist_free(args);
+          break;
+        }
 
-      if (loaded_cnt+count+ (unsigned)state->CircuitBuildAbandonedCount
-          > (unsigned) state->TotalBuildTimes) {
-        log_warn(LD_CIRC,
-                 "Too many build times in state file. "
-                 "Stopping short before %d",
-                 loaded_cnt+count);
+        if (loaded_cnt+count+ (unsigned)state->CircuitBuildAbandonedCount
+            > (unsigned) state->TotalBuildTimes) {
+          log_warn(LD_CIRC,
+                   "Too many build times in state file. "
+                   "Stopping short before %d",
+                   loaded_cnt+count);
+          SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
+          smartlist_free(args);
+          break;
+        }
+
+        for (k = 0; k < count; k++) {
+          loaded_times[loaded_cnt++] = ms;
+        }
+        N++;
         SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
         smartlist_free(args);
-        break;
       }
-
-      for (k = 0; k < count; k++) {
-        loaded_times[loaded_cnt++] = ms;
-      }
-      N++;
-      SMARTLIST_FOREACH(args, char*, cp, tor_free(cp));
-      smartlist_free(args);
     }
   }
 
@@ -1047,9 +1213,10 @@ circuit_build_times_parse_state(circuit_build_times_t *cbt,
 STATIC int
 circuit_build_times_update_alpha(circuit_build_times_t *cbt)
 {
-  build_time_t *x=cbt->circuit_build_times;
+  const build_time_t *x=cbt->circuit_build_times;
   double a = 0;
-  int n=0,i=0,abandoned_count=0;
+  int64_t a_fixed = 0, log_xm_fixed;
+  int n=0,bin=0,abandoned_count=cbt->n_abandoned;
   build_time_t max_time=0;
 
   /* http://en.wikipedia.org/wiki/Pareto_distribution#Parameter_estimation */
@@ -1058,23 +1225,34 @@ circuit_build_times_update_alpha(circuit_build_times_t *cbt)
   cbt->Xm = circuit_build_times_get_xm(cbt);
 
   tor_assert(cbt->Xm > 0);
+  log_xm_fixed = CBT_LOG_FIXED(cbt->Xm);
 
-  for (i=0; i< CBT_NCIRCUITS_TO_OBSERVE; i++) {
-    if (!x[i]) {
+  /* Every build time below Xm counts as Xm.  Whole bins on either side of
+   * Xm come straight from the histogram; only the bin holding Xm needs us
+   * to look at its build times one by one. */
+  for (bin = 0; bin < cbt->histogram_nbins; bin++) {
+    if (cbt->histogram[bin] == 0)
       continue;
-    }
-
-    if (x[i] < cbt->Xm) {
-      a += tor_mathlog(cbt->Xm);
-    } else if (x[i] == CBT_BUILD_ABANDONED) {
-      abandoned_count++;
+    if (circuit_build_times_bin_below(bin, cbt->Xm)) {
+      a_fixed += cbt->histogram[bin] * log_xm_fixed;
+    } else if (circuit_build_times_bin_at_or_above(bin, cbt->Xm)) {
+      a_fixed += cbt->histogram_logsum[bin];
     } else {
-      a += tor_mathlog(x[i]);
-      if (x[i] > max_time)
-        max_time = x[i];
+      uint16_t i;
+      for (i = cbt->bin_first[bin]; i; i = cbt->bin_next[i-1]) {
+        if (x[i-1] < cbt->Xm)
+          a_fixed += log_xm_fixed;
+        else
+          a_fixed += CBT_LOG_FIXED(x[i-1]);
+      }
     }
-    n++;
+    n += cbt->histogram[bin];
   }
+  n += abandoned_count;
+  a = a_fixed / CBT_LOG_SCALE;
+  max_time = circuit_build_times_max(cbt);
+  if (max_time < cbt->Xm)
+    max_time = 0;
 
   /*
    * We are erring and asserting here because this can only happen
@@ -1478,10 +1656,19 @@ circuit_build_times_network_check_changed(circuit_build_times_t *cbt)
 double
 circuit_build_times_timeout_rate(const circuit_build_times_t *cbt)
 {
-  int i=0,timeouts=0;
-  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE; i++) {
-    if (cbt->circuit_build_times[i] >= cbt->timeout_ms) {
-       timeouts++;
+  int bin=0,timeouts=cbt->n_abandoned;
+  for (bin = 0; bin < cbt->histogram_nbins; bin++) {
+    if (cbt->histogram[bin] == 0 ||
+        circuit_build_times_bin_below(bin, cbt->timeout_ms))
+      continue;
+    if (circuit_build_times_bin_at_or_above(bin, cbt->timeout_ms)) {
+      timeouts += cbt->histogram[bin];
+    } else {
+      uint16_t i;
+      for (i = cbt->bin_first[bin]; i; i = cbt->bin_next[i-1]) {
+        if (cbt->circuit_build_times[i-1] >= cbt->timeout_ms)
+          timeouts++;
+      }
     }
   }
 
@@ -1497,12 +1684,7 @@ circuit_build_times_timeout_rate(const circuit_build_times_t *cbt)
 double
 circuit_build_times_close_rate(const circuit_build_times_t *cbt)
 {
-  int i=0,closed=0;
-  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE; i++) {
-    if (cbt->circuit_build_times[i] == CBT_BUILD_ABANDONED) {
-       closed++;
-    }
-  }
+  int closed=cbt->n_abandoned;
 
   if (!cbt->total_build_times)
     return 0;
@@ -71,6 +71,10 @@ int circuit_build_times_network_check_live(const circuit_build_times_t *cbt);
 void circuit_build_times_network_circ_success(circuit_build_times_t *cbt);
 
 #ifdef CIRCUITSTATS_PRIVATE
+/** Number of CBT_BIN_WIDTH-wide bins in the build time histogram.  Build
+ * times past the end of the histogram all land in its last bin. */
+#define CBT_HISTOGRAM_NBINS 3600
+
 /** Structure for circuit build times history */
 struct circuit_build_times_s {
   /** The circular array of recorded build times in milliseconds */
@@ -79,6 +83,26 @@ struct circuit_build_times_s {
   int build_times_idx;
   /** Total number of build times accumulated. Max CBT_NCIRCUITS_TO_OBSERVE */
   int total_build_times;
+
+  /* The fields below summarize circuit_build_times, and are kept up to date
+   * by every change to it, so that estimating the timeout never has to look
+   * at the whole array. */
+  /** Number of entries in circuit_build_times that are CBT_BUILD_ABANDONED */
+  int n_abandoned;
+  /** Number of recorded, non-abandoned build times in each bin. */
+  uint16_t histogram[CBT_HISTOGRAM_NBINS];
+  /** Sum of CBT_LOG_FIXED(t) over the build times t in each bin. */
+  int64_t histogram_logsum[CBT_HISTOGRAM_NBINS];
+  /** One more than the highest bin with a nonzero count, or 0 if the
+   * histogram is empty. */
+  int histogram_nbins;
+  /** For each bin, one more than the index in circuit_build_times of the
+   * first build time in that bin, or 0 if the bin is empty. */
+  uint16_t bin_first[CBT_HISTOGRAM_NBINS];
+  /** Doubly-linked lists through circuit_build_times of the build times in
+   * each bin, encoded like bin_first. */
+  uint16_t bin_next[CBT_NCIRCUITS_TO_OBSERVE];
+  uint16_t bin_prev[CBT_NCIRCUITS_TO_OBSERVE];
   /** Information about the state of our local network connection */
   network_liveness_t liveness;
   /** Last time we built a circuit. Used to decide to build new test circs */
@@ -316,6 +316,21 @@ circuit_get_best(const entry_connection_t *conn,
                  int must_be_open, uint8_t purpose,
                  int need_uptime, int need_internal)
 {
+  /* The purposes of the circuits that circuit_is_acceptable() might accept
+   * when we're asked for a rendezvous or introduction circuit that needn't
+   * be open. */
+  static const uint8_t rend_purposes[] = {
+    CIRCUIT_PURPOSE_C_ESTABLISH_REND,
+    CIRCUIT_PURPOSE_C_REND_READY,
+    CIRCUIT_PURPOSE_C_REND_READY_INTRO_ACKED,
+    CIRCUIT_PURPOSE_C_REND_JOINED,
+  };
+  static const uint8_t intro_purposes[] = {
+    CIRCUIT_PURPOSE_C_INTRODUCING,
+    CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT,
+  };
+  const uint8_t *purposes = &purpose;
+  size_t n_purposes = 1, i;
   origin_circuit_t *best=NULL;
   struct timeval now;
   int intro_going_on_but_too_old = 0;
@@ -328,32 +343,38 @@ circuit_get_best(const entry_connection_t *conn,
 
   tor_gettimeofday(&now);
 
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    origin_circuit_t *origin_circ;
-    if (!CIRCUIT_IS_ORIGIN(circ))
-      continue;
-    origin_circ = TO_ORIGIN_CIRCUIT(circ);
-
-    /* Log an info message if we're going to launch a new intro circ in
-     * parallel */
-    if (purpose == CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT &&
-        !must_be_open && origin_circ->hs_circ_has_timed_out &&
-        !circ->marked_for_close) {
-        intro_going_on_but_too_old = 1;
-        continue;
-    }
+  if (purpose == CIRCUIT_PURPOSE_C_REND_JOINED && !must_be_open) {
+    purposes = rend_purposes;
+    n_purposes = ARRAY_LENGTH(rend_purposes);
+  } else if (purpose == CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT &&
+             !must_be_open) {
+    purposes = intro_purposes;
+    n_purposes = ARRAY_LENGTH(intro_purposes);
+  }
 
-    if (!circuit_is_acceptable(origin_circ,conn,must_be_open,purpose,
-                               need_uptime,need_internal, (time_t)now.tv_sec))
-      continue;
+  for (i = 0; i < n_purposes; ++i) {
+    ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(purposes[i], origin_circ) {
+      /* Log an info message if we're going to launch a new intro circ in
+       * parallel */
+      if (purpose == CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT &&
+          !must_be_open && origin_circ->hs_circ_has_timed_out &&
+          !TO_CIRCUIT(origin_circ)->marked_for_close) {
+          intro_going_on_but_too_old = 1;
+          continue;
+      }
 
-    /* now this is an acceptable circ to hand back. but that doesn't
-     * mean it's the *best* circ to hand back. try to decide.
-     */
-    if (!best || circuit_is_better(origin_circ,best,conn))
-      best = origin_circ;
+      if (!circuit_is_acceptable(origin_circ,conn,must_be_open,purpose,
+                                 need_uptime,need_internal,
+                                 (time_t)now.tv_sec))
+        continue;
+
+      /* now this is an acceptable circ to hand back. but that doesn't
+       * mean it's the *best* circ to hand back. try to decide.
+       */
+      if (!best || circuit_is_better(origin_circ,best,conn))
+        best = origin_circ;
+    } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(origin_circ);
   }
-  SMARTLIST_FOREACH_END(circ);
 
   if (!best && intro_going_on_but_too_old)
     log_info(LD_REND|LD_CIRC, "There is an intro circuit being created "
@@ -369,16 +390,15 @@ count_pending_general_client_circuits(void)
 {
   int count = 0;
 
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
+  ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(CIRCUIT_PURPOSE_C_GENERAL,
+                                            ocirc) {
+    const circuit_t *circ = TO_CIRCUIT(ocirc);
     if (circ->marked_for_close ||
-        circ->state == CIRCUIT_STATE_OPEN ||
-        circ->purpose != CIRCUIT_PURPOSE_C_GENERAL ||
-        !CIRCUIT_IS_ORIGIN(circ))
+        circ->state == CIRCUIT_STATE_OPEN)
       continue;
 
     ++count;
-  }
-  SMARTLIST_FOREACH_END(circ);
+  } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(ocirc);
 
   return count;
 }
@@ -412,52 +432,41 @@ circuit_conforms_to_options(const origin_circuit_t *circ,
 }
 #endif /* 0 */
 
-/** Close all circuits that start at us, aren't open, and were born
- * at least CircuitBuildTimeout seconds ago.
- */
-void
-circuit_expire_building(void)
+/** How long, in msec, each kind of circuit may take to build before
+ * circuit_expire_building() does something about it. */
+typedef struct circuit_build_cutoffs_t {
+  long general;
+  long begindir;
+  long fourhop;
+  long stream;
+  long cannibalized;
+  long c_intro;
+  long s_intro;
+  long close;
+  long extremely_old;
+  long hs_extremely_old;
+} circuit_build_cutoffs_t;
+
+/** Priority queue of the origin circuits that circuit_expire_building() may
+ * need to act on, ordered by build_deadline_msec. */
+static smartlist_t *circuits_by_build_deadline = NULL;
+/** The cutoffs that we used to compute the build_deadline_msec of every
+ * circuit in circuits_by_build_deadline. */
+static circuit_build_cutoffs_t build_deadline_cutoffs;
+/** True iff build_deadline_cutoffs has been set. */
+static int build_deadline_cutoffs_set = 0;
+
+/** Set *<b>out</b> to the build cutoffs for our current circuit build
+ * timeout and options. */
+static void
+circuit_build_cutoffs_compute(circuit_build_cutoffs_t *out)
 {
   /* circ_times.timeout_ms and circ_times.close_ms are from
    * circuit_build_times_get_initial_timeout() if we haven't computed
    * custom timeouts yet */
-  struct timeval general_cutoff, begindir_cutoff, fourhop_cutoff,
-    close_cutoff, extremely_old_cutoff, hs_extremely_old_cutoff,
-    cannibalized_cutoff, c_intro_cutoff, s_intro_cutoff, stream_cutoff;
   const or_options_t *options = get_options();
-  struct timeval now;
-  cpath_build_state_t *build_state;
-  int any_opened_circs = 0;
-
-  tor_gettimeofday(&now);
-
-  /* Check to see if we have any opened circuits. If we don't,
-   * we want to be more lenient with timeouts, in case the
-   * user has relocated and/or changed network connections.
-   * See bug #3443. */
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, next_circ) {
-    if (!CIRCUIT_IS_ORIGIN(next_circ) || /* didn't originate here */
-        next_circ->marked_for_close) { /* don't mess with marked circs */
-      continue;
-    }
-
-    if (TO_ORIGIN_CIRCUIT(next_circ)->has_opened &&
-        next_circ->state == CIRCUIT_STATE_OPEN &&
-        TO_ORIGIN_CIRCUIT(next_circ)->build_state &&
-        TO_ORIGIN_CIRCUIT(next_circ)->build_state->desired_path_len
-          == DEFAULT_ROUTE_LEN) {
-      any_opened_circs = 1;
-      break;
-    }
-  } SMARTLIST_FOREACH_END(next_circ);
 
-#define SET_CUTOFF(target, msec) do {                       \
-    long ms = tor_lround(msec);                             \
-    struct timeval diff;                                    \
-    diff.tv_sec = ms / 1000;                                \
-    diff.tv_usec = (int)((ms % 1000) * 1000);               \
-    timersub(&now, &diff, &target);                         \
-  } while (0)
+  memset(out, 0, sizeof(*out));
 
   /**
    * Because circuit build timeout is calculated only based on 3 hop
@@ -474,7 +483,7 @@ circuit_expire_building(void)
    *
    * Let h = a = b = c = d
    *
-   * Three hops (general_cutoff)
+   * Three hops (general)
    *   RTTs = 3a + 2b + c
    *   RTTs = 6h
    * Cannibalized:
@@ -490,40 +499,233 @@ circuit_expire_building(void)
    *   RTTs = 4a + 3b + 2c
    *   RTTs = 9h
    */
-  SET_CUTOFF(general_cutoff, get_circuit_build_timeout_ms());
-  SET_CUTOFF(begindir_cutoff, get_circuit_build_timeout_ms());
+  out->general = tor_lround(get_circuit_build_timeout_ms());
+  out->begindir = tor_lround(get_circuit_build_timeout_ms());
 
   /* > 3hop circs seem to have a 1.0 second delay on their cannibalized
    * 4th hop. */
-  SET_CUTOFF(fourhop_cutoff, get_circuit_build_timeout_ms() * (10/6.0) + 1000);
+  out->fourhop = tor_lround(get_circuit_build_timeout_ms() * (10/6.0) + 1000);
 
   /* CIRCUIT_PURPOSE_C_ESTABLISH_REND behaves more like a RELAY cell.
    * Use the stream cutoff (more or less). */
-  SET_CUTOFF(stream_cutoff, MAX(options->CircuitStreamTimeout,15)*1000 + 1000);
+  out->stream = MAX(options->CircuitStreamTimeout,15)*1000 + 1000;
 
   /* Be lenient with cannibalized circs. They already survived the official
    * CBT, and they're usually not performance-critical. */
-  SET_CUTOFF(cannibalized_cutoff,
-             MAX(get_circuit_build_close_time_ms()*(4/6.0),
-                 options->CircuitStreamTimeout * 1000) + 1000);
+  out->cannibalized =
+    tor_lround(MAX(get_circuit_build_close_time_ms()*(4/6.0),
+                   options->CircuitStreamTimeout * 1000) + 1000);
 
   /* Intro circs have an extra round trip (and are also 4 hops long) */
-  SET_CUTOFF(c_intro_cutoff, get_circuit_build_timeout_ms() * (14/6.0) + 1000);
+  out->c_intro = tor_lround(get_circuit_build_timeout_ms() * (14/6.0) + 1000);
 
   /* Server intro circs have an extra round trip */
-  SET_CUTOFF(s_intro_cutoff, get_circuit_build_timeout_ms() * (9/6.0) + 1000);
+  out->s_intro = tor_lround(get_circuit_build_timeout_ms() * (9/6.0) + 1000);
+
+  out->close = tor_lround(get_circuit_build_close_time_ms());
+  out->extremely_old =
+    tor_lround(get_circuit_build_close_time_ms()*2 + 1000);
+
+  out->hs_extremely_old =
+    tor_lround(MAX(get_circuit_build_close_time_ms()*2 + 1000,
+                   options->SocksTimeout * 1000));
+}
+
+/** Return how long, in msec, <b>circ</b> may take to build under
+ * <b>cutoffs</b> before circuit_expire_building() does something about
+ * it. */
+static long
+circuit_build_cutoff_for(const origin_circuit_t *circ,
+                         const circuit_build_cutoffs_t *cutoffs)
+{
+  const cpath_build_state_t *build_state = circ->build_state;
+  const uint8_t purpose = circ->base_.purpose;
+  long cutoff;
+
+  if (build_state && build_state->onehop_tunnel)
+    cutoff = cutoffs->begindir;
+  else if (purpose == CIRCUIT_PURPOSE_C_MEASURE_TIMEOUT)
+    cutoff = cutoffs->close;
+  else if (purpose == CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT)
+    cutoff = cutoffs->c_intro;
+  else if (purpose == CIRCUIT_PURPOSE_S_ESTABLISH_INTRO)
+    cutoff = cutoffs->s_intro;
+  else if (purpose == CIRCUIT_PURPOSE_C_ESTABLISH_REND)
+    cutoff = cutoffs->stream;
+  else if (purpose == CIRCUIT_PURPOSE_PATH_BIAS_TESTING)
+    cutoff = cutoffs->close;
+  else if (circ->has_opened &&
+           circ->base_.state != CIRCUIT_STATE_OPEN)
+    cutoff = cutoffs->cannibalized;
+  else if (build_state && build_state->desired_path_len >= 4)
+    cutoff = cutoffs->fourhop;
+  else
+    cutoff = cutoffs->general;
+
+  if (circ->hs_circ_has_timed_out)
+    cutoff = cutoffs->hs_extremely_old;
+
+  return cutoff;
+}
 
-  SET_CUTOFF(close_cutoff, get_circuit_build_close_time_ms());
-  SET_CUTOFF(extremely_old_cutoff, get_circuit_build_close_time_ms()*2 + 1000);
+/** Return true iff circuit_expire_building() might ever act on
+ * <b>circ</b>, as things stand. */
+static int
+circuit_build_deadline_matters(const origin_circuit_t *circ)
+{
+  if (circ->base_.marked_for_close ||
+      circ->global_origin_circuit_list_idx < 0)
+    return 0;
+  if (circ->base_.state != CIRCUIT_STATE_OPEN)
+    return 1;
+  /* Most open circuits are left alone; see circuit_expire_building(). */
+  switch (circ->base_.purpose) {
+    case CIRCUIT_PURPOSE_S_ESTABLISH_INTRO:
+    case CIRCUIT_PURPOSE_C_REND_READY:
+    case CIRCUIT_PURPOSE_PATH_BIAS_TESTING:
+    case CIRCUIT_PURPOSE_C_ESTABLISH_REND:
+    case CIRCUIT_PURPOSE_C_REND_READY_INTRO_ACKED:
+    case CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT:
+      return 1;
+    default:
+      return 0;
+  }
+}
 
-  SET_CUTOFF(hs_extremely_old_cutoff,
-             MAX(get_circuit_build_close_time_ms()*2 + 1000,
-                 options->SocksTimeout * 1000));
+/** Helper: compare two origin circuits by their build deadlines. */
+static int
+compare_origin_circuits_by_build_deadline_(const void *a_, const void *b_)
+{
+  const origin_circuit_t *a = a_, *b = b_;
+  if (a->build_deadline_msec < b->build_deadline_msec)
+    return -1;
+  else if (a->build_deadline_msec > b->build_deadline_msec)
+    return 1;
+  else
+    return 0;
+}
 
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *,victim) {
+/** Recompute when circuit_expire_building() next needs to look at
+ * <b>circ</b>, and queue it accordingly.  Must be called whenever the
+ * circuit's state or purpose changes. */
+void
+circuit_build_deadline_update(origin_circuit_t *circ)
+{
+  if (circ->build_deadline_idx >= 0) {
+    smartlist_pqueue_remove(circuits_by_build_deadline,
+                            compare_origin_circuits_by_build_deadline_,
+                            offsetof(origin_circuit_t, build_deadline_idx),
+                            circ);
+  }
+  if (!circuit_build_deadline_matters(circ))
+    return;
+
+  if (!build_deadline_cutoffs_set) {
+    circuit_build_cutoffs_compute(&build_deadline_cutoffs);
+    build_deadline_cutoffs_set = 1;
+  }
+  if (!circuits_by_build_deadline)
+    circuits_by_build_deadline = smartlist_new();
+
+  /* If the circuit's timestamp_began moves later, we'll just look at it
+   * early and requeue it then. */
+  circ->build_deadline_msec = tv_to_msec(&TO_CIRCUIT(circ)->timestamp_began) +
+    circuit_build_cutoff_for(circ, &build_deadline_cutoffs);
+  smartlist_pqueue_add(circuits_by_build_deadline,
+                       compare_origin_circuits_by_build_deadline_,
+                       offsetof(origin_circuit_t, build_deadline_idx),
+                       circ);
+}
+
+/** Release all storage held for circuit_expire_building(). */
+void
+circuit_build_deadlines_free_all(void)
+{
+  smartlist_free(circuits_by_build_deadline);
+  circuits_by_build_deadline = NULL;
+  build_deadline_cutoffs_set = 0;
+}
+
+/** Close all circuits that start at us, aren't open, and were born
+ * at least CircuitBuildTimeout seconds ago.
+ */
+void
+circuit_expire_building(void)
+{
+  circuit_build_cutoffs_t cutoffs;
+  struct timeval close_cutoff, extremely_old_cutoff;
+  struct timeval now;
+  int64_t now_msec;
+  smartlist_t *due;
+  int any_opened_circs = 0;
+
+  tor_gettimeofday(&now);
+  now_msec = tv_to_msec(&now);
+
+  /* If the build timeout or our options have changed, every deadline we
+   * computed is stale. */
+  circuit_build_cutoffs_compute(&cutoffs);
+  if (!build_deadline_cutoffs_set ||
+      fast_memneq(&cutoffs, &build_deadline_cutoffs, sizeof(cutoffs))) {
+    build_deadline_cutoffs = cutoffs;
+    build_deadline_cutoffs_set = 1;
+    SMARTLIST_FOREACH(circuit_get_global_origin_circuit_list(),
+                      origin_circuit_t *, circ,
+                      circuit_build_deadline_update(circ));
+  }
+
+  if (!circuits_by_build_deadline ||
+      smartlist_len(circuits_by_build_deadline) == 0)
+    return;
+  if (((origin_circuit_t *)smartlist_get(circuits_by_build_deadline, 0))
+        ->build_deadline_msec > now_msec)
+    return; /* Nothing is due yet. */
+
+  /* Check to see if we have any opened circuits. If we don't,
+   * we want to be more lenient with timeouts, in case the
+   * user has relocated and/or changed network connections.
+   * See bug #3443. */
+  SMARTLIST_FOREACH_BEGIN(circuit_get_global_origin_circuit_list(),
+                          origin_circuit_t *, next_circ) {
+    if (TO_CIRCUIT(next_circ)->marked_for_close) {
+      continue; /* don't mess with marked circs */
+    }
+
+    if (next_circ->has_opened &&
+        TO_CIRCUIT(next_circ)->state == CIRCUIT_STATE_OPEN &&
+        next_circ->build_state &&
+        next_circ->build_state->desired_path_len == DEFAULT_ROUTE_LEN) {
+      any_opened_circs = 1;
+      break;
+    }
+  } SMARTLIST_FOREACH_END(next_circ);
+
+#define SET_CUTOFF(target, msec) do {                       \
+    long ms = (msec);                                       \
+    struct timeval diff;                                    \
+    diff.tv_sec = ms / 1000;                                \
+    diff.tv_usec = (int)((ms % 1000) * 1000);               \
+    timersub(&now, &diff, &target);                         \
+  } while (0)
+
+  SET_CUTOFF(close_cutoff, cutoffs.close);
+  SET_CUTOFF(extremely_old_cutoff, cutoffs.extremely_old);
+
+  /* Take everything that's due off the queue before we look at any of it,
+   * since looking at a circuit can put it back. */
+  due = smartlist_new();
+  while (smartlist_len(circuits_by_build_deadline) &&
+         ((origin_circuit_t *)smartlist_get(circuits_by_build_deadline, 0))
+           ->build_deadline_msec <= now_msec) {
+    smartlist_add(due, smartlist_pqueue_pop(circuits_by_build_deadline,
+                            compare_origin_circuits_by_build_deadline_,
+                            offsetof(origin_circuit_t, build_deadline_idx)));
+  }
+
+  SMARTLIST_FOREACH_BEGIN(due, origin_circuit_t *, origin_victim) {
+    circuit_t *victim = TO_CIRCUIT(origin_victim);
     struct timeval cutoff;
-    if (!CIRCUIT_IS_ORIGIN(victim) || /* didn't originate here */
-        victim->marked_for_close)     /* don't mess with marked circs */
+    if (victim->marked_for_close)     /* don't mess with marked circs */
       continue;
 
     /* If we haven't yet started the first hop, it means we don't have
@@ -534,33 +736,11 @@ circuit_expire_building(void)
      * Continue to wait in this case. The ORConn should timeout
      * independently and kill us then.
      */
-    if (TO_ORIGIN_CIRCUIT(victim)->cpath->state == CPATH_STATE_CLOSED) {
+    if (origin_victim->cpath->state == CPATH_STATE_CLOSED) {
       continue;
     }
 
-    build_state = TO_ORIGIN_CIRCUIT(victim)->build_state;
-    if (build_state && build_state->onehop_tunnel)
-      cutoff = begindir_cutoff;
-    else if (victim->purpose == CIRCUIT_PURPOSE_C_MEASURE_TIMEOUT)
-      cutoff = close_cutoff;
-    else if (victim->purpose == CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT)
-      cutoff = c_intro_cutoff;
-    else if (victim->purpose == CIRCUIT_PURPOSE_S_ESTABLISH_INTRO)
-      cutoff = s_intro_cutoff;
-    else if (victim->purpose == CIRCUIT_PURPOSE_C_ESTABLISH_REND)
-      cutoff = stream_cutoff;
-    else if (victim->purpose == CIRCUIT_PURPOSE_PATH_BIAS_TESTING)
-      cutoff = close_cutoff;
-    else if (TO_ORIGIN_CIRCUIT(victim)->has_opened &&
-             victim->state != CIRCUIT_STATE_OPEN)
-      cutoff = cannibalized_cutoff;
-    else if (build_state && build_state->desired_path_len >= 4)
-      cutoff = fourhop_cutoff;
-    else
-      cutoff = general_cutoff;
-
-    if (TO_ORIGIN_CIRCUIT(victim)->hs_circ_has_timed_out)
-      cutoff = hs_extremely_old_cutoff;
+    SET_CUTOFF(cutoff, circuit_build_cutoff_for(origin_victim, &cutoffs));
 
     if (timercmp(&victim->timestamp_began, &cutoff, OP_GT))
       continue; /* it's still young, leave it alone */
@@ -818,7 +998,13 @@ circuit_expire_building(void)
       circuit_mark_for_close(victim, END_CIRC_REASON_TIMEOUT);
 
     pathbias_count_timeout(TO_ORIGIN_CIRCUIT(victim));
-  } SMARTLIST_FOREACH_END(victim);
+  } SMARTLIST_FOREACH_END(origin_victim);
+
+  /* Requeue whatever we spared, to look at again once it's due. */
+  SMARTLIST_FOREACH(due, origin_circuit_t *, circ,
+                    circuit_build_deadline_update(circ));
+  smartlist_free(due);
+#undef SET_CUTOFF
 }
 
 /**
@@ -1026,13 +1212,12 @@ circuit_stream_is_being_handled(entry_connection_t *conn,
                                    get_options()->LongLivedPorts,
                                    conn ? conn->socks_request->port : port);
 
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    if (CIRCUIT_IS_ORIGIN(circ) &&
-        !circ->marked_for_close &&
-        circ->purpose == CIRCUIT_PURPOSE_C_GENERAL &&
+  ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(CIRCUIT_PURPOSE_C_GENERAL,
+                                            origin_circ) {
+    const circuit_t *circ = TO_CIRCUIT(origin_circ);
+    if (!circ->marked_for_close &&
         (!circ->timestamp_dirty ||
          circ->timestamp_dirty + get_options()->MaxCircuitDirtiness > now)) {
-      origin_circuit_t *origin_circ = TO_ORIGIN_CIRCUIT(circ);
       cpath_build_state_t *build_state = origin_circ->build_state;
       if (build_state->is_internal || build_state->onehop_tunnel)
         continue;
@@ -1059,8 +1244,7 @@ circuit_stream_is_being_handled(entry_connection_t *conn,
         }
       }
     }
-  }
-  SMARTLIST_FOREACH_END(circ);
+  } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(origin_circ);
   return 0;
 }
 
@@ -1211,19 +1395,19 @@ circuit_predict_and_launch_new(void)
   int flags = 0;
 
   /* Count how many of each type of circuit we currently have. */
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    if (!circuit_is_available_for_use(circ))
+  ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(CIRCUIT_PURPOSE_C_GENERAL,
+                                            ocirc) {
+    if (!circuit_is_available_for_use(TO_CIRCUIT(ocirc)))
       continue;
 
     num++;
 
-    cpath_build_state_t *build_state = TO_ORIGIN_CIRCUIT(circ)->build_state;
+    cpath_build_state_t *build_state = ocirc->build_state;
     if (build_state->is_internal)
       num_internal++;
     if (build_state->need_uptime && build_state->is_internal)
       num_uptime_internal++;
-  }
-  SMARTLIST_FOREACH_END(circ);
+  } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(ocirc);
 
   /* If that's enough, then stop now. */
   if (num >= MAX_UNUSED_OPEN_CIRCUITS)
@@ -1572,13 +1756,11 @@ circuit_enough_testing_circs(void)
   if (have_performed_bandwidth_test)
     return 1;
 
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    if (!circ->marked_for_close && CIRCUIT_IS_ORIGIN(circ) &&
-        circ->purpose == CIRCUIT_PURPOSE_TESTING &&
-        circ->state == CIRCUIT_STATE_OPEN)
+  ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(CIRCUIT_PURPOSE_TESTING, ocirc) {
+    if (!TO_CIRCUIT(ocirc)->marked_for_close &&
+        TO_CIRCUIT(ocirc)->state == CIRCUIT_STATE_OPEN)
       num++;
-  }
-  SMARTLIST_FOREACH_END(circ);
+  } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(ocirc);
   return num >= NUM_PARALLEL_TESTING_CIRCS;
 }
 
@@ -1625,7 +1807,7 @@ circuit_testing_failed(origin_circuit_t *circ, int at_last_hop)
 /** The circuit <b>circ</b> has just become open. Take the next
  * step: for rendezvous circuits, we pass circ to the appropriate
  * function in rendclient or rendservice. For general circuits, we
- * call connection_ap_attach_pending, which looks for pending streams
+ * call circuit_try_attaching_streams, which looks for pending streams
  * that could use circ.
  */
 void
@@ -1704,14 +1886,14 @@ void
 circuit_try_attaching_streams(origin_circuit_t *circ)
 {
   /* Attach streams to this circuit if we can. */
-  connection_ap_attach_pending(1);
+  connection_ap_attach_pending_to_circ(circ);
 
   /* The call to circuit_try_clearing_isolation_state here will do
    * nothing and return 0 if we didn't attach any streams to circ
    * above. */
   if (circuit_try_clearing_isolation_state(circ)) {
     /* Maybe *now* we can attach some streams to this circuit. */
-    connection_ap_attach_pending(1);
+    connection_ap_attach_pending_to_circ(circ);
   }
 }
 
@@ -2005,6 +2187,47 @@ circuit_reset_failure_count(int timeout)
   n_circuit_failures = 0;
 }
 
+/** Set *<b>need_uptime_out</b> and *<b>need_internal_out</b> to whether
+ * <b>conn</b> needs a high-uptime circuit and an "internal" circuit
+ * respectively, when we're looking for a circuit of
+ * <b>desired_circuit_purpose</b> for it. */
+static void
+circuit_stream_needs(const entry_connection_t *conn,
+                     uint8_t desired_circuit_purpose,
+                     int *need_uptime_out, int *need_internal_out)
+{
+  *need_uptime_out = !conn->want_onehop && !conn->use_begindir &&
+    smartlist_contains_int_as_string(get_options()->LongLivedPorts,
+                                     conn->socks_request->port);
+
+  if (desired_circuit_purpose != CIRCUIT_PURPOSE_C_GENERAL)
+    *need_internal_out = 1;
+  else if (conn->use_begindir || conn->want_onehop)
+    *need_internal_out = 1;
+  else
+    *need_internal_out = 0;
+}
+
+/** Return 1 if <b>circ</b> is an open circuit that
+ * connection_ap_handshake_attach_circuit() could attach the pending stream
+ * <b>conn</b> to.  Else return 0. */
+int
+circuit_could_carry_stream(const origin_circuit_t *circ,
+                           const entry_connection_t *conn)
+{
+  uint8_t purpose;
+  int need_uptime, need_internal;
+
+  if (connection_edge_is_rendezvous_stream(ENTRY_TO_EDGE_CONN(conn)))
+    purpose = CIRCUIT_PURPOSE_C_REND_JOINED;
+  else
+    purpose = CIRCUIT_PURPOSE_C_GENERAL;
+  circuit_stream_needs(conn, purpose, &need_uptime, &need_internal);
+
+  return circuit_is_acceptable(circ, conn, 1, purpose,
+                               need_uptime, need_internal, approx_time());
+}
+
 /** Find an open circ that we're happy to use for <b>conn</b> and return 1. If
  * there isn't one, and there isn't one on the way, launch one and return
  * 0. If it will never work, return -1.
@@ -2041,18 +2264,9 @@ circuit_get_open_circ_or_launch(entry_connection_t *conn,
   /* Does this connection want a one-hop circuit? */
   want_onehop = conn->want_onehop;
 
-  /* Do we need a high-uptime circuit? */
-  need_uptime = !conn->want_onehop && !conn->use_begindir &&
-                smartlist_contains_int_as_string(options->LongLivedPorts,
-                                          conn->socks_request->port);
-
-  /* Do we need an "internal" circuit? */
-  if (desired_circuit_purpose != CIRCUIT_PURPOSE_C_GENERAL)
-    need_internal = 1;
-  else if (conn->use_begindir || conn->want_onehop)
-    need_internal = 1;
-  else
-    need_internal = 0;
+  /* Do we need a high-uptime or an "internal" circuit? */
+  circuit_stream_needs(conn, desired_circuit_purpose,
+                       &need_uptime, &need_internal);
 
   /* We now know what kind of circuit we need.  See if there is an
    * open circuit that we can use for this stream */
@@ -2856,6 +3070,8 @@ circuit_change_purpose(circuit_t *circ, uint8_t new_purpose)
   circ->purpose = new_purpose;
 
   if (CIRCUIT_IS_ORIGIN(circ)) {
+    circuit_update_purpose_index(TO_ORIGIN_CIRCUIT(circ));
+    circuit_build_deadline_update(TO_ORIGIN_CIRCUIT(circ));
     control_event_circuit_purpose_changed(TO_ORIGIN_CIRCUIT(circ),
                                           old_purpose);
   }
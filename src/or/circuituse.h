@@ -13,6 +13,8 @@
 #define TOR_CIRCUITUSE_H
 
 void circuit_expire_building(void);
+void circuit_build_deadline_update(origin_circuit_t *circ);
+void circuit_build_deadlines_free_all(void);
 void circuit_expire_waiting_for_better_guard(void);
 void circuit_remove_handled_ports(smartlist_t *needed_ports);
 int circuit_stream_is_being_handled(entry_connection_t *conn, uint16_t port,
@@ -33,6 +35,8 @@ int circuit_enough_testing_circs(void);
 
 void circuit_has_opened(origin_circuit_t *circ);
 void circuit_try_attaching_streams(origin_circuit_t *circ);
+int circuit_could_carry_stream(const origin_circuit_t *circ,
+                               const entry_connection_t *conn);
 void circuit_build_failed(origin_circuit_t *circ);
 
 /** Flag to set when a circuit should have only a single hop. */
@@ -54,6 +54,7 @@
 #include "relay.h"
 #include "router.h"
 #include "routerlist.h"
+#include "trace/events.h"
 
 /** How many CELL_CREATE cells have we received, ever? */
 uint64_t stats_n_create_cells_processed = 0;
@@ -178,6 +179,9 @@ command_process_cell(channel_t *chan, cell_t *cell)
 #define PROCESS_CELL(tp, cl, cn) command_process_ ## tp ## _cell(cl, cn)
 #endif /* defined(KEEP_TIMING_STATS) */
 
+  tor_trace(cell, recv, cell->command, cell->circ_id,
+            chan->global_identifier);
+
   switch (cell->command) {
     case CELL_CREATE:
     case CELL_CREATE_FAST:
@@ -224,6 +224,9 @@ static config_var_t option_vars_[] = {
   V(AlternateDirAuthority,       LINELIST, NULL),
   OBSOLETE("AlternateHSAuthority"),
   V(AssumeReachable,             BOOL,     "0"),
+  V(AsyncLogBufferSize,          MEMUNIT,  "1 MB"),
+  V(AsyncLogging,                BOOL,     "0"),
+  V(AsyncLogOverflowPolicy,      STRING,   "drop"),
   OBSOLETE("AuthDirBadDir"),
   OBSOLETE("AuthDirBadDirCCs"),
   V(AuthDirBadExit,              LINELIST, NULL),
@@ -325,6 +328,13 @@ static config_var_t option_vars_[] = {
   V(DoSConnectionEnabled,        AUTOBOOL, "auto"),
   V(DoSConnectionMaxConcurrentCount,       UINT, "0"),
   V(DoSConnectionDefenseType,    INT,      "0"),
+  /* DoS prefix aggregation options. */
+  V(DoSPrefixAggregationEnabled, AUTOBOOL, "auto"),
+  V(DoSPrefixIPv4Bits,           UINT,     "0"),
+  V(DoSPrefixIPv6Bits,           UINT,     "0"),
+  V(DoSPrefixCircuitRate,        UINT,     "0"),
+  V(DoSPrefixCircuitBurst,       UINT,     "0"),
+  V(DoSPrefixMaxConcurrentCount, UINT,     "0"),
   /* DoS single hop client options. */
   V(DoSRefuseSingleHopClientRendezvous,    AUTOBOOL, "auto"),
   V(DownloadExtraInfo,           BOOL,     "0"),
@@ -515,7 +525,9 @@ static config_var_t option_vars_[] = {
   V(SafeSocks,                   BOOL,     "0"),
   V(ServerDNSAllowBrokenConfig,  BOOL,     "1"),
   V(ServerDNSAllowNonRFC953Hostnames, BOOL,"0"),
+  V(ServerDNSCacheMaxMemory,     MEMUNIT,  "32 MB"),
   V(ServerDNSDetectHijacking,    BOOL,     "1"),
+  V(ServerDNSPrefetchMinHits,    UINT,     "3"),
   V(ServerDNSRandomizeCase,      BOOL,     "1"),
   V(ServerDNSResolvConfFile,     STRING,   NULL),
   V(ServerDNSSearchDomains,      BOOL,     "0"),
@@ -1839,6 +1851,14 @@ options_act(const or_options_t *old_options)
     finish_daemon(options->DataDirectory);
   }
 
+  /* Now that we won't fork anymore, we can hand our logs to a thread. */
+  if (logs_set_async(options->AsyncLogging,
+                     (size_t) options->AsyncLogBufferSize,
+                     options->AsyncLogOverflowPolicy_) < 0) {
+    log_warn(LD_CONFIG, "Unable to start the asynchronous log writer; "
+             "logging synchronously instead.");
+  }
+
   /* We want to reinit keys as needed before we do much of anything else:
      keys are important, and other things can depend on them. */
   if (transition_affects_workers ||
@@ -1893,6 +1913,11 @@ options_act(const or_options_t *old_options)
     log_warn(LD_GENERAL,"Error loading rendezvous service keys");
     return -1;
   }
+  /* Onion services decrypt their INTRODUCE2 cells on the cpuworkers. Relays
+   * get them started once their onion keys are loaded. */
+  if (hs_service_get_num_services() > 0 && !server_mode(options)) {
+    cpu_init();
+  }
 
   /* Inform the scheduler subsystem that a configuration changed happened. It
    * might be a change of scheduler or parameter. */
@@ -3627,6 +3652,26 @@ options_validate(or_options_t *old_options, or_options_t *options,
     return -1;
   }
 
+  if (!options->AsyncLogOverflowPolicy ||
+      !strcasecmp(options->AsyncLogOverflowPolicy, "drop")) {
+    options->AsyncLogOverflowPolicy_ = LOG_ASYNC_OVERFLOW_DROP;
+  } else if (!strcasecmp(options->AsyncLogOverflowPolicy, "block")) {
+    options->AsyncLogOverflowPolicy_ = LOG_ASYNC_OVERFLOW_BLOCK;
+  } else {
+    tor_asprintf(msg, "Unrecognized value '%s' in AsyncLogOverflowPolicy",
+                 escaped(options->AsyncLogOverflowPolicy));
+    return -1;
+  }
+
+  if (options->AsyncLogging &&
+      (options->AsyncLogBufferSize < LOG_ASYNC_MIN_BUFFER_SIZE ||
+       options->AsyncLogBufferSize > SIZE_T_CEILING)) {
+    tor_asprintf(msg, "AsyncLogBufferSize must be between %d bytes and "
+                 U64_FORMAT " bytes.", LOG_ASYNC_MIN_BUFFER_SIZE,
+                 U64_PRINTF_ARG(SIZE_T_CEILING));
+    return -1;
+  }
+
   if (compute_publishserverdescriptor(options) < 0) {
     tor_asprintf(msg, "Unrecognized value in PublishServerDescriptor");
     return -1;
@@ -85,6 +85,7 @@
 #include "ext_orport.h"
 #include "geoip.h"
 #include "main.h"
+#include "objpool.h"
 #include "hs_common.h"
 #include "hs_ident.h"
 #include "nodelist.h"
@@ -102,6 +103,7 @@
 #include "routerparse.h"
 #include "sandbox.h"
 #include "transports.h"
+#include "trace/events.h"
 
 #ifdef HAVE_PWD_H
 #include <pwd.h>
@@ -155,6 +157,11 @@ static tor_addr_t *last_interface_ipv6 = NULL;
  * Used to detect IP address changes. */
 static smartlist_t *outgoing_addrs = NULL;
 
+/** Pools for stream connections, which come and go far more often than any
+ * other kind.  Each is created on first use. */
+static objpool_t *entry_connection_pool = NULL;
+static objpool_t *edge_connection_pool = NULL;
+
 #define CASE_ANY_LISTENER_TYPE \
     case CONN_TYPE_OR_LISTENER: \
     case CONN_TYPE_EXT_OR_LISTENER: \
@@ -327,8 +334,12 @@ or_connection_new(int type, int socket_family)
 entry_connection_t *
 entry_connection_new(int type, int socket_family)
 {
-  entry_connection_t *entry_conn = tor_malloc_zero(sizeof(entry_connection_t));
+  entry_connection_t *entry_conn;
   tor_assert(type == CONN_TYPE_AP);
+  if (PREDICT_UNLIKELY(!entry_connection_pool))
+    entry_connection_pool = objpool_new("entry_connection",
+                                        sizeof(entry_connection_t), 0);
+  entry_conn = objpool_alloc_zero(entry_connection_pool);
   connection_init(time(NULL), ENTRY_TO_CONN(entry_conn), type, socket_family);
   entry_conn->socks_request = socks_request_new();
   /* If this is coming from a listener, we'll set it up based on the listener
@@ -348,8 +359,12 @@ entry_connection_new(int type, int socket_family)
 edge_connection_t *
 edge_connection_new(int type, int socket_family)
 {
-  edge_connection_t *edge_conn = tor_malloc_zero(sizeof(edge_connection_t));
+  edge_connection_t *edge_conn;
   tor_assert(type == CONN_TYPE_EXIT);
+  if (PREDICT_UNLIKELY(!edge_connection_pool))
+    edge_connection_pool = objpool_new("edge_connection",
+                                       sizeof(edge_connection_t), 0);
+  edge_conn = objpool_alloc_zero(edge_connection_pool);
   connection_init(time(NULL), TO_CONN(edge_conn), type, socket_family);
   return edge_conn;
 }
@@ -507,6 +522,7 @@ connection_free_(connection_t *conn)
 {
   void *mem;
   size_t memlen;
+  objpool_t *pool = NULL;
   if (!conn)
     return;
 
@@ -521,11 +537,13 @@ connection_free_(connection_t *conn)
       tor_assert(conn->magic == ENTRY_CONNECTION_MAGIC);
       mem = TO_ENTRY_CONN(conn);
       memlen = sizeof(entry_connection_t);
+      pool = entry_connection_pool;
       break;
     case CONN_TYPE_EXIT:
       tor_assert(conn->magic == EDGE_CONNECTION_MAGIC);
       mem = TO_EDGE_CONN(conn);
       memlen = sizeof(edge_connection_t);
+      pool = edge_connection_pool;
       break;
     case CONN_TYPE_DIR:
       tor_assert(conn->magic == DIR_CONNECTION_MAGIC);
@@ -622,6 +640,8 @@ connection_free_(connection_t *conn)
     control_connection_t *control_conn = TO_CONTROL_CONN(conn);
     tor_free(control_conn->safecookie_client_hash);
     tor_free(control_conn->incoming_cmd);
+    control_getinfo_stream_free(control_conn->getinfo_stream);
+    control_conn->getinfo_stream = NULL;
     if (control_conn->ephemeral_onion_services) {
       SMARTLIST_FOREACH(control_conn->ephemeral_onion_services, char *, cp, {
         memwipe(cp, 0, strlen(cp));
@@ -675,7 +695,10 @@ connection_free_(connection_t *conn)
   }
 
   memwipe(mem, 0xCC, memlen); /* poison memory */
-  tor_free(mem);
+  if (pool)
+    objpool_free(pool, mem);
+  else
+    tor_free(mem);
 }
 
 /** Make sure <b>conn</b> isn't in any of the global conn lists; then free it.
@@ -3972,6 +3995,9 @@ connection_handle_write_impl(connection_t *conn, int force)
     n_written = (size_t) result;
   }
 
+  tor_trace(buffer, flush, conn->global_identifier, n_written,
+            buf_datalen(conn->outbuf));
+
   if (n_written && conn->type == CONN_TYPE_AP) {
     edge_connection_t *edge_conn = TO_EDGE_CONN(conn);
     circuit_t *circ = circuit_get_by_edge_conn(edge_conn);
@@ -4567,6 +4593,8 @@ connection_flushed_some(connection_t *conn)
     r = connection_or_flushed_some(TO_OR_CONN(conn));
   } else if (CONN_IS_EDGE(conn)) {
     r = connection_edge_flushed_some(TO_EDGE_CONN(conn));
+  } else if (conn->type == CONN_TYPE_CONTROL) {
+    r = connection_control_flushed_some(TO_CONTROL_CONN(conn));
   }
   conn->in_flushed_some = 0;
   return r;
@@ -5237,6 +5265,11 @@ connection_free_all(void)
 
   tor_free(last_interface_ipv4);
   tor_free(last_interface_ipv6);
+
+  objpool_destroy(entry_connection_pool);
+  entry_connection_pool = NULL;
+  objpool_destroy(edge_connection_pool);
+  edge_connection_pool = NULL;
 }
 
 /** Log a warning, and possibly emit a control event, that <b>received</b> came
@@ -911,23 +911,13 @@ connection_ap_rescan_and_attach_pending(void)
 #define UNMARK() do { } while (0)
 #endif /* defined(DEBUGGING_17659) */
 
-/** Tell any AP streams that are listed as waiting for a new circuit to try
- * again.  If there is an available circuit for a stream, attach it. Otherwise,
- * launch a new circuit.
- *
- * If <b>retry</b> is false, only check the list if it contains at least one
- * streams that we have not yet tried to attach to a circuit.
- */
-void
-connection_ap_attach_pending(int retry)
+/** Helper for connection_ap_attach_pending() and
+ * connection_ap_attach_pending_to_circ(): try to attach every pending stream,
+ * or, if <b>circ</b> is set, every pending stream that <b>circ</b> could
+ * carry.  Leave the other streams on the list untouched. */
+static void
+connection_ap_attach_pending_impl(const origin_circuit_t *circ)
 {
-  if (PREDICT_UNLIKELY(!pending_entry_connections)) {
-    return;
-  }
-
-  if (untried_pending_connections == 0 && !retry)
-    return;
-
   /* Don't allow any modifications to list while we are iterating over
    * it.  We'll put streams back on this list if we can't attach them
    * immediately. */
@@ -957,6 +947,14 @@ connection_ap_attach_pending(int retry)
       continue;
     }
 
+    /* If this circuit can't carry the stream, nothing has changed for it:
+     * leave it where it was. */
+    if (circ && !circuit_could_carry_stream(circ, entry_conn)) {
+      if (!smartlist_contains(pending_entry_connections, entry_conn))
+        smartlist_add(pending_entry_connections, entry_conn);
+      continue;
+    }
+
     /* Okay, we're through the sanity checks. Try to handle this stream. */
     if (connection_ap_handshake_attach_circuit(entry_conn) < 0) {
       if (!conn->marked_for_close)
@@ -982,9 +980,46 @@ connection_ap_attach_pending(int retry)
   } SMARTLIST_FOREACH_END(entry_conn);
 
   smartlist_free(pending);
+}
+
+/** Tell any AP streams that are listed as waiting for a new circuit to try
+ * again.  If there is an available circuit for a stream, attach it. Otherwise,
+ * launch a new circuit.
+ *
+ * If <b>retry</b> is false, only check the list if it contains at least one
+ * streams that we have not yet tried to attach to a circuit.
+ */
+void
+connection_ap_attach_pending(int retry)
+{
+  if (PREDICT_UNLIKELY(!pending_entry_connections)) {
+    return;
+  }
+
+  if (untried_pending_connections == 0 && !retry)
+    return;
+
+  connection_ap_attach_pending_impl(NULL);
   untried_pending_connections = 0;
 }
 
+/** The open circuit <b>circ</b> has just become usable for streams.  Try to
+ * attach the pending AP streams that it could carry.
+ *
+ * Unlike connection_ap_attach_pending(), this doesn't retry the streams that
+ * <b>circ</b> is no use to: nothing has changed for them, and
+ * circuit_build_needed_circs() retries every pending stream once a second.
+ */
+void
+connection_ap_attach_pending_to_circ(const origin_circuit_t *circ)
+{
+  tor_assert(circ);
+  if (PREDICT_UNLIKELY(!pending_entry_connections))
+    return;
+
+  connection_ap_attach_pending_impl(circ);
+}
+
 /** Mark <b>entry_conn</b> as needing to get attached to a circuit.
  *
  * And <b>entry_conn</b> must be in AP_CONN_STATE_CIRCUIT_WAIT,
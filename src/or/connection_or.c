@@ -1847,6 +1847,7 @@ connection_init_or_handshake_state(or_connection_t *conn, int started_here)
   if (! started_here && get_current_link_cert_cert()) {
     s->own_link_cert = tor_cert_dup(get_current_link_cert_cert());
   }
+  s->own_link_cert_generation = get_ed_keys_generation();
   s->certs = or_handshake_certs_new();
   s->certs->started_here = s->started_here;
   return 0;
@@ -1858,6 +1859,7 @@ or_handshake_state_free(or_handshake_state_t *state)
 {
   if (!state)
     return;
+  channel_tls_cancel_handshake_crypto(state);
   crypto_digest_free(state->digest_sent);
   crypto_digest_free(state->digest_received);
   or_handshake_certs_free(state->certs);
@@ -2062,6 +2064,10 @@ connection_or_process_cells_from_inbuf(or_connection_t *conn)
    */
 
   while (1) {
+    /* A cpuworker is busy with the last handshake cell; the rest wait. */
+    if (conn->handshake_state && conn->handshake_state->crypto_job)
+      return 0;
+
     log_debug(LD_OR,
               TOR_SOCKET_T_FORMAT": starting, inbuf_datalen %d "
               "(%d pending in tls object).",
@@ -2080,11 +2086,16 @@ connection_or_process_cells_from_inbuf(or_connection_t *conn)
       var_cell_free(var_cell);
     } else {
       const int wide_circ_ids = conn->wide_circ_ids;
-      size_t cell_network_size = get_cell_network_size(conn->wide_circ_ids);
-      char buf[CELL_MAX_NETWORK_SIZE];
+      const size_t cell_network_size = get_cell_network_size(wide_circ_ids);
+      const char *cells;
       cell_t cell;
-      if (connection_get_inbuf_len(TO_CONN(conn))
-          < cell_network_size) /* whole response available? */
+      int i, n_cells;
+
+      /* Handle every complete fixed-length cell in the first chunk of the
+       * inbuf where it sits, and drain them all at once afterwards. */
+      n_cells = peek_fixed_cells_from_buf(conn->base_.inbuf, conn->link_proto,
+                                          &cells);
+      if (!n_cells)
         return 0; /* not yet */
 
       /* Touch the channel's active timestamp if there is one */
@@ -2092,13 +2103,15 @@ connection_or_process_cells_from_inbuf(or_connection_t *conn)
         channel_timestamp_active(TLS_CHAN_TO_BASE(conn->chan));
 
       circuit_build_times_network_is_live(get_circuit_build_times_mutable());
-      connection_buf_get_bytes(buf, cell_network_size, TO_CONN(conn));
 
-      /* retrieve cell info from buf (create the host-order struct from the
-       * network-order string) */
-      cell_unpack(&cell, buf, wide_circ_ids);
+      for (i = 0; i < n_cells; ++i) {
+        /* retrieve cell info from the inbuf (create the host-order struct
+         * from the network-order string) */
+        cell_unpack(&cell, cells + cell_network_size * i, wide_circ_ids);
 
-      channel_tls_handle_cell(&cell, conn);
+        channel_tls_handle_cell(&cell, conn);
+      }
+      buf_drain(conn->base_.inbuf, cell_network_size * n_cells);
     }
   }
 }
@@ -2282,6 +2295,27 @@ int certs_cell_ed25519_disabled_for_testing = 0;
 #define certs_cell_ed25519_disabled_for_testing 0
 #endif
 
+/** A CERTS cell that we've already encoded, along with the keys that went
+ * into it. */
+typedef struct certs_cell_cache_t {
+  /** The tor_tls_get_my_context_serial() of the TLS context whose
+   * certificates are in <b>cell</b>. */
+  uint64_t tls_context_serial;
+  /** The get_ed_keys_generation() of the Ed25519 certificates in
+   * <b>cell</b>. */
+  uint64_t ed_keys_generation;
+  /** True iff we left the Ed25519 certificates out of <b>cell</b>. */
+  int ed25519_disabled;
+  /** The encoded cell, or NULL if we haven't made one yet. */
+  var_cell_t *cell;
+} certs_cell_cache_t;
+
+/** The last CERTS cell that we sent as an initiator (index 0) and as a
+ * responder (index 1).  Every connection that uses the same keys gets the
+ * same CERTS cell, so we only need to encode it again when the keys change.
+ */
+static certs_cell_cache_t certs_cell_cache[2];
+
 /** Send a CERTS cell on the connection <b>conn</b>.  Return 0 on success, -1
  * on failure. */
 int
@@ -2289,6 +2323,12 @@ connection_or_send_certs_cell(or_connection_t *conn)
 {
   const tor_x509_cert_t *global_link_cert = NULL, *id_cert = NULL;
   tor_x509_cert_t *own_link_cert = NULL;
+  const tor_cert_t *ed_link_cert;
+  const uint8_t *crosscert = NULL;
+  size_t crosscert_len = 0;
+  uint64_t tls_context_serial, ed_keys_generation;
+  int cacheable;
+  certs_cell_cache_t *cache;
   var_cell_t *cell;
 
   certs_cell_t *certs_cell = NULL;
@@ -2305,10 +2345,35 @@ connection_or_send_certs_cell(or_connection_t *conn)
                            &global_link_cert, &id_cert) < 0)
     return -1;
 
+  /* Everything in the cell comes from our current TLS context and Ed25519
+   * keys, except that a responder sends the link certificates it had when
+   * its connection began.  We can only share the cell with other
+   * connections when those are still current. */
+  tls_context_serial = tor_tls_get_my_context_serial(conn_in_server_mode);
+  ed_keys_generation = get_ed_keys_generation();
+  cacheable = ! conn_in_server_mode ||
+    (tor_tls_get_context_serial(conn->tls) == tls_context_serial &&
+     conn->handshake_state->own_link_cert_generation == ed_keys_generation);
+
+  /* If nothing has changed since we last built a cell like this one, just
+   * send that again. */
+  cache = &certs_cell_cache[conn_in_server_mode];
+  if (cacheable && cache->cell &&
+      cache->tls_context_serial == tls_context_serial &&
+      cache->ed_keys_generation == ed_keys_generation &&
+      cache->ed25519_disabled == certs_cell_ed25519_disabled_for_testing) {
+    connection_or_write_var_cell_to_buf(cache->cell, conn);
+    return 0;
+  }
+
   if (conn_in_server_mode) {
     own_link_cert = tor_tls_get_own_cert(conn->tls);
+    ed_link_cert = conn->handshake_state->own_link_cert;
+  } else {
+    ed_link_cert = get_current_auth_key_cert();
   }
   tor_assert(id_cert);
+  get_master_rsa_crosscert(&crosscert, &crosscert_len);
 
   certs_cell = certs_cell_new();
 
@@ -2332,27 +2397,22 @@ connection_or_send_certs_cell(or_connection_t *conn)
                    CERTTYPE_ED_ID_SIGN,
                    get_master_signing_key_cert());
   if (conn_in_server_mode) {
-    tor_assert_nonfatal(conn->handshake_state->own_link_cert ||
+    tor_assert_nonfatal(ed_link_cert ||
                         certs_cell_ed25519_disabled_for_testing);
     add_ed25519_cert(certs_cell,
                      CERTTYPE_ED_SIGN_LINK,
-                     conn->handshake_state->own_link_cert);
+                     ed_link_cert);
   } else {
     add_ed25519_cert(certs_cell,
                      CERTTYPE_ED_SIGN_AUTH,
-                     get_current_auth_key_cert());
+                     ed_link_cert);
   }
 
   /* And finally the crosscert. */
-  {
-    const uint8_t *crosscert=NULL;
-    size_t crosscert_len;
-    get_master_rsa_crosscert(&crosscert, &crosscert_len);
-    if (crosscert) {
-      add_certs_cell_cert_helper(certs_cell,
+  if (crosscert) {
+    add_certs_cell_cert_helper(certs_cell,
                                CERTTYPE_RSA1024_ID_EDID,
                                crosscert, crosscert_len);
-    }
   }
 
   /* We've added all the certs; make the cell. */
@@ -2367,13 +2427,35 @@ connection_or_send_certs_cell(or_connection_t *conn)
   cell->payload_len = enc_len;
 
   connection_or_write_var_cell_to_buf(cell, conn);
-  var_cell_free(cell);
+
+  /* Remember the cell for the next connection that uses these keys. */
+  if (cacheable) {
+    var_cell_free(cache->cell);
+    cache->cell = cell;
+    cache->tls_context_serial = tls_context_serial;
+    cache->ed_keys_generation = ed_keys_generation;
+    cache->ed25519_disabled = certs_cell_ed25519_disabled_for_testing;
+  } else {
+    var_cell_free(cell);
+  }
+
   certs_cell_free(certs_cell);
   tor_x509_cert_free(own_link_cert);
 
   return 0;
 }
 
+/** Release all storage held by connection_or.c. */
+void
+connection_or_free_all(void)
+{
+  unsigned i;
+  for (i = 0; i < ARRAY_LENGTH(certs_cell_cache); ++i) {
+    var_cell_free(certs_cell_cache[i].cell);
+    memset(&certs_cell_cache[i], 0, sizeof(certs_cell_cache[i]));
+  }
+}
+
 /** Return true iff <b>challenge_type</b> is an AUTHCHALLENGE type that
  * we can send and receive. */
 int
@@ -2452,6 +2534,10 @@ connection_or_send_auth_challenge_cell(or_connection_t *conn)
   return r;
 }
 
+/** Length of the type and length fields at the start of an AUTHENTICATE
+ * cell's payload. */
+#define AUTH_CELL_HEADER_LEN 4
+
 /** Compute the main body of an AUTHENTICATE cell that a client can use
  * to authenticate itself on a v3 handshake for <b>conn</b>.  Return it
  * in a var_cell_t.
@@ -2604,13 +2690,7 @@ connection_or_compute_authenticate_cell_body(or_connection_t *conn,
   crypto_rand((char*)auth->rand, 24);
 
   ssize_t maxlen = auth1_encoded_len(auth, ctx);
-  if (ed_signing_key && is_ed) {
-    maxlen += ED25519_SIG_LEN;
-  } else if (signing_key && !is_ed) {
-    maxlen += crypto_pk_keysize(signing_key);
-  }
 
-  const int AUTH_CELL_HEADER_LEN = 4; /* 2 bytes of type, 2 bytes of length */
   result = var_cell_new(AUTH_CELL_HEADER_LEN + maxlen);
   uint8_t *const out = result->payload + AUTH_CELL_HEADER_LEN;
   const size_t outlen = maxlen;
@@ -2648,45 +2728,17 @@ connection_or_compute_authenticate_cell_body(or_connection_t *conn,
     goto done;
   }
 
-  if (ed_signing_key && is_ed) {
-    ed25519_signature_t sig;
-    if (ed25519_sign(&sig, out, len, ed_signing_key) < 0) {
-      /* LCOV_EXCL_START */
-      log_warn(LD_BUG, "Unable to sign ed25519 authentication data");
-      goto err;
-      /* LCOV_EXCL_STOP */
-    }
-    auth1_setlen_sig(auth, ED25519_SIG_LEN);
-    memcpy(auth1_getarray_sig(auth), sig.sig, ED25519_SIG_LEN);
-
-  } else if (signing_key && !is_ed) {
-    auth1_setlen_sig(auth, crypto_pk_keysize(signing_key));
-
-    char d[32];
-    crypto_digest256(d, (char*)out, len, DIGEST_SHA256);
-    int siglen = crypto_pk_private_sign(signing_key,
-                                    (char*)auth1_getarray_sig(auth),
-                                    auth1_getlen_sig(auth),
-                                    d, 32);
-    if (siglen < 0) {
-      log_warn(LD_OR, "Unable to sign AUTH1 data.");
-      goto err;
-    }
-
-    auth1_setlen_sig(auth, siglen);
-  }
-
-  len = auth1_encode(out, outlen, auth, ctx);
-  if (len < 0) {
-    /* LCOV_EXCL_START */
-    log_warn(LD_BUG, "Unable to encode signed AUTH1 data.");
-    goto err;
-    /* LCOV_EXCL_STOP */
-  }
-  tor_assert(len + AUTH_CELL_HEADER_LEN <= result->payload_len);
   result->payload_len = len + AUTH_CELL_HEADER_LEN;
   set_uint16(result->payload+2, htons(len));
 
+  if ((ed_signing_key && is_ed) || (signing_key && !is_ed)) {
+    var_cell_t *signed_cell =
+      connection_or_sign_authenticate_cell_body(result, signing_key,
+                                                ed_signing_key);
+    var_cell_free(result);
+    result = signed_cell;
+  }
+
   goto done;
 
  err:
@@ -2698,6 +2750,64 @@ connection_or_compute_authenticate_cell_body(or_connection_t *conn,
   return result;
 }
 
+/** Given an unsigned AUTHENTICATE cell <b>cell</b>, as made by
+ * connection_or_compute_authenticate_cell_body() with no signing keys,
+ * return a new copy of it signed with <b>ed_signing_key</b> or
+ * <b>signing_key</b>, as its authentication type requires.  Return NULL on
+ * failure.
+ *
+ * This function doesn't look at any connection or global state, so it is
+ * safe to call from a cpuworker. */
+var_cell_t *
+connection_or_sign_authenticate_cell_body(const var_cell_t *cell,
+                                          crypto_pk_t *signing_key,
+                                    const ed25519_keypair_t *ed_signing_key)
+{
+  const uint8_t *body = cell->payload + AUTH_CELL_HEADER_LEN;
+  const size_t bodylen = cell->payload_len - AUTH_CELL_HEADER_LEN;
+  var_cell_t *result;
+  size_t siglen;
+
+  tor_assert(cell->payload_len >= AUTH_CELL_HEADER_LEN);
+
+  if (ntohs(get_uint16(cell->payload)) == AUTHTYPE_ED25519_SHA256_RFC5705) {
+    ed25519_signature_t sig;
+    if (BUG(!ed_signing_key) ||
+        ed25519_sign(&sig, body, bodylen, ed_signing_key) < 0) {
+      /* LCOV_EXCL_START */
+      log_warn(LD_BUG, "Unable to sign ed25519 authentication data");
+      return NULL;
+      /* LCOV_EXCL_STOP */
+    }
+    result = var_cell_new(cell->payload_len + ED25519_SIG_LEN);
+    memcpy(result->payload + cell->payload_len, sig.sig, ED25519_SIG_LEN);
+    siglen = ED25519_SIG_LEN;
+  } else {
+    char d[DIGEST256_LEN];
+    int r;
+    if (BUG(!signing_key))
+      return NULL; // LCOV_EXCL_LINE
+    result = var_cell_new(cell->payload_len + crypto_pk_keysize(signing_key));
+    crypto_digest256(d, (const char *)body, bodylen, DIGEST_SHA256);
+    r = crypto_pk_private_sign(signing_key,
+                               (char *)result->payload + cell->payload_len,
+                               crypto_pk_keysize(signing_key),
+                               d, sizeof(d));
+    if (r < 0) {
+      log_warn(LD_OR, "Unable to sign AUTH1 data.");
+      var_cell_free(result);
+      return NULL;
+    }
+    siglen = r;
+  }
+
+  result->command = cell->command;
+  memcpy(result->payload, cell->payload, cell->payload_len);
+  result->payload_len = cell->payload_len + siglen;
+  set_uint16(result->payload+2, htons(bodylen + siglen));
+  return result;
+}
+
 /** Send an AUTHENTICATE cell on the connection <b>conn</b>.  Return 0 on
  * success, -1 on failure */
 MOCK_IMPL(int,
@@ -14,6 +14,7 @@
 
 void connection_or_clear_identity(or_connection_t *conn);
 void connection_or_clear_identity_map(void);
+void connection_or_free_all(void);
 void clear_broken_connection_map(int disable);
 or_connection_t *connection_or_get_for_extend(const char *digest,
                                               const tor_addr_t *target_addr,
@@ -95,6 +96,9 @@ var_cell_t *connection_or_compute_authenticate_cell_body(or_connection_t *conn,
                                        crypto_pk_t *signing_key,
                                        const ed25519_keypair_t *ed_signing_key,
                                        int server);
+var_cell_t *connection_or_sign_authenticate_cell_body(const var_cell_t *cell,
+                                      crypto_pk_t *signing_key,
+                                      const ed25519_keypair_t *ed_signing_key);
 MOCK_DECL(int,connection_or_send_authenticate_cell,
           (or_connection_t *conn, int type));
 
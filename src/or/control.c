@@ -54,6 +54,7 @@
 #include "control.h"
 #include "directory.h"
 #include "dirserv.h"
+#include "dns.h"
 #include "dnsserv.h"
 #include "entrynodes.h"
 #include "geoip.h"
@@ -63,6 +64,7 @@
 #include "microdesc.h"
 #include "networkstatus.h"
 #include "nodelist.h"
+#include "objpool.h"
 #include "policies.h"
 #include "proto_control0.h"
 #include "proto_http.h"
@@ -158,6 +160,8 @@ static int control_event_status(int type, int severity, const char *format,
   CHECK_PRINTF(3,0);
 
 static void send_control_done(control_connection_t *conn);
+static void getinfo_stream_defer_event(control_connection_t *conn,
+                                       const char *msg);
 static void send_control_event(uint16_t event,
                                const char *format, ...)
   CHECK_PRINTF(2,3);
@@ -179,8 +183,6 @@ static int handle_control_signal(control_connection_t *conn, uint32_t len,
 static int handle_control_mapaddress(control_connection_t *conn, uint32_t len,
                                      const char *body);
 static char *list_getinfo_options(void);
-static int handle_control_getinfo(control_connection_t *conn, uint32_t len,
-                                  const char *body);
 static int handle_control_extendcircuit(control_connection_t *conn,
                                         uint32_t len,
                                         const char *body);
@@ -367,6 +369,74 @@ connection_write_str_to_buf(const char *s, control_connection_t *conn)
   connection_buf_add(s, len, TO_CONN(conn));
 }
 
+/** Prepare <b>st</b> to escape a new data reply. */
+STATIC void
+control_escape_state_init(control_escape_state_t *st)
+{
+  memset(st, 0, sizeof(*st));
+  st->start_of_line = 1;
+}
+
+/** Helper: append <b>c</b> to <b>out</b> at *<b>n</b>, remembering it in
+ * <b>st</b>. */
+static inline void
+control_escape_emit(control_escape_state_t *st, char *out, size_t *n, char c)
+{
+  out[(*n)++] = c;
+  st->last_out[0] = st->last_out[1];
+  st->last_out[1] = c;
+  if (st->n_out < 2)
+    ++st->n_out;
+}
+
+/** Escape the next <b>len</b> bytes of a data reply from <b>data</b> into
+ * <b>out</b>, as write_escaped_data() does, given that <b>st</b> holds the
+ * state left by the previous pieces.  <b>out</b> must have room for
+ * 2*<b>len</b>+1 bytes.  Return the number of bytes written. */
+STATIC size_t
+control_escape_data_chunk(control_escape_state_t *st, const char *data,
+                          size_t len, char *out)
+{
+  size_t n = 0;
+  const char *end = data + len;
+  while (data < end) {
+    if (*data == '\n') {
+      if (st->started && st->last_in != '\r')
+        control_escape_emit(st, out, &n, '\r');
+      st->start_of_line = 1;
+    } else if (*data == '.') {
+      if (st->start_of_line) {
+        st->start_of_line = 0;
+        control_escape_emit(st, out, &n, '.');
+      }
+    } else {
+      st->start_of_line = 0;
+    }
+    st->started = 1;
+    st->last_in = *data;
+    control_escape_emit(st, out, &n, *data++);
+  }
+  return n;
+}
+
+/** Finish the data reply escaped with <b>st</b>: write a CRLF if the data
+ * didn't end with one, and the terminating period-CRLF line, into
+ * <b>out</b>, which must have room for 5 bytes.  Return the number of bytes
+ * written. */
+STATIC size_t
+control_escape_data_finish(control_escape_state_t *st, char *out)
+{
+  size_t n = 0;
+  if (st->n_out < 2 || fast_memcmp(st->last_out, "\r\n", 2)) {
+    control_escape_emit(st, out, &n, '\r');
+    control_escape_emit(st, out, &n, '\n');
+  }
+  control_escape_emit(st, out, &n, '.');
+  control_escape_emit(st, out, &n, '\r');
+  control_escape_emit(st, out, &n, '\n');
+  return n;
+}
+
 /** Given a <b>len</b>-character string in <b>data</b>, made of lines
  * terminated by CRLF, allocate a new string in *<b>out</b>, and copy the
  * contents of <b>data</b> into *<b>out</b>, adding a period before any period
@@ -380,9 +450,8 @@ write_escaped_data(const char *data, size_t len, char **out)
   tor_assert(len < SIZE_MAX - 9);
   size_t sz_out = len+8+1;
   char *outp;
-  const char *start = data, *end;
+  control_escape_state_t st;
   size_t i;
-  int start_of_line;
   for (i=0; i < len; ++i) {
     if (data[i] == '\n') {
       sz_out += 2; /* Maybe add a CR; maybe add a dot. */
@@ -394,30 +463,9 @@ write_escaped_data(const char *data, size_t len, char **out)
     }
   }
   *out = outp = tor_malloc(sz_out);
-  end = data+len;
-  start_of_line = 1;
-  while (data < end) {
-    if (*data == '\n') {
-      if (data > start && data[-1] != '\r')
-        *outp++ = '\r';
-      start_of_line = 1;
-    } else if (*data == '.') {
-      if (start_of_line) {
-        start_of_line = 0;
-        *outp++ = '.';
-      }
-    } else {
-      start_of_line = 0;
-    }
-    *outp++ = *data++;
-  }
-  if (outp < *out+2 || fast_memcmp(outp-2, "\r\n", 2)) {
-    *outp++ = '\r';
-    *outp++ = '\n';
-  }
-  *outp++ = '.';
-  *outp++ = '\r';
-  *outp++ = '\n';
+  control_escape_state_init(&st);
+  outp += control_escape_data_chunk(&st, data, len, outp);
+  outp += control_escape_data_finish(&st, outp);
   *outp = '\0'; /* NUL-terminate just in case. */
   tor_assert(outp >= *out);
   tor_assert((size_t)(outp - *out) <= sz_out);
@@ -798,7 +846,12 @@ queued_events_flush_all(int force)
     const size_t msg_len = strlen(ev->msg);
     SMARTLIST_FOREACH_BEGIN(controllers, control_connection_t *,
                             control_conn) {
-      if (control_conn->event_mask & bit) {
+      if (!(control_conn->event_mask & bit)) {
+        continue;
+      } else if (control_conn->getinfo_stream) {
+        /* Don't put an event in the middle of a reply. */
+        getinfo_stream_defer_event(control_conn, ev->msg);
+      } else {
         connection_buf_add(ev->msg, msg_len, TO_CONN(control_conn));
       }
     } SMARTLIST_FOREACH_END(control_conn);
@@ -1558,6 +1611,7 @@ static const struct signal_t signal_table[] = {
   { SIGNEWNYM, "NEWNYM" },
   { SIGCLEARDNSCACHE, "CLEARDNSCACHE"},
   { SIGHEARTBEAT, "HEARTBEAT"},
+  { SIGDUMPTRACE, "DUMPTRACE"},
   { 0, NULL },
 };
 
@@ -1823,6 +1877,30 @@ getinfo_helper_misc(control_connection_t *conn, const char *question,
   } else if (!strcmp(question, "limits/max-mem-in-queues")) {
     tor_asprintf(answer, U64_FORMAT,
                  U64_PRINTF_ARG(get_options()->MaxMemInQueues));
+  } else if (!strcmp(question, "memory/pools")) {
+    const smartlist_t *pools = objpool_get_all();
+    smartlist_t *lines = smartlist_new();
+    if (pools) {
+      SMARTLIST_FOREACH_BEGIN(pools, const objpool_t *, pool) {
+        objpool_stats_t st;
+        objpool_get_stats(pool, &st);
+        smartlist_add_asprintf(lines,
+                 "name=%s item-size=%lu chunks=%lu empty-chunks=%lu "
+                 "in-use=%lu bytes=%lu idle-bytes=%lu allocs="U64_FORMAT
+                 " chunks-released="U64_FORMAT,
+                 st.name, (unsigned long)st.item_size,
+                 (unsigned long)st.n_chunks,
+                 (unsigned long)st.n_empty_chunks,
+                 (unsigned long)st.n_items_in_use,
+                 (unsigned long)st.bytes_allocated,
+                 (unsigned long)st.bytes_idle,
+                 U64_PRINTF_ARG(st.n_allocs_total),
+                 U64_PRINTF_ARG(st.n_chunks_released_total));
+      } SMARTLIST_FOREACH_END(pool);
+    }
+    *answer = smartlist_join_strings(lines, "\n", 0, NULL);
+    SMARTLIST_FOREACH(lines, char *, cp, tor_free(cp));
+    smartlist_free(lines);
   } else if (!strcmp(question, "fingerprint")) {
     crypto_pk_t *server_key;
     if (!server_mode(get_options())) {
@@ -3166,6 +3244,8 @@ static const getinfo_item_t getinfo_items[] = {
        "Username under which the tor process is running."),
   ITEM("process/descriptor-limit", misc, "File descriptor limit."),
   ITEM("limits/max-mem-in-queues", misc, "Actual limit on memory in queues"),
+  ITEM("memory/pools", misc,
+       "Usage statistics for the circuit and stream object pools."),
   PREFIX("desc-annotations/id/", dir, "Router annotations by hexdigest."),
   PREFIX("dir/server/", dir,"Router descriptors as retrieved from a DirPort."),
   PREFIX("dir/status/", dir,
@@ -3184,6 +3264,10 @@ static const getinfo_item_t getinfo_items[] = {
   ITEM("exit-policy/ipv4", policies, "IPv4 parts of exit policy"),
   ITEM("exit-policy/ipv6", policies, "IPv6 parts of exit policy"),
   PREFIX("ip-to-country/", geoip, "Perform a GEOIP lookup"),
+  ITEM("dns/cache/stats", dns,
+       "Hit, miss, prefetch and eviction counts of the exit DNS cache."),
+  ITEM("dns/cache/latency", dns,
+       "Histogram of exit DNS lookup latencies, in milliseconds."),
   ITEM("onions/current", onions,
        "Onion services owned by the current control connection."),
   ITEM("onions/detached", onions,
@@ -3245,9 +3329,300 @@ handle_getinfo_helper(control_connection_t *control_conn,
   return 0; /* unrecognized */
 }
 
+/** Keep adding to a streamed GETINFO reply until the control connection's
+ * outbuf holds at least this many bytes. */
+#define GETINFO_STREAM_LOWAT (16*1024)
+/** Largest piece of a flat document that we escape at once when streaming
+ * it. */
+#define GETINFO_STREAM_CHUNK_LEN (16*1024)
+
+/** Kinds of GETINFO answers that we write a piece at a time. */
+typedef enum getinfo_stream_kind_t {
+  /** A routerstatus line for each identity digest in the list. */
+  GETINFO_STREAM_NS,
+  /** A router descriptor for each descriptor digest in the list. */
+  GETINFO_STREAM_DESC,
+  /** As GETINFO_STREAM_DESC, with the extrainfo munged in. */
+  GETINFO_STREAM_DESC_EI_HACK,
+  /** A single document that we hold a reference to or have mapped. */
+  GETINFO_STREAM_FLAT,
+} getinfo_stream_kind_t;
+
+/** One answer in a GETINFO reply that has at least one streamed answer. */
+typedef struct getinfo_stream_answer_t {
+  /** The key this answers. */
+  char *key;
+  /** The whole answer, if we computed it up front. */
+  char *value;
+  /** Otherwise, how we produce it. */
+  getinfo_stream_kind_t kind;
+  /** For lists: the digests of the items left to write, and the index of
+   * the next one. */
+  smartlist_t *digests;
+  int next_idx;
+  /** For GETINFO_STREAM_FLAT: exactly one of these holds the document. */
+  cached_dir_t *cached_dir;
+  tor_mmap_t *map;
+  /** For GETINFO_STREAM_FLAT: how much of the document we've written. */
+  size_t pos;
+  /** True iff we've written the "250+key=" line. */
+  unsigned int header_written:1;
+  /** Escaping state for the data we've written so far. */
+  control_escape_state_t esc;
+} getinfo_stream_answer_t;
+
+/** A GETINFO reply that we're writing as the control connection drains, so
+ * that big answers never need to be built in memory as a whole. */
+struct control_getinfo_stream_t {
+  /** The getinfo_stream_answer_t for each question, in order. */
+  smartlist_t *answers;
+  /** Index in answers of the next one to write. */
+  int next_answer;
+  /** Events for this controller that arrived in the middle of the reply,
+   * as strings, to write once it's done. */
+  smartlist_t *deferred_events;
+};
+
+/** Release all storage held by <b>ans</b>. */
+static void
+getinfo_stream_answer_free(getinfo_stream_answer_t *ans)
+{
+  if (!ans)
+    return;
+  tor_free(ans->key);
+  tor_free(ans->value);
+  if (ans->digests) {
+    SMARTLIST_FOREACH(ans->digests, char *, cp, tor_free(cp));
+    smartlist_free(ans->digests);
+  }
+  cached_dir_decref(ans->cached_dir);
+  if (ans->map)
+    tor_munmap_file(ans->map);
+  tor_free(ans);
+}
+
+/** Remember to write the event <b>msg</b> to <b>conn</b> once it's done
+ * with the GETINFO reply it's streaming. */
+static void
+getinfo_stream_defer_event(control_connection_t *conn, const char *msg)
+{
+  tor_assert(conn->getinfo_stream);
+  smartlist_add_strdup(conn->getinfo_stream->deferred_events, msg);
+}
+
+/** Release all storage held by <b>stream</b>. */
+void
+control_getinfo_stream_free(control_getinfo_stream_t *stream)
+{
+  if (!stream)
+    return;
+  SMARTLIST_FOREACH(stream->answers, getinfo_stream_answer_t *, ans,
+                    getinfo_stream_answer_free(ans));
+  smartlist_free(stream->answers);
+  SMARTLIST_FOREACH(stream->deferred_events, char *, cp, tor_free(cp));
+  smartlist_free(stream->deferred_events);
+  tor_free(stream);
+}
+
+/** If <b>question</b> is a GETINFO key whose answer we stream, set up
+ * <b>ans</b> to produce it, taking a snapshot of which items to include,
+ * and return 1.  If we know the answer is empty, set ans-\>value instead.
+ * Return 0 if we don't stream this key, or -1 and set *<b>errmsg</b> on
+ * error. */
+static int
+getinfo_stream_answer_setup(getinfo_stream_answer_t *ans,
+                            const char *question, const char **errmsg)
+{
+  if (!strcmp(question, "ns/all")) {
+    const networkstatus_t *ns = networkstatus_get_latest_consensus();
+    ans->kind = GETINFO_STREAM_NS;
+    ans->digests = smartlist_new();
+    if (ns) {
+      SMARTLIST_FOREACH(ns->routerstatus_list, const routerstatus_t *, rs,
+        smartlist_add(ans->digests,
+                      tor_memdup(rs->identity_digest, DIGEST_LEN)));
+    }
+  } else if (!strcmp(question, "desc/all-recent") ||
+             !strcmp(question, "desc/all-recent-extrainfo-hack")) {
+    routerlist_t *routerlist = router_get_routerlist();
+    ans->kind = strcmp(question, "desc/all-recent") ?
+      GETINFO_STREAM_DESC_EI_HACK : GETINFO_STREAM_DESC;
+    ans->digests = smartlist_new();
+    if (routerlist && routerlist->routers) {
+      SMARTLIST_FOREACH(routerlist->routers, const routerinfo_t *, ri,
+        smartlist_add(ans->digests,
+                      tor_memdup(ri->cache_info.signed_descriptor_digest,
+                                 DIGEST_LEN)));
+    }
+  } else if (!strcmp(question, "dir/status-vote/current/consensus")) {
+    ans->kind = GETINFO_STREAM_FLAT;
+    if (we_want_to_fetch_flavor(get_options(), FLAV_NS)) {
+      cached_dir_t *consensus = dirserv_get_consensus("ns");
+      if (consensus) {
+        ++consensus->refcnt;
+        ans->cached_dir = consensus;
+      }
+    }
+    if (!ans->cached_dir) { /* try loading it from disk */
+      char *filename = get_datadir_fname("cached-consensus");
+      ans->map = tor_mmap_file(filename);
+      tor_free(filename);
+      if (!ans->map) {
+        if (errno == ERANGE) { /* The file is empty. */
+          ans->value = tor_strdup("");
+          return 1;
+        }
+        /* generate an error */
+        *errmsg = "Could not open cached consensus. "
+          "Make sure FetchUselessDescriptors is set to 1.";
+        return -1;
+      }
+    }
+    return 1;
+  } else {
+    return 0;
+  }
+
+  if (smartlist_len(ans->digests) == 0)
+    ans->value = tor_strdup("");
+  return 1;
+}
+
+/** Write the next piece of the streamed answer <b>ans</b> to <b>conn</b>.
+ * Return 1 if that was the last piece, else 0. */
+static int
+getinfo_stream_answer_write_some(control_connection_t *conn,
+                                 getinfo_stream_answer_t *ans)
+{
+  const char *body = NULL;
+  char *body_tmp = NULL;
+  size_t body_len = 0;
+  int done = 0;
+
+  if (ans->kind == GETINFO_STREAM_FLAT) {
+    const char *doc = ans->cached_dir ? ans->cached_dir->dir : ans->map->data;
+    size_t doc_len = ans->cached_dir ? ans->cached_dir->dir_len
+                                     : ans->map->size;
+    body = doc + ans->pos;
+    body_len = MIN(doc_len - ans->pos, GETINFO_STREAM_CHUNK_LEN);
+    ans->pos += body_len;
+    done = (ans->pos == doc_len);
+  } else {
+    /* Items that went away since we started are just left out. */
+    const char *digest = smartlist_get(ans->digests, ans->next_idx++);
+    done = (ans->next_idx == smartlist_len(ans->digests));
+    if (ans->kind == GETINFO_STREAM_NS) {
+      const routerstatus_t *rs = router_get_consensus_status_by_id(digest);
+      if (rs) {
+        body = body_tmp = networkstatus_getinfo_helper_single(rs);
+        body_len = strlen(body);
+      }
+    } else {
+      const signed_descriptor_t *sd = router_get_by_descriptor_digest(digest);
+      const char *sd_body = sd ? signed_descriptor_get_body(sd) : NULL;
+      signed_descriptor_t *ei = NULL;
+      if (sd_body && ans->kind == GETINFO_STREAM_DESC_EI_HACK)
+        ei = extrainfo_get_by_descriptor_digest(sd->extra_info_digest);
+      if (ei) {
+        body = body_tmp = munge_extrainfo_into_routerinfo(sd_body, sd, ei);
+        body_len = strlen(body);
+      } else if (sd_body) {
+        body = sd_body;
+        body_len = sd->signed_descriptor_len;
+      }
+    }
+  }
+
+  if (body_len || done) {
+    char *esc = tor_malloc(2*body_len + 6);
+    size_t esc_len = control_escape_data_chunk(&ans->esc, body, body_len,
+                                               esc);
+    if (done)
+      esc_len += control_escape_data_finish(&ans->esc, esc + esc_len);
+    connection_buf_add(esc, esc_len, TO_CONN(conn));
+    tor_free(esc);
+  }
+  tor_free(body_tmp);
+  return done;
+}
+
+/** Write the complete answer <b>v</b> for the GETINFO key <b>k</b> to
+ * <b>conn</b>. */
+static void
+getinfo_write_answer(control_connection_t *conn, const char *k,
+                     const char *v)
+{
+  if (!strchr(v, '\n') && !strchr(v, '\r')) {
+    connection_printf_to_buf(conn, "250-%s=", k);
+    connection_write_str_to_buf(v, conn);
+    connection_write_str_to_buf("\r\n", conn);
+  } else {
+    char *esc = NULL;
+    size_t esc_len;
+    esc_len = write_escaped_data(v, strlen(v), &esc);
+    connection_printf_to_buf(conn, "250+%s=\r\n", k);
+    connection_buf_add(esc, esc_len, TO_CONN(conn));
+    tor_free(esc);
+  }
+}
+
+/** Write more of the GETINFO reply that <b>conn</b> is streaming, until its
+ * outbuf is full enough or the reply is done.  When it is done, write any
+ * events that we held back in the meantime, and forget the stream.  Return
+ * 1 if the reply is done, else 0. */
+STATIC int
+control_getinfo_stream_continue(control_connection_t *conn)
+{
+  control_getinfo_stream_t *stream = conn->getinfo_stream;
+  tor_assert(stream);
+
+  while (connection_get_outbuf_len(TO_CONN(conn)) < GETINFO_STREAM_LOWAT) {
+    getinfo_stream_answer_t *ans;
+    if (stream->next_answer == smartlist_len(stream->answers)) {
+      connection_write_str_to_buf("250 OK\r\n", conn);
+      SMARTLIST_FOREACH(stream->deferred_events, const char *, msg,
+                        connection_write_str_to_buf(msg, conn));
+      conn->getinfo_stream = NULL;
+      control_getinfo_stream_free(stream);
+      return 1;
+    }
+    ans = smartlist_get(stream->answers, stream->next_answer);
+    if (ans->value) {
+      getinfo_write_answer(conn, ans->key, ans->value);
+      ++stream->next_answer;
+      continue;
+    }
+    if (!ans->header_written) {
+      connection_printf_to_buf(conn, "250+%s=\r\n", ans->key);
+      ans->header_written = 1;
+    }
+    if (getinfo_stream_answer_write_some(conn, ans)) {
+      /* We won't come back to this one, so let go of its resources. */
+      smartlist_set(stream->answers, stream->next_answer, NULL);
+      getinfo_stream_answer_free(ans);
+      ++stream->next_answer;
+    }
+  }
+  return 0;
+}
+
+/** Called when <b>conn</b> has written some of its outbuf: keep up any
+ * GETINFO reply we're streaming, and once it's done, go back to the
+ * commands that arrived meanwhile. */
+int
+connection_control_flushed_some(control_connection_t *conn)
+{
+  if (!conn->getinfo_stream || TO_CONN(conn)->marked_for_close)
+    return 0;
+  if (control_getinfo_stream_continue(conn) &&
+      connection_get_inbuf_len(TO_CONN(conn)))
+    return connection_control_process_inbuf(conn);
+  return 0;
+}
+
 /** Called when we receive a GETINFO command.  Try to fetch all requested
  * information, and reply with information or error message. */
-static int
+STATIC int
 handle_control_getinfo(control_connection_t *conn, uint32_t len,
                        const char *body)
 {
@@ -3255,27 +3630,43 @@ handle_control_getinfo(control_connection_t *conn, uint32_t len,
   smartlist_t *answers = smartlist_new();
   smartlist_t *unrecognized = smartlist_new();
   char *ans = NULL;
-  int i;
+  int i, n_streamed = 0;
   (void) len; /* body is NUL-terminated, so it's safe to ignore the length. */
 
   smartlist_split_string(questions, body, " ",
                          SPLIT_SKIP_SPACE|SPLIT_IGNORE_BLANK, 0);
   SMARTLIST_FOREACH_BEGIN(questions, const char *, q) {
     const char *errmsg = NULL;
-    if (handle_getinfo_helper(conn, q, &ans, &errmsg) < 0) {
+    getinfo_stream_answer_t *stream_ans =
+      tor_malloc_zero(sizeof(getinfo_stream_answer_t));
+    int r;
+    control_escape_state_init(&stream_ans->esc);
+    stream_ans->key = tor_strdup(q);
+
+    /* Big answers are written as the connection drains, instead of being
+     * built up front. */
+    r = getinfo_stream_answer_setup(stream_ans, q, &errmsg);
+    if (r == 0) {
+      r = handle_getinfo_helper(conn, q, &ans, &errmsg);
+      stream_ans->value = ans;
+    } else if (r > 0 && !stream_ans->value) {
+      ++n_streamed;
+    }
+    if (r < 0) {
+      getinfo_stream_answer_free(stream_ans);
       if (!errmsg)
         errmsg = "Internal error";
       connection_printf_to_buf(conn, "551 %s\r\n", errmsg);
       goto done;
     }
-    if (!ans) {
+    if (!stream_ans->value && r == 0) {
+      getinfo_stream_answer_free(stream_ans);
       if (errmsg) /* use provided error message */
         smartlist_add_strdup(unrecognized, errmsg);
       else /* use default error message */
         smartlist_add_asprintf(unrecognized, "Unrecognized key \"%s\"", q);
     } else {
-      smartlist_add_strdup(answers, q);
-      smartlist_add(answers, ans);
+      smartlist_add(answers, stream_ans);
     }
   } SMARTLIST_FOREACH_END(q);
 
@@ -3292,32 +3683,31 @@ handle_control_getinfo(control_connection_t *conn, uint32_t len,
     goto done;
   }
 
-  for (i = 0; i < smartlist_len(answers); i += 2) {
-    char *k = smartlist_get(answers, i);
-    char *v = smartlist_get(answers, i+1);
-    if (!strchr(v, '\n') && !strchr(v, '\r')) {
-      connection_printf_to_buf(conn, "250-%s=", k);
-      connection_write_str_to_buf(v, conn);
-      connection_write_str_to_buf("\r\n", conn);
-    } else {
-      char *esc = NULL;
-      size_t esc_len;
-      esc_len = write_escaped_data(v, strlen(v), &esc);
-      connection_printf_to_buf(conn, "250+%s=\r\n", k);
-      connection_buf_add(esc, esc_len, TO_CONN(conn));
-      tor_free(esc);
-    }
+  if (n_streamed) {
+    /* Hand the answers over to the stream, which finishes the reply. */
+    tor_assert(!conn->getinfo_stream);
+    conn->getinfo_stream = tor_malloc_zero(sizeof(control_getinfo_stream_t));
+    conn->getinfo_stream->answers = answers;
+    conn->getinfo_stream->deferred_events = smartlist_new();
+    answers = NULL;
+    control_getinfo_stream_continue(conn);
+    goto done;
   }
+
+  SMARTLIST_FOREACH(answers, getinfo_stream_answer_t *, a,
+                    getinfo_write_answer(conn, a->key, a->value));
   connection_write_str_to_buf("250 OK\r\n", conn);
 
  done:
-  SMARTLIST_FOREACH(answers, char *, cp, tor_free(cp));
-  smartlist_free(answers);
+  if (answers) {
+    SMARTLIST_FOREACH(answers, getinfo_stream_answer_t *, a,
+                      getinfo_stream_answer_free(a));
+    smartlist_free(answers);
+  }
   SMARTLIST_FOREACH(questions, char *, cp, tor_free(cp));
   smartlist_free(questions);
   SMARTLIST_FOREACH(unrecognized, char *, cp, tor_free(cp));
   smartlist_free(unrecognized);
-
   return 0;
 }
 
@@ -5069,6 +5459,10 @@ connection_control_process_inbuf(control_connection_t *conn)
   }
 
  again:
+  /* Wait for the reply we're streaming before handling more commands. */
+  if (conn->getinfo_stream)
+    return 0;
+
   while (1) {
     size_t last_idx;
     int r;
@@ -9864,6 +10258,9 @@ control_event_signal(uintptr_t signal_num)
     case SIGHEARTBEAT:
       signal_string = "HEARTBEAT";
       break;
+    case SIGDUMPTRACE:
+      signal_string = "DUMPTRACE";
+      break;
     default:
       log_warn(LD_BUG, "Unrecognized signal %lu in control_event_signal",
                (unsigned long)signal_num);
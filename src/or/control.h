@@ -27,6 +27,9 @@ void control_ports_write_to_file(void);
 #define LOG_FN_CONN(conn, args)                 \
   CONN_LOG_PROTECT(conn, log_fn args)
 
+typedef struct control_getinfo_stream_t control_getinfo_stream_t;
+void control_getinfo_stream_free(control_getinfo_stream_t *stream);
+int connection_control_flushed_some(control_connection_t *conn);
 int connection_control_finished_flushing(control_connection_t *conn);
 int connection_control_reached_eof(control_connection_t *conn);
 void connection_control_closed(control_connection_t *conn);
@@ -316,8 +319,32 @@ void control_free_all(void);
 #define EVENT_MASK_ALL_              (EVENT_MASK_ABOVE_MIN_ \
                                       & EVENT_MASK_BELOW_MAX_)
 
+/** State for escaping a data reply a piece at a time: see
+ * control_escape_data_chunk(). */
+typedef struct control_escape_state_t {
+  /** True once we have seen any input. */
+  unsigned int started:1;
+  /** True iff the next input byte starts a line. */
+  unsigned int start_of_line:1;
+  /** The last input byte. */
+  char last_in;
+  /** The last two output bytes, oldest first. */
+  char last_out[2];
+  /** Number of output bytes so far, up to 2. */
+  unsigned int n_out;
+} control_escape_state_t;
+
 /* Used only by control.c and test.c */
+STATIC void control_escape_state_init(control_escape_state_t *st);
+STATIC size_t control_escape_data_chunk(control_escape_state_t *st,
+                                        const char *data, size_t len,
+                                        char *out);
+STATIC size_t control_escape_data_finish(control_escape_state_t *st,
+                                         char *out);
 STATIC size_t write_escaped_data(const char *data, size_t len, char **out);
+STATIC int handle_control_getinfo(control_connection_t *conn, uint32_t len,
+                                  const char *body);
+STATIC int control_getinfo_stream_continue(control_connection_t *conn);
 STATIC size_t read_escaped_data(const char *data, size_t len, char **out);
 
 #ifdef TOR_UNIT_TESTS
@@ -29,6 +29,7 @@
 #include "rephist.h"
 #include "router.h"
 #include "workqueue.h"
+#include "trace/events.h"
 
 #include <event2/event.h>
 
@@ -45,7 +46,10 @@ worker_state_new(void *arg)
   worker_state_t *ws;
   (void)arg;
   ws = tor_malloc_zero(sizeof(worker_state_t));
-  ws->onion_keys = server_onion_keys_new();
+  /* Onion services use the cpuworkers even when we aren't a relay, in which
+   * case we have no onion keys to answer onionskins with. */
+  if (server_mode(get_options()))
+    ws->onion_keys = server_onion_keys_new();
   return ws;
 }
 static void
@@ -92,6 +96,8 @@ cpu_init(void)
     event_add(reply_event, NULL);
   }
   if (!threadpool) {
+    /* Some of our jobs parse documents, and log about them on the way. */
+    escaped_init_threads();
     /*
       In our threadpool implementation, half the threads are permissive and
       half are strict (when it comes to running lower-priority tasks). So we
@@ -323,6 +329,7 @@ cpuworker_onion_handshake_replyfn(void *work_)
   memcpy(&rpl, &job->u.reply, sizeof(rpl));
 
   tor_assert(rpl.magic == CPUWORKER_REPLY_MAGIC);
+  tor_trace(cpuworker, reply, rpl.handshake_type, rpl.success, rpl.n_usec);
 
   if (rpl.timed && rpl.success &&
       rpl.handshake_type <= MAX_ONION_HANDSHAKE_TYPE) {
@@ -359,8 +366,7 @@ cpuworker_onion_handshake_replyfn(void *work_)
      * pending. Instead, it got left for us to free so that we wouldn't freak
      * out when the job->circ field wound up pointing to nothing. */
     log_debug(LD_OR, "Circuit died while reply was pending. Freeing memory.");
-    circ->base_.magic = 0;
-    tor_free(circ);
+    or_circuit_free_dead(circ);
     goto done_processing;
   }
 
@@ -421,14 +427,20 @@ cpuworker_onion_handshake_threadfn(void *state_, void *work_)
   rpl.timed = req.timed;
   rpl.started_at = req.started_at;
   rpl.handshake_type = cc->handshake_type;
+  tor_trace(cpuworker, job_begin, cc->handshake_type);
   if (req.timed)
     tor_gettimeofday(&tv_start);
-  n = onion_skin_server_handshake(cc->handshake_type,
-                                  cc->onionskin, cc->handshake_len,
-                                  onion_keys,
-                                  cell_out->reply,
-                                  rpl.keys, CPATH_KEY_MATERIAL_LEN,
-                                  rpl.rend_auth_material);
+  if (onion_keys) {
+    n = onion_skin_server_handshake(cc->handshake_type,
+                                    cc->onionskin, cc->handshake_len,
+                                    onion_keys,
+                                    cell_out->reply,
+                                    rpl.keys, CPATH_KEY_MATERIAL_LEN,
+                                    rpl.rend_auth_material);
+  } else {
+    /* We stopped being a relay while this onionskin was queued. */
+    n = -1;
+  }
   if (n < 0) {
     /* failure */
     log_debug(LD_OR,"onion_skin_server_handshake failed.");
@@ -452,6 +464,7 @@ cpuworker_onion_handshake_threadfn(void *state_, void *work_)
     rpl.success = 1;
   }
   rpl.magic = CPUWORKER_REPLY_MAGIC;
+  tor_trace(cpuworker, job_end, rpl.handshake_type, rpl.success);
   if (req.timed) {
     struct timeval tv_diff;
     int64_t usec;
@@ -489,6 +502,14 @@ queue_pending_tasks(void)
   }
 }
 
+/** Return true iff the cpuworker threadpool has been set up with cpu_init(),
+ * so that cpuworker_queue_work() can be used. */
+MOCK_IMPL(int,
+cpuworker_is_running,(void))
+{
+  return threadpool != NULL;
+}
+
 /** DOCDOC */
 MOCK_IMPL(workqueue_entry_t *,
 cpuworker_queue_work,(workqueue_priority_t priority,
@@ -505,6 +526,15 @@ cpuworker_queue_work,(workqueue_priority_t priority,
                                         arg);
 }
 
+/** Cancel <b>ent</b>, as returned by cpuworker_queue_work(), unless a
+ * cpuworker has already started on it.  Return its argument if we cancelled
+ * it, and NULL otherwise. */
+MOCK_IMPL(void *,
+cpuworker_cancel_work,(workqueue_entry_t *ent))
+{
+  return workqueue_entry_cancel(ent);
+}
+
 /** Try to tell a cpuworker to perform the public key operations necessary to
  * respond to <b>onionskin</b> for the circuit <b>circ</b>.
  *
@@ -557,6 +587,8 @@ assign_onionskin_to_cpuworker(or_circuit_t *circ,
   memwipe(&req, 0, sizeof(req));
 
   ++total_pending_tasks;
+  tor_trace(cpuworker, queue, job->u.request.create_cell.handshake_type,
+            total_pending_tasks);
   queue_entry = threadpool_queue_work_priority(threadpool,
                                       WQ_PRI_HIGH,
                                       cpuworker_onion_handshake_threadfn,
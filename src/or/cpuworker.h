@@ -17,11 +17,13 @@ void cpuworkers_rotate_keyinfo(void);
 struct workqueue_entry_s;
 enum workqueue_reply_t;
 enum workqueue_priority_t;
+MOCK_DECL(int, cpuworker_is_running, (void));
 MOCK_DECL(struct workqueue_entry_s *, cpuworker_queue_work, (
                     enum workqueue_priority_t priority,
                     enum workqueue_reply_t (*fn)(void *, void *),
                     void (*reply_fn)(void *),
                     void *arg));
+MOCK_DECL(void *, cpuworker_cancel_work, (struct workqueue_entry_s *ent));
 
 struct create_cell_t;
 int assign_onionskin_to_cpuworker(or_circuit_t *circ,
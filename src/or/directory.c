@@ -5177,6 +5177,38 @@ handle_post_hs_descriptor(const char *url, const char *body)
   return 400;
 }
 
+/** Called once the descriptors uploaded on the directory connection with
+ * global identifier <b>conn_id</b> have been handled, with <b>r</b> and
+ * <b>msg</b> as returned by dirserv_add_multiple_descriptors(): answer the
+ * uploader, if it's still there. */
+static void
+descriptor_post_done(uint64_t conn_id, was_router_added_t r, const char *msg)
+{
+  connection_t *base_conn = connection_get_by_global_id(conn_id);
+  dir_connection_t *conn;
+
+  if (!base_conn || base_conn->type != CONN_TYPE_DIR) {
+    log_info(LD_DIRSERV, "Directory connection closed before we were done "
+             "with the descriptors it uploaded.");
+    return;
+  }
+  conn = TO_DIR_CONN(base_conn);
+  tor_assert(msg);
+
+  if (r == ROUTER_ADDED_SUCCESSFULLY) {
+    write_short_http_response(conn, 200, msg);
+  } else if (WRA_WAS_OUTDATED(r)) {
+    write_http_response_header_impl(conn, -1, NULL, NULL,
+                                    "X-Descriptor-Not-New: Yes\r\n", -1);
+  } else {
+    log_info(LD_DIRSERV,
+             "Rejected router descriptor or extra-info from %s "
+             "(\"%s\").",
+             conn->base_.address, msg);
+    write_short_http_response(conn, 400, msg);
+  }
+}
+
 /** Helper function: called when a dirserver gets a complete HTTP POST
  * request.  Look for an uploaded server descriptor or rendezvous
  * service descriptor.  On finding one, process it and write a
@@ -5298,24 +5330,15 @@ directory_handle_command_post,(dir_connection_t *conn, const char *headers,
 
   if (authdir_mode(options) &&
       !strcmp(url,"/tor/")) { /* server descriptor post */
-    const char *msg = "[None]";
     uint8_t purpose = authdir_mode_bridge(options) ?
                       ROUTER_PURPOSE_BRIDGE : ROUTER_PURPOSE_GENERAL;
-    was_router_added_t r = dirserv_add_multiple_descriptors(body, purpose,
-                                             conn->base_.address, &msg);
-    tor_assert(msg);
-
-    if (r == ROUTER_ADDED_SUCCESSFULLY) {
-      write_short_http_response(conn, 200, msg);
-    } else if (WRA_WAS_OUTDATED(r)) {
-      write_http_response_header_impl(conn, -1, NULL, NULL,
-                                      "X-Descriptor-Not-New: Yes\r\n", -1);
-    } else {
-      log_info(LD_DIRSERV,
-               "Rejected router descriptor or extra-info from %s "
-               "(\"%s\").",
-               conn->base_.address, msg);
-      write_short_http_response(conn, 400, msg);
+    if (dirserv_add_multiple_descriptors_async(body, purpose,
+                                            conn->base_.address,
+                                            conn->base_.global_identifier,
+                                            descriptor_post_done) < 0) {
+      write_short_http_response(conn, 503,
+                                "Busy checking other descriptors; "
+                                "try again later");
     }
     goto done;
   }
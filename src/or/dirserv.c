@@ -16,6 +16,7 @@
 #include "conscache.h"
 #include "consdiffmgr.h"
 #include "control.h"
+#include "cpuworker.h"
 #include "directory.h"
 #include "dirserv.h"
 #include "dirvote.h"
@@ -33,6 +34,7 @@
 #include "routerparse.h"
 #include "routerset.h"
 #include "torcert.h"
+#include "workqueue.h"
 
 /**
  * \file dirserv.c
@@ -565,6 +567,81 @@ WRA_MORE_SEVERE(was_router_added_t a, was_router_added_t b)
   return a < b;
 }
 
+/** Format into <b>buf</b> the annotations we prepend to descriptors that
+ * <b>source</b> uploaded at <b>now</b> for <b>purpose</b>.  Return 0 on
+ * success, -1 on failure. */
+static int
+format_upload_annotations(char *buf, size_t buf_len, uint8_t purpose,
+                          const char *source, time_t now)
+{
+  char time_buf[ISO_TIME_LEN+1];
+  int general = purpose == ROUTER_PURPOSE_GENERAL;
+
+  format_iso_time(time_buf, now);
+  if (tor_snprintf(buf, buf_len,
+                   "@uploaded-at %s\n"
+                   "@source %s\n"
+                   "%s%s%s", time_buf, escaped(source),
+                   !general ? "@purpose " : "",
+                   !general ? router_purpose_to_string(purpose) : "",
+                   !general ? "\n" : "")<0) {
+    return -1;
+  }
+  return 0;
+}
+
+/** Helper: if <b>r_tmp</b> is more severe than *<b>r</b>, make it and
+ * <b>msg_tmp</b> the result of the whole upload. */
+static inline void
+note_upload_result(was_router_added_t r_tmp, const char *msg_tmp,
+                   was_router_added_t *r, const char **msg)
+{
+  if (WRA_MORE_SEVERE(r_tmp, *r)) {
+    *r = r_tmp;
+    *msg = msg_tmp;
+  }
+}
+
+/** Parse and add every extra-info document in <b>desc</b>, folding the
+ * results into *<b>r</b> and *<b>msg</b>.  Return the number of documents
+ * we parsed. */
+static int
+dirserv_add_extrainfos_from_string(const char *desc, was_router_added_t *r,
+                                   const char **msg)
+{
+  smartlist_t *list = smartlist_new();
+  const char *s = desc;
+  int n_parsed;
+
+  if (!router_parse_list_from_string(&s, NULL, list, SAVED_NOWHERE, 1, 0,
+                                     NULL, NULL)) {
+    SMARTLIST_FOREACH(list, extrainfo_t *, ei, {
+        const char *msg_out = NULL;
+        was_router_added_t r_tmp = dirserv_add_extrainfo(ei, &msg_out);
+        note_upload_result(r_tmp, msg_out, r, msg);
+      });
+  }
+  n_parsed = smartlist_len(list);
+  smartlist_free(list);
+  return n_parsed;
+}
+
+/** Give *<b>msg</b> a value if nothing in an upload of <b>n_parsed</b>
+ * documents set one. */
+static void
+finish_upload_result(int n_parsed, was_router_added_t *r, const char **msg)
+{
+  if (! *msg) {
+    if (!n_parsed) {
+      *msg = "No descriptors found in your POST.";
+      if (WRA_WAS_ADDED(*r))
+        *r = ROUTER_IS_ALREADY_KNOWN;
+    } else {
+      *msg = "(no message)";
+    }
+  }
+}
+
 /** As for dirserv_add_descriptor(), but accepts multiple documents, and
  * returns the most severe error that occurred for any one of them. */
 was_router_added_t
@@ -572,27 +649,17 @@ dirserv_add_multiple_descriptors(const char *desc, uint8_t purpose,
                                  const char *source,
                                  const char **msg)
 {
-  was_router_added_t r, r_tmp;
-  const char *msg_out;
+  was_router_added_t r;
   smartlist_t *list;
   const char *s;
   int n_parsed = 0;
-  time_t now = time(NULL);
   char annotation_buf[ROUTER_ANNOTATION_BUF_LEN];
-  char time_buf[ISO_TIME_LEN+1];
-  int general = purpose == ROUTER_PURPOSE_GENERAL;
   tor_assert(msg);
 
   r=ROUTER_ADDED_SUCCESSFULLY; /*Least severe return value. */
 
-  format_iso_time(time_buf, now);
-  if (tor_snprintf(annotation_buf, sizeof(annotation_buf),
-                   "@uploaded-at %s\n"
-                   "@source %s\n"
-                   "%s%s%s", time_buf, escaped(source),
-                   !general ? "@purpose " : "",
-                   !general ? router_purpose_to_string(purpose) : "",
-                   !general ? "\n" : "")<0) {
+  if (format_upload_annotations(annotation_buf, sizeof(annotation_buf),
+                                purpose, source, time(NULL)) < 0) {
     *msg = "Couldn't format annotations";
     /* XXX Not cool: we return -1 below, but (was_router_added_t)-1 is
      * ROUTER_BAD_EI, which isn't what's gone wrong here. :( */
@@ -604,45 +671,351 @@ dirserv_add_multiple_descriptors(const char *desc, uint8_t purpose,
   if (!router_parse_list_from_string(&s, NULL, list, SAVED_NOWHERE, 0, 0,
                                      annotation_buf, NULL)) {
     SMARTLIST_FOREACH(list, routerinfo_t *, ri, {
-        msg_out = NULL;
+        const char *msg_out = NULL;
+        was_router_added_t r_tmp;
         tor_assert(ri->purpose == purpose);
         r_tmp = dirserv_add_descriptor(ri, &msg_out, source);
-        if (WRA_MORE_SEVERE(r_tmp, r)) {
-          r = r_tmp;
-          *msg = msg_out;
-        }
+        note_upload_result(r_tmp, msg_out, &r, msg);
       });
   }
   n_parsed += smartlist_len(list);
-  smartlist_clear(list);
+  smartlist_free(list);
 
-  s = desc;
-  if (!router_parse_list_from_string(&s, NULL, list, SAVED_NOWHERE, 1, 0,
-                                     NULL, NULL)) {
-    SMARTLIST_FOREACH(list, extrainfo_t *, ei, {
-        msg_out = NULL;
+  n_parsed += dirserv_add_extrainfos_from_string(desc, &r, msg);
+  finish_upload_result(n_parsed, &r, msg);
 
-        r_tmp = dirserv_add_extrainfo(ei, &msg_out);
-        if (WRA_MORE_SEVERE(r_tmp, r)) {
-          r = r_tmp;
-          *msg = msg_out;
-        }
-      });
+  return r;
+}
+
+/** How many descriptor uploads may wait on the cpuworkers at once.  Past
+ * this, dirserv_add_multiple_descriptors_async() turns uploads away, and the
+ * uploader gets to try again later. */
+#define MAX_PENDING_DESCRIPTOR_UPLOADS 64
+
+/** A router descriptor digest that some pending upload is having checked by
+ * a cpuworker. */
+typedef struct in_flight_desc_t {
+  /** Number of pending_router_desc_t with this digest that point to us. */
+  int refcnt;
+  /** True iff the descriptor with this digest failed to parse. */
+  unsigned int failed : 1;
+} in_flight_desc_t;
+
+/** One router descriptor from an upload that is waiting on a cpuworker. */
+typedef struct pending_router_desc_t {
+  /** Bounds of the descriptor, within the body of its upload. */
+  const char *start, *end;
+  /** The descriptor's digest. */
+  char digest[DIGEST_LEN];
+  /** True iff we didn't hand this descriptor to the cpuworker, since we
+   * already had or were already checking one with the same digest. */
+  unsigned int is_duplicate : 1;
+  /** The entry for <b>digest</b> in in_flight_descriptor_digests that we
+   * hold a reference to, if any. */
+  in_flight_desc_t *in_flight;
+  /** The parsed and verified descriptor, or NULL if the cpuworker couldn't
+   * make sense of it or wasn't asked to. */
+  routerinfo_t *ri;
+} pending_router_desc_t;
+
+/** A descriptor upload whose router descriptors are being parsed and checked
+ * by a cpuworker. */
+typedef struct descriptor_upload_t {
+  /** Our copy of the uploaded documents. */
+  char *body;
+  /** Address of the uploader, for the annotations and for log messages. */
+  char *source;
+  /** Purpose of the uploaded routers. */
+  uint8_t purpose;
+  /** Annotations to prepend to each router descriptor. */
+  char annotations[ROUTER_ANNOTATION_BUF_LEN];
+  /** Global identifier of the connection the upload came in on. */
+  uint64_t conn_id;
+  /** Function to tell about the result of the upload. */
+  dirserv_upload_done_fn_t done_fn;
+  /** The router descriptors in <b>body</b>, in order. */
+  int n_descs;
+  pending_router_desc_t *descs;
+  /** The cpuworker job checking this upload, until it replies. */
+  workqueue_entry_t *work;
+  /** True once the cpuworker is done with this upload. */
+  unsigned int is_parsed : 1;
+  /** True iff we freed everything else at exit while a cpuworker was
+   * checking this upload; we free it when the cpuworker replies. */
+  unsigned int is_abandoned : 1;
+} descriptor_upload_t;
+
+/** Uploads handed to dirserv_add_multiple_descriptors_async() that we
+ * haven't added yet, in the order they arrived.  We add each one only once
+ * all of the uploads before it have been added. */
+static smartlist_t *pending_descriptor_uploads = NULL;
+
+/** Map from the digest of each router descriptor that a cpuworker is
+ * checking, or has checked for an upload that isn't finished yet, to an
+ * in_flight_desc_t for it. */
+static digestmap_t *in_flight_descriptor_digests = NULL;
+
+/** Drop the reference that <b>d</b> holds to its in_flight_desc_t, if
+ * any. */
+static void
+pending_router_desc_release_in_flight(pending_router_desc_t *d)
+{
+  if (!d->in_flight)
+    return;
+  if (--d->in_flight->refcnt == 0) {
+    digestmap_remove(in_flight_descriptor_digests, d->digest);
+    tor_free(d->in_flight);
   }
-  n_parsed += smartlist_len(list);
-  smartlist_free(list);
+  d->in_flight = NULL;
+}
 
-  if (! *msg) {
-    if (!n_parsed) {
-      *msg = "No descriptors found in your POST.";
-      if (WRA_WAS_ADDED(r))
-        r = ROUTER_IS_ALREADY_KNOWN;
-    } else {
-      *msg = "(no message)";
+/** Release all storage held by <b>upload</b>. */
+static void
+descriptor_upload_free(descriptor_upload_t *upload)
+{
+  int i;
+  if (!upload)
+    return;
+  for (i = 0; i < upload->n_descs; ++i)
+    routerinfo_free(upload->descs[i].ri);
+  tor_free(upload->descs);
+  tor_free(upload->body);
+  tor_free(upload->source);
+  tor_free(upload);
+}
+
+/** Worker thread function: parse and check the signatures of the router
+ * descriptors of the descriptor_upload_t in <b>work_</b>. */
+static workqueue_reply_t
+descriptor_upload_threadfn(void *state_, void *work_)
+{
+  descriptor_upload_t *upload = work_;
+  int i;
+  (void) state_;
+
+  for (i = 0; i < upload->n_descs; ++i) {
+    pending_router_desc_t *d = &upload->descs[i];
+    if (d->is_duplicate)
+      continue;
+    d->ri = router_parse_entry_from_string(d->start, d->end, 1, 0,
+                                           upload->annotations, NULL);
+  }
+  return WQ_RPL_REPLY;
+}
+
+/** Add the router descriptors and extra-info documents of <b>upload</b>,
+ * now that its router descriptors have been checked, and tell its done_fn
+ * how it went. */
+static void
+descriptor_upload_finish(descriptor_upload_t *upload)
+{
+  was_router_added_t r = ROUTER_ADDED_SUCCESSFULLY;
+  const char *msg = NULL;
+  int n_parsed = 0;
+  int i;
+
+  for (i = 0; i < upload->n_descs; ++i) {
+    pending_router_desc_t *d = &upload->descs[i];
+    const char *msg_out = NULL;
+    was_router_added_t r_tmp;
+    routerinfo_t *ri = d->ri;
+    d->ri = NULL;
+
+    if (d->is_duplicate) {
+      if (d->in_flight && d->in_flight->failed) {
+        /* The same bytes didn't parse for the upload we waited on. */
+        pending_router_desc_release_in_flight(d);
+        continue;
+      }
+      pending_router_desc_release_in_flight(d);
+      if (router_get_by_descriptor_digest(d->digest)) {
+        ++n_parsed;
+        note_upload_result(ROUTER_IS_ALREADY_KNOWN,
+                           "Router descriptor was not new.", &r, &msg);
+        continue;
+      }
+      /* We didn't keep the copy we were waiting on, so this one gets a
+       * hearing of its own. */
+      ri = router_parse_entry_from_string(d->start, d->end, 1, 0,
+                                          upload->annotations, NULL);
+    } else if (d->in_flight) {
+      if (!ri)
+        d->in_flight->failed = 1;
+      pending_router_desc_release_in_flight(d);
     }
+    if (!ri)
+      continue;
+
+    ++n_parsed;
+    tor_assert(ri->purpose == upload->purpose);
+    addr_policy_list_make_canonical(ri->exit_policy);
+    r_tmp = dirserv_add_descriptor(ri, &msg_out, upload->source);
+    note_upload_result(r_tmp, msg_out, &r, &msg);
   }
 
-  return r;
+  n_parsed += dirserv_add_extrainfos_from_string(upload->body, &r, &msg);
+  finish_upload_result(n_parsed, &r, &msg);
+
+  upload->done_fn(upload->conn_id, r, msg);
+}
+
+/** Finish every upload at the front of pending_descriptor_uploads that the
+ * cpuworkers are done with. */
+static void
+finish_parsed_descriptor_uploads(void)
+{
+  while (smartlist_len(pending_descriptor_uploads)) {
+    descriptor_upload_t *upload = smartlist_get(pending_descriptor_uploads, 0);
+    if (!upload->is_parsed)
+      break;
+    smartlist_del_keeporder(pending_descriptor_uploads, 0);
+    descriptor_upload_finish(upload);
+    descriptor_upload_free(upload);
+  }
+}
+
+/** Main thread function: a cpuworker is done with the descriptor_upload_t
+ * in <b>work_</b>. */
+static void
+descriptor_upload_replyfn(void *work_)
+{
+  descriptor_upload_t *upload = work_;
+  upload->work = NULL;
+  if (upload->is_abandoned) {
+    descriptor_upload_free(upload);
+    return;
+  }
+  upload->is_parsed = 1;
+  finish_parsed_descriptor_uploads();
+}
+
+/** As dirserv_add_multiple_descriptors(), but parse and check the router
+ * descriptors in <b>desc</b> on a cpuworker when they're running.  Router
+ * descriptors that we already have, or that another upload is already
+ * checking, are not checked again.  Uploads are still added in the order
+ * they arrive.
+ *
+ * Once the upload is handled, which might be before this function returns,
+ * call <b>done_fn</b> with <b>conn_id</b> and the result.  Return 0 if the
+ * upload was handled or queued, and -1 if too many uploads are already
+ * waiting; in that case, <b>done_fn</b> is never called. */
+int
+dirserv_add_multiple_descriptors_async(const char *desc, uint8_t purpose,
+                                       const char *source, uint64_t conn_id,
+                                       dirserv_upload_done_fn_t done_fn)
+{
+  descriptor_upload_t *upload;
+  const char *s, *end, *eos;
+  int i, is_extrainfo, n_to_parse = 0;
+
+  tor_assert(desc);
+  tor_assert(source);
+  tor_assert(done_fn);
+
+  if (!cpuworker_is_running()) {
+    was_router_added_t r;
+    const char *msg = NULL;
+    r = dirserv_add_multiple_descriptors(desc, purpose, source, &msg);
+    done_fn(conn_id, r, msg);
+    return 0;
+  }
+
+  if (!pending_descriptor_uploads)
+    pending_descriptor_uploads = smartlist_new();
+  if (!in_flight_descriptor_digests)
+    in_flight_descriptor_digests = digestmap_new();
+
+  if (smartlist_len(pending_descriptor_uploads) >=
+      MAX_PENDING_DESCRIPTOR_UPLOADS) {
+    log_info(LD_DIRSERV, "Too many descriptor uploads pending; turning away "
+             "the one from %s.", source);
+    return -1;
+  }
+
+  upload = tor_malloc_zero(sizeof(descriptor_upload_t));
+  if (format_upload_annotations(upload->annotations,
+                                sizeof(upload->annotations),
+                                purpose, source, time(NULL)) < 0) {
+    tor_free(upload);
+    done_fn(conn_id, -1, "Couldn't format annotations");
+    return 0;
+  }
+  upload->body = tor_strdup(desc);
+  upload->source = tor_strdup(source);
+  upload->purpose = purpose;
+  upload->conn_id = conn_id;
+  upload->done_fn = done_fn;
+
+  /* Find the router descriptors... */
+  eos = upload->body + strlen(upload->body);
+  for (s = upload->body;
+       router_find_next_descriptor(&s, eos, &end, &is_extrainfo) == 0;
+       s = end) {
+    if (!is_extrainfo)
+      ++upload->n_descs;
+  }
+  upload->descs = tor_calloc(upload->n_descs, sizeof(pending_router_desc_t));
+  i = 0;
+  for (s = upload->body;
+       router_find_next_descriptor(&s, eos, &end, &is_extrainfo) == 0;
+       s = end) {
+    if (!is_extrainfo) {
+      upload->descs[i].start = s;
+      upload->descs[i].end = end;
+      ++i;
+    }
+  }
+
+  /* ...and decide which of them need checking. */
+  for (i = 0; i < upload->n_descs; ++i) {
+    pending_router_desc_t *d = &upload->descs[i];
+    /* Bridge authorities may replace a descriptor with an identical one of
+     * a different purpose; let them see every copy. */
+    if (purpose != ROUTER_PURPOSE_GENERAL ||
+        router_get_router_hash(d->start, d->end - d->start, d->digest) < 0) {
+      ++n_to_parse;
+      continue;
+    }
+    d->in_flight = digestmap_get(in_flight_descriptor_digests, d->digest);
+    if (d->in_flight) {
+      ++d->in_flight->refcnt;
+      d->is_duplicate = 1;
+      continue;
+    }
+    if (router_get_by_descriptor_digest(d->digest)) {
+      d->is_duplicate = 1;
+      continue;
+    }
+    d->in_flight = tor_malloc_zero(sizeof(in_flight_desc_t));
+    d->in_flight->refcnt = 1;
+    digestmap_set(in_flight_descriptor_digests, d->digest, d->in_flight);
+    ++n_to_parse;
+  }
+
+  smartlist_add(pending_descriptor_uploads, upload);
+  if (n_to_parse == 0) {
+    upload->is_parsed = 1;
+    finish_parsed_descriptor_uploads();
+    return 0;
+  }
+
+  upload->work = cpuworker_queue_work(WQ_PRI_LOW, descriptor_upload_threadfn,
+                                      descriptor_upload_replyfn, upload);
+  if (!upload->work) {
+    /* Check them here instead, once the uploads ahead of this one are
+     * done. */
+    log_warn(LD_BUG, "Unable to queue descriptor upload from %s for a "
+             "cpuworker.", source);
+    for (i = 0; i < upload->n_descs; ++i) {
+      pending_router_desc_t *d = &upload->descs[i];
+      if (!d->is_duplicate)
+        pending_router_desc_release_in_flight(d);
+      d->is_duplicate = 1;
+    }
+    upload->is_parsed = 1;
+    finish_parsed_descriptor_uploads();
+  }
+  return 0;
 }
 
 /** Examine the parsed server descriptor in <b>ri</b> and maybe insert it into
@@ -1926,11 +2299,17 @@ routerstatus_format_entry(const routerstatus_t *rs, const char *version,
   char published[ISO_TIME_LEN+1];
   char identity64[BASE64_DIGEST_LEN+1];
   char digest64[BASE64_DIGEST_LEN+1];
+  char addrbuf[TOR_ADDR_BUF_LEN];
+  struct in_addr in;
   smartlist_t *chunks = smartlist_new();
 
   format_iso_time(published, rs->published_on);
   digest_to_base64(identity64, rs->identity_digest);
   digest_to_base64(digest64, rs->descriptor_digest);
+  /* We don't use fmt_addr32() or fmt_addrport() here: authorities can
+   * format consensus entries on several threads at once. */
+  in.s_addr = htonl(rs->addr);
+  tor_inet_ntoa(&in, addrbuf, sizeof(addrbuf));
 
   smartlist_add_asprintf(chunks,
                    "r %s %s %s%s%s %s %d %d\n",
@@ -1939,7 +2318,7 @@ routerstatus_format_entry(const routerstatus_t *rs, const char *version,
                    (format==NS_V3_CONSENSUS_MICRODESC)?"":digest64,
                    (format==NS_V3_CONSENSUS_MICRODESC)?"":" ",
                    published,
-                   fmt_addr32(rs->addr),
+                   addrbuf,
                    (int)rs->or_port,
                    (int)rs->dir_port);
 
@@ -1954,8 +2333,10 @@ routerstatus_format_entry(const routerstatus_t *rs, const char *version,
 
   /* Possible "a" line. At most one for now. */
   if (!tor_addr_is_null(&rs->ipv6_addr)) {
-    smartlist_add_asprintf(chunks, "a %s\n",
-                           fmt_addrport(&rs->ipv6_addr, rs->ipv6_orport));
+    smartlist_add_asprintf(chunks, "a %s:%u\n",
+                           tor_addr_to_str(addrbuf, &rs->ipv6_addr,
+                                           sizeof(addrbuf), 1),
+                           rs->ipv6_orport);
   }
 
   if (format == NS_V3_CONSENSUS)
@@ -4025,5 +4406,21 @@ dirserv_free_all(void)
   cached_consensuses = NULL;
 
   dirserv_clear_measured_bw_cache();
+
+  /* Nobody will hear about the uploads we haven't finished.  The ones that
+   * a cpuworker is checking right now get freed when it replies. */
+  if (pending_descriptor_uploads) {
+    SMARTLIST_FOREACH_BEGIN(pending_descriptor_uploads,
+                            descriptor_upload_t *, upload) {
+      if (upload->work && !cpuworker_cancel_work(upload->work))
+        upload->is_abandoned = 1;
+      else
+        descriptor_upload_free(upload);
+    } SMARTLIST_FOREACH_END(upload);
+  }
+  smartlist_free(pending_descriptor_uploads);
+  pending_descriptor_uploads = NULL;
+  digestmap_free(in_flight_descriptor_digests, tor_free_);
+  in_flight_descriptor_digests = NULL;
 }
 
@@ -96,6 +96,17 @@ enum was_router_added_t dirserv_add_multiple_descriptors(
                                      const char *desc, uint8_t purpose,
                                      const char *source,
                                      const char **msg);
+/** Function to call once an upload handed to
+ * dirserv_add_multiple_descriptors_async() is handled: gets the global
+ * identifier of the uploading connection, the result, and a message for the
+ * uploader. */
+typedef void (*dirserv_upload_done_fn_t)(uint64_t conn_id,
+                                         enum was_router_added_t r,
+                                         const char *msg);
+int dirserv_add_multiple_descriptors_async(const char *desc, uint8_t purpose,
+                                           const char *source,
+                                           uint64_t conn_id,
+                                           dirserv_upload_done_fn_t done_fn);
 enum was_router_added_t dirserv_add_descriptor(routerinfo_t *ri,
                                                const char **msg,
                                                const char *source);
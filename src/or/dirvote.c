@@ -570,10 +570,13 @@ compute_routerstatus_consensus(smartlist_t *votes, int consensus_method,
     most_alt_orport = smartlist_get_most_frequent(alt_orports,
                                                   compare_orports_);
     if (most_alt_orport) {
+      char addrbuf[TOR_ADDR_BUF_LEN];
       memcpy(best_alt_orport_out, most_alt_orport, sizeof(tor_addr_port_t));
-      log_debug(LD_DIR, "\"a\" line winner for %s is %s",
+      log_debug(LD_DIR, "\"a\" line winner for %s is %s:%u",
                 most->status.nickname,
-                fmt_addrport(&most_alt_orport->addr, most_alt_orport->port));
+                tor_addr_to_str(addrbuf, &most_alt_orport->addr,
+                                sizeof(addrbuf), 1),
+                most_alt_orport->port);
     }
 
     SMARTLIST_FOREACH(alt_orports, tor_addr_port_t *, ap, tor_free(ap));
@@ -1312,6 +1315,578 @@ compute_nth_protocol_set(int n, int n_voters, const smartlist_t *votes)
   return result;
 }
 
+/** State shared by the threads that dirvote_run_in_parallel() starts. */
+typedef struct parallel_run_t {
+  /** Protects n_running. */
+  tor_mutex_t lock;
+  /** Signalled when n_running reaches zero. */
+  tor_cond_t done;
+  /** How many of the spawned calls haven't finished yet? */
+  int n_running;
+} parallel_run_t;
+
+/** One call for a thread started by dirvote_run_in_parallel() to make. */
+typedef struct parallel_call_t {
+  /** The run that this call is part of. */
+  parallel_run_t *run;
+  /** The function to call, and its argument. */
+  void (*fn)(void *);
+  void *arg;
+} parallel_call_t;
+
+/** Thread main function for dirvote_run_in_parallel(). */
+static void
+parallel_call_main(void *arg)
+{
+  parallel_call_t *call = arg;
+  parallel_run_t *run = call->run;
+  call->fn(call->arg);
+  tor_mutex_acquire(&run->lock);
+  if (--run->n_running == 0)
+    tor_cond_signal_one(&run->done);
+  tor_mutex_release(&run->lock);
+}
+
+/** Call <b>fn</b> on each of the <b>n</b> elements of <b>args</b>, running
+ * all but the first call on new threads, and return once they have all
+ * finished.  If we can't start a thread, we make that call ourselves. */
+static void
+dirvote_run_in_parallel(void (*fn)(void *), void **args, int n)
+{
+  parallel_run_t run;
+  parallel_call_t *calls;
+  int i;
+
+  tor_assert(n >= 1);
+  if (n == 1) {
+    fn(args[0]);
+    return;
+  }
+
+  memset(&run, 0, sizeof(run));
+  tor_mutex_init_for_cond(&run.lock);
+  tor_cond_init(&run.done);
+  calls = tor_calloc(n, sizeof(parallel_call_t));
+
+  tor_mutex_acquire(&run.lock);
+  for (i = 1; i < n; ++i) {
+    calls[i].run = &run;
+    calls[i].fn = fn;
+    calls[i].arg = args[i];
+    ++run.n_running;
+    if (spawn_func(parallel_call_main, &calls[i]) < 0) {
+      log_warn(LD_GENERAL, "Couldn't start a thread; computing a part of "
+               "the consensus on this one instead.");
+      --run.n_running;
+      tor_mutex_release(&run.lock);
+      fn(args[i]);
+      tor_mutex_acquire(&run.lock);
+    }
+  }
+  tor_mutex_release(&run.lock);
+
+  fn(args[0]);
+
+  tor_mutex_acquire(&run.lock);
+  while (run.n_running > 0)
+    tor_cond_wait(&run.done, &run.lock, NULL);
+  tor_mutex_release(&run.lock);
+
+  tor_cond_uninit(&run.done);
+  tor_mutex_uninit(&run.lock);
+  tor_free(calls);
+}
+
+/** Everything that the per-router part of networkstatus_compute_consensus()
+ * needs to know about the votes.  Nothing modifies it once it's built, so
+ * several threads can share it. */
+typedef struct consensus_router_ctx_t {
+  /** The votes, sorted by authority ID. */
+  smartlist_t *votes;
+  /** The number of authorities that we believe exist. */
+  int total_authorities;
+  /** The consensus method that we're using. */
+  int consensus_method;
+  /** Which flavor of consensus we're computing. */
+  consensus_flavor_t flavor;
+  /** How to format each routerstatus. */
+  routerstatus_format_type_t rs_format;
+  /** Every flag that any vote knows about, sorted. */
+  const smartlist_t *flags;
+  /** n_voter_flags[j] is the number of flags that votes[j] knows about. */
+  const int *n_voter_flags;
+  /** n_flag_voters[f] is the number of votes that care about flags[f]. */
+  const int *n_flag_voters;
+  /** flag_map[j][b] is an index f such that flags[f] is the same flag as
+   * votes[j]->known_flags[b]. */
+  int * const *flag_map;
+  /** Index of the flag "Named" for votes[j], or -1. */
+  const int *named_flag;
+  /** Map from lowercase nickname to the identity digest that the Named
+   * votes agree on, or to a "conflict" or "unknown" marker. */
+  const strmap_t *name_to_id_map;
+  /** How many votes include measured bandwidths? */
+  int n_authorities_measuring_bandwidth;
+  /** Largest bandwidth to list for an unmeasured router. */
+  uint32_t max_unmeasured_bw_kb;
+  /** All the routerstatuses in the votes, grouped by router. */
+  dircollator_t *collator;
+} consensus_router_ctx_t;
+
+/** A contiguous range of routers, in collation order, whose consensus
+ * entries one thread formats. */
+typedef struct consensus_router_job_t {
+  /** What we know about the votes. */
+  const consensus_router_ctx_t *ctx;
+  /** The index of the first router in the range. */
+  int start;
+  /** One more than the index of the last router in the range. */
+  int end;
+  /** Strings to append to the consensus, in order. */
+  smartlist_t *chunks;
+  /** The bandwidths of the routers that we listed, as summed by
+   * update_total_bandwidth_weights(). */
+  int64_t G, M, E, D, T;
+} consensus_router_job_t;
+
+/** Add the consensus entries for the routers in <b>arg</b>, a
+ * consensus_router_job_t, to its chunks, and add their bandwidths to its
+ * totals.  This is the part of networkstatus_compute_consensus() that does
+ * a separate merge for each router, so it's the part we split up across
+ * threads.  It must not touch any global state. */
+static void
+compute_consensus_router_entries(void *arg)
+{
+  consensus_router_job_t *job = arg;
+  const consensus_router_ctx_t *ctx = job->ctx;
+  smartlist_t *votes = ctx->votes;
+  const smartlist_t *flags = ctx->flags;
+  const int total_authorities = ctx->total_authorities;
+  const int consensus_method = ctx->consensus_method;
+  const consensus_flavor_t flavor = ctx->flavor;
+  const int *n_voter_flags = ctx->n_voter_flags;
+  const int *n_flag_voters = ctx->n_flag_voters;
+  int * const *flag_map = ctx->flag_map;
+  const int *named_flag = ctx->named_flag;
+  smartlist_t *chunks = job->chunks;
+  int *flag_counts; /* The number of voters that list flag[j] for the
+                     * currently considered router. */
+  int i;
+  smartlist_t *matching_descs = smartlist_new();
+  smartlist_t *chosen_flags = smartlist_new();
+  smartlist_t *versions = smartlist_new();
+  smartlist_t *protocols = smartlist_new();
+  smartlist_t *exitsummaries = smartlist_new();
+  uint32_t *bandwidths_kb = tor_calloc(smartlist_len(votes),
+                                       sizeof(uint32_t));
+  uint32_t *measured_bws_kb = tor_calloc(smartlist_len(votes),
+                                         sizeof(uint32_t));
+  uint32_t *measured_guardfraction = tor_calloc(smartlist_len(votes),
+                                                sizeof(uint32_t));
+  int num_bandwidths;
+  int num_mbws;
+  int num_guardfraction_inputs;
+
+  flag_counts = tor_calloc(smartlist_len(flags), sizeof(int));
+  for (i = job->start; i < job->end; ++i) {
+    vote_routerstatus_t **vrs_lst =
+      dircollator_get_votes_for_router(ctx->collator, i);
+
+    vote_routerstatus_t *rs;
+    routerstatus_t rs_out;
+    const char *current_rsa_id = NULL;
+    const char *chosen_version;
+    const char *chosen_protocol_list;
+    const char *chosen_name = NULL;
+    int exitsummary_disagreement = 0;
+    int is_named = 0, is_unnamed = 0, is_running = 0, is_valid = 0;
+    int is_guard = 0, is_exit = 0, is_bad_exit = 0;
+    int naming_conflict = 0;
+    int n_listing = 0;
+    char microdesc_digest[DIGEST256_LEN];
+    tor_addr_port_t alt_orport = {TOR_ADDR_NULL, 0};
+
+    memset(flag_counts, 0, sizeof(int)*smartlist_len(flags));
+    smartlist_clear(matching_descs);
+    smartlist_clear(chosen_flags);
+    smartlist_clear(versions);
+    smartlist_clear(protocols);
+    num_bandwidths = 0;
+    num_mbws = 0;
+    num_guardfraction_inputs = 0;
+    int ed_consensus = 0;
+    const uint8_t *ed_consensus_val = NULL;
+
+    /* Okay, go through all the entries for this digest. */
+    for (int voter_idx = 0; voter_idx < smartlist_len(votes); ++voter_idx) {
+      if (vrs_lst[voter_idx] == NULL)
+        continue; /* This voter had nothing to say about this entry. */
+      rs = vrs_lst[voter_idx];
+      ++n_listing;
+
+      current_rsa_id = rs->status.identity_digest;
+
+      smartlist_add(matching_descs, rs);
+      if (rs->version && rs->version[0])
+        smartlist_add(versions, rs->version);
+
+      if (rs->protocols) {
+        /* We include this one even if it's empty: voting for an
+         * empty protocol list actually is meaningful. */
+        smartlist_add(protocols, rs->protocols);
+      }
+
+      /* Tally up all the flags. */
+      for (int flag = 0; flag < n_voter_flags[voter_idx]; ++flag) {
+        if (rs->flags & (U64_LITERAL(1) << flag))
+          ++flag_counts[flag_map[voter_idx][flag]];
+      }
+      if (named_flag[voter_idx] >= 0 &&
+          (rs->flags & (U64_LITERAL(1) << named_flag[voter_idx]))) {
+        if (chosen_name && strcmp(chosen_name, rs->status.nickname)) {
+          log_notice(LD_DIR, "Conflict on naming for router: %s vs %s",
+                     chosen_name, rs->status.nickname);
+          naming_conflict = 1;
+        }
+        chosen_name = rs->status.nickname;
+      }
+
+      /* Count guardfraction votes and note down the values. */
+      if (rs->status.has_guardfraction) {
+        measured_guardfraction[num_guardfraction_inputs++] =
+          rs->status.guardfraction_percentage;
+      }
+
+      /* count bandwidths */
+      if (rs->has_measured_bw)
+        measured_bws_kb[num_mbws++] = rs->measured_bw_kb;
+
+      if (rs->status.has_bandwidth)
+        bandwidths_kb[num_bandwidths++] = rs->status.bandwidth_kb;
+
+      /* Count number for which ed25519 is canonical. */
+      if (rs->ed25519_reflects_consensus) {
+        ++ed_consensus;
+        if (ed_consensus_val) {
+          tor_assert(fast_memeq(ed_consensus_val, rs->ed25519_id,
+                                ED25519_PUBKEY_LEN));
+        } else {
+          ed_consensus_val = rs->ed25519_id;
+        }
+      }
+    }
+
+    /* We don't include this router at all unless more than half of
+     * the authorities we believe in list it. */
+    if (n_listing <= total_authorities/2)
+      continue;
+
+    if (ed_consensus > 0) {
+      tor_assert(consensus_method >= MIN_METHOD_FOR_ED25519_ID_VOTING);
+      if (ed_consensus <= total_authorities / 2) {
+        log_warn(LD_BUG, "Not enough entries had ed_consensus set; how "
+                 "can we have a consensus of %d?", ed_consensus);
+      }
+    }
+
+    /* The clangalyzer can't figure out that this will never be NULL
+     * if n_listing is at least 1 */
+    tor_assert(current_rsa_id);
+
+    /* Figure out the most popular opinion of what the most recent
+     * routerinfo and its contents are. */
+    memset(microdesc_digest, 0, sizeof(microdesc_digest));
+    rs = compute_routerstatus_consensus(matching_descs, consensus_method,
+                                        microdesc_digest, &alt_orport);
+    /* Copy bits of that into rs_out. */
+    memset(&rs_out, 0, sizeof(rs_out));
+    tor_assert(fast_memeq(current_rsa_id,
+                          rs->status.identity_digest,DIGEST_LEN));
+    memcpy(rs_out.identity_digest, current_rsa_id, DIGEST_LEN);
+    memcpy(rs_out.descriptor_digest, rs->status.descriptor_digest,
+           DIGEST_LEN);
+    rs_out.addr = rs->status.addr;
+    rs_out.published_on = rs->status.published_on;
+    rs_out.dir_port = rs->status.dir_port;
+    rs_out.or_port = rs->status.or_port;
+    if (consensus_method >= MIN_METHOD_FOR_A_LINES) {
+      tor_addr_copy(&rs_out.ipv6_addr, &alt_orport.addr);
+      rs_out.ipv6_orport = alt_orport.port;
+    }
+    rs_out.has_bandwidth = 0;
+    rs_out.has_exitsummary = 0;
+
+    if (chosen_name && !naming_conflict) {
+      strlcpy(rs_out.nickname, chosen_name, sizeof(rs_out.nickname));
+    } else {
+      strlcpy(rs_out.nickname, rs->status.nickname, sizeof(rs_out.nickname));
+    }
+
+    {
+      const char *d = strmap_get_lc(ctx->name_to_id_map, rs_out.nickname);
+      if (!d) {
+        is_named = is_unnamed = 0;
+      } else if (fast_memeq(d, current_rsa_id, DIGEST_LEN)) {
+        is_named = 1; is_unnamed = 0;
+      } else {
+        is_named = 0; is_unnamed = 1;
+      }
+    }
+
+    /* Set the flags. */
+    smartlist_add(chosen_flags, (char*)"s"); /* for the start of the line. */
+    SMARTLIST_FOREACH_BEGIN(flags, const char *, fl) {
+      if (!strcmp(fl, "Named")) {
+        if (is_named)
+          smartlist_add(chosen_flags, (char*)fl);
+      } else if (!strcmp(fl, "Unnamed")) {
+        if (is_unnamed)
+          smartlist_add(chosen_flags, (char*)fl);
+      } else if (!strcmp(fl, "NoEdConsensus") &&
+                 consensus_method >= MIN_METHOD_FOR_ED25519_ID_VOTING) {
+        if (ed_consensus <= total_authorities/2)
+          smartlist_add(chosen_flags, (char*)fl);
+      } else {
+        if (flag_counts[fl_sl_idx] > n_flag_voters[fl_sl_idx]/2) {
+          smartlist_add(chosen_flags, (char*)fl);
+          if (!strcmp(fl, "Exit"))
+            is_exit = 1;
+          else if (!strcmp(fl, "Guard"))
+            is_guard = 1;
+          else if (!strcmp(fl, "Running"))
+            is_running = 1;
+          else if (!strcmp(fl, "BadExit"))
+            is_bad_exit = 1;
+          else if (!strcmp(fl, "Valid"))
+            is_valid = 1;
+        }
+      }
+    } SMARTLIST_FOREACH_END(fl);
+
+    /* Starting with consensus method 4 we do not list servers
+     * that are not running in a consensus.  See Proposal 138 */
+    if (!is_running)
+      continue;
+
+    /* Starting with consensus method 24, we don't list servers
+     * that are not valid in a consensus.  See Proposal 272 */
+    if (!is_valid &&
+        consensus_method >= MIN_METHOD_FOR_EXCLUDING_INVALID_NODES)
+      continue;
+
+    /* Pick the version. */
+    if (smartlist_len(versions)) {
+      sort_version_list(versions, 0);
+      chosen_version = get_most_frequent_member(versions);
+    } else {
+      chosen_version = NULL;
+    }
+
+    /* Pick the protocol list */
+    if (smartlist_len(protocols)) {
+      smartlist_sort_strings(protocols);
+      chosen_protocol_list = get_most_frequent_member(protocols);
+    } else {
+      chosen_protocol_list = NULL;
+    }
+
+    /* If it's a guard and we have enough guardfraction votes,
+       calculate its consensus guardfraction value. */
+    if (is_guard && num_guardfraction_inputs > 2 &&
+        consensus_method >= MIN_METHOD_FOR_GUARDFRACTION) {
+      rs_out.has_guardfraction = 1;
+      rs_out.guardfraction_percentage = median_uint32(measured_guardfraction,
+                                                   num_guardfraction_inputs);
+      /* final value should be an integer percentage! */
+      tor_assert(rs_out.guardfraction_percentage <= 100);
+    }
+
+    /* Pick a bandwidth */
+    if (num_mbws > 2) {
+      rs_out.has_bandwidth = 1;
+      rs_out.bw_is_unmeasured = 0;
+      rs_out.bandwidth_kb = median_uint32(measured_bws_kb, num_mbws);
+    } else if (num_bandwidths > 0) {
+      rs_out.has_bandwidth = 1;
+      rs_out.bw_is_unmeasured = 1;
+      rs_out.bandwidth_kb = median_uint32(bandwidths_kb, num_bandwidths);
+      if (consensus_method >= MIN_METHOD_TO_CLIP_UNMEASURED_BW &&
+          ctx->n_authorities_measuring_bandwidth > 2) {
+        /* Cap non-measured bandwidths. */
+        if (rs_out.bandwidth_kb > ctx->max_unmeasured_bw_kb) {
+          rs_out.bandwidth_kb = ctx->max_unmeasured_bw_kb;
+        }
+      }
+    }
+
+    /* Fix bug 2203: Do not count BadExit nodes as Exits for bw weights */
+    is_exit = is_exit && !is_bad_exit;
+
+    /* Update total bandwidth weights with the bandwidths of this router. */
+    {
+      update_total_bandwidth_weights(&rs_out,
+                                     is_exit, is_guard,
+                                     &job->G, &job->M, &job->E, &job->D,
+                                     &job->T);
+    }
+
+    /* Ok, we already picked a descriptor digest we want to list
+     * previously.  Now we want to use the exit policy summary from
+     * that descriptor.  If everybody plays nice all the voters who
+     * listed that descriptor will have the same summary.  If not then
+     * something is fishy and we'll use the most common one (breaking
+     * ties in favor of lexicographically larger one (only because it
+     * lets me reuse more existing code)).
+     *
+     * The other case that can happen is that no authority that voted
+     * for that descriptor has an exit policy summary.  That's
+     * probably quite unlikely but can happen.  In that case we use
+     * the policy that was most often listed in votes, again breaking
+     * ties like in the previous case.
+     */
+    {
+      /* Okay, go through all the votes for this router.  We prepared
+       * that list previously */
+      const char *chosen_exitsummary = NULL;
+      smartlist_clear(exitsummaries);
+      SMARTLIST_FOREACH_BEGIN(matching_descs, vote_routerstatus_t *, vsr) {
+        /* Check if the vote where this status comes from had the
+         * proper descriptor */
+        tor_assert(fast_memeq(rs_out.identity_digest,
+                           vsr->status.identity_digest,
+                           DIGEST_LEN));
+        if (vsr->status.has_exitsummary &&
+             fast_memeq(rs_out.descriptor_digest,
+                     vsr->status.descriptor_digest,
+                     DIGEST_LEN)) {
+          tor_assert(vsr->status.exitsummary);
+          smartlist_add(exitsummaries, vsr->status.exitsummary);
+          if (!chosen_exitsummary) {
+            chosen_exitsummary = vsr->status.exitsummary;
+          } else if (strcmp(chosen_exitsummary, vsr->status.exitsummary)) {
+            /* Great.  There's disagreement among the voters.  That
+             * really shouldn't be */
+            exitsummary_disagreement = 1;
+          }
+        }
+      } SMARTLIST_FOREACH_END(vsr);
+
+      if (exitsummary_disagreement) {
+        char id[HEX_DIGEST_LEN+1];
+        char dd[HEX_DIGEST_LEN+1];
+        base16_encode(id, sizeof(dd), rs_out.identity_digest, DIGEST_LEN);
+        base16_encode(dd, sizeof(dd), rs_out.descriptor_digest, DIGEST_LEN);
+        log_warn(LD_DIR, "The voters disagreed on the exit policy summary "
+                 " for router %s with descriptor %s.  This really shouldn't"
+                 " have happened.", id, dd);
+
+        smartlist_sort_strings(exitsummaries);
+        chosen_exitsummary = get_most_frequent_member(exitsummaries);
+      } else if (!chosen_exitsummary) {
+        char id[HEX_DIGEST_LEN+1];
+        char dd[HEX_DIGEST_LEN+1];
+        base16_encode(id, sizeof(dd), rs_out.identity_digest, DIGEST_LEN);
+        base16_encode(dd, sizeof(dd), rs_out.descriptor_digest, DIGEST_LEN);
+        log_warn(LD_DIR, "Not one of the voters that made us select"
+                 "descriptor %s for router %s had an exit policy"
+                 "summary", dd, id);
+
+        /* Ok, none of those voting for the digest we chose had an
+         * exit policy for us.  Well, that kinda sucks.
+         */
+        smartlist_clear(exitsummaries);
+        SMARTLIST_FOREACH(matching_descs, vote_routerstatus_t *, vsr, {
+          if (vsr->status.has_exitsummary)
+            smartlist_add(exitsummaries, vsr->status.exitsummary);
+        });
+        smartlist_sort_strings(exitsummaries);
+        chosen_exitsummary = get_most_frequent_member(exitsummaries);
+
+        if (!chosen_exitsummary)
+          log_warn(LD_DIR, "Wow, not one of the voters had an exit "
+                   "policy summary for %s.  Wow.", id);
+      }
+
+      if (chosen_exitsummary) {
+        rs_out.has_exitsummary = 1;
+        /* yea, discards the const */
+        rs_out.exitsummary = (char *)chosen_exitsummary;
+      }
+    }
+
+    if (flavor == FLAV_MICRODESC &&
+        tor_digest256_is_zero(microdesc_digest)) {
+      /* With no microdescriptor digest, we omit the entry entirely. */
+      continue;
+    }
+
+    {
+      char *buf;
+      /* Okay!! Now we can write the descriptor... */
+      /*     First line goes into "buf". */
+      buf = routerstatus_format_entry(&rs_out, NULL, NULL, ctx->rs_format,
+                                      NULL);
+      if (buf)
+        smartlist_add(chunks, buf);
+    }
+    /*     Now an m line, if applicable. */
+    if (flavor == FLAV_MICRODESC &&
+        !tor_digest256_is_zero(microdesc_digest)) {
+      char m[BASE64_DIGEST256_LEN+1];
+      digest256_to_base64(m, microdesc_digest);
+      smartlist_add_asprintf(chunks, "m %s\n", m);
+    }
+    /*     Next line is all flags.  The "\n" is missing. */
+    smartlist_add(chunks,
+                  smartlist_join_strings(chosen_flags, " ", 0, NULL));
+    /*     Now the version line. */
+    if (chosen_version) {
+      smartlist_add_strdup(chunks, "\nv ");
+      smartlist_add_strdup(chunks, chosen_version);
+    }
+    smartlist_add_strdup(chunks, "\n");
+    if (chosen_protocol_list &&
+        consensus_method >= MIN_METHOD_FOR_RS_PROTOCOLS) {
+      smartlist_add_asprintf(chunks, "pr %s\n", chosen_protocol_list);
+    }
+    /*     Now the weight line. */
+    if (rs_out.has_bandwidth) {
+      char *guardfraction_str = NULL;
+      int unmeasured = rs_out.bw_is_unmeasured &&
+        consensus_method >= MIN_METHOD_TO_CLIP_UNMEASURED_BW;
+
+      /* If we have guardfraction info, include it in the 'w' line. */
+      if (rs_out.has_guardfraction) {
+        tor_asprintf(&guardfraction_str,
+                     " GuardFraction=%u", rs_out.guardfraction_percentage);
+      }
+      smartlist_add_asprintf(chunks, "w Bandwidth=%d%s%s\n",
+                             rs_out.bandwidth_kb,
+                             unmeasured?" Unmeasured=1":"",
+                             guardfraction_str ? guardfraction_str : "");
+
+      tor_free(guardfraction_str);
+    }
+
+    /*     Now the exitpolicy summary line. */
+    if (rs_out.has_exitsummary && flavor == FLAV_NS) {
+      smartlist_add_asprintf(chunks, "p %s\n", rs_out.exitsummary);
+    }
+
+    /* And the loop is over and we move on to the next router */
+  }
+
+  tor_free(flag_counts);
+  smartlist_free(matching_descs);
+  smartlist_free(chosen_flags);
+  smartlist_free(versions);
+  smartlist_free(protocols);
+  smartlist_free(exitsummaries);
+  tor_free(bandwidths_kb);
+  tor_free(measured_bws_kb);
+  tor_free(measured_guardfraction);
+}
+
 /** Given a list of vote networkstatus_t in <b>votes</b>, our public
  * authority <b>identity_key</b>, our private authority <b>signing_key</b>,
  * and the number of <b>total_authorities</b> that we believe exist in our
@@ -1338,6 +1913,30 @@ networkstatus_compute_consensus(smartlist_t *votes,
                                 const char *legacy_id_key_digest,
                                 crypto_pk_t *legacy_signing_key,
                                 consensus_flavor_t flavor)
+{
+  return networkstatus_compute_consensus_threaded(votes, total_authorities,
+                                                  identity_key, signing_key,
+                                                  legacy_id_key_digest,
+                                                  legacy_signing_key,
+                                                  flavor, 1);
+}
+
+/** As networkstatus_compute_consensus(), but split the per-router part of
+ * the work across up to <b>n_threads</b> threads (including this one).
+ * The result is the same for any number of threads.
+ *
+ * This function may itself run on a thread other than the main thread, as
+ * long as the main thread doesn't change the votes, the options, or the
+ * list of authorities while it runs. */
+char *
+networkstatus_compute_consensus_threaded(smartlist_t *votes,
+                                         int total_authorities,
+                                         crypto_pk_t *identity_key,
+                                         crypto_pk_t *signing_key,
+                                         const char *legacy_id_key_digest,
+                                         crypto_pk_t *legacy_signing_key,
+                                         consensus_flavor_t flavor,
+                                         int n_threads)
 {
   smartlist_t *chunks;
   char *result = NULL;
@@ -1573,15 +2172,20 @@ networkstatus_compute_consensus(smartlist_t *votes,
       char votedigest[HEX_DIGEST_LEN+1];
       networkstatus_t *v = e->v;
       networkstatus_voter_info_t *voter = get_voter(v);
+      char addrbuf[INET_NTOA_BUF_LEN];
+      struct in_addr in;
 
       base16_encode(fingerprint, sizeof(fingerprint), e->digest, DIGEST_LEN);
       base16_encode(votedigest, sizeof(votedigest), voter->vote_digest,
                     DIGEST_LEN);
+      /* Not fmt_addr32(): we might not be on the main thread. */
+      in.s_addr = htonl(voter->addr);
+      tor_inet_ntoa(&in, addrbuf, sizeof(addrbuf));
 
       smartlist_add_asprintf(chunks,
                    "dir-source %s%s %s %s %s %d %d\n",
                    voter->nickname, e->is_legacy ? "-legacy" : "",
-                   fingerprint, voter->address, fmt_addr32(voter->addr),
+                   fingerprint, voter->address, addrbuf,
                    voter->dir_port,
                    voter->or_port);
       if (! e->is_legacy) {
@@ -1612,8 +2216,10 @@ networkstatus_compute_consensus(smartlist_t *votes,
         max_unmeasured_bw_kb = (uint32_t)
           tor_parse_ulong(eq+1, 10, 1, UINT32_MAX, &ok, NULL);
         if (!ok) {
+          char *esc = esc_for_log(max_unmeasured_param);
           log_warn(LD_DIR, "Bad element '%s' in max unmeasured bw param",
-                   escaped(max_unmeasured_param));
+                   esc);
+          tor_free(esc);
           max_unmeasured_bw_kb = DEFAULT_MAX_UNMEASURED_BW_KB;
         }
       }
@@ -1623,24 +2229,7 @@ networkstatus_compute_consensus(smartlist_t *votes,
   /* Add the actual router entries. */
   {
     int *size; /* size[j] is the number of routerstatuses in votes[j]. */
-    int *flag_counts; /* The number of voters that list flag[j] for the
-                       * currently considered router. */
     int i;
-    smartlist_t *matching_descs = smartlist_new();
-    smartlist_t *chosen_flags = smartlist_new();
-    smartlist_t *versions = smartlist_new();
-    smartlist_t *protocols = smartlist_new();
-    smartlist_t *exitsummaries = smartlist_new();
-    uint32_t *bandwidths_kb = tor_calloc(smartlist_len(votes),
-                                         sizeof(uint32_t));
-    uint32_t *measured_bws_kb = tor_calloc(smartlist_len(votes),
-                                           sizeof(uint32_t));
-    uint32_t *measured_guardfraction = tor_calloc(smartlist_len(votes),
-                                                  sizeof(uint32_t));
-    int num_bandwidths;
-    int num_mbws;
-    int num_guardfraction_inputs;
-
     int *n_voter_flags; /* n_voter_flags[j] is the number of flags that
                          * votes[j] knows about. */
     int *n_flag_voters; /* n_flag_voters[f] is the number of votes that care
@@ -1761,393 +2350,59 @@ networkstatus_compute_consensus(smartlist_t *votes,
 
     dircollator_collate(collator, consensus_method);
 
-    /* Now go through all the votes */
-    flag_counts = tor_calloc(smartlist_len(flags), sizeof(int));
-    const int num_routers = dircollator_n_routers(collator);
-    for (i = 0; i < num_routers; ++i) {
-      vote_routerstatus_t **vrs_lst =
-        dircollator_get_votes_for_router(collator, i);
-
-      vote_routerstatus_t *rs;
-      routerstatus_t rs_out;
-      const char *current_rsa_id = NULL;
-      const char *chosen_version;
-      const char *chosen_protocol_list;
-      const char *chosen_name = NULL;
-      int exitsummary_disagreement = 0;
-      int is_named = 0, is_unnamed = 0, is_running = 0, is_valid = 0;
-      int is_guard = 0, is_exit = 0, is_bad_exit = 0;
-      int naming_conflict = 0;
-      int n_listing = 0;
-      char microdesc_digest[DIGEST256_LEN];
-      tor_addr_port_t alt_orport = {TOR_ADDR_NULL, 0};
-
-      memset(flag_counts, 0, sizeof(int)*smartlist_len(flags));
-      smartlist_clear(matching_descs);
-      smartlist_clear(chosen_flags);
-      smartlist_clear(versions);
-      smartlist_clear(protocols);
-      num_bandwidths = 0;
-      num_mbws = 0;
-      num_guardfraction_inputs = 0;
-      int ed_consensus = 0;
-      const uint8_t *ed_consensus_val = NULL;
-
-      /* Okay, go through all the entries for this digest. */
-      for (int voter_idx = 0; voter_idx < smartlist_len(votes); ++voter_idx) {
-        if (vrs_lst[voter_idx] == NULL)
-          continue; /* This voter had nothing to say about this entry. */
-        rs = vrs_lst[voter_idx];
-        ++n_listing;
-
-        current_rsa_id = rs->status.identity_digest;
-
-        smartlist_add(matching_descs, rs);
-        if (rs->version && rs->version[0])
-          smartlist_add(versions, rs->version);
-
-        if (rs->protocols) {
-          /* We include this one even if it's empty: voting for an
-           * empty protocol list actually is meaningful. */
-          smartlist_add(protocols, rs->protocols);
-        }
-
-        /* Tally up all the flags. */
-        for (int flag = 0; flag < n_voter_flags[voter_idx]; ++flag) {
-          if (rs->flags & (U64_LITERAL(1) << flag))
-            ++flag_counts[flag_map[voter_idx][flag]];
-        }
-        if (named_flag[voter_idx] >= 0 &&
-            (rs->flags & (U64_LITERAL(1) << named_flag[voter_idx]))) {
-          if (chosen_name && strcmp(chosen_name, rs->status.nickname)) {
-            log_notice(LD_DIR, "Conflict on naming for router: %s vs %s",
-                       chosen_name, rs->status.nickname);
-            naming_conflict = 1;
-          }
-          chosen_name = rs->status.nickname;
-        }
-
-        /* Count guardfraction votes and note down the values. */
-        if (rs->status.has_guardfraction) {
-          measured_guardfraction[num_guardfraction_inputs++] =
-            rs->status.guardfraction_percentage;
-        }
-
-        /* count bandwidths */
-        if (rs->has_measured_bw)
-          measured_bws_kb[num_mbws++] = rs->measured_bw_kb;
-
-        if (rs->status.has_bandwidth)
-          bandwidths_kb[num_bandwidths++] = rs->status.bandwidth_kb;
-
-        /* Count number for which ed25519 is canonical. */
-        if (rs->ed25519_reflects_consensus) {
-          ++ed_consensus;
-          if (ed_consensus_val) {
-            tor_assert(fast_memeq(ed_consensus_val, rs->ed25519_id,
-                                  ED25519_PUBKEY_LEN));
-          } else {
-            ed_consensus_val = rs->ed25519_id;
-          }
-        }
-      }
-
-      /* We don't include this router at all unless more than half of
-       * the authorities we believe in list it. */
-      if (n_listing <= total_authorities/2)
-        continue;
-
-      if (ed_consensus > 0) {
-        tor_assert(consensus_method >= MIN_METHOD_FOR_ED25519_ID_VOTING);
-        if (ed_consensus <= total_authorities / 2) {
-          log_warn(LD_BUG, "Not enough entries had ed_consensus set; how "
-                   "can we have a consensus of %d?", ed_consensus);
-        }
-      }
-
-      /* The clangalyzer can't figure out that this will never be NULL
-       * if n_listing is at least 1 */
-      tor_assert(current_rsa_id);
-
-      /* Figure out the most popular opinion of what the most recent
-       * routerinfo and its contents are. */
-      memset(microdesc_digest, 0, sizeof(microdesc_digest));
-      rs = compute_routerstatus_consensus(matching_descs, consensus_method,
-                                          microdesc_digest, &alt_orport);
-      /* Copy bits of that into rs_out. */
-      memset(&rs_out, 0, sizeof(rs_out));
-      tor_assert(fast_memeq(current_rsa_id,
-                            rs->status.identity_digest,DIGEST_LEN));
-      memcpy(rs_out.identity_digest, current_rsa_id, DIGEST_LEN);
-      memcpy(rs_out.descriptor_digest, rs->status.descriptor_digest,
-             DIGEST_LEN);
-      rs_out.addr = rs->status.addr;
-      rs_out.published_on = rs->status.published_on;
-      rs_out.dir_port = rs->status.dir_port;
-      rs_out.or_port = rs->status.or_port;
-      if (consensus_method >= MIN_METHOD_FOR_A_LINES) {
-        tor_addr_copy(&rs_out.ipv6_addr, &alt_orport.addr);
-        rs_out.ipv6_orport = alt_orport.port;
-      }
-      rs_out.has_bandwidth = 0;
-      rs_out.has_exitsummary = 0;
-
-      if (chosen_name && !naming_conflict) {
-        strlcpy(rs_out.nickname, chosen_name, sizeof(rs_out.nickname));
-      } else {
-        strlcpy(rs_out.nickname, rs->status.nickname, sizeof(rs_out.nickname));
-      }
-
-      {
-        const char *d = strmap_get_lc(name_to_id_map, rs_out.nickname);
-        if (!d) {
-          is_named = is_unnamed = 0;
-        } else if (fast_memeq(d, current_rsa_id, DIGEST_LEN)) {
-          is_named = 1; is_unnamed = 0;
-        } else {
-          is_named = 0; is_unnamed = 1;
-        }
-      }
-
-      /* Set the flags. */
-      smartlist_add(chosen_flags, (char*)"s"); /* for the start of the line. */
-      SMARTLIST_FOREACH_BEGIN(flags, const char *, fl) {
-        if (!strcmp(fl, "Named")) {
-          if (is_named)
-            smartlist_add(chosen_flags, (char*)fl);
-        } else if (!strcmp(fl, "Unnamed")) {
-          if (is_unnamed)
-            smartlist_add(chosen_flags, (char*)fl);
-        } else if (!strcmp(fl, "NoEdConsensus") &&
-                   consensus_method >= MIN_METHOD_FOR_ED25519_ID_VOTING) {
-          if (ed_consensus <= total_authorities/2)
-            smartlist_add(chosen_flags, (char*)fl);
-        } else {
-          if (flag_counts[fl_sl_idx] > n_flag_voters[fl_sl_idx]/2) {
-            smartlist_add(chosen_flags, (char*)fl);
-            if (!strcmp(fl, "Exit"))
-              is_exit = 1;
-            else if (!strcmp(fl, "Guard"))
-              is_guard = 1;
-            else if (!strcmp(fl, "Running"))
-              is_running = 1;
-            else if (!strcmp(fl, "BadExit"))
-              is_bad_exit = 1;
-            else if (!strcmp(fl, "Valid"))
-              is_valid = 1;
-          }
-        }
-      } SMARTLIST_FOREACH_END(fl);
-
-      /* Starting with consensus method 4 we do not list servers
-       * that are not running in a consensus.  See Proposal 138 */
-      if (!is_running)
-        continue;
-
-      /* Starting with consensus method 24, we don't list servers
-       * that are not valid in a consensus.  See Proposal 272 */
-      if (!is_valid &&
-          consensus_method >= MIN_METHOD_FOR_EXCLUDING_INVALID_NODES)
-        continue;
-
-      /* Pick the version. */
-      if (smartlist_len(versions)) {
-        sort_version_list(versions, 0);
-        chosen_version = get_most_frequent_member(versions);
-      } else {
-        chosen_version = NULL;
-      }
-
-      /* Pick the protocol list */
-      if (smartlist_len(protocols)) {
-        smartlist_sort_strings(protocols);
-        chosen_protocol_list = get_most_frequent_member(protocols);
-      } else {
-        chosen_protocol_list = NULL;
-      }
-
-      /* If it's a guard and we have enough guardfraction votes,
-         calculate its consensus guardfraction value. */
-      if (is_guard && num_guardfraction_inputs > 2 &&
-          consensus_method >= MIN_METHOD_FOR_GUARDFRACTION) {
-        rs_out.has_guardfraction = 1;
-        rs_out.guardfraction_percentage = median_uint32(measured_guardfraction,
-                                                     num_guardfraction_inputs);
-        /* final value should be an integer percentage! */
-        tor_assert(rs_out.guardfraction_percentage <= 100);
-      }
-
-      /* Pick a bandwidth */
-      if (num_mbws > 2) {
-        rs_out.has_bandwidth = 1;
-        rs_out.bw_is_unmeasured = 0;
-        rs_out.bandwidth_kb = median_uint32(measured_bws_kb, num_mbws);
-      } else if (num_bandwidths > 0) {
-        rs_out.has_bandwidth = 1;
-        rs_out.bw_is_unmeasured = 1;
-        rs_out.bandwidth_kb = median_uint32(bandwidths_kb, num_bandwidths);
-        if (consensus_method >= MIN_METHOD_TO_CLIP_UNMEASURED_BW &&
-            n_authorities_measuring_bandwidth > 2) {
-          /* Cap non-measured bandwidths. */
-          if (rs_out.bandwidth_kb > max_unmeasured_bw_kb) {
-            rs_out.bandwidth_kb = max_unmeasured_bw_kb;
-          }
-        }
-      }
-
-      /* Fix bug 2203: Do not count BadExit nodes as Exits for bw weights */
-      is_exit = is_exit && !is_bad_exit;
-
-      /* Update total bandwidth weights with the bandwidths of this router. */
-      {
-        update_total_bandwidth_weights(&rs_out,
-                                       is_exit, is_guard,
-                                       &G, &M, &E, &D, &T);
-      }
-
-      /* Ok, we already picked a descriptor digest we want to list
-       * previously.  Now we want to use the exit policy summary from
-       * that descriptor.  If everybody plays nice all the voters who
-       * listed that descriptor will have the same summary.  If not then
-       * something is fishy and we'll use the most common one (breaking
-       * ties in favor of lexicographically larger one (only because it
-       * lets me reuse more existing code)).
-       *
-       * The other case that can happen is that no authority that voted
-       * for that descriptor has an exit policy summary.  That's
-       * probably quite unlikely but can happen.  In that case we use
-       * the policy that was most often listed in votes, again breaking
-       * ties like in the previous case.
-       */
-      {
-        /* Okay, go through all the votes for this router.  We prepared
-         * that list previously */
-        const char *chosen_exitsummary = NULL;
-        smartlist_clear(exitsummaries);
-        SMARTLIST_FOREACH_BEGIN(matching_descs, vote_routerstatus_t *, vsr) {
-          /* Check if the vote where this status comes from had the
-           * proper descriptor */
-          tor_assert(fast_memeq(rs_out.identity_digest,
-                             vsr->status.identity_digest,
-                             DIGEST_LEN));
-          if (vsr->status.has_exitsummary &&
-               fast_memeq(rs_out.descriptor_digest,
-                       vsr->status.descriptor_digest,
-                       DIGEST_LEN)) {
-            tor_assert(vsr->status.exitsummary);
-            smartlist_add(exitsummaries, vsr->status.exitsummary);
-            if (!chosen_exitsummary) {
-              chosen_exitsummary = vsr->status.exitsummary;
-            } else if (strcmp(chosen_exitsummary, vsr->status.exitsummary)) {
-              /* Great.  There's disagreement among the voters.  That
-               * really shouldn't be */
-              exitsummary_disagreement = 1;
-            }
-          }
-        } SMARTLIST_FOREACH_END(vsr);
-
-        if (exitsummary_disagreement) {
-          char id[HEX_DIGEST_LEN+1];
-          char dd[HEX_DIGEST_LEN+1];
-          base16_encode(id, sizeof(dd), rs_out.identity_digest, DIGEST_LEN);
-          base16_encode(dd, sizeof(dd), rs_out.descriptor_digest, DIGEST_LEN);
-          log_warn(LD_DIR, "The voters disagreed on the exit policy summary "
-                   " for router %s with descriptor %s.  This really shouldn't"
-                   " have happened.", id, dd);
-
-          smartlist_sort_strings(exitsummaries);
-          chosen_exitsummary = get_most_frequent_member(exitsummaries);
-        } else if (!chosen_exitsummary) {
-          char id[HEX_DIGEST_LEN+1];
-          char dd[HEX_DIGEST_LEN+1];
-          base16_encode(id, sizeof(dd), rs_out.identity_digest, DIGEST_LEN);
-          base16_encode(dd, sizeof(dd), rs_out.descriptor_digest, DIGEST_LEN);
-          log_warn(LD_DIR, "Not one of the voters that made us select"
-                   "descriptor %s for router %s had an exit policy"
-                   "summary", dd, id);
-
-          /* Ok, none of those voting for the digest we chose had an
-           * exit policy for us.  Well, that kinda sucks.
-           */
-          smartlist_clear(exitsummaries);
-          SMARTLIST_FOREACH(matching_descs, vote_routerstatus_t *, vsr, {
-            if (vsr->status.has_exitsummary)
-              smartlist_add(exitsummaries, vsr->status.exitsummary);
-          });
-          smartlist_sort_strings(exitsummaries);
-          chosen_exitsummary = get_most_frequent_member(exitsummaries);
-
-          if (!chosen_exitsummary)
-            log_warn(LD_DIR, "Wow, not one of the voters had an exit "
-                     "policy summary for %s.  Wow.", id);
-        }
-
-        if (chosen_exitsummary) {
-          rs_out.has_exitsummary = 1;
-          /* yea, discards the const */
-          rs_out.exitsummary = (char *)chosen_exitsummary;
-        }
-      }
-
-      if (flavor == FLAV_MICRODESC &&
-          tor_digest256_is_zero(microdesc_digest)) {
-        /* With no microdescriptor digest, we omit the entry entirely. */
-        continue;
-      }
-
-      {
-        char *buf;
-        /* Okay!! Now we can write the descriptor... */
-        /*     First line goes into "buf". */
-        buf = routerstatus_format_entry(&rs_out, NULL, NULL, rs_format, NULL);
-        if (buf)
-          smartlist_add(chunks, buf);
-      }
-      /*     Now an m line, if applicable. */
-      if (flavor == FLAV_MICRODESC &&
-          !tor_digest256_is_zero(microdesc_digest)) {
-        char m[BASE64_DIGEST256_LEN+1];
-        digest256_to_base64(m, microdesc_digest);
-        smartlist_add_asprintf(chunks, "m %s\n", m);
-      }
-      /*     Next line is all flags.  The "\n" is missing. */
-      smartlist_add(chunks,
-                    smartlist_join_strings(chosen_flags, " ", 0, NULL));
-      /*     Now the version line. */
-      if (chosen_version) {
-        smartlist_add_strdup(chunks, "\nv ");
-        smartlist_add_strdup(chunks, chosen_version);
-      }
-      smartlist_add_strdup(chunks, "\n");
-      if (chosen_protocol_list &&
-          consensus_method >= MIN_METHOD_FOR_RS_PROTOCOLS) {
-        smartlist_add_asprintf(chunks, "pr %s\n", chosen_protocol_list);
-      }
-      /*     Now the weight line. */
-      if (rs_out.has_bandwidth) {
-        char *guardfraction_str = NULL;
-        int unmeasured = rs_out.bw_is_unmeasured &&
-          consensus_method >= MIN_METHOD_TO_CLIP_UNMEASURED_BW;
-
-        /* If we have guardfraction info, include it in the 'w' line. */
-        if (rs_out.has_guardfraction) {
-          tor_asprintf(&guardfraction_str,
-                       " GuardFraction=%u", rs_out.guardfraction_percentage);
-        }
-        smartlist_add_asprintf(chunks, "w Bandwidth=%d%s%s\n",
-                               rs_out.bandwidth_kb,
-                               unmeasured?" Unmeasured=1":"",
-                               guardfraction_str ? guardfraction_str : "");
-
-        tor_free(guardfraction_str);
+    /* Build the consensus entries for each router, in ranges that we can
+     * hand out to separate threads, and then put the ranges back together
+     * in order. */
+    {
+      consensus_router_ctx_t ctx;
+      consensus_router_job_t *jobs;
+      void **job_ptrs;
+      const int num_routers = dircollator_n_routers(collator);
+      int n_jobs = MIN(n_threads, num_routers);
+      if (n_jobs < 1)
+        n_jobs = 1;
+
+      memset(&ctx, 0, sizeof(ctx));
+      ctx.votes = votes;
+      ctx.total_authorities = total_authorities;
+      ctx.consensus_method = consensus_method;
+      ctx.flavor = flavor;
+      ctx.rs_format = rs_format;
+      ctx.flags = flags;
+      ctx.n_voter_flags = n_voter_flags;
+      ctx.n_flag_voters = n_flag_voters;
+      ctx.flag_map = flag_map;
+      ctx.named_flag = named_flag;
+      ctx.name_to_id_map = name_to_id_map;
+      ctx.n_authorities_measuring_bandwidth =
+        n_authorities_measuring_bandwidth;
+      ctx.max_unmeasured_bw_kb = max_unmeasured_bw_kb;
+      ctx.collator = collator;
+
+      jobs = tor_calloc(n_jobs, sizeof(consensus_router_job_t));
+      job_ptrs = tor_calloc(n_jobs, sizeof(void *));
+      for (i = 0; i < n_jobs; ++i) {
+        jobs[i].ctx = &ctx;
+        jobs[i].start = (int)(((int64_t)num_routers * i) / n_jobs);
+        jobs[i].end = (int)(((int64_t)num_routers * (i+1)) / n_jobs);
+        jobs[i].chunks = smartlist_new();
+        job_ptrs[i] = &jobs[i];
       }
 
-      /*     Now the exitpolicy summary line. */
-      if (rs_out.has_exitsummary && flavor == FLAV_NS) {
-        smartlist_add_asprintf(chunks, "p %s\n", rs_out.exitsummary);
+      dirvote_run_in_parallel(compute_consensus_router_entries,
+                              job_ptrs, n_jobs);
+
+      for (i = 0; i < n_jobs; ++i) {
+        smartlist_add_all(chunks, jobs[i].chunks);
+        smartlist_free(jobs[i].chunks);
+        G += jobs[i].G;
+        M += jobs[i].M;
+        E += jobs[i].E;
+        D += jobs[i].D;
+        T += jobs[i].T;
       }
-
-      /* And the loop is over and we move on to the next router */
+      tor_free(jobs);
+      tor_free(job_ptrs);
     }
 
     tor_free(size);
@@ -2156,18 +2411,9 @@ networkstatus_compute_consensus(smartlist_t *votes,
     for (i = 0; i < smartlist_len(votes); ++i)
       tor_free(flag_map[i]);
     tor_free(flag_map);
-    tor_free(flag_counts);
     tor_free(named_flag);
     tor_free(unnamed_flag);
     strmap_free(name_to_id_map, NULL);
-    smartlist_free(matching_descs);
-    smartlist_free(chosen_flags);
-    smartlist_free(versions);
-    smartlist_free(protocols);
-    smartlist_free(exitsummaries);
-    tor_free(bandwidths_kb);
-    tor_free(measured_bws_kb);
-    tor_free(measured_guardfraction);
   }
 
   /* Mark the directory footer region */
@@ -2195,13 +2441,15 @@ networkstatus_compute_consensus(smartlist_t *votes,
         weight_scale = tor_parse_long(eq+1, 10, 1, INT32_MAX, &ok,
                                          NULL);
         if (!ok) {
-          log_warn(LD_DIR, "Bad element '%s' in bw weight param",
-              escaped(bw_weight_param));
+          char *esc = esc_for_log(bw_weight_param);
+          log_warn(LD_DIR, "Bad element '%s' in bw weight param", esc);
+          tor_free(esc);
           weight_scale = BW_WEIGHT_SCALE;
         }
       } else {
-        log_warn(LD_DIR, "Bad element '%s' in bw weight param",
-            escaped(bw_weight_param));
+        char *esc = esc_for_log(bw_weight_param);
+        log_warn(LD_DIR, "Bad element '%s' in bw weight param", esc);
+        tor_free(esc);
         weight_scale = BW_WEIGHT_SCALE;
       }
     }
@@ -3353,6 +3601,50 @@ write_v3_votes_to_disk(const smartlist_t *pending_votes)
   smartlist_free(votestrings);
 }
 
+/** Don't give a thread fewer than this many routers to merge when computing
+ * a consensus: below this, starting the thread costs more than it saves. */
+#define MIN_ROUTERS_PER_CONSENSUS_THREAD 512
+
+/** A consensus flavor for dirvote_compute_consensuses() to compute, possibly
+ * on a thread of its own. */
+typedef struct consensus_flavor_job_t {
+  /** Which flavor to compute. */
+  consensus_flavor_t flavor;
+  /** This job's own copy of the list of votes. */
+  smartlist_t *votes;
+  /** The number of authorities we believe in. */
+  int n_voters;
+  /** Our authority keys, as for networkstatus_compute_consensus(). */
+  crypto_pk_t *identity_key;
+  crypto_pk_t *signing_key;
+  const char *legacy_id_digest;
+  crypto_pk_t *legacy_signing_key;
+  /** How many threads to use for the per-router part of the work. */
+  int n_threads;
+  /** Output: the text of the consensus, or NULL if we couldn't make one. */
+  char *body;
+  /** Output: the consensus, parsed from <b>body</b>, or NULL if we couldn't
+   * parse it. */
+  networkstatus_t *consensus;
+} consensus_flavor_job_t;
+
+/** Compute and parse the consensus described by <b>arg</b>, a
+ * consensus_flavor_job_t.  Runs on a thread other than the main thread if
+ * we have more than one CPU. */
+static void
+compute_consensus_flavor(void *arg)
+{
+  consensus_flavor_job_t *job = arg;
+  job->body = networkstatus_compute_consensus_threaded(
+                        job->votes, job->n_voters,
+                        job->identity_key, job->signing_key,
+                        job->legacy_id_digest, job->legacy_signing_key,
+                        job->flavor, job->n_threads);
+  if (job->body)
+    job->consensus = networkstatus_parse_vote_from_string(job->body, NULL,
+                                                     NS_TYPE_CONSENSUS);
+}
+
 /** Try to compute a v3 networkstatus consensus from the currently pending
  * votes.  Return 0 on success, -1 on failure.  Store the consensus in
  * pending_consensus: it won't be ready to be published until we have
@@ -3429,36 +3721,71 @@ dirvote_compute_consensuses(void)
       }
     }
 
-    for (flav = 0; flav < N_CONSENSUS_FLAVORS; ++flav) {
-      const char *flavor_name = networkstatus_get_flavor_name(flav);
-      consensus_body = networkstatus_compute_consensus(
-        votes, n_voters,
-        my_cert->identity_key,
-        get_my_v3_authority_signing_key(), legacy_id_digest, legacy_sign,
-        flav);
-
-      if (!consensus_body) {
-        log_warn(LD_DIR, "Couldn't generate a %s consensus at all!",
-                 flavor_name);
-        continue;
+    /* Compute the flavors at the same time, each on its own thread, and
+     * split the rest of our CPUs between them for the per-router work.
+     * Each flavor gets its own copy of the vote list, since
+     * networkstatus_compute_consensus_threaded() sorts it. */
+    {
+      consensus_flavor_job_t jobs[N_CONSENSUS_FLAVORS];
+      void *job_ptrs[N_CONSENSUS_FLAVORS];
+      const int n_cpus = get_num_cpus(get_options());
+      int n_router_threads = MAX(1, n_cpus / N_CONSENSUS_FLAVORS);
+      int max_routers = 0;
+
+      SMARTLIST_FOREACH(votes, networkstatus_t *, v,
+        max_routers = MAX(max_routers, smartlist_len(v->routerstatus_list)));
+      n_router_threads = MIN(n_router_threads,
+                     1 + max_routers / MIN_ROUTERS_PER_CONSENSUS_THREAD);
+
+      memset(jobs, 0, sizeof(jobs));
+      for (flav = 0; flav < N_CONSENSUS_FLAVORS; ++flav) {
+        jobs[flav].flavor = flav;
+        jobs[flav].votes = smartlist_new();
+        smartlist_add_all(jobs[flav].votes, votes);
+        jobs[flav].n_voters = n_voters;
+        jobs[flav].identity_key = my_cert->identity_key;
+        jobs[flav].signing_key = get_my_v3_authority_signing_key();
+        jobs[flav].legacy_id_digest = legacy_id_digest;
+        jobs[flav].legacy_signing_key = legacy_sign;
+        jobs[flav].n_threads = n_router_threads;
+        job_ptrs[flav] = &jobs[flav];
       }
-      consensus = networkstatus_parse_vote_from_string(consensus_body, NULL,
-                                                       NS_TYPE_CONSENSUS);
-      if (!consensus) {
-        log_warn(LD_DIR, "Couldn't parse %s consensus we generated!",
-                 flavor_name);
-        tor_free(consensus_body);
-        continue;
+
+      if (n_cpus > 1) {
+        dirvote_run_in_parallel(compute_consensus_flavor, job_ptrs,
+                                N_CONSENSUS_FLAVORS);
+      } else {
+        for (flav = 0; flav < N_CONSENSUS_FLAVORS; ++flav)
+          compute_consensus_flavor(job_ptrs[flav]);
       }
 
-      /* 'Check' our own signature, to mark it valid. */
-      networkstatus_check_consensus_signature(consensus, -1);
+      for (flav = 0; flav < N_CONSENSUS_FLAVORS; ++flav) {
+        const char *flavor_name = networkstatus_get_flavor_name(flav);
+        consensus_body = jobs[flav].body;
+        consensus = jobs[flav].consensus;
+        smartlist_free(jobs[flav].votes);
+
+        if (!consensus_body) {
+          log_warn(LD_DIR, "Couldn't generate a %s consensus at all!",
+                   flavor_name);
+          continue;
+        }
+        if (!consensus) {
+          log_warn(LD_DIR, "Couldn't parse %s consensus we generated!",
+                   flavor_name);
+          tor_free(consensus_body);
+          continue;
+        }
+
+        /* 'Check' our own signature, to mark it valid. */
+        networkstatus_check_consensus_signature(consensus, -1);
 
-      pending[flav].body = consensus_body;
-      pending[flav].consensus = consensus;
-      n_generated++;
-      consensus_body = NULL;
-      consensus = NULL;
+        pending[flav].body = consensus_body;
+        pending[flav].consensus = consensus;
+        n_generated++;
+        consensus_body = NULL;
+        consensus = NULL;
+      }
     }
     if (!n_generated) {
       log_warn(LD_DIR, "Couldn't generate any consensus flavors at all.");
@@ -130,6 +130,14 @@ char *networkstatus_compute_consensus(smartlist_t *votes,
                                       const char *legacy_identity_key_digest,
                                       crypto_pk_t *legacy_signing_key,
                                       consensus_flavor_t flavor);
+char *networkstatus_compute_consensus_threaded(smartlist_t *votes,
+                                      int total_authorities,
+                                      crypto_pk_t *identity_key,
+                                      crypto_pk_t *signing_key,
+                                      const char *legacy_identity_key_digest,
+                                      crypto_pk_t *legacy_signing_key,
+                                      consensus_flavor_t flavor,
+                                      int n_threads);
 int networkstatus_add_detached_signatures(networkstatus_t *target,
                                           ns_detached_signatures_t *sigs,
                                           const char *source,
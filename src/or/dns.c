@@ -87,7 +87,7 @@ static time_t resolv_conf_mtime = 0;
 
 static void purge_expired_resolves(time_t now);
 static void dns_found_answer(const char *address, uint8_t query_type,
-                             int dns_answer,
+                             uint32_t prefetch_serial, int dns_answer,
                              const tor_addr_t *addr,
                              const char *hostname,
                              uint32_t ttl);
@@ -97,6 +97,9 @@ static int answer_is_wildcarded(const char *ip);
 static int evdns_err_is_transient(int err);
 static void inform_pending_connections(cached_resolve_t *resolve);
 static void make_pending_resolve_cached(cached_resolve_t *cached);
+static void cache_answer_from_resolve(const cached_resolve_t *resolve);
+static int cached_resolve_is_transient_failure(
+                                         const cached_resolve_t *resolve);
 
 #ifdef DEBUG_DNS_CACHE
 static void assert_cache_ok_(void);
@@ -116,6 +119,25 @@ static uint64_t n_ipv6_timeouts = 0;
 /** Global: Do we think that IPv6 DNS is broken? */
 static int dns_is_broken_for_ipv6 = 0;
 
+/** List of the cached answers in cache_root (those in state
+ * CACHE_STATE_CACHED), from least recently used to most recently used. */
+static TOR_TAILQ_HEAD(cached_resolve_lru_t, cached_resolve_t)
+  cached_resolve_lru = TOR_TAILQ_HEAD_INITIALIZER(cached_resolve_lru);
+/** Approximate number of bytes used by the answers in cached_resolve_lru. */
+static size_t dns_cache_total_bytes = 0;
+
+/** Counters about how well the cache is doing. */
+static dns_cache_stats_t dns_cache_stats;
+/** The prefetch_serial of the last refresh that we launched. */
+static uint32_t dns_last_prefetch_serial = 0;
+
+/** Upper bounds, in milliseconds, of the buckets of the lookup latency
+ * histogram. The last bucket holds everything slower. */
+static const uint32_t
+dns_latency_histogram_bounds_msec[DNS_LATENCY_HISTOGRAM_LEN - 1] = {
+  10, 25, 50, 100, 250, 500, 1000, 2500, 5000
+};
+
 /** Function to compare hashed resolves on their addresses; used to
  * implement hash tables. */
 static inline int
@@ -285,6 +307,7 @@ free_cached_resolve_(cached_resolve_t *r)
   }
   if (r->res_status_hostname == RES_STATUS_DONE_OK)
     tor_free(r->result_ptr.hostname);
+  free_cached_resolve_(r->prefetch);
   r->magic = 0xFF00FF00;
   tor_free(r);
 }
@@ -383,6 +406,104 @@ set_expiry(cached_resolve_t *resolve, time_t expires)
                        resolve);
 }
 
+/** Return the approximate number of bytes used by <b>resolve</b>. */
+static size_t
+cached_resolve_mem_usage(const cached_resolve_t *resolve)
+{
+  size_t n = sizeof(cached_resolve_t);
+  if (resolve->res_status_hostname == RES_STATUS_DONE_OK &&
+      resolve->result_ptr.hostname)
+    n += strlen(resolve->result_ptr.hostname) + 1;
+  return n;
+}
+
+/** Add the cached answer <b>resolve</b> as the most recently used one. */
+static void
+dns_lru_add(cached_resolve_t *resolve)
+{
+  tor_assert(!resolve->in_lru);
+  TOR_TAILQ_INSERT_TAIL(&cached_resolve_lru, resolve, lru_link);
+  resolve->in_lru = 1;
+  dns_cache_total_bytes += cached_resolve_mem_usage(resolve);
+}
+
+/** Remove <b>resolve</b> from the LRU list, if it is there. */
+static void
+dns_lru_remove(cached_resolve_t *resolve)
+{
+  if (!resolve->in_lru)
+    return;
+  TOR_TAILQ_REMOVE(&cached_resolve_lru, resolve, lru_link);
+  resolve->in_lru = 0;
+  dns_cache_total_bytes -= cached_resolve_mem_usage(resolve);
+}
+
+/** Note that the cached answer <b>resolve</b> has just been used. */
+static void
+dns_lru_touch(cached_resolve_t *resolve)
+{
+  if (!resolve->in_lru)
+    return;
+  TOR_TAILQ_REMOVE(&cached_resolve_lru, resolve, lru_link);
+  TOR_TAILQ_INSERT_TAIL(&cached_resolve_lru, resolve, lru_link);
+}
+
+/** Remove the cached answer <b>resolve</b> from the cache, the LRU list and
+ * the expiry queue, and free it. */
+static void
+remove_cached_resolve(cached_resolve_t *resolve)
+{
+  cached_resolve_t *removed;
+
+  tor_assert(resolve->state == CACHE_STATE_CACHED);
+  removed = HT_REMOVE(cache_map, &cache_root, resolve);
+  tor_assert(removed == resolve);
+  dns_lru_remove(resolve);
+  if (cached_resolve_pqueue && resolve->minheap_idx >= 0)
+    smartlist_pqueue_remove(cached_resolve_pqueue,
+                            compare_cached_resolves_by_expiry_,
+                            offsetof(cached_resolve_t, minheap_idx),
+                            resolve);
+  /* If we were refreshing it, this frees the refresh too: answers to it will
+   * match no refresh, and be ignored. */
+  free_cached_resolve_(resolve);
+}
+
+/** Drop the least recently used cached answers until the cache fits in
+ * ServerDNSCacheMaxMemory. */
+static void
+dns_cache_enforce_max_memory(void)
+{
+  const uint64_t max_bytes = get_options()->ServerDNSCacheMaxMemory;
+
+  while (dns_cache_total_bytes > max_bytes &&
+         !TOR_TAILQ_EMPTY(&cached_resolve_lru)) {
+    cached_resolve_t *victim = TOR_TAILQ_FIRST(&cached_resolve_lru);
+    log_debug(LD_EXIT, "Evicting cached resolve for %s to save memory.",
+              escaped_safe_str(victim->address));
+    remove_cached_resolve(victim);
+    ++dns_cache_stats.n_evictions;
+  }
+}
+
+/** Record in the latency histogram how long the lookups of <b>resolve</b>
+ * took, now that they are all done. */
+static void
+dns_note_lookup_latency(const cached_resolve_t *resolve)
+{
+  monotime_coarse_t now;
+  int64_t msec;
+  int i;
+
+  monotime_coarse_get(&now);
+  msec = monotime_coarse_diff_msec(&resolve->launched, &now);
+  for (i = 0; i < DNS_LATENCY_HISTOGRAM_LEN - 1; ++i) {
+    if (msec < dns_latency_histogram_bounds_msec[i])
+      break;
+  }
+  ++dns_cache_stats.latency_msec_histogram[i];
+}
+
 /** Free all storage held in the DNS cache and related structures. */
 void
 dns_free_all(void)
@@ -404,6 +525,8 @@ dns_free_all(void)
   HT_CLEAR(cache_map, &cache_root);
   smartlist_free(cached_resolve_pqueue);
   cached_resolve_pqueue = NULL;
+  TOR_TAILQ_INIT(&cached_resolve_lru);
+  dns_cache_total_bytes = 0;
   tor_free(resolv_conf_fname);
 }
 
@@ -474,6 +597,7 @@ purge_expired_resolves(time_t now)
                 removed ? removed->address : "NULL", (void*)removed);
       }
       tor_assert(removed == resolve);
+      dns_lru_remove(resolve);
     } else {
       /* This should be in state DONE. Make sure it's not in the cache. */
       cached_resolve_t *tmp = HT_FIND(cache_map, &cache_root, resolve);
@@ -481,6 +605,7 @@ purge_expired_resolves(time_t now)
     }
     if (resolve->res_status_hostname == RES_STATUS_DONE_OK)
       tor_free(resolve->result_ptr.hostname);
+    free_cached_resolve_(resolve->prefetch);
     resolve->magic = 0xF0BBF0BB;
     tor_free(resolve);
   }
@@ -792,6 +917,7 @@ dns_resolve_impl,(edge_connection_t *exitconn, int is_resolve,
         pending_connection->next = resolve->pending_connections;
         resolve->pending_connections = pending_connection;
         *made_connection_pending_out = 1;
+        ++dns_cache_stats.n_pending_hits;
         log_debug(LD_EXIT,"Connection (fd "TOR_SOCKET_T_FORMAT") waiting "
                   "for pending DNS resolve of %s", exitconn->base_.s,
                   escaped_safe_str(exitconn->base_.address));
@@ -802,6 +928,15 @@ dns_resolve_impl,(edge_connection_t *exitconn, int is_resolve,
                   exitconn->base_.s,
                   escaped_safe_str(resolve->address));
 
+        if (resolve->is_negative)
+          ++dns_cache_stats.n_negative_hits;
+        else
+          ++dns_cache_stats.n_hits;
+        ++resolve->n_hits;
+        dns_lru_touch(resolve);
+        if (dns_resolve_should_prefetch(resolve, now))
+          dns_launch_prefetch(resolve);
+
         *resolve_out = resolve;
 
         return set_exitconn_info_from_resolve(exitconn, resolve, hostname_out);
@@ -828,6 +963,8 @@ dns_resolve_impl,(edge_connection_t *exitconn, int is_resolve,
   /* Add this resolve to the cache and priority queue. */
   HT_INSERT(cache_map, &cache_root, resolve);
   set_expiry(resolve, now + RESOLVE_MAX_TIMEOUT);
+  monotime_coarse_get(&resolve->launched);
+  ++dns_cache_stats.n_misses;
 
   log_debug(LD_EXIT,"Launching %s.",
             escaped_safe_str(exitconn->base_.address));
@@ -1131,6 +1268,88 @@ is_test_address(const char *address)
     smartlist_contains_string_case(options->ServerDNSTestAddresses, address);
 }
 
+/** Return true iff we should launch a lookup to refresh the cached answer
+ * <b>resolve</b> now, to have a fresh one before it expires: it must have
+ * served at least ServerDNSPrefetchMinHits streams, and expire within
+ * DNS_PREFETCH_WINDOW seconds. */
+STATIC int
+dns_resolve_should_prefetch(const cached_resolve_t *resolve, time_t now)
+{
+  const unsigned min_hits = get_options()->ServerDNSPrefetchMinHits;
+
+  return min_hits > 0 &&
+    resolve->state == CACHE_STATE_CACHED &&
+    !resolve->is_negative &&
+    !resolve->prefetch_tried &&
+    resolve->n_hits >= min_hits &&
+    resolve->expire > now &&
+    resolve->expire - now <= DNS_PREFETCH_WINDOW;
+}
+
+/** Launch a lookup to refresh the cached answer <b>resolve</b>, which keeps
+ * being served until the fresh answer replaces it in
+ * dns_found_prefetch_answer(). We only try this once per cached answer. */
+STATIC void
+dns_launch_prefetch(cached_resolve_t *resolve)
+{
+  cached_resolve_t *prefetch;
+
+  tor_assert(resolve->state == CACHE_STATE_CACHED);
+  tor_assert(!resolve->prefetch);
+  resolve->prefetch_tried = 1;
+
+  /* The refresh belongs to the answer it refreshes: it is in neither the
+   * hash table nor the expiry queue, and goes away with that answer. */
+  prefetch = tor_malloc_zero(sizeof(cached_resolve_t));
+  prefetch->magic = CACHED_RESOLVE_MAGIC;
+  prefetch->state = CACHE_STATE_DONE;
+  prefetch->minheap_idx = -1;
+  strlcpy(prefetch->address, resolve->address, sizeof(prefetch->address));
+  if (++dns_last_prefetch_serial == 0)
+    ++dns_last_prefetch_serial;
+  prefetch->prefetch_serial = dns_last_prefetch_serial;
+  monotime_coarse_get(&prefetch->launched);
+
+  log_debug(LD_EXIT, "Refreshing popular cached resolve for %s.",
+            escaped_safe_str(resolve->address));
+  if (launch_resolve(prefetch) < 0) {
+    /* Answers to any request that did go out match no refresh now. */
+    free_cached_resolve_(prefetch);
+    return;
+  }
+  resolve->prefetch = prefetch;
+  ++dns_cache_stats.n_prefetches_launched;
+}
+
+/** Called when the eventdns library tells us the outcome of a single DNS
+ * resolve that we launched to refresh the cached answer <b>resolve</b>. Once
+ * we have all the answers, replace <b>resolve</b> with them, unless they are
+ * transient failures. Arguments are as for dns_found_answer(). */
+static void
+dns_found_prefetch_answer(cached_resolve_t *resolve, uint8_t query_type,
+                          int dns_answer, const tor_addr_t *addr,
+                          const char *hostname, uint32_t ttl)
+{
+  cached_resolve_t *prefetch = resolve->prefetch;
+
+  cached_resolve_add_answer(prefetch, query_type, dns_answer,
+                            addr, hostname, ttl);
+  if (!cached_resolve_have_all_answers(prefetch))
+    return;
+
+  resolve->prefetch = NULL;
+  dns_note_lookup_latency(prefetch);
+  if (cached_resolve_is_transient_failure(prefetch)) {
+    /* Keep serving the answer we have until it expires. */
+    ++dns_cache_stats.n_transient_failures;
+  } else {
+    remove_cached_resolve(resolve);
+    cache_answer_from_resolve(prefetch);
+    ++dns_cache_stats.n_prefetches_completed;
+  }
+  free_cached_resolve_(prefetch);
+}
+
 /** Called on the OR side when the eventdns library tells us the outcome of a
  * single DNS resolve: remember the answer, and tell all pending connections
  * about the result of the lookup if the lookup is now done.  (<b>address</b>
@@ -1138,11 +1357,13 @@ is_test_address(const char *address)
  * <b>query_type</b> is one of DNS_{IPv4_A,IPv6_AAAA,PTR}; <b>dns_answer</b>
  * is DNS_OK or one of DNS_ERR_*, <b>addr</b> is an IPv4 or IPv6 address if we
  * got one; <b>hostname</b> is a hostname fora PTR request if we got one, and
- * <b>ttl</b> is the time-to-live of this answer, in seconds.)
+ * <b>ttl</b> is the time-to-live of this answer, in seconds.  If the lookup
+ * was launched to refresh a cached answer, <b>prefetch_serial</b> is the
+ * prefetch_serial of that refresh; otherwise it is 0.)
  */
 static void
 dns_found_answer(const char *address, uint8_t query_type,
-                 int dns_answer,
+                 uint32_t prefetch_serial, int dns_answer,
                  const tor_addr_t *addr,
                  const char *hostname, uint32_t ttl)
 {
@@ -1154,6 +1375,17 @@ dns_found_answer(const char *address, uint8_t query_type,
   strlcpy(search.address, address, sizeof(search.address));
 
   resolve = HT_FIND(cache_map, &cache_root, &search);
+  if (prefetch_serial) {
+    if (resolve && resolve->prefetch &&
+        resolve->prefetch->prefetch_serial == prefetch_serial) {
+      dns_found_prefetch_answer(resolve, query_type, dns_answer,
+                                addr, hostname, ttl);
+    } else {
+      log_debug(LD_EXIT, "Got an answer for an abandoned refresh of %s; "
+                "ignoring.", escaped_safe_str(address));
+    }
+    return;
+  }
   if (!resolve) {
     int is_test_addr = is_test_address(address);
     if (!is_test_addr)
@@ -1292,43 +1524,98 @@ make_pending_resolve_cached(cached_resolve_t *resolve)
   }
   assert_resolve_ok(resolve);
   assert_cache_ok();
+  dns_note_lookup_latency(resolve);
   /* The resolve will eventually just hit the time-out in the expiry queue and
   * expire. See fd0bafb0dedc7e2 for a brief explanation of how this got that
   * way.  XXXXX we could do better!*/
 
-  {
-    cached_resolve_t *new_resolve = tor_memdup(resolve,
-                                               sizeof(cached_resolve_t));
-    uint32_t ttl = UINT32_MAX;
-    new_resolve->expire = 0; /* So that set_expiry won't croak. */
-    if (resolve->res_status_hostname == RES_STATUS_DONE_OK)
-      new_resolve->result_ptr.hostname =
-        tor_strdup(resolve->result_ptr.hostname);
-
-    new_resolve->state = CACHE_STATE_CACHED;
+  if (cached_resolve_is_transient_failure(resolve)) {
+    /* Don't remember timeouts and server failures: the next stream that
+     * wants this address should try again. */
+    log_debug(LD_EXIT, "Not caching transient failure to resolve %s.",
+              escaped_safe_str(resolve->address));
+    ++dns_cache_stats.n_transient_failures;
+  } else {
+    cache_answer_from_resolve(resolve);
+  }
 
-    assert_resolve_ok(new_resolve);
-    HT_INSERT(cache_map, &cache_root, new_resolve);
+  assert_cache_ok();
+}
 
-    if ((resolve->res_status_ipv4 == RES_STATUS_DONE_OK ||
-         resolve->res_status_ipv4 == RES_STATUS_DONE_ERR) &&
-        resolve->ttl_ipv4 < ttl)
-      ttl = resolve->ttl_ipv4;
+/** Return true iff all the lookups of <b>resolve</b> failed, and at least one
+ * of them failed transiently. */
+static int
+cached_resolve_is_transient_failure(const cached_resolve_t *resolve)
+{
+  int transient = 0;
 
-    if ((resolve->res_status_ipv6 == RES_STATUS_DONE_OK ||
-         resolve->res_status_ipv6 == RES_STATUS_DONE_ERR) &&
-        resolve->ttl_ipv6 < ttl)
-      ttl = resolve->ttl_ipv6;
+  if (resolve->res_status_ipv4 == RES_STATUS_DONE_OK ||
+      resolve->res_status_ipv6 == RES_STATUS_DONE_OK ||
+      resolve->res_status_hostname == RES_STATUS_DONE_OK)
+    return 0;
 
-    if ((resolve->res_status_hostname == RES_STATUS_DONE_OK ||
-         resolve->res_status_hostname == RES_STATUS_DONE_ERR) &&
-        resolve->ttl_hostname < ttl)
-      ttl = resolve->ttl_hostname;
+  if (resolve->res_status_ipv4 == RES_STATUS_DONE_ERR)
+    transient |= evdns_err_is_transient(resolve->result_ipv4.err_ipv4);
+  if (resolve->res_status_ipv6 == RES_STATUS_DONE_ERR)
+    transient |= evdns_err_is_transient(resolve->result_ipv6.err_ipv6);
+  if (resolve->res_status_hostname == RES_STATUS_DONE_ERR)
+    transient |= evdns_err_is_transient(resolve->result_ptr.err_hostname);
+  return transient;
+}
 
-    set_expiry(new_resolve, time(NULL) + dns_clip_ttl(ttl));
-  }
+/** Add to the cache a copy of the finished lookup <b>resolve</b>, which must
+ * not be in the cache itself. Answers made only of errors are cached for
+ * NEGATIVE_DNS_TTL. Afterwards, evict old answers if the cache has grown too
+ * large. */
+static void
+cache_answer_from_resolve(const cached_resolve_t *resolve)
+{
+  cached_resolve_t *new_resolve = tor_memdup(resolve,
+                                             sizeof(cached_resolve_t));
+  uint32_t ttl = UINT32_MAX;
+  time_t now = time(NULL);
+  new_resolve->expire = 0; /* So that set_expiry won't croak. */
+  new_resolve->minheap_idx = -1;
+  if (resolve->res_status_hostname == RES_STATUS_DONE_OK)
+    new_resolve->result_ptr.hostname =
+      tor_strdup(resolve->result_ptr.hostname);
+
+  new_resolve->state = CACHE_STATE_CACHED;
+  new_resolve->n_hits = 0;
+  new_resolve->in_lru = 0;
+  new_resolve->prefetch = NULL;
+  new_resolve->prefetch_serial = 0;
+  new_resolve->prefetch_tried = 0;
+  new_resolve->is_negative =
+    resolve->res_status_ipv4 != RES_STATUS_DONE_OK &&
+    resolve->res_status_ipv6 != RES_STATUS_DONE_OK &&
+    resolve->res_status_hostname != RES_STATUS_DONE_OK;
+
+  assert_resolve_ok(new_resolve);
+  HT_INSERT(cache_map, &cache_root, new_resolve);
+  dns_lru_add(new_resolve);
+
+  if ((resolve->res_status_ipv4 == RES_STATUS_DONE_OK ||
+       resolve->res_status_ipv4 == RES_STATUS_DONE_ERR) &&
+      resolve->ttl_ipv4 < ttl)
+    ttl = resolve->ttl_ipv4;
+
+  if ((resolve->res_status_ipv6 == RES_STATUS_DONE_OK ||
+       resolve->res_status_ipv6 == RES_STATUS_DONE_ERR) &&
+      resolve->ttl_ipv6 < ttl)
+    ttl = resolve->ttl_ipv6;
+
+  if ((resolve->res_status_hostname == RES_STATUS_DONE_OK ||
+       resolve->res_status_hostname == RES_STATUS_DONE_ERR) &&
+      resolve->ttl_hostname < ttl)
+    ttl = resolve->ttl_hostname;
+
+  if (new_resolve->is_negative)
+    set_expiry(new_resolve, now + NEGATIVE_DNS_TTL);
+  else
+    set_expiry(new_resolve, now + dns_clip_ttl(ttl));
 
-  assert_cache_ok();
+  dns_cache_enforce_max_memory();
 }
 
 /** Eventdns helper: return true iff the eventdns result <b>err</b> is
@@ -1494,7 +1781,9 @@ configure_nameservers(int force)
 }
 
 /** For eventdns: Called when we get an answer for a request we launched.
- * See eventdns.h for arguments; 'arg' holds the address we tried to resolve.
+ * See eventdns.h for arguments; 'arg' holds the query type, the
+ * prefetch_serial and the address we tried to resolve, as laid out by
+ * launch_one_resolve().
  */
 static void
 evdns_callback(int result, char type, int count, int ttl, void *addresses,
@@ -1502,7 +1791,8 @@ evdns_callback(int result, char type, int count, int ttl, void *addresses,
 {
   char *arg_ = arg;
   uint8_t orig_query_type = arg_[0];
-  char *string_address = arg_ + 1;
+  uint32_t prefetch_serial = get_uint32(arg_ + 1);
+  char *string_address = arg_ + 5;
   tor_addr_t addr;
   const char *hostname = NULL;
   int was_wildcarded = 0;
@@ -1602,7 +1892,7 @@ evdns_callback(int result, char type, int count, int ttl, void *addresses,
              (int)orig_query_type, (int)type);
   }
   if (result != DNS_ERR_SHUTDOWN)
-    dns_found_answer(string_address, orig_query_type,
+    dns_found_answer(string_address, orig_query_type, prefetch_serial,
                      result, &addr, hostname, ttl);
 
   tor_free(arg_);
@@ -1610,18 +1900,20 @@ evdns_callback(int result, char type, int count, int ttl, void *addresses,
 
 /** Start a single DNS resolve for <b>address</b> (if <b>query_type</b> is
  * DNS_IPv4_A or DNS_IPv6_AAAA) <b>ptr_address</b> (if <b>query_type</b> is
- * DNS_PTR). Return 0 if we launched the request, -1 otherwise. */
+ * DNS_PTR), on behalf of the refresh with <b>prefetch_serial</b> if that is
+ * nonzero. Return 0 if we launched the request, -1 otherwise. */
 static int
 launch_one_resolve(const char *address, uint8_t query_type,
-                   const tor_addr_t *ptr_address)
+                   const tor_addr_t *ptr_address, uint32_t prefetch_serial)
 {
   const int options = get_options()->ServerDNSSearchDomains ? 0
     : DNS_QUERY_NO_SEARCH;
   const size_t addr_len = strlen(address);
   struct evdns_request *req = 0;
-  char *addr = tor_malloc(addr_len + 2);
+  char *addr = tor_malloc(addr_len + 6);
   addr[0] = (char) query_type;
-  memcpy(addr+1, address, addr_len + 1);
+  set_uint32(addr+1, prefetch_serial);
+  memcpy(addr+5, address, addr_len + 1);
 
   switch (query_type) {
   case DNS_IPv4_A:
@@ -1692,14 +1984,16 @@ launch_resolve,(cached_resolve_t *resolve))
     if (get_options()->IPv6Exit)
       resolve->res_status_ipv6 = RES_STATUS_INFLIGHT;
 
-    if (launch_one_resolve(resolve->address, DNS_IPv4_A, NULL) < 0) {
+    if (launch_one_resolve(resolve->address, DNS_IPv4_A, NULL,
+                           resolve->prefetch_serial) < 0) {
       resolve->res_status_ipv4 = 0;
       r = -1;
     }
 
     if (r==0 && get_options()->IPv6Exit) {
       /* We ask for an IPv6 address for *everything*. */
-      if (launch_one_resolve(resolve->address, DNS_IPv6_AAAA, NULL) < 0) {
+      if (launch_one_resolve(resolve->address, DNS_IPv6_AAAA, NULL,
+                             resolve->prefetch_serial) < 0) {
         resolve->res_status_ipv6 = 0;
         r = -1;
       }
@@ -1709,7 +2003,8 @@ launch_resolve,(cached_resolve_t *resolve))
     log_info(LD_EXIT, "Launching eventdns reverse request for %s",
              escaped_safe_str(resolve->address));
     resolve->res_status_hostname = RES_STATUS_INFLIGHT;
-    if (launch_one_resolve(resolve->address, DNS_PTR, &a) < 0) {
+    if (launch_one_resolve(resolve->address, DNS_PTR, &a,
+                           resolve->prefetch_serial) < 0) {
       resolve->res_status_hostname = 0;
       r = -1;
     }
@@ -1917,12 +2212,12 @@ launch_test_addresses(evutil_socket_t fd, short event, void *args)
     tor_assert(the_evdns_base);
     SMARTLIST_FOREACH_BEGIN(options->ServerDNSTestAddresses,
                             const char *, address) {
-      if (launch_one_resolve(address, DNS_IPv4_A, NULL) < 0) {
+      if (launch_one_resolve(address, DNS_IPv4_A, NULL, 0) < 0) {
         log_info(LD_EXIT, "eventdns rejected test address %s",
                  escaped_safe_str(address));
       }
 
-      if (launch_one_resolve(address, DNS_IPv6_AAAA, NULL) < 0) {
+      if (launch_one_resolve(address, DNS_IPv6_AAAA, NULL, 0) < 0) {
         log_info(LD_EXIT, "eventdns rejected test address %s",
                  escaped_safe_str(address));
       }
@@ -2081,6 +2376,68 @@ dump_dns_mem_usage(int severity)
   tor_log(severity, LD_MM, "Our DNS cache has %d entries.", hash_count);
   tor_log(severity, LD_MM, "Our DNS cache size is approximately %u bytes.",
       (unsigned)hash_mem);
+  tor_log(severity, LD_MM, "Cached DNS answers use approximately %u bytes.",
+      (unsigned)dns_cache_total_bytes);
+}
+
+#ifdef TOR_UNIT_TESTS
+/** Return the counters about how well the DNS cache is doing. */
+STATIC const dns_cache_stats_t *
+dns_get_cache_stats(void)
+{
+  return &dns_cache_stats;
+}
+
+/** Return the approximate number of bytes used by cached DNS answers. */
+STATIC size_t
+dns_cache_get_total_bytes(void)
+{
+  return dns_cache_total_bytes;
+}
+#endif /* defined(TOR_UNIT_TESTS) */
+
+/** Implementation for GETINFO control command: knows the answer for questions
+ * about "dns/cache/..." */
+int
+getinfo_helper_dns(control_connection_t *control_conn,
+                   const char *question, char **answer,
+                   const char **errmsg)
+{
+  const dns_cache_stats_t *st = &dns_cache_stats;
+  (void) control_conn;
+  (void) errmsg;
+
+  if (!strcmp(question, "dns/cache/stats")) {
+    tor_asprintf(answer,
+                 "entries=%d bytes=%"PRIu64" max-bytes=%"PRIu64"\n"
+                 "hits=%"PRIu64" negative-hits=%"PRIu64
+                 " pending-hits=%"PRIu64" misses=%"PRIu64"\n"
+                 "prefetches=%"PRIu64" prefetches-completed=%"PRIu64
+                 " transient-failures=%"PRIu64" evictions=%"PRIu64,
+                 dns_cache_entry_count(),
+                 (uint64_t) dns_cache_total_bytes,
+                 get_options()->ServerDNSCacheMaxMemory,
+                 st->n_hits, st->n_negative_hits,
+                 st->n_pending_hits, st->n_misses,
+                 st->n_prefetches_launched, st->n_prefetches_completed,
+                 st->n_transient_failures, st->n_evictions);
+  } else if (!strcmp(question, "dns/cache/latency")) {
+    smartlist_t *items = smartlist_new();
+    int i;
+    for (i = 0; i < DNS_LATENCY_HISTOGRAM_LEN; ++i) {
+      if (i < DNS_LATENCY_HISTOGRAM_LEN - 1)
+        smartlist_add_asprintf(items, "%"PRIu32"=%"PRIu64,
+                               dns_latency_histogram_bounds_msec[i],
+                               st->latency_msec_histogram[i]);
+      else
+        smartlist_add_asprintf(items, "inf=%"PRIu64,
+                               st->latency_msec_histogram[i]);
+    }
+    *answer = smartlist_join_strings(items, " ", 0, NULL);
+    SMARTLIST_FOREACH(items, char *, cp, tor_free(cp));
+    smartlist_free(items);
+  }
+  return 0;
 }
 
 #ifdef DEBUG_DNS_CACHE
@@ -23,6 +23,12 @@
 /** How long do we cache/tell clients to cache DNS records when no TTL is
  * known? */
 #define DEFAULT_DNS_TTL (30*60)
+/** How long do we cache lookups that failed permanently, for example with
+ * NXDOMAIN? */
+#define NEGATIVE_DNS_TTL MIN_DNS_TTL_AT_EXIT
+/** How long before a popular cached answer expires do we launch a lookup to
+ * refresh it? */
+#define DNS_PREFETCH_WINDOW 60
 
 int dns_init(void);
 int has_dns_init_failed(void);
@@ -39,6 +45,9 @@ int dns_seems_to_be_broken(void);
 int dns_seems_to_be_broken_for_ipv6(void);
 void dns_reset_correctness_checks(void);
 void dump_dns_mem_usage(int severity);
+int getinfo_helper_dns(control_connection_t *control_conn,
+                       const char *question, char **answer,
+                       const char **errmsg);
 
 #ifdef DNS_PRIVATE
 #include "dns_structs.h"
@@ -64,6 +73,14 @@ set_exitconn_info_from_resolve,(edge_connection_t *exitconn,
 MOCK_DECL(STATIC int,
 launch_resolve,(cached_resolve_t *resolve));
 
+#ifdef TOR_UNIT_TESTS
+STATIC const dns_cache_stats_t *dns_get_cache_stats(void);
+STATIC size_t dns_cache_get_total_bytes(void);
+#endif /* defined(TOR_UNIT_TESTS) */
+STATIC int dns_resolve_should_prefetch(const cached_resolve_t *resolve,
+                                       time_t now);
+STATIC void dns_launch_prefetch(cached_resolve_t *resolve);
+
 #endif /* defined(DNS_PRIVATE) */
 
 #endif /* !defined(TOR_DNS_H) */
@@ -96,7 +96,55 @@ typedef struct cached_resolve_t {
   pending_connection_t *pending_connections;
   /** Position of this element in the heap*/
   int minheap_idx;
+
+  /** When did we launch the lookups for this resolve? Used for the latency
+   * histogram. */
+  monotime_coarse_t launched;
+  /** How many streams has this cached answer served? */
+  uint32_t n_hits;
+  /** True iff this is a cached answer that holds errors only. */
+  unsigned int is_negative : 1;
+  /** True iff this is a cached answer linked in the LRU list. */
+  unsigned int in_lru : 1;
+  /** If this is a cached answer that we are refreshing ahead of its expiry,
+   * the DONE resolve collecting the fresh answer. That one is in neither the
+   * hash table nor the expiry queue: it is freed along with this entry. */
+  struct cached_resolve_t *prefetch;
+  /** If this resolve is collecting a refresh, a number that no other refresh
+   * has had. The eventdns requests that it launches carry it, so that their
+   * answers only ever go to this refresh. 0 otherwise. */
+  uint32_t prefetch_serial;
+  /** True iff we have tried to refresh this cached answer already. */
+  unsigned int prefetch_tried : 1;
+  /** Link in the LRU list of cached answers. */
+  TOR_TAILQ_ENTRY(cached_resolve_t) lru_link;
 } cached_resolve_t;
 
+/** Number of buckets in the DNS lookup latency histogram. */
+#define DNS_LATENCY_HISTOGRAM_LEN 10
+
+/** Counters about the exit DNS cache, exposed with GETINFO dns/cache/... */
+typedef struct dns_cache_stats_t {
+  /** Streams answered from a cached successful answer. */
+  uint64_t n_hits;
+  /** Streams answered from a cached failure. */
+  uint64_t n_negative_hits;
+  /** Streams that joined a lookup already in flight. */
+  uint64_t n_pending_hits;
+  /** Streams for which we had to launch a lookup. */
+  uint64_t n_misses;
+  /** Refreshes of popular answers that we launched before they expired. */
+  uint64_t n_prefetches_launched;
+  /** Refreshes that replaced the answer they were launched for. */
+  uint64_t n_prefetches_completed;
+  /** Lookups that failed transiently, and that we didn't cache. */
+  uint64_t n_transient_failures;
+  /** Cached answers dropped to stay within ServerDNSCacheMaxMemory. */
+  uint64_t n_evictions;
+  /** How many lookups completed in each bucket of
+   * dns_latency_histogram_bounds_msec, plus one for slower lookups. */
+  uint64_t latency_msec_histogram[DNS_LATENCY_HISTOGRAM_LEN];
+} dns_cache_stats_t;
+
 #endif /* !defined(TOR_DNS_STRUCTS_H) */
 
@@ -58,6 +58,77 @@ static dos_conn_defense_type_t dos_conn_defense_type;
 /* Keep some stats for the heartbeat so we can report out. */
 static uint64_t conn_num_addr_rejected;
 
+/*
+ * Prefix aggregation.
+ *
+ * Namespace used for this part of the framework is "dos_pfx_".
+ *
+ * The per-address statistics above live in the geoip client cache, one entry
+ * per exact address. A client that rotates through the addresses of an IPv6
+ * /64 (or a large IPv4 block) gets a fresh entry, and thus a fresh circuit
+ * bucket and connection count, for every address. When prefix aggregation is
+ * enabled, we also account circuits and connections per address prefix
+ * (DoSPrefixIPv4Bits and DoSPrefixIPv6Bits long).
+ *
+ * Since the number of prefixes an attacker can use is still unbounded, we
+ * don't keep an entry per prefix. Instead, we use count-min sketches: a fixed
+ * grid of DOS_PFX_SKETCH_DEPTH rows by DOS_PFX_SKETCH_WIDTH columns, where
+ * every prefix maps to one cell per row. For circuits, each cell is a token
+ * bucket; collisions only ever drain a cell faster, so a prefix has exhausted
+ * its circuits only once all of its cells are empty. For connections, each
+ * cell is a counter and the estimate for a prefix is the smallest of its
+ * cells.
+ *
+ * Prefixes that are detected are remembered in a small, fixed-size table of
+ * heavy hitters, which is what the per-cell defense check looks at. Memory
+ * use is therefore constant no matter how many addresses we see, and all
+ * operations are O(DOS_PFX_SKETCH_DEPTH).
+ */
+
+/* Is prefix aggregation enabled? */
+static unsigned int dos_pfx_enabled = 0;
+
+/* Consensus parameters. They can be changed when a new consensus arrives.
+ * They are initialized with the hardcoded default values. */
+static uint32_t dos_pfx_ipv4_bits;
+static uint32_t dos_pfx_ipv6_bits;
+static uint32_t dos_pfx_circuit_rate;
+static uint32_t dos_pfx_circuit_burst;
+static uint32_t dos_pfx_max_concurrent_count;
+
+/* Keep some stats for the heartbeat so we can report out. */
+static uint64_t pfx_num_rejected_cells;
+static uint64_t pfx_num_conn_rejected;
+static uint32_t pfx_num_marked_prefixes;
+
+/* One cell of the circuit sketch: a token bucket shared by every prefix that
+ * hashes to it. */
+typedef struct pfx_circ_cell_t {
+  uint32_t circuit_bucket;
+  /* When was the last time we've refilled this bucket? 0 if never. */
+  time_t last_circ_bucket_refill_ts;
+} pfx_circ_cell_t;
+
+/* A prefix that we've detected as going above the circuit creation rate. */
+typedef struct pfx_heavy_hitter_t {
+  /* The prefix, as computed by pfx_key_from_addr(). All zeroes if this slot
+   * is unused, which can't be a valid key since the first byte is the
+   * address family. */
+  uint8_t key[DOS_PFX_KEY_LEN];
+  /* Until when should the defense be applied to this prefix. */
+  time_t marked_until_ts;
+} pfx_heavy_hitter_t;
+
+/* The sketches and the heavy hitter table. NULL when prefix aggregation is
+ * disabled. */
+static pfx_circ_cell_t *pfx_circ_sketch = NULL;
+static uint32_t *pfx_conn_sketch = NULL;
+static pfx_heavy_hitter_t *pfx_heavy_hitters = NULL;
+/* Incremented every time we allocate new sketches, so that connections
+ * counted in older ones aren't taken out of the new ones. */
+static uint32_t pfx_sketch_generation = 0;
+
+
 /*
  * General interface of the denial of service mitigation subsystem.
  */
@@ -181,6 +252,356 @@ get_param_conn_defense_type(const networkstatus_t *ns)
                                  DOS_CONN_DEFENSE_NONE, DOS_CONN_DEFENSE_MAX);
 }
 
+/* Return true iff prefix aggregation is enabled. We look at the consensus for
+ * this else a default value is returned. */
+MOCK_IMPL(STATIC unsigned int,
+get_param_pfx_enabled, (const networkstatus_t *ns))
+{
+  if (get_options()->DoSPrefixAggregationEnabled != -1) {
+    return get_options()->DoSPrefixAggregationEnabled;
+  }
+  return !!networkstatus_get_param(ns, "DoSPrefixAggregationEnabled",
+                                   DOS_PFX_ENABLED_DEFAULT, 0, 1);
+}
+
+/* Return the length of the prefixes we aggregate IPv4 addresses to. */
+static uint32_t
+get_param_pfx_ipv4_bits(const networkstatus_t *ns)
+{
+  if (get_options()->DoSPrefixIPv4Bits) {
+    return MIN(get_options()->DoSPrefixIPv4Bits, 32);
+  }
+  return networkstatus_get_param(ns, "DoSPrefixIPv4Bits",
+                                 DOS_PFX_IPV4_BITS_DEFAULT, 1, 32);
+}
+
+/* Return the length of the prefixes we aggregate IPv6 addresses to. */
+static uint32_t
+get_param_pfx_ipv6_bits(const networkstatus_t *ns)
+{
+  if (get_options()->DoSPrefixIPv6Bits) {
+    return MIN(get_options()->DoSPrefixIPv6Bits, 128);
+  }
+  return networkstatus_get_param(ns, "DoSPrefixIPv6Bits",
+                                 DOS_PFX_IPV6_BITS_DEFAULT, 1, 128);
+}
+
+/* Return the parameter for how many circuits per second a whole prefix is
+ * allowed to create. */
+static uint32_t
+get_param_pfx_circuit_rate(const networkstatus_t *ns)
+{
+  if (get_options()->DoSPrefixCircuitRate) {
+    return get_options()->DoSPrefixCircuitRate;
+  }
+  return networkstatus_get_param(ns, "DoSPrefixCircuitRate",
+                                 DOS_PFX_CIRCUIT_RATE_DEFAULT,
+                                 1, INT32_MAX);
+}
+
+/* Return the parameter for the maximum circuit burst of a whole prefix. */
+STATIC uint32_t
+get_param_pfx_circuit_burst(const networkstatus_t *ns)
+{
+  if (get_options()->DoSPrefixCircuitBurst) {
+    return get_options()->DoSPrefixCircuitBurst;
+  }
+  return networkstatus_get_param(ns, "DoSPrefixCircuitBurst",
+                                 DOS_PFX_CIRCUIT_BURST_DEFAULT,
+                                 1, INT32_MAX);
+}
+
+/* Return the parameter for the maximum concurrent connections allowed from a
+ * whole prefix. */
+STATIC uint32_t
+get_param_pfx_max_concurrent_count(const networkstatus_t *ns)
+{
+  if (get_options()->DoSPrefixMaxConcurrentCount) {
+    return get_options()->DoSPrefixMaxConcurrentCount;
+  }
+  return networkstatus_get_param(ns, "DoSPrefixMaxConcurrentCount",
+                                 DOS_PFX_MAX_CONCURRENT_COUNT_DEFAULT,
+                                 1, INT32_MAX);
+}
+
+/* Free everything for prefix aggregation. */
+static void
+pfx_free_all(void)
+{
+  tor_free(pfx_circ_sketch);
+  tor_free(pfx_conn_sketch);
+  tor_free(pfx_heavy_hitters);
+  dos_pfx_enabled = 0;
+}
+
+/* Allocate the sketches and the heavy hitter table if we don't have them
+ * yet. Their size never changes after this. */
+static void
+pfx_init(void)
+{
+  if (pfx_circ_sketch) {
+    return;
+  }
+  pfx_circ_sketch = tor_calloc(DOS_PFX_SKETCH_DEPTH * DOS_PFX_SKETCH_WIDTH,
+                               sizeof(pfx_circ_cell_t));
+  pfx_conn_sketch = tor_calloc(DOS_PFX_SKETCH_DEPTH * DOS_PFX_SKETCH_WIDTH,
+                               sizeof(uint32_t));
+  pfx_heavy_hitters = tor_calloc(DOS_PFX_HEAVY_HITTERS_SIZE,
+                                 sizeof(pfx_heavy_hitter_t));
+  ++pfx_sketch_generation;
+}
+
+/* Called when the consensus has changed. Do appropriate actions for prefix
+ * aggregation. */
+static void
+pfx_consensus_has_changed(const networkstatus_t *ns)
+{
+  if (dos_pfx_enabled && !get_param_pfx_enabled(ns)) {
+    pfx_free_all();
+  }
+}
+
+/* Return the prefix length that addresses of the family of <b>addr</b> are
+ * currently aggregated with, or 0 if it is not IPv4 or IPv6. */
+static uint32_t
+pfx_bits_for_addr(const tor_addr_t *addr)
+{
+  switch (tor_addr_family(addr)) {
+    case AF_INET:
+      return dos_pfx_ipv4_bits;
+    case AF_INET6:
+      return dos_pfx_ipv6_bits;
+    default:
+      return 0;
+  }
+}
+
+/* Write into <b>key_out</b> the prefix of length <b>bits</b> that
+ * <b>addr</b> is aggregated into: its family followed by its first
+ * <b>bits</b> bits, with every other bit cleared. Return 0 on success, or -1
+ * if the address is not IPv4 or IPv6. */
+static int
+pfx_key_from_addr_bits(const tor_addr_t *addr, uint32_t bits,
+                       uint8_t *key_out)
+{
+  uint32_t i;
+
+  memset(key_out, 0, DOS_PFX_KEY_LEN);
+  switch (tor_addr_family(addr)) {
+    case AF_INET: {
+      const uint32_t a = tor_addr_to_ipv4h(addr);
+      key_out[0] = 4;
+      set_uint32(key_out + 1,
+                 htonl(bits == 0 ? 0 : a & (UINT32_MAX << (32 - bits))));
+      return 0;
+    }
+    case AF_INET6:
+      key_out[0] = 6;
+      memcpy(key_out + 1, tor_addr_to_in6_addr8(addr), 16);
+      for (i = bits; i < 128; ++i) {
+        key_out[1 + i / 8] &= ~(0x80 >> (i % 8));
+      }
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+/* Write into <b>key_out</b> the prefix that <b>addr</b> is currently
+ * aggregated into, using dos_pfx_ipv4_bits or dos_pfx_ipv6_bits. Return 0 on
+ * success, or -1 if the address is not IPv4 or IPv6. */
+STATIC int
+pfx_key_from_addr(const tor_addr_t *addr, uint8_t *key_out)
+{
+  return pfx_key_from_addr_bits(addr, pfx_bits_for_addr(addr), key_out);
+}
+
+/* Compute the sketch columns of <b>key</b>, one per row, into
+ * <b>cols_out</b>. We derive all of them from a single keyed hash, using the
+ * two halves of the hash as the base and the stride of the probe sequence. */
+static void
+pfx_sketch_columns(const uint8_t *key, unsigned *cols_out)
+{
+  const uint64_t h = siphash24g(key, DOS_PFX_KEY_LEN);
+  const uint32_t h1 = (uint32_t) h, h2 = ((uint32_t) (h >> 32)) | 1;
+  int row;
+
+  for (row = 0; row < DOS_PFX_SKETCH_DEPTH; ++row) {
+    cols_out[row] = (h1 + row * h2) & (DOS_PFX_SKETCH_WIDTH - 1);
+  }
+}
+
+/* Return the heavy hitter slot for <b>key</b>, or NULL if it has none. If
+ * <b>create</b> is true, allocate a slot for it instead of returning NULL,
+ * evicting the entry that expires first among the slots it may use. */
+static pfx_heavy_hitter_t *
+pfx_heavy_hitter_find(const uint8_t *key, int create)
+{
+  const uint64_t h = siphash24g(key, DOS_PFX_KEY_LEN);
+  pfx_heavy_hitter_t *victim = NULL;
+  int i;
+
+  for (i = 0; i < DOS_PFX_HEAVY_HITTERS_PROBES; ++i) {
+    pfx_heavy_hitter_t *hh =
+      &pfx_heavy_hitters[(h + i) & (DOS_PFX_HEAVY_HITTERS_SIZE - 1)];
+    if (tor_memeq(hh->key, key, DOS_PFX_KEY_LEN)) {
+      return hh;
+    }
+    if (!victim || hh->marked_until_ts < victim->marked_until_ts) {
+      victim = hh;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  memcpy(victim->key, key, DOS_PFX_KEY_LEN);
+  victim->marked_until_ts = 0;
+  return victim;
+}
+
+/* Refill the circuit bucket of the sketch cell <b>cell</b> at the prefix
+ * circuit rate, up to the prefix burst. Buckets that have never been used
+ * start out full. */
+static void
+pfx_circ_cell_refill(pfx_circ_cell_t *cell, time_t now)
+{
+  uint64_t num_token;
+
+  if (cell->last_circ_bucket_refill_ts == now) {
+    return;
+  }
+  if (cell->last_circ_bucket_refill_ts == 0 ||
+      now < cell->last_circ_bucket_refill_ts ||
+      (uint64_t) (now - cell->last_circ_bucket_refill_ts) > UINT32_MAX) {
+    /* Never filled, or the clock jumped: fill it to the maximum, as
+     * cc_stats_refill_bucket() does. */
+    num_token = dos_pfx_circuit_burst;
+  } else {
+    num_token = (uint64_t) (now - cell->last_circ_bucket_refill_ts) *
+      dos_pfx_circuit_rate;
+  }
+  cell->circuit_bucket = (uint32_t)
+    MIN((uint64_t) cell->circuit_bucket + num_token,
+        (uint64_t) dos_pfx_circuit_burst);
+  cell->last_circ_bucket_refill_ts = now;
+}
+
+/* Return our estimate of the number of concurrent connections from the prefix
+ * with sketch columns <b>cols</b>. */
+static uint32_t
+pfx_conn_estimate(const unsigned *cols)
+{
+  uint32_t estimate = UINT32_MAX;
+  int row;
+  for (row = 0; row < DOS_PFX_SKETCH_DEPTH; ++row) {
+    estimate = MIN(estimate,
+                   pfx_conn_sketch[row * DOS_PFX_SKETCH_WIDTH + cols[row]]);
+  }
+  return estimate;
+}
+
+/* Add <b>delta</b>, which is 1 or -1, to the connection count of the prefix
+ * of length <b>bits</b> of <b>addr</b>. Counters never go below 0. */
+static void
+pfx_conn_count_add(const tor_addr_t *addr, uint32_t bits, int delta)
+{
+  uint8_t key[DOS_PFX_KEY_LEN];
+  unsigned cols[DOS_PFX_SKETCH_DEPTH];
+  int row;
+
+  if (!pfx_conn_sketch || pfx_key_from_addr_bits(addr, bits, key) < 0) {
+    return;
+  }
+  pfx_sketch_columns(key, cols);
+  for (row = 0; row < DOS_PFX_SKETCH_DEPTH; ++row) {
+    uint32_t *c = &pfx_conn_sketch[row * DOS_PFX_SKETCH_WIDTH + cols[row]];
+    if (delta > 0 && *c < UINT32_MAX) {
+      ++*c;
+    } else if (delta < 0 && *c > 0) {
+      --*c;
+    }
+  }
+}
+
+/* Account a new CREATE cell from <b>addr</b> against its prefix, and mark
+ * the prefix if it has exhausted its circuits while having at least the
+ * minimum number of concurrent connections. */
+static void
+pfx_cc_new_create_cell(const tor_addr_t *addr)
+{
+  uint8_t key[DOS_PFX_KEY_LEN];
+  unsigned cols[DOS_PFX_SKETCH_DEPTH];
+  uint32_t best_bucket = 0;
+  const time_t now = approx_time();
+  int row;
+
+  if (!pfx_circ_sketch || pfx_key_from_addr(addr, key) < 0) {
+    return;
+  }
+  pfx_sketch_columns(key, cols);
+
+  /* Take a token out of every cell of the prefix, and remember the fullest
+   * one: that's the least inflated estimate of what the prefix has left. */
+  for (row = 0; row < DOS_PFX_SKETCH_DEPTH; ++row) {
+    pfx_circ_cell_t *cell =
+      &pfx_circ_sketch[row * DOS_PFX_SKETCH_WIDTH + cols[row]];
+    pfx_circ_cell_refill(cell, now);
+    if (cell->circuit_bucket > 0) {
+      cell->circuit_bucket--;
+    }
+    best_bucket = MAX(best_bucket, cell->circuit_bucket);
+  }
+
+  if (best_bucket == 0 &&
+      pfx_conn_estimate(cols) >= dos_cc_min_concurrent_conn) {
+    pfx_heavy_hitter_t *hh = pfx_heavy_hitter_find(key, 1);
+    if (hh->marked_until_ts == 0) {
+      log_debug(LD_DOS, "Detected circuit creation DoS by address prefix "
+                "of %s", fmt_addr(addr));
+      pfx_num_marked_prefixes++;
+    }
+    hh->marked_until_ts =
+      now + dos_cc_defense_time_period +
+      crypto_rand_int_range(1, dos_cc_defense_time_period / 2);
+  }
+}
+
+/* Return true iff the address prefix of the given channel is marked as
+ * malicious. Like cc_channel_addr_is_marked(), this is part of the fast path
+ * of handling cells. */
+static int
+pfx_channel_addr_is_marked(channel_t *chan)
+{
+  tor_addr_t addr;
+  uint8_t key[DOS_PFX_KEY_LEN];
+  const pfx_heavy_hitter_t *hh;
+
+  if (!pfx_heavy_hitters || !channel_is_client(chan)) {
+    return 0;
+  }
+  if (!channel_get_addr_if_possible(chan, &addr) ||
+      pfx_key_from_addr(&addr, key) < 0) {
+    return 0;
+  }
+  hh = pfx_heavy_hitter_find(key, 0);
+  return hh && hh->marked_until_ts >= approx_time();
+}
+
+/* Return true iff the prefix of <b>addr</b> has more concurrent connections
+ * than we allow. */
+static int
+pfx_addr_has_too_many_conns(const tor_addr_t *addr)
+{
+  uint8_t key[DOS_PFX_KEY_LEN];
+  unsigned cols[DOS_PFX_SKETCH_DEPTH];
+
+  if (!pfx_conn_sketch || pfx_key_from_addr(addr, key) < 0) {
+    return 0;
+  }
+  pfx_sketch_columns(key, cols);
+  return pfx_conn_estimate(cols) > dos_pfx_max_concurrent_count;
+}
+
 /* Set circuit creation parameters located in the consensus or their default
  * if none are present. Called at initialization or when the consensus
  * changes. */
@@ -199,6 +620,17 @@ set_dos_parameters(const networkstatus_t *ns)
   dos_conn_enabled = get_param_conn_enabled(ns);
   dos_conn_max_concurrent_count = get_param_conn_max_concurrent_count(ns);
   dos_conn_defense_type = get_param_conn_defense_type(ns);
+
+  /* Prefix aggregation. */
+  dos_pfx_enabled = get_param_pfx_enabled(ns);
+  dos_pfx_ipv4_bits = get_param_pfx_ipv4_bits(ns);
+  dos_pfx_ipv6_bits = get_param_pfx_ipv6_bits(ns);
+  dos_pfx_circuit_rate = get_param_pfx_circuit_rate(ns);
+  dos_pfx_circuit_burst = get_param_pfx_circuit_burst(ns);
+  dos_pfx_max_concurrent_count = get_param_pfx_max_concurrent_count(ns);
+  if (dos_pfx_enabled) {
+    pfx_init();
+  }
 }
 
 /* Free everything for the circuit creation DoS mitigation subsystem. */
@@ -488,6 +920,12 @@ dos_cc_new_create_cell(channel_t *chan)
     cc_mark_client(&entry->dos_stats.cc_stats);
   }
 
+  /* Account the cell against the address prefix as well so that a client
+   * rotating through many addresses of the same prefix still gets caught. */
+  if (dos_pfx_enabled) {
+    pfx_cc_new_create_cell(&addr);
+  }
+
  end:
   return;
 }
@@ -514,6 +952,12 @@ dos_cc_get_defense_type(channel_t *chan)
     return dos_cc_defense_type;
   }
 
+  /* The address itself is fine, but it might be part of a marked prefix. */
+  if (dos_pfx_enabled && pfx_channel_addr_is_marked(chan)) {
+    pfx_num_rejected_cells++;
+    return dos_cc_defense_type;
+  }
+
  end:
   return DOS_CC_DEFENSE_NONE;
 }
@@ -547,6 +991,12 @@ dos_conn_addr_get_defense_type(const tor_addr_t *addr)
     return dos_conn_defense_type;
   }
 
+  /* Same for the whole prefix of the address. */
+  if (dos_pfx_enabled && pfx_addr_has_too_many_conns(addr)) {
+    pfx_num_conn_rejected++;
+    return dos_conn_defense_type;
+  }
+
  end:
   return DOS_CONN_DEFENSE_NONE;
 }
@@ -622,6 +1072,7 @@ dos_log_heartbeat(void)
   char *conn_msg = NULL;
   char *cc_msg = NULL;
   char *single_hop_client_msg = NULL;
+  char *pfx_msg = NULL;
 
   if (!dos_is_enabled()) {
     goto end;
@@ -640,6 +1091,14 @@ dos_log_heartbeat(void)
                  conn_num_addr_rejected);
   }
 
+  if (dos_pfx_enabled) {
+    tor_asprintf(&pfx_msg,
+                 " %" PRIu64 " circuits and %" PRIu64 " connections rejected"
+                 " by prefix, %" PRIu32 " marked prefixes.",
+                 pfx_num_rejected_cells, pfx_num_conn_rejected,
+                 pfx_num_marked_prefixes);
+  }
+
   if (dos_should_refuse_single_hop_client()) {
     tor_asprintf(&single_hop_client_msg,
                  " %" PRIu64 " single hop clients refused.",
@@ -647,14 +1106,16 @@ dos_log_heartbeat(void)
   }
 
   log_notice(LD_HEARTBEAT,
-             "DoS mitigation since startup:%s%s%s",
+             "DoS mitigation since startup:%s%s%s%s",
              (cc_msg != NULL) ? cc_msg : " [cc not enabled]",
              (conn_msg != NULL) ? conn_msg : " [conn not enabled]",
+             (pfx_msg != NULL) ? pfx_msg : "",
              (single_hop_client_msg != NULL) ? single_hop_client_msg : "");
 
   tor_free(conn_msg);
   tor_free(cc_msg);
   tor_free(single_hop_client_msg);
+  tor_free(pfx_msg);
 
  end:
   return;
@@ -694,6 +1155,15 @@ dos_new_client_conn(or_connection_t *or_conn)
 
   entry->dos_stats.concurrent_count++;
   or_conn->tracked_for_dos_mitigation = 1;
+  if (dos_pfx_enabled) {
+    /* Remember which bucket we counted it in: the prefix lengths can change
+     * before it closes. */
+    or_conn->dos_prefix_bits =
+      (uint8_t) pfx_bits_for_addr(&or_conn->real_addr);
+    or_conn->dos_prefix_generation = pfx_sketch_generation;
+    pfx_conn_count_add(&or_conn->real_addr, or_conn->dos_prefix_bits, 1);
+    or_conn->tracked_for_dos_prefix = 1;
+  }
   log_debug(LD_DOS, "Client address %s has now %u concurrent connections.",
             fmt_addr(&or_conn->real_addr),
             entry->dos_stats.concurrent_count);
@@ -710,6 +1180,14 @@ dos_close_client_conn(const or_connection_t *or_conn)
 
   tor_assert(or_conn);
 
+  /* The prefix counters are decremented on their own flag: they don't depend
+   * on the geoip cache entry being around. We take the connection out of the
+   * bucket that we put it in, unless the sketches have been reset since. */
+  if (or_conn->tracked_for_dos_prefix &&
+      or_conn->dos_prefix_generation == pfx_sketch_generation) {
+    pfx_conn_count_add(&or_conn->real_addr, or_conn->dos_prefix_bits, -1);
+  }
+
   /* We have to decrement the count on tracked connection only even if the
    * subsystem has been disabled at runtime because it might be re-enabled
    * after and we need to keep a synchronized counter at all time. */
@@ -758,6 +1236,7 @@ dos_consensus_has_changed(const networkstatus_t *ns)
 
   cc_consensus_has_changed(ns);
   conn_consensus_has_changed(ns);
+  pfx_consensus_has_changed(ns);
 
   /* We were already enabled or we just became enabled but either way, set the
    * consensus parameters for all subsystems. */
@@ -782,6 +1261,10 @@ dos_free_all(void)
   /* Free the connection mitigation subsystem. It is safe to do this even if
    * it wasn't initialized. */
   conn_free_all();
+
+  /* Free the prefix aggregation sketches. It is safe to do this even if they
+   * were never allocated. */
+  pfx_free_all();
 }
 
 /* Initialize the Denial of Service subsystem. */
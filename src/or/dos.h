@@ -117,6 +117,34 @@ typedef enum dos_conn_defense_type_t {
 
 dos_conn_defense_type_t dos_conn_addr_get_defense_type(const tor_addr_t *addr);
 
+/*
+ * Address prefix aggregation interface.
+ */
+
+/* DoSPrefixAggregationEnabled default. Disabled by default. */
+#define DOS_PFX_ENABLED_DEFAULT 0
+/* DoSPrefixIPv4Bits default. */
+#define DOS_PFX_IPV4_BITS_DEFAULT 24
+/* DoSPrefixIPv6Bits default. */
+#define DOS_PFX_IPV6_BITS_DEFAULT 64
+/* DoSPrefixCircuitRate default, per second. */
+#define DOS_PFX_CIRCUIT_RATE_DEFAULT 30
+/* DoSPrefixCircuitBurst default. */
+#define DOS_PFX_CIRCUIT_BURST_DEFAULT 900
+/* DoSPrefixMaxConcurrentCount default. */
+#define DOS_PFX_MAX_CONCURRENT_COUNT_DEFAULT 1000
+
+/* Length of a prefix key: one byte for the address family and up to 16 bytes
+ * of address. */
+#define DOS_PFX_KEY_LEN 17
+/* Dimensions of the count-min sketches. The width must be a power of 2. */
+#define DOS_PFX_SKETCH_DEPTH 4
+#define DOS_PFX_SKETCH_WIDTH 4096
+/* Number of slots in the table of marked prefixes, a power of 2, and how many
+ * of them a prefix may use. */
+#define DOS_PFX_HEAVY_HITTERS_SIZE 1024
+#define DOS_PFX_HEAVY_HITTERS_PROBES 8
+
 #ifdef DOS_PRIVATE
 
 STATIC uint32_t get_param_conn_max_concurrent_count(
@@ -134,6 +162,13 @@ MOCK_DECL(STATIC unsigned int, get_param_cc_enabled,
 MOCK_DECL(STATIC unsigned int, get_param_conn_enabled,
           (const networkstatus_t *ns));
 
+STATIC uint32_t get_param_pfx_circuit_burst(const networkstatus_t *ns);
+STATIC uint32_t get_param_pfx_max_concurrent_count(
+                                              const networkstatus_t *ns);
+STATIC int pfx_key_from_addr(const tor_addr_t *addr, uint8_t *key_out);
+MOCK_DECL(STATIC unsigned int, get_param_pfx_enabled,
+          (const networkstatus_t *ns));
+
 #endif /* TOR_DOS_PRIVATE */
 
 #endif /* TOR_DOS_H */
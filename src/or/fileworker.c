@@ -0,0 +1,494 @@
+/* Copyright (c) 2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file fileworker.c
+ * \brief Write files to disk from a dedicated background thread.
+ *
+ * Other modules hand us whole-file replacements (like the state file) or
+ * appends (like the key-pinning and microdescriptor journals), and we get
+ * them onto the disk without making the main thread wait for write() and
+ * fsync().  We use a single-thread threadpool from workqueue.c, with its own
+ * reply queue, so that completions are delivered on the main thread.
+ *
+ * For each file, at most one write is in flight at a time.  Requests that
+ * arrive while one is in flight are coalesced: appends are concatenated,
+ * and a replacement discards everything queued before it.  The next write
+ * for the file is launched when the previous one is done, so writes to any
+ * one file reach the disk in the order they were requested.  Replacements
+ * go through a temporary file that is fsync()ed before it is renamed over
+ * the target, and appends are fsync()ed before we report them done, so that
+ * after a crash a file holds either the old or the new contents, plus some
+ * prefix of any later appends.
+ *
+ * Until fileworker_init() has been called (and in the unit tests, unless
+ * they call it), every request is written synchronously before it returns.
+ **/
+#include "or.h"
+#include "buffers.h"
+#include "compat_libevent.h"
+#include "fileworker.h"
+#include "workqueue.h"
+
+#include <event2/event.h>
+
+/** A single write of coalesced data to a file, owned by the main thread
+ * except while the I/O thread is running it. */
+typedef struct fileworker_job_t {
+  /** The file we're writing, or NULL once it no longer cares about us.
+   * Main thread only. */
+  struct fileworker_file_t *file;
+  /** Name of the file to write. */
+  char *fname;
+  /** Bytes to write. */
+  char *data;
+  /** Number of bytes in <b>data</b>. */
+  size_t len;
+  /** True iff we replace the file, rather than appending to it. */
+  unsigned int replace : 1;
+  /** True iff we write the file in binary mode. */
+  unsigned int bin : 1;
+  /** True iff this job was handed to the I/O thread. */
+  unsigned int queued : 1;
+  /** True iff we've run the callbacks for this job.  Main thread only. */
+  unsigned int handled : 1;
+  /** True iff the write is complete.  Protected by fileworker_lock, and
+   * kept out of the bitfield above, which belongs to the main thread. */
+  int done;
+  /** 0 if the write succeeded, -1 if it failed. */
+  int status;
+  /** List of fileworker_cb_t for the requests that this write covers. */
+  smartlist_t *callbacks;
+} fileworker_job_t;
+
+/** A function to call once some request has been written. */
+typedef struct fileworker_cb_t {
+  fileworker_done_fn_t fn;
+  void *arg;
+} fileworker_cb_t;
+
+/** Everything we know about one file that has writes outstanding. */
+typedef struct fileworker_file_t {
+  /** Name of the file. */
+  char *fname;
+  /** The write for this file that is currently in progress, if any. */
+  fileworker_job_t *job;
+  /** True iff we have data that hasn't been handed to a job yet. */
+  unsigned int has_pending : 1;
+  /** True iff the pending data replaces the file. */
+  unsigned int pending_replace : 1;
+  /** True iff the pending data should be written in binary mode. */
+  unsigned int pending_bin : 1;
+  /** Data waiting for the current job to finish. */
+  buf_t *pending;
+  /** List of fileworker_cb_t for the requests covered by <b>pending</b>. */
+  smartlist_t *pending_callbacks;
+} fileworker_file_t;
+
+/** Map from filename to fileworker_file_t, for every file with requests
+ * that we haven't finished. */
+static strmap_t *fileworker_files = NULL;
+
+/** Reply queue that the I/O thread reports to. */
+static replyqueue_t *fileworker_replyqueue = NULL;
+/** Threadpool holding the I/O thread. */
+static threadpool_t *fileworker_threadpool = NULL;
+/** Event that fires when the I/O thread has replies for us. */
+static struct event *fileworker_reply_event = NULL;
+
+/** Lock protecting the done field of every fileworker_job_t. */
+static tor_mutex_t fileworker_lock;
+/** Signaled whenever the I/O thread finishes a job. */
+static tor_cond_t fileworker_cond;
+
+/** Helper: the I/O thread keeps no state of its own. */
+static void *
+fileworker_state_new(void *arg)
+{
+  (void)arg;
+  return tor_malloc_zero(1);
+}
+
+/** Helper: free the state returned by fileworker_state_new(). */
+static void
+fileworker_state_free(void *state)
+{
+  tor_free(state);
+}
+
+/** Callback: the I/O thread has queued some replies for us. */
+static void
+fileworker_replyqueue_cb(evutil_socket_t sock, short events, void *arg)
+{
+  replyqueue_t *rq = arg;
+  (void) sock;
+  (void) events;
+  replyqueue_process(rq);
+}
+
+/** Start the I/O thread, so that writes no longer happen on the main
+ * thread.  It is OK to call this more than once. */
+void
+fileworker_init(void)
+{
+  if (fileworker_threadpool)
+    return;
+  fileworker_replyqueue = replyqueue_new(0);
+  if (!fileworker_replyqueue) {
+    log_warn(LD_FS, "Couldn't create a reply queue for background file "
+             "writes; writing files from the main thread.");
+    return;
+  }
+  fileworker_reply_event =
+    tor_event_new(tor_libevent_get_base(),
+                  replyqueue_get_socket(fileworker_replyqueue),
+                  EV_READ|EV_PERSIST,
+                  fileworker_replyqueue_cb,
+                  fileworker_replyqueue);
+  event_add(fileworker_reply_event, NULL);
+  tor_mutex_init_nonrecursive(&fileworker_lock);
+  tor_cond_init(&fileworker_cond);
+  fileworker_threadpool = threadpool_new(1, fileworker_replyqueue,
+                                         fileworker_state_new,
+                                         fileworker_state_free,
+                                         NULL);
+}
+
+/** Return true iff writes are being done on the I/O thread. */
+int
+fileworker_is_running(void)
+{
+  return fileworker_threadpool != NULL;
+}
+
+/** Write the data for <b>job</b> to disk and return 0 on success, -1 on
+ * failure.  Called from the I/O thread, or from the main thread when it
+ * needs the write to be finished right away. */
+static int
+fileworker_job_write(const fileworker_job_t *job)
+{
+  open_file_t *open_file = NULL;
+  int flags = job->replace ? OPEN_FLAGS_REPLACE : OPEN_FLAGS_APPEND;
+  int fd;
+
+  flags |= job->bin ? O_BINARY : O_TEXT;
+  fd = start_writing_to_file(job->fname, flags, 0600, &open_file);
+  if (fd < 0)
+    return -1;
+  if (write_all(fd, job->data, job->len, 0) < 0) {
+    log_warn(LD_FS, "Error writing to \"%s\": %s", job->fname,
+             strerror(errno));
+    goto err;
+  }
+  if (tor_fsync(fd) < 0) {
+    log_warn(LD_FS, "Error syncing \"%s\" to disk: %s", job->fname,
+             strerror(errno));
+    goto err;
+  }
+  return finish_writing_to_file(open_file);
+ err:
+  abort_writing_to_file(open_file);
+  return -1;
+}
+
+/** Function run on the I/O thread: write the data for one job. */
+static workqueue_reply_t
+fileworker_threadfn(void *state, void *arg)
+{
+  fileworker_job_t *job = arg;
+  (void) state;
+
+  job->status = fileworker_job_write(job);
+
+  tor_mutex_acquire(&fileworker_lock);
+  job->done = 1;
+  tor_cond_signal_all(&fileworker_cond);
+  tor_mutex_release(&fileworker_lock);
+
+  return WQ_RPL_REPLY;
+}
+
+/** Release all storage held by <b>job</b>. */
+static void
+fileworker_job_free(fileworker_job_t *job)
+{
+  if (!job)
+    return;
+  SMARTLIST_FOREACH(job->callbacks, fileworker_cb_t *, cb, tor_free(cb));
+  smartlist_free(job->callbacks);
+  tor_free(job->fname);
+  tor_free(job->data);
+  tor_free(job);
+}
+
+/** Return the entry for <b>fname</b>, creating it if there is none. */
+static fileworker_file_t *
+fileworker_file_get(const char *fname)
+{
+  fileworker_file_t *file;
+  if (!fileworker_files)
+    fileworker_files = strmap_new();
+  file = strmap_get(fileworker_files, fname);
+  if (!file) {
+    file = tor_malloc_zero(sizeof(fileworker_file_t));
+    file->fname = tor_strdup(fname);
+    file->pending = buf_new();
+    file->pending_callbacks = smartlist_new();
+    strmap_set(fileworker_files, fname, file);
+  }
+  return file;
+}
+
+/** Forget about <b>file</b>, which must have no writes outstanding. */
+static void
+fileworker_file_remove(fileworker_file_t *file)
+{
+  tor_assert(!file->job);
+  tor_assert(!file->has_pending);
+  strmap_remove(fileworker_files, file->fname);
+  buf_free(file->pending);
+  smartlist_free(file->pending_callbacks);
+  tor_free(file->fname);
+  tor_free(file);
+}
+
+/** Take everything pending for <b>file</b> and return a new job to write
+ * it, which becomes the file's current job. */
+static fileworker_job_t *
+fileworker_job_new_from_pending(fileworker_file_t *file)
+{
+  fileworker_job_t *job = tor_malloc_zero(sizeof(fileworker_job_t));
+  tor_assert(!file->job);
+  tor_assert(file->has_pending);
+
+  job->file = file;
+  job->fname = tor_strdup(file->fname);
+  job->len = buf_datalen(file->pending);
+  job->data = tor_malloc(job->len ? job->len : 1);
+  buf_get_bytes(file->pending, job->data, job->len);
+  job->replace = file->pending_replace;
+  job->bin = file->pending_bin;
+  job->callbacks = file->pending_callbacks;
+
+  file->pending_callbacks = smartlist_new();
+  file->has_pending = file->pending_replace = 0;
+  file->job = job;
+  return job;
+}
+
+/** Called on the main thread once <b>job</b> is done: detach it from its
+ * file, and tell everybody who asked for it how it went. */
+static void
+fileworker_job_finish(fileworker_job_t *job)
+{
+  tor_assert(!job->handled);
+  job->handled = 1;
+  if (job->file) {
+    job->file->job = NULL;
+    job->file = NULL;
+  }
+  if (job->status < 0)
+    log_warn(LD_FS, "Unable to %s \"%s\".",
+             job->replace ? "write" : "append to", job->fname);
+  SMARTLIST_FOREACH(job->callbacks, fileworker_cb_t *, cb,
+                    cb->fn(job->fname, job->status, cb->arg));
+}
+
+/** Write <b>job</b> on the main thread, finish it, and free it.  Return
+ * its status. */
+static int
+fileworker_job_run_here(fileworker_job_t *job)
+{
+  int status;
+  job->status = status = fileworker_job_write(job);
+  job->done = 1;
+  fileworker_job_finish(job);
+  fileworker_job_free(job);
+  return status;
+}
+
+static void fileworker_replyfn(void *arg);
+
+/** If the file called <b>fname</b> has nothing in flight, launch a write
+ * for whatever is pending for it, or forget about it if nothing is. */
+static void
+fileworker_file_update(const char *fname)
+{
+  fileworker_file_t *file;
+  fileworker_job_t *job;
+
+  if (!fileworker_files)
+    return;
+  file = strmap_get(fileworker_files, fname);
+  if (!file || file->job)
+    return;
+  if (!file->has_pending) {
+    fileworker_file_remove(file);
+    return;
+  }
+
+  job = fileworker_job_new_from_pending(file);
+  if (fileworker_threadpool) {
+    job->queued = 1;
+    if (threadpool_queue_work(fileworker_threadpool, fileworker_threadfn,
+                              fileworker_replyfn, job))
+      return;
+    log_warn(LD_BUG, "Couldn't queue a write to \"%s\"; doing it "
+             "synchronously.", job->fname);
+    job->queued = 0;
+  }
+  /* Write everything out now.  The callbacks may have queued more data,
+   * so go around again. */
+  char *name = tor_strdup(fname);
+  fileworker_job_run_here(job);
+  fileworker_file_update(name);
+  tor_free(name);
+}
+
+/** Called on the main thread once the I/O thread is done with a job. */
+static void
+fileworker_replyfn(void *arg)
+{
+  fileworker_job_t *job = arg;
+  if (!job->handled) {
+    fileworker_job_finish(job);
+    fileworker_file_update(job->fname);
+  }
+  fileworker_job_free(job);
+}
+
+/** Helper: queue <b>len</b> bytes of <b>data</b> to be written to
+ * <b>fname</b>, replacing its contents if <b>replace</b> is true. */
+static void
+fileworker_queue(const char *fname, const char *data, size_t len,
+                 int replace, int bin,
+                 fileworker_done_fn_t done_fn, void *arg)
+{
+  fileworker_file_t *file;
+  tor_assert(fname);
+  tor_assert(data || len == 0);
+
+  file = fileworker_file_get(fname);
+  if (replace) {
+    /* Whatever was waiting would just be overwritten; its callbacks run
+     * when this replacement is done. */
+    buf_clear(file->pending);
+    file->pending_replace = 1;
+  }
+  if (len)
+    buf_add(file->pending, data, len);
+  file->has_pending = 1;
+  file->pending_bin = bin ? 1 : 0;
+  if (done_fn) {
+    fileworker_cb_t *cb = tor_malloc_zero(sizeof(fileworker_cb_t));
+    cb->fn = done_fn;
+    cb->arg = arg;
+    smartlist_add(file->pending_callbacks, cb);
+  }
+
+  fileworker_file_update(fname);
+}
+
+/** Arrange for the file <b>fname</b> to hold exactly the <b>len</b> bytes
+ * at <b>data</b>, as with write_bytes_to_file(), once every earlier request
+ * for it is done.  If <b>done_fn</b> is set, call it with <b>arg</b> once
+ * the file is on disk, or we fail to write it.  The data is copied. */
+void
+fileworker_replace(const char *fname, const char *data, size_t len,
+                   int bin, fileworker_done_fn_t done_fn, void *arg)
+{
+  fileworker_queue(fname, data, len, 1, bin, done_fn, arg);
+}
+
+/** As fileworker_replace(), but add the data to the end of <b>fname</b>,
+ * creating it if it does not exist. */
+void
+fileworker_append(const char *fname, const char *data, size_t len,
+                  int bin, fileworker_done_fn_t done_fn, void *arg)
+{
+  fileworker_queue(fname, data, len, 0, bin, done_fn, arg);
+}
+
+/** Block until <b>job</b>, which the I/O thread owns, is complete. */
+static void
+fileworker_job_wait(fileworker_job_t *job)
+{
+  tor_mutex_acquire(&fileworker_lock);
+  while (!job->done) {
+    if (tor_cond_wait(&fileworker_cond, &fileworker_lock, NULL) < 0) {
+      log_warn(LD_BUG, "Failed to wait for a background file write.");
+      break;
+    }
+  }
+  tor_mutex_release(&fileworker_lock);
+}
+
+/** Block until every request so far for the file <b>fname</b> has been
+ * written, writing any that haven't been started on this thread.  Call this
+ * before reading a file that may have writes outstanding.  Return 0 if the
+ * last write succeeded (or there was nothing to do), and -1 if it failed. */
+int
+fileworker_flush(const char *fname)
+{
+  fileworker_file_t *file;
+  fileworker_job_t *job;
+  int status = 0;
+
+  while (fileworker_files && (file = strmap_get(fileworker_files, fname))) {
+    if (file->job) {
+      job = file->job;
+      fileworker_job_wait(job);
+      status = job->status;
+      /* The reply function will free it. */
+      fileworker_job_finish(job);
+    } else if (file->has_pending) {
+      /* The callbacks may ask for more; we'll look again. */
+      job = fileworker_job_new_from_pending(file);
+      status = fileworker_job_run_here(job);
+    } else {
+      fileworker_file_remove(file);
+    }
+  }
+  return status;
+}
+
+/** Block until every request so far, for every file, has been written. */
+void
+fileworker_flush_all(void)
+{
+  smartlist_t *names;
+  if (!fileworker_files)
+    return;
+  names = smartlist_new();
+  /* Flushing one file can run callbacks that write to others. */
+  while (fileworker_files && strmap_size(fileworker_files)) {
+    STRMAP_FOREACH(fileworker_files, fname, fileworker_file_t *, file) {
+      (void)file;
+      smartlist_add(names, tor_strdup(fname));
+    } STRMAP_FOREACH_END;
+    SMARTLIST_FOREACH(names, char *, fname, {
+        fileworker_flush(fname);
+        tor_free(fname);
+    });
+    smartlist_clear(names);
+  }
+  smartlist_free(names);
+}
+
+/** Return the number of files that have writes outstanding. */
+int
+fileworker_n_pending(void)
+{
+  return fileworker_files ? strmap_size(fileworker_files) : 0;
+}
+
+/** Write everything that is outstanding, and release our storage.  The I/O
+ * thread, like the cpuworkers, stays around until we exit. */
+void
+fileworker_free_all(void)
+{
+  fileworker_flush_all();
+  strmap_free(fileworker_files, NULL);
+  fileworker_files = NULL;
+}
+
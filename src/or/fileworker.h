@@ -0,0 +1,29 @@
+/* Copyright (c) 2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file fileworker.h
+ * \brief Header file for fileworker.c.
+ **/
+
+#ifndef TOR_FILEWORKER_H
+#define TOR_FILEWORKER_H
+
+/** Function to call once a queued write to <b>fname</b> has reached the
+ * disk, or failed.  <b>status</b> is 0 on success and -1 on failure. */
+typedef void (*fileworker_done_fn_t)(const char *fname, int status,
+                                     void *arg);
+
+void fileworker_init(void);
+int fileworker_is_running(void);
+void fileworker_replace(const char *fname, const char *data, size_t len,
+                        int bin, fileworker_done_fn_t done_fn, void *arg);
+void fileworker_append(const char *fname, const char *data, size_t len,
+                       int bin, fileworker_done_fn_t done_fn, void *arg);
+int fileworker_flush(const char *fname);
+void fileworker_flush_all(void);
+int fileworker_n_pending(void);
+void fileworker_free_all(void);
+
+#endif /* !defined(TOR_FILEWORKER_H) */
+
@@ -13,14 +13,17 @@
  * statistical functions, which collect statistics about different kinds of
  * per-country usage.
  *
- * The geoip lookup tables are implemented as sorted lists of disjoint address
- * ranges, each mapping to a singleton geoip_country_t.  These country objects
- * are also indexed by their names in a hashtable.
+ * The geoip lookup tables are implemented as sorted arrays of disjoint address
+ * ranges, each mapping to a singleton geoip_country_t, with an index on the
+ * first 16 bits of the address.  These country objects are also indexed by
+ * their names in a hashtable.
  *
  * The tables are populated from disk at startup by the geoip_load_file()
- * function.  For more information on the file format they read, see that
- * function.  See the scripts and the README file in src/config for more
- * information about how those files are generated.
+ * function, either by parsing a text file or by mapping a binary file whose
+ * layout is the same as the in-memory tables.  For more information on the
+ * file formats they read, see that function.  See the scripts and the README
+ * file in src/config for more information about how those files are
+ * generated.
  *
  * Tor uses GeoIP information in order to implement user requests (such as
  * ExcludeNodes {cc}), and to keep track of how much usage relays are getting
@@ -39,35 +42,101 @@
 
 static void init_geoip_countries(void);
 
-/** An entry from the GeoIP IPv4 file: maps an IPv4 range to a country. */
+/** An entry in the GeoIP IPv4 table: maps an IPv4 range to a country.
+ *
+ * This is also the layout of an entry in a binary GeoIP file, so that we can
+ * use such files without copying them: every field is stored in network
+ * order. */
 typedef struct geoip_ipv4_entry_t {
-  uint32_t ip_low; /**< The lowest IP in the range, in host order */
-  uint32_t ip_high; /**< The highest IP in the range, in host order */
-  intptr_t country; /**< An index into geoip_countries */
+  uint32_t ip_low; /**< The lowest IP in the range, in network order */
+  uint32_t ip_high; /**< The highest IP in the range, in network order */
+  /** An index into the country table of the GeoIP table holding this entry,
+   * in network order. */
+  uint32_t country;
 } geoip_ipv4_entry_t;
 
-/** An entry from the GeoIP IPv6 file: maps an IPv6 range to a country. */
+/** An entry in the GeoIP IPv6 table: maps an IPv6 range to a country.  As
+ * geoip_ipv4_entry_t, this is also the layout used in binary GeoIP files. */
 typedef struct geoip_ipv6_entry_t {
-  struct in6_addr ip_low; /**< The lowest IP in the range, in host order */
-  struct in6_addr ip_high; /**< The highest IP in the range, in host order */
-  intptr_t country; /**< An index into geoip_countries */
+  uint8_t ip_low[16]; /**< The lowest IP in the range, in network order */
+  uint8_t ip_high[16]; /**< The highest IP in the range, in network order */
+  /** An index into the country table of the GeoIP table holding this entry,
+   * in network order. */
+  uint32_t country;
 } geoip_ipv6_entry_t;
 
+/** Number of entries in the index of a geoip_table_t: one for each possible
+ * value of the first 16 bits of an address, plus one. */
+#define GEOIP_INDEX_LEN ((1<<16) + 1)
+
+/** A GeoIP lookup table for one address family: a sorted array of disjoint
+ * address ranges, each mapping to a country.
+ *
+ * Its contents either live on the heap (when we parsed a text GeoIP file) or
+ * point directly into a memory-mapped binary GeoIP file.  Either way, an
+ * address is looked up by using its first 16 bits to find, in <b>index</b>,
+ * the small slice of the array that can contain it, and then doing a binary
+ * search in that slice. */
+typedef struct geoip_table_t {
+  /** Address family of this table: AF_INET or AF_INET6. */
+  sa_family_t family;
+  /** Size of each entry: sizeof(geoip_ipv4_entry_t) or
+   * sizeof(geoip_ipv6_entry_t). */
+  size_t entry_size;
+  /** Length of the addresses in this table, in bytes: 4 or 16. */
+  size_t addr_len;
+  /** The entries of this table. Once the table is finished, they are sorted
+   * by ip_low. */
+  const uint8_t *entries;
+  /** Number of entries in <b>entries</b>. */
+  int n_entries;
+  /** If the entries live on the heap, the array that holds them (the same as
+   * <b>entries</b>), and its allocated length.  NULL if they are mapped. */
+  uint8_t *entries_buf;
+  int n_entries_allocated;
+  /** True iff the entries were added in sorted order. */
+  unsigned int is_sorted : 1;
+  /** GEOIP_INDEX_LEN values in network order: index[p] is the position of the
+   * first entry whose ip_high has its first 16 bits greater than or equal to
+   * p.  NULL if we haven't built the index yet. */
+  const uint32_t *index;
+  /** If the index lives on the heap, the array that holds it. */
+  uint32_t *index_buf;
+  /** Translation from the country indices stored in the entries to positions
+   * in geoip_countries, with <b>n_countries</b> elements.  NULL if the
+   * entries use positions in geoip_countries directly. */
+  country_t *country_map;
+  int n_countries;
+  /** The binary GeoIP file that this table points into, or NULL. */
+  tor_mmap_t *map;
+} geoip_table_t;
+
 /** A per-country record for GeoIP request history. */
 typedef struct geoip_country_t {
   char countrycode[3];
   uint32_t n_v3_ns_requests;
 } geoip_country_t;
 
+/** Magic string at the start of a binary GeoIP file. */
+#define GEOIP_BINARY_MAGIC "TORGEOIP"
+/** Length of GEOIP_BINARY_MAGIC, not counting the NUL. */
+#define GEOIP_BINARY_MAGIC_LEN 8
+/** Version of the binary GeoIP file format that we understand. */
+#define GEOIP_BINARY_VERSION 1
+/** Length of the header of a binary GeoIP file: the magic, then four 32-bit
+ * integers in network order (version, family as 4 or 6, number of countries
+ * and number of entries), then the SHA1 digest of the text GeoIP file it was
+ * converted from, then 4 bytes of padding. */
+#define GEOIP_BINARY_HEADER_LEN (GEOIP_BINARY_MAGIC_LEN + 16 + DIGEST_LEN + 4)
+
 /** A list of geoip_country_t */
 static smartlist_t *geoip_countries = NULL;
 /** A map from lowercased country codes to their position in geoip_countries.
  * The index is encoded in the pointer, and 1 is added so that NULL can mean
  * not found. */
 static strmap_t *country_idxplus1_by_lc_code = NULL;
-/** Lists of all known geoip_ipv4_entry_t and geoip_ipv6_entry_t, sorted
- * by their respective ip_low. */
-static smartlist_t *geoip_ipv4_entries = NULL, *geoip_ipv6_entries = NULL;
+/** The IPv4 and IPv6 GeoIP tables, or NULL if we don't have them. */
+static geoip_table_t *geoip_ipv4_table = NULL, *geoip_ipv6_table = NULL;
 
 /** SHA1 digest of the GeoIP files to include in extra-info descriptors. */
 static char geoip_digest[DIGEST_LEN];
@@ -122,20 +191,14 @@ geoip_get_country,(const char *country))
   return (country_t)idx;
 }
 
-/** Add an entry to a GeoIP table, mapping all IP addresses between <b>low</b>
- * and <b>high</b>, inclusive, to the 2-letter country code <b>country</b>. */
-static void
-geoip_add_entry(const tor_addr_t *low, const tor_addr_t *high,
-                const char *country)
+/** Return the position of the country with the 2-letter code <b>country</b>
+ * in geoip_countries, adding it if we have not seen it before. */
+static intptr_t
+geoip_get_or_add_country(const char *country)
 {
   intptr_t idx;
   void *idxplus1_;
 
-  IF_BUG_ONCE(tor_addr_family(low) != tor_addr_family(high))
-    return;
-  IF_BUG_ONCE(tor_addr_compare(high, low, CMP_EXACT) < 0)
-    return;
-
   idxplus1_ = strmap_get_lc(country_idxplus1_by_lc_code, country);
 
   if (!idxplus1_) {
@@ -152,19 +215,214 @@ geoip_add_entry(const tor_addr_t *low, const tor_addr_t *high,
     geoip_country_t *c = smartlist_get(geoip_countries, idx);
     tor_assert(!strcasecmp(c->countrycode, country));
   }
+  return idx;
+}
+
+/** Allocate and return a new, empty GeoIP table for <b>family</b>. */
+static geoip_table_t *
+geoip_table_new(sa_family_t family)
+{
+  geoip_table_t *t = tor_malloc_zero(sizeof(geoip_table_t));
+  tor_assert(family == AF_INET || family == AF_INET6);
+  t->family = family;
+  if (family == AF_INET) {
+    t->entry_size = sizeof(geoip_ipv4_entry_t);
+    t->addr_len = 4;
+  } else {
+    t->entry_size = sizeof(geoip_ipv6_entry_t);
+    t->addr_len = 16;
+  }
+  t->is_sorted = 1;
+  return t;
+}
+
+/** Release all storage held by the GeoIP table <b>t</b>, including the
+ * mapping of its binary file, if any. */
+static void
+geoip_table_free(geoip_table_t *t)
+{
+  if (!t)
+    return;
+  tor_free(t->entries_buf);
+  tor_free(t->index_buf);
+  tor_free(t->country_map);
+  if (t->map)
+    tor_munmap_file(t->map);
+  tor_free(t);
+}
+
+/** Return a pointer to the <b>idx</b>th entry of <b>t</b>.  The first
+ * <b>t</b>-&gt;addr_len bytes are the entry's ip_low, and the next
+ * <b>t</b>-&gt;addr_len bytes are its ip_high. */
+static inline const uint8_t *
+geoip_table_entry(const geoip_table_t *t, int idx)
+{
+  return t->entries + t->entry_size * idx;
+}
+
+/** Return the country index (in network order) stored in <b>ent</b>, an
+ * entry of <b>t</b>. */
+static inline uint32_t
+geoip_table_entry_country(const geoip_table_t *t, const uint8_t *ent)
+{
+  return get_uint32(ent + 2 * t->addr_len);
+}
+
+/** Return the first 16 bits of the address starting at <b>a</b>. */
+static inline unsigned
+geoip_addr_prefix16(const uint8_t *a)
+{
+  return ((unsigned)a[0] << 8) | a[1];
+}
+
+/** Append an entry to the heap-allocated table <b>t</b>, mapping the
+ * addresses between <b>low</b> and <b>high</b> (each <b>t</b>-&gt;addr_len
+ * bytes in network order) to position <b>country</b> of geoip_countries. */
+static void
+geoip_table_add_entry(geoip_table_t *t, const uint8_t *low,
+                      const uint8_t *high, intptr_t country)
+{
+  uint8_t *ent;
+
+  tor_assert(!t->map);
+  if (t->n_entries == t->n_entries_allocated) {
+    t->n_entries_allocated = t->n_entries_allocated ?
+      t->n_entries_allocated * 2 : 256;
+    t->entries_buf = tor_reallocarray(t->entries_buf, t->n_entries_allocated,
+                                      t->entry_size);
+    t->entries = t->entries_buf;
+  }
+  if (t->n_entries &&
+      fast_memcmp(geoip_table_entry(t, t->n_entries - 1), low,
+                  t->addr_len) > 0)
+    t->is_sorted = 0;
+
+  ent = t->entries_buf + t->entry_size * t->n_entries;
+  memcpy(ent, low, t->addr_len);
+  memcpy(ent + t->addr_len, high, t->addr_len);
+  set_uint32(ent + 2 * t->addr_len, htonl((uint32_t)country));
+  ++t->n_entries;
+
+  /* Any index we had is now out of date. */
+  tor_free(t->index_buf);
+  t->index = NULL;
+}
+
+/** Address length used by geoip_table_compare_entries_(), which qsort()
+ * cannot pass to it directly. */
+static size_t geoip_table_sort_addr_len = 0;
+
+/** qsort helper: compare two entries of a GeoIP table by their ip_low. */
+static int
+geoip_table_compare_entries_(const void *a, const void *b)
+{
+  return fast_memcmp(a, b, geoip_table_sort_addr_len);
+}
+
+/** Compute into <b>index</b>, which must have GEOIP_INDEX_LEN elements, the
+ * first-16-bits index for the sorted entries of <b>t</b>.  See
+ * geoip_table_t.index. */
+static void
+geoip_table_compute_index(const geoip_table_t *t, uint32_t *index)
+{
+  int i = 0;
+  unsigned p;
+  for (p = 0; p < GEOIP_INDEX_LEN; ++p) {
+    while (i < t->n_entries &&
+           geoip_addr_prefix16(geoip_table_entry(t, i) + t->addr_len) < p)
+      ++i;
+    index[p] = htonl((uint32_t)i);
+  }
+}
+
+/** Sort the heap-allocated table <b>t</b> if needed, and build its index, so
+ * that it is ready for lookups. */
+static void
+geoip_table_finish(geoip_table_t *t)
+{
+  tor_assert(!t->map);
+  if (!t->is_sorted) {
+    geoip_table_sort_addr_len = t->addr_len;
+    qsort(t->entries_buf, t->n_entries, t->entry_size,
+          geoip_table_compare_entries_);
+    t->is_sorted = 1;
+  }
+  if (!t->index_buf) {
+    t->index_buf = tor_calloc(GEOIP_INDEX_LEN, sizeof(uint32_t));
+    geoip_table_compute_index(t, t->index_buf);
+    t->index = t->index_buf;
+  }
+}
+
+/** Return the position in geoip_countries of the country for the address
+ * <b>addr</b> (<b>t</b>-&gt;addr_len bytes in network order) according to
+ * <b>t</b>, or 0 if no entry contains <b>addr</b>. */
+static int
+geoip_table_lookup(const geoip_table_t *t, const uint8_t *addr)
+{
+  int lo = 0, hi = t->n_entries;
+  const uint8_t *ent;
+  uint32_t country;
+
+  if (t->index) {
+    /* Only entries in this slice can end at or after addr while ending no
+     * later than the next 16-bit prefix. */
+    const unsigned p = geoip_addr_prefix16(addr);
+    lo = (int)ntohl(t->index[p]);
+    hi = (int)ntohl(t->index[p+1]);
+    if (hi < t->n_entries)
+      ++hi;
+  }
+
+  /* Find the first entry whose ip_high is at least addr.  The entries are
+   * disjoint and sorted, so it is the only one that might contain addr. */
+  while (lo < hi) {
+    const int mid = lo + (hi - lo) / 2;
+    if (fast_memcmp(geoip_table_entry(t, mid) + t->addr_len, addr,
+                    t->addr_len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo >= t->n_entries)
+    return 0;
+  ent = geoip_table_entry(t, lo);
+  if (fast_memcmp(ent, addr, t->addr_len) > 0)
+    return 0;
+
+  country = ntohl(geoip_table_entry_country(t, ent));
+  if (t->country_map) {
+    /* Checked when we loaded the file. */
+    tor_assert_nonfatal(country < (uint32_t)t->n_countries);
+    return country < (uint32_t)t->n_countries ? t->country_map[country] : 0;
+  }
+  return (int)country;
+}
+
+/** Add an entry to a GeoIP table, mapping all IP addresses between <b>low</b>
+ * and <b>high</b>, inclusive, to the 2-letter country code <b>country</b>. */
+static void
+geoip_add_entry(const tor_addr_t *low, const tor_addr_t *high,
+                const char *country)
+{
+  intptr_t idx;
+
+  IF_BUG_ONCE(tor_addr_family(low) != tor_addr_family(high))
+    return;
+  IF_BUG_ONCE(tor_addr_compare(high, low, CMP_EXACT) < 0)
+    return;
+
+  idx = geoip_get_or_add_country(country);
 
   if (tor_addr_family(low) == AF_INET) {
-    geoip_ipv4_entry_t *ent = tor_malloc_zero(sizeof(geoip_ipv4_entry_t));
-    ent->ip_low = tor_addr_to_ipv4h(low);
-    ent->ip_high = tor_addr_to_ipv4h(high);
-    ent->country = idx;
-    smartlist_add(geoip_ipv4_entries, ent);
+    uint32_t low_n = tor_addr_to_ipv4n(low);
+    uint32_t high_n = tor_addr_to_ipv4n(high);
+    geoip_table_add_entry(geoip_ipv4_table, (const uint8_t *)&low_n,
+                          (const uint8_t *)&high_n, idx);
   } else if (tor_addr_family(low) == AF_INET6) {
-    geoip_ipv6_entry_t *ent = tor_malloc_zero(sizeof(geoip_ipv6_entry_t));
-    ent->ip_low = *tor_addr_to_in6_assert(low);
-    ent->ip_high = *tor_addr_to_in6_assert(high);
-    ent->country = idx;
-    smartlist_add(geoip_ipv6_entries, ent);
+    geoip_table_add_entry(geoip_ipv6_table,
+                          tor_addr_to_in6_addr8(low),
+                          tor_addr_to_in6_addr8(high), idx);
   }
 }
 
@@ -180,11 +438,11 @@ geoip_parse_entry(const char *line, sa_family_t family)
   if (!geoip_countries)
     init_geoip_countries();
   if (family == AF_INET) {
-    if (!geoip_ipv4_entries)
-      geoip_ipv4_entries = smartlist_new();
+    if (!geoip_ipv4_table)
+      geoip_ipv4_table = geoip_table_new(AF_INET);
   } else if (family == AF_INET6) {
-    if (!geoip_ipv6_entries)
-      geoip_ipv6_entries = smartlist_new();
+    if (!geoip_ipv6_table)
+      geoip_ipv6_table = geoip_table_new(AF_INET6);
   } else {
     log_warn(LD_GENERAL, "Unsupported family: %d", family);
     return -1;
@@ -237,64 +495,6 @@ geoip_parse_entry(const char *line, sa_family_t family)
   return -1;
 }
 
-/** Sorting helper: return -1, 1, or 0 based on comparison of two
- * geoip_ipv4_entry_t */
-static int
-geoip_ipv4_compare_entries_(const void **_a, const void **_b)
-{
-  const geoip_ipv4_entry_t *a = *_a, *b = *_b;
-  if (a->ip_low < b->ip_low)
-    return -1;
-  else if (a->ip_low > b->ip_low)
-    return 1;
-  else
-    return 0;
-}
-
-/** bsearch helper: return -1, 1, or 0 based on comparison of an IP (a pointer
- * to a uint32_t in host order) to a geoip_ipv4_entry_t */
-static int
-geoip_ipv4_compare_key_to_entry_(const void *_key, const void **_member)
-{
-  /* No alignment issue here, since _key really is a pointer to uint32_t */
-  const uint32_t addr = *(uint32_t *)_key;
-  const geoip_ipv4_entry_t *entry = *_member;
-  if (addr < entry->ip_low)
-    return -1;
-  else if (addr > entry->ip_high)
-    return 1;
-  else
-    return 0;
-}
-
-/** Sorting helper: return -1, 1, or 0 based on comparison of two
- * geoip_ipv6_entry_t */
-static int
-geoip_ipv6_compare_entries_(const void **_a, const void **_b)
-{
-  const geoip_ipv6_entry_t *a = *_a, *b = *_b;
-  return fast_memcmp(a->ip_low.s6_addr, b->ip_low.s6_addr,
-                     sizeof(struct in6_addr));
-}
-
-/** bsearch helper: return -1, 1, or 0 based on comparison of an IPv6
- * (a pointer to a in6_addr) to a geoip_ipv6_entry_t */
-static int
-geoip_ipv6_compare_key_to_entry_(const void *_key, const void **_member)
-{
-  const struct in6_addr *addr = (struct in6_addr *)_key;
-  const geoip_ipv6_entry_t *entry = *_member;
-
-  if (fast_memcmp(addr->s6_addr, entry->ip_low.s6_addr,
-             sizeof(struct in6_addr)) < 0)
-    return -1;
-  else if (fast_memcmp(addr->s6_addr, entry->ip_high.s6_addr,
-                  sizeof(struct in6_addr)) > 0)
-    return 1;
-  else
-    return 0;
-}
-
 /** Return 1 if we should collect geoip stats on bridge users, and
  * include them in our extrainfo descriptor. Else return 0. */
 int
@@ -321,10 +521,137 @@ init_geoip_countries(void)
   strmap_set_lc(country_idxplus1_by_lc_code, "??", (void*)(1));
 }
 
+/** Return a pointer to the GeoIP table variable for <b>family</b>. */
+static geoip_table_t **
+geoip_table_ptr(sa_family_t family)
+{
+  return family == AF_INET ? &geoip_ipv4_table : &geoip_ipv6_table;
+}
+
+/** Return true iff the <b>size</b>-byte contents of <b>data</b> are a binary
+ * GeoIP file, as opposed to a text one. */
+STATIC int
+geoip_is_binary_file(const char *data, size_t size)
+{
+  return size >= GEOIP_BINARY_MAGIC_LEN &&
+    fast_memeq(data, GEOIP_BINARY_MAGIC, GEOIP_BINARY_MAGIC_LEN);
+}
+
+/** Check that the binary GeoIP file in <b>map</b> is well-formed and holds a
+ * table for <b>family</b>, and if so, return a new table that points into
+ * it and takes ownership of <b>map</b>, and set <b>digest_out</b> to the
+ * digest of the text file it was made from.  Otherwise, log a warning at
+ * <b>severity</b> mentioning <b>filename</b> and return NULL. */
+static geoip_table_t *
+geoip_table_new_from_binary(sa_family_t family, tor_mmap_t *map,
+                            const char *filename, int severity,
+                            char *digest_out)
+{
+  geoip_table_t *t = geoip_table_new(family);
+  const uint8_t *data = (const uint8_t *)map->data;
+  const char *problem = NULL;
+  uint32_t version, file_family, n_countries, n_entries;
+  size_t countries_len, expected_len;
+  uint32_t *expected_index = NULL;
+  int i;
+
+  if (map->size < GEOIP_BINARY_HEADER_LEN) {
+    problem = "truncated header";
+    goto err;
+  }
+  version = ntohl(get_uint32(data + GEOIP_BINARY_MAGIC_LEN));
+  file_family = ntohl(get_uint32(data + GEOIP_BINARY_MAGIC_LEN + 4));
+  n_countries = ntohl(get_uint32(data + GEOIP_BINARY_MAGIC_LEN + 8));
+  n_entries = ntohl(get_uint32(data + GEOIP_BINARY_MAGIC_LEN + 12));
+  if (version != GEOIP_BINARY_VERSION) {
+    problem = "unsupported version";
+    goto err;
+  }
+  if (file_family != (family == AF_INET ? 4 : 6)) {
+    problem = "wrong address family";
+    goto err;
+  }
+  if (n_countries > UINT16_MAX || n_entries > INT_MAX / t->entry_size) {
+    problem = "too many entries";
+    goto err;
+  }
+
+  /* Country codes are 2 bytes each, padded to a multiple of 4 so that the
+   * index and the entries stay aligned. */
+  countries_len = (2 * (size_t)n_countries + 3) & ~(size_t)3;
+  expected_len = GEOIP_BINARY_HEADER_LEN + countries_len +
+    GEOIP_INDEX_LEN * sizeof(uint32_t) + n_entries * t->entry_size;
+  if (map->size != expected_len) {
+    problem = "wrong length";
+    goto err;
+  }
+
+  t->n_countries = (int)n_countries;
+  t->country_map = tor_calloc(n_countries ? n_countries : 1,
+                              sizeof(country_t));
+  for (i = 0; i < t->n_countries; ++i) {
+    const char *cc = (const char *)data + GEOIP_BINARY_HEADER_LEN + 2*i;
+    char code[3];
+    if (!TOR_ISALPHA(cc[0]) || !TOR_ISALPHA(cc[1])) {
+      if (!(cc[0] == '?' && cc[1] == '?')) {
+        problem = "invalid country code";
+        goto err;
+      }
+    }
+    memcpy(code, cc, 2);
+    code[2] = '\0';
+    t->country_map[i] = (country_t)geoip_get_or_add_country(code);
+  }
+
+  t->index = (const uint32_t *)
+    (data + GEOIP_BINARY_HEADER_LEN + countries_len);
+  t->entries = (const uint8_t *)(t->index + GEOIP_INDEX_LEN);
+  t->n_entries = (int)n_entries;
+
+  /* Check that the entries are sorted, disjoint, and well-formed, and that
+   * the index matches them, so that lookups can trust both. */
+  for (i = 0; i < t->n_entries; ++i) {
+    const uint8_t *ent = geoip_table_entry(t, i);
+    if (fast_memcmp(ent, ent + t->addr_len, t->addr_len) > 0 ||
+        (i && fast_memcmp(geoip_table_entry(t, i-1) + t->addr_len, ent,
+                          t->addr_len) >= 0)) {
+      problem = "unsorted or overlapping entries";
+      goto err;
+    }
+    if (ntohl(geoip_table_entry_country(t, ent)) >= n_countries) {
+      problem = "invalid country index";
+      goto err;
+    }
+  }
+  expected_index = tor_calloc(GEOIP_INDEX_LEN, sizeof(uint32_t));
+  geoip_table_compute_index(t, expected_index);
+  if (!fast_memeq(expected_index, t->index,
+                  GEOIP_INDEX_LEN * sizeof(uint32_t))) {
+    problem = "index does not match entries";
+    goto err;
+  }
+  tor_free(expected_index);
+
+  memcpy(digest_out, data + GEOIP_BINARY_MAGIC_LEN + 16, DIGEST_LEN);
+  t->map = map;
+  return t;
+
+ err:
+  log_fn(severity, LD_GENERAL, "Binary GEOIP file %s is not usable: %s.",
+         filename, problem);
+  tor_free(expected_index);
+  geoip_table_free(t);
+  return NULL;
+}
+
 /** Clear appropriate GeoIP database, based on <b>family</b>, and
  * reload it from the file <b>filename</b>. Return 0 on success, -1 on
  * failure.
  *
+ * The file may be a binary GeoIP file, as written by mmdb-convert.py, in
+ * which case we map it into memory and use it in place.  Otherwise it is a
+ * text file.
+ *
  * Recognized line formats for IPv4 are:
  *   INTIPLOW,INTIPHIGH,CC
  * and
@@ -347,8 +674,38 @@ geoip_load_file(sa_family_t family, const char *filename)
   const or_options_t *options = get_options();
   int severity = options_need_geoip_info(options, &msg) ? LOG_WARN : LOG_INFO;
   crypto_digest_t *geoip_digest_env = NULL;
+  geoip_table_t **tablep;
+  tor_mmap_t *map;
 
   tor_assert(family == AF_INET || family == AF_INET6);
+  tablep = geoip_table_ptr(family);
+
+  map = tor_mmap_file(filename);
+  if (map && geoip_is_binary_file(map->data, map->size)) {
+    geoip_table_t *t;
+    char digest[DIGEST_LEN];
+    if (!geoip_countries)
+      init_geoip_countries();
+    log_notice(LD_GENERAL, "Mapping binary GEOIP %s file %s.",
+               (family == AF_INET) ? "IPv4" : "IPv6", filename);
+    t = geoip_table_new_from_binary(family, map, filename, severity,
+                                    digest);
+    if (!t) {
+      tor_munmap_file(map);
+      return -1;
+    }
+    geoip_table_free(*tablep);
+    *tablep = t;
+    if (family == AF_INET) {
+      refresh_all_country_info();
+      memcpy(geoip_digest, digest, DIGEST_LEN);
+    } else {
+      memcpy(geoip6_digest, digest, DIGEST_LEN);
+    }
+    return 0;
+  }
+  if (map)
+    tor_munmap_file(map);
 
   if (!(f = tor_fopen_cloexec(filename, "r"))) {
     log_fn(severity, LD_GENERAL, "Failed to open GEOIP file %s.  %s",
@@ -358,21 +715,8 @@ geoip_load_file(sa_family_t family, const char *filename)
   if (!geoip_countries)
     init_geoip_countries();
 
-  if (family == AF_INET) {
-    if (geoip_ipv4_entries) {
-      SMARTLIST_FOREACH(geoip_ipv4_entries, geoip_ipv4_entry_t *, e,
-                        tor_free(e));
-      smartlist_free(geoip_ipv4_entries);
-    }
-    geoip_ipv4_entries = smartlist_new();
-  } else { /* AF_INET6 */
-    if (geoip_ipv6_entries) {
-      SMARTLIST_FOREACH(geoip_ipv6_entries, geoip_ipv6_entry_t *, e,
-                        tor_free(e));
-      smartlist_free(geoip_ipv6_entries);
-    }
-    geoip_ipv6_entries = smartlist_new();
-  }
+  geoip_table_free(*tablep);
+  *tablep = geoip_table_new(family);
   geoip_digest_env = crypto_digest_new();
 
   log_notice(LD_GENERAL, "Parsing GEOIP %s file %s.",
@@ -388,10 +732,10 @@ geoip_load_file(sa_family_t family, const char *filename)
   /*XXXX abort and return -1 if no entries/illformed?*/
   fclose(f);
 
-  /* Sort list and remember file digests so that we can include it in
-   * our extra-info descriptors. */
+  /* Sort the table and build its index, and remember file digests so that we
+   * can include it in our extra-info descriptors. */
+  geoip_table_finish(*tablep);
   if (family == AF_INET) {
-    smartlist_sort(geoip_ipv4_entries, geoip_ipv4_compare_entries_);
     /* Okay, now we need to maybe change our mind about what is in
      * which country. We do this for IPv4 only since that's what we
      * store in node->country. */
@@ -399,7 +743,6 @@ geoip_load_file(sa_family_t family, const char *filename)
     crypto_digest_get_digest(geoip_digest_env, geoip_digest, DIGEST_LEN);
   } else {
     /* AF_INET6 */
-    smartlist_sort(geoip_ipv6_entries, geoip_ipv6_compare_entries_);
     crypto_digest_get_digest(geoip_digest_env, geoip6_digest, DIGEST_LEN);
   }
   crypto_digest_free(geoip_digest_env);
@@ -416,12 +759,11 @@ geoip_load_file(sa_family_t family, const char *filename)
 STATIC int
 geoip_get_country_by_ipv4(uint32_t ipaddr)
 {
-  geoip_ipv4_entry_t *ent;
-  if (!geoip_ipv4_entries)
+  uint32_t addr_n;
+  if (!geoip_ipv4_table)
     return -1;
-  ent = smartlist_bsearch(geoip_ipv4_entries, &ipaddr,
-                          geoip_ipv4_compare_key_to_entry_);
-  return ent ? (int)ent->country : 0;
+  addr_n = htonl(ipaddr);
+  return geoip_table_lookup(geoip_ipv4_table, (const uint8_t *)&addr_n);
 }
 
 /** Given an IPv6 address, return a number representing the country to
@@ -432,13 +774,9 @@ geoip_get_country_by_ipv4(uint32_t ipaddr)
 STATIC int
 geoip_get_country_by_ipv6(const struct in6_addr *addr)
 {
-  geoip_ipv6_entry_t *ent;
-
-  if (!geoip_ipv6_entries)
+  if (!geoip_ipv6_table)
     return -1;
-  ent = smartlist_bsearch(geoip_ipv6_entries, addr,
-                          geoip_ipv6_compare_key_to_entry_);
-  return ent ? (int)ent->country : 0;
+  return geoip_table_lookup(geoip_ipv6_table, addr->s6_addr);
 }
 
 /** Given an IP address, return a number representing the country to which
@@ -486,10 +824,7 @@ geoip_is_loaded,(sa_family_t family))
   tor_assert(family == AF_INET || family == AF_INET6);
   if (geoip_countries == NULL)
     return 0;
-  if (family == AF_INET)
-    return geoip_ipv4_entries != NULL;
-  else                          /* AF_INET6 */
-    return geoip_ipv6_entries != NULL;
+  return *geoip_table_ptr(family) != NULL;
 }
 
 /** Return the hex-encoded SHA1 digest of the loaded GeoIP file. The
@@ -1839,20 +2174,12 @@ clear_geoip_db(void)
   }
 
   strmap_free(country_idxplus1_by_lc_code, NULL);
-  if (geoip_ipv4_entries) {
-    SMARTLIST_FOREACH(geoip_ipv4_entries, geoip_ipv4_entry_t *, ent,
-                      tor_free(ent));
-    smartlist_free(geoip_ipv4_entries);
-  }
-  if (geoip_ipv6_entries) {
-    SMARTLIST_FOREACH(geoip_ipv6_entries, geoip_ipv6_entry_t *, ent,
-                      tor_free(ent));
-    smartlist_free(geoip_ipv6_entries);
-  }
+  geoip_table_free(geoip_ipv4_table);
+  geoip_table_free(geoip_ipv6_table);
   geoip_countries = NULL;
   country_idxplus1_by_lc_code = NULL;
-  geoip_ipv4_entries = NULL;
-  geoip_ipv6_entries = NULL;
+  geoip_ipv4_table = NULL;
+  geoip_ipv6_table = NULL;
 }
 
 /** Release all storage held in this file. */
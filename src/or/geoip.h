@@ -20,6 +20,7 @@ STATIC int geoip_parse_entry(const char *line, sa_family_t family);
 STATIC int geoip_get_country_by_ipv4(uint32_t ipaddr);
 STATIC int geoip_get_country_by_ipv6(const struct in6_addr *addr);
 STATIC void clear_geoip_db(void);
+STATIC int geoip_is_binary_file(const char *data, size_t size);
 #endif /* defined(GEOIP_PRIVATE) */
 
 /** Entry in a map from IP address to the last time we've seen an incoming
@@ -31,12 +31,69 @@ static int cached_client_descriptor_has_expired(time_t now,
 /* Directory descriptor cache. Map indexed by blinded key. */
 static digest256map_t *hs_cache_v3_dir;
 
+/* Priority queues of the entries of hs_cache_v3_dir, oldest first and first
+ * to expire first. Cleaning and OOM handling pop entries from them so they
+ * only cost as much as what they remove. */
+static smartlist_t *hs_cache_v3_dir_by_age;
+static smartlist_t *hs_cache_v3_dir_by_expiry;
+
+/* Return the size of a cache entry in bytes. */
+static size_t
+cache_get_dir_entry_size(const hs_cache_dir_descriptor_t *entry)
+{
+  return (sizeof(*entry) + hs_desc_plaintext_obj_size(entry->plaintext_data)
+          + strlen(entry->encoded_desc));
+}
+
+/* Helper: compare two directory cache entries by creation time. */
+static int
+compare_dir_desc_created_ts_(const void *a_, const void *b_)
+{
+  const hs_cache_dir_descriptor_t *a = a_, *b = b_;
+  if (a->created_ts < b->created_ts) {
+    return -1;
+  } else if (a->created_ts > b->created_ts) {
+    return 1;
+  }
+  return 0;
+}
+
+/* Return the time at which the directory cache entry desc expires. */
+static inline time_t
+dir_desc_expiry_ts(const hs_cache_dir_descriptor_t *desc)
+{
+  return desc->created_ts + desc->plaintext_data->lifetime_sec;
+}
+
+/* Helper: compare two directory cache entries by expiry time. */
+static int
+compare_dir_desc_expiry_ts_(const void *a_, const void *b_)
+{
+  time_t a = dir_desc_expiry_ts(a_), b = dir_desc_expiry_ts(b_);
+  if (a < b) {
+    return -1;
+  } else if (a > b) {
+    return 1;
+  }
+  return 0;
+}
+
 /* Remove a given descriptor from our cache. */
 static void
-remove_v3_desc_as_dir(const hs_cache_dir_descriptor_t *desc)
+remove_v3_desc_as_dir(hs_cache_dir_descriptor_t *desc)
 {
   tor_assert(desc);
   digest256map_remove(hs_cache_v3_dir, desc->key);
+  smartlist_pqueue_remove(hs_cache_v3_dir_by_age,
+                          compare_dir_desc_created_ts_,
+                          offsetof(hs_cache_dir_descriptor_t, age_idx), desc);
+  smartlist_pqueue_remove(hs_cache_v3_dir_by_expiry,
+                          compare_dir_desc_expiry_ts_,
+                          offsetof(hs_cache_dir_descriptor_t, expiry_idx),
+                          desc);
+  /* Update our total cache size with this entry for the OOM. This uses the
+   * old HS protocol cache subsystem for which we are tied with. */
+  rend_cache_decrement_allocation(desc->n_bytes);
 }
 
 /* Store a given descriptor in our cache. */
@@ -45,6 +102,15 @@ store_v3_desc_as_dir(hs_cache_dir_descriptor_t *desc)
 {
   tor_assert(desc);
   digest256map_set(hs_cache_v3_dir, desc->key, desc);
+  smartlist_pqueue_add(hs_cache_v3_dir_by_age,
+                       compare_dir_desc_created_ts_,
+                       offsetof(hs_cache_dir_descriptor_t, age_idx), desc);
+  smartlist_pqueue_add(hs_cache_v3_dir_by_expiry,
+                       compare_dir_desc_expiry_ts_,
+                       offsetof(hs_cache_dir_descriptor_t, expiry_idx), desc);
+  /* Update our total cache size with this entry for the OOM. */
+  desc->n_bytes = cache_get_dir_entry_size(desc);
+  rend_cache_increment_allocation(desc->n_bytes);
 }
 
 /* Query our cache and return the entry or NULL if not found. */
@@ -106,14 +172,6 @@ cache_dir_desc_new(const char *desc)
   return NULL;
 }
 
-/* Return the size of a cache entry in bytes. */
-static size_t
-cache_get_dir_entry_size(const hs_cache_dir_descriptor_t *entry)
-{
-  return (sizeof(*entry) + hs_desc_plaintext_obj_size(entry->plaintext_data)
-          + strlen(entry->encoded_desc));
-}
-
 /* Try to store a valid version 3 descriptor in the directory cache. Return 0
  * on success else a negative value is returned indicating that we have a
  * newer version in our cache. On error, caller is responsible to free the
@@ -192,7 +250,6 @@ cache_store_v3_as_dir(hs_cache_dir_descriptor_t *desc)
      * remove the entry we currently have from our cache so we can then
      * store the new one. */
     remove_v3_desc_as_dir(cache_entry);
-    rend_cache_decrement_allocation(cache_get_dir_entry_size(cache_entry));
     cache_dir_desc_free(cache_entry);
   }
   /* Store the descriptor we just got. We are sure here that either we
@@ -200,10 +257,6 @@ cache_store_v3_as_dir(hs_cache_dir_descriptor_t *desc)
    * has been removed from the cache. */
   store_v3_desc_as_dir(desc);
 
-  /* Update our total cache size with this entry for the OOM. This uses the
-   * old HS protocol cache subsystem for which we are tied with. */
-  rend_cache_increment_allocation(cache_get_dir_entry_size(desc));
-
   /* XXX: Update HS statistics. We should have specific stats for v3. */
 
   if (options->EnablePrivCount) {
@@ -336,6 +389,22 @@ cache_lookup_v3_as_dir(const char *query, const char **desc_out)
   return -1;
 }
 
+/* Remove the given entry from the v3 directory cache, log it, and free it.
+ * Return the number of bytes it accounted for. */
+static size_t
+cache_dir_desc_evict(hs_cache_dir_descriptor_t *entry)
+{
+  size_t entry_size = entry->n_bytes;
+  char key_b64[BASE64_DIGEST256_LEN + 1];
+
+  digest256_to_base64(key_b64, (const char *) entry->key);
+  log_info(LD_REND, "Removing v3 descriptor '%s' from HSDir cache",
+           safe_str_client(key_b64));
+  remove_v3_desc_as_dir(entry);
+  cache_dir_desc_free(entry);
+  return entry_size;
+}
+
 /* Clean the v3 cache by removing any entry that has expired using the
  * <b>global_cutoff</b> value. If <b>global_cutoff</b> is 0, the cleaning
  * process will use the lifetime found in the plaintext data section. Return
@@ -352,36 +421,32 @@ cache_clean_v3_as_dir(time_t now, time_t global_cutoff)
     return 0;
   }
 
-  DIGEST256MAP_FOREACH_MODIFY(hs_cache_v3_dir, key,
-                              hs_cache_dir_descriptor_t *, entry) {
-    size_t entry_size;
-    time_t cutoff = global_cutoff;
-    if (!cutoff) {
-      /* Cutoff is the lifetime of the entry found in the descriptor. */
-      cutoff = now - entry->plaintext_data->lifetime_sec;
-    }
-
-    /* If the entry has been created _after_ the cutoff, not expired so
-     * continue to the next entry in our v3 cache. */
-    if (entry->created_ts > cutoff) {
-      continue;
+  while (1) {
+    hs_cache_dir_descriptor_t *entry;
+    if (global_cutoff) {
+      /* Oldest entry first: stop at the first one created _after_ the
+       * cutoff. */
+      if (smartlist_len(hs_cache_v3_dir_by_age) == 0) {
+        break;
+      }
+      entry = smartlist_get(hs_cache_v3_dir_by_age, 0);
+      if (entry->created_ts > global_cutoff) {
+        break;
+      }
+    } else {
+      /* Cutoff is the lifetime of the entry found in the descriptor: stop at
+       * the first one that hasn't expired. */
+      if (smartlist_len(hs_cache_v3_dir_by_expiry) == 0) {
+        break;
+      }
+      entry = smartlist_get(hs_cache_v3_dir_by_expiry, 0);
+      if (entry->created_ts > now - entry->plaintext_data->lifetime_sec) {
+        break;
+      }
     }
     /* Here, our entry has expired, remove and free. */
-    MAP_DEL_CURRENT(key);
-    entry_size = cache_get_dir_entry_size(entry);
-    bytes_removed += entry_size;
-    /* Entry is not in the cache anymore, destroy it. */
-    cache_dir_desc_free(entry);
-    /* Update our cache entry allocation size for the OOM. */
-    rend_cache_decrement_allocation(entry_size);
-    /* Logging. */
-    {
-      char key_b64[BASE64_DIGEST256_LEN + 1];
-      digest256_to_base64(key_b64, (const char *) key);
-      log_info(LD_REND, "Removing v3 descriptor '%s' from HSDir cache",
-               safe_str_client(key_b64));
-    }
-  } DIGEST256MAP_FOREACH_END;
+    bytes_removed += cache_dir_desc_evict(entry);
+  }
 
   return bytes_removed;
 }
@@ -486,6 +551,10 @@ hs_cache_clean_as_dir(time_t now)
 /* Client-side HS descriptor cache. Map indexed by service identity key. */
 static digest256map_t *hs_cache_v3_client;
 
+/* Priority queue of the entries of hs_cache_v3_client, first to expire
+ * first. */
+static smartlist_t *hs_cache_v3_client_by_expiry;
+
 /* Client-side introduction point state cache. Map indexed by service public
  * identity key (onion address). It contains hs_cache_client_intro_state_t
  * objects all related to a specific service. */
@@ -499,14 +568,31 @@ cache_get_client_entry_size(const hs_cache_client_descriptor_t *entry)
          strlen(entry->encoded_desc) + hs_desc_obj_size(entry->desc);
 }
 
+/* Helper: compare two client cache entries by expiry time. */
+static int
+compare_client_desc_expiration_ts_(const void *a_, const void *b_)
+{
+  const hs_cache_client_descriptor_t *a = a_, *b = b_;
+  if (a->expiration_ts < b->expiration_ts) {
+    return -1;
+  } else if (a->expiration_ts > b->expiration_ts) {
+    return 1;
+  }
+  return 0;
+}
+
 /* Remove a given descriptor from our cache. */
 static void
-remove_v3_desc_as_client(const hs_cache_client_descriptor_t *desc)
+remove_v3_desc_as_client(hs_cache_client_descriptor_t *desc)
 {
   tor_assert(desc);
   digest256map_remove(hs_cache_v3_client, desc->key.pubkey);
+  smartlist_pqueue_remove(hs_cache_v3_client_by_expiry,
+                          compare_client_desc_expiration_ts_,
+                          offsetof(hs_cache_client_descriptor_t, expiry_idx),
+                          desc);
   /* Update cache size with this entry for the OOM handler. */
-  rend_cache_decrement_allocation(cache_get_client_entry_size(desc));
+  rend_cache_decrement_allocation(desc->n_bytes);
 }
 
 /* Store a given descriptor in our cache. */
@@ -515,8 +601,13 @@ store_v3_desc_as_client(hs_cache_client_descriptor_t *desc)
 {
   tor_assert(desc);
   digest256map_set(hs_cache_v3_client, desc->key.pubkey, desc);
+  smartlist_pqueue_add(hs_cache_v3_client_by_expiry,
+                       compare_client_desc_expiration_ts_,
+                       offsetof(hs_cache_client_descriptor_t, expiry_idx),
+                       desc);
   /* Update cache size with this entry for the OOM handler. */
-  rend_cache_increment_allocation(cache_get_client_entry_size(desc));
+  desc->n_bytes = cache_get_client_entry_size(desc);
+  rend_cache_increment_allocation(desc->n_bytes);
 }
 
 /* Query our cache and return the entry or NULL if not found or if expired. */
@@ -835,32 +926,29 @@ cache_clean_v3_as_client(time_t now)
     return 0;
   }
 
-  DIGEST256MAP_FOREACH_MODIFY(hs_cache_v3_client, key,
-                              hs_cache_client_descriptor_t *, entry) {
-    size_t entry_size;
+  /* Entries expire in the order of their expiration time so stop at the
+   * first one that hasn't. */
+  while (smartlist_len(hs_cache_v3_client_by_expiry) > 0) {
+    hs_cache_client_descriptor_t *entry =
+      smartlist_get(hs_cache_v3_client_by_expiry, 0);
 
-    /* If the entry has not expired, continue to the next cached entry */
     if (!cached_client_descriptor_has_expired(now, entry)) {
-      continue;
+      break;
     }
     /* Here, our entry has expired, remove and free. */
-    MAP_DEL_CURRENT(key);
-    entry_size = cache_get_client_entry_size(entry);
-    bytes_removed += entry_size;
-    /* Entry is not in the cache anymore, destroy it. */
-    cache_client_desc_free(entry);
-    /* Update our OOM. We didn't use the remove() function because we are in
-     * a loop so we have to explicitely decrement. */
-    rend_cache_decrement_allocation(entry_size);
+    bytes_removed += entry->n_bytes;
     /* Logging. */
     {
       char key_b64[BASE64_DIGEST256_LEN + 1];
-      digest256_to_base64(key_b64, (const char *) key);
+      digest256_to_base64(key_b64, (const char *) entry->key.pubkey);
       log_info(LD_REND, "Removing hidden service v3 descriptor '%s' "
                         "from client cache",
                safe_str_client(key_b64));
     }
-  } DIGEST256MAP_FOREACH_END;
+    remove_v3_desc_as_client(entry);
+    /* Entry is not in the cache anymore, destroy it. */
+    cache_client_desc_free(entry);
+  }
 
   return bytes_removed;
 }
@@ -931,13 +1019,15 @@ hs_cache_purge_as_client(void)
 {
   DIGEST256MAP_FOREACH_MODIFY(hs_cache_v3_client, key,
                               hs_cache_client_descriptor_t *, entry) {
-    size_t entry_size = cache_get_client_entry_size(entry);
+    size_t entry_size = entry->n_bytes;
     MAP_DEL_CURRENT(key);
     cache_client_desc_free(entry);
     /* Update our OOM. We didn't use the remove() function because we are in
      * a loop so we have to explicitely decrement. */
     rend_cache_decrement_allocation(entry_size);
   } DIGEST256MAP_FOREACH_END;
+  /* Every entry is gone so there's nothing left to order. */
+  smartlist_clear(hs_cache_v3_client_by_expiry);
 
   log_info(LD_REND, "Hidden service client descriptor cache purged.");
 }
@@ -1018,49 +1108,39 @@ hs_cache_client_intro_state_purge(void)
 size_t
 hs_cache_handle_oom(time_t now, size_t min_remove_bytes)
 {
-  time_t k;
   size_t bytes_removed = 0;
 
   /* Our OOM handler called with 0 bytes to remove is a code flow error. */
   tor_assert(min_remove_bytes != 0);
+  /* Ages are compared between entries so we don't need the time. */
+  (void) now;
 
-  /* The algorithm is as follow. K is the oldest expected descriptor age.
+  /* The algorithm is as follow: remove the oldest entry of either the v2 or
+   * the v3 cache, using the v2 descriptor timestamp and the v3 creation time
+   * as their age, until enough bytes are removed or both caches are empty.
+   * On a tie, the v2 entry goes first.
    *
-   *   1) Deallocate all entries from v2 cache that are older than K hours.
-   *      1.1) If the amount of remove bytes has been reached, stop.
-   *   2) Deallocate all entries from v3 cache that are older than K hours
-   *      2.1) If the amount of remove bytes has been reached, stop.
-   *   3) Set K = K - RendPostPeriod and repeat process until K is < 0.
-   *
-   * This ends up being O(Kn).
-   */
-
-  /* Set K to the oldest expected age in seconds which is the maximum
-   * lifetime of a cache entry. We'll use the v2 lifetime because it's much
-   * bigger than the v3 thus leading to cleaning older descriptors. */
-  k = rend_cache_max_entry_lifetime();
-
-  do {
-    time_t cutoff;
-
-    /* If K becomes negative, it means we've empty the caches so stop and
-     * return what we were able to cleanup. */
-    if (k < 0) {
+   * Both caches keep their entries in a priority queue by age, so this is
+   * O(m log n) for the m entries we remove. */
+  while (bytes_removed < min_remove_bytes) {
+    time_t v2_oldest = 0;
+    int have_v2 = rend_cache_get_oldest_v2_desc_as_dir(&v2_oldest);
+    hs_cache_dir_descriptor_t *v3_oldest = NULL;
+
+    if (hs_cache_v3_dir_by_age &&
+        smartlist_len(hs_cache_v3_dir_by_age) > 0) {
+      v3_oldest = smartlist_get(hs_cache_v3_dir_by_age, 0);
+    }
+    if (!have_v2 && !v3_oldest) {
+      /* Both caches are empty: return what we were able to cleanup. */
       break;
     }
-    /* Compute a cutoff value with K and the current time. */
-    cutoff = now - k;
-
-    /* Start by cleaning the v2 cache with that cutoff. */
-    bytes_removed += rend_cache_clean_v2_descs_as_dir(cutoff);
-
-    if (bytes_removed < min_remove_bytes) {
-      /* We haven't remove enough bytes so clean v3 cache. */
-      bytes_removed += cache_clean_v3_as_dir(now, cutoff);
-      /* Decrement K by a post period to shorten the cutoff. */
-      k -= get_options()->RendPostPeriod;
+    if (have_v2 && (!v3_oldest || v2_oldest <= v3_oldest->created_ts)) {
+      bytes_removed += rend_cache_remove_oldest_v2_desc_as_dir();
+    } else {
+      bytes_removed += cache_dir_desc_evict(v3_oldest);
     }
-  } while (bytes_removed < min_remove_bytes);
+  }
 
   return bytes_removed;
 }
@@ -1081,9 +1161,12 @@ hs_cache_init(void)
   /* Calling this twice is very wrong code flow. */
   tor_assert(!hs_cache_v3_dir);
   hs_cache_v3_dir = digest256map_new();
+  hs_cache_v3_dir_by_age = smartlist_new();
+  hs_cache_v3_dir_by_expiry = smartlist_new();
 
   tor_assert(!hs_cache_v3_client);
   hs_cache_v3_client = digest256map_new();
+  hs_cache_v3_client_by_expiry = smartlist_new();
 
   tor_assert(!hs_cache_client_intro_state);
   hs_cache_client_intro_state = digest256map_new();
@@ -1095,9 +1178,15 @@ hs_cache_free_all(void)
 {
   digest256map_free(hs_cache_v3_dir, cache_dir_desc_free_);
   hs_cache_v3_dir = NULL;
+  smartlist_free(hs_cache_v3_dir_by_age);
+  hs_cache_v3_dir_by_age = NULL;
+  smartlist_free(hs_cache_v3_dir_by_expiry);
+  hs_cache_v3_dir_by_expiry = NULL;
 
   digest256map_free(hs_cache_v3_client, cache_client_desc_free_);
   hs_cache_v3_client = NULL;
+  smartlist_free(hs_cache_v3_client_by_expiry);
+  hs_cache_v3_client_by_expiry = NULL;
 
   digest256map_free(hs_cache_client_intro_state,
                     cache_client_intro_state_free_);
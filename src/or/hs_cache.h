@@ -61,6 +61,15 @@ typedef struct hs_cache_dir_descriptor_t {
   /* Encoded descriptor which is basically in text form. It's a NUL terminated
    * string thus safe to strlen(). */
   char *encoded_desc;
+
+  /* Number of bytes this entry accounts for in the cache allocation. Set
+   * when the entry is stored so we remove exactly what we added. */
+  size_t n_bytes;
+
+  /* Positions of this entry in the priority queues of the cache by creation
+   * time and by expiry time. */
+  int age_idx;
+  int expiry_idx;
 } hs_cache_dir_descriptor_t;
 
 /* Public API */
@@ -114,6 +123,14 @@ typedef struct hs_cache_client_descriptor_t {
 
   /* Encoded descriptor in string form. Can't be NULL. */
   char *encoded_desc;
+
+  /* Number of bytes this entry accounts for in the cache allocation. Set
+   * when the entry is stored so we remove exactly what we added. */
+  size_t n_bytes;
+
+  /* Position of this entry in the priority queue of the cache by expiry
+   * time. */
+  int expiry_idx;
 } hs_cache_client_descriptor_t;
 
 STATIC size_t cache_clean_v3_as_dir(time_t now, time_t global_cutoff);
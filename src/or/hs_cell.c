@@ -137,24 +137,23 @@ decrypt_introduce2(const uint8_t *enc_key, const uint8_t *encrypted_section,
 /* Given a pointer to the decrypted data of the ENCRYPTED section of an
  * INTRODUCE2 cell of length decrypted_len, parse and validate the cell
  * content. Return a newly allocated cell structure or NULL on error. The
- * circuit and service object are only used for logging purposes. */
+ * circuit id and onion address, already scrubbed for logging, are only used
+ * for logging purposes so this can be called from any thread. */
 static trn_cell_introduce_encrypted_t *
 parse_introduce2_encrypted(const uint8_t *decrypted_data,
-                           size_t decrypted_len, const origin_circuit_t *circ,
-                           const hs_service_t *service)
+                           size_t decrypted_len, uint32_t circ_id,
+                           const char *onion_address)
 {
   trn_cell_introduce_encrypted_t *enc_cell = NULL;
 
   tor_assert(decrypted_data);
-  tor_assert(circ);
-  tor_assert(service);
+  tor_assert(onion_address);
 
   if (trn_cell_introduce_encrypted_parse(&enc_cell, decrypted_data,
                                          decrypted_len) < 0) {
     log_info(LD_REND, "Unable to parse the decrypted ENCRYPTED section of "
                       "the INTRODUCE2 cell on circuit %u for service %s",
-             TO_CIRCUIT(circ)->n_circ_id,
-             safe_str_client(service->onion_address));
+             circ_id, onion_address);
     goto err;
   }
 
@@ -163,8 +162,7 @@ parse_introduce2_encrypted(const uint8_t *decrypted_data,
     log_info(LD_REND, "INTRODUCE2 onion key type is invalid. Got %u but "
                       "expected %u on circuit %u for service %s",
              trn_cell_introduce_encrypted_get_onion_key_type(enc_cell),
-             HS_CELL_ONION_KEY_TYPE_NTOR, TO_CIRCUIT(circ)->n_circ_id,
-             safe_str_client(service->onion_address));
+             HS_CELL_ONION_KEY_TYPE_NTOR, circ_id, onion_address);
     goto err;
   }
 
@@ -173,8 +171,7 @@ parse_introduce2_encrypted(const uint8_t *decrypted_data,
     log_info(LD_REND, "INTRODUCE2 onion key length is invalid. Got %u but "
                       "expected %d on circuit %u for service %s",
              (unsigned)trn_cell_introduce_encrypted_getlen_onion_key(enc_cell),
-             CURVE25519_PUBKEY_LEN, TO_CIRCUIT(circ)->n_circ_id,
-             safe_str_client(service->onion_address));
+             CURVE25519_PUBKEY_LEN, circ_id, onion_address);
     goto err;
   }
   /* XXX: Validate NSPEC field as well. */
@@ -208,8 +205,9 @@ build_legacy_establish_intro(const char *circ_nonce, crypto_pk_t *enc_key,
 }
 
 /* Parse an INTRODUCE2 cell from payload of size payload_len for the given
- * service and circuit which are used only for logging purposes. The resulting
- * parsed cell is put in cell_ptr_out.
+ * circuit id and onion address, already scrubbed for logging, which are used
+ * only for logging purposes. The resulting parsed cell is put in
+ * cell_ptr_out.
  *
  * This function only parses prop224 INTRODUCE2 cells even when the intro point
  * is a legacy intro point. That's because intro points don't actually care
@@ -218,24 +216,20 @@ build_legacy_establish_intro(const char *circ_nonce, crypto_pk_t *enc_key,
  *
  * Return 0 on success else a negative value and cell_ptr_out is untouched. */
 static int
-parse_introduce2_cell(const hs_service_t *service,
-                      const origin_circuit_t *circ, const uint8_t *payload,
-                      size_t payload_len,
+parse_introduce2_cell(uint32_t circ_id, const char *onion_address,
+                      const uint8_t *payload, size_t payload_len,
                       trn_cell_introduce1_t **cell_ptr_out)
 {
   trn_cell_introduce1_t *cell = NULL;
 
-  tor_assert(service);
-  tor_assert(circ);
+  tor_assert(onion_address);
   tor_assert(payload);
   tor_assert(cell_ptr_out);
 
   /* Parse the cell so we can start cell validation. */
   if (trn_cell_introduce1_parse(&cell, payload, payload_len) < 0) {
     log_info(LD_PROTOCOL, "Unable to parse INTRODUCE2 cell on circuit %u "
-                          "for service %s",
-             TO_CIRCUIT(circ)->n_circ_id,
-             safe_str_client(service->onion_address));
+                          "for service %s", circ_id, onion_address);
     goto err;
   }
 
@@ -618,31 +612,30 @@ hs_cell_parse_intro_established(const uint8_t *payload, size_t payload_len)
   return ret;
 }
 
-/* Parsse the INTRODUCE2 cell using data which contains everything we need to
- * do so and contains the destination buffers of information we extract and
- * compute from the cell. Return 0 on success else a negative value. The
- * service and circ are only used for logging purposes. */
+/* Do the checks of an INTRODUCE2 cell that must happen on the main thread,
+ * before any expensive computation: parse the cell found in data, validate
+ * the length of its ENCRYPTED section and add it to the replay cache of the
+ * introduction point. Return 0 if the cell is worth decrypting else a
+ * negative value. The service and circ are only used for logging purposes. */
 ssize_t
-hs_cell_parse_introduce2(hs_cell_introduce2_data_t *data,
+hs_cell_check_introduce2(const hs_cell_introduce2_data_t *data,
                          const origin_circuit_t *circ,
                          const hs_service_t *service)
 {
   int ret = -1;
   time_t elapsed;
-  uint8_t *decrypted = NULL;
   size_t encrypted_section_len;
   const uint8_t *encrypted_section;
   trn_cell_introduce1_t *cell = NULL;
-  trn_cell_introduce_encrypted_t *enc_cell = NULL;
-  hs_ntor_intro_cell_keys_t *intro_keys = NULL;
 
   tor_assert(data);
   tor_assert(circ);
   tor_assert(service);
 
   /* Parse the cell into a decoded data structure pointed by cell_ptr. */
-  if (parse_introduce2_cell(service, circ, data->payload, data->payload_len,
-                            &cell) < 0) {
+  if (parse_introduce2_cell(TO_CIRCUIT(circ)->n_circ_id,
+                            safe_str_client(service->onion_address),
+                            data->payload, data->payload_len, &cell) < 0) {
     goto done;
   }
 
@@ -672,6 +665,48 @@ hs_cell_parse_introduce2(hs_cell_introduce2_data_t *data,
     goto done;
   }
 
+  /* Success. */
+  ret = 0;
+
+ done:
+  trn_cell_introduce1_free(cell);
+  return ret;
+}
+
+/* Compute the key material of an INTRODUCE2 cell that passed
+ * hs_cell_check_introduce2(), validate its MAC, decrypt it and put what we
+ * extract from it in data. Return 0 on success else a negative value.
+ *
+ * This only uses data and its immutable section, never the replay cache, so
+ * it can be called from a cpuworker thread. The circuit id and onion
+ * address, already scrubbed for logging, are only used for logging. */
+ssize_t
+hs_cell_decrypt_introduce2(hs_cell_introduce2_data_t *data,
+                           uint32_t circ_id, const char *onion_address)
+{
+  int ret = -1;
+  uint8_t *decrypted = NULL;
+  size_t encrypted_section_len;
+  const uint8_t *encrypted_section;
+  trn_cell_introduce1_t *cell = NULL;
+  trn_cell_introduce_encrypted_t *enc_cell = NULL;
+  hs_ntor_intro_cell_keys_t *intro_keys = NULL;
+
+  tor_assert(data);
+  tor_assert(onion_address);
+
+  /* Parsing is cheap next to the key exchange so do it again rather than
+   * carrying the parsed cell around. */
+  if (parse_introduce2_cell(circ_id, onion_address, data->payload,
+                            data->payload_len, &cell) < 0) {
+    goto done;
+  }
+  encrypted_section = trn_cell_introduce1_getconstarray_encrypted(cell);
+  encrypted_section_len = trn_cell_introduce1_getlen_encrypted(cell);
+  if (BUG(encrypted_section_len < (CURVE25519_PUBKEY_LEN + DIGEST256_LEN))) {
+    goto done;
+  }
+
   /* Build the key material out of the key material found in the cell. */
   intro_keys = get_introduce2_key_material(data->auth_pk, data->enc_kp,
                                            data->subcredential,
@@ -680,8 +715,7 @@ hs_cell_parse_introduce2(hs_cell_introduce2_data_t *data,
   if (intro_keys == NULL) {
     log_info(LD_REND, "Invalid INTRODUCE2 encrypted data. Unable to "
                       "compute key material on circuit %u for service %s",
-             TO_CIRCUIT(circ)->n_circ_id,
-             safe_str_client(service->onion_address));
+             circ_id, onion_address);
     goto done;
   }
 
@@ -701,8 +735,7 @@ hs_cell_parse_introduce2(hs_cell_introduce2_data_t *data,
     if (tor_memcmp(mac, encrypted_section + mac_offset, sizeof(mac))) {
       log_info(LD_REND, "Invalid MAC validation for INTRODUCE2 cell on "
                         "circuit %u for service %s",
-               TO_CIRCUIT(circ)->n_circ_id,
-               safe_str_client(service->onion_address));
+               circ_id, onion_address);
       goto done;
     }
   }
@@ -723,15 +756,14 @@ hs_cell_parse_introduce2(hs_cell_introduce2_data_t *data,
     if (decrypted == NULL) {
       log_info(LD_REND, "Unable to decrypt the ENCRYPTED section of an "
                         "INTRODUCE2 cell on circuit %u for service %s",
-               TO_CIRCUIT(circ)->n_circ_id,
-               safe_str_client(service->onion_address));
+               circ_id, onion_address);
       goto done;
     }
 
     /* Parse this blob into an encrypted cell structure so we can then extract
      * the data we need out of it. */
     enc_cell = parse_introduce2_encrypted(decrypted, encrypted_data_len,
-                                          circ, service);
+                                          circ_id, onion_address);
     memwipe(decrypted, 0, encrypted_data_len);
     if (enc_cell == NULL) {
       goto done;
@@ -772,6 +804,28 @@ hs_cell_parse_introduce2(hs_cell_introduce2_data_t *data,
   return ret;
 }
 
+/* Parsse the INTRODUCE2 cell using data which contains everything we need to
+ * do so and contains the destination buffers of information we extract and
+ * compute from the cell. This does all the work of hs_cell_check_introduce2()
+ * and hs_cell_decrypt_introduce2() on the calling thread. Return 0 on success
+ * else a negative value. The service and circ are only used for logging
+ * purposes. */
+ssize_t
+hs_cell_parse_introduce2(hs_cell_introduce2_data_t *data,
+                         const origin_circuit_t *circ,
+                         const hs_service_t *service)
+{
+  tor_assert(data);
+  tor_assert(circ);
+  tor_assert(service);
+
+  if (hs_cell_check_introduce2(data, circ, service) < 0) {
+    return -1;
+  }
+  return hs_cell_decrypt_introduce2(data, TO_CIRCUIT(circ)->n_circ_id,
+                                    safe_str_client(service->onion_address));
+}
+
 /* Build a RENDEZVOUS1 cell with the given rendezvous cookie and handshake
  * info. The encoded cell is put in cell_out and the length of the data is
  * returned. This can't fail. */
@@ -13,11 +13,13 @@
 #include "circuitlist.h"
 #include "circuituse.h"
 #include "config.h"
+#include "cpuworker.h"
 #include "policies.h"
 #include "relay.h"
 #include "rendservice.h"
 #include "rephist.h"
 #include "router.h"
+#include "workqueue.h"
 
 #include "hs_cell.h"
 #include "hs_ident.h"
@@ -77,12 +79,12 @@ create_rend_cpath(const uint8_t *ntor_key_seed, size_t seed_len,
   }
 
   /* Setup the cpath */
-  cpath = tor_malloc_zero(sizeof(crypt_path_t));
-  cpath->magic = CRYPT_PATH_MAGIC;
+  cpath = crypt_path_new();
 
   if (circuit_init_cpath_crypto(cpath, (char*)keys, sizeof(keys),
                                 is_service_side, 1) < 0) {
-    tor_free(cpath);
+    circuit_free_cpath_node(cpath);
+    cpath = NULL;
     goto err;
   }
 
@@ -934,19 +936,194 @@ hs_circ_handle_intro_established(const hs_service_t *service,
   return ret;
 }
 
+/* An INTRODUCE2 cell handed to a cpuworker for its key exchange and
+ * decryption. The service and its intro point can go away while the job is
+ * pending so everything the worker reads is owned by the job. */
+typedef struct hs_circ_introduce2_job_t {
+  /* Identity key of the service and authentication key of the intro point
+   * that received the cell, used to find them again on reply. */
+  ed25519_public_key_t identity_pk;
+  ed25519_public_key_t intro_auth_pk;
+  /* Copies of the key material and payload that data points to. */
+  curve25519_keypair_t enc_kp;
+  uint8_t subcredential[DIGEST256_LEN];
+  uint8_t *payload;
+  /* Circuit id and onion address, scrubbed as needed. Only for logging. */
+  uint32_t circ_id;
+  char onion_address[HS_SERVICE_ADDR_LEN_BASE32 + 1];
+  /* Given to hs_cell_decrypt_introduce2() which fills it up. */
+  hs_cell_introduce2_data_t data;
+  /* What hs_cell_decrypt_introduce2() returned. */
+  int status;
+} hs_circ_introduce2_job_t;
+
+/* Free the content of data that we allocated and wipe it. */
+static void
+introduce2_data_clear(hs_cell_introduce2_data_t *data)
+{
+  if (data->link_specifiers) {
+    SMARTLIST_FOREACH(data->link_specifiers, link_specifier_t *, lspec,
+                      link_specifier_free(lspec));
+    smartlist_free(data->link_specifiers);
+  }
+  memwipe(data, 0, sizeof(*data));
+}
+
+/* Free the given INTRODUCE2 job and wipe the key material it holds. */
+static void
+introduce2_job_free(hs_circ_introduce2_job_t *job)
+{
+  if (!job) {
+    return;
+  }
+  introduce2_data_clear(&job->data);
+  tor_free(job->payload);
+  memwipe(job, 0, sizeof(*job));
+  tor_free(job);
+}
+
+/* Finish handling an INTRODUCE2 cell received for the service on the intro
+ * point ip, once data has been decrypted out of it: check the rendezvous
+ * cookie for repeats and launch the rendezvous circuit. Return 0 on success
+ * else a negative value. */
+static int
+handle_introduce2_data(const hs_service_t *service,
+                       hs_service_intro_point_t *ip,
+                       const hs_cell_introduce2_data_t *data)
+{
+  time_t elapsed;
+
+  /* Check whether we've seen this REND_COOKIE before to detect repeats. */
+  if (replaycache_add_test_and_elapsed(
+           service->state.replay_cache_rend_cookie,
+           data->rendezvous_cookie, sizeof(data->rendezvous_cookie),
+           &elapsed)) {
+    /* A Tor client will send a new INTRODUCE1 cell with the same REND_COOKIE
+     * as its previous one if its intro circ times out while in state
+     * CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT. If we received the first
+     * INTRODUCE1 cell (the intro-point relay converts it into an INTRODUCE2
+     * cell), we are already trying to connect to that rend point (and may
+     * have already succeeded); drop this cell. */
+    log_info(LD_REND, "We received an INTRODUCE2 cell with same REND_COOKIE "
+                      "field %ld seconds ago. Dropping cell.",
+             (long int) elapsed);
+    return -1;
+  }
+
+  /* At this point, we just confirmed that the full INTRODUCE2 cell is valid
+   * so increment our counter that we've seen one on this intro point. */
+  ip->introduce2_count++;
+
+  /* Launch rendezvous circuit with the onion key and rend cookie. */
+  launch_rendezvous_point_circuit(service, ip, data);
+  return 0;
+}
+
+/* Worker thread function: do the key exchange and decryption of the
+ * INTRODUCE2 cell in the given hs_circ_introduce2_job_t. */
+static workqueue_reply_t
+introduce2_job_threadfn(void *state_, void *work_)
+{
+  hs_circ_introduce2_job_t *job = work_;
+  (void) state_;
+
+  job->status = (int) hs_cell_decrypt_introduce2(&job->data, job->circ_id,
+                                                 job->onion_address);
+  return WQ_RPL_REPLY;
+}
+
+/* Main thread function: a cpuworker is done with the INTRODUCE2 job work_.
+ * If the cell was valid and its service and intro point are still around,
+ * launch the rendezvous circuit. */
+static void
+introduce2_job_replyfn(void *work_)
+{
+  hs_circ_introduce2_job_t *job = work_;
+  hs_service_t *service = NULL;
+  hs_service_intro_point_t *ip = NULL;
+
+  hs_service_find_intro_point(&job->identity_pk, &job->intro_auth_pk,
+                              &service, &ip);
+  /* The count can be off if the service was removed and added back while
+   * this job was pending. */
+  if (service && service->state.n_pending_introduce2 > 0) {
+    service->state.n_pending_introduce2--;
+  }
+
+  if (job->status < 0) {
+    /* The worker already logged why. */
+    goto done;
+  }
+  if (service == NULL || ip == NULL) {
+    log_info(LD_REND, "Service %s or its introduction point went away while "
+                      "we decrypted an INTRODUCE2 cell from circuit %u. "
+                      "Dropping cell.",
+             job->onion_address, job->circ_id);
+    goto done;
+  }
+  handle_introduce2_data(service, ip, &job->data);
+
+ done:
+  introduce2_job_free(job);
+}
+
+/* Hand the INTRODUCE2 cell of size payload_len received on circ for the
+ * service on the intro point ip to a cpuworker. Return 0 on success else a
+ * negative value. */
+static int
+queue_introduce2_job(hs_service_t *service, const origin_circuit_t *circ,
+                     const hs_service_intro_point_t *ip,
+                     const uint8_t *subcredential,
+                     const uint8_t *payload, size_t payload_len)
+{
+  hs_circ_introduce2_job_t *job = tor_malloc_zero(sizeof(*job));
+
+  ed25519_pubkey_copy(&job->identity_pk, &service->keys.identity_pk);
+  ed25519_pubkey_copy(&job->intro_auth_pk, &ip->auth_key_kp.pubkey);
+  memcpy(&job->enc_kp, &ip->enc_key_kp, sizeof(job->enc_kp));
+  memcpy(job->subcredential, subcredential, sizeof(job->subcredential));
+  job->payload = tor_memdup(payload, payload_len);
+  job->circ_id = TO_CIRCUIT(circ)->n_circ_id;
+  strlcpy(job->onion_address, safe_str_client(service->onion_address),
+          sizeof(job->onion_address));
+
+  job->data.auth_pk = &job->intro_auth_pk;
+  job->data.enc_kp = &job->enc_kp;
+  job->data.subcredential = job->subcredential;
+  job->data.payload = job->payload;
+  job->data.payload_len = payload_len;
+  job->data.link_specifiers = smartlist_new();
+
+  /* Onionskins of the circuits we relay come first. */
+  if (!cpuworker_queue_work(WQ_PRI_MED, introduce2_job_threadfn,
+                            introduce2_job_replyfn, job)) {
+    log_warn(LD_REND, "Unable to queue an INTRODUCE2 cell for decryption "
+                      "for service %s.", job->onion_address);
+    introduce2_job_free(job);
+    return -1;
+  }
+  service->state.n_pending_introduce2++;
+  return 0;
+}
+
 /* We just received an INTRODUCE2 cell on the established introduction circuit
  * circ.  Handle the INTRODUCE2 payload of size payload_len for the given
  * circuit and service. This cell is associated with the intro point object ip
- * and the subcredential. Return 0 on success else a negative value. */
+ * and the subcredential.
+ *
+ * If the cpuworkers are running, the cell is checked against the replay
+ * cache here and then handed to them for its key exchange and decryption;
+ * the rendezvous circuit is launched once they answer. Else, all of it is
+ * done right away. Return 0 on success else a negative value. */
 int
-hs_circ_handle_introduce2(const hs_service_t *service,
+hs_circ_handle_introduce2(hs_service_t *service,
                           const origin_circuit_t *circ,
                           hs_service_intro_point_t *ip,
                           const uint8_t *subcredential,
                           const uint8_t *payload, size_t payload_len)
 {
   int ret = -1;
-  time_t elapsed;
+  int use_cpuworker = cpuworker_is_running();
   hs_cell_introduce2_data_t data;
 
   tor_assert(service);
@@ -955,8 +1132,21 @@ hs_circ_handle_introduce2(const hs_service_t *service,
   tor_assert(subcredential);
   tor_assert(payload);
 
+  /* Drop the cell early if we're already too far behind. */
+  if (use_cpuworker &&
+      service->state.n_pending_introduce2 >=
+        HS_SERVICE_MAX_PENDING_INTRODUCE2) {
+    static ratelim_t pending_limit = RATELIM_INIT(60);
+    log_fn_ratelim(&pending_limit, LOG_NOTICE, LD_REND,
+                   "Too many INTRODUCE2 cells are waiting to be decrypted "
+                   "for service %s. Dropping cell.",
+                   safe_str_client(service->onion_address));
+    return -1;
+  }
+
   /* Populate the data structure with everything we need for the cell to be
    * parsed, decrypted and key material computed correctly. */
+  memset(&data, 0, sizeof(data));
   data.auth_pk = &ip->auth_key_kp.pubkey;
   data.enc_kp = &ip->enc_key_kp;
   data.subcredential = subcredential;
@@ -965,41 +1155,26 @@ hs_circ_handle_introduce2(const hs_service_t *service,
   data.link_specifiers = smartlist_new();
   data.replay_cache = ip->replay_cache;
 
-  if (hs_cell_parse_introduce2(&data, circ, service) < 0) {
+  /* Cheap checks, including the replay cache, before any expensive work. */
+  if (hs_cell_check_introduce2(&data, circ, service) < 0) {
     goto done;
   }
 
-  /* Check whether we've seen this REND_COOKIE before to detect repeats. */
-  if (replaycache_add_test_and_elapsed(
-           service->state.replay_cache_rend_cookie,
-           data.rendezvous_cookie, sizeof(data.rendezvous_cookie),
-           &elapsed)) {
-    /* A Tor client will send a new INTRODUCE1 cell with the same REND_COOKIE
-     * as its previous one if its intro circ times out while in state
-     * CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT. If we received the first
-     * INTRODUCE1 cell (the intro-point relay converts it into an INTRODUCE2
-     * cell), we are already trying to connect to that rend point (and may
-     * have already succeeded); drop this cell. */
-    log_info(LD_REND, "We received an INTRODUCE2 cell with same REND_COOKIE "
-                      "field %ld seconds ago. Dropping cell.",
-             (long int) elapsed);
+  if (use_cpuworker) {
+    ret = queue_introduce2_job(service, circ, ip, subcredential,
+                               payload, payload_len);
     goto done;
   }
 
-  /* At this point, we just confirmed that the full INTRODUCE2 cell is valid
-   * so increment our counter that we've seen one on this intro point. */
-  ip->introduce2_count++;
-
-  /* Launch rendezvous circuit with the onion key and rend cookie. */
-  launch_rendezvous_point_circuit(service, ip, &data);
-  /* Success. */
-  ret = 0;
+  if (hs_cell_decrypt_introduce2(&data, TO_CIRCUIT(circ)->n_circ_id,
+                                 safe_str_client(service->onion_address))
+      < 0) {
+    goto done;
+  }
+  ret = handle_introduce2_data(service, ip, &data);
 
  done:
-  SMARTLIST_FOREACH(data.link_specifiers, link_specifier_t *, lspec,
-                    link_specifier_free(lspec));
-  smartlist_free(data.link_specifiers);
-  memwipe(&data, 0, sizeof(data));
+  introduce2_data_clear(&data);
   return ret;
 }
 
@@ -42,7 +42,7 @@ int hs_circ_handle_intro_established(const hs_service_t *service,
                                      origin_circuit_t *circ,
                                      const uint8_t *payload,
                                      size_t payload_len);
-int hs_circ_handle_introduce2(const hs_service_t *service,
+int hs_circ_handle_introduce2(hs_service_t *service,
                               const origin_circuit_t *circ,
                               hs_service_intro_point_t *ip,
                               const uint8_t *subcredential,
@@ -413,7 +413,12 @@ service_intro_point_new(const extend_info_t *ei, unsigned int is_legacy)
       crypto_rand_int_range(intro_point_min_lifetime,intro_point_max_lifetime);
   }
 
-  ip->replay_cache = replaycache_new(0, 0);
+  /* The intro point is rotated once it has seen introduce2_max cells, so
+   * this is enough for a fixed size replay cache. Its filter is only
+   * allocated when the first INTRODUCE2 cell comes in. */
+  ip->replay_cache =
+    replaycache_new_bloom(0, (unsigned int) ip->introduce2_max,
+                          INTRO_POINT_REPLAY_FALSE_POSITIVE_RATE);
 
   /* Initialize the base object. We don't need the certificate object. */
   ip->base.link_specifiers = smartlist_new();
@@ -841,6 +846,7 @@ move_hs_state(hs_service_t *src_service, hs_service_t *dst_service)
   dst->intro_circ_retry_started_time = src->intro_circ_retry_started_time;
   dst->num_intro_circ_launched = src->num_intro_circ_launched;
   dst->replay_cache_rend_cookie = src->replay_cache_rend_cookie;
+  dst->n_pending_introduce2 = src->n_pending_introduce2;
 
   src->replay_cache_rend_cookie = NULL; /* steal pointer reference */
 }
@@ -3098,6 +3104,33 @@ hs_service_dir_info_changed(void)
   }
 }
 
+/* Find the service of identity key identity_pk and its introduction point
+ * of authentication key intro_auth_pk. Each object we find is put in
+ * service_out and ip_out; the ones we don't find are set to NULL. This is
+ * used to get back to those objects after an asynchronous operation, during
+ * which they might have gone away. */
+void
+hs_service_find_intro_point(const ed25519_public_key_t *identity_pk,
+                            const ed25519_public_key_t *intro_auth_pk,
+                            hs_service_t **service_out,
+                            hs_service_intro_point_t **ip_out)
+{
+  tor_assert(identity_pk);
+  tor_assert(intro_auth_pk);
+  tor_assert(service_out);
+  tor_assert(ip_out);
+
+  *ip_out = NULL;
+  *service_out = NULL;
+  if (!hs_service_map) {
+    return;
+  }
+  *service_out = find_service(hs_service_map, identity_pk);
+  if (*service_out) {
+    *ip_out = service_intro_point_find(*service_out, intro_auth_pk);
+  }
+}
+
 /* Called when we get an INTRODUCE2 cell on the circ. Respond to the cell and
  * launch a circuit to the rendezvous point. */
 int
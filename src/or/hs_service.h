@@ -31,6 +31,11 @@
 #define HS_SERVICE_NEXT_UPLOAD_TIME_MIN (60 * 60)
 #define HS_SERVICE_NEXT_UPLOAD_TIME_MAX (120 * 60)
 
+/* Maximum number of INTRODUCE2 cells a service can have waiting for a
+ * cpuworker. Past that, we drop new ones as soon as they arrive: they would
+ * likely be answered too late to be of use to the client anyway. */
+#define HS_SERVICE_MAX_PENDING_INTRODUCE2 256
+
 /* Service side introduction point. */
 typedef struct hs_service_intro_point_t {
   /* Top level intropoint "shared" data between client/service. */
@@ -206,6 +211,11 @@ typedef struct hs_service_state_t {
   /* When is the next time we should rotate our descriptors. This is has to be
    * done at the start time of the next SRV protocol run. */
   time_t next_rotation_time;
+
+  /* Number of INTRODUCE2 cells we've handed to the cpuworkers and haven't
+   * heard back about. This should never go over
+   * HS_SERVICE_MAX_PENDING_INTRODUCE2. */
+  unsigned int n_pending_introduce2;
 } hs_service_state_t;
 
 /* Representation of a service running on this tor instance. */
@@ -270,6 +280,10 @@ int hs_service_receive_introduce2(origin_circuit_t *circ,
                                   size_t payload_len);
 
 void hs_service_intro_circ_has_closed(origin_circuit_t *circ);
+void hs_service_find_intro_point(const ed25519_public_key_t *identity_pk,
+                                 const ed25519_public_key_t *intro_auth_pk,
+                                 hs_service_t **service_out,
+                                 hs_service_intro_point_t **ip_out);
 
 #ifdef HS_SERVICE_PRIVATE
 
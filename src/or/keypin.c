@@ -15,6 +15,7 @@
 #include "crypto.h"
 #include "crypto_format.h"
 #include "di_ops.h"
+#include "fileworker.h"
 #include "ht.h"
 #include "keypin.h"
 #include "siphash.h"
@@ -281,14 +282,20 @@ keypin_check_lone_rsa(const uint8_t *rsa_id_digest)
   }
 }
 
-/** Open fd to the keypinning journal file. */
-static int keypin_journal_fd = -1;
+/** Name of the keypinning journal file, or NULL if it isn't open. */
+static char *keypin_journal_fname = NULL;
+/** True iff appending to the keypinning journal has failed since we opened
+ * it. */
+static int keypin_journal_failed = 0;
 
 /** Open the key-pinning journal to append to <b>fname</b>.  Return 0 on
  * success, -1 on failure. */
 int
 keypin_open_journal(const char *fname)
 {
+  /* Finish with any journal we already had open before we write here. */
+  keypin_close_journal();
+
   /* O_SYNC ??*/
   int fd = tor_open_cloexec(fname, O_WRONLY|O_CREAT|O_BINARY, 0600);
   if (fd < 0)
@@ -309,7 +316,10 @@ keypin_open_journal(const char *fname)
   if (write_all(fd, buf, strlen(buf), 0) < 0)
     goto err;
 
-  keypin_journal_fd = fd;
+  /* From here on, entries are appended in the background. */
+  close(fd);
+  keypin_journal_fname = tor_strdup(fname);
+  keypin_journal_failed = 0;
   return 0;
  err:
   if (fd >= 0)
@@ -317,26 +327,41 @@ keypin_open_journal(const char *fname)
   return -1;
 }
 
-/** Close the keypinning journal file. */
+/** Close the keypinning journal file, after writing every entry that was
+ * added to it. */
 int
 keypin_close_journal(void)
 {
-  if (keypin_journal_fd >= 0)
-    close(keypin_journal_fd);
-  keypin_journal_fd = -1;
+  if (keypin_journal_fname)
+    fileworker_flush(keypin_journal_fname);
+  tor_free(keypin_journal_fname);
   return 0;
 }
 
 /** Length of a keypinning journal line, including terminating newline. */
 #define JOURNAL_LINE_LEN (BASE64_DIGEST_LEN + BASE64_DIGEST256_LEN + 2)
 
+/** Called when a line we queued for the keypinning journal is on disk, or
+ * has failed to get there. */
+static void
+keypin_journal_append_done(const char *fname, int status, void *arg)
+{
+  (void) arg;
+  if (status < 0 && !keypin_journal_failed) {
+    log_warn(LD_DIRSERV, "Error while adding a line to the key-pinning "
+             "journal in \"%s\"; no longer adding to it.", fname);
+    keypin_journal_failed = 1;
+  }
+}
+
 /** Add an entry to the keypinning journal to map <b>rsa_id_digest</b> and
- * <b>ed25519_id_key</b>. */
+ * <b>ed25519_id_key</b>.  Newly pinned keys are batched up and written in
+ * the background. */
 static int
 keypin_journal_append_entry(const uint8_t *rsa_id_digest,
                             const uint8_t *ed25519_id_key)
 {
-  if (keypin_journal_fd == -1)
+  if (keypin_journal_fname == NULL || keypin_journal_failed)
     return -1;
   char line[JOURNAL_LINE_LEN];
   digest_to_base64(line, (const char*)rsa_id_digest);
@@ -345,12 +370,8 @@ keypin_journal_append_entry(const uint8_t *rsa_id_digest,
                       (const char*)ed25519_id_key);
   line[BASE64_DIGEST_LEN+1+BASE64_DIGEST256_LEN] = '\n';
 
-  if (write_all(keypin_journal_fd, line, JOURNAL_LINE_LEN, 0)<0) {
-    log_warn(LD_DIRSERV, "Error while adding a line to the key-pinning "
-             "journal: %s", strerror(errno));
-    keypin_close_journal();
-    return -1;
-  }
+  fileworker_append(keypin_journal_fname, line, JOURNAL_LINE_LEN, 1,
+                    keypin_journal_append_done, NULL);
 
   return 0;
 }
@@ -78,6 +78,7 @@
 #include "dnsserv.h"
 #include "dos.h"
 #include "entrynodes.h"
+#include "fileworker.h"
 #include "geoip.h"
 #include "hibernate.h"
 #include "hs_cache.h"
@@ -109,6 +110,10 @@
 #include "status.h"
 #include "util_process.h"
 #include "ext_orport.h"
+#include "trace/trace.h"
+#ifdef USE_EVENT_TRACING_RING
+#include "trace/ring.h"
+#endif
 #ifdef USE_DMALLOC
 #include <dmalloc.h>
 #endif
@@ -133,6 +138,7 @@ void evdns_shutdown(int);
 
 static void dumpmemusage(int severity);
 static void dumpstats(int severity); /* log stats */
+static void dump_trace_buffers(void);
 static void conn_read_callback(evutil_socket_t fd, short event, void *_conn);
 static void conn_write_callback(evutil_socket_t fd, short event, void *_conn);
 static void second_elapsed_callback(periodic_timer_t *timer, void *args);
@@ -2524,6 +2530,8 @@ do_main_loop(void)
     /* launch cpuworkers. Need to do this *after* we've read the onion key. */
     cpu_init();
   }
+  /* From now on, write the state file and journals in the background. */
+  fileworker_init();
   consdiffmgr_enable_background_compression();
 
   /* Setup shared random protocol subsystem. */
@@ -2731,6 +2739,9 @@ process_signal(int sig)
     case SIGUSR1:
       /* prefer to log it at INFO, but make sure we always see it */
       dumpstats(get_min_log_level()<LOG_INFO ? get_min_log_level() : LOG_INFO);
+#ifdef USE_EVENT_TRACING_RING
+      dump_trace_buffers();
+#endif
       control_event_signal(sig);
       break;
     case SIGUSR2:
@@ -2778,7 +2789,31 @@ process_signal(int sig)
       log_heartbeat(time(NULL));
       control_event_signal(sig);
       break;
+    case SIGDUMPTRACE:
+      dump_trace_buffers();
+      control_event_signal(sig);
+      break;
+  }
+}
+
+/** Write the contents of the in-process trace buffers to the "trace-dump"
+ * file in our data directory, if we were built with a tracer that keeps
+ * them. */
+static void
+dump_trace_buffers(void)
+{
+#ifdef USE_EVENT_TRACING_RING
+  char *fname = get_datadir_fname("trace-dump");
+  if (tor_trace_ring_dump(fname) < 0) {
+    log_warn(LD_FS, "Unable to write event trace to %s", escaped(fname));
+  } else {
+    log_notice(LD_GENERAL, "Wrote event trace to %s", escaped(fname));
   }
+  tor_free(fname);
+#else
+  log_notice(LD_GENERAL, "Tor was built without --enable-event-tracing-ring, "
+             "so there are no trace buffers to dump.");
+#endif /* defined(USE_EVENT_TRACING_RING) */
 }
 
 /** Returns Tor's uptime. */
@@ -2961,6 +2996,7 @@ static struct {
   { SIGNEWNYM, 0, NULL },
   { SIGCLEARDNSCACHE, 0, NULL },
   { SIGHEARTBEAT, 0, NULL },
+  { SIGDUMPTRACE, 0, NULL },
   { -1, -1, NULL }
 };
 
@@ -3029,6 +3065,7 @@ tor_init(int argc, char *argv[])
   int quiet = 0;
 
   time_of_process_start = time(NULL);
+  tor_trace_init();
   init_connection_lists();
   /* Have the log set up with our application name. */
   tor_snprintf(progname, sizeof(progname), "Tor %s", get_version());
@@ -3260,8 +3297,10 @@ tor_free_all(int postfork)
   pt_free_all();
   channel_tls_free_all();
   channel_free_all();
+  channelpadding_free_all();
   connection_free_all();
   connection_edge_free_all();
+  connection_or_free_all();
   scheduler_free_all();
   nodelist_free_all();
   microdesc_free_all();
@@ -3274,12 +3313,14 @@ tor_free_all(int postfork)
   consdiffmgr_free_all();
   hs_free_all();
   dos_free_all();
+  tor_trace_free_all();
   if (!postfork) {
     config_free_all();
     or_state_free_all();
     router_free_all();
     routerkeys_free_all();
     policies_free_all();
+    fileworker_free_all();
   }
   if (!postfork) {
     tor_tls_free_all();
@@ -3346,6 +3387,9 @@ tor_cleanup(void)
     keypin_close_journal();
   }
 
+  /* Make sure that everything we saved above is on disk. */
+  fileworker_flush_all();
+
   timers_shutdown();
 
   /* Some OSs will clear any unread data on control connections when the tor
@@ -9,11 +9,13 @@
  */
 
 #include "or.h"
+#include "buffers.h"
 #include "circuitbuild.h"
 #include "config.h"
 #include "directory.h"
 #include "dirserv.h"
 #include "entrynodes.h"
+#include "fileworker.h"
 #include "microdesc.h"
 #include "networkstatus.h"
 #include "nodelist.h"
@@ -170,6 +172,47 @@ microdesc_reset_outdated_dirservers_list(void)
 
 /****************************************************************************/
 
+/** Maximum length of the annotations that we store with a
+ * microdescriptor. */
+#define MICRODESC_ANNOTATION_MAXLEN (ISO_TIME_LEN+32)
+
+/** Write the annotations that we store on disk for <b>md</b> into
+ * <b>annotation</b>, which must hold MICRODESC_ANNOTATION_MAXLEN bytes, and
+ * return their length. */
+static size_t
+format_microdesc_annotations(const microdesc_t *md, char *annotation)
+{
+  /* XXXX drops unknown annotations. */
+  if (md->last_listed) {
+    char buf[ISO_TIME_LEN+1];
+    format_iso_time(buf, md->last_listed);
+    tor_snprintf(annotation, MICRODESC_ANNOTATION_MAXLEN,
+                 "@last-listed %s\n", buf);
+    return strlen(annotation);
+  }
+  annotation[0] = '\0';
+  return 0;
+}
+
+/** Add the body of <b>md</b> to <b>buf</b>, with appropriate annotations,
+ * as dump_microdescriptor() would write it.  Return the total number of
+ * bytes added, and set *<b>annotation_len_out</b> to the number of bytes
+ * added as annotations. */
+static size_t
+add_microdescriptor_to_buf(buf_t *buf, const microdesc_t *md,
+                           size_t *annotation_len_out)
+{
+  char annotation[MICRODESC_ANNOTATION_MAXLEN];
+  if (md->body == NULL) {
+    *annotation_len_out = 0;
+    return 0;
+  }
+  *annotation_len_out = format_microdesc_annotations(md, annotation);
+  buf_add(buf, annotation, *annotation_len_out);
+  buf_add(buf, md->body, md->bodylen);
+  return *annotation_len_out + md->bodylen;
+}
+
 /** Write the body of <b>md</b> into <b>f</b>, with appropriate annotations.
  * On success, return the total number of bytes written, and set
  * *<b>annotation_len_out</b> to the number of bytes written as
@@ -183,12 +226,9 @@ dump_microdescriptor(int fd, microdesc_t *md, size_t *annotation_len_out)
     *annotation_len_out = 0;
     return 0;
   }
-  /* XXXX drops unknown annotations. */
   if (md->last_listed) {
-    char buf[ISO_TIME_LEN+1];
-    char annotation[ISO_TIME_LEN+32];
-    format_iso_time(buf, md->last_listed);
-    tor_snprintf(annotation, sizeof(annotation), "@last-listed %s\n", buf);
+    char annotation[MICRODESC_ANNOTATION_MAXLEN];
+    format_microdesc_annotations(md, annotation);
     if (write_all(fd, annotation, strlen(annotation), 0) < 0) {
       log_warn(LD_DIR,
                "Couldn't write microdescriptor annotation: %s",
@@ -349,6 +389,18 @@ microdescs_add_to_cache(microdesc_cache_t *cache,
   return added;
 }
 
+/** Called once descriptors we appended to the microdescriptor journal have
+ * reached the disk, or failed to.  Their bodies are still in memory, so the
+ * next cache rebuild will save them even if this failed. */
+static void
+microdesc_journal_append_done(const char *fname, int status, void *arg)
+{
+  (void) arg;
+  if (status < 0)
+    log_warn(LD_DIR, "Error appending to microdescriptor journal \"%s\".",
+             fname);
+}
+
 /** As microdescs_add_to_cache, but takes a list of microdescriptors instead of
  * a string to decode.  Frees any members of <b>descriptors</b> that it does
  * not add. */
@@ -358,20 +410,14 @@ microdescs_add_list_to_cache(microdesc_cache_t *cache,
                              int no_save)
 {
   smartlist_t *added;
-  open_file_t *open_file = NULL;
-  int fd = -1;
+  buf_t *journal_buf = NULL;
   //  int n_added = 0;
   ssize_t size = 0;
 
-  if (where == SAVED_NOWHERE && !no_save) {
-    fd = start_writing_to_file(cache->journal_fname,
-                               OPEN_FLAGS_APPEND|O_BINARY,
-                               0600, &open_file);
-    if (fd < 0) {
-      log_warn(LD_DIR, "Couldn't append to journal in %s: %s",
-               cache->journal_fname, strerror(errno));
-    }
-  }
+  /* New descriptors go to the journal in a single append, which is written
+   * in the background. */
+  if (where == SAVED_NOWHERE && !no_save)
+    journal_buf = buf_new();
 
   added = smartlist_new();
   SMARTLIST_FOREACH_BEGIN(descriptors, microdesc_t *, md) {
@@ -388,17 +434,12 @@ microdescs_add_list_to_cache(microdesc_cache_t *cache,
     }
 
     /* Okay, it's a new one. */
-    if (fd >= 0) {
+    if (journal_buf) {
       size_t annotation_len;
-      size = dump_microdescriptor(fd, md, &annotation_len);
-      if (size < 0) {
-        /* we already warned in dump_microdescriptor */
-        abort_writing_to_file(open_file);
-        fd = -1;
-      } else {
-        md->saved_location = SAVED_IN_JOURNAL;
-        cache->journal_len += size;
-      }
+      size = add_microdescriptor_to_buf(journal_buf, md, &annotation_len);
+      md->off = cache->journal_len + annotation_len;
+      md->saved_location = SAVED_IN_JOURNAL;
+      cache->journal_len += size;
     } else {
       md->saved_location = where;
     }
@@ -412,13 +453,16 @@ microdescs_add_list_to_cache(microdesc_cache_t *cache,
     cache->total_len_seen += md->bodylen;
   } SMARTLIST_FOREACH_END(md);
 
-  if (fd >= 0) {
-    if (finish_writing_to_file(open_file) < 0) {
-      log_warn(LD_DIR, "Error appending to microdescriptor file: %s",
-               strerror(errno));
-      smartlist_clear(added);
-      return added;
+  if (journal_buf) {
+    size_t len = buf_datalen(journal_buf);
+    if (len) {
+      char *data = tor_malloc(len);
+      buf_get_bytes(journal_buf, data, len);
+      fileworker_append(cache->journal_fname, data, len, 1,
+                        microdesc_journal_append_done, NULL);
+      tor_free(data);
     }
+    buf_free(journal_buf);
   }
 
   {
@@ -476,6 +520,9 @@ microdesc_cache_reload(microdesc_cache_t *cache)
 
   cache->is_loaded = 1;
 
+  /* Don't read the journal while we're still appending to it. */
+  fileworker_flush(cache->journal_fname);
+
   mm = cache->cache_content = tor_mmap_file(cache->cache_fname);
   if (mm) {
     added = microdescs_add_to_cache(cache, mm->data, mm->data+mm->size,
@@ -775,7 +822,9 @@ microdesc_cache_rebuild(microdesc_cache_t *cache, int force)
 
   smartlist_free(wrote);
 
-  write_str_to_file(cache->journal_fname, "", 1);
+  /* Everything in the journal is in the cache file now.  Emptying it waits
+   * for any appends still on their way to it. */
+  fileworker_replace(cache->journal_fname, "", 0, 1, NULL, NULL);
   cache->journal_len = 0;
   cache->bytes_dropped = 0;
 
@@ -841,6 +890,7 @@ microdesc_free_(microdesc_t *md, const char *fname, int lineno)
         if (node->md == md) {
           ++found;
           node->md = NULL;
+          nodelist_node_exit_policy_changed(node);
         }
       });
     if (found) {
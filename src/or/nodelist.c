@@ -107,6 +107,11 @@ typedef struct nodelist_t {
   HT_HEAD(nodelist_ed_map, node_t) nodes_by_ed_id;
   /* Set of addresses that belong to nodes we believe in. */
   address_set_t *node_addrs;
+  /* Hash table to map from port to the set of nodes whose exit policies
+   * might allow exiting to that port.  Built lazily, one port at a time, by
+   * nodelist_get_exit_port_set(), and kept current as descriptors come and
+   * go. */
+  HT_HEAD(exit_port_map, exit_port_set_t) exit_port_sets;
 } nodelist_t;
 
 static inline unsigned int
@@ -142,6 +147,41 @@ HT_PROTOTYPE(nodelist_ed_map, node_t, ed_ht_ent, node_ed_id_hash,
 HT_GENERATE2(nodelist_ed_map, node_t, ed_ht_ent, node_ed_id_hash,
              node_ed_id_eq, 0.6, tor_reallocarray_, tor_free_)
 
+/** An entry in the nodelist's exit_port_sets map: a bitarray, indexed by
+ * nodelist_idx, of the nodes that might allow exits to <b>port</b>. */
+typedef struct exit_port_set_t {
+  HT_ENTRY(exit_port_set_t) node;
+  /** The port that this set describes. */
+  uint16_t port;
+  /** How many bits <b>bits</b> currently has room for. */
+  int n_bits;
+  /** Bit <b>i</b> is set iff the node at position <b>i</b> in the nodelist
+   * might allow exits to <b>port</b>. All bits at or after the end of the
+   * nodelist are clear. */
+  bitarray_t *bits;
+} exit_port_set_t;
+
+static inline unsigned int
+exit_port_set_hash(const exit_port_set_t *set)
+{
+  return (unsigned) set->port;
+}
+
+static inline unsigned int
+exit_port_set_eq(const exit_port_set_t *a, const exit_port_set_t *b)
+{
+  return a->port == b->port;
+}
+
+HT_PROTOTYPE(exit_port_map, exit_port_set_t, node, exit_port_set_hash,
+             exit_port_set_eq)
+HT_GENERATE2(exit_port_map, exit_port_set_t, node, exit_port_set_hash,
+             exit_port_set_eq, 0.6, tor_reallocarray_, tor_free_)
+
+/** The largest number of ports for which we'll keep an exit port set
+ * between consensuses.  Clients only ever ask about a handful of ports. */
+#define MAX_EXIT_PORT_SETS 256
+
 /** The global nodelist. */
 static nodelist_t *the_nodelist=NULL;
 
@@ -153,6 +193,7 @@ init_nodelist(void)
     the_nodelist = tor_malloc_zero(sizeof(nodelist_t));
     HT_INIT(nodelist_map, &the_nodelist->nodes_by_id);
     HT_INIT(nodelist_ed_map, &the_nodelist->nodes_by_ed_id);
+    HT_INIT(exit_port_map, &the_nodelist->exit_port_sets);
     the_nodelist->nodes = smartlist_new();
   }
 }
@@ -448,6 +489,172 @@ nodelist_probably_contains_address(const tor_addr_t *addr)
   return address_set_probably_contains(the_nodelist->node_addrs, addr);
 }
 
+/** Return true iff <b>node</b>'s exit policy might allow it to exit to some
+ * address on <b>port</b>.  This is the answer recorded in the exit port
+ * sets. */
+static int
+node_might_exit_to_port(const node_t *node, uint16_t port)
+{
+  addr_policy_result_t r = compare_tor_addr_to_node_policy(NULL, port, node);
+  return r != ADDR_POLICY_REJECTED && r != ADDR_POLICY_PROBABLY_REJECTED;
+}
+
+/** Make sure that <b>set</b> has room for every node in the nodelist. */
+static void
+exit_port_set_ensure_capacity(exit_port_set_t *set)
+{
+  const int n_nodes = smartlist_len(the_nodelist->nodes);
+  if (set->n_bits < n_nodes) {
+    int n_bits = set->n_bits ? set->n_bits : 64;
+    while (n_bits < n_nodes)
+      n_bits *= 2;
+    set->bits = bitarray_expand(set->bits, set->n_bits, n_bits);
+    set->n_bits = n_bits;
+  }
+}
+
+/** Release all storage held by the exit port sets in the nodelist. */
+static void
+nodelist_clear_exit_port_sets(void)
+{
+  exit_port_set_t **ent, *set;
+  for (ent = HT_START(exit_port_map, &the_nodelist->exit_port_sets); ent; ) {
+    set = *ent;
+    ent = HT_NEXT_RMV(exit_port_map, &the_nodelist->exit_port_sets, ent);
+    bitarray_free(set->bits);
+    tor_free(set);
+  }
+  HT_CLEAR(exit_port_map, &the_nodelist->exit_port_sets);
+}
+
+/** Called when <b>node</b> has just moved from position <b>old_idx</b> in
+ * the nodelist to position <b>new_idx</b>, replacing a node that was
+ * dropped. Move its bits along with it. */
+static void
+nodelist_move_exit_port_bits(int old_idx, int new_idx)
+{
+  exit_port_set_t **ent;
+  HT_FOREACH(ent, exit_port_map, &the_nodelist->exit_port_sets) {
+    exit_port_set_t *set = *ent;
+    if (old_idx >= set->n_bits)
+      continue;
+    if (new_idx >= 0) {
+      if (bitarray_is_set(set->bits, old_idx))
+        bitarray_set(set->bits, new_idx);
+      else
+        bitarray_clear(set->bits, new_idx);
+    }
+    bitarray_clear(set->bits, old_idx);
+  }
+}
+
+/** Called whenever anything that could change <b>node</b>'s exit policy
+ * has changed: its routerinfo, its microdescriptor, or whether we've
+ * decided it rejects everything. Recompute its bit in every exit port
+ * set. */
+void
+nodelist_node_exit_policy_changed(const node_t *node)
+{
+  exit_port_set_t **ent;
+  if (PREDICT_UNLIKELY(the_nodelist == NULL) || node->nodelist_idx < 0)
+    return;
+  HT_FOREACH(ent, exit_port_map, &the_nodelist->exit_port_sets) {
+    exit_port_set_t *set = *ent;
+    exit_port_set_ensure_capacity(set);
+    if (node_might_exit_to_port(node, set->port))
+      bitarray_set(set->bits, node->nodelist_idx);
+    else
+      bitarray_clear(set->bits, node->nodelist_idx);
+  }
+}
+
+/** Return a bitarray, indexed by nodelist_idx, in which bit <b>i</b> is set
+ * iff the <b>i</b>th node in nodelist_get_list() might allow exits to some
+ * address on <b>port</b>, according to compare_tor_addr_to_node_policy().
+ * The bitarray has room for every node in the nodelist.
+ *
+ * The result belongs to the nodelist, and must not be modified.  It stays
+ * valid until the nodelist next changes.  Return NULL if we are already
+ * tracking too many ports; the caller should check the policies itself. */
+bitarray_t *
+nodelist_get_exit_port_set(uint16_t port)
+{
+  exit_port_set_t search, *set;
+  tor_assert(port);
+  init_nodelist();
+
+  search.port = port;
+  set = HT_FIND(exit_port_map, &the_nodelist->exit_port_sets, &search);
+  if (set) {
+    exit_port_set_ensure_capacity(set);
+    return set->bits;
+  }
+
+  if (HT_SIZE(&the_nodelist->exit_port_sets) >= MAX_EXIT_PORT_SETS)
+    return NULL;
+
+  set = tor_malloc_zero(sizeof(exit_port_set_t));
+  set->port = port;
+  exit_port_set_ensure_capacity(set);
+  SMARTLIST_FOREACH_BEGIN(the_nodelist->nodes, const node_t *, node) {
+    if (node_might_exit_to_port(node, port))
+      bitarray_set(set->bits, node_sl_idx);
+  } SMARTLIST_FOREACH_END(node);
+  HT_INSERT(exit_port_map, &the_nodelist->exit_port_sets, set);
+  return set->bits;
+}
+
+/** Remove from <b>sl</b> every node_t that appears in <b>excluded</b>.
+ * Does not preserve the order of <b>sl</b>.
+ *
+ * This is smartlist_subtract() for lists of nodes: rather than hashing
+ * pointers, we mark the excluded nodes in a bitarray indexed by
+ * nodelist_idx, which makes subtracting large exclusion sets (families,
+ * ExcludeNodes) from the whole nodelist cheap. */
+void
+nodelist_subtract_nodes(smartlist_t *sl, const smartlist_t *excluded)
+{
+  bitarray_t *bits;
+  smartlist_t *unlisted = NULL;
+  int n_nodes;
+
+  tor_assert(sl);
+  tor_assert(excluded);
+  if (smartlist_len(sl) == 0 || smartlist_len(excluded) == 0)
+    return;
+  if (the_nodelist == NULL) {
+    smartlist_subtract(sl, excluded);
+    return;
+  }
+
+  n_nodes = smartlist_len(the_nodelist->nodes);
+  bits = bitarray_init_zero(n_nodes ? n_nodes : 1);
+  SMARTLIST_FOREACH_BEGIN(excluded, const node_t *, node) {
+    if (node && node->nodelist_idx >= 0 &&
+        node->nodelist_idx < n_nodes &&
+        smartlist_get(the_nodelist->nodes, node->nodelist_idx) == node) {
+      bitarray_set(bits, node->nodelist_idx);
+    } else {
+      /* Not in the nodelist: we'll have to compare these ones directly. */
+      if (!unlisted)
+        unlisted = smartlist_new();
+      smartlist_add(unlisted, (void*)node);
+    }
+  } SMARTLIST_FOREACH_END(node);
+
+  SMARTLIST_FOREACH_BEGIN(sl, const node_t *, node) {
+    int listed = node && node->nodelist_idx >= 0 &&
+      node->nodelist_idx < n_nodes &&
+      smartlist_get(the_nodelist->nodes, node->nodelist_idx) == node;
+    if (listed ? bitarray_is_set(bits, node->nodelist_idx)
+               : (unlisted && smartlist_contains(unlisted, node)))
+      SMARTLIST_DEL_CURRENT(sl, node);
+  } SMARTLIST_FOREACH_END(node);
+
+  bitarray_free(bits);
+  smartlist_free(unlisted);
+}
+
 /** Add <b>ri</b> to an appropriate node in the nodelist.  If we replace an
  * old routerinfo, and <b>ri_old_out</b> is not NULL, set *<b>ri_old_out</b>
  * to the previous routerinfo.
@@ -499,6 +706,7 @@ nodelist_set_routerinfo(routerinfo_t *ri, routerinfo_t **ri_old_out)
   }
 
   node_add_to_address_set(node);
+  nodelist_node_exit_policy_changed(node);
 
   return node;
 }
@@ -539,6 +747,7 @@ nodelist_add_microdesc(microdesc_t *md)
       node_set_hsdir_index(node, ns);
     }
     node_add_to_ed25519_map(node);
+    nodelist_node_exit_policy_changed(node);
   }
 
   node_add_to_address_set(node);
@@ -624,6 +833,10 @@ nodelist_set_consensus(networkstatus_t *ns)
 
   nodelist_purge();
 
+  /* Many microdescriptors may have changed; rebuild the exit port sets
+   * lazily as they are next needed. */
+  nodelist_clear_exit_port_sets();
+
   /* Now add all the nodes we have to the address set. */
   SMARTLIST_FOREACH_BEGIN(the_nodelist->nodes, node_t *, node) {
     node_add_to_address_set(node);
@@ -667,6 +880,7 @@ nodelist_remove_microdesc(const char *identity_digest, microdesc_t *md)
     if (! node_get_ed25519_id(node)) {
       node_remove_from_ed25519_map(node);
     }
+    nodelist_node_exit_policy_changed(node);
   }
 }
 
@@ -680,6 +894,8 @@ nodelist_remove_routerinfo(routerinfo_t *ri)
     if (! node_is_usable(node)) {
       nodelist_drop_node(node, 1);
       node_free(node);
+    } else {
+      nodelist_node_exit_policy_changed(node);
     }
   }
 }
@@ -705,6 +921,9 @@ nodelist_drop_node(node_t *node, int remove_from_ht)
   if (idx < smartlist_len(the_nodelist->nodes)) {
     tmp = smartlist_get(the_nodelist->nodes, idx);
     tmp->nodelist_idx = idx;
+    nodelist_move_exit_port_bits(smartlist_len(the_nodelist->nodes), idx);
+  } else {
+    nodelist_move_exit_port_bits(idx, -1);
   }
   node->nodelist_idx = -1;
 }
@@ -790,6 +1009,8 @@ nodelist_free_all(void)
   address_set_free(the_nodelist->node_addrs);
   the_nodelist->node_addrs = NULL;
 
+  nodelist_clear_exit_port_sets();
+
   tor_free(the_nodelist);
 }
 
@@ -30,6 +30,9 @@ node_t *nodelist_set_routerinfo(routerinfo_t *ri, routerinfo_t **ri_old_out);
 node_t *nodelist_add_microdesc(microdesc_t *md);
 void nodelist_set_consensus(networkstatus_t *ns);
 int nodelist_probably_contains_address(const tor_addr_t *addr);
+bitarray_t *nodelist_get_exit_port_set(uint16_t port);
+void nodelist_node_exit_policy_changed(const node_t *node);
+void nodelist_subtract_nodes(smartlist_t *sl, const smartlist_t *excluded);
 
 void nodelist_remove_microdesc(const char *identity_digest, microdesc_t *md);
 void nodelist_remove_routerinfo(routerinfo_t *ri);
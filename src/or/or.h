@@ -106,6 +106,7 @@
 #define SIGNEWNYM 129
 #define SIGCLEARDNSCACHE 130
 #define SIGHEARTBEAT 131
+#define SIGDUMPTRACE 132
 
 #if (SIZEOF_CELL_T != 0)
 /* On Irix, stdlib.h defines a cell_t type, so we need to make sure
@@ -1516,6 +1517,14 @@ typedef struct or_handshake_state_t {
    * connection). We make a copy of this here to prevent a race condition
    * caused by TLS context rotation. */
   struct tor_cert_st *own_link_cert;
+  /** The value of get_ed_keys_generation() when we copied
+   * <b>own_link_cert</b>. */
+  uint64_t own_link_cert_generation;
+
+  /** If a cpuworker is doing public-key work for this handshake, the job
+   * for it.  We don't look at any more cells from the peer until the
+   * cpuworker replies. */
+  struct handshake_crypto_job_t *crypto_job;
 
   /** True iff we should feed outgoing cells into digest_sent and
    * digest_received respectively.
@@ -1622,6 +1631,15 @@ typedef struct or_connection_t {
    * geoip cache and handled by the DoS mitigation subsystem. We use this to
    * insure we have a coherent count of concurrent connection. */
   unsigned int tracked_for_dos_mitigation : 1;
+  /** True iff this client connection has been counted in the address prefix
+   * sketch of the DoS mitigation subsystem. */
+  unsigned int tracked_for_dos_prefix : 1;
+  /** If tracked_for_dos_prefix is set, the prefix length that this
+   * connection was counted with. */
+  uint8_t dos_prefix_bits;
+  /** If tracked_for_dos_prefix is set, the generation of the prefix sketches
+   * that this connection was counted in. */
+  uint32_t dos_prefix_generation;
 
   uint16_t link_proto; /**< What protocol version are we using? 0 for
                         * "none negotiated yet." */
@@ -1916,6 +1934,11 @@ typedef struct control_connection_t {
   /** A control command that we're reading from the inbuf, but which has not
    * yet arrived completely. */
   char *incoming_cmd;
+
+  /** If we're in the middle of writing a GETINFO reply as the connection
+   * drains, its state; otherwise NULL.  We don't handle further commands
+   * until it's done. */
+  struct control_getinfo_stream_t *getinfo_stream;
 } control_connection_t;
 
 /** Cast a connection_t subtype pointer to a connection_t **/
@@ -2018,6 +2041,10 @@ typedef struct addr_policy_t {
   uint16_t prt_max; /**< Highest port number to accept/reject. */
 } addr_policy_t;
 
+/** A read-only form of an addr_policy_t list that is faster to evaluate.
+ * See addr_policy_compile(). */
+typedef struct compiled_addr_policy_t compiled_addr_policy_t;
+
 /** A cached_dir_t represents a cacheable directory object, along with its
  * compressed form. */
 typedef struct cached_dir_t {
@@ -2250,6 +2277,9 @@ typedef struct {
   /** What streams will this OR permit to exit on IPv6?
    * NULL for 'reject *:*' */
   struct short_policy_t *ipv6_exit_policy;
+  /** Compiled form of <b>exit_policy</b>, built the first time we evaluate
+   * the policy, or NULL. */
+  struct compiled_addr_policy_t *compiled_exit_policy;
   long uptime; /**< How many seconds the router claims to have been up */
   smartlist_t *declared_family; /**< Nicknames of router which this router
                                  * claims are its family. */
@@ -3326,6 +3356,18 @@ typedef struct origin_circuit_t {
    * present. */
   int global_origin_circuit_list_idx;
 
+  /** Links for the list of origin circuits with the same purpose as this
+   * one.  Not linked if the circuit's purpose isn't set yet. */
+  TOR_LIST_ENTRY(origin_circuit_t) purpose_link;
+
+  /** When circuit_expire_building() next needs to look at this circuit, in
+   * msec since the epoch.  Only meaningful while build_deadline_idx is
+   * nonnegative. */
+  int64_t build_deadline_msec;
+  /** Index of this circuit in the priority queue of circuits by
+   * build_deadline_msec, or -1 if it isn't there. */
+  int build_deadline_idx;
+
   /** How many more relay_early cells can we send on this circuit, according
    * to the specification? */
   unsigned int remaining_relay_early_cells : 4;
@@ -3777,6 +3819,14 @@ typedef struct {
                           * each log message occurs? */
   int TruncateLogFile; /**< Boolean: Should we truncate the log file
                             before we start writing? */
+  int AsyncLogging; /**< Boolean: Should a separate thread write our file
+                     * and console logs? */
+  uint64_t AsyncLogBufferSize; /**< Bytes of log messages we can queue for
+                                * that thread. */
+  char *AsyncLogOverflowPolicy; /**< What to do with messages when that
+                                 * queue is full: "drop" or "block". */
+  /** Derived from AsyncLogOverflowPolicy. */
+  log_async_overflow_t AsyncLogOverflowPolicy_;
   char *SyslogIdentityTag; /**< Identity tag to add for syslog logging. */
 
   char *DebugLogFile; /**< Where to send verbose log messages. */
@@ -4306,6 +4356,11 @@ typedef struct {
                                 * with weird characters. */
   /** If true, we try resolving hostnames with weird characters. */
   int ServerDNSAllowNonRFC953Hostnames;
+  /** How much memory may answers in our exit DNS cache use? */
+  uint64_t ServerDNSCacheMaxMemory;
+  /** How many streams must a cached DNS answer serve before we refresh it
+   * ahead of its expiry? 0 to never refresh answers. */
+  int ServerDNSPrefetchMinHits;
 
   /** If true, we try to download extra-info documents (and we serve them,
    * if we are a cache).  For authorities, this is always true. */
@@ -4823,6 +4878,20 @@ typedef struct {
    * used against it. See the dos_conn_defense_type_t enum. */
   int DoSConnectionDefenseType;
 
+  /** Autobool: Do we also account circuits and connections per address
+   * prefix? */
+  int DoSPrefixAggregationEnabled;
+  /** Length of the prefixes IPv4 addresses are aggregated to. */
+  int DoSPrefixIPv4Bits;
+  /** Length of the prefixes IPv6 addresses are aggregated to. */
+  int DoSPrefixIPv6Bits;
+  /** Circuit rate used for a whole address prefix. */
+  int DoSPrefixCircuitRate;
+  /** Maximum circuit burst of a whole address prefix. */
+  int DoSPrefixCircuitBurst;
+  /** Maximum concurrent connections allowed per address prefix. */
+  int DoSPrefixMaxConcurrentCount;
+
   /** Autobool: Do we refuse single hop client rendezvous? */
   int DoSRefuseSingleHopClientRendezvous;
 } or_options_t;
@@ -4886,8 +4955,10 @@ typedef struct {
   smartlist_t *BWHistoryDirWriteValues;
   smartlist_t *BWHistoryDirWriteMaxima;
 
-  /** Build time histogram */
+  /** Build time histogram, one line per bin.  We only read this form. */
   config_line_t * BuildtimeHistogram;
+  /** Build time histogram, as base64-encoded (bin, count) pairs. */
+  char *BuildtimeHistogramPacked;
   int TotalBuildTimes;
   int CircuitBuildAbandonedCount;
 
@@ -5405,6 +5476,12 @@ typedef struct rend_encoded_v2_service_descriptor_t {
 #define INTRO_POINT_MAX_LIFETIME_INTRODUCTIONS \
   (INTRO_POINT_MIN_LIFETIME_INTRODUCTIONS * 2)
 
+/** The highest rate of INTRODUCE2 cells which a hidden service will wrongly
+ * reject as replays, for an introduction point that hasn't received more
+ * than its maximum number of INTRODUCE2 cells.  A client whose cell was
+ * rejected this way can just retry with a fresh one. */
+#define INTRO_POINT_REPLAY_FALSE_POSITIVE_RATE 1e-6
+
 /** The minimum number of seconds that an introduction point will last
  * before expiring due to old age.  (If it receives
  * INTRO_POINT_LIFETIME_INTRODUCTIONS INTRODUCE2 cells, it may expire
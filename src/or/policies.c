@@ -1340,7 +1340,11 @@ HT_GENERATE2(policy_map, policy_map_ent_t, node, policy_hash,
 
 /** Given a pointer to an addr_policy_t, return a copy of the pointer to the
  * "canonical" copy of that addr_policy_t; the canonical copy is a single
- * reference-counted object. */
+ * reference-counted object.
+ *
+ * The table of canonical entries belongs to the main thread: elsewhere,
+ * return a private copy of <b>e</b> instead, which the main thread can later
+ * replace with addr_policy_list_make_canonical(). */
 addr_policy_t *
 addr_policy_get_canonical_entry(addr_policy_t *e)
 {
@@ -1348,6 +1352,12 @@ addr_policy_get_canonical_entry(addr_policy_t *e)
   if (e->is_canonical)
     return e;
 
+  if (!in_main_thread()) {
+    addr_policy_t *copy = tor_memdup(e, sizeof(addr_policy_t));
+    copy->refcnt = 1;
+    return copy;
+  }
+
   search.policy = e;
   found = HT_FIND(policy_map, &policy_root, &search);
   if (!found) {
@@ -1363,6 +1373,22 @@ addr_policy_get_canonical_entry(addr_policy_t *e)
   return found->policy;
 }
 
+/** Replace every entry in <b>lst</b> that isn't canonical with a reference
+ * to its canonical copy, releasing the original.  Used on policies that were
+ * parsed outside the main thread. */
+void
+addr_policy_list_make_canonical(smartlist_t *lst)
+{
+  if (!lst)
+    return;
+  SMARTLIST_FOREACH_BEGIN(lst, addr_policy_t *, p) {
+    if (!p->is_canonical) {
+      smartlist_set(lst, p_sl_idx, addr_policy_get_canonical_entry(p));
+      addr_policy_free(p);
+    }
+  } SMARTLIST_FOREACH_END(p);
+}
+
 /** Helper for compare_tor_addr_to_addr_policy.  Implements the case where
  * addr and port are both known. */
 static addr_policy_result_t
@@ -1508,6 +1534,525 @@ compare_tor_addr_to_addr_policy,(const tor_addr_t *addr, uint16_t port,
   }
 }
 
+/* Compiled address policies.
+ *
+ * An addr_policy_t list is a first-match list: the first entry whose address
+ * and port range both match decides the result.  Evaluating it linearly costs
+ * one masked address comparison per entry, which adds up for long exit
+ * policies that we check on every BEGIN cell and for every candidate exit.
+ *
+ * A compiled_addr_policy_t holds the same decision in a form that can be
+ * queried in time proportional to the address length.  Every entry is
+ * inserted into a binary prefix trie for its address family, at the depth
+ * given by its maskbits.  The entries ending at each trie node are then
+ * flattened into a sorted table of disjoint port ranges, each naming the
+ * first entry (by position in the original list) that covers those ports.
+ * To decide an addr:port, we walk the trie along the bits of the address and
+ * take the lowest entry index found in any visited node's port table.
+ *
+ * The "unknown address" case (compare_unknown_tor_addr_to_addr_policy) only
+ * depends on the port, so we precompute its answer for every port range as
+ * well.  The "unknown port" case is answered from a few per-node summaries.
+ */
+
+/** Sentinel entry index meaning "no entry matches". */
+#define CPOLICY_NO_MATCH INT_MAX
+
+/** An entry in the port table of a compiled policy trie node, or in the
+ * unknown-address port table.  Ports <b>prt_min</b> through <b>prt_max</b>
+ * (inclusive) map to <b>val</b>. */
+typedef struct compiled_port_range_t {
+  uint16_t prt_min;
+  uint16_t prt_max;
+  /** For trie nodes, the index of the first policy entry that ends at this
+   * node and covers these ports.  For the unknown-address table, an
+   * addr_policy_result_t. */
+  int val;
+} compiled_port_range_t;
+
+/** A node in the binary prefix trie of a compiled address policy. */
+typedef struct compiled_policy_node_t {
+  /** Indices of the children for the next address bit being 0 or 1, or -1
+   * if there is no such child. */
+  int child[2];
+  /** The lowest policy entry index ending at this node or any of its
+   * descendants.  Used to stop the walk early. */
+  int subtree_min_idx;
+  /** The lowest index of an entry ending at this node that covers every
+   * port. */
+  int first_allports_idx;
+  /** The lowest index of a reject entry ending at this node that covers only
+   * some ports. */
+  int first_partial_reject_idx;
+  /** The lowest index of an accept entry ending at this node that covers
+   * only some ports. */
+  int first_partial_accept_idx;
+  /** Position of this node's port table within the ranges array of the
+   * compiled policy, and its length. */
+  int ranges_offset;
+  int n_ranges;
+} compiled_policy_node_t;
+
+/** A compiled, read-only form of an addr_policy_t list.  See the comment
+ * above for the layout. */
+struct compiled_addr_policy_t {
+  /** Trie nodes for both families.  Node 0 is the IPv4 root and node 1 is
+   * the IPv6 root. */
+  compiled_policy_node_t *nodes;
+  int n_nodes;
+  int nodes_allocated;
+  /** Port tables for all trie nodes, concatenated. */
+  compiled_port_range_t *ranges;
+  int n_ranges;
+  int ranges_allocated;
+  /** For each policy entry, 1 if it is an accept entry, else 0. */
+  uint8_t *is_accept;
+  int n_entries;
+  /** Port table for compare_unknown_tor_addr_to_addr_policy(): covers every
+   * port from 1 to 65535, in order. */
+  compiled_port_range_t *unknown_addr_ranges;
+  int n_unknown_addr_ranges;
+  int unknown_addr_ranges_allocated;
+};
+
+/** Index of the IPv4 and IPv6 trie roots in compiled_addr_policy_t.nodes. */
+#define CPOLICY_ROOT_IPV4 0
+#define CPOLICY_ROOT_IPV6 1
+
+/** Append a fresh, childless trie node to <b>cp</b> and return its index. */
+static int
+compiled_policy_new_node(compiled_addr_policy_t *cp)
+{
+  compiled_policy_node_t *node;
+  if (cp->n_nodes == cp->nodes_allocated) {
+    cp->nodes_allocated = cp->nodes_allocated ? cp->nodes_allocated * 2 : 16;
+    cp->nodes = tor_reallocarray(cp->nodes, cp->nodes_allocated,
+                                 sizeof(compiled_policy_node_t));
+  }
+  node = &cp->nodes[cp->n_nodes];
+  memset(node, 0, sizeof(*node));
+  node->child[0] = node->child[1] = -1;
+  node->subtree_min_idx = CPOLICY_NO_MATCH;
+  node->first_allports_idx = CPOLICY_NO_MATCH;
+  node->first_partial_reject_idx = CPOLICY_NO_MATCH;
+  node->first_partial_accept_idx = CPOLICY_NO_MATCH;
+  return cp->n_nodes++;
+}
+
+/** Append a port range mapping to <b>val</b> onto the array <b>*arr</b> of
+ * length <b>*n</b> and capacity <b>*n_alloc</b>, merging it with the last
+ * range if they are adjacent and map to the same value. */
+static void
+compiled_port_ranges_add(compiled_port_range_t **arr, int *n, int *n_alloc,
+                         int merge_from, uint16_t prt_min, uint16_t prt_max,
+                         int val)
+{
+  if (*n > merge_from) {
+    compiled_port_range_t *last = &(*arr)[*n - 1];
+    if (last->val == val && last->prt_max + 1 == prt_min) {
+      last->prt_max = prt_max;
+      return;
+    }
+  }
+  if (*n == *n_alloc) {
+    *n_alloc = *n_alloc ? *n_alloc * 2 : 16;
+    *arr = tor_reallocarray(*arr, *n_alloc, sizeof(compiled_port_range_t));
+  }
+  (*arr)[*n].prt_min = prt_min;
+  (*arr)[*n].prt_max = prt_max;
+  (*arr)[*n].val = val;
+  ++*n;
+}
+
+/** Helper for sorting uint32_t port boundaries. */
+static int
+compare_uint32_ports_(const void **a, const void **b)
+{
+  const uintptr_t pa = (uintptr_t)*a, pb = (uintptr_t)*b;
+  return (pa > pb) - (pa < pb);
+}
+
+/** Return a sorted list (as uintptr_t values) of every port at which the
+ * set of entries among <b>entries</b> covering a port can change: each
+ * entry's prt_min and prt_max+1, plus 1 and 65536. */
+static smartlist_t *
+compiled_policy_port_boundaries(const smartlist_t *entries)
+{
+  smartlist_t *bounds = smartlist_new();
+  smartlist_add(bounds, (void*)(uintptr_t)1);
+  smartlist_add(bounds, (void*)(uintptr_t)65536);
+  SMARTLIST_FOREACH_BEGIN(entries, const addr_policy_t *, e) {
+    smartlist_add(bounds, (void*)(uintptr_t)MAX(e->prt_min, 1));
+    smartlist_add(bounds, (void*)(uintptr_t)(e->prt_max + 1));
+  } SMARTLIST_FOREACH_END(e);
+  smartlist_sort(bounds, compare_uint32_ports_);
+  smartlist_uniq(bounds, compare_uint32_ports_, NULL);
+  return bounds;
+}
+
+/** Build the port table for trie node <b>node_idx</b> of <b>cp</b> from
+ * <b>entries</b>, the policy entries ending at that node, and the matching
+ * list <b>entry_idx</b> of their indices in the policy.  Both lists are in
+ * policy order. */
+static void
+compiled_policy_build_node_ranges(compiled_addr_policy_t *cp, int node_idx,
+                                  const smartlist_t *entries,
+                                  const smartlist_t *entry_idx)
+{
+  compiled_policy_node_t *node = &cp->nodes[node_idx];
+  smartlist_t *bounds;
+  int i;
+
+  node->ranges_offset = cp->n_ranges;
+  if (smartlist_len(entries) == 0)
+    return;
+
+  bounds = compiled_policy_port_boundaries(entries);
+  for (i = 0; i < smartlist_len(bounds) - 1; ++i) {
+    const uint32_t lo = (uint32_t)(uintptr_t)smartlist_get(bounds, i);
+    const uint32_t hi = (uint32_t)(uintptr_t)smartlist_get(bounds, i+1) - 1;
+    SMARTLIST_FOREACH_BEGIN(entries, const addr_policy_t *, e) {
+      if (e->prt_min <= lo && lo <= e->prt_max) {
+        int idx = (int)(intptr_t)smartlist_get(entry_idx, e_sl_idx);
+        compiled_port_ranges_add(&cp->ranges, &cp->n_ranges,
+                                 &cp->ranges_allocated, node->ranges_offset,
+                                 (uint16_t)lo, (uint16_t)hi, idx);
+        break;
+      }
+    } SMARTLIST_FOREACH_END(e);
+  }
+  smartlist_free(bounds);
+  node->n_ranges = cp->n_ranges - node->ranges_offset;
+}
+
+/** Return the number of address bits that <b>e</b> actually compares, or -1
+ * if <b>e</b> can never match a known IPv4 or IPv6 address. */
+static int
+compiled_policy_entry_depth(const addr_policy_t *e)
+{
+  switch (tor_addr_family(&e->addr)) {
+    case AF_INET:
+      return MIN(e->maskbits, 32);
+    case AF_INET6:
+      return MIN(e->maskbits, 128);
+    default:
+      return -1;
+  }
+}
+
+/** Return bit <b>depth</b> (counting from the most significant bit) of the
+ * IPv4 or IPv6 address <b>addr</b>. */
+static inline int
+compiled_policy_addr_bit(const tor_addr_t *addr, int depth)
+{
+  if (tor_addr_family(addr) == AF_INET) {
+    return (tor_addr_to_ipv4h(addr) >> (31 - depth)) & 1;
+  } else {
+    const uint8_t *a = tor_addr_to_in6_addr8(addr);
+    return (a[depth >> 3] >> (7 - (depth & 7))) & 1;
+  }
+}
+
+/** Compile <b>policy</b>, a list of addr_policy_t, into a
+ * compiled_addr_policy_t that gives the same answers as
+ * compare_tor_addr_to_addr_policy() for every address and port.  Return
+ * NULL if <b>policy</b> is NULL.  The result does not refer to
+ * <b>policy</b>, and must be freed with compiled_addr_policy_free(). */
+compiled_addr_policy_t *
+addr_policy_compile(const smartlist_t *policy)
+{
+  compiled_addr_policy_t *cp;
+  smartlist_t **node_entries, **node_entry_idx;
+  smartlist_t *bounds;
+  int i;
+
+  if (!policy)
+    return NULL;
+
+  cp = tor_malloc_zero(sizeof(compiled_addr_policy_t));
+  cp->n_entries = smartlist_len(policy);
+  cp->is_accept = tor_malloc_zero(cp->n_entries ? cp->n_entries : 1);
+  compiled_policy_new_node(cp); /* CPOLICY_ROOT_IPV4 */
+  compiled_policy_new_node(cp); /* CPOLICY_ROOT_IPV6 */
+
+  /* First pass: insert every entry into its family's trie. */
+  SMARTLIST_FOREACH_BEGIN(policy, const addr_policy_t *, e) {
+    const int depth = compiled_policy_entry_depth(e);
+    const int allports = (e->prt_min <= 1 && e->prt_max >= 65535);
+    int n, d;
+
+    cp->is_accept[e_sl_idx] = (e->policy_type == ADDR_POLICY_ACCEPT);
+    if (depth < 0)
+      continue;
+
+    n = tor_addr_family(&e->addr) == AF_INET ?
+      CPOLICY_ROOT_IPV4 : CPOLICY_ROOT_IPV6;
+    for (d = 0; ; ++d) {
+      compiled_policy_node_t *node = &cp->nodes[n];
+      if (e_sl_idx < node->subtree_min_idx)
+        node->subtree_min_idx = e_sl_idx;
+      if (d == depth)
+        break;
+      const int bit = compiled_policy_addr_bit(&e->addr, d);
+      if (node->child[bit] < 0) {
+        const int child = compiled_policy_new_node(cp);
+        /* compiled_policy_new_node() may have moved cp->nodes. */
+        cp->nodes[n].child[bit] = child;
+      }
+      n = cp->nodes[n].child[bit];
+    }
+
+    compiled_policy_node_t *node = &cp->nodes[n];
+    if (allports) {
+      if (e_sl_idx < node->first_allports_idx)
+        node->first_allports_idx = e_sl_idx;
+    } else if (e->policy_type == ADDR_POLICY_REJECT) {
+      if (e_sl_idx < node->first_partial_reject_idx)
+        node->first_partial_reject_idx = e_sl_idx;
+    } else {
+      if (e_sl_idx < node->first_partial_accept_idx)
+        node->first_partial_accept_idx = e_sl_idx;
+    }
+  } SMARTLIST_FOREACH_END(e);
+
+  /* Second pass: group the entries by the node where they end, in policy
+   * order, and flatten each group into a port table. */
+  node_entries = tor_calloc(cp->n_nodes, sizeof(smartlist_t *));
+  node_entry_idx = tor_calloc(cp->n_nodes, sizeof(smartlist_t *));
+  SMARTLIST_FOREACH_BEGIN(policy, const addr_policy_t *, e) {
+    const int depth = compiled_policy_entry_depth(e);
+    int n, d;
+    if (depth < 0)
+      continue;
+    n = tor_addr_family(&e->addr) == AF_INET ?
+      CPOLICY_ROOT_IPV4 : CPOLICY_ROOT_IPV6;
+    for (d = 0; d < depth; ++d)
+      n = cp->nodes[n].child[compiled_policy_addr_bit(&e->addr, d)];
+    if (!node_entries[n]) {
+      node_entries[n] = smartlist_new();
+      node_entry_idx[n] = smartlist_new();
+    }
+    smartlist_add(node_entries[n], (void*)e);
+    smartlist_add(node_entry_idx[n], (void*)(intptr_t)e_sl_idx);
+  } SMARTLIST_FOREACH_END(e);
+
+  for (i = 0; i < cp->n_nodes; ++i) {
+    if (node_entries[i]) {
+      compiled_policy_build_node_ranges(cp, i, node_entries[i],
+                                        node_entry_idx[i]);
+      smartlist_free(node_entries[i]);
+      smartlist_free(node_entry_idx[i]);
+    } else {
+      cp->nodes[i].ranges_offset = cp->n_ranges;
+    }
+  }
+  tor_free(node_entries);
+  tor_free(node_entry_idx);
+
+  /* Finally, the unknown-address table.  The answer for an unknown address
+   * only depends on which entries cover the port, so it is constant between
+   * consecutive port boundaries. */
+  bounds = compiled_policy_port_boundaries(policy);
+  for (i = 0; i < smartlist_len(bounds) - 1; ++i) {
+    const uint32_t lo = (uint32_t)(uintptr_t)smartlist_get(bounds, i);
+    const uint32_t hi = (uint32_t)(uintptr_t)smartlist_get(bounds, i+1) - 1;
+    addr_policy_result_t r =
+      compare_unknown_tor_addr_to_addr_policy((uint16_t)lo, policy);
+    compiled_port_ranges_add(&cp->unknown_addr_ranges,
+                             &cp->n_unknown_addr_ranges,
+                             &cp->unknown_addr_ranges_allocated, 0,
+                             (uint16_t)lo, (uint16_t)hi, (int)r);
+  }
+  smartlist_free(bounds);
+
+  return cp;
+}
+
+/** Release all storage held by <b>cp</b>. */
+void
+compiled_addr_policy_free(compiled_addr_policy_t *cp)
+{
+  if (!cp)
+    return;
+  tor_free(cp->nodes);
+  tor_free(cp->ranges);
+  tor_free(cp->is_accept);
+  tor_free(cp->unknown_addr_ranges);
+  tor_free(cp);
+}
+
+/** Return the value of the range containing <b>port</b> in the sorted,
+ * disjoint port table <b>ranges</b> of length <b>n</b>, or <b>dflt</b> if
+ * no range contains it. */
+static inline int
+compiled_port_ranges_lookup(const compiled_port_range_t *ranges, int n,
+                            uint16_t port, int dflt)
+{
+  int lo = 0, hi = n - 1;
+  while (lo <= hi) {
+    const int mid = (lo + hi) / 2;
+    if (port < ranges[mid].prt_min)
+      hi = mid - 1;
+    else if (port > ranges[mid].prt_max)
+      lo = mid + 1;
+    else
+      return ranges[mid].val;
+  }
+  return dflt;
+}
+
+/** Return the index of the root node of the trie in <b>cp</b> for the
+ * family of <b>addr</b>, and set *<b>nbits_out</b> to the address length
+ * in bits.  Return -1 if <b>addr</b> is neither IPv4 nor IPv6. */
+static int
+compiled_policy_root_for_addr(const tor_addr_t *addr, int *nbits_out)
+{
+  switch (tor_addr_family(addr)) {
+    case AF_INET:
+      *nbits_out = 32;
+      return CPOLICY_ROOT_IPV4;
+    case AF_INET6:
+      *nbits_out = 128;
+      return CPOLICY_ROOT_IPV6;
+    default:
+      return -1;
+  }
+}
+
+/** Compiled-policy counterpart of compare_known_tor_addr_to_addr_policy. */
+static addr_policy_result_t
+compare_known_tor_addr_to_compiled_policy(const tor_addr_t *addr,
+                                          uint16_t port,
+                                          const compiled_addr_policy_t *cp)
+{
+  int nbits, depth, n, best = CPOLICY_NO_MATCH;
+
+  n = compiled_policy_root_for_addr(addr, &nbits);
+  for (depth = 0; n >= 0; ++depth) {
+    const compiled_policy_node_t *node = &cp->nodes[n];
+    int idx;
+    /* Nothing at or below this node can beat what we already have. */
+    if (node->subtree_min_idx >= best)
+      break;
+    idx = compiled_port_ranges_lookup(cp->ranges + node->ranges_offset,
+                                      node->n_ranges, port,
+                                      CPOLICY_NO_MATCH);
+    if (idx < best)
+      best = idx;
+    if (depth == nbits)
+      break;
+    n = node->child[compiled_policy_addr_bit(addr, depth)];
+  }
+
+  if (best == CPOLICY_NO_MATCH) {
+    /* accept all by default. */
+    return ADDR_POLICY_ACCEPTED;
+  }
+  return cp->is_accept[best] ? ADDR_POLICY_ACCEPTED : ADDR_POLICY_REJECTED;
+}
+
+/** Compiled-policy counterpart of
+ * compare_known_tor_addr_to_addr_policy_noport. */
+static addr_policy_result_t
+compare_known_tor_addr_to_compiled_policy_noport(const tor_addr_t *addr,
+                                          const compiled_addr_policy_t *cp)
+{
+  int nbits, depth, n;
+  int first_allports = CPOLICY_NO_MATCH;
+  int first_reject = CPOLICY_NO_MATCH, first_accept = CPOLICY_NO_MATCH;
+
+  /* Find the first all-ports entry matching addr, and the first partial
+   * accept and reject entries.  Partial entries that come before the
+   * all-ports one are the "maybe" matches of the linear version. */
+  n = compiled_policy_root_for_addr(addr, &nbits);
+  for (depth = 0; n >= 0; ++depth) {
+    const compiled_policy_node_t *node = &cp->nodes[n];
+    first_allports = MIN(first_allports, node->first_allports_idx);
+    first_reject = MIN(first_reject, node->first_partial_reject_idx);
+    first_accept = MIN(first_accept, node->first_partial_accept_idx);
+    if (depth == nbits)
+      break;
+    n = node->child[compiled_policy_addr_bit(addr, depth)];
+  }
+
+  if (first_allports != CPOLICY_NO_MATCH) {
+    if (cp->is_accept[first_allports]) {
+      return first_reject < first_allports ? ADDR_POLICY_PROBABLY_ACCEPTED :
+        ADDR_POLICY_ACCEPTED;
+    } else {
+      return first_accept < first_allports ? ADDR_POLICY_PROBABLY_REJECTED :
+        ADDR_POLICY_REJECTED;
+    }
+  }
+
+  /* accept all by default. */
+  return first_reject != CPOLICY_NO_MATCH ? ADDR_POLICY_PROBABLY_ACCEPTED :
+    ADDR_POLICY_ACCEPTED;
+}
+
+/** As compare_tor_addr_to_addr_policy(), but use the compiled policy
+ * <b>cp</b> (as returned by addr_policy_compile()) instead of walking the
+ * policy list.  The result is always the same as it would be for the
+ * original list. */
+addr_policy_result_t
+compare_tor_addr_to_compiled_addr_policy(const tor_addr_t *addr,
+                                         uint16_t port,
+                                         const compiled_addr_policy_t *cp)
+{
+  if (!cp) {
+    /* no policy? accept all. */
+    return ADDR_POLICY_ACCEPTED;
+  } else if (addr == NULL || tor_addr_is_null(addr)) {
+    if (port == 0) {
+      log_info(LD_BUG, "Rejecting null address with 0 port (family %d)",
+               addr ? tor_addr_family(addr) : -1);
+      return ADDR_POLICY_REJECTED;
+    }
+    const int r = compiled_port_ranges_lookup(cp->unknown_addr_ranges,
+                                              cp->n_unknown_addr_ranges, port,
+                                              ADDR_POLICY_ACCEPTED);
+    return (addr_policy_result_t) r;
+  } else if (port == 0) {
+    return compare_known_tor_addr_to_compiled_policy_noport(addr, cp);
+  } else {
+    return compare_known_tor_addr_to_compiled_policy(addr, port, cp);
+  }
+}
+
+/** Return the compiled form of <b>router</b>'s exit policy, building and
+ * caching it on first use.  Return NULL if the policy is short enough that
+ * walking it linearly is just as fast. */
+static const compiled_addr_policy_t *
+router_get_compiled_exit_policy(const routerinfo_t *router)
+{
+  if (!router->exit_policy ||
+      smartlist_len(router->exit_policy) < POLICY_COMPILE_MIN_ENTRIES)
+    return NULL;
+
+  if (!router->compiled_exit_policy) {
+    /* The compiled policy is only a cache of exit_policy, which never
+     * changes once the routerinfo is built, so it is safe to fill it in on
+     * a const routerinfo. */
+    ((routerinfo_t *)router)->compiled_exit_policy =
+      addr_policy_compile(router->exit_policy);
+  }
+  return router->compiled_exit_policy;
+}
+
+/** Decide whether addr:port is probably or definitely accepted or rejected by
+ * the IPv4 and IPv6 exit policy of <b>router</b>.  See
+ * compare_tor_addr_to_addr_policy for details on addr/port interpretation. */
+addr_policy_result_t
+compare_tor_addr_to_router_exit_policy(const tor_addr_t *addr, uint16_t port,
+                                       const routerinfo_t *router)
+{
+  const compiled_addr_policy_t *cp = router_get_compiled_exit_policy(router);
+  if (cp)
+    return compare_tor_addr_to_compiled_addr_policy(addr, port, cp);
+  else
+    return compare_tor_addr_to_addr_policy(addr, port, router->exit_policy);
+}
+
 /** Return true iff the address policy <b>a</b> covers every case that
  * would be covered by <b>b</b>, so that a,b is redundant. */
 static int
@@ -2138,6 +2683,7 @@ void
 policies_set_node_exitpolicy_to_reject_all(node_t *node)
 {
   node->rejects_all = 1;
+  nodelist_node_exit_policy_changed(node);
 }
 
 /** Return 1 if there is at least one /8 subnet in <b>policy</b> that
@@ -2863,7 +3409,7 @@ compare_tor_addr_to_node_policy(const tor_addr_t *addr, uint16_t port,
   }
 
   if (node->ri) {
-    return compare_tor_addr_to_addr_policy(addr, port, node->ri->exit_policy);
+    return compare_tor_addr_to_router_exit_policy(addr, port, node->ri);
   } else if (node->md) {
     if (node->md->exit_policy == NULL)
       return ADDR_POLICY_REJECTED;
@@ -33,6 +33,11 @@ typedef enum firewall_connection_t {
 
 typedef int exit_policy_parser_cfg_t;
 
+/** Exit policies with at least this many entries are compiled (see
+ * addr_policy_compile()) before we evaluate them for a router; shorter ones
+ * are just as fast to walk. */
+#define POLICY_COMPILE_MIN_ENTRIES 8
+
 int firewall_is_fascist_or(void);
 int firewall_is_fascist_dir(void);
 int fascist_firewall_use_ipv6(const or_options_t *options);
@@ -76,11 +81,21 @@ void policy_expand_unspec(smartlist_t **policy);
 int policies_parse_from_options(const or_options_t *options);
 
 addr_policy_t *addr_policy_get_canonical_entry(addr_policy_t *ent);
+void addr_policy_list_make_canonical(smartlist_t *lst);
 int addr_policies_eq(const smartlist_t *a, const smartlist_t *b);
 MOCK_DECL(addr_policy_result_t, compare_tor_addr_to_addr_policy,
     (const tor_addr_t *addr, uint16_t port, const smartlist_t *policy));
 addr_policy_result_t compare_tor_addr_to_node_policy(const tor_addr_t *addr,
                               uint16_t port, const node_t *node);
+addr_policy_result_t compare_tor_addr_to_router_exit_policy(
+                              const tor_addr_t *addr, uint16_t port,
+                              const routerinfo_t *router);
+
+compiled_addr_policy_t *addr_policy_compile(const smartlist_t *policy);
+void compiled_addr_policy_free(compiled_addr_policy_t *cp);
+addr_policy_result_t compare_tor_addr_to_compiled_addr_policy(
+                              const tor_addr_t *addr, uint16_t port,
+                              const compiled_addr_policy_t *cp);
 
 int policies_parse_exit_policy_from_options(
                                           const or_options_t *or_options,
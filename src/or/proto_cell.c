@@ -82,3 +82,39 @@ fetch_var_cell_from_buf(buf_t *buf, var_cell_t **out, int linkproto)
   return 1;
 }
 
+/** Look for a run of complete fixed-length cells, in the format of link
+ * protocol <b>linkproto</b>, at the start of <b>buf</b>.  Set
+ * *<b>cells_out</b> to point to the first of them, in place, and return
+ * how many of them there are.  The run stops at the end of the first chunk
+ * of <b>buf</b>, at the first variable-length cell, or at the first
+ * incomplete cell, whichever comes first.  Return 0 if there is no complete
+ * fixed-length cell at the start of <b>buf</b>.
+ *
+ * The cells stay on <b>buf</b>: the caller should drain them once it is
+ * done with them, and must not modify <b>buf</b> before then. */
+int
+peek_fixed_cells_from_buf(buf_t *buf, int linkproto, const char **cells_out)
+{
+  const int wide_circ_ids = linkproto >= MIN_LINK_PROTO_FOR_WIDE_CIRC_IDS;
+  const int circ_id_len = get_circ_id_size(wide_circ_ids);
+  const size_t cell_size = get_cell_network_size(wide_circ_ids);
+  const char *head;
+  size_t head_len;
+  int n = 0;
+
+  *cells_out = NULL;
+  if (buf_datalen(buf) < cell_size)
+    return 0;
+  /* Only a cell that straddles the first two chunks gets moved. */
+  buf_pullup(buf, cell_size, &head, &head_len);
+
+  while (head_len >= cell_size * (n + 1)) {
+    const uint8_t command = get_uint8(head + cell_size * n + circ_id_len);
+    if (cell_command_is_var_length(command, linkproto))
+      break;
+    ++n;
+  }
+  if (n)
+    *cells_out = head;
+  return n;
+}
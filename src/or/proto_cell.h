@@ -12,6 +12,8 @@ struct var_cell_t;
 
 int fetch_var_cell_from_buf(struct buf_t *buf, struct var_cell_t **out,
                             int linkproto);
+int peek_fixed_cells_from_buf(struct buf_t *buf, int linkproto,
+                              const char **cells_out);
 
 #endif /* !defined(TOR_PROTO_CELL_H) */
 
@@ -77,6 +77,7 @@
 #include "routerparse.h"
 #include "scheduler.h"
 #include "rephist.h"
+#include "trace/events.h"
 
 static edge_connection_t *relay_lookup_conn(circuit_t *circ, cell_t *cell,
                                             cell_direction_t cell_direction,
@@ -294,6 +295,7 @@ circuit_receive_relay_cell(cell_t *cell, circuit_t *circ,
   tor_assert(circ);
   tor_assert(cell_direction == CELL_DIRECTION_OUT ||
              cell_direction == CELL_DIRECTION_IN);
+  tor_trace(relay, recv, cell->circ_id, cell_direction);
   if (circ->marked_for_close) {
 
     /* Received cells on circuits that are marked for close are read from the
@@ -3072,6 +3074,7 @@ channel_flush_from_first_active_circuit, (channel_t *chan, int max))
   /* Okay, we're done sending now */
   assert_cmux_ok_paranoid(chan);
 
+  tor_trace(cell, flush, chan->global_identifier, n_flushed);
   return n_flushed;
 }
 
@@ -3232,6 +3235,7 @@ append_cell_to_circuit_queue(circuit_t *circ, channel_t *chan,
 
   cell_queue_append_packed_copy(circ, queue, exitward, cell,
                                 chan->wide_circ_ids, 1);
+  tor_trace(cell, queue, cell->command, cell->circ_id, direction, queue->n);
 
   if (PREDICT_UNLIKELY(cell_queues_check_size())) {
     /* We ran the OOM handler */
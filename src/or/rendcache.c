@@ -30,6 +30,11 @@ static strmap_t *rend_cache_local_service = NULL;
  * directories. */
 STATIC digestmap_t *rend_cache_v2_dir = NULL;
 
+/** Priority queue of the entries of rend_cache_v2_dir, oldest descriptor
+ * timestamp first, so that expiring or evicting them only costs as much as
+ * the number of entries we actually remove. */
+STATIC smartlist_t *rend_cache_v2_dir_by_age = NULL;
+
 /** (Client side only) Map from service id to rend_cache_failure_t. This
  * cache is used to track intro point(IP) failures so we know when to keep
  * or discard a new descriptor we just fetched. Here is a description of the
@@ -67,6 +72,7 @@ rend_cache_init(void)
 {
   rend_cache = strmap_new();
   rend_cache_v2_dir = digestmap_new();
+  rend_cache_v2_dir_by_age = smartlist_new();
   rend_cache_local_service = strmap_new();
   rend_cache_failure = strmap_new();
 }
@@ -232,10 +238,12 @@ rend_cache_free_all(void)
 {
   strmap_free(rend_cache, rend_cache_entry_free_);
   digestmap_free(rend_cache_v2_dir, rend_cache_entry_free_);
+  smartlist_free(rend_cache_v2_dir_by_age);
   strmap_free(rend_cache_local_service, rend_cache_entry_free_);
   strmap_free(rend_cache_failure, rend_cache_failure_entry_free_);
   rend_cache = NULL;
   rend_cache_v2_dir = NULL;
+  rend_cache_v2_dir_by_age = NULL;
   rend_cache_local_service = NULL;
   rend_cache_failure = NULL;
   rend_cache_total_allocation = 0;
@@ -465,6 +473,77 @@ rend_cache_intro_failure_note(rend_intro_point_failure_t failure,
   }
 }
 
+/** Helper: compare two HSDir cache entries by descriptor timestamp, for
+ * rend_cache_v2_dir_by_age. */
+static int
+compare_rend_cache_entry_timestamp_(const void *a_, const void *b_)
+{
+  const rend_cache_entry_t *a = a_, *b = b_;
+  if (a->parsed->timestamp < b->parsed->timestamp)
+    return -1;
+  else if (a->parsed->timestamp > b->parsed->timestamp)
+    return 1;
+  return 0;
+}
+
+/** Add the entry <b>e</b>, which must have a parsed descriptor, to the
+ * HSDir cache under <b>desc_id</b>. */
+STATIC void
+rend_cache_v2_dir_add(const char *desc_id, rend_cache_entry_t *e)
+{
+  tor_assert(desc_id);
+  tor_assert(e);
+  tor_assert(e->parsed);
+
+  memcpy(e->desc_id, desc_id, DIGEST_LEN);
+  digestmap_set(rend_cache_v2_dir, desc_id, e);
+  smartlist_pqueue_add(rend_cache_v2_dir_by_age,
+                       compare_rend_cache_entry_timestamp_,
+                       offsetof(rend_cache_entry_t, dir_heap_idx), e);
+}
+
+/** Remove the oldest entry of the HSDir cache, log it, and free it. Return
+ * the number of bytes it accounted for, or 0 if the cache is empty. */
+size_t
+rend_cache_remove_oldest_v2_desc_as_dir(void)
+{
+  rend_cache_entry_t *ent;
+  size_t bytes_removed;
+  char key_base32[REND_DESC_ID_V2_LEN_BASE32 + 1];
+
+  if (!rend_cache_v2_dir_by_age ||
+      smartlist_len(rend_cache_v2_dir_by_age) == 0)
+    return 0;
+
+  ent = smartlist_pqueue_pop(rend_cache_v2_dir_by_age,
+                             compare_rend_cache_entry_timestamp_,
+                             offsetof(rend_cache_entry_t, dir_heap_idx));
+  base32_encode(key_base32, sizeof(key_base32), ent->desc_id, DIGEST_LEN);
+  log_info(LD_REND, "Removing descriptor with ID '%s' from cache",
+           safe_str_client(key_base32));
+  bytes_removed = rend_cache_entry_allocation(ent);
+  digestmap_remove(rend_cache_v2_dir, ent->desc_id);
+  rend_cache_entry_free(ent);
+  return bytes_removed;
+}
+
+/** If the HSDir cache isn't empty, set *<b>timestamp_out</b> to the
+ * timestamp of its oldest descriptor and return 1. Else, return 0. */
+int
+rend_cache_get_oldest_v2_desc_as_dir(time_t *timestamp_out)
+{
+  const rend_cache_entry_t *ent;
+
+  tor_assert(timestamp_out);
+
+  if (!rend_cache_v2_dir_by_age ||
+      smartlist_len(rend_cache_v2_dir_by_age) == 0)
+    return 0;
+  ent = smartlist_get(rend_cache_v2_dir_by_age, 0);
+  *timestamp_out = ent->parsed->timestamp;
+  return 1;
+}
+
 /** Remove all old v2 descriptors and those for which this hidden service
  * directory is not responsible for any more. The cutoff is the time limit for
  * which we want to keep the cache entry. In other words, any entry created
@@ -472,27 +551,11 @@ rend_cache_intro_failure_note(rend_intro_point_failure_t failure,
 size_t
 rend_cache_clean_v2_descs_as_dir(time_t cutoff)
 {
-  digestmap_iter_t *iter;
   size_t bytes_removed = 0;
+  time_t oldest;
 
-  for (iter = digestmap_iter_init(rend_cache_v2_dir);
-       !digestmap_iter_done(iter); ) {
-    const char *key;
-    void *val;
-    rend_cache_entry_t *ent;
-    digestmap_iter_get(iter, &key, &val);
-    ent = val;
-    if (ent->parsed->timestamp < cutoff) {
-      char key_base32[REND_DESC_ID_V2_LEN_BASE32 + 1];
-      base32_encode(key_base32, sizeof(key_base32), key, DIGEST_LEN);
-      log_info(LD_REND, "Removing descriptor with ID '%s' from cache",
-               safe_str_client(key_base32));
-      bytes_removed += rend_cache_entry_allocation(ent);
-      iter = digestmap_iter_next_rmv(rend_cache_v2_dir, iter);
-      rend_cache_entry_free(ent);
-    } else {
-      iter = digestmap_iter_next(rend_cache_v2_dir, iter);
-    }
+  while (rend_cache_get_oldest_v2_desc_as_dir(&oldest) && oldest < cutoff) {
+    bytes_removed += rend_cache_remove_oldest_v2_desc_as_dir();
   }
 
   return bytes_removed;
@@ -765,13 +828,16 @@ rend_cache_store_v2_desc_as_dir(const char *desc)
     /* Store received descriptor. */
     if (!e) {
       e = tor_malloc_zero(sizeof(rend_cache_entry_t));
-      digestmap_set(rend_cache_v2_dir, desc_id, e);
       /* Treat something just uploaded as having been served a little
        * while ago, so that flooding with new descriptors doesn't help
        * too much.
        */
       e->last_served = approx_time() - 3600;
     } else {
+      /* Its timestamp is about to change: take it out of the queue. */
+      smartlist_pqueue_remove(rend_cache_v2_dir_by_age,
+                              compare_rend_cache_entry_timestamp_,
+                              offsetof(rend_cache_entry_t, dir_heap_idx), e);
       rend_cache_decrement_allocation(rend_cache_entry_allocation(e));
       rend_service_descriptor_free(e->parsed);
       tor_free(e->desc);
@@ -779,6 +845,7 @@ rend_cache_store_v2_desc_as_dir(const char *desc)
     e->parsed = parsed;
     e->desc = tor_strndup(current_desc, encoded_size);
     e->len = encoded_size;
+    rend_cache_v2_dir_add(desc_id, e);
     rend_cache_increment_allocation(rend_cache_entry_allocation(e));
     log_info(LD_REND, "Successfully stored service descriptor with desc ID "
              "'%s' and len %d.",
@@ -32,6 +32,11 @@ typedef struct rend_cache_entry_t {
                        * (HSDir only) */
   char *desc; /**< Service descriptor */
   rend_service_descriptor_t *parsed; /**< Parsed value of 'desc' */
+  /** Descriptor ID under which this entry is stored. (HSDir only) */
+  char desc_id[DIGEST_LEN];
+  /** Position of this entry in the HSDir priority queue of entries by
+   * descriptor timestamp. (HSDir only) */
+  int dir_heap_idx;
 } rend_cache_entry_t;
 
 /* Introduction point failure type. */
@@ -64,6 +69,8 @@ void rend_cache_init(void);
 void rend_cache_clean(time_t now, rend_cache_type_t cache_type);
 void rend_cache_failure_clean(time_t now);
 size_t rend_cache_clean_v2_descs_as_dir(time_t cutoff);
+int rend_cache_get_oldest_v2_desc_as_dir(time_t *timestamp_out);
+size_t rend_cache_remove_oldest_v2_desc_as_dir(void);
 void rend_cache_purge(void);
 void rend_cache_free_all(void);
 int rend_cache_lookup_entry(const char *query, int version,
@@ -109,11 +116,13 @@ STATIC void validate_intro_point_failure(const rend_service_descriptor_t *desc,
                                         const char *service_id);
 
 STATIC void rend_cache_failure_entry_free_(void *entry);
+STATIC void rend_cache_v2_dir_add(const char *desc_id, rend_cache_entry_t *e);
 
 #ifdef TOR_UNIT_TESTS
 extern strmap_t *rend_cache;
 extern strmap_t *rend_cache_failure;
 extern digestmap_t *rend_cache_v2_dir;
+extern smartlist_t *rend_cache_v2_dir_by_age;
 extern size_t rend_cache_total_allocation;
 #endif /* defined(TOR_UNIT_TESTS) */
 #endif /* defined(RENDCACHE_PRIVATE) */
@@ -180,9 +180,7 @@ rend_client_send_introduction(origin_circuit_t *introcirc,
   /* Initialize the pending_final_cpath and start the DH handshake. */
   cpath = rendcirc->build_state->pending_final_cpath;
   if (!cpath) {
-    cpath = rendcirc->build_state->pending_final_cpath =
-      tor_malloc_zero(sizeof(crypt_path_t));
-    cpath->magic = CRYPT_PATH_MAGIC;
+    cpath = rendcirc->build_state->pending_final_cpath = crypt_path_new();
     if (!(cpath->rend_dh_handshake_state = crypto_dh_new(DH_TYPE_REND))) {
       log_warn(LD_BUG, "Internal error: couldn't allocate DH.");
       status = -2;
@@ -329,22 +327,25 @@ rend_client_rendcirc_has_opened(origin_circuit_t *circ)
 static void
 rend_client_close_other_intros(const uint8_t *rend_pk_digest)
 {
+  static const uint8_t purposes[] = {
+    CIRCUIT_PURPOSE_C_INTRODUCING,
+    CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT,
+  };
+  unsigned i;
+
   /* abort parallel intro circs, if any */
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, c) {
-    if ((c->purpose == CIRCUIT_PURPOSE_C_INTRODUCING ||
-        c->purpose == CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT) &&
-        !c->marked_for_close && CIRCUIT_IS_ORIGIN(c)) {
-      origin_circuit_t *oc = TO_ORIGIN_CIRCUIT(c);
-      if (oc->rend_data &&
+  for (i = 0; i < ARRAY_LENGTH(purposes); ++i) {
+    ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(purposes[i], oc) {
+      circuit_t *c = TO_CIRCUIT(oc);
+      if (!c->marked_for_close && oc->rend_data &&
           rend_circuit_pk_digest_eq(oc, rend_pk_digest)) {
         log_info(LD_REND|LD_CIRC, "Closing introduction circuit %d that we "
                  "built in parallel (Purpose %d).", oc->global_identifier,
                  c->purpose);
         circuit_mark_for_close(c, END_CIRC_REASON_IP_NOW_REDUNDANT);
       }
-    }
+    } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(oc);
   }
-  SMARTLIST_FOREACH_END(c);
 }
 
 /** Called when get an ACK or a NAK for a REND_INTRODUCE1 cell.
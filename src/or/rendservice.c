@@ -91,6 +91,12 @@ static const char *hostname_fname = "hostname";
 static const char *client_keys_fname = "client_keys";
 static const char *sos_poison_fname = "onion_service_non_anonymous";
 
+/** The purposes of our circuits to a service's introduction points. */
+static const uint8_t intro_purposes[] = {
+  CIRCUIT_PURPOSE_S_ESTABLISH_INTRO,
+  CIRCUIT_PURPOSE_S_INTRO,
+};
+
 /** A list of rend_service_t's for services run on this OP. */
 static smartlist_t *rend_service_list = NULL;
 /** A list of rend_service_t's for services run on this OP which is used as a
@@ -921,6 +927,7 @@ int
 rend_service_del_ephemeral(const char *service_id)
 {
   rend_service_t *s;
+  unsigned i;
   if (!rend_valid_v2_service_id(service_id)) {
     log_warn(LD_CONFIG, "Requested malformed Onion Service id for removal.");
     return -1;
@@ -941,11 +948,10 @@ rend_service_del_ephemeral(const char *service_id)
    * XXX: As with the comment in rend_config_services(), a nice abstraction
    * would be ideal here, but for now just duplicate the code.
    */
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    if (!circ->marked_for_close &&
-        (circ->purpose == CIRCUIT_PURPOSE_S_ESTABLISH_INTRO ||
-         circ->purpose == CIRCUIT_PURPOSE_S_INTRO)) {
-      origin_circuit_t *oc = TO_ORIGIN_CIRCUIT(circ);
+  for (i = 0; i < ARRAY_LENGTH(intro_purposes); ++i) {
+    ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(intro_purposes[i], oc) {
+      if (TO_CIRCUIT(oc)->marked_for_close)
+        continue;
       if (oc->rend_data == NULL ||
           !rend_circuit_pk_digest_eq(oc, (uint8_t *) s->pk_digest)) {
         continue;
@@ -954,9 +960,9 @@ rend_service_del_ephemeral(const char *service_id)
                 safe_str_client(extend_info_describe(
                                           oc->build_state->chosen_exit)),
                 rend_data_get_address(oc->rend_data));
-      circuit_mark_for_close(circ, END_CIRC_REASON_FINISHED);
-    }
-  } SMARTLIST_FOREACH_END(circ);
+      circuit_mark_for_close(TO_CIRCUIT(oc), END_CIRC_REASON_FINISHED);
+    } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(oc);
+  }
   smartlist_remove(rend_service_list, s);
   rend_service_free(s);
 
@@ -1900,7 +1906,9 @@ rend_service_receive_introduction(origin_circuit_t *circuit,
   }
 
   if (!intro_point->accepted_intro_rsa_parts) {
-    intro_point->accepted_intro_rsa_parts = replaycache_new(0, 0);
+    intro_point->accepted_intro_rsa_parts =
+      replaycache_new_bloom(0, (unsigned int) intro_point->max_introductions,
+                            INTRO_POINT_REPLAY_FALSE_POSITIVE_RATE);
   }
 
   /* check for replay of PK-encrypted portion. */
@@ -2082,8 +2090,7 @@ rend_service_receive_introduction(origin_circuit_t *circuit,
   launched->build_state->service_pending_final_cpath_ref->refcount = 1;
 
   launched->build_state->service_pending_final_cpath_ref->cpath = cpath =
-    tor_malloc_zero(sizeof(crypt_path_t));
-  cpath->magic = CRYPT_PATH_MAGIC;
+    crypt_path_new();
   launched->build_state->expiry_time = now + MAX_REND_TIMEOUT;
 
   cpath->rend_dh_handshake_state = dh;
@@ -3083,20 +3090,18 @@ count_established_intro_points(const rend_service_t *service)
 static unsigned int
 count_intro_point_circuits(const rend_service_t *service)
 {
-  unsigned int num_ipos = 0;
-  SMARTLIST_FOREACH_BEGIN(circuit_get_global_list(), circuit_t *, circ) {
-    if (!circ->marked_for_close &&
-        circ->state == CIRCUIT_STATE_OPEN &&
-        (circ->purpose == CIRCUIT_PURPOSE_S_ESTABLISH_INTRO ||
-         circ->purpose == CIRCUIT_PURPOSE_S_INTRO)) {
-      origin_circuit_t *oc = TO_ORIGIN_CIRCUIT(circ);
-      if (oc->rend_data &&
+  unsigned int num_ipos = 0, i;
+  for (i = 0; i < ARRAY_LENGTH(intro_purposes); ++i) {
+    ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(intro_purposes[i], oc) {
+      const circuit_t *circ = TO_CIRCUIT(oc);
+      if (!circ->marked_for_close &&
+          circ->state == CIRCUIT_STATE_OPEN &&
+          oc->rend_data &&
           rend_circuit_pk_digest_eq(oc, (uint8_t *) service->pk_digest)) {
         num_ipos++;
       }
-    }
+    } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(oc);
   }
-  SMARTLIST_FOREACH_END(circ);
   return num_ipos;
 }
 
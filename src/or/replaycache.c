@@ -17,6 +17,17 @@
  * malleable.)
  *
  * This module is used from rendservice.c.
+ *
+ * A cache made with replaycache_new() remembers the digest of every entry
+ * until it ages out, and periodically walks all of them to scrub old ones.
+ * A cache made with replaycache_new_bloom() is instead made of a few Bloom
+ * filters, each covering a slice of the horizon: we add entries to the
+ * newest slice, test them against all the slices, and reuse the oldest slice
+ * when a new one starts. It uses constant memory and constant time per
+ * entry, at the cost of a small, configurable, rate of false positives, and
+ * of entries staying in the cache for up to one slice longer than the
+ * horizon. Each slice is only allocated when the first entry goes to it, so
+ * a cache that never sees an entry costs next to nothing.
  */
 
 #define REPLAYCACHE_PRIVATE
@@ -24,6 +35,8 @@
 #include "or.h"
 #include "replaycache.h"
 
+#include <math.h>
+
 /** Free the replaycache r and all of its entries.
  */
 
@@ -36,6 +49,13 @@ replaycache_free(replaycache_t *r)
   }
 
   if (r->digests_seen) digest256map_free(r->digests_seen, tor_free_);
+  if (r->bloom) {
+    int i;
+    for (i = 0; i < r->bloom->n_slices; ++i) {
+      bitarray_free(r->bloom->slices[i]);
+    }
+    tor_free(r->bloom);
+  }
 
   tor_free(r);
 }
@@ -67,11 +87,156 @@ replaycache_new(time_t horizon, time_t interval)
   r->scrubbed = 0;
   r->horizon = horizon;
   r->digests_seen = digest256map_new();
+  r->bloom = NULL;
+
+ err:
+  return r;
+}
+
+/** Allocate a new, empty replay detection cache made of Bloom filters, where
+ * horizon is the time for entries to age out, or 0 if they never do.  The
+ * cache is sized so that, as long as no more than max_entries are added per
+ * horizon (or ever, if the horizon is 0), fewer than false_positive_rate of
+ * the new entries are reported as replays.  Its memory use doesn't depend on
+ * how many entries are actually added, once there is one, and it never needs
+ * scrubbing.
+ */
+
+replaycache_t *
+replaycache_new_bloom(time_t horizon, unsigned int max_entries,
+                      double false_positive_rate)
+{
+  replaycache_t *r = NULL;
+  replaycache_bloom_t *b;
+  double entries_per_slice, slice_fp_rate, n_bits;
+
+  if (horizon < 0) {
+    log_info(LD_BUG, "replaycache_new_bloom() called with negative"
+        " horizon parameter");
+    goto err;
+  }
+
+  if (!(false_positive_rate > 0 && false_positive_rate < 1)) {
+    log_info(LD_BUG, "replaycache_new_bloom() called with a false positive"
+        " rate out of range");
+    false_positive_rate = 1e-6;
+  }
+  if (max_entries == 0) max_entries = 1;
+
+  b = tor_malloc_zero(sizeof(*b));
+  if (horizon > 0) {
+    b->n_slices = REPLAYCACHE_BLOOM_N_SLICES;
+    /*
+     * An entry stays in the slice it was added to until that slice is reused
+     * n_slices - 1 slices later, so this makes it stay for at least horizon.
+     */
+    b->slice_len = CEIL_DIV(horizon, b->n_slices - 1);
+    entries_per_slice = (double)max_entries / (b->n_slices - 1);
+  } else {
+    b->n_slices = 1;
+    b->slice_len = 0;
+    entries_per_slice = max_entries;
+  }
+
+  /* We test each entry against every slice, so split the rate between them,
+   * and use the usual optimal size and number of hashes for each. */
+  slice_fp_rate = false_positive_rate / b->n_slices;
+  n_bits = ceil(-entries_per_slice * log(slice_fp_rate) /
+                (log(2.0) * log(2.0)));
+  if (n_bits > REPLAYCACHE_BLOOM_MAX_BITS)
+    n_bits = REPLAYCACHE_BLOOM_MAX_BITS;
+  b->n_bits = MAX((uint32_t)n_bits, 64);
+  b->n_hashes = (int)tor_lround(b->n_bits / entries_per_slice * log(2.0));
+  b->n_hashes = CLAMP(1, b->n_hashes, REPLAYCACHE_BLOOM_MAX_HASHES);
+  crypto_rand((char *)&b->key, sizeof(b->key));
+
+  r = tor_malloc(sizeof(*r));
+  r->scrub_interval = 0;
+  r->scrubbed = 0;
+  r->horizon = horizon;
+  r->digests_seen = NULL;
+  r->bloom = b;
 
  err:
   return r;
 }
 
+/** Return the index of the slice of <b>b</b> that entries seen at
+ * <b>present</b> go to, allocating it first if it was never used, or
+ * clearing it if it was last used for an older time slice.
+ */
+
+static int
+replaycache_bloom_current_slice(replaycache_bloom_t *b, time_t present)
+{
+  time_t start;
+  int idx;
+
+  if (b->slice_len == 0) {
+    start = b->slice_start[0] ? b->slice_start[0] : present;
+    idx = 0;
+  } else {
+    start = present - (present % b->slice_len);
+    idx = (int)((start / b->slice_len) % b->n_slices);
+  }
+
+  if (!b->slices[idx]) {
+    b->slices[idx] = bitarray_init_zero(b->n_bits);
+  } else if (b->slice_start[idx] != start) {
+    memset(b->slices[idx], 0,
+           ((b->n_bits + BITARRAY_MASK) >> BITARRAY_SHIFT) *
+           sizeof(bitarray_t));
+  }
+  b->slice_start[idx] = start;
+  return idx;
+}
+
+/** Bloom filter version of replaycache_add_and_test_internal(), for the
+ * SHA256 <b>digest</b> of the data.  The elapsed time is measured from the
+ * start of the most recent slice where the digest was found.
+ */
+
+static int
+replaycache_bloom_add_and_test(time_t present, replaycache_bloom_t *b,
+                               const uint8_t *digest, time_t *elapsed)
+{
+  uint32_t bits[REPLAYCACHE_BLOOM_MAX_HASHES];
+  const uint64_t h = siphash24(digest, DIGEST256_LEN, &b->key);
+  const uint32_t h1 = (uint32_t)h, h2 = ((uint32_t)(h >> 32)) | 1;
+  time_t oldest_start, newest_hit = 0;
+  int cur, i, s, hit = 0;
+
+  for (i = 0; i < b->n_hashes; ++i) {
+    bits[i] = (h1 + (uint32_t)i * h2) % b->n_bits;
+  }
+
+  cur = replaycache_bloom_current_slice(b, present);
+  oldest_start = b->slice_start[cur] - (b->n_slices - 1) * b->slice_len;
+
+  for (s = 0; s < b->n_slices; ++s) {
+    int all_set = 1;
+    /* Skip slices that we haven't reused in a while: they're too old. */
+    if (b->slice_start[s] == 0 || b->slice_start[s] < oldest_start)
+      continue;
+    for (i = 0; i < b->n_hashes && all_set; ++i) {
+      all_set = bitarray_is_set(b->slices[s], bits[i]) != 0;
+    }
+    if (all_set) {
+      hit = 1;
+      newest_hit = MAX(newest_hit, b->slice_start[s]);
+    }
+  }
+
+  for (i = 0; i < b->n_hashes; ++i) {
+    bitarray_set(b->slices[cur], bits[i]);
+  }
+
+  if (hit && elapsed) {
+    *elapsed = (present >= newest_hit) ? present - newest_hit : 0;
+  }
+  return hit;
+}
+
 /** See documentation for replaycache_add_and_test()
  */
 
@@ -94,6 +259,11 @@ replaycache_add_and_test_internal(
   /* compute digest */
   crypto_digest256((char *)digest, (const char *)data, len, DIGEST_SHA256);
 
+  if (r->bloom) {
+    rv = replaycache_bloom_add_and_test(present, r->bloom, digest, elapsed);
+    goto done;
+  }
+
   /* check map */
   access_time = digest256map_get(r->digests_seen, digest);
 
@@ -147,6 +317,9 @@ replaycache_scrub_if_needed_internal(time_t present, replaycache_t *r)
   void *valp;
   time_t *access_time;
 
+  /* Bloom filters reuse their oldest slice as time goes: nothing to do */
+  if (r && r->bloom) return;
+
   /* sanity check */
   if (!r || !(r->digests_seen)) {
     log_info(LD_BUG, "replaycache_scrub_if_needed_internal() called with"
@@ -13,6 +13,34 @@ typedef struct replaycache_s replaycache_t;
 
 #ifdef REPLAYCACHE_PRIVATE
 
+/* Number of time slices in a replay cache with a nonzero horizon that is
+ * made of Bloom filters. */
+#define REPLAYCACHE_BLOOM_N_SLICES 4
+/* Largest number of hash functions we use per Bloom filter. */
+#define REPLAYCACHE_BLOOM_MAX_HASHES 32
+/* Largest number of bits we use per Bloom filter. */
+#define REPLAYCACHE_BLOOM_MAX_BITS (1u<<30)
+
+/* Time-sliced rotating Bloom filters, used instead of a digest map by replay
+ * caches made with replaycache_new_bloom(). */
+typedef struct replaycache_bloom_s {
+  /* Number of slices: 1 if entries never expire, REPLAYCACHE_BLOOM_N_SLICES
+   * otherwise. */
+  int n_slices;
+  /* Number of seconds covered by each slice, or 0 if entries never expire */
+  time_t slice_len;
+  /* Number of bits in each slice */
+  uint32_t n_bits;
+  /* Number of bits we set per digest */
+  int n_hashes;
+  /* Key for hashing digests to bit positions */
+  struct sipkey key;
+  /* Time at which each slice started, or 0 if it was never used */
+  time_t slice_start[REPLAYCACHE_BLOOM_N_SLICES];
+  /* Bits of each slice, or NULL if no entry ever went to it */
+  bitarray_t *slices[REPLAYCACHE_BLOOM_N_SLICES];
+} replaycache_bloom_t;
+
 struct replaycache_s {
   /* Scrub interval */
   time_t scrub_interval;
@@ -27,6 +55,11 @@ struct replaycache_s {
    * Digest map: keys are digests, values are times the digest was last seen
    */
   digest256map_t *digests_seen;
+  /*
+   * Bloom filters, if this cache was made with replaycache_new_bloom(); in
+   * that case, digests_seen is NULL.
+   */
+  replaycache_bloom_t *bloom;
 };
 
 #endif /* defined(REPLAYCACHE_PRIVATE) */
@@ -35,6 +68,9 @@ struct replaycache_s {
 
 void replaycache_free(replaycache_t *r);
 replaycache_t * replaycache_new(time_t horizon, time_t interval);
+replaycache_t * replaycache_new_bloom(time_t horizon,
+                                      unsigned int max_entries,
+                                      double false_positive_rate);
 
 #ifdef REPLAYCACHE_PRIVATE
 
@@ -1937,8 +1937,8 @@ router_compare_to_my_exit_policy(const tor_addr_t *addr, uint16_t port)
    * summary. */
   if ((tor_addr_family(addr) == AF_INET ||
        tor_addr_family(addr) == AF_INET6)) {
-    return compare_tor_addr_to_addr_policy(addr, port,
-                               me->exit_policy) != ADDR_POLICY_ACCEPTED;
+    return compare_tor_addr_to_router_exit_policy(addr, port,
+                               me) != ADDR_POLICY_ACCEPTED;
 #if 0
   } else if (tor_addr_family(addr) == AF_INET6) {
     return get_options()->IPv6Exit &&
@@ -671,6 +671,9 @@ static uint8_t *rsa_ed_crosscert = NULL;
 static size_t rsa_ed_crosscert_len = 0;
 static time_t rsa_ed_crosscert_expiration = 0;
 
+/** Incremented whenever any of the keys or certificates above change. */
+static uint64_t ed_keys_generation = 0;
+
 /**
  * Running as a server: load, reload, or refresh our ed25519 keys and
  * certificates, creating and saving new ones as needed.
@@ -945,6 +948,7 @@ load_ed_keys(const or_options_t *options, time_t now)
     rsa_ed_crosscert_len = crosscert_len;
     rsa_ed_crosscert = crosscert;
     rsa_ed_crosscert_expiration = expiration;
+    ++ed_keys_generation;
   }
 
   if (!current_auth_key ||
@@ -964,16 +968,19 @@ load_ed_keys(const or_options_t *options, time_t now)
  end:
   if (! master_identity_key) {
     SET_KEY(master_identity_key, id);
+    ++ed_keys_generation;
   } else {
     tor_free(id);
   }
   if (sign) {
     SET_KEY(master_signing_key, sign);
     SET_CERT(signing_key_cert, sign_cert);
+    ++ed_keys_generation;
   }
   if (auth) {
     SET_KEY(current_auth_key, auth);
     SET_CERT(auth_key_cert, auth_cert);
+    ++ed_keys_generation;
   }
 
   return signing_key_changed;
@@ -1036,6 +1043,7 @@ generate_ed_link_cert(const or_options_t *options, time_t now,
 
   if (link_cert) {
     SET_CERT(link_cert_cert, link_cert);
+    ++ed_keys_generation;
   }
   return 0;
 }
@@ -1130,6 +1138,7 @@ init_mock_ed_keys(const crypto_pk_t *rsa_identity_key)
                                      rsa_identity_key,
                                      time(NULL)+86400,
                                      &rsa_ed_crosscert);
+  ++ed_keys_generation;
 
   return;
 
@@ -1307,6 +1316,16 @@ get_master_rsa_crosscert(const uint8_t **cert_out,
   *size_out = rsa_ed_crosscert_len;
 }
 
+/** Return a number that changes whenever any of our Ed25519 keys or
+ * certificates, or our RSA->Ed25519 crosscert, change.  Callers can compare
+ * it against an earlier value to learn whether anything they built from
+ * those keys is stale. */
+uint64_t
+get_ed_keys_generation(void)
+{
+  return ed_keys_generation;
+}
+
 /** Construct cross-certification for the master identity key with
  * the ntor onion key. Store the sign of the corresponding ed25519 public key
  * in *<b>sign_out</b>. */
@@ -1412,5 +1431,6 @@ routerkeys_free_all(void)
   signing_key_cert = link_cert_cert = auth_key_cert = NULL;
   rsa_ed_crosscert = NULL; // redundant
   rsa_ed_crosscert_len = 0;
+  ++ed_keys_generation;
 }
 
@@ -44,6 +44,7 @@ const struct tor_cert_st *get_current_auth_key_cert(void);
 
 void get_master_rsa_crosscert(const uint8_t **cert_out,
                               size_t *size_out);
+uint64_t get_ed_keys_generation(void);
 
 int router_ed25519_id_is_me(const ed25519_public_key_t *id);
 
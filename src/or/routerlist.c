@@ -2852,14 +2852,14 @@ router_choose_random_node(smartlist_t *excludedsmartlist,
            "We found %d running nodes.",
             smartlist_len(sl));
 
-  smartlist_subtract(sl,excludednodes);
+  nodelist_subtract_nodes(sl,excludednodes);
   log_debug(LD_CIRC,
             "We removed %d excludednodes, leaving %d nodes.",
             smartlist_len(excludednodes),
             smartlist_len(sl));
 
   if (excludedsmartlist) {
-    smartlist_subtract(sl,excludedsmartlist);
+    nodelist_subtract_nodes(sl,excludedsmartlist);
     log_debug(LD_CIRC,
               "We removed %d excludedsmartlist, leaving %d nodes.",
               smartlist_len(excludedsmartlist),
@@ -3188,6 +3188,7 @@ routerinfo_free(routerinfo_t *router)
     smartlist_free(router->declared_family);
   }
   addr_policy_list_free(router->exit_policy);
+  compiled_addr_policy_free(router->compiled_exit_policy);
   short_policy_free(router->ipv6_exit_policy);
 
   memset(router, 77, sizeof(routerinfo_t));
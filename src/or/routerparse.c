@@ -863,7 +863,10 @@ dump_desc_populate_fifo_from_directory(const char *dirname)
 /** For debugging purposes, dump unparseable descriptor *<b>desc</b> of
  * type *<b>type</b> to file $DATADIR/unparseable-desc. Do not write more
  * than one descriptor to disk per minute. If there is already such a
- * file in the data directory, overwrite it. */
+ * file in the data directory, overwrite it.
+ *
+ * The dump FIFO and the options belong to the main thread, so descriptors
+ * that fail to parse on a cpuworker are not dumped. */
 MOCK_IMPL(STATIC void,
 dump_desc,(const char *desc, const char *type))
 {
@@ -876,6 +879,9 @@ dump_desc,(const char *desc, const char *type))
   /* Filename to log it to */
   char *debugfile, *debugfile_base;
 
+  if (!in_main_thread())
+    return;
+
   /* Get the hash for logging purposes anyway */
   len = strlen(desc);
   if (crypto_digest256((char *)digest_sha256, desc, len,
@@ -1304,6 +1310,32 @@ find_start_of_next_router_or_extrainfo(const char **s_ptr,
   return -1;
 }
 
+/** Find the next complete router descriptor or extra-info document in the
+ * string from *<b>s_ptr</b> up to <b>eos</b>, without parsing it.  On
+ * success, move *<b>s_ptr</b> to its start (including any annotations), set
+ * *<b>end_out</b> to point immediately after its signature, set
+ * *<b>is_extrainfo_out</b> to true iff it's an extra-info document, and
+ * return 0.  Return -1 if there are no more complete entries. */
+int
+router_find_next_descriptor(const char **s_ptr, const char *eos,
+                            const char **end_out, int *is_extrainfo_out)
+{
+  const char *end;
+
+  if (find_start_of_next_router_or_extrainfo(s_ptr, eos,
+                                             is_extrainfo_out) < 0)
+    return -1;
+
+  end = tor_memstr(*s_ptr, eos-*s_ptr, "\nrouter-signature");
+  if (end)
+    end = tor_memstr(end, eos-end, "\n-----END SIGNATURE-----\n");
+  if (!end)
+    return -1;
+
+  *end_out = end + strlen("\n-----END SIGNATURE-----\n");
+  return 0;
+}
+
 /** Given a string *<b>s</b> containing a concatenated sequence of router
  * descriptors (or extra-info documents if <b>is_extrainfo</b> is set), parses
  * them and stores the result in <b>dest</b>.  All routers are marked running
@@ -1348,16 +1380,7 @@ router_parse_list_from_string(const char **s, const char *eos,
     char raw_digest[DIGEST_LEN];
     int have_raw_digest = 0;
     int dl_again = 0;
-    if (find_start_of_next_router_or_extrainfo(s, eos, &have_extrainfo) < 0)
-      break;
-
-    end = tor_memstr(*s, eos-*s, "\nrouter-signature");
-    if (end)
-      end = tor_memstr(end, eos-end, "\n-----END SIGNATURE-----\n");
-    if (end)
-      end += strlen("\n-----END SIGNATURE-----\n");
-
-    if (!end)
+    if (router_find_next_descriptor(s, eos, &end, &have_extrainfo) < 0)
       break;
 
     elt = NULL;
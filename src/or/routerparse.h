@@ -30,6 +30,8 @@ int router_append_dirobj_signature(char *buf, size_t buf_len,
                                    const char *digest,
                                    size_t digest_len,
                                    crypto_pk_t *private_key);
+int router_find_next_descriptor(const char **s_ptr, const char *eos,
+                                const char **end_out, int *is_extrainfo_out);
 int router_parse_list_from_string(const char **s, const char *eos,
                                   smartlist_t *dest,
                                   saved_location_t saved_location,
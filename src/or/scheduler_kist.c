@@ -15,6 +15,7 @@
 #include "channeltls.h"
 #define SCHEDULER_PRIVATE_
 #include "scheduler.h"
+#include "trace/events.h"
 
 #define TLS_PER_CELL_OVERHEAD 29
 
@@ -580,6 +581,7 @@ kist_scheduler_run(void)
 
   log_debug(LD_SCHED, "Running the scheduler. %d channels pending",
             smartlist_len(cp));
+  tor_trace(scheduler, kist_run_begin, smartlist_len(cp));
 
   /* The main scheduling loop. Loop until there are no more pending channels */
   while (smartlist_len(cp) > 0) {
@@ -717,6 +719,7 @@ kist_scheduler_run(void)
   log_debug(LD_SCHED, "len pending=%d, len to_readd=%d",
             smartlist_len(cp),
             (to_readd ? smartlist_len(to_readd) : -1));
+  tor_trace(scheduler, kist_run_end, to_readd ? smartlist_len(to_readd) : 0);
 
   /* Re-add any channels we need to */
   if (to_readd) {
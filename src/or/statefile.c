@@ -36,6 +36,7 @@
 #include "connection.h"
 #include "control.h"
 #include "entrynodes.h"
+#include "fileworker.h"
 #include "hibernate.h"
 #include "rephist.h"
 #include "router.h"
@@ -120,6 +121,8 @@ static config_var_t state_vars_[] = {
   V(CircuitBuildAbandonedCount,       UINT,     "0"),
   VAR("CircuitBuildTimeBin",          LINELIST_S, BuildtimeHistogram, NULL),
   VAR("BuildtimeHistogram",           LINELIST_V, BuildtimeHistogram, NULL),
+  VAR("CircuitBuildTimeHistogram",    STRING,   BuildtimeHistogramPacked,
+      NULL),
 
   END_OF_CONFIG_VARS
 };
@@ -353,6 +356,8 @@ or_state_load(void)
   int r = -1, badstate = 0;
 
   fname = get_datadir_fname("state");
+  /* Make sure we read the last state that we saved. */
+  fileworker_flush(fname);
   switch (file_status(fname)) {
     case FN_FILE:
       if (!(contents = read_file_to_str(fname, 0, NULL))) {
@@ -462,7 +467,32 @@ did_last_state_file_write_fail(void)
  * bandwidth used, per-country user stats, etc. */
 #define STATE_RELAY_CHECKPOINT_INTERVAL (12*60*60)
 
-/** Write the persistent state to disk. Return 0 for success, <0 on failure. */
+/** Called once the state file write that or_state_save() queued is done,
+ * with <b>status</b> 0 on success and -1 on failure. */
+static void
+or_state_save_done(const char *fname, int status, void *arg)
+{
+  (void) arg;
+  if (status < 0) {
+    log_warn(LD_FS, "Unable to write state to file \"%s\"; "
+             "will try again later", fname);
+    last_state_file_write_failed = 1;
+    /* Try again after STATE_WRITE_RETRY_INTERVAL (or sooner, if the state
+     * changes sooner). */
+    if (global_state)
+      global_state->next_write = approx_time() + STATE_WRITE_RETRY_INTERVAL;
+    return;
+  }
+
+  last_state_file_write_failed = 0;
+  log_info(LD_GENERAL, "Saved state to \"%s\"", fname);
+}
+
+/** Write the persistent state to disk. Return 0 for success, <0 on failure.
+ *
+ * The file itself is written in the background, so a failure to write it
+ * isn't reported here: we note it for did_last_state_file_write_fail() and
+ * try again later. */
 int
 or_state_save(time_t now)
 {
@@ -496,29 +526,20 @@ or_state_save(time_t now)
                "# You *do not* need to edit this file.\n\n%s",
                tbuf, state);
   tor_free(state);
-  fname = get_datadir_fname("state");
-  if (write_str_to_file(fname, contents, 0)<0) {
-    log_warn(LD_FS, "Unable to write state to file \"%s\"; "
-             "will try again later", fname);
-    last_state_file_write_failed = 1;
-    tor_free(fname);
-    tor_free(contents);
-    /* Try again after STATE_WRITE_RETRY_INTERVAL (or sooner, if the state
-     * changes sooner). */
-    global_state->next_write = now + STATE_WRITE_RETRY_INTERVAL;
-    return -1;
-  }
-
-  last_state_file_write_failed = 0;
-  log_info(LD_GENERAL, "Saved state to \"%s\"", fname);
-  tor_free(fname);
-  tor_free(contents);
 
   if (server_mode(get_options()))
     global_state->next_write = now + STATE_RELAY_CHECKPOINT_INTERVAL;
   else
     global_state->next_write = TIME_MAX;
 
+  /* If this replaces a save that hasn't started yet, only this one gets
+   * written. */
+  fname = get_datadir_fname("state");
+  fileworker_replace(fname, contents, strlen(contents), 0,
+                     or_state_save_done, NULL);
+  tor_free(fname);
+  tor_free(contents);
+
   return 0;
 }
 
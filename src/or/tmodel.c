@@ -21,6 +21,7 @@
 #include "util_bug.h"
 #include "workqueue.h"
 #include "tmodel.h"
+#include "trace/events.h"
 
 /* magic for memory checking */
 #define TRAFFIC_MAGIC 0xAABBCCDD
@@ -2063,6 +2064,9 @@ static workqueue_reply_t _viterbi_worker_work_threadfn(void* state_arg, void* jo
     /* if we make it here, we can run the viterbi algorithm.
      * The result will be stored in the job object, and handled
      * by the main thread in the handle_reply function. */
+    tor_trace(tmodel, viterbi_begin, job->tpackets ?
+              smartlist_len(job->tpackets->packets) :
+              smartlist_len(job->tstreams->streams));
     if(job->tpackets && state->thread_traffic_model->hmm_packets) {
       job->viterbi_result = _tmodel_run_viterbi(
           state->thread_traffic_model->hmm_packets, job->tpackets->packets);
@@ -2070,6 +2074,7 @@ static workqueue_reply_t _viterbi_worker_work_threadfn(void* state_arg, void* jo
       job->viterbi_result = _tmodel_run_viterbi(
           state->thread_traffic_model->hmm_streams, job->tstreams->streams);
     }
+    tor_trace(tmodel, viterbi_end, job->viterbi_result != NULL);
   }
 
   return WQ_RPL_REPLY;
@@ -2094,6 +2099,7 @@ static void _viterbi_worker_handle_reply(void* job_arg) {
 /* Pass the stream as a job for the thread pool.
  * This function is run in the main thread. */
 static void _viterbi_worker_assign_job(viterbi_worker_job_t* job) {
+  tor_trace(tmodel, viterbi_queue, num_outstanding_jobs);
   /* queue the job in the thread pool */
   workqueue_entry_t* queue_entry = threadpool_queue_work(viterbi_thread_pool,
       _viterbi_worker_work_threadfn, _viterbi_worker_handle_reply, job);
@@ -29,6 +29,9 @@ const char tor_git_revision[] = "";
 #include "onion_ntor.h"
 #include "crypto_ed25519.h"
 #include "consdiff.h"
+#include "dirvote.h"
+#include "networkstatus.h"
+#include "routerparse.h"
 
 #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_PROCESS_CPUTIME_ID)
 static uint64_t nanostart;
@@ -419,6 +422,37 @@ bench_dmap(void)
   printf("False positive rate on digestset: %.2f%%\n",
          (fp/(double)fpostests)*100);
 
+  start = perftime();
+  for (i = 0; i < iters; ++i) {
+    DIGESTMAP_FOREACH(dm, k, void *, v) {
+      n += (v != NULL) + (k[0] & 1);
+    } DIGESTMAP_FOREACH_END;
+  }
+  pt2 = perftime();
+  printf("DIGESTMAP_FOREACH: %.2f ns per element\n",
+         NANOCOUNT(start, pt2, iters*elts));
+
+  for (i = 0; i < iters; ++i) {
+    SMARTLIST_FOREACH(sl, const char *, cp, digestmap_remove(dm, cp));
+    SMARTLIST_FOREACH(sl, const char *, cp, digestmap_set(dm, cp, (void*)1));
+  }
+  pt3 = perftime();
+  printf("digestmap_remove+digestmap_set: %.2f ns per element\n",
+         NANOCOUNT(pt2, pt3, iters*elts));
+
+  /* Building a map from scratch, as we do for each new nodelist. */
+  for (i = 0; i < iters / 16; ++i) {
+    digestmap_t *dm2 = digestmap_new();
+    SMARTLIST_FOREACH(sl, const char *, cp, digestmap_set(dm2, cp, (void*)1));
+    SMARTLIST_FOREACH(sl2, const char *, cp,
+                      digestmap_set(dm2, cp, (void*)1));
+    digestmap_free(dm2, NULL);
+  }
+  end = perftime();
+  printf("digestmap_new+digestmap_set+digestmap_free: %.2f ns per element\n",
+         NANOCOUNT(pt3, end, (iters/16)*elts*2));
+  printf("Hits == %d\n", n);
+
   digestmap_free(dm, NULL);
   digestset_free(ds);
   SMARTLIST_FOREACH(sl, char *, cp, tor_free(cp));
@@ -625,6 +659,72 @@ bench_ecdh_p224(void)
   bench_ecdh_impl(NID_secp224r1, "P-224");
 }
 
+/** Replay the votes in the <b>n_files</b> files named in <b>files</b>:
+ * compute each flavor of consensus from them, first on one thread and then
+ * on as many as we have CPUs, and report how long it took. */
+static int
+bench_consensus_from_votes(int n_files, const char **files)
+{
+  smartlist_t *votes = smartlist_new();
+  crypto_pk_t *identity_key = crypto_pk_new(), *signing_key = crypto_pk_new();
+  const int n_cpus = get_num_cpus(get_options());
+  const int iters = 5;
+  int i, r = 1;
+
+  for (i = 0; i < n_files; ++i) {
+    char *body = read_file_to_str(files[i], 0, NULL);
+    networkstatus_t *v;
+    if (!body) {
+      printf("Couldn't read %s\n", files[i]);
+      goto done;
+    }
+    v = networkstatus_parse_vote_from_string(body, NULL, NS_TYPE_VOTE);
+    tor_free(body);
+    if (!v) {
+      printf("Couldn't parse a vote from %s\n", files[i]);
+      goto done;
+    }
+    smartlist_add(votes, v);
+  }
+  if (crypto_pk_generate_key(identity_key) < 0 ||
+      crypto_pk_generate_key(signing_key) < 0) {
+    printf("Couldn't generate keys\n");
+    goto done;
+  }
+
+  for (int n_threads = 1; ; n_threads = n_cpus) {
+    for (int flav = 0; flav < N_CONSENSUS_FLAVORS; ++flav) {
+      uint64_t start, end;
+      start = perftime();
+      for (i = 0; i < iters; ++i) {
+        char *c = networkstatus_compute_consensus_threaded(votes,
+                                   smartlist_len(votes),
+                                   identity_key, signing_key, NULL, NULL,
+                                   flav, n_threads);
+        if (!c) {
+          printf("Couldn't compute a consensus\n");
+          goto done;
+        }
+        tor_free(c);
+      }
+      end = perftime();
+      printf("%s consensus from %d votes, %d thread(s): %.2f msec\n",
+             networkstatus_get_flavor_name(flav), smartlist_len(votes),
+             n_threads, NANOCOUNT(start, end, iters)/1e6);
+    }
+    if (n_threads == n_cpus)
+      break;
+  }
+  r = 0;
+
+ done:
+  SMARTLIST_FOREACH(votes, networkstatus_t *, v, networkstatus_vote_free(v));
+  smartlist_free(votes);
+  crypto_pk_free(identity_key);
+  crypto_pk_free(signing_key);
+  return r;
+}
+
 typedef void (*bench_fn)(void);
 
 typedef struct benchmark_t {
@@ -671,6 +771,8 @@ main(int argc, const char **argv)
 {
   int i;
   int list=0, n_enabled=0;
+  const char **vote_files = NULL;
+  int n_vote_files = 0;
   char *errmsg;
   or_options_t *options;
 
@@ -698,7 +800,12 @@ main(int argc, const char **argv)
     return 0;
   }
 
-  for (i = 1; i < argc; ++i) {
+  if (argc >= 3 && !strcmp(argv[1], "consensus")) {
+    vote_files = argv + 2;
+    n_vote_files = argc - 2;
+  }
+
+  for (i = 1; i < argc && !vote_files; ++i) {
     if (!strcmp(argv[i], "--list")) {
       list = 1;
     } else {
@@ -730,6 +837,9 @@ main(int argc, const char **argv)
     return 1;
   }
 
+  if (vote_files)
+    return bench_consensus_from_votes(n_vote_files, vote_files);
+
   for (benchmark_t *b = benchmarks; b->name; ++b) {
     if (b->enabled || n_enabled == 0) {
       printf("===== %s =====\n", b->name);
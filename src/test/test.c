@@ -48,6 +48,7 @@ double fabs(double x);
 #include "config.h"
 #include "connection_edge.h"
 #include "geoip.h"
+#include "log_test_helpers.h"
 #include "rendcommon.h"
 #include "rendcache.h"
 #include "test.h"
@@ -517,6 +518,156 @@ test_circuit_timeout(void *arg)
   teardown_periodic_events();
 }
 
+/** Check that the histogram and other summaries in <b>cbt</b> agree with
+ * its array of build times. */
+static void
+check_circuit_timeout_summaries(const circuit_build_times_t *cbt)
+{
+  int i, n_abandoned = 0, nbins = 0;
+  uint16_t counts[CBT_HISTOGRAM_NBINS];
+  memset(counts, 0, sizeof(counts));
+
+  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE; i++) {
+    build_time_t t = cbt->circuit_build_times[i];
+    int bin;
+    if (t == 0)
+      continue;
+    if (t == CBT_BUILD_ABANDONED) {
+      n_abandoned++;
+      continue;
+    }
+    bin = (int)MIN(t / CBT_BIN_WIDTH, CBT_HISTOGRAM_NBINS-1);
+    counts[bin]++;
+    nbins = MAX(nbins, bin+1);
+  }
+
+  tt_int_op(cbt->n_abandoned, OP_EQ, n_abandoned);
+  tt_int_op(cbt->histogram_nbins, OP_EQ, nbins);
+  for (i = 0; i < CBT_HISTOGRAM_NBINS; i++) {
+    int n_listed = 0;
+    uint16_t j;
+    tt_int_op(cbt->histogram[i], OP_EQ, counts[i]);
+    for (j = cbt->bin_first[i]; j; j = cbt->bin_next[j-1]) {
+      build_time_t t = cbt->circuit_build_times[j-1];
+      tt_int_op(MIN(t / CBT_BIN_WIDTH, CBT_HISTOGRAM_NBINS-1), OP_EQ, i);
+      n_listed++;
+    }
+    tt_int_op(n_listed, OP_EQ, counts[i]);
+  }
+ done:
+  ;
+}
+
+/** Check that the circuit build time histogram is kept up to date as build
+ * times come and go, that estimates made from it match a direct
+ * computation, and that it survives a trip through the state file. */
+static void
+test_circuit_timeout_histogram(void *arg)
+{
+  circuit_build_times_t *cbt = tor_malloc_zero(sizeof(*cbt));
+  circuit_build_times_t *loaded = tor_malloc_zero(sizeof(*loaded));
+  or_state_t *state = or_state_new();
+  double a = 0, expected_alpha, expected_rate;
+  int i, n = 0, n_abandoned = 0, timeouts = 0;
+  build_time_t max_time = 0;
+  (void)arg;
+
+  circuitbuild_running_unit_tests();
+  circuit_build_times_init(cbt);
+  circuit_build_times_init(loaded);
+
+  /* Wrap around the array a few times, with some abandoned circuits and
+   * some times past the end of the histogram. */
+  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE*3 + 17; i++) {
+    build_time_t t;
+    if (i % 23 == 0)
+      t = CBT_BUILD_ABANDONED;
+    else if (i % 101 == 0)
+      t = CBT_HISTOGRAM_NBINS * CBT_BIN_WIDTH + crypto_rand_int(100000);
+    else
+      t = 100 + crypto_rand_int(20000);
+    tt_int_op(circuit_build_times_add_time(cbt, t), OP_EQ, 0);
+  }
+  check_circuit_timeout_summaries(cbt);
+  tt_int_op(cbt->total_build_times, OP_EQ, CBT_NCIRCUITS_TO_OBSERVE);
+
+  /* Compare the estimator against a direct pass over the build times. */
+  tt_int_op(circuit_build_times_update_alpha(cbt), OP_EQ, 1);
+  cbt->timeout_ms = 9000;
+  for (i = 0; i < CBT_NCIRCUITS_TO_OBSERVE; i++) {
+    build_time_t t = cbt->circuit_build_times[i];
+    if (t >= cbt->timeout_ms)
+      timeouts++;
+    if (t < cbt->Xm) {
+      a += tor_mathlog(cbt->Xm);
+    } else if (t == CBT_BUILD_ABANDONED) {
+      n_abandoned++;
+    } else {
+      a += tor_mathlog(t);
+      max_time = MAX(max_time, t);
+    }
+    n++;
+  }
+  a += n_abandoned*tor_mathlog(max_time);
+  a -= n*tor_mathlog(cbt->Xm);
+  expected_alpha = (n-n_abandoned)/a;
+  expected_rate = ((double)timeouts)/n;
+  tt_double_op(fabs(cbt->alpha - expected_alpha), OP_LT, 1e-6);
+  tt_double_op(fabs(circuit_build_times_timeout_rate(cbt) - expected_rate),
+               OP_LT, 1e-9);
+  tt_double_op(fabs(circuit_build_times_close_rate(cbt) -
+                    ((double)n_abandoned)/n), OP_LT, 1e-9);
+
+  /* Save and reload: we write one packed line, and get the same bins. */
+  circuit_build_times_update_state(cbt, state);
+  tt_ptr_op(state->BuildtimeHistogram, OP_EQ, NULL);
+  tt_assert(state->BuildtimeHistogramPacked);
+  tt_int_op(state->TotalBuildTimes, OP_EQ, CBT_NCIRCUITS_TO_OBSERVE);
+  tt_int_op(state->CircuitBuildAbandonedCount, OP_EQ, n_abandoned);
+  circuit_build_times_free_timeouts(loaded);
+  tt_int_op(circuit_build_times_parse_state(loaded, state), OP_EQ, 0);
+  check_circuit_timeout_summaries(loaded);
+  tt_int_op(loaded->total_build_times, OP_EQ, CBT_NCIRCUITS_TO_OBSERVE);
+  tt_int_op(loaded->n_abandoned, OP_EQ, n_abandoned);
+  tt_int_op(loaded->histogram_nbins, OP_EQ, cbt->histogram_nbins);
+  tt_mem_op(loaded->histogram, OP_EQ, cbt->histogram,
+            sizeof(cbt->histogram));
+
+  /* A corrupt packed histogram is rejected. */
+  tor_free(state->BuildtimeHistogramPacked);
+  state->BuildtimeHistogramPacked = tor_strdup("Ag");
+  circuit_build_times_free_timeouts(loaded);
+  setup_full_capture_of_logs(LOG_WARN);
+  tt_int_op(circuit_build_times_parse_state(loaded, state), OP_EQ, -1);
+  expect_log_msg_containing("Malformed CircuitBuildTimeHistogram");
+  teardown_capture_of_logs();
+
+  /* State files written by older versions still load. */
+  tor_free(state->BuildtimeHistogramPacked);
+  state->TotalBuildTimes = 6;
+  state->CircuitBuildAbandonedCount = 1;
+  config_line_append(&state->BuildtimeHistogram, "CircuitBuildTimeBin",
+                     "125 3");
+  config_line_append(&state->BuildtimeHistogram, "CircuitBuildTimeBin",
+                     "1025 2");
+  circuit_build_times_free_timeouts(loaded);
+  tt_int_op(circuit_build_times_parse_state(loaded, state), OP_EQ, 0);
+  check_circuit_timeout_summaries(loaded);
+  tt_int_op(loaded->total_build_times, OP_EQ, 6);
+  tt_int_op(loaded->n_abandoned, OP_EQ, 1);
+  tt_int_op(loaded->histogram[2], OP_EQ, 3);
+  tt_int_op(loaded->histogram[20], OP_EQ, 2);
+  tt_int_op(loaded->histogram_nbins, OP_EQ, 21);
+
+ done:
+  teardown_capture_of_logs();
+  circuit_build_times_free_timeouts(cbt);
+  circuit_build_times_free_timeouts(loaded);
+  tor_free(cbt);
+  tor_free(loaded);
+  or_state_free(state);
+}
+
 /** Test encoding and parsing of rendezvous service descriptors. */
 static void
 test_rend_fns(void *arg)
@@ -996,6 +1147,148 @@ test_geoip_with_pt(void *arg)
   tor_free(s);
 }
 
+/** Helper: write a binary GeoIP file for IPv4 to <b>fname</b>, with the
+ * <b>n</b> sorted ranges in <b>ranges</b> (low, high, index into "AB", "XY"
+ * in host order) and the text file digest <b>digest</b>.  If
+ * <b>truncate</b> is set, leave off the last byte. */
+static void
+write_binary_geoip_ipv4(const char *fname, const uint32_t (*ranges)[3],
+                        int n, const char *digest, int truncate)
+{
+  const size_t len = 8 + 16 + DIGEST_LEN + 4 + 4 + ((1<<16)+1) * 4 + n * 12;
+  char *buf = tor_malloc_zero(len);
+  char *cp = buf;
+  uint32_t p;
+  int i = 0;
+
+  memcpy(cp, "TORGEOIP", 8); cp += 8;
+  set_uint32(cp, htonl(1)); cp += 4;
+  set_uint32(cp, htonl(4)); cp += 4;
+  set_uint32(cp, htonl(2)); cp += 4;
+  set_uint32(cp, htonl(n)); cp += 4;
+  memcpy(cp, digest, DIGEST_LEN); cp += DIGEST_LEN + 4;
+  memcpy(cp, "ABXY", 4); cp += 4;
+  for (p = 0; p <= (1<<16); ++p) {
+    while (i < n && (ranges[i][1] >> 16) < p)
+      ++i;
+    set_uint32(cp, htonl(i)); cp += 4;
+  }
+  for (i = 0; i < n; ++i) {
+    set_uint32(cp, htonl(ranges[i][0])); cp += 4;
+    set_uint32(cp, htonl(ranges[i][1])); cp += 4;
+    set_uint32(cp, htonl(ranges[i][2])); cp += 4;
+  }
+  tor_assert(cp == buf + len);
+  tor_assert(!write_bytes_to_file(fname, buf, len - (truncate ? 1 : 0), 1));
+  tor_free(buf);
+}
+
+/** Run unit tests for loading text and binary GeoIP files. */
+static void
+test_geoip_load_file(void *arg)
+{
+  const char *text4 =
+    "# A comment\n"
+    "200,250,AB\n"
+    "10,50,AB\n"
+    "167772160,184549375,XY\n"
+    "52,90,XY\n";
+  const char *text6 =
+    "::c8,::fa,AB\n"
+    "::a,::32,AB\n"
+    "::34,::5a,XY\n";
+  const uint32_t ranges[][3] = {
+    { 10, 50, 0 },
+    { 52, 90, 1 },
+    { 200, 250, 0 },
+    { 167772160, 184549375, 1 }, /* 10.0.0.0/8 */
+  };
+  char *fname4 = tor_strdup(get_fname("geoip_text"));
+  char *fname6 = tor_strdup(get_fname("geoip6_text"));
+  char *fname_bin = tor_strdup(get_fname("geoip_bin"));
+  char digest[DIGEST_LEN];
+  char hex[HEX_DIGEST_LEN+1];
+  struct in6_addr in6;
+  (void)arg;
+
+  memset(&in6, 0, sizeof(in6));
+  tt_int_op(0, OP_EQ, write_str_to_file(fname4, text4, 0));
+  tt_int_op(0, OP_EQ, write_str_to_file(fname6, text6, 0));
+
+  tt_assert(!geoip_is_binary_file(text4, strlen(text4)));
+  tt_assert(geoip_is_binary_file("TORGEOIP", 8));
+  tt_assert(!geoip_is_binary_file("TORGEOI", 7));
+
+  /* Text files can come in any order; we sort them when we load them. */
+  tt_int_op(0, OP_EQ, geoip_load_file(AF_INET, fname4));
+  tt_int_op(0, OP_EQ, geoip_load_file(AF_INET6, fname6));
+  tt_assert(geoip_is_loaded(AF_INET));
+  tt_assert(geoip_is_loaded(AF_INET6));
+  CHECK_COUNTRY("ab", 10);
+  CHECK_COUNTRY("ab", 32);
+  CHECK_COUNTRY("??", 51);
+  CHECK_COUNTRY("xy", 90);
+  CHECK_COUNTRY("ab", 250);
+  CHECK_COUNTRY("??", 251);
+  tt_str_op("xy", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(0x0a123456)));
+  tt_str_op("xy", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(0x0affffff)));
+  tt_str_op("??", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(0x0b000000)));
+  crypto_digest(digest, text4, strlen(text4));
+  base16_encode(hex, sizeof(hex), digest, DIGEST_LEN);
+  tt_str_op(hex, OP_EQ, geoip_db_digest(AF_INET));
+
+  /* A binary file gives the same answers, and reports the digest of the
+   * text file it was made from. */
+  clear_geoip_db();
+  write_binary_geoip_ipv4(fname_bin, ranges, ARRAY_LENGTH(ranges), digest, 0);
+  tt_int_op(0, OP_EQ, geoip_load_file(AF_INET, fname_bin));
+  tt_assert(geoip_is_loaded(AF_INET));
+  tt_str_op(hex, OP_EQ, geoip_db_digest(AF_INET));
+  tt_str_op("ab", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(10)));
+  tt_str_op("xy", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(52)));
+  tt_str_op("??", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(51)));
+  tt_str_op("ab", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(250)));
+  tt_str_op("??", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(251)));
+  tt_str_op("xy", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(0x0a123456)));
+  tt_str_op("??", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(0x0b000000)));
+  tt_int_op(geoip_get_country("ab"), OP_GT, 0);
+  tt_int_op(geoip_get_country("xy"), OP_GT, 0);
+
+  /* Unsorted, truncated, or wrong-family binary files are rejected. */
+  {
+    const uint32_t unsorted[][3] = {
+      { 52, 90, 1 },
+      { 10, 50, 0 },
+    };
+    write_binary_geoip_ipv4(fname_bin, unsorted, 2, digest, 0);
+    tt_int_op(-1, OP_EQ, geoip_load_file(AF_INET, fname_bin));
+  }
+  write_binary_geoip_ipv4(fname_bin, ranges, ARRAY_LENGTH(ranges), digest, 1);
+  tt_int_op(-1, OP_EQ, geoip_load_file(AF_INET, fname_bin));
+  write_binary_geoip_ipv4(fname_bin, ranges, ARRAY_LENGTH(ranges), digest, 0);
+  tt_int_op(-1, OP_EQ, geoip_load_file(AF_INET6, fname_bin));
+  tt_assert(!geoip_is_loaded(AF_INET6));
+  /* The last good table is still there. */
+  tt_str_op("xy", OP_EQ,
+            geoip_get_country_name(geoip_get_country_by_ipv4(52)));
+
+ done:
+  clear_geoip_db();
+  tor_free(fname4);
+  tor_free(fname6);
+  tor_free(fname_bin);
+}
+
 #undef SET_TEST_ADDRESS
 #undef SET_TEST_IPV6
 #undef CHECK_COUNTRY
@@ -1172,9 +1465,11 @@ static struct testcase_t test_array[] = {
   { "ntor_handshake", test_ntor_handshake, 0, NULL, NULL },
   { "fast_handshake", test_fast_handshake, 0, NULL, NULL },
   FORK(circuit_timeout),
+  FORK(circuit_timeout_histogram),
   FORK(rend_fns),
   ENT(geoip),
   FORK(geoip_with_pt),
+  FORK(geoip_load_file),
   FORK(stats),
 
   END_OF_TESTCASES
@@ -1216,6 +1511,7 @@ struct testgroup_t testgroups[] = {
   { "entrynodes/", entrynodes_tests },
   { "guardfraction/", guardfraction_tests },
   { "extorport/", extorport_tests },
+  { "fileworker/", fileworker_tests },
   { "legacy_hs/", hs_tests },
   { "hs_cache/", hs_cache },
   { "hs_cell/", hs_cell_tests },
@@ -1255,6 +1551,7 @@ struct testgroup_t testgroups[] = {
   { "storagedir/", storagedir_tests },
   { "tmodel/", tmodel_tests },
   { "tortls/", tortls_tests },
+  { "trace/", trace_tests },
   { "util/", util_tests },
   { "util/format/", util_format_tests },
   { "util/logging/", logging_tests },
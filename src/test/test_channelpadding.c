@@ -1,4 +1,5 @@
 #define TOR_CHANNEL_INTERNAL_
+#define CHANNELPADDING_PRIVATE
 #define MAIN_PRIVATE
 #define NETWORKSTATUS_PRIVATE
 #define TOR_TIMERS_PRIVATE
@@ -28,6 +29,7 @@ void test_channelpadding_consensus(void *arg);
 void test_channelpadding_negotiation(void *arg);
 void test_channelpadding_decide_to_pad_channel(void *arg);
 void test_channelpadding_killonehop(void *arg);
+void test_channelpadding_wheel(void *arg);
 
 void dummy_nop_timer(void);
 
@@ -160,8 +162,7 @@ free_fake_channeltls(channel_tls_t *chan)
   buf_free(((channel_tls_t*)chan)->conn->base_.outbuf);
   tor_free(((channel_tls_t*)chan)->conn);
 
-  timer_free(chan->base_.padding_timer);
-  channel_handle_free(chan->base_.timer_handle);
+  channelpadding_channel_free(&chan->base_);
   channel_handles_clear(&chan->base_);
 
   free_fake_channel(&chan->base_);
@@ -1115,6 +1116,113 @@ test_channelpadding_decide_to_pad_channel(void *arg)
   return;
 }
 
+/** Number of channels in the padding timer wheel simulation. */
+#define WHEEL_TEST_N_CHANNELS 100000
+/** How far we move the clock forward between runs of the wheel. */
+#define WHEEL_TEST_STEP_MSEC 7
+
+static channel_t *wheel_test_chans = NULL;
+static uint64_t *wheel_test_fired_at = NULL;
+static int *wheel_test_n_fired = NULL;
+
+static void
+mock_channelpadding_padding_due(channel_t *chan)
+{
+  const ptrdiff_t idx = chan - wheel_test_chans;
+  tor_assert(idx >= 0 && idx < WHEEL_TEST_N_CHANNELS);
+  tor_assert(chan->pending_padding_callback);
+  chan->pending_padding_callback = 0;
+  wheel_test_fired_at[idx] = monotime_coarse_absolute_msec();
+  ++wheel_test_n_fired[idx];
+}
+
+/**
+ * Simulate a busy guard: schedule padding on a great many channels at once,
+ * and make sure the timer wheel gets to each of them on time, exactly
+ * once.
+ */
+void
+test_channelpadding_wheel(void *arg)
+{
+  uint64_t *due = NULL;
+  uint64_t start_ms, now_ms, end_ms;
+  int i, n_expected = 0, n_fired = 0;
+  (void)arg;
+
+  tor_libevent_postfork();
+  monotime_init();
+  monotime_enable_test_mocking();
+  monotime_set_mock_time_nsec(1);
+  monotime_coarse_set_mock_time_nsec(1);
+  timers_initialize();
+  MOCK(channelpadding_padding_due, mock_channelpadding_padding_due);
+
+  wheel_test_chans = tor_calloc(WHEEL_TEST_N_CHANNELS, sizeof(channel_t));
+  wheel_test_fired_at = tor_calloc(WHEEL_TEST_N_CHANNELS, sizeof(uint64_t));
+  wheel_test_n_fired = tor_calloc(WHEEL_TEST_N_CHANNELS, sizeof(int));
+  due = tor_calloc(WHEEL_TEST_N_CHANNELS, sizeof(uint64_t));
+
+  start_ms = monotime_coarse_absolute_msec();
+  end_ms = start_ms;
+  for (i = 0; i < WHEEL_TEST_N_CHANNELS; ++i) {
+    channel_t *chan = &wheel_test_chans[i];
+    /* Spread most deadlines over the next 1.1 seconds; put a few well
+     * past the end of the wheel. */
+    if (i % 1000 == 999)
+      due[i] = start_ms + 5000 + i % 97;
+    else
+      due[i] = start_ms + 1 + (i * 7919) % 1100;
+    end_ms = MAX(end_ms, due[i]);
+    chan->next_padding_time_ms = due[i];
+    chan->pending_padding_callback = 1;
+    channelpadding_wheel_add(chan, due[i]);
+  }
+  tt_int_op(channelpadding_wheel_n_pending(), OP_EQ, WHEEL_TEST_N_CHANNELS);
+
+  /* Traffic on a channel doesn't touch the wheel; its slot still comes
+   * due, and it's up to the callback to notice. */
+  for (i = 1; i < WHEEL_TEST_N_CHANNELS; i += 10)
+    wheel_test_chans[i].next_padding_time_ms = 0;
+
+  /* Freed channels are taken out right away. */
+  for (i = 5; i < WHEEL_TEST_N_CHANNELS; i += 100) {
+    channelpadding_channel_free(&wheel_test_chans[i]);
+    tt_assert(!wheel_test_chans[i].pending_padding_callback);
+  }
+  n_expected = WHEEL_TEST_N_CHANNELS - WHEEL_TEST_N_CHANNELS / 100;
+  tt_int_op(channelpadding_wheel_n_pending(), OP_EQ, n_expected);
+
+  for (now_ms = start_ms; now_ms <= end_ms + WHEEL_TEST_STEP_MSEC;
+       now_ms += WHEEL_TEST_STEP_MSEC) {
+    monotime_coarse_set_mock_time_nsec(now_ms * NSEC_PER_MSEC);
+    monotime_set_mock_time_nsec(now_ms * NSEC_PER_MSEC);
+    timers_run_pending();
+  }
+
+  tt_int_op(channelpadding_wheel_n_pending(), OP_EQ, 0);
+  for (i = 0; i < WHEEL_TEST_N_CHANNELS; ++i) {
+    if (i % 100 == 5) {
+      tt_int_op(wheel_test_n_fired[i], OP_EQ, 0);
+      continue;
+    }
+    tt_int_op(wheel_test_n_fired[i], OP_EQ, 1);
+    tt_u64_op(wheel_test_fired_at[i], OP_GE, due[i]);
+    tt_u64_op(wheel_test_fired_at[i], OP_LT, due[i] + WHEEL_TEST_STEP_MSEC);
+    ++n_fired;
+  }
+  tt_int_op(n_fired, OP_EQ, n_expected);
+
+ done:
+  UNMOCK(channelpadding_padding_due);
+  channelpadding_free_all();
+  tor_free(wheel_test_chans);
+  tor_free(wheel_test_fired_at);
+  tor_free(wheel_test_n_fired);
+  tor_free(due);
+  timers_shutdown();
+  monotime_disable_test_mocking();
+}
+
 #define TEST_CHANNELPADDING(name, flags) \
     { #name, test_##name, (flags), NULL, NULL }
 
@@ -1125,6 +1233,7 @@ struct testcase_t channelpadding_tests[] = {
   TEST_CHANNELPADDING(channelpadding_consensus, TT_FORK),
   TEST_CHANNELPADDING(channelpadding_killonehop, TT_FORK),
   TEST_CHANNELPADDING(channelpadding_timers, TT_FORK),
+  TEST_CHANNELPADDING(channelpadding_wheel, TT_FORK),
   END_OF_TESTCASES
 };
 
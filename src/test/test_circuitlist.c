@@ -9,6 +9,7 @@
 #include "channel.h"
 #include "circuitbuild.h"
 #include "circuitlist.h"
+#include "circuituse.h"
 #include "hs_circuitmap.h"
 #include "test.h"
 #include "log_test_helpers.h"
@@ -176,6 +177,64 @@ test_clist_maps(void *arg)
   UNMOCK(circuitmux_detach_circuit);
 }
 
+/* Fill the chan,circid map past its initial size with reserved IDs on two
+ * channels, empty parts of it again, and make sure every lookup still finds
+ * what it should. */
+static void
+test_clist_maps_churn(void *arg)
+{
+  channel_t *ch1 = new_fake_channel();
+  channel_t *ch2 = new_fake_channel();
+  or_circuit_t *or_c = NULL;
+  circid_t id;
+  const circid_t n_ids = 3000;
+
+  (void) arg;
+
+  MOCK(circuitmux_attach_circuit, circuitmux_attach_mock);
+  MOCK(circuitmux_detach_circuit, circuitmux_detach_mock);
+  ch1->cmux = tor_malloc(1);
+  ch2->cmux = tor_malloc(1);
+
+  for (id = 1; id <= n_ids; ++id) {
+    channel_mark_circid_unusable(ch1, id);
+    if (id % 3 == 0)
+      channel_mark_circid_unusable(ch2, id);
+  }
+  for (id = 1; id <= n_ids; id += 2)
+    channel_mark_circid_usable(ch1, id);
+
+  for (id = 1; id <= n_ids; ++id) {
+    tt_int_op(circuit_id_in_use_on_channel(id, ch1), OP_EQ,
+              (id % 2) ? 0 : 2);
+    tt_int_op(circuit_id_in_use_on_channel(id, ch2), OP_EQ,
+              (id % 3) ? 0 : 2);
+  }
+  tt_int_op(circuit_id_in_use_on_channel(n_ids + 1, ch1), OP_EQ, 0);
+
+  /* A circuit that moves to another ID can't be found under the old one,
+   * even right after a lookup under the old one. */
+  or_c = or_circuit_new(1, ch1);
+  tt_ptr_op(circuit_get_by_circid_channel(1, ch1), OP_EQ, TO_CIRCUIT(or_c));
+  circuit_set_p_circid_chan(or_c, 9, ch1);
+  tt_ptr_op(circuit_get_by_circid_channel(1, ch1), OP_EQ, NULL);
+  tt_ptr_op(circuit_get_by_circid_channel(9, ch1), OP_EQ, TO_CIRCUIT(or_c));
+  tt_ptr_op(circuit_get_by_circid_channel(9, ch2), OP_EQ, NULL);
+  circuit_set_p_circid_chan(or_c, 0, NULL);
+  tt_ptr_op(circuit_get_by_circid_channel(9, ch1), OP_EQ, NULL);
+  tt_int_op(circuit_id_in_use_on_channel(8, ch1), OP_EQ, 2);
+
+ done:
+  if (or_c)
+    circuit_free(TO_CIRCUIT(or_c));
+  tor_free(ch1->cmux);
+  tor_free(ch2->cmux);
+  tor_free(ch1);
+  tor_free(ch2);
+  UNMOCK(circuitmux_attach_circuit);
+  UNMOCK(circuitmux_detach_circuit);
+}
+
 static void
 test_rend_token_maps(void *arg)
 {
@@ -306,6 +365,10 @@ test_pick_circid(void *arg)
 
   chan1 = tor_malloc_zero(sizeof(channel_t));
   chan2 = tor_malloc_zero(sizeof(channel_t));
+  /* The circuit ID map tells channels apart by their global identifiers,
+   * as channel_init() would assign them. */
+  chan1->global_identifier = 1;
+  chan2->global_identifier = 2;
   chan2->wide_circ_ids = 1;
 
   chan1->cmux = circuitmux_alloc();
@@ -458,12 +521,124 @@ test_hs_circuitmap_isolation(void *arg)
   circuit_free(TO_CIRCUIT(circ4));
 }
 
+/** Return the number of origin circuits with <b>purpose</b>, checking that
+ * each of them really has that purpose. */
+static int
+count_origin_circuits_with_purpose(uint8_t purpose)
+{
+  int n = 0;
+  ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(purpose, ocirc) {
+    tor_assert(TO_CIRCUIT(ocirc)->purpose == purpose);
+    ++n;
+  } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(ocirc);
+  return n;
+}
+
+static void
+test_clist_purpose_index(void *arg)
+{
+  origin_circuit_t *c1 = NULL, *c2 = NULL, *c3 = NULL;
+  (void) arg;
+
+  c1 = origin_circuit_init(CIRCUIT_PURPOSE_C_GENERAL, 0);
+  c2 = origin_circuit_init(CIRCUIT_PURPOSE_C_GENERAL, 0);
+  c3 = origin_circuit_init(CIRCUIT_PURPOSE_C_INTRODUCING, 0);
+  tt_int_op(count_origin_circuits_with_purpose(CIRCUIT_PURPOSE_C_GENERAL),
+            OP_EQ, 2);
+  tt_int_op(count_origin_circuits_with_purpose(
+                                       CIRCUIT_PURPOSE_C_INTRODUCING),
+            OP_EQ, 1);
+  tt_int_op(count_origin_circuits_with_purpose(CIRCUIT_PURPOSE_TESTING),
+            OP_EQ, 0);
+
+  /* Changing the purpose moves a circuit to the right list, even from
+   * inside a loop over the old one. */
+  ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_BEGIN(CIRCUIT_PURPOSE_C_GENERAL,
+                                            ocirc) {
+    circuit_change_purpose(TO_CIRCUIT(ocirc), CIRCUIT_PURPOSE_TESTING);
+  } ORIGIN_CIRCUIT_FOREACH_WITH_PURPOSE_END(ocirc);
+  tt_int_op(count_origin_circuits_with_purpose(CIRCUIT_PURPOSE_C_GENERAL),
+            OP_EQ, 0);
+  tt_int_op(count_origin_circuits_with_purpose(CIRCUIT_PURPOSE_TESTING),
+            OP_EQ, 2);
+  circuit_change_purpose(TO_CIRCUIT(c3), CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT);
+  tt_int_op(count_origin_circuits_with_purpose(
+                                       CIRCUIT_PURPOSE_C_INTRODUCING),
+            OP_EQ, 0);
+  tt_int_op(count_origin_circuits_with_purpose(
+                                       CIRCUIT_PURPOSE_C_INTRODUCE_ACK_WAIT),
+            OP_EQ, 1);
+
+  /* Marked circuits stay listed until they're freed. */
+  circuit_mark_for_close(TO_CIRCUIT(c1), END_CIRC_REASON_FINISHED);
+  tt_int_op(count_origin_circuits_with_purpose(CIRCUIT_PURPOSE_TESTING),
+            OP_EQ, 2);
+  circuit_close_all_marked();
+  c1 = NULL;
+  tt_int_op(count_origin_circuits_with_purpose(CIRCUIT_PURPOSE_TESTING),
+            OP_EQ, 1);
+  tt_ptr_op(TOR_LIST_FIRST(circuit_get_origin_circuits_with_purpose(
+                                       CIRCUIT_PURPOSE_TESTING)), OP_EQ, c2);
+
+  circuit_free(TO_CIRCUIT(c2));
+  c2 = NULL;
+  tt_int_op(count_origin_circuits_with_purpose(CIRCUIT_PURPOSE_TESTING),
+            OP_EQ, 0);
+
+ done:
+  if (c1)
+    circuit_free(TO_CIRCUIT(c1));
+  if (c2)
+    circuit_free(TO_CIRCUIT(c2));
+  if (c3)
+    circuit_free(TO_CIRCUIT(c3));
+}
+
+static void
+test_clist_build_deadlines(void *arg)
+{
+  origin_circuit_t *c1 = NULL, *c2 = NULL;
+  (void) arg;
+
+  c1 = origin_circuit_init(CIRCUIT_PURPOSE_C_GENERAL, 0);
+  c2 = origin_circuit_init(CIRCUIT_PURPOSE_C_ESTABLISH_REND, 0);
+
+  /* Circuits that are still building are queued. */
+  tt_int_op(c1->build_deadline_idx, OP_GE, 0);
+  tt_int_op(c2->build_deadline_idx, OP_GE, 0);
+
+  /* Open general circuits aren't, but some purposes still are. */
+  circuit_set_state(TO_CIRCUIT(c1), CIRCUIT_STATE_OPEN);
+  circuit_set_state(TO_CIRCUIT(c2), CIRCUIT_STATE_OPEN);
+  tt_int_op(c1->build_deadline_idx, OP_EQ, -1);
+  tt_int_op(c2->build_deadline_idx, OP_GE, 0);
+  circuit_change_purpose(TO_CIRCUIT(c2), CIRCUIT_PURPOSE_C_REND_JOINED);
+  tt_int_op(c2->build_deadline_idx, OP_EQ, -1);
+  circuit_change_purpose(TO_CIRCUIT(c1), CIRCUIT_PURPOSE_PATH_BIAS_TESTING);
+  tt_int_op(c1->build_deadline_idx, OP_GE, 0);
+
+  /* Marked circuits leave the queue at once. */
+  circuit_mark_for_close(TO_CIRCUIT(c1), END_CIRC_REASON_FINISHED);
+  tt_int_op(c1->build_deadline_idx, OP_EQ, -1);
+  circuit_close_all_marked();
+  c1 = NULL;
+
+ done:
+  if (c1)
+    circuit_free(TO_CIRCUIT(c1));
+  if (c2)
+    circuit_free(TO_CIRCUIT(c2));
+}
+
 struct testcase_t circuitlist_tests[] = {
   { "maps", test_clist_maps, TT_FORK, NULL, NULL },
+  { "maps_churn", test_clist_maps_churn, TT_FORK, NULL, NULL },
   { "rend_token_maps", test_rend_token_maps, TT_FORK, NULL, NULL },
   { "pick_circid", test_pick_circid, TT_FORK, NULL, NULL },
   { "hs_circuitmap_isolation", test_hs_circuitmap_isolation,
     TT_FORK, NULL, NULL },
+  { "purpose_index", test_clist_purpose_index, TT_FORK, NULL, NULL },
+  { "build_deadlines", test_clist_build_deadlines, TT_FORK, NULL, NULL },
   END_OF_TESTCASES
 };
 
@@ -4,6 +4,7 @@
 /* See LICENSE for licensing information */
 
 #define CIRCUITLIST_PRIVATE
+#define CONNECTION_PRIVATE
 
 #include "or.h"
 #include "test.h"
@@ -12,6 +13,8 @@
 #include "circuitlist.h"
 #include "circuituse.h"
 #include "circuitbuild.h"
+#include "connection.h"
+#include "connection_edge.h"
 #include "nodelist.h"
 
 static void
@@ -241,6 +244,56 @@ test_needs_circuits_for_build_returns_true_when_more_are_needed(void *arg)
     UNMOCK(router_have_consensus_path);
 }
 
+static void
+test_circuit_could_carry_stream(void *arg)
+{
+  origin_circuit_t *circ = NULL;
+  entry_connection_t *ec = NULL;
+  char hexid[HEX_DIGEST_LEN+2];
+  (void)arg;
+
+  circ = origin_circuit_init(CIRCUIT_PURPOSE_C_GENERAL,
+                             CIRCLAUNCH_ONEHOP_TUNNEL|CIRCLAUNCH_IS_INTERNAL);
+  circ->build_state->chosen_exit = tor_malloc_zero(sizeof(extend_info_t));
+  memset(circ->build_state->chosen_exit->identity_digest, 'A', DIGEST_LEN);
+
+  ec = entry_connection_new(CONN_TYPE_AP, AF_INET);
+  ENTRY_TO_CONN(ec)->state = AP_CONN_STATE_CIRCUIT_WAIT;
+  strlcpy(ec->socks_request->address, "127.0.0.1",
+          sizeof(ec->socks_request->address));
+  ec->socks_request->port = 80;
+  ec->want_onehop = 1;
+  hexid[0] = '$';
+  base16_encode(hexid+1, HEX_DIGEST_LEN+1,
+                circ->build_state->chosen_exit->identity_digest, DIGEST_LEN);
+  ec->chosen_exit_name = tor_strdup(hexid);
+
+  /* Circuits that aren't open can't carry anything yet. */
+  tt_int_op(0, OP_EQ, circuit_could_carry_stream(circ, ec));
+
+  TO_CIRCUIT(circ)->state = CIRCUIT_STATE_OPEN;
+  TO_CIRCUIT(circ)->n_chan = (channel_t *)circ; /* only checked for NULL */
+  tt_int_op(1, OP_EQ, circuit_could_carry_stream(circ, ec));
+
+  /* A stream that wants a different relay can't use this circuit. */
+  hexid[1] = (hexid[1] == 'B') ? 'C' : 'B';
+  tor_free(ec->chosen_exit_name);
+  ec->chosen_exit_name = tor_strdup(hexid);
+  tt_int_op(0, OP_EQ, circuit_could_carry_stream(circ, ec));
+
+  /* Nor can a stream that doesn't want a one-hop circuit. */
+  ec->want_onehop = 0;
+  tt_int_op(0, OP_EQ, circuit_could_carry_stream(circ, ec));
+
+ done:
+  if (circ) {
+    TO_CIRCUIT(circ)->n_chan = NULL;
+    circuit_free(TO_CIRCUIT(circ));
+  }
+  if (ec)
+    connection_free_(ENTRY_TO_CONN(ec));
+}
+
 struct testcase_t circuituse_tests[] = {
  { "marked",
    test_circuit_is_available_for_use_ret_false_when_marked_for_close,
@@ -301,6 +354,10 @@ struct testcase_t circuituse_tests[] = {
  { "more_needed",
    test_needs_circuits_for_build_returns_true_when_more_are_needed,
    TT_FORK, NULL, NULL
+ },
+ { "could_carry_stream",
+   test_circuit_could_carry_stream,
+   TT_FORK, NULL, NULL
  },
   END_OF_TESTCASES
 };
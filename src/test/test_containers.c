@@ -407,6 +407,55 @@ test_container_smartlist_overlap(void *arg)
   smartlist_free(sl);
 }
 
+/** Run unit tests for the smartlist set manipulation functions on lists
+ * large enough that they use a hash set. */
+static void
+test_container_smartlist_overlap_large(void *arg)
+{
+  smartlist_t *sl = smartlist_new();
+  smartlist_t *threes = smartlist_new();
+  smartlist_t *fives = smartlist_new();
+  smartlist_t *big = smartlist_new();
+  int i;
+  (void)arg;
+
+  for (i = 0; i < 1000; i += 3)
+    smartlist_add(threes, (void*)(uintptr_t)i);
+  for (i = 0; i < 1000; i += 5)
+    smartlist_add(fives, (void*)(uintptr_t)i);
+  for (i = 1000; i < 2000; ++i)
+    smartlist_add(big, (void*)(uintptr_t)i);
+
+  /* overlap: 0 is NULL, and it's in both lists. */
+  tt_assert(smartlist_overlap(threes, fives));
+  tt_assert(! smartlist_overlap(big, threes));
+  smartlist_add(big, NULL);
+  tt_assert(smartlist_overlap(big, threes));
+  smartlist_del(big, smartlist_len(big) - 1);
+
+  /* intersect */
+  smartlist_add_all(sl, threes);
+  smartlist_intersect(sl, fives);
+  tt_int_op(smartlist_len(sl), OP_EQ, 67);
+  SMARTLIST_FOREACH(sl, void *, p, tt_int_op((uintptr_t)p % 15, OP_EQ, 0));
+
+  /* subtract, with duplicates in the first list. */
+  smartlist_clear(sl);
+  smartlist_add_all(sl, threes);
+  smartlist_add_all(sl, threes);
+  smartlist_add_all(sl, big);
+  smartlist_subtract(sl, fives);
+  tt_int_op(smartlist_len(sl), OP_EQ, 2*(334-67) + 1000);
+  SMARTLIST_FOREACH(sl, void *, p,
+                    tt_assert((uintptr_t)p >= 1000 || (uintptr_t)p % 5));
+
+ done:
+  smartlist_free(sl);
+  smartlist_free(threes);
+  smartlist_free(fives);
+  smartlist_free(big);
+}
+
 /** Run unit tests for smartlist-of-digests functions. */
 static void
 test_container_smartlist_digests(void *arg)
@@ -1002,6 +1051,106 @@ test_container_order_functions(void *arg)
   ;
 }
 
+/** Helper: set <b>d</b> to a digest that encodes <b>i</b>. */
+static void
+make_test_digest(char *d, int i)
+{
+  memset(d, 0, DIGEST_LEN);
+  set_uint32(d, htonl(i));
+  set_uint32(d + DIGEST_LEN - 4, htonl(i * 7919));
+}
+
+/** Run a digestmap through enough additions and removals to make it grow,
+ * reuse deleted slots, and rehash, checking it against what we put in. */
+static void
+test_container_digestmap_churn(void *arg)
+{
+  digestmap_t *map = digestmap_new();
+  bitarray_t *seen = NULL;
+  const int N = 3000;
+  char d[DIGEST_LEN];
+  int i, n_seen = 0;
+  (void)arg;
+
+  for (i = 0; i < N; ++i) {
+    make_test_digest(d, i);
+    tt_ptr_op(NULL, OP_EQ, digestmap_set(map, d, (void*)(intptr_t)(i+1)));
+  }
+  digestmap_assert_ok(map);
+  tt_int_op(N, OP_EQ, digestmap_size(map));
+
+  /* Remove the odd entries, and put half of them back. */
+  for (i = 1; i < N; i += 2) {
+    make_test_digest(d, i);
+    tt_ptr_op((void*)(intptr_t)(i+1), OP_EQ, digestmap_remove(map, d));
+    tt_ptr_op(NULL, OP_EQ, digestmap_remove(map, d));
+  }
+  digestmap_assert_ok(map);
+  tt_int_op(N/2, OP_EQ, digestmap_size(map));
+  for (i = 1; i < N; i += 4) {
+    make_test_digest(d, i);
+    tt_ptr_op(NULL, OP_EQ, digestmap_set(map, d, (void*)(intptr_t)(i+1)));
+  }
+  /* Replacing a value doesn't add an entry. */
+  make_test_digest(d, 0);
+  tt_ptr_op((void*)1, OP_EQ, digestmap_set(map, d, (void*)2));
+  tt_ptr_op((void*)2, OP_EQ, digestmap_set(map, d, (void*)1));
+  digestmap_assert_ok(map);
+  tt_int_op(N/2 + N/4, OP_EQ, digestmap_size(map));
+
+  for (i = 0; i < N; ++i) {
+    make_test_digest(d, i);
+    if (i % 2 == 0 || i % 4 == 1)
+      tt_ptr_op((void*)(intptr_t)(i+1), OP_EQ, digestmap_get(map, d));
+    else
+      tt_ptr_op(NULL, OP_EQ, digestmap_get(map, d));
+  }
+
+  /* Every entry is visited exactly once, even while we remove some. */
+  seen = bitarray_init_zero(N);
+  DIGESTMAP_FOREACH_MODIFY(map, k, void *, v) {
+    int idx = (int)(intptr_t)v - 1;
+    tt_assert(idx >= 0 && idx < N);
+    make_test_digest(d, idx);
+    tt_mem_op(k, OP_EQ, d, DIGEST_LEN);
+    tt_assert(! bitarray_is_set(seen, idx));
+    bitarray_set(seen, idx);
+    ++n_seen;
+    if (idx % 3 == 0)
+      MAP_DEL_CURRENT(k);
+  } DIGESTMAP_FOREACH_END;
+  tt_int_op(n_seen, OP_EQ, N/2 + N/4);
+  digestmap_assert_ok(map);
+  for (i = 0; i < N; ++i) {
+    make_test_digest(d, i);
+    if ((i % 2 == 0 || i % 4 == 1) && i % 3 != 0)
+      tt_ptr_op((void*)(intptr_t)(i+1), OP_EQ, digestmap_get(map, d));
+    else
+      tt_ptr_op(NULL, OP_EQ, digestmap_get(map, d));
+  }
+
+  /* Emptying the map and filling it again reuses its deleted slots. */
+  for (i = 0; i < N; ++i) {
+    make_test_digest(d, i);
+    digestmap_remove(map, d);
+  }
+  tt_assert(digestmap_isempty(map));
+  digestmap_assert_ok(map);
+  for (i = 0; i < 10 * N; ++i) {
+    make_test_digest(d, (i / 2) % 100 + N);
+    if (i % 2)
+      digestmap_remove(map, d);
+    else
+      digestmap_set(map, d, (void*)1);
+  }
+  digestmap_assert_ok(map);
+  tt_int_op(0, OP_EQ, digestmap_size(map));
+
+ done:
+  bitarray_free(seen);
+  digestmap_free(map, NULL);
+}
+
 static void
 test_container_di_map(void *arg)
 {
@@ -1277,6 +1426,7 @@ struct testcase_t container_tests[] = {
   CONTAINER_LEGACY(smartlist_basic),
   CONTAINER_LEGACY(smartlist_strings),
   CONTAINER_LEGACY(smartlist_overlap),
+  CONTAINER(smartlist_overlap_large, 0),
   CONTAINER_LEGACY(smartlist_digests),
   CONTAINER_LEGACY(smartlist_join),
   CONTAINER_LEGACY(smartlist_pos),
@@ -1285,6 +1435,7 @@ struct testcase_t container_tests[] = {
   CONTAINER_LEGACY(bitarray),
   CONTAINER_LEGACY(digestset),
   CONTAINER_LEGACY(strmap),
+  CONTAINER(digestmap_churn, 0),
   CONTAINER_LEGACY(pqueue),
   CONTAINER_LEGACY(order_functions),
   CONTAINER(di_map, 0),
@@ -1,9 +1,13 @@
 /* Copyright (c) 2015-2017, The Tor Project, Inc. */
 /* See LICENSE for licensing information */
 
+#define CONNECTION_PRIVATE
 #define CONTROL_PRIVATE
 #include "or.h"
 #include "bridges.h"
+#include "buffers.h"
+#include "config.h"
+#include "connection.h"
 #include "control.h"
 #include "entrynodes.h"
 #include "networkstatus.h"
@@ -1369,6 +1373,104 @@ test_download_status_bridge(void *arg)
   return;
 }
 
+static void
+test_escape_data_chunked(void *arg)
+{
+  const char *inputs[] = {
+    "", "\n", "\r\n", "abc", "abc\n", "abc\r\n", ".", "..\n.x\r\n",
+    "a\n.b\n..c\r\n.\n\n.", "\n.\n", NULL
+  };
+  char *whole = NULL;
+  char out[256];
+  int i;
+  (void) arg;
+
+  for (i = 0; inputs[i]; ++i) {
+    const char *in = inputs[i];
+    size_t len = strlen(in), whole_len, split;
+    whole_len = write_escaped_data(in, len, &whole);
+    /* Escaping in two pieces, split anywhere, gives the same result. */
+    for (split = 0; split <= len; ++split) {
+      control_escape_state_t st;
+      size_t n;
+      control_escape_state_init(&st);
+      n = control_escape_data_chunk(&st, in, split, out);
+      n += control_escape_data_chunk(&st, in + split, len - split, out + n);
+      n += control_escape_data_finish(&st, out + n);
+      tt_int_op(n, OP_EQ, whole_len);
+      tt_mem_op(out, OP_EQ, whole, whole_len);
+    }
+    tor_free(whole);
+  }
+
+ done:
+  tor_free(whole);
+}
+
+static void
+test_getinfo_stream_consensus(void *arg)
+{
+  control_connection_t *conn = NULL;
+  char *fname = get_datadir_fname("cached-consensus");
+  smartlist_t *lines = smartlist_new();
+  char *consensus = NULL, *expected = NULL, *escaped = NULL, *got = NULL;
+  buf_t *reply = buf_new();
+  size_t reply_len;
+  int i;
+  (void) arg;
+
+  MOCK(connection_write_to_buf_impl_, connection_write_to_buf_mock);
+
+  /* A document much bigger than the outbuf is allowed to get, with some
+   * lines that need escaping. */
+  for (i = 0; i < 5000; ++i)
+    smartlist_add_asprintf(lines, "%sline %d of the consensus\n",
+                           (i % 7) ? "" : ".", i);
+  consensus = smartlist_join_strings(lines, "", 0, NULL);
+  tt_int_op(write_str_to_file(fname, consensus, 0), OP_EQ, 0);
+  write_escaped_data(consensus, strlen(consensus), &escaped);
+  tor_asprintf(&expected,
+               "250+dir/status-vote/current/consensus=\r\n%s"
+               "250-version=%s\r\n"
+               "250 OK\r\n", escaped, get_version());
+
+  conn = control_connection_new(AF_INET);
+  tt_int_op(handle_control_getinfo(conn, 0,
+                        "dir/status-vote/current/consensus version"),
+            OP_EQ, 0);
+  tt_ptr_op(conn->getinfo_stream, OP_NE, NULL);
+
+  /* Drain the outbuf as a socket would, and check that it never holds more
+   * than a couple of pieces. */
+  for (i = 0; conn->getinfo_stream && i < 1000; ++i) {
+    size_t n = connection_get_outbuf_len(TO_CONN(conn));
+    tt_int_op(n, OP_LT, 64*1024);
+    buf_move_to_buf(reply, TO_CONN(conn)->outbuf, &n);
+    connection_control_flushed_some(conn);
+  }
+  tt_ptr_op(conn->getinfo_stream, OP_EQ, NULL);
+  reply_len = connection_get_outbuf_len(TO_CONN(conn));
+  buf_move_to_buf(reply, TO_CONN(conn)->outbuf, &reply_len);
+
+  reply_len = buf_datalen(reply);
+  got = tor_malloc_zero(reply_len + 1);
+  buf_get_bytes(reply, got, reply_len);
+  tt_str_op(got, OP_EQ, expected);
+
+ done:
+  UNMOCK(connection_write_to_buf_impl_);
+  if (conn)
+    connection_free_(TO_CONN(conn));
+  SMARTLIST_FOREACH(lines, char *, cp, tor_free(cp));
+  smartlist_free(lines);
+  buf_free(reply);
+  tor_free(fname);
+  tor_free(consensus);
+  tor_free(expected);
+  tor_free(escaped);
+  tor_free(got);
+}
+
 struct testcase_t controller_tests[] = {
   { "add_onion_helper_keyarg", test_add_onion_helper_keyarg, 0, NULL, NULL },
   { "getinfo_helper_onion", test_getinfo_helper_onion, 0, NULL, NULL },
@@ -1382,6 +1484,9 @@ struct testcase_t controller_tests[] = {
     NULL },
   { "download_status_desc", test_download_status_desc, 0, NULL, NULL },
   { "download_status_bridge", test_download_status_bridge, 0, NULL, NULL },
+  { "escape_data_chunked", test_escape_data_chunked, 0, NULL, NULL },
+  { "getinfo_stream_consensus", test_getinfo_stream_consensus, TT_FORK,
+    NULL, NULL },
   END_OF_TESTCASES
 };
 
@@ -22,6 +22,7 @@
 #include "confparse.h"
 #include "config.h"
 #include "control.h"
+#include "cpuworker.h"
 #include "crypto_ed25519.h"
 #include "directory.h"
 #include "dirserv.h"
@@ -41,6 +42,8 @@
 #include "torcert.h"
 #include "relay.h"
 #include "log_test_helpers.h"
+#include "policies.h"
+#include "workqueue.h"
 
 #define NS_MODULE dir
 
@@ -1018,6 +1021,211 @@ test_dir_load_extrainfo(void *arg)
   tor_free(list);
 }
 
+static int mock_cpuworker_running = 0;
+
+static int
+mock_cpuworker_is_running(void)
+{
+  return mock_cpuworker_running;
+}
+
+/** Work handed to mock_cpuworker_queue_work(). */
+typedef struct mock_cpuworker_job_t {
+  workqueue_reply_t (*fn)(void *, void *);
+  void (*reply_fn)(void *);
+  void *arg;
+  /** True once a "cpuworker" has started on this job. */
+  int started;
+  /** True iff this job was cancelled. */
+  int cancelled;
+} mock_cpuworker_job_t;
+
+static smartlist_t *mock_cpuworker_jobs = NULL;
+
+static workqueue_entry_t *
+mock_cpuworker_queue_work(workqueue_priority_t priority,
+                          workqueue_reply_t (*fn)(void *, void *),
+                          void (*reply_fn)(void *),
+                          void *arg)
+{
+  mock_cpuworker_job_t *job = tor_malloc_zero(sizeof(*job));
+  (void) priority;
+  job->fn = fn;
+  job->reply_fn = reply_fn;
+  job->arg = arg;
+  smartlist_add(mock_cpuworker_jobs, job);
+  /* Never dereferenced. */
+  return (workqueue_entry_t *) job;
+}
+
+static void *
+mock_cpuworker_cancel_work(workqueue_entry_t *ent)
+{
+  mock_cpuworker_job_t *job = (mock_cpuworker_job_t *) ent;
+  if (job->started)
+    return NULL;
+  job->cancelled = 1;
+  return job->arg;
+}
+
+/* Have a cpuworker start on the idx'th job handed to
+ * mock_cpuworker_queue_work(), without delivering its reply. */
+static void
+start_mock_cpuworker_job(int idx)
+{
+  mock_cpuworker_job_t *job = smartlist_get(mock_cpuworker_jobs, idx);
+  tt_assert(!job->started);
+  tt_assert(!job->cancelled);
+  job->started = 1;
+  tt_int_op(job->fn(NULL, job->arg), OP_EQ, WQ_RPL_REPLY);
+ done:
+  ;
+}
+
+/* Do the work of the idx'th job handed to mock_cpuworker_queue_work(), and
+ * deliver its reply. */
+static void
+run_mock_cpuworker_job(int idx)
+{
+  mock_cpuworker_job_t *job = smartlist_get(mock_cpuworker_jobs, idx);
+  start_mock_cpuworker_job(idx);
+  job->reply_fn(job->arg);
+}
+
+static smartlist_t *upload_done_ids = NULL;
+static was_router_added_t upload_done_r;
+static const char *upload_done_msg = NULL;
+
+static void
+upload_done_cb(uint64_t conn_id, was_router_added_t r, const char *msg)
+{
+  smartlist_add(upload_done_ids, tor_memdup(&conn_id, sizeof(conn_id)));
+  upload_done_r = r;
+  upload_done_msg = msg;
+}
+
+/* Return the connection identifier of the idx'th upload upload_done_cb()
+ * heard about. */
+static uint64_t
+upload_done_id(int idx)
+{
+  return *(uint64_t *) smartlist_get(upload_done_ids, idx);
+}
+
+static void
+test_dir_add_descriptors_async(void *arg)
+{
+  smartlist_t *policy = smartlist_new();
+  addr_policy_t *canonical = NULL, *copy;
+  mock_cpuworker_job_t *job;
+  int malformed = 0, i;
+  (void) arg;
+
+  MOCK(cpuworker_is_running, mock_cpuworker_is_running);
+  MOCK(cpuworker_queue_work, mock_cpuworker_queue_work);
+  MOCK(cpuworker_cancel_work, mock_cpuworker_cancel_work);
+  mock_cpuworker_jobs = smartlist_new();
+  upload_done_ids = smartlist_new();
+
+  /* Without cpuworkers, uploads are handled right away. */
+  mock_cpuworker_running = 0;
+  tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG1,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 1,
+                                upload_done_cb), OP_EQ, 0);
+  tt_int_op(smartlist_len(upload_done_ids), OP_EQ, 1);
+  tt_u64_op(upload_done_id(0), OP_EQ, 1);
+  tt_int_op(upload_done_r, OP_EQ, ROUTER_IS_ALREADY_KNOWN);
+  tt_str_op(upload_done_msg, OP_EQ, "No descriptors found in your POST.");
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 0);
+
+  /* With them, the checking happens on a cpuworker, and a copy of an upload
+   * that's already being checked doesn't get checked twice. */
+  mock_cpuworker_running = 1;
+  tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG1,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 2,
+                                upload_done_cb), OP_EQ, 0);
+  tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG2,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 3,
+                                upload_done_cb), OP_EQ, 0);
+  tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG1,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 4,
+                                upload_done_cb), OP_EQ, 0);
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 2);
+  tt_int_op(smartlist_len(upload_done_ids), OP_EQ, 1);
+
+  /* Uploads finish in the order they arrived, whatever order the
+   * cpuworkers answer in. */
+  run_mock_cpuworker_job(1);
+  tt_int_op(smartlist_len(upload_done_ids), OP_EQ, 1);
+  run_mock_cpuworker_job(0);
+  tt_int_op(smartlist_len(upload_done_ids), OP_EQ, 4);
+  tt_u64_op(upload_done_id(1), OP_EQ, 2);
+  tt_u64_op(upload_done_id(2), OP_EQ, 3);
+  tt_u64_op(upload_done_id(3), OP_EQ, 4);
+  /* The copy was checked once its original turned out bad. */
+  tt_int_op(upload_done_r, OP_EQ, ROUTER_IS_ALREADY_KNOWN);
+  tt_str_op(upload_done_msg, OP_EQ, "No descriptors found in your POST.");
+
+  /* Too many pending uploads, and we turn new ones away. */
+  for (i = 0; i < 64; ++i) {
+    tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG1,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 100+i,
+                                upload_done_cb), OP_EQ, 0);
+  }
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 3);
+  tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG2,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 200,
+                                upload_done_cb), OP_EQ, -1);
+  run_mock_cpuworker_job(2);
+  tt_int_op(smartlist_len(upload_done_ids), OP_EQ, 4+64);
+  tt_u64_op(upload_done_id(4+63), OP_EQ, 163);
+  tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG2,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 201,
+                                upload_done_cb), OP_EQ, 0);
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 4);
+
+  /* At exit, we free the uploads that no cpuworker has started on.  One
+   * that a cpuworker is checking gets freed when it replies, and its
+   * uploader never hears back. */
+  tt_int_op(dirserv_add_multiple_descriptors_async(EX_RI_BAD_SIG1,
+                                ROUTER_PURPOSE_GENERAL, "127.0.0.1", 202,
+                                upload_done_cb), OP_EQ, 0);
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 5);
+  start_mock_cpuworker_job(4);
+  dirserv_free_all();
+  job = smartlist_get(mock_cpuworker_jobs, 3);
+  tt_assert(job->cancelled);
+  job = smartlist_get(mock_cpuworker_jobs, 4);
+  tt_assert(!job->cancelled);
+  job->reply_fn(job->arg);
+  tt_int_op(smartlist_len(upload_done_ids), OP_EQ, 4+64);
+
+  /* Exit policies parsed on a cpuworker get their canonical entries back on
+   * the main thread. */
+  canonical = router_parse_addr_policy_item_from_string("reject *:25", -1,
+                                                        &malformed);
+  tt_assert(canonical);
+  copy = tor_memdup(canonical, sizeof(*copy));
+  copy->is_canonical = 0;
+  copy->refcnt = 1;
+  smartlist_add(policy, copy);
+  addr_policy_list_make_canonical(policy);
+  tt_ptr_op(smartlist_get(policy, 0), OP_EQ, canonical);
+
+ done:
+  UNMOCK(cpuworker_is_running);
+  UNMOCK(cpuworker_queue_work);
+  UNMOCK(cpuworker_cancel_work);
+  addr_policy_list_free(policy);
+  addr_policy_free(canonical);
+  SMARTLIST_FOREACH(mock_cpuworker_jobs, mock_cpuworker_job_t *, j,
+                    tor_free(j));
+  smartlist_free(mock_cpuworker_jobs);
+  SMARTLIST_FOREACH(upload_done_ids, uint64_t *, id, tor_free(id));
+  smartlist_free(upload_done_ids);
+  dirserv_free_all();
+}
+
 static void
 test_dir_getinfo_extra(void *arg)
 {
@@ -2492,6 +2700,23 @@ test_a_networkstatus(
   tt_assert(con_md);
   tt_int_op(con_md->flavor,OP_EQ, FLAV_MICRODESC);
 
+  /* Splitting the work across threads doesn't change the result. */
+  {
+    consensus_flavor_t flav;
+    for (flav = FLAV_NS; flav <= FLAV_MICRODESC; ++flav) {
+      char *threaded = networkstatus_compute_consensus_threaded(votes, 3,
+                                                   cert3->identity_key,
+                                                   sign_skey_3,
+                                                   "AAAAAAAAAAAAAAAAAAAA",
+                                                   sign_skey_leg1,
+                                                   flav, 3);
+      tt_assert(threaded);
+      tt_str_op(threaded, OP_EQ,
+                flav == FLAV_NS ? consensus_text : consensus_text_md);
+      tor_free(threaded);
+    }
+  }
+
   /* Check consensus contents. */
   tt_assert(con->type == NS_TYPE_CONSENSUS);
   tt_int_op(con->published,OP_EQ, 0); /* this field only appears in votes. */
@@ -6192,6 +6417,7 @@ struct testcase_t dir_tests[] = {
   DIR(parse_router_list, TT_FORK),
   DIR(load_routers, TT_FORK),
   DIR(load_extrainfo, TT_FORK),
+  DIR(add_descriptors_async, TT_FORK),
   DIR(getinfo_extra, 0),
   DIR_LEGACY(versions),
   DIR_LEGACY(fp_pairs),
@@ -4,9 +4,15 @@
 #define DNS_PRIVATE
 
 #include "dns.h"
+#include "config.h"
 #include "connection.h"
+#include "control.h"
 #include "router.h"
 
+#include <event2/dns.h>
+#include <event2/dns_struct.h>
+#include <event2/event.h>
+
 #define NS_MODULE dns
 
 #define NS_SUBMODULE clip_ttl
@@ -728,6 +734,387 @@ NS(test_main)(void *arg)
 
 #undef NS_SUBMODULE
 
+/* The tests below use a stub DNS server on a local UDP socket, and resolve
+ * through it with the real evdns code. It answers A queries for any name
+ * with 192.0.2.N, where N is the number of queries it has answered so far,
+ * except for names starting with "nx." (NXDOMAIN) and "fail." (SERVFAIL).
+ */
+
+static int n_stub_queries = 0;
+
+static void
+stub_dns_server_cb(struct evdns_server_request *req, void *data)
+{
+  int i, err = DNS_ERR_NONE;
+  (void)data;
+
+  for (i = 0; i < req->nquestions; ++i) {
+    const char *name = req->questions[i]->name;
+    ++n_stub_queries;
+    if (!strcmpstart(name, "nx.")) {
+      err = DNS_ERR_NOTEXIST;
+    } else if (!strcmpstart(name, "fail.")) {
+      err = DNS_ERR_SERVERFAILED;
+    } else if (req->questions[i]->type == EVDNS_TYPE_A) {
+      uint32_t a = htonl(0xc0000200 + n_stub_queries);
+      evdns_server_request_add_a_reply(req, name, 1, &a, 600);
+    }
+  }
+  evdns_server_request_respond(req, err);
+}
+
+static tor_socket_t stub_sock = TOR_INVALID_SOCKET;
+static struct evdns_server_port *stub_port = NULL;
+
+/** Start the stub DNS server, and make it our only nameserver. Return 0 on
+ * success, -1 on failure. */
+static int
+start_stub_dns_server(void)
+{
+  struct sockaddr_in sin;
+  socklen_t len = sizeof(sin);
+  char *conf = NULL;
+  or_options_t *options = get_options_mutable();
+
+  stub_sock = tor_open_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (!SOCKET_OK(stub_sock))
+    return -1;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(0x7f000001);
+  if (bind(stub_sock, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+      getsockname(stub_sock, (struct sockaddr *)&sin, &len) < 0)
+    return -1;
+  set_socket_nonblocking(stub_sock);
+  stub_port = tor_evdns_add_server_port(stub_sock, 0, stub_dns_server_cb,
+                                        NULL);
+  if (!stub_port)
+    return -1;
+
+  tor_asprintf(&conf, "nameserver 127.0.0.1:%d\n", (int)ntohs(sin.sin_port));
+  write_str_to_file(get_fname("stub_resolv.conf"), conf, 0);
+  tor_free(conf);
+  tor_free(options->ServerDNSResolvConfFile);
+  options->ServerDNSResolvConfFile = tor_strdup(get_fname("stub_resolv.conf"));
+  options->ServerDNSRandomizeCase = 0;
+  options->ServerDNSDetectHijacking = 0;
+  return 0;
+}
+
+static void
+stop_stub_dns_server(void)
+{
+  if (stub_port)
+    evdns_close_server_port(stub_port);
+  stub_port = NULL;
+  if (SOCKET_OK(stub_sock))
+    tor_close_socket(stub_sock);
+  stub_sock = TOR_INVALID_SOCKET;
+}
+
+/** Return the entry for <b>address</b> in the DNS cache, or NULL. */
+static cached_resolve_t *
+cache_entry_for(const char *address)
+{
+  cached_resolve_t query;
+  strlcpy(query.address, address, sizeof(query.address));
+  return dns_get_cache_entry(&query);
+}
+
+/** Run the event loop until the lookup of <b>address</b> is no longer
+ * pending. */
+static void
+wait_for_lookup(const char *address)
+{
+  int i;
+  for (i = 0; i < 50; ++i) {
+    const cached_resolve_t *r = cache_entry_for(address);
+    if (!r || r->state != CACHE_STATE_PENDING)
+      return;
+    event_base_loop(tor_libevent_get_base(), EVLOOP_ONCE);
+  }
+}
+
+/** Resolve <b>address</b> for a RESOLVE stream, waiting for the stub server
+ * if the answer isn't cached. Return what dns_resolve_impl() returned; on
+ * success, store the answer in <b>addr_out</b>. */
+static int
+resolve_through_cache(const char *address, tor_addr_t *addr_out)
+{
+  edge_connection_t *exitconn = create_valid_exitconn();
+  or_circuit_t *on_circ = tor_malloc_zero(sizeof(or_circuit_t));
+  cached_resolve_t *resolve = NULL;
+  char *hostname = NULL;
+  int made_pending = 0, r;
+
+  TO_CONN(exitconn)->address = tor_strdup(address);
+  r = dns_resolve_impl(exitconn, 1, on_circ, &hostname, &made_pending,
+                       &resolve);
+  if (r == 0) {
+    /* Nobody is going to read the answer: let inform_pending_connections()
+     * just drop the stream. */
+    TO_CONN(exitconn)->marked_for_close = 1;
+    wait_for_lookup(address);
+  } else if (r == 1) {
+    tor_addr_copy(addr_out, &TO_CONN(exitconn)->addr);
+  }
+
+  tor_free(hostname);
+  tor_free(TO_CONN(exitconn)->address);
+  tor_free(exitconn);
+  tor_free(on_circ);
+  return r;
+}
+
+static int
+mock_router_my_exit_policy_is_reject_star(void)
+{
+  return 0;
+}
+
+#define NS_SUBMODULE ASPECT(cache, stub_server)
+
+/* Given a working nameserver, we want answers to be cached and reused,
+ * NXDOMAIN to be cached too, server failures not to be cached, and all of it
+ * to show in the statistics. */
+static void
+NS(test_main)(void *arg)
+{
+  const dns_cache_stats_t *st = dns_get_cache_stats();
+  const cached_resolve_t *entry;
+  tor_addr_t addr, expected;
+  char *answer = NULL;
+  const char *errmsg = NULL;
+  uint64_t n_latencies = 0;
+  int i;
+
+  (void)arg;
+
+  MOCK(router_my_exit_policy_is_reject_star,
+       mock_router_my_exit_policy_is_reject_star);
+  dns_init();
+  tt_int_op(start_stub_dns_server(), OP_EQ, 0);
+
+  /* A miss, then a hit with the same answer. */
+  tt_int_op(resolve_through_cache("www.example.com", &addr), OP_EQ, 0);
+  entry = cache_entry_for("www.example.com");
+  tt_assert(entry);
+  tt_int_op(entry->state, OP_EQ, CACHE_STATE_CACHED);
+  tt_assert(!entry->is_negative);
+  tt_int_op(n_stub_queries, OP_EQ, 1);
+  tt_int_op(resolve_through_cache("www.example.com", &addr), OP_EQ, 1);
+  tor_addr_parse(&expected, "192.0.2.1");
+  tt_assert(tor_addr_eq(&addr, &expected));
+  tt_int_op(n_stub_queries, OP_EQ, 1);
+
+  /* NXDOMAIN is remembered. */
+  tt_int_op(resolve_through_cache("nx.example.com", &addr), OP_EQ, 0);
+  entry = cache_entry_for("nx.example.com");
+  tt_assert(entry);
+  tt_assert(entry->is_negative);
+  tt_int_op(resolve_through_cache("nx.example.com", &addr), OP_EQ, -1);
+  tt_int_op(n_stub_queries, OP_EQ, 2);
+
+  /* A server failure isn't. */
+  tt_int_op(resolve_through_cache("fail.example.com", &addr), OP_EQ, 0);
+  tt_ptr_op(cache_entry_for("fail.example.com"), OP_EQ, NULL);
+
+  tt_u64_op(st->n_misses, OP_EQ, 3);
+  tt_u64_op(st->n_hits, OP_EQ, 1);
+  tt_u64_op(st->n_negative_hits, OP_EQ, 1);
+  tt_u64_op(st->n_transient_failures, OP_EQ, 1);
+  for (i = 0; i < DNS_LATENCY_HISTOGRAM_LEN; ++i)
+    n_latencies += st->latency_msec_histogram[i];
+  tt_u64_op(n_latencies, OP_EQ, 3);
+  tt_int_op(dns_cache_get_total_bytes(), OP_EQ,
+            2 * sizeof(cached_resolve_t));
+
+  tt_int_op(getinfo_helper_dns(NULL, "dns/cache/stats", &answer, &errmsg),
+            OP_EQ, 0);
+  tt_assert(answer);
+  tt_assert(strstr(answer, "entries=2 "));
+  tt_assert(strstr(answer, "hits=1 negative-hits=1 pending-hits=0 "
+                           "misses=3\n"));
+  tor_free(answer);
+  tt_int_op(getinfo_helper_dns(NULL, "dns/cache/latency", &answer, &errmsg),
+            OP_EQ, 0);
+  tt_assert(answer);
+  tt_assert(!strcmpstart(answer, "10="));
+  tt_assert(strstr(answer, " inf="));
+
+ done:
+  tor_free(answer);
+  stop_stub_dns_server();
+  dns_free_all();
+  UNMOCK(router_my_exit_policy_is_reject_star);
+}
+
+#undef NS_SUBMODULE
+
+#define NS_SUBMODULE ASPECT(cache, prefetch)
+
+static int
+mock_launch_resolve_fails(cached_resolve_t *resolve)
+{
+  (void)resolve;
+  return -1;
+}
+
+static int
+mock_launch_resolve_succeeds(cached_resolve_t *resolve)
+{
+  (void)resolve;
+  return 0;
+}
+
+/* Given a popular cached answer close to its expiry, we want a refresh to be
+ * launched, and the fresh answer to replace the cached one. */
+static void
+NS(test_main)(void *arg)
+{
+  const dns_cache_stats_t *st = dns_get_cache_stats();
+  cached_resolve_t *entry, fake;
+  tor_addr_t addr, expected;
+  const time_t now = time(NULL);
+  int i;
+
+  (void)arg;
+
+  /* Check when we decide to refresh. */
+  get_options_mutable()->ServerDNSPrefetchMinHits = 3;
+  memset(&fake, 0, sizeof(fake));
+  fake.state = CACHE_STATE_CACHED;
+  fake.n_hits = 3;
+  fake.expire = now + DNS_PREFETCH_WINDOW;
+  tt_assert(dns_resolve_should_prefetch(&fake, now));
+  fake.expire = now + DNS_PREFETCH_WINDOW + 1;
+  tt_assert(!dns_resolve_should_prefetch(&fake, now));
+  fake.expire = now + 1;
+  fake.n_hits = 2;
+  tt_assert(!dns_resolve_should_prefetch(&fake, now));
+  fake.n_hits = 3;
+  fake.is_negative = 1;
+  tt_assert(!dns_resolve_should_prefetch(&fake, now));
+  fake.is_negative = 0;
+  fake.prefetch_tried = 1;
+  tt_assert(!dns_resolve_should_prefetch(&fake, now));
+  fake.prefetch_tried = 0;
+  get_options_mutable()->ServerDNSPrefetchMinHits = 0;
+  tt_assert(!dns_resolve_should_prefetch(&fake, now));
+  get_options_mutable()->ServerDNSPrefetchMinHits = 3;
+
+  MOCK(router_my_exit_policy_is_reject_star,
+       mock_router_my_exit_policy_is_reject_star);
+  dns_init();
+  tt_int_op(start_stub_dns_server(), OP_EQ, 0);
+
+  tt_int_op(resolve_through_cache("www.example.com", &addr), OP_EQ, 0);
+  for (i = 0; i < 3; ++i)
+    tt_int_op(resolve_through_cache("www.example.com", &addr), OP_EQ, 1);
+  entry = cache_entry_for("www.example.com");
+  tt_assert(entry);
+  tt_int_op(entry->n_hits, OP_EQ, 3);
+
+  /* Refresh it, as if it was about to expire. The old answer keeps being
+   * served while the refresh is in flight. */
+  dns_launch_prefetch(entry);
+  tt_assert(entry->prefetch);
+  tt_assert(entry->prefetch_tried);
+  tt_assert(!dns_resolve_should_prefetch(entry, entry->expire - 1));
+  tt_u64_op(st->n_prefetches_launched, OP_EQ, 1);
+  tt_int_op(resolve_through_cache("www.example.com", &addr), OP_EQ, 1);
+  tor_addr_parse(&expected, "192.0.2.1");
+  tt_assert(tor_addr_eq(&addr, &expected));
+
+  for (i = 0; i < 50 && !st->n_prefetches_completed; ++i)
+    event_base_loop(tor_libevent_get_base(), EVLOOP_ONCE);
+  tt_u64_op(st->n_prefetches_completed, OP_EQ, 1);
+  tt_int_op(n_stub_queries, OP_EQ, 2);
+
+  entry = cache_entry_for("www.example.com");
+  tt_assert(entry);
+  tt_int_op(entry->state, OP_EQ, CACHE_STATE_CACHED);
+  tt_int_op(entry->n_hits, OP_EQ, 0);
+  tt_ptr_op(entry->prefetch, OP_EQ, NULL);
+  tt_assert(!entry->prefetch_tried);
+  tt_int_op(resolve_through_cache("www.example.com", &addr), OP_EQ, 1);
+  tor_addr_parse(&expected, "192.0.2.2");
+  tt_assert(tor_addr_eq(&addr, &expected));
+  tt_int_op(dns_cache_get_total_bytes(), OP_EQ, sizeof(cached_resolve_t));
+
+  /* If we can't launch the refresh, we forget it, and don't try again for
+   * this answer. */
+  MOCK(launch_resolve, mock_launch_resolve_fails);
+  dns_launch_prefetch(entry);
+  tt_ptr_op(entry->prefetch, OP_EQ, NULL);
+  tt_assert(entry->prefetch_tried);
+  tt_u64_op(st->n_prefetches_launched, OP_EQ, 1);
+  UNMOCK(launch_resolve);
+
+  /* A refresh that is still in flight when its answer gets evicted goes
+   * away with it. */
+  entry->prefetch_tried = 0;
+  MOCK(launch_resolve, mock_launch_resolve_succeeds);
+  dns_launch_prefetch(entry);
+  UNMOCK(launch_resolve);
+  tt_assert(entry->prefetch);
+  tt_u64_op(st->n_prefetches_launched, OP_EQ, 2);
+  get_options_mutable()->ServerDNSCacheMaxMemory = sizeof(cached_resolve_t);
+  tt_int_op(resolve_through_cache("www.example.org", &addr), OP_EQ, 0);
+  tt_ptr_op(cache_entry_for("www.example.com"), OP_EQ, NULL);
+  tt_assert(cache_entry_for("www.example.org"));
+  tt_u64_op(st->n_prefetches_completed, OP_EQ, 1);
+
+ done:
+  UNMOCK(launch_resolve);
+  stop_stub_dns_server();
+  dns_free_all();
+  UNMOCK(router_my_exit_policy_is_reject_star);
+}
+
+#undef NS_SUBMODULE
+
+#define NS_SUBMODULE ASPECT(cache, lru_eviction)
+
+/* Given a cache that is full, we want the least recently used answer to be
+ * dropped when a new one comes in. */
+static void
+NS(test_main)(void *arg)
+{
+  const dns_cache_stats_t *st = dns_get_cache_stats();
+  tor_addr_t addr;
+
+  (void)arg;
+
+  MOCK(router_my_exit_policy_is_reject_star,
+       mock_router_my_exit_policy_is_reject_star);
+  get_options_mutable()->ServerDNSCacheMaxMemory =
+    2 * sizeof(cached_resolve_t);
+  dns_init();
+  tt_int_op(start_stub_dns_server(), OP_EQ, 0);
+
+  tt_int_op(resolve_through_cache("a.example.com", &addr), OP_EQ, 0);
+  tt_int_op(resolve_through_cache("b.example.com", &addr), OP_EQ, 0);
+  /* Use a.example.com, so b.example.com is the least recently used. */
+  tt_int_op(resolve_through_cache("a.example.com", &addr), OP_EQ, 1);
+  tt_u64_op(st->n_evictions, OP_EQ, 0);
+
+  tt_int_op(resolve_through_cache("c.example.com", &addr), OP_EQ, 0);
+  tt_u64_op(st->n_evictions, OP_EQ, 1);
+  tt_assert(cache_entry_for("a.example.com"));
+  tt_ptr_op(cache_entry_for("b.example.com"), OP_EQ, NULL);
+  tt_assert(cache_entry_for("c.example.com"));
+  tt_int_op(dns_cache_get_total_bytes(), OP_LE,
+            get_options()->ServerDNSCacheMaxMemory);
+
+ done:
+  stop_stub_dns_server();
+  dns_free_all();
+  UNMOCK(router_my_exit_policy_is_reject_star);
+}
+
+#undef NS_SUBMODULE
+
 struct testcase_t dns_tests[] = {
    TEST_CASE(clip_ttl),
    TEST_CASE(resolve),
@@ -738,6 +1125,9 @@ struct testcase_t dns_tests[] = {
    TEST_CASE_ASPECT(resolve_impl, cache_hit_pending),
    TEST_CASE_ASPECT(resolve_impl, cache_hit_cached),
    TEST_CASE_ASPECT(resolve_impl, cache_miss),
+   TEST_CASE_ASPECT(cache, stub_server),
+   TEST_CASE_ASPECT(cache, prefetch),
+   TEST_CASE_ASPECT(cache, lru_eviction),
    END_OF_TESTCASES
 };
 
@@ -8,6 +8,7 @@
 #include "or.h"
 #include "dos.h"
 #include "circuitlist.h"
+#include "config.h"
 #include "geoip.h"
 #include "channel.h"
 #include "microdesc.h"
@@ -486,12 +487,233 @@ test_known_relay(void *arg)
   UNMOCK(get_param_cc_enabled);
 }
 
+/** Address returned by mock_channel_get_rotating_addr(). */
+static tor_addr_t mock_rotating_addr;
+
+/** Helper mock: Place mock_rotating_addr in <b>addr_out</b>. */
+static int
+mock_channel_get_rotating_addr(channel_t *chan, tor_addr_t *addr_out)
+{
+  (void)chan;
+  tor_addr_copy(addr_out, &mock_rotating_addr);
+  return 1;
+}
+
+/** Set <b>addr</b> to the address number <b>n</b> of 2001:db8::/64. */
+static void
+set_rotating_addr(tor_addr_t *addr, uint32_t n)
+{
+  uint8_t a[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+  set_uint32(a + 12, htonl(n + 1));
+  tor_addr_from_ipv6_bytes(addr, (const char *) a);
+}
+
+/** Test that prefix keys keep exactly the configured number of bits. */
+static void
+test_dos_prefix_key(void *arg)
+{
+  tor_addr_t a, b;
+  uint8_t ka[DOS_PFX_KEY_LEN], kb[DOS_PFX_KEY_LEN];
+  (void) arg;
+
+  dos_init();
+
+  /* Same /24, but not the same /16 as another family. */
+  tor_addr_parse(&a, "18.0.0.1");
+  tor_addr_parse(&b, "18.0.0.254");
+  tt_int_op(pfx_key_from_addr(&a, ka), OP_EQ, 0);
+  tt_int_op(pfx_key_from_addr(&b, kb), OP_EQ, 0);
+  tt_mem_op(ka, OP_EQ, kb, DOS_PFX_KEY_LEN);
+  tor_addr_parse(&b, "18.0.1.1");
+  tt_int_op(pfx_key_from_addr(&b, kb), OP_EQ, 0);
+  tt_mem_op(ka, OP_NE, kb, DOS_PFX_KEY_LEN);
+
+  /* Same /64, different /64. */
+  tor_addr_parse(&a, "2001:db8::1");
+  tor_addr_parse(&b, "2001:db8::ffff:ffff:ffff:ffff");
+  tt_int_op(pfx_key_from_addr(&a, ka), OP_EQ, 0);
+  tt_int_op(pfx_key_from_addr(&b, kb), OP_EQ, 0);
+  tt_mem_op(ka, OP_EQ, kb, DOS_PFX_KEY_LEN);
+  tor_addr_parse(&b, "2001:db8:0:1::1");
+  tt_int_op(pfx_key_from_addr(&b, kb), OP_EQ, 0);
+  tt_mem_op(ka, OP_NE, kb, DOS_PFX_KEY_LEN);
+
+  /* An odd prefix length. */
+  get_options_mutable()->DoSPrefixIPv6Bits = 61;
+  dos_init();
+  tor_addr_parse(&b, "2001:db8:0:7::1");
+  tt_int_op(pfx_key_from_addr(&a, ka), OP_EQ, 0);
+  tt_int_op(pfx_key_from_addr(&b, kb), OP_EQ, 0);
+  tt_mem_op(ka, OP_EQ, kb, DOS_PFX_KEY_LEN);
+  tor_addr_parse(&b, "2001:db8:0:8::1");
+  tt_int_op(pfx_key_from_addr(&b, kb), OP_EQ, 0);
+  tt_mem_op(ka, OP_NE, kb, DOS_PFX_KEY_LEN);
+
+ done:
+  dos_free_all();
+}
+
+/** Test that a client rotating through the addresses of an IPv6 /64 gets
+ *  caught by prefix aggregation, while every single address stays below the
+ *  per address limits. */
+static void
+test_dos_prefix_rotation(void *arg)
+{
+  (void) arg;
+  uint32_t i, max_prefix_conns, prefix_burst;
+  channel_t *chan = NULL;
+  or_connection_t *conns = NULL;
+  tor_addr_t other;
+  time_t now = 1281533250; /* 2010-08-11 13:27:30 UTC */
+
+  MOCK(get_param_cc_enabled, mock_enable_dos_protection);
+  MOCK(get_param_conn_enabled, mock_enable_dos_protection);
+  MOCK(get_param_pfx_enabled, mock_enable_dos_protection);
+  MOCK(channel_get_addr_if_possible, mock_channel_get_rotating_addr);
+  update_approx_time(now);
+
+  /* Keep the numbers small so the test stays fast. */
+  get_options_mutable()->DoSPrefixMaxConcurrentCount = 50;
+  get_options_mutable()->DoSPrefixCircuitBurst = 40;
+  dos_init();
+  max_prefix_conns = get_param_pfx_max_concurrent_count(NULL);
+  prefix_burst = get_param_pfx_circuit_burst(NULL);
+  tt_int_op(max_prefix_conns, OP_EQ, 50);
+  tt_int_op(prefix_burst, OP_EQ, 40);
+
+  chan = tor_malloc_zero(sizeof(channel_t));
+  channel_init(chan);
+  chan->is_client = 1;
+
+  /* One connection from each of many addresses of the prefix. */
+  conns = tor_calloc(max_prefix_conns + 1, sizeof(or_connection_t));
+  for (i = 0; i < max_prefix_conns; i++) {
+    set_rotating_addr(&conns[i].real_addr, i);
+    geoip_note_client_seen(GEOIP_CLIENT_CONNECT, &conns[i].real_addr, NULL,
+                           now);
+    dos_new_client_conn(&conns[i]);
+    tt_int_op(DOS_CONN_DEFENSE_NONE, OP_EQ,
+              dos_conn_addr_get_defense_type(&conns[i].real_addr));
+  }
+
+  /* One more, and the whole prefix is over the limit, even for an address
+   * we've never seen. Another prefix isn't. */
+  set_rotating_addr(&conns[i].real_addr, i);
+  geoip_note_client_seen(GEOIP_CLIENT_CONNECT, &conns[i].real_addr, NULL,
+                         now);
+  dos_new_client_conn(&conns[i]);
+  set_rotating_addr(&other, 12345);
+  geoip_note_client_seen(GEOIP_CLIENT_CONNECT, &other, NULL, now);
+  tt_int_op(DOS_CONN_DEFENSE_CLOSE, OP_EQ,
+            dos_conn_addr_get_defense_type(&other));
+  tor_addr_parse(&other, "2001:db8:0:1::1");
+  geoip_note_client_seen(GEOIP_CLIENT_CONNECT, &other, NULL, now);
+  tt_int_op(DOS_CONN_DEFENSE_NONE, OP_EQ,
+            dos_conn_addr_get_defense_type(&other));
+
+  /* Closing a connection brings the prefix back under the limit. */
+  dos_close_client_conn(&conns[i]);
+  tt_int_op(DOS_CONN_DEFENSE_NONE, OP_EQ,
+            dos_conn_addr_get_defense_type(&conns[0].real_addr));
+
+  /* Now create circuits, each from a different address of the prefix. None
+   * of them has enough connections to be tracked by itself. */
+  for (i = 0; i < prefix_burst - 1; i++) {
+    tor_addr_copy(&mock_rotating_addr, &conns[i].real_addr);
+    dos_cc_new_create_cell(chan);
+  }
+  tt_int_op(DOS_CC_DEFENSE_NONE, OP_EQ, dos_cc_get_defense_type(chan));
+  tor_addr_copy(&mock_rotating_addr, &conns[i].real_addr);
+  dos_cc_new_create_cell(chan);
+  tt_int_op(DOS_CC_DEFENSE_REFUSE_CELL, OP_EQ, dos_cc_get_defense_type(chan));
+
+  /* Every address of the prefix is refused, others aren't. */
+  set_rotating_addr(&mock_rotating_addr, 999);
+  tt_int_op(DOS_CC_DEFENSE_REFUSE_CELL, OP_EQ, dos_cc_get_defense_type(chan));
+  tor_addr_copy(&mock_rotating_addr, &other);
+  tt_int_op(DOS_CC_DEFENSE_NONE, OP_EQ, dos_cc_get_defense_type(chan));
+
+ done:
+  tor_free(conns);
+  tor_free(chan);
+  dos_free_all();
+  UNMOCK(get_param_cc_enabled);
+  UNMOCK(get_param_conn_enabled);
+  UNMOCK(get_param_pfx_enabled);
+  UNMOCK(channel_get_addr_if_possible);
+}
+
+/** Test that a connection leaves the same prefix bucket that it was counted
+ *  in, even if the prefix lengths or the sketches change while it's open. */
+static void
+test_dos_prefix_param_change(void *arg)
+{
+  (void) arg;
+  or_connection_t *conns = NULL;
+  tor_addr_t probe;
+  int i;
+  time_t now = 1281533250; /* 2010-08-11 13:27:30 UTC */
+
+  MOCK(get_param_conn_enabled, mock_enable_dos_protection);
+  MOCK(get_param_pfx_enabled, mock_enable_dos_protection);
+  update_approx_time(now);
+
+  get_options_mutable()->DoSPrefixMaxConcurrentCount = 1;
+  dos_init();
+
+  conns = tor_calloc(3, sizeof(or_connection_t));
+  for (i = 0; i < 3; i++) {
+    set_rotating_addr(&conns[i].real_addr, i);
+    geoip_note_client_seen(GEOIP_CLIENT_CONNECT, &conns[i].real_addr, NULL,
+                           now);
+  }
+  set_rotating_addr(&probe, 100);
+  geoip_note_client_seen(GEOIP_CLIENT_CONNECT, &probe, NULL, now);
+
+  dos_new_client_conn(&conns[0]);
+  dos_new_client_conn(&conns[1]);
+  tt_int_op(DOS_CONN_DEFENSE_CLOSE, OP_EQ,
+            dos_conn_addr_get_defense_type(&probe));
+
+  /* Close them while we aggregate with another length: they must still
+   * leave the /64 bucket. */
+  get_options_mutable()->DoSPrefixIPv6Bits = 48;
+  dos_init();
+  dos_close_client_conn(&conns[0]);
+  dos_close_client_conn(&conns[1]);
+  get_options_mutable()->DoSPrefixIPv6Bits = 64;
+  dos_init();
+  tt_int_op(DOS_CONN_DEFENSE_NONE, OP_EQ,
+            dos_conn_addr_get_defense_type(&probe));
+
+  /* A connection counted before the sketches were reset doesn't take
+   * anything out of the new ones. */
+  dos_new_client_conn(&conns[0]);
+  dos_free_all();
+  dos_init();
+  dos_new_client_conn(&conns[1]);
+  dos_new_client_conn(&conns[2]);
+  dos_close_client_conn(&conns[0]);
+  tt_int_op(DOS_CONN_DEFENSE_CLOSE, OP_EQ,
+            dos_conn_addr_get_defense_type(&probe));
+
+ done:
+  tor_free(conns);
+  dos_free_all();
+  UNMOCK(get_param_conn_enabled);
+  UNMOCK(get_param_pfx_enabled);
+}
+
 struct testcase_t dos_tests[] = {
   { "conn_creation", test_dos_conn_creation, TT_FORK, NULL, NULL },
   { "circuit_creation", test_dos_circuit_creation, TT_FORK, NULL, NULL },
   { "bucket_refill", test_dos_bucket_refill, TT_FORK, NULL, NULL },
   { "known_relay" , test_known_relay, TT_FORK,
     NULL, NULL },
+  { "prefix_key", test_dos_prefix_key, TT_FORK, NULL, NULL },
+  { "prefix_rotation", test_dos_prefix_rotation, TT_FORK, NULL, NULL },
+  { "prefix_param_change", test_dos_prefix_param_change, TT_FORK,
+    NULL, NULL },
   END_OF_TESTCASES
 };
 
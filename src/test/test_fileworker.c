@@ -0,0 +1,144 @@
+/* Copyright (c) 2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#include "orconfig.h"
+#include "or.h"
+#include "compat_libevent.h"
+#include "fileworker.h"
+
+#include "test.h"
+#include "log_test_helpers.h"
+
+#include <event2/event.h>
+
+/** Number of times fileworker_test_cb() has been called. */
+static int n_done = 0;
+/** Number of those calls that reported a failure. */
+static int n_failed = 0;
+
+static void
+fileworker_test_cb(const char *fname, int status, void *arg)
+{
+  (void) fname;
+  tt_ptr_op(arg, OP_EQ, &n_done);
+  ++n_done;
+  if (status < 0)
+    ++n_failed;
+ done:
+  ;
+}
+
+static void
+test_fileworker_sync(void *arg)
+{
+  char *fname = tor_strdup(get_fname("fileworker-sync"));
+  char *bad_fname = tor_strdup(get_fname("no-such-dir/fileworker-sync"));
+  char *content = NULL;
+  (void) arg;
+
+  n_done = n_failed = 0;
+  tt_assert(! fileworker_is_running());
+
+  /* Without the I/O thread, everything happens before we return. */
+  fileworker_replace(fname, "abc\n", 4, 0, fileworker_test_cb, &n_done);
+  tt_int_op(n_done, OP_EQ, 1);
+  content = read_file_to_str(fname, 0, NULL);
+  tt_str_op(content, OP_EQ, "abc\n");
+  tor_free(content);
+
+  fileworker_append(fname, "def\n", 4, 0, fileworker_test_cb, &n_done);
+  fileworker_append(fname, "ghi\n", 4, 0, NULL, NULL);
+  tt_int_op(n_done, OP_EQ, 2);
+  content = read_file_to_str(fname, 0, NULL);
+  tt_str_op(content, OP_EQ, "abc\ndef\nghi\n");
+  tor_free(content);
+
+  /* Replacing with nothing leaves an empty file. */
+  fileworker_replace(fname, "", 0, 1, NULL, NULL);
+  content = read_file_to_str(fname, RFTS_BIN, NULL);
+  tt_str_op(content, OP_EQ, "");
+  tor_free(content);
+
+  setup_full_capture_of_logs(LOG_WARN);
+  fileworker_replace(bad_fname, "x", 1, 0, fileworker_test_cb, &n_done);
+  teardown_capture_of_logs();
+  tt_int_op(n_done, OP_EQ, 3);
+  tt_int_op(n_failed, OP_EQ, 1);
+
+  tt_int_op(fileworker_n_pending(), OP_EQ, 0);
+
+ done:
+  teardown_capture_of_logs();
+  fileworker_free_all();
+  tor_free(content);
+  tor_free(fname);
+  tor_free(bad_fname);
+}
+
+static void
+test_fileworker_thread(void *arg)
+{
+  char *fname = tor_strdup(get_fname("fileworker-thread"));
+  char *fname2 = tor_strdup(get_fname("fileworker-thread2"));
+  char *content = NULL;
+  (void) arg;
+
+  n_done = n_failed = 0;
+  fileworker_init();
+  tt_assert(fileworker_is_running());
+
+  /* Completion is reported through the main loop. */
+  fileworker_replace(fname, "one\n", 4, 0, fileworker_test_cb, &n_done);
+  tt_int_op(fileworker_n_pending(), OP_EQ, 1);
+  while (n_done == 0)
+    event_base_loop(tor_libevent_get_base(), EVLOOP_ONCE);
+  tt_int_op(n_failed, OP_EQ, 0);
+  tt_int_op(fileworker_n_pending(), OP_EQ, 0);
+  content = read_file_to_str(fname, 0, NULL);
+  tt_str_op(content, OP_EQ, "one\n");
+  tor_free(content);
+
+  /* Requests for the same file are coalesced but keep their order; a
+   * replacement drops whatever was still waiting before it. */
+  n_done = 0;
+  fileworker_append(fname, "two\n", 4, 0, fileworker_test_cb, &n_done);
+  fileworker_append(fname, "three\n", 6, 0, fileworker_test_cb, &n_done);
+  fileworker_append(fname2, "other\n", 6, 0, fileworker_test_cb, &n_done);
+  fileworker_replace(fname, "four\n", 5, 0, fileworker_test_cb, &n_done);
+  fileworker_append(fname, "five\n", 5, 0, fileworker_test_cb, &n_done);
+  fileworker_append(fname, "six\n", 4, 0, fileworker_test_cb, &n_done);
+  tt_int_op(fileworker_flush(fname), OP_EQ, 0);
+  content = read_file_to_str(fname, 0, NULL);
+  tt_str_op(content, OP_EQ, "four\nfive\nsix\n");
+  tor_free(content);
+
+  fileworker_flush_all();
+  tt_int_op(n_done, OP_EQ, 6);
+  tt_int_op(n_failed, OP_EQ, 0);
+  tt_int_op(fileworker_n_pending(), OP_EQ, 0);
+  content = read_file_to_str(fname2, 0, NULL);
+  tt_str_op(content, OP_EQ, "other\n");
+  tor_free(content);
+
+  /* Replies for the writes that we flushed don't run the callbacks
+   * again. */
+  fileworker_append(fname2, "more\n", 5, 0, fileworker_test_cb, &n_done);
+  while (n_done == 6)
+    event_base_loop(tor_libevent_get_base(), EVLOOP_ONCE);
+  tt_int_op(n_done, OP_EQ, 7);
+  content = read_file_to_str(fname2, 0, NULL);
+  tt_str_op(content, OP_EQ, "other\nmore\n");
+
+ done:
+  fileworker_free_all();
+  tor_free(content);
+  tor_free(fname);
+  tor_free(fname2);
+}
+
+struct testcase_t fileworker_tests[] = {
+  { "sync", test_fileworker_sync, TT_FORK, NULL, NULL },
+  { "thread", test_fileworker_thread, TT_FORK, NULL, NULL },
+  END_OF_TESTCASES
+};
+
@@ -9,6 +9,7 @@
 #define CONNECTION_PRIVATE
 #define DIRECTORY_PRIVATE
 #define HS_CACHE_PRIVATE
+#define RENDCACHE_PRIVATE
 
 #include "ed25519_cert.h"
 #include "hs_cache.h"
@@ -214,6 +215,62 @@ test_clean_as_dir(void *arg)
   tor_free(desc1_str);
 }
 
+/* Test that the OOM handler evicts the oldest directory descriptors first,
+ * across the v2 and v3 caches, and stops once it has removed enough. */
+static void
+test_oom_oldest_first(void *arg)
+{
+  size_t ret, oom_size;
+  char *desc1_str = NULL;
+  time_t now = time(NULL);
+  hs_descriptor_t *desc1 = NULL;
+  ed25519_keypair_t signing_kp1;
+  rend_cache_entry_t *e;
+  const char v2_key[DIGEST_LEN] = "abcde";
+
+  (void) arg;
+
+  init_test();
+
+  /* A v3 descriptor created now. */
+  ret = ed25519_keypair_generate(&signing_kp1, 0);
+  tt_int_op(ret, OP_EQ, 0);
+  desc1 = hs_helper_build_hs_desc_with_ip(&signing_kp1);
+  tt_assert(desc1);
+  ret = hs_desc_encode_descriptor(desc1, &signing_kp1, &desc1_str);
+  tt_int_op(ret, OP_EQ, 0);
+  ret = hs_cache_store_as_dir(desc1_str);
+  tt_int_op(ret, OP_EQ, 0);
+
+  /* A v2 descriptor published an hour ago. */
+  e = tor_malloc_zero(sizeof(rend_cache_entry_t));
+  e->parsed = tor_malloc_zero(sizeof(rend_service_descriptor_t));
+  e->parsed->timestamp = now - 3600;
+  e->parsed->pk = pk_generate(0);
+  rend_cache_v2_dir_add(v2_key, e);
+
+  /* Asking for a single byte only removes the older v2 entry. */
+  oom_size = hs_cache_handle_oom(now, 1);
+  tt_u64_op(oom_size, OP_GT, 0);
+  tt_ptr_op(digestmap_get(rend_cache_v2_dir, v2_key), OP_EQ, NULL);
+  ret = hs_cache_lookup_as_dir(3, helper_get_hsdir_query(desc1), NULL);
+  tt_int_op(ret, OP_EQ, 1);
+
+  /* Next in line is the v3 one. */
+  oom_size = hs_cache_handle_oom(now, 1);
+  tt_u64_op(oom_size, OP_GT, 0);
+  ret = hs_cache_lookup_as_dir(3, helper_get_hsdir_query(desc1), NULL);
+  tt_int_op(ret, OP_EQ, 0);
+
+  /* Both caches are empty now. */
+  oom_size = hs_cache_handle_oom(now, 1);
+  tt_u64_op(oom_size, OP_EQ, 0);
+
+ done:
+  hs_descriptor_free(desc1);
+  tor_free(desc1_str);
+}
+
 /* Test helper: Fetch an HS descriptor from an HSDir (for the hidden service
    with <b>blinded_key</b>. Return the received descriptor string. */
 static char *
@@ -549,6 +606,8 @@ struct testcase_t hs_cache[] = {
     NULL, NULL },
   { "clean_as_dir", test_clean_as_dir, TT_FORK,
     NULL, NULL },
+  { "oom_oldest_first", test_oom_oldest_first, TT_FORK,
+    NULL, NULL },
   { "hsdir_revision_counter_check", test_hsdir_revision_counter_check, TT_FORK,
     NULL, NULL },
   { "upload_and_download_hs_desc", test_upload_and_download_hs_desc, TT_FORK,
@@ -32,12 +32,14 @@
 #include "circuitbuild.h"
 #include "circuitlist.h"
 #include "circuituse.h"
+#include "cpuworker.h"
 #include "crypto.h"
 #include "dirvote.h"
 #include "networkstatus.h"
 #include "nodelist.h"
 #include "relay.h"
 
+#include "hs_cell.h"
 #include "hs_common.h"
 #include "hs_config.h"
 #include "hs_ident.h"
@@ -50,6 +52,7 @@
 #include "rendservice.h"
 #include "statefile.h"
 #include "shared_random_state.h"
+#include "workqueue.h"
 
 /* Trunnel */
 #include "hs/cell_establish_intro.h"
@@ -195,8 +198,7 @@ helper_create_origin_circuit(int purpose, int flags)
 
   circ = origin_circuit_init(purpose, flags);
   tt_assert(circ);
-  circ->cpath = tor_malloc_zero(sizeof(crypt_path_t));
-  circ->cpath->magic = CRYPT_PATH_MAGIC;
+  circ->cpath = crypt_path_new();
   circ->cpath->state = CPATH_STATE_OPEN;
   circ->cpath->package_window = circuit_initial_package_window();
   circ->cpath->deliver_window = CIRCWINDOW_START;
@@ -942,6 +944,165 @@ test_introduce2(void *arg)
   hs_free_all();
   UNMOCK(circuit_mark_for_close_);
 }
+/* Captured by mock_cpuworker_queue_work() so the test can run the job. */
+static workqueue_reply_t (*queued_work_fn)(void *, void *) = NULL;
+static void (*queued_reply_fn)(void *) = NULL;
+static void *queued_work_arg = NULL;
+static int n_queued_work = 0;
+
+static int
+mock_cpuworker_is_running(void)
+{
+  return 1;
+}
+
+static workqueue_entry_t *
+mock_cpuworker_queue_work(workqueue_priority_t priority,
+                          workqueue_reply_t (*fn)(void *, void *),
+                          void (*reply_fn)(void *),
+                          void *arg)
+{
+  (void) priority;
+  queued_work_fn = fn;
+  queued_reply_fn = reply_fn;
+  queued_work_arg = arg;
+  n_queued_work++;
+  return (workqueue_entry_t *) arg;
+}
+
+/* Helper: Build a valid INTRODUCE2 cell for the given service and intro
+ * point in payload and return its length. */
+static ssize_t
+helper_build_introduce2(const hs_service_t *service,
+                        const hs_service_intro_point_t *ip,
+                        uint8_t *payload)
+{
+  ssize_t len;
+  hs_cell_introduce1_data_t data;
+  curve25519_keypair_t client_kp, onion_kp;
+  uint8_t rendezvous_cookie[REND_COOKIE_LEN];
+
+  curve25519_keypair_generate(&client_kp, 0);
+  curve25519_keypair_generate(&onion_kp, 0);
+  crypto_rand((char *) rendezvous_cookie, sizeof(rendezvous_cookie));
+
+  memset(&data, 0, sizeof(data));
+  data.auth_pk = &ip->auth_key_kp.pubkey;
+  data.enc_pk = &ip->enc_key_kp.pubkey;
+  data.subcredential = service->desc_current->desc->subcredential;
+  data.onion_pk = &onion_kp.pubkey;
+  data.rendezvous_cookie = rendezvous_cookie;
+  data.client_kp = &client_kp;
+  data.link_specifiers = smartlist_new();
+  /* Not enough to extend to a rendezvous point, which is fine here. The
+   * cell takes ownership of it. */
+  {
+    link_specifier_t *ls = link_specifier_new();
+    link_specifier_set_ls_type(ls, LS_IPV4);
+    link_specifier_set_un_ipv4_addr(ls, 0x7f000001);
+    link_specifier_set_un_ipv4_port(ls, 9001);
+    smartlist_add(data.link_specifiers, ls);
+  }
+  len = hs_cell_build_introduce1(&data, payload);
+  smartlist_free(data.link_specifiers);
+  return len;
+}
+
+/** Test that INTRODUCE2 cells are decrypted on the cpuworkers. */
+static void
+test_introduce2_cpuworker(void *arg)
+{
+  int ret;
+  int flags = CIRCLAUNCH_NEED_UPTIME | CIRCLAUNCH_IS_INTERNAL;
+  uint8_t payload[RELAY_PAYLOAD_SIZE];
+  ssize_t payload_len;
+  origin_circuit_t *circ = NULL;
+  hs_service_t *service;
+  hs_service_intro_point_t *ip = NULL;
+
+  (void) arg;
+
+  hs_init();
+  MOCK(circuit_mark_for_close_, mock_circuit_mark_for_close);
+  MOCK(get_or_state, get_or_state_replacement);
+  MOCK(cpuworker_is_running, mock_cpuworker_is_running);
+  MOCK(cpuworker_queue_work, mock_cpuworker_queue_work);
+
+  dummy_state = tor_malloc_zero(sizeof(or_state_t));
+
+  circ = helper_create_origin_circuit(CIRCUIT_PURPOSE_S_INTRO, flags);
+  tt_assert(circ);
+  service = helper_create_service();
+  ed25519_pubkey_copy(&circ->hs_ident->identity_pk,
+                      &service->keys.identity_pk);
+  ip = helper_create_service_ip();
+  service_intro_point_add(service->desc_current->intro_points.map, ip);
+  ed25519_pubkey_copy(&circ->hs_ident->intro_auth_pk,
+                      &ip->auth_key_kp.pubkey);
+
+  /* A valid cell is queued without being decrypted. */
+  payload_len = helper_build_introduce2(service, ip, payload);
+  tt_int_op(payload_len, OP_GT, 0);
+  ret = hs_service_receive_introduce2(circ, payload, payload_len);
+  tt_int_op(ret, OP_EQ, 0);
+  tt_int_op(n_queued_work, OP_EQ, 1);
+  tt_uint_op(service->state.n_pending_introduce2, OP_EQ, 1);
+  tt_u64_op(ip->introduce2_count, OP_EQ, 0);
+
+  /* The same cell is caught by the replay cache before being queued. */
+  ret = hs_service_receive_introduce2(circ, payload, payload_len);
+  tt_int_op(ret, OP_EQ, -1);
+  tt_int_op(n_queued_work, OP_EQ, 1);
+
+  /* Run the job as a cpuworker would, then its reply. */
+  tt_int_op(queued_work_fn(NULL, queued_work_arg), OP_EQ, WQ_RPL_REPLY);
+  queued_reply_fn(queued_work_arg);
+  tt_uint_op(service->state.n_pending_introduce2, OP_EQ, 0);
+  tt_u64_op(ip->introduce2_count, OP_EQ, 1);
+
+  /* A garbled cell is queued, fails on the cpuworker and isn't counted. */
+  payload_len = helper_build_introduce2(service, ip, payload);
+  payload[payload_len - 1] ^= 0xff;
+  ret = hs_service_receive_introduce2(circ, payload, payload_len);
+  tt_int_op(ret, OP_EQ, 0);
+  tt_int_op(n_queued_work, OP_EQ, 2);
+  tt_int_op(queued_work_fn(NULL, queued_work_arg), OP_EQ, WQ_RPL_REPLY);
+  queued_reply_fn(queued_work_arg);
+  tt_uint_op(service->state.n_pending_introduce2, OP_EQ, 0);
+  tt_u64_op(ip->introduce2_count, OP_EQ, 1);
+
+  /* With a full queue, new cells are dropped right away. */
+  service->state.n_pending_introduce2 = HS_SERVICE_MAX_PENDING_INTRODUCE2;
+  payload_len = helper_build_introduce2(service, ip, payload);
+  ret = hs_service_receive_introduce2(circ, payload, payload_len);
+  tt_int_op(ret, OP_EQ, -1);
+  tt_int_op(n_queued_work, OP_EQ, 2);
+  /* It didn't make it to the replay cache either. */
+  service->state.n_pending_introduce2 = 0;
+  ret = hs_service_receive_introduce2(circ, payload, payload_len);
+  tt_int_op(ret, OP_EQ, 0);
+  tt_int_op(n_queued_work, OP_EQ, 3);
+
+  /* If the intro point goes away meanwhile, the cell is dropped. */
+  service_intro_point_remove(service, ip);
+  service_intro_point_free(ip);
+  ip = NULL;
+  tt_int_op(queued_work_fn(NULL, queued_work_arg), OP_EQ, WQ_RPL_REPLY);
+  queued_reply_fn(queued_work_arg);
+  tt_uint_op(service->state.n_pending_introduce2, OP_EQ, 0);
+
+ done:
+  or_state_free(dummy_state);
+  dummy_state = NULL;
+  if (circ)
+    circuit_free(TO_CIRCUIT(circ));
+  hs_free_all();
+  UNMOCK(circuit_mark_for_close_);
+  UNMOCK(get_or_state);
+  UNMOCK(cpuworker_is_running);
+  UNMOCK(cpuworker_queue_work);
+}
+
 
 /** Test basic hidden service housekeeping operations (maintaining intro
  *  points, etc) */
@@ -1604,6 +1765,8 @@ struct testcase_t hs_service_tests[] = {
     NULL, NULL },
   { "introduce2", test_introduce2, TT_FORK,
     NULL, NULL },
+  { "introduce2_cpuworker", test_introduce2_cpuworker, TT_FORK,
+    NULL, NULL },
   { "service_event", test_service_event, TT_FORK,
     NULL, NULL },
   { "rotate_descriptors", test_rotate_descriptors, TT_FORK,
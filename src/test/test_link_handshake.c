@@ -15,11 +15,14 @@
 #include "connection.h"
 #include "connection_or.h"
 #include "channeltls.h"
+#include "cpuworker.h"
 #include "link_handshake.h"
+#include "main.h"
 #include "router.h"
 #include "routerkeys.h"
 #include "scheduler.h"
 #include "torcert.h"
+#include "workqueue.h"
 
 #include "test.h"
 #include "log_test_helpers.h"
@@ -112,7 +115,7 @@ test_link_handshake_certs_ok(void *arg)
 {
   or_connection_t *c1 = or_connection_new(CONN_TYPE_OR, AF_INET);
   or_connection_t *c2 = or_connection_new(CONN_TYPE_OR, AF_INET);
-  var_cell_t *cell1 = NULL, *cell2 = NULL;
+  var_cell_t *cell1 = NULL, *cell2 = NULL, *cell3 = NULL;
   certs_cell_t *cc1 = NULL, *cc2 = NULL;
   channel_tls_t *chan1 = NULL, *chan2 = NULL;
   crypto_pk_t *key1 = NULL, *key2 = NULL;
@@ -160,6 +163,7 @@ test_link_handshake_certs_ok(void *arg)
   /* c2 has started_here == 0 */
   c2->base_.state = OR_CONN_STATE_OR_HANDSHAKING_V3;
   c2->link_proto = 3;
+  c2->tls = tor_tls_new(-1, 1);
   tt_int_op(connection_init_or_handshake_state(c2, 0), OP_EQ, 0);
 
   tt_int_op(0, OP_EQ, connection_or_send_certs_cell(c1));
@@ -170,6 +174,14 @@ test_link_handshake_certs_ok(void *arg)
   tt_assert(mock_got_var_cell);
   cell2 = mock_got_var_cell;
 
+  /* Sending again with the same keys gives the same cell. */
+  tt_int_op(0, OP_EQ, connection_or_send_certs_cell(c2));
+  cell3 = mock_got_var_cell;
+  tt_ptr_op(cell3, OP_NE, cell2);
+  tt_int_op(cell3->payload_len, OP_EQ, cell2->payload_len);
+  tt_mem_op(cell3->payload, OP_EQ, cell2->payload, cell2->payload_len);
+  tor_free(cell3);
+
   tt_int_op(cell1->command, OP_EQ, CELL_CERTS);
   tt_int_op(cell1->payload_len, OP_GT, 1);
 
@@ -264,7 +276,6 @@ test_link_handshake_certs_ok(void *arg)
   c2->chan = chan2;
   chan2->conn = c2;
   c2->base_.address = tor_strdup("C2");
-  c2->tls = tor_tls_new(-1, 1);
   c2->link_proto = 4;
   c2->base_.conn_array_index = -1;
   crypto_pk_get_digest(key1, c2->identity_digest);
@@ -306,6 +317,7 @@ test_link_handshake_certs_ok(void *arg)
   connection_free_(TO_CONN(c2));
   tor_free(cell1);
   tor_free(cell2);
+  tor_free(cell3);
   certs_cell_free(cc1);
   certs_cell_free(cc2);
   if (chan1)
@@ -318,6 +330,266 @@ test_link_handshake_certs_ok(void *arg)
   crypto_pk_free(key2);
 }
 
+static int n_get_own_cert = 0;
+static tor_x509_cert_t *
+mock_get_own_cert_counting(tor_tls_t *tls)
+{
+  ++n_get_own_cert;
+  return tor_tls_get_own_cert__real(tls);
+}
+
+/* Return a new server-side connection that is ready to send a CERTS cell
+ * with whatever keys we have right now. */
+static or_connection_t *
+new_responder_conn(void)
+{
+  or_connection_t *conn = or_connection_new(CONN_TYPE_OR, AF_INET);
+  conn->base_.state = OR_CONN_STATE_OR_HANDSHAKING_V3;
+  conn->link_proto = 3;
+  conn->tls = tor_tls_new(-1, 1);
+  connection_init_or_handshake_state(conn, 0);
+  return conn;
+}
+
+/* Send a CERTS cell on <b>conn</b>, and return a copy of it. */
+static var_cell_t *
+send_certs_cell_copy(or_connection_t *conn)
+{
+  mock_got_var_cell = NULL;
+  if (connection_or_send_certs_cell(conn) < 0)
+    return NULL;
+  return mock_got_var_cell;
+}
+
+static int
+var_cells_eq(const var_cell_t *a, const var_cell_t *b)
+{
+  return a->command == b->command &&
+    a->payload_len == b->payload_len &&
+    fast_memeq(a->payload, b->payload, a->payload_len);
+}
+
+/* Make sure that we build a new CERTS cell when our keys rotate, and reuse
+ * the one we have when they don't. */
+static void
+test_link_handshake_certs_rotate(void *arg)
+{
+  or_connection_t *c1 = NULL, *c2 = NULL, *c3 = NULL, *c4 = NULL;
+  var_cell_t *cell1 = NULL, *cell2 = NULL, *cell3 = NULL;
+  certs_cell_t *cc1 = NULL, *cc2 = NULL;
+  crypto_pk_t *key1 = NULL, *key2 = NULL;
+  const int with_ed = !strcmp((const char *)arg, "Ed25519");
+
+  MOCK(connection_or_write_var_cell_to_buf, mock_write_var_cell);
+  MOCK(tor_tls_get_own_cert, mock_get_own_cert_counting);
+
+  key1 = pk_generate(2);
+  key2 = pk_generate(3);
+  tt_int_op(tor_tls_context_init(TOR_TLS_CTX_IS_PUBLIC_SERVER,
+                                 key1, key2, 86400), OP_EQ, 0);
+  if (with_ed) {
+    init_mock_ed_keys(key2);
+  } else {
+    certs_cell_ed25519_disabled_for_testing = 1;
+  }
+
+  /* The first connection builds the cell; the second one reuses it without
+   * looking at its own certificate at all. */
+  c1 = new_responder_conn();
+  c2 = new_responder_conn();
+  cell1 = send_certs_cell_copy(c1);
+  tt_assert(cell1);
+  tt_int_op(n_get_own_cert, OP_EQ, 1);
+  cell2 = send_certs_cell_copy(c2);
+  tt_assert(cell2);
+  tt_int_op(n_get_own_cert, OP_EQ, 1);
+  tt_assert(var_cells_eq(cell1, cell2));
+  tor_free(cell2);
+
+  /* Rotate our link key, and the Ed25519 certificate for it, the same way
+   * that we do when the TLS context expires. */
+  tt_int_op(tor_tls_context_init(TOR_TLS_CTX_IS_PUBLIC_SERVER,
+                                 key1, key2, 86400), OP_EQ, 0);
+  if (with_ed)
+    tt_int_op(generate_ed_link_cert(get_options(), time(NULL), 0), OP_EQ, 0);
+
+  c3 = new_responder_conn();
+  cell3 = send_certs_cell_copy(c3);
+  tt_assert(cell3);
+  tt_int_op(n_get_own_cert, OP_EQ, 2);
+  tt_assert(! var_cells_eq(cell1, cell3));
+
+  /* A connection from before the rotation still sends the link certificate
+   * it started with, and doesn't replace the new cell. */
+  cell2 = send_certs_cell_copy(c1);
+  tt_assert(cell2);
+  tt_int_op(n_get_own_cert, OP_EQ, 3);
+  tt_int_op(cell1->payload_len, OP_EQ,
+            certs_cell_parse(&cc1, cell1->payload, cell1->payload_len));
+  tt_int_op(cell2->payload_len, OP_EQ,
+            certs_cell_parse(&cc2, cell2->payload, cell2->payload_len));
+  tt_int_op(certs_cell_get_certs(cc2, 0)->cert_type, OP_EQ,
+            CERTTYPE_RSA1024_ID_LINK);
+  {
+    const certs_cell_cert_t *old_link = certs_cell_get_certs(cc1, 0);
+    const certs_cell_cert_t *link = certs_cell_get_certs(cc2, 0);
+    tt_int_op(old_link->cert_len, OP_EQ, link->cert_len);
+    tt_mem_op(certs_cell_cert_getconstarray_body(old_link), OP_EQ,
+              certs_cell_cert_getconstarray_body(link), link->cert_len);
+  }
+  tor_free(cell2);
+
+  cell2 = send_certs_cell_copy(c3);
+  tt_assert(cell2);
+  tt_int_op(n_get_own_cert, OP_EQ, 3);
+  tt_assert(var_cells_eq(cell3, cell2));
+  tor_free(cell2);
+
+  if (with_ed) {
+    /* A new Ed25519 link certificate alone also gets a new cell. */
+    tt_int_op(generate_ed_link_cert(get_options(), time(NULL) + 3600, 1),
+              OP_EQ, 0);
+    c4 = new_responder_conn();
+    cell2 = send_certs_cell_copy(c4);
+    tt_assert(cell2);
+    tt_int_op(n_get_own_cert, OP_EQ, 4);
+    tt_assert(! var_cells_eq(cell3, cell2));
+  }
+
+ done:
+  UNMOCK(connection_or_write_var_cell_to_buf);
+  UNMOCK(tor_tls_get_own_cert);
+  if (c1)
+    connection_free_(TO_CONN(c1));
+  if (c2)
+    connection_free_(TO_CONN(c2));
+  if (c3)
+    connection_free_(TO_CONN(c3));
+  if (c4)
+    connection_free_(TO_CONN(c4));
+  tor_free(cell1);
+  tor_free(cell2);
+  tor_free(cell3);
+  certs_cell_free(cc1);
+  certs_cell_free(cc2);
+  crypto_pk_free(key1);
+  crypto_pk_free(key2);
+}
+
+/** Work handed to mock_cpuworker_queue_work(). */
+typedef struct mock_cpuworker_job_t {
+  workqueue_reply_t (*fn)(void *, void *);
+  void (*reply_fn)(void *);
+  void *arg;
+  /** True once a "cpuworker" has started on this job. */
+  int started;
+  /** True iff this job was cancelled. */
+  int cancelled;
+} mock_cpuworker_job_t;
+
+static smartlist_t *mock_cpuworker_jobs = NULL;
+
+static int
+mock_cpuworker_is_running(void)
+{
+  return 1;
+}
+
+static workqueue_entry_t *
+mock_cpuworker_queue_work(workqueue_priority_t priority,
+                          workqueue_reply_t (*fn)(void *, void *),
+                          void (*reply_fn)(void *),
+                          void *arg)
+{
+  mock_cpuworker_job_t *job = tor_malloc_zero(sizeof(*job));
+  (void) priority;
+  job->fn = fn;
+  job->reply_fn = reply_fn;
+  job->arg = arg;
+  smartlist_add(mock_cpuworker_jobs, job);
+  /* Never dereferenced. */
+  return (workqueue_entry_t *) job;
+}
+
+static void *
+mock_cpuworker_cancel_work(workqueue_entry_t *ent)
+{
+  mock_cpuworker_job_t *job = (mock_cpuworker_job_t *) ent;
+  if (job->started)
+    return NULL;
+  job->cancelled = 1;
+  return job->arg;
+}
+
+/* Have a cpuworker start on the idx'th job handed to
+ * mock_cpuworker_queue_work(), without delivering its reply. */
+static void
+start_mock_cpuworker_job(int idx)
+{
+  mock_cpuworker_job_t *job = smartlist_get(mock_cpuworker_jobs, idx);
+  tt_assert(!job->started);
+  tt_assert(!job->cancelled);
+  job->started = 1;
+  tt_int_op(job->fn(NULL, job->arg), OP_EQ, WQ_RPL_REPLY);
+ done:
+  ;
+}
+
+/* Do the work of the idx'th job handed to mock_cpuworker_queue_work(), and
+ * deliver its reply. */
+static void
+run_mock_cpuworker_job(int idx)
+{
+  mock_cpuworker_job_t *job = smartlist_get(mock_cpuworker_jobs, idx);
+  start_mock_cpuworker_job(idx);
+  job->reply_fn(job->arg);
+}
+
+static int mock_stop_reading_called = 0;
+static void
+mock_stop_reading(connection_t *conn)
+{
+  (void) conn;
+  ++mock_stop_reading_called;
+}
+
+static int mock_start_reading_called = 0;
+static void
+mock_start_reading(connection_t *conn)
+{
+  (void) conn;
+  ++mock_start_reading_called;
+}
+
+/* Pretend to have cpuworkers, which only do their work when the test asks
+ * them to. */
+static void
+start_mock_cpuworkers(void)
+{
+  mock_cpuworker_jobs = smartlist_new();
+  MOCK(cpuworker_is_running, mock_cpuworker_is_running);
+  MOCK(cpuworker_queue_work, mock_cpuworker_queue_work);
+  MOCK(cpuworker_cancel_work, mock_cpuworker_cancel_work);
+  MOCK(connection_stop_reading, mock_stop_reading);
+  MOCK(connection_start_reading, mock_start_reading);
+}
+
+/* Undo start_mock_cpuworkers(). */
+static void
+stop_mock_cpuworkers(void)
+{
+  UNMOCK(cpuworker_is_running);
+  UNMOCK(cpuworker_queue_work);
+  UNMOCK(cpuworker_cancel_work);
+  UNMOCK(connection_stop_reading);
+  UNMOCK(connection_start_reading);
+  if (mock_cpuworker_jobs) {
+    SMARTLIST_FOREACH(mock_cpuworker_jobs, mock_cpuworker_job_t *, job,
+                      tor_free(job));
+    smartlist_free(mock_cpuworker_jobs);
+  }
+}
+
 typedef struct certs_data_s {
   int is_ed;
   int is_link_cert;
@@ -350,6 +622,7 @@ recv_certs_cleanup(const struct testcase_t *test, void *obj)
     crypto_pk_free(d->key2);
     tor_free(d);
   }
+  stop_mock_cpuworkers();
   routerkeys_free_all();
   return 1;
 }
@@ -534,6 +807,74 @@ test_link_handshake_recv_certs_ok_server(void *arg)
   ;
 }
 
+static void
+test_link_handshake_recv_certs_ok_server_async(void *arg)
+{
+  certs_data_t *d = arg;
+  start_mock_cpuworkers();
+  d->c->handshake_state->started_here = 0;
+  d->c->handshake_state->certs->started_here = 0;
+  channel_tls_process_certs_cell(d->cell, d->chan);
+
+  /* A cpuworker checks the certificates; we don't read till it's done. */
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 1);
+  tt_ptr_op(d->c->handshake_state->crypto_job, OP_NE, NULL);
+  tt_int_op(mock_stop_reading_called, OP_EQ, 1);
+  tt_int_op(d->c->handshake_state->received_certs_cell, OP_EQ, 0);
+
+  run_mock_cpuworker_job(0);
+  tt_ptr_op(d->c->handshake_state->crypto_job, OP_EQ, NULL);
+  tt_int_op(mock_start_reading_called, OP_EQ, 1);
+  tt_int_op(0, OP_EQ, mock_close_called);
+  tt_int_op(d->c->handshake_state->authenticated, OP_EQ, 0);
+  tt_int_op(d->c->handshake_state->received_certs_cell, OP_EQ, 1);
+  tt_ptr_op(d->c->handshake_state->certs->id_cert, OP_NE, NULL);
+  if (d->is_ed) {
+    tt_ptr_op(d->c->handshake_state->certs->ed_sign_auth, OP_NE, NULL);
+  } else {
+    tt_ptr_op(d->c->handshake_state->certs->auth_cert, OP_NE, NULL);
+  }
+
+ done:
+  ;
+}
+
+static void
+test_link_handshake_recv_certs_server_closed_async(void *arg)
+{
+  certs_data_t *d = arg;
+  mock_cpuworker_job_t *job;
+  start_mock_cpuworkers();
+
+  /* If the connection goes away before a cpuworker starts on its
+   * certificates, we cancel the work. */
+  d->c->handshake_state->started_here = 0;
+  d->c->handshake_state->certs->started_here = 0;
+  channel_tls_process_certs_cell(d->cell, d->chan);
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 1);
+  or_handshake_state_free(d->c->handshake_state);
+  d->c->handshake_state = NULL;
+  job = smartlist_get(mock_cpuworker_jobs, 0);
+  tt_int_op(job->cancelled, OP_EQ, 1);
+
+  /* If a cpuworker has already started, its reply ignores the
+   * connection. */
+  tt_int_op(connection_init_or_handshake_state(d->c, 0), OP_EQ, 0);
+  channel_tls_process_certs_cell(d->cell, d->chan);
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 2);
+  start_mock_cpuworker_job(1);
+  or_handshake_state_free(d->c->handshake_state);
+  d->c->handshake_state = NULL;
+  job = smartlist_get(mock_cpuworker_jobs, 1);
+  tt_int_op(job->cancelled, OP_EQ, 0);
+  job->reply_fn(job->arg);
+  tt_int_op(mock_start_reading_called, OP_EQ, 0);
+  tt_int_op(mock_close_called, OP_EQ, 0);
+
+ done:
+  ;
+}
+
 #define CERTS_FAIL(name, code)                          \
   static void                                                           \
   test_link_handshake_recv_certs_ ## name(void *arg)                    \
@@ -1166,6 +1507,7 @@ authenticate_data_cleanup(const struct testcase_t *test, void *arg)
     crypto_pk_free(d->key2);
     tor_free(d);
   }
+  stop_mock_cpuworkers();
   tor_x509_cert_free(mock_peer_cert);
   tor_x509_cert_free(mock_own_cert);
   mock_peer_cert = NULL;
@@ -1351,6 +1693,71 @@ test_link_handshake_auth_cell(void *arg)
   crypto_pk_free(auth_pubkey);
 }
 
+static void
+test_link_handshake_auth_async(void *arg)
+{
+  authenticate_data_t *d = arg;
+  channel_tls_t *chan1 = NULL;
+  var_cell_t *challenge = NULL;
+  const int authtype = d->is_ed ? AUTHTYPE_ED25519_SHA256_RFC5705 :
+    AUTHTYPE_RSA_SHA256_TLSSECRET;
+
+  start_mock_cpuworkers();
+  MOCK(connection_or_send_netinfo, mock_send_netinfo);
+  get_options_mutable()->ORPort_set = 1;
+
+  /* c1 gets an AUTH_CHALLENGE, and has a cpuworker sign its answer. */
+  chan1 = tor_malloc_zero(sizeof(*chan1));
+  chan1->conn = d->c1;
+  d->c1->chan = chan1;
+  d->c1->base_.address = tor_strdup("C1");
+  d->c1->handshake_state->received_certs_cell = 1;
+  challenge = var_cell_new(36);
+  challenge->command = CELL_AUTH_CHALLENGE;
+  challenge->payload[33] = 1; /* 1 method */
+  challenge->payload[35] = authtype;
+  channel_tls_process_auth_challenge_cell(challenge, chan1);
+
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 1);
+  tt_ptr_op(d->c1->handshake_state->crypto_job, OP_NE, NULL);
+  tt_int_op(mock_stop_reading_called, OP_EQ, 1);
+  tt_ptr_op(mock_got_var_cell, OP_EQ, NULL);
+  tt_int_op(mock_send_netinfo_called, OP_EQ, 0);
+
+  run_mock_cpuworker_job(0);
+  tt_ptr_op(d->c1->handshake_state->crypto_job, OP_EQ, NULL);
+  tt_int_op(mock_start_reading_called, OP_EQ, 1);
+  tt_int_op(mock_close_called, OP_EQ, 0);
+  tt_int_op(mock_send_netinfo_called, OP_EQ, 1);
+  tt_assert(mock_got_var_cell);
+  tt_int_op(mock_got_var_cell->command, OP_EQ, CELL_AUTHENTICATE);
+  tt_int_op(ntohs(get_uint16(mock_got_var_cell->payload)), OP_EQ, authtype);
+  tt_int_op(mock_got_var_cell->payload_len, OP_EQ, d->cell->payload_len);
+
+  /* c2 has a cpuworker check the signature. */
+  channel_tls_process_authenticate_cell(mock_got_var_cell, d->chan2);
+  tt_int_op(smartlist_len(mock_cpuworker_jobs), OP_EQ, 2);
+  tt_ptr_op(d->c2->handshake_state->crypto_job, OP_NE, NULL);
+  tt_int_op(mock_stop_reading_called, OP_EQ, 2);
+  tt_int_op(d->c2->handshake_state->authenticated, OP_EQ, 0);
+
+  run_mock_cpuworker_job(1);
+  tt_ptr_op(d->c2->handshake_state->crypto_job, OP_EQ, NULL);
+  tt_int_op(mock_start_reading_called, OP_EQ, 2);
+  tt_int_op(mock_close_called, OP_EQ, 0);
+  tt_int_op(d->c2->handshake_state->authenticated, OP_EQ, 1);
+  tt_int_op(d->c2->handshake_state->authenticated_rsa, OP_EQ, 1);
+  tt_int_op(d->c2->handshake_state->authenticated_ed25519, OP_EQ,
+            d->is_ed);
+
+ done:
+  UNMOCK(connection_or_send_netinfo);
+  d->c1->chan = NULL;
+  tor_free(chan1);
+  tor_free(challenge);
+  tor_free(mock_got_var_cell);
+}
+
 #define AUTHENTICATE_FAIL(name, code)                           \
   static void                                                   \
   test_link_handshake_auth_ ## name(void *arg)                  \
@@ -1492,11 +1899,16 @@ AUTHENTICATE_FAIL(missing_ed_auth,
 struct testcase_t link_handshake_tests[] = {
   TEST_RSA(certs_ok, TT_FORK),
   TEST_ED(certs_ok, TT_FORK),
+  TEST_RSA(certs_rotate, TT_FORK),
+  TEST_ED(certs_rotate, TT_FORK),
 
   TEST_RCV_CERTS(ok),
   TEST_RCV_CERTS_ED(ok, "Ed25519-Link"),
   TEST_RCV_CERTS_RSA(ok_server, "RSA-Auth"),
   TEST_RCV_CERTS_ED(ok_server, "Ed25519-Auth"),
+  TEST_RCV_CERTS_RSA(ok_server_async, "RSA-Auth"),
+  TEST_RCV_CERTS_ED(ok_server_async, "Ed25519-Auth"),
+  TEST_RCV_CERTS_RSA(server_closed_async, "RSA-Auth"),
   TEST_RCV_CERTS(badstate),
   TEST_RCV_CERTS(badproto),
   TEST_RCV_CERTS(duplicate),
@@ -1554,6 +1966,8 @@ struct testcase_t link_handshake_tests[] = {
 
   TEST_AUTHENTICATE(cell),
   TEST_AUTHENTICATE_ED(cell),
+  TEST_AUTHENTICATE(async),
+  TEST_AUTHENTICATE_ED(async),
   TEST_AUTHENTICATE(badstate),
   TEST_AUTHENTICATE(badproto),
   TEST_AUTHENTICATE(atclient),
@@ -1,6 +1,7 @@
 /* Copyright (c) 2013-2017, The Tor Project, Inc. */
 /* See LICENSE for licensing information */
 
+#define LOG_PRIVATE
 #include "orconfig.h"
 #include "or.h"
 #include "torlog.h"
@@ -164,10 +165,150 @@ test_ratelim(void *arg)
   tor_free(msg);
 }
 
+static void
+test_async_ring(void *arg)
+{
+  log_ring_t ring;
+  log_ring_chunk_t chunks[4];
+  void *target = NULL;
+  int t1, t2, n, n_chunks, i;
+  size_t n_bytes;
+  (void) arg;
+
+  log_ring_init(&ring, 256);
+  tt_assert(! log_ring_can_fit(&ring, 1000));
+
+  /* Fill the ring up. */
+  for (n = 0; log_ring_push(&ring, &t1, "aaaa", 4) == 0; ++n)
+    ;
+  tt_int_op(n, OP_GT, 3);
+
+  /* Take two messages out, and make room for one more. */
+  n_bytes = log_ring_peek(&ring, &target, chunks, 2, &n_chunks);
+  tt_int_op(n_chunks, OP_EQ, 2);
+  tt_ptr_op(target, OP_EQ, &t1);
+  tt_mem_op(chunks[0].data, OP_EQ, "aaaa", 4);
+  tt_int_op(chunks[0].len, OP_EQ, 4);
+  log_ring_consume(&ring, n_bytes);
+  tt_int_op(log_ring_push(&ring, &t2, "bbbbbb", 6), OP_EQ, 0);
+
+  /* We get back the rest of the first log's messages, then the second
+   * log's, even though it wrapped around. */
+  for (i = 2; i < n; ) {
+    n_bytes = log_ring_peek(&ring, &target, chunks, 4, &n_chunks);
+    tt_ptr_op(target, OP_EQ, &t1);
+    tt_int_op(n_chunks, OP_GT, 0);
+    i += n_chunks;
+    log_ring_consume(&ring, n_bytes);
+  }
+  tt_int_op(i, OP_EQ, n);
+  n_bytes = log_ring_peek(&ring, &target, chunks, 4, &n_chunks);
+  tt_ptr_op(target, OP_EQ, &t2);
+  tt_int_op(n_chunks, OP_EQ, 1);
+  tt_mem_op(chunks[0].data, OP_EQ, "bbbbbb", 6);
+  log_ring_consume(&ring, n_bytes);
+  tt_int_op(ring.used, OP_EQ, 0);
+
+ done:
+  log_ring_clear(&ring);
+}
+
+static void
+test_async_file(void *arg)
+{
+  const char *fn = get_fname("async_log");
+  char *content = NULL;
+  smartlist_t *lines = smartlist_new();
+  log_severity_list_t severity;
+  int i;
+  (void) arg;
+
+  set_log_severity_config(LOG_NOTICE, LOG_ERR, &severity);
+  init_logging(1);
+  mark_logs_temp();
+  tt_int_op(add_file_log(&severity, fn, 1), OP_EQ, 0);
+  close_temp_logs();
+
+  tt_int_op(logs_set_async(1, LOG_ASYNC_MIN_BUFFER_SIZE,
+                           LOG_ASYNC_OVERFLOW_BLOCK), OP_EQ, 0);
+  /* Write a lot more than fits in the buffer. */
+  for (i = 0; i < 2000; ++i)
+    log_notice(LD_GENERAL, "Message number %d.", i);
+  /* Errors get written before we return, after everything else. */
+  log_err(LD_GENERAL, "The end.");
+
+  content = read_file_to_str(fn, 0, NULL);
+  tt_ptr_op(content, OP_NE, NULL);
+  tor_split_lines(lines, content, (int)strlen(content));
+  if (strstr(smartlist_get(lines, 0), "opening new log file"))
+    smartlist_del_keeporder(lines, 0);
+  tt_int_op(smartlist_len(lines), OP_EQ, 2001);
+  for (i = 0; i < 2000; ++i) {
+    char expected[64];
+    tor_snprintf(expected, sizeof(expected), "Message number %d.", i);
+    tt_assert(strstr(smartlist_get(lines, i), expected));
+  }
+  tt_assert(strstr(smartlist_get(lines, 2000), "The end."));
+  tt_u64_op(logs_get_n_async_dropped(), OP_EQ, 0);
+
+  tt_int_op(logs_set_async(0, 0, LOG_ASYNC_OVERFLOW_DROP), OP_EQ, 0);
+
+ done:
+  tor_free(content);
+  smartlist_free(lines);
+}
+
+static void
+test_async_dead(void *arg)
+{
+  const char *fn = get_fname("async_log_ro");
+  log_severity_list_t severity;
+  const int *fds;
+  int fd = -1, n, i, found;
+  (void) arg;
+
+  tt_int_op(write_str_to_file(fn, "", 0), OP_EQ, 0);
+  fd = tor_open_cloexec(fn, O_RDONLY, 0);
+  tt_int_op(fd, OP_GE, 0);
+
+  set_log_severity_config(LOG_NOTICE, LOG_ERR, &severity);
+  init_logging(1);
+  mark_logs_temp();
+  add_stream_log(&severity, "read-only", fd);
+  close_temp_logs();
+  tor_log_update_sigsafe_err_fds();
+  n = tor_log_get_sigsafe_err_fds(&fds);
+  for (i = 0, found = 0; i < n; ++i)
+    found |= fds[i] == fd;
+  tt_assert(found);
+
+  tt_int_op(logs_set_async(1, LOG_ASYNC_MIN_BUFFER_SIZE,
+                           LOG_ASYNC_OVERFLOW_BLOCK), OP_EQ, 0);
+  /* The writer thread fails to write this one... */
+  log_notice(LD_GENERAL, "Nobody will read this.");
+  truncate_logs();
+  /* ...and we notice when we log the next one. */
+  log_notice(LD_GENERAL, "Nor this.");
+  tor_log_update_sigsafe_err_fds();
+  n = tor_log_get_sigsafe_err_fds(&fds);
+  for (i = 0, found = 0; i < n; ++i)
+    found |= fds[i] == fd;
+  tt_assert(!found);
+
+  tt_int_op(logs_set_async(0, 0, LOG_ASYNC_OVERFLOW_DROP), OP_EQ, 0);
+
+ done:
+  if (fd >= 0)
+    close(fd);
+}
+
 struct testcase_t logging_tests[] = {
   { "sigsafe_err_fds", test_get_sigsafe_err_fds, TT_FORK, NULL, NULL },
   { "sigsafe_err", test_sigsafe_err, TT_FORK, NULL, NULL },
   { "ratelim", test_ratelim, 0, NULL, NULL },
+  { "async_ring", test_async_ring, 0, NULL, NULL },
+  { "async_file", test_async_file, TT_FORK, NULL, NULL },
+  { "async_dead", test_async_dead, TT_FORK, NULL, NULL },
   END_OF_TESTCASES
 };
 
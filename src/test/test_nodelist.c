@@ -9,6 +9,7 @@
 #include "or.h"
 #include "networkstatus.h"
 #include "nodelist.h"
+#include "policies.h"
 #include "torcert.h"
 #include "test.h"
 
@@ -203,6 +204,191 @@ test_nodelist_ed_id(void *arg)
   UNMOCK(networkstatus_get_latest_consensus_by_flavor);
 }
 
+/** Check that the exit port set for <b>port</b> agrees with the exit
+ * policy of every node in the nodelist. Return 0 on success, -1 on
+ * failure. */
+static int
+check_exit_port_set(uint16_t port)
+{
+  bitarray_t *set = nodelist_get_exit_port_set(port);
+  if (!set)
+    return -1;
+  SMARTLIST_FOREACH_BEGIN(nodelist_get_list(), const node_t *, node) {
+    addr_policy_result_t r = compare_tor_addr_to_node_policy(NULL, port,
+                                                             node);
+    int expected = (r != ADDR_POLICY_REJECTED &&
+                    r != ADDR_POLICY_PROBABLY_REJECTED);
+    if (expected != !!bitarray_is_set(set, node_sl_idx))
+      return -1;
+  } SMARTLIST_FOREACH_END(node);
+  return 0;
+}
+
+static void
+test_nodelist_exit_port_sets(void *arg)
+{
+  routerstatus_t *rs[3];
+  microdesc_t *md[3];
+  routerinfo_t *ri[5];
+  networkstatus_t *ns;
+  node_t *n[5];
+  bitarray_t *set80, *set22;
+  int i;
+  (void)arg;
+
+  memset(md, 0, sizeof(md));
+  memset(ri, 0, sizeof(ri));
+  ns = tor_malloc_zero(sizeof(networkstatus_t));
+  ns->flavor = FLAV_MICRODESC;
+  ns->routerstatus_list = smartlist_new();
+  dummy_ns = ns;
+  MOCK(networkstatus_get_latest_consensus,
+       mock_networkstatus_get_latest_consensus);
+  MOCK(networkstatus_get_latest_consensus_by_flavor,
+       mock_networkstatus_get_latest_consensus_by_flavor);
+
+  for (i = 0; i < 3; ++i) {
+    rs[i] = tor_malloc_zero(sizeof(*rs[i]));
+    md[i] = tor_malloc_zero(sizeof(*md[i]));
+    crypto_rand(md[i]->digest, sizeof(md[i]->digest));
+    crypto_rand(rs[i]->identity_digest, sizeof(rs[i]->identity_digest));
+    memcpy(rs[i]->descriptor_digest, md[i]->digest, DIGEST256_LEN);
+    smartlist_add(ns->routerstatus_list, rs[i]);
+  }
+  md[0]->exit_policy = parse_short_policy("accept 80,443");
+  md[1]->exit_policy = parse_short_policy("reject 80");
+  /* Routers 3 and 4 are only known by routerinfo; with no exit policy,
+   * they accept everything. */
+  for (i = 3; i < 5; ++i) {
+    ri[i] = tor_malloc_zero(sizeof(*ri[i]));
+    crypto_rand(ri[i]->cache_info.identity_digest, DIGEST_LEN);
+  }
+
+  nodelist_set_consensus(ns);
+  for (i = 0; i < 3; ++i)
+    n[i] = node_get_mutable_by_id(rs[i]->identity_digest);
+
+  /* Nothing has a microdescriptor yet, so nothing looks like an exit. */
+  set80 = nodelist_get_exit_port_set(80);
+  tt_assert(set80);
+  for (i = 0; i < 3; ++i)
+    tt_assert(!bitarray_is_set(set80, n[i]->nodelist_idx));
+  set22 = nodelist_get_exit_port_set(22);
+  tt_int_op(0, OP_EQ, check_exit_port_set(22));
+
+  /* The sets we already built are updated as microdescriptors arrive. */
+  tt_ptr_op(n[0], OP_EQ, nodelist_add_microdesc(md[0]));
+  tt_ptr_op(n[1], OP_EQ, nodelist_add_microdesc(md[1]));
+  tt_assert(bitarray_is_set(set80, n[0]->nodelist_idx));
+  tt_assert(!bitarray_is_set(set80, n[1]->nodelist_idx));
+  tt_assert(!bitarray_is_set(set22, n[0]->nodelist_idx));
+  tt_assert(bitarray_is_set(set22, n[1]->nodelist_idx));
+  tt_int_op(0, OP_EQ, check_exit_port_set(80));
+  tt_int_op(0, OP_EQ, check_exit_port_set(443));
+
+  /* ... and when we learn that a node rejects everything. */
+  policies_set_node_exitpolicy_to_reject_all(n[1]);
+  tt_assert(!bitarray_is_set(set22, n[1]->nodelist_idx));
+
+  /* New nodes get a bit as soon as they have a routerinfo. */
+  n[3] = nodelist_set_routerinfo(ri[3], NULL);
+  n[4] = nodelist_set_routerinfo(ri[4], NULL);
+  tt_int_op(5, OP_EQ, smartlist_len(nodelist_get_list()));
+  tt_int_op(3, OP_EQ, n[3]->nodelist_idx);
+  tt_int_op(4, OP_EQ, n[4]->nodelist_idx);
+  set80 = nodelist_get_exit_port_set(80);
+  tt_assert(bitarray_is_set(set80, 3));
+  tt_assert(bitarray_is_set(set80, 4));
+
+  /* Dropping a node moves the last node's bit into its slot. */
+  policies_set_node_exitpolicy_to_reject_all(n[3]);
+  tt_assert(!bitarray_is_set(set80, 3));
+  nodelist_remove_routerinfo(ri[3]);
+  tt_int_op(4, OP_EQ, smartlist_len(nodelist_get_list()));
+  tt_int_op(3, OP_EQ, n[4]->nodelist_idx);
+  tt_assert(bitarray_is_set(set80, 3));
+  tt_assert(!bitarray_is_set(set80, 4));
+  tt_int_op(0, OP_EQ, check_exit_port_set(80));
+
+  /* Losing a microdescriptor clears the node's bits. */
+  nodelist_remove_microdesc(rs[0]->identity_digest, md[0]);
+  tt_assert(!bitarray_is_set(set80, n[0]->nodelist_idx));
+  tt_int_op(0, OP_EQ, check_exit_port_set(80));
+  tt_int_op(0, OP_EQ, check_exit_port_set(443));
+  tt_int_op(0, OP_EQ, check_exit_port_set(22));
+
+ done:
+  nodelist_free_all();
+  for (i = 0; i < 3; ++i) {
+    tor_free(rs[i]);
+    if (md[i])
+      short_policy_free(md[i]->exit_policy);
+    tor_free(md[i]);
+  }
+  for (i = 3; i < 5; ++i)
+    tor_free(ri[i]);
+  smartlist_clear(ns->routerstatus_list);
+  networkstatus_vote_free(ns);
+  UNMOCK(networkstatus_get_latest_consensus);
+  UNMOCK(networkstatus_get_latest_consensus_by_flavor);
+}
+
+static void
+test_nodelist_subtract_nodes(void *arg)
+{
+  routerinfo_t *ri[40];
+  node_t *n[40];
+  node_t *unlisted = NULL;
+  smartlist_t *sl = smartlist_new(), *excluded = smartlist_new();
+  int i;
+  (void)arg;
+
+  memset(ri, 0, sizeof(ri));
+  for (i = 0; i < 40; ++i) {
+    ri[i] = tor_malloc_zero(sizeof(*ri[i]));
+    crypto_rand(ri[i]->cache_info.identity_digest, DIGEST_LEN);
+    n[i] = nodelist_set_routerinfo(ri[i], NULL);
+    tt_int_op(i, OP_EQ, n[i]->nodelist_idx);
+  }
+  unlisted = tor_malloc_zero(sizeof(node_t));
+  unlisted->nodelist_idx = -1;
+
+  /* Exclude every third node, and a node that isn't in the nodelist. */
+  smartlist_add_all(sl, nodelist_get_list());
+  smartlist_add(sl, unlisted);
+  smartlist_add(sl, n[1]);
+  for (i = 0; i < 40; i += 3)
+    smartlist_add(excluded, n[i]);
+  smartlist_add(excluded, unlisted);
+  nodelist_subtract_nodes(sl, excluded);
+
+  tt_int_op(27, OP_EQ, smartlist_len(sl));
+  for (i = 0; i < 40; ++i)
+    tt_int_op(i % 3 != 0, OP_EQ, smartlist_contains(sl, n[i]));
+  tt_assert(! smartlist_contains(sl, unlisted));
+
+  /* Removing a node from the nodelist doesn't confuse us. */
+  nodelist_remove_routerinfo(ri[39]);
+  smartlist_clear(sl);
+  smartlist_add_all(sl, nodelist_get_list());
+  smartlist_clear(excluded);
+  smartlist_add(excluded, n[1]);
+  smartlist_add(excluded, n[38]);
+  nodelist_subtract_nodes(sl, excluded);
+  tt_int_op(37, OP_EQ, smartlist_len(sl));
+  tt_assert(! smartlist_contains(sl, n[1]));
+  tt_assert(! smartlist_contains(sl, n[38]));
+  tt_assert(smartlist_contains(sl, n[0]));
+
+ done:
+  nodelist_free_all();
+  for (i = 0; i < 40; ++i)
+    tor_free(ri[i]);
+  tor_free(unlisted);
+  smartlist_free(sl);
+  smartlist_free(excluded);
+}
+
 #define NODE(name, flags) \
   { #name, test_nodelist_##name, (flags), NULL, NULL }
 
@@ -211,6 +397,8 @@ struct testcase_t nodelist_tests[] = {
   NODE(node_get_verbose_nickname_not_named, TT_FORK),
   NODE(node_is_dir, TT_FORK),
   NODE(ed_id, TT_FORK),
+  NODE(exit_port_sets, TT_FORK),
+  NODE(subtract_nodes, TT_FORK),
   END_OF_TESTCASES
 };
 
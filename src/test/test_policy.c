@@ -2362,6 +2362,140 @@ test_policies_fascist_firewall_choose_address(void *arg)
   UNMOCK(get_options);
 }
 
+/** Helper: fill <b>addr</b> with a random address of <b>family</b> that
+ * shares a random-length prefix with <b>base</b>. */
+static void
+random_addr_near(tor_addr_t *addr, sa_family_t family, const uint8_t *base)
+{
+  uint8_t bytes[16];
+  const int len = family == AF_INET ? 4 : 16;
+  const int keep = crypto_rand_int(len * 8 + 1);
+  int i;
+
+  crypto_rand((char*)bytes, len);
+  for (i = 0; i < keep; ++i) {
+    const uint8_t bit = 0x80 >> (i & 7);
+    bytes[i >> 3] = (bytes[i >> 3] & ~bit) | (base[i >> 3] & bit);
+  }
+  if (family == AF_INET) {
+    uint32_t a;
+    memcpy(&a, bytes, 4);
+    tor_addr_from_ipv4n(addr, a);
+  } else {
+    tor_addr_from_ipv6_bytes(addr, (const char *)bytes);
+  }
+}
+
+/** Helper: return a random port, biased towards the handful of values in
+ * <b>ports</b>, and sometimes 0 if <b>allow_zero</b> is set. */
+static uint16_t
+random_port_near(const uint16_t *ports, int n_ports, int allow_zero)
+{
+  const int r = crypto_rand_int(8);
+  if (allow_zero && r == 0)
+    return 0;
+  else if (r < 5)
+    return ports[crypto_rand_int(n_ports)];
+  else
+    return (uint16_t)(1 + crypto_rand_int(65535));
+}
+
+/** Compare addr_policy_compile() against the linear evaluator in
+ * compare_tor_addr_to_addr_policy() on randomized policies. */
+static void
+test_policies_compiled(void *arg)
+{
+  /* A few base addresses, so that entries and queries overlap a lot. */
+  uint8_t bases[4][16];
+  const uint16_t ports[] = { 1, 2, 22, 23, 24, 80, 443, 444, 1024, 65534,
+                             65535 };
+  const int n_ports = (int)ARRAY_LENGTH(ports);
+  smartlist_t *policy = NULL;
+  compiled_addr_policy_t *cp = NULL;
+  int round, i;
+  (void)arg;
+
+  crypto_rand((char*)bases, sizeof(bases));
+
+  /* A NULL policy compiles to NULL, which accepts everything. */
+  tt_ptr_op(addr_policy_compile(NULL), OP_EQ, NULL);
+  tt_int_op(compare_tor_addr_to_compiled_addr_policy(NULL, 80, NULL),
+            OP_EQ, ADDR_POLICY_ACCEPTED);
+
+  for (round = 0; round < 200; ++round) {
+    const int n_entries = crypto_rand_int(40);
+    policy = smartlist_new();
+    for (i = 0; i < n_entries; ++i) {
+      addr_policy_t *e = tor_malloc_zero(sizeof(addr_policy_t));
+      const sa_family_t family = crypto_rand_int(2) ? AF_INET : AF_INET6;
+      const int maxbits = family == AF_INET ? 32 : 128;
+      uint16_t a, b;
+      e->refcnt = 1;
+      e->policy_type = crypto_rand_int(2) ? ADDR_POLICY_ACCEPT :
+        ADDR_POLICY_REJECT;
+      random_addr_near(&e->addr, family, bases[crypto_rand_int(4)]);
+      /* Favor short masks, so that entries cover each other. */
+      e->maskbits = crypto_rand_int(4) ? crypto_rand_int(maxbits / 4 + 1) :
+        crypto_rand_int(maxbits + 1);
+      if (crypto_rand_int(3) == 0) {
+        e->prt_min = 1;
+        e->prt_max = 65535;
+      } else {
+        a = random_port_near(ports, n_ports, 0);
+        b = random_port_near(ports, n_ports, 0);
+        e->prt_min = MIN(a, b);
+        e->prt_max = MAX(a, b);
+      }
+      smartlist_add(policy, e);
+    }
+
+    cp = addr_policy_compile(policy);
+    tt_assert(cp);
+
+    for (i = 0; i < 500; ++i) {
+      tor_addr_t addr;
+      const tor_addr_t *addrp = &addr;
+      const uint16_t port = random_port_near(ports, n_ports, 1);
+      const int kind = crypto_rand_int(10);
+      if (kind == 0) {
+        addrp = NULL;
+      } else if (kind == 1) {
+        tor_addr_make_null(&addr, AF_INET);
+      } else {
+        random_addr_near(&addr, kind & 1 ? AF_INET : AF_INET6,
+                         bases[crypto_rand_int(4)]);
+      }
+      tt_int_op(compare_tor_addr_to_compiled_addr_policy(addrp, port, cp),
+                OP_EQ, compare_tor_addr_to_addr_policy(addrp, port, policy));
+    }
+
+    compiled_addr_policy_free(cp);
+    cp = NULL;
+    addr_policy_list_free(policy);
+    policy = NULL;
+  }
+
+  /* And the same for the default exit policy, which is what most exits
+   * actually run. */
+  policies_parse_exit_policy(NULL, &policy, EXIT_POLICY_IPV6_ENABLED |
+                             EXIT_POLICY_REJECT_PRIVATE |
+                             EXIT_POLICY_ADD_DEFAULT, NULL);
+  tt_int_op(smartlist_len(policy), OP_GE, POLICY_COMPILE_MIN_ENTRIES);
+  cp = addr_policy_compile(policy);
+  for (i = 0; i < 5000; ++i) {
+    tor_addr_t addr;
+    const uint16_t port = random_port_near(ports, n_ports, 1);
+    random_addr_near(&addr, crypto_rand_int(2) ? AF_INET : AF_INET6,
+                     bases[crypto_rand_int(4)]);
+    tt_int_op(compare_tor_addr_to_compiled_addr_policy(&addr, port, cp),
+              OP_EQ, compare_tor_addr_to_addr_policy(&addr, port, policy));
+  }
+
+ done:
+  compiled_addr_policy_free(cp);
+  addr_policy_list_free(policy);
+}
+
 #undef TEST_IPV4_ADDR_STR
 #undef TEST_IPV6_ADDR_STR
 #undef TEST_IPV4_OR_PORT
@@ -2387,6 +2521,7 @@ struct testcase_t policy_tests[] = {
     test_policies_fascist_firewall_allows_address, 0, NULL, NULL },
   { "fascist_firewall_choose_address",
     test_policies_fascist_firewall_choose_address, 0, NULL, NULL },
+  { "compiled", test_policies_compiled, 0, NULL, NULL },
   END_OF_TESTCASES
 };
 
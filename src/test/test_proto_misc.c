@@ -102,6 +102,79 @@ test_proto_var_cell(void *arg)
   tor_free(mem_op_hex_tmp);
 }
 
+static void
+test_proto_fixed_cells(void *arg)
+{
+  (void)arg;
+  char tmp[CELL_MAX_NETWORK_SIZE];
+  buf_t *buf = NULL;
+  const char *cells = NULL;
+  int i, n, n_total;
+
+  /* Use small chunks, so that some cells straddle two of them. */
+  buf = buf_new_with_capacity(1024);
+
+  /* Nothing there, or not a whole cell: no cells yet. */
+  tt_int_op(0, OP_EQ, peek_fixed_cells_from_buf(buf, 4, &cells));
+  tt_ptr_op(cells, OP_EQ, NULL);
+  memset(tmp, 0, sizeof(tmp));
+  tmp[4] = CELL_RELAY;
+  buf_add(buf, tmp, 513);
+  tt_int_op(0, OP_EQ, peek_fixed_cells_from_buf(buf, 4, &cells));
+  buf_clear(buf);
+
+  /* Ten relay cells in a row come out in order, a chunk's worth at a
+   * time. */
+  for (i = 0; i < 10; ++i) {
+    set_uint32(tmp, htonl(i));
+    tmp[4] = CELL_RELAY;
+    memset(tmp+5, 'a'+i, sizeof(tmp)-5);
+    buf_add(buf, tmp, 514);
+  }
+  n_total = 0;
+  while ((n = peek_fixed_cells_from_buf(buf, 4, &cells))) {
+    tt_ptr_op(cells, OP_NE, NULL);
+    tt_int_op(n, OP_LE, 10 - n_total);
+    for (i = 0; i < n; ++i) {
+      const char *c = cells + 514 * i;
+      tt_int_op(ntohl(get_uint32(c)), OP_EQ, n_total + i);
+      tt_int_op(c[4], OP_EQ, CELL_RELAY);
+      tt_int_op(c[5], OP_EQ, 'a' + n_total + i);
+      tt_int_op(c[513], OP_EQ, 'a' + n_total + i);
+    }
+    buf_drain(buf, 514 * n);
+    n_total += n;
+  }
+  tt_int_op(n_total, OP_EQ, 10);
+  tt_int_op(buf_datalen(buf), OP_EQ, 0);
+
+  /* A variable-length cell ends the run. */
+  memset(tmp, 0, sizeof(tmp));
+  tmp[4] = CELL_PADDING;
+  buf_add(buf, tmp, 514);
+  buf_add(buf,
+          "\x01\x02\x03\x04" /* circid */
+          "\x07" /* VERSIONS */
+          "\x00\x02\x00\x04", 9);
+  buf_add(buf, tmp, 514);
+  tt_int_op(1, OP_EQ, peek_fixed_cells_from_buf(buf, 4, &cells));
+  buf_drain(buf, 514);
+  tt_int_op(0, OP_EQ, peek_fixed_cells_from_buf(buf, 4, &cells));
+  buf_clear(buf);
+
+  /* Two-byte circuit IDs before link protocol 4. */
+  tmp[2] = CELL_CREATE_FAST;
+  buf_add(buf, tmp, 512);
+  buf_add(buf, tmp, 512);
+  buf_add(buf, tmp, 100);
+  tt_int_op(2, OP_EQ, peek_fixed_cells_from_buf(buf, 3, &cells));
+  tt_int_op(cells[2], OP_EQ, CELL_CREATE_FAST);
+  tt_int_op(cells[512+2], OP_EQ, CELL_CREATE_FAST);
+
+ done:
+  buf_free(buf);
+}
+
 static void
 test_proto_control0(void *arg)
 {
@@ -254,6 +327,7 @@ test_proto_line(void *arg)
 
 struct testcase_t proto_misc_tests[] = {
   { "var_cell", test_proto_var_cell, 0, NULL, NULL },
+  { "fixed_cells", test_proto_fixed_cells, 0, NULL, NULL },
   { "control0", test_proto_control0, 0, NULL, NULL },
   { "ext_or_cmd", test_proto_ext_or_cmd, TT_FORK, NULL, NULL },
   { "line", test_proto_line, 0, NULL, NULL },
@@ -1074,6 +1074,7 @@ test_rend_cache_clean_v2_descs_as_dir(void *data)
   now = time(NULL);
   cutoff = now - (REND_CACHE_MAX_AGE + REND_CACHE_MAX_SKEW);
   const char key[DIGEST_LEN] = "abcde";
+  const char old_key[DIGEST_LEN] = "fghij";
 
   (void)data;
 
@@ -1090,16 +1091,31 @@ test_rend_cache_clean_v2_descs_as_dir(void *data)
   desc->timestamp = now;
   desc->pk = pk_generate(0);
   e->parsed = desc;
-  digestmap_set(rend_cache_v2_dir, key, e);
+  rend_cache_v2_dir_add(key, e);
 
   /* Set the cutoff to minus 10 seconds. */
   rend_cache_clean_v2_descs_as_dir(cutoff - 10);
   tt_int_op(digestmap_size(rend_cache_v2_dir), OP_EQ, 1);
 
-  // Test with one old entry
+  // Test with one old entry next to the new one
+  e = tor_malloc_zero(sizeof(rend_cache_entry_t));
+  e->last_served = now;
+  desc = tor_malloc_zero(sizeof(rend_service_descriptor_t));
   desc->timestamp = cutoff - 1000;
+  desc->pk = pk_generate(0);
+  e->parsed = desc;
+  rend_cache_v2_dir_add(old_key, e);
+  tt_int_op(digestmap_size(rend_cache_v2_dir), OP_EQ, 2);
   rend_cache_clean_v2_descs_as_dir(cutoff);
+  tt_int_op(digestmap_size(rend_cache_v2_dir), OP_EQ, 1);
+  tt_ptr_op(digestmap_get(rend_cache_v2_dir, old_key), OP_EQ, NULL);
+  tt_ptr_op(rend_cache_v2_dir_by_age, OP_NE, NULL);
+  tt_int_op(smartlist_len(rend_cache_v2_dir_by_age), OP_EQ, 1);
+
+  // Once the cutoff moves past it, the new entry goes too
+  rend_cache_clean_v2_descs_as_dir(now + 1);
   tt_int_op(digestmap_size(rend_cache_v2_dir), OP_EQ, 0);
+  tt_int_op(smartlist_len(rend_cache_v2_dir_by_age), OP_EQ, 0);
 
  done:
   rend_cache_free_all();
@@ -371,6 +371,168 @@ test_replaycache_realtime(void *arg)
   return;
 }
 
+static void
+test_replaycache_bloom_badalloc(void *arg)
+{
+  replaycache_t *r = NULL;
+
+  (void)arg;
+  /* Negative horizon should fail */
+  r = replaycache_new_bloom(-600, 100, 0.001);
+  tt_ptr_op(r, OP_EQ, NULL);
+
+  /* A silly false positive rate gets replaced by a sane one */
+  r = replaycache_new_bloom(600, 100, 2.0);
+  tt_ptr_op(r, OP_NE, NULL);
+  tt_ptr_op(r->digests_seen, OP_EQ, NULL);
+  tt_ptr_op(r->bloom, OP_NE, NULL);
+  tt_int_op(r->bloom->n_slices, OP_EQ, REPLAYCACHE_BLOOM_N_SLICES);
+  tt_int_op(r->bloom->n_hashes, OP_GE, 1);
+
+ done:
+  if (r) replaycache_free(r);
+
+  return;
+}
+
+static void
+test_replaycache_bloom_hit(void *arg)
+{
+  replaycache_t *r = NULL;
+  int result;
+  time_t elapsed = -1;
+
+  (void)arg;
+  r = replaycache_new_bloom(0, 100, 0.001);
+  tt_ptr_op(r, OP_NE, NULL);
+  tt_int_op(r->bloom->n_slices, OP_EQ, 1);
+  /* Nothing is allocated until the first entry comes in */
+  tt_ptr_op(r->bloom->slices[0], OP_EQ, NULL);
+
+  result =
+    replaycache_add_and_test_internal(1200, r, test_buffer,
+        strlen(test_buffer), NULL);
+  tt_int_op(result,OP_EQ, 0);
+  tt_ptr_op(r->bloom->slices[0], OP_NE, NULL);
+
+  result =
+    replaycache_add_and_test_internal(1300, r, test_buffer_2,
+        strlen(test_buffer_2), NULL);
+  tt_int_op(result,OP_EQ, 0);
+
+  /* No horizon: still there much later */
+  result =
+    replaycache_add_and_test_internal(1000000, r, test_buffer,
+        strlen(test_buffer), &elapsed);
+  tt_int_op(result,OP_EQ, 1);
+  tt_int_op(elapsed, OP_EQ, 1000000 - 1200);
+
+  /* Scrubbing does nothing to a Bloom cache */
+  replaycache_scrub_if_needed_internal(2000000, r);
+  result =
+    replaycache_add_and_test_internal(2000000, r, test_buffer_2,
+        strlen(test_buffer_2), NULL);
+  tt_int_op(result,OP_EQ, 1);
+
+ done:
+  if (r) replaycache_free(r);
+
+  return;
+}
+
+static void
+test_replaycache_bloom_age(void *arg)
+{
+  replaycache_t *r = NULL;
+  int i, result, n_allocated = 0;
+
+  (void)arg;
+  r = replaycache_new_bloom(600, 100, 0.001);
+  tt_ptr_op(r, OP_NE, NULL);
+  tt_int_op(r->bloom->slice_len, OP_EQ, 200);
+
+  result =
+    replaycache_add_and_test_internal(1399, r, test_buffer,
+        strlen(test_buffer), NULL);
+  tt_int_op(result,OP_EQ, 0);
+  /* Only the slice in use is allocated */
+  for (i = 0; i < r->bloom->n_slices; ++i) {
+    n_allocated += r->bloom->slices[i] != NULL;
+  }
+  tt_int_op(n_allocated, OP_EQ, 1);
+
+  /* Still seen a full horizon later, in a different slice */
+  result =
+    replaycache_add_and_test_internal(1999, r, test_buffer_2,
+        strlen(test_buffer_2), NULL);
+  tt_int_op(result,OP_EQ, 0);
+  result =
+    replaycache_add_and_test_internal(1999, r, test_buffer,
+        strlen(test_buffer), NULL);
+  tt_int_op(result,OP_EQ, 1);
+
+  /* test_buffer was just added again to the current slice; test_buffer_2
+   * ages out once its slice is older than the horizon. */
+  result =
+    replaycache_add_and_test_internal(2500, r, test_buffer,
+        strlen(test_buffer), NULL);
+  tt_int_op(result,OP_EQ, 1);
+  result =
+    replaycache_add_and_test_internal(2600, r, test_buffer_2,
+        strlen(test_buffer_2), NULL);
+  tt_int_op(result,OP_EQ, 0);
+
+  /* Everything is gone after a long silence */
+  result =
+    replaycache_add_and_test_internal(100000, r, test_buffer,
+        strlen(test_buffer), NULL);
+  tt_int_op(result,OP_EQ, 0);
+
+ done:
+  if (r) replaycache_free(r);
+
+  return;
+}
+
+static void
+test_replaycache_bloom_many(void *arg)
+{
+  replaycache_t *r = NULL;
+  const int n_entries = 2000;
+  int i, result, false_positives = 0;
+  uint32_t n_bits;
+  char buf[32];
+
+  (void)arg;
+  r = replaycache_new_bloom(0, n_entries, 0.001);
+  tt_ptr_op(r, OP_NE, NULL);
+  n_bits = r->bloom->n_bits;
+
+  for (i = 0; i < n_entries; ++i) {
+    tor_snprintf(buf, sizeof(buf), "entry %d", i);
+    false_positives +=
+      replaycache_add_and_test_internal(1200, r, buf, strlen(buf), NULL);
+  }
+  /* We expect about 2 false positives here. */
+  tt_int_op(false_positives, OP_LE, 20);
+
+  /* No false negatives */
+  for (i = 0; i < n_entries; ++i) {
+    tor_snprintf(buf, sizeof(buf), "entry %d", i);
+    result =
+      replaycache_add_and_test_internal(1300, r, buf, strlen(buf), NULL);
+    tt_int_op(result, OP_EQ, 1);
+  }
+
+  /* The size doesn't change as we add entries. */
+  tt_uint_op(r->bloom->n_bits, OP_EQ, n_bits);
+
+ done:
+  if (r) replaycache_free(r);
+
+  return;
+}
+
 #define REPLAYCACHE_LEGACY(name) \
   { #name, test_replaycache_ ## name , 0, NULL, NULL }
 
@@ -386,6 +548,10 @@ struct testcase_t replaycache_tests[] = {
   REPLAYCACHE_LEGACY(scrub),
   REPLAYCACHE_LEGACY(future),
   REPLAYCACHE_LEGACY(realtime),
+  REPLAYCACHE_LEGACY(bloom_badalloc),
+  REPLAYCACHE_LEGACY(bloom_hit),
+  REPLAYCACHE_LEGACY(bloom_age),
+  REPLAYCACHE_LEGACY(bloom_many),
   END_OF_TESTCASES
 };
 
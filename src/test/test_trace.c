@@ -0,0 +1,136 @@
+/* Copyright (c) 2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+#include "orconfig.h"
+#include "or.h"
+#include "trace/ring.h"
+#include "test.h"
+
+/** Size of the fixed part of a dump header, before the event table. */
+#define DUMP_HEADER_LEN (8 + 4*4)
+/** Size of one record in a dump. */
+#define DUMP_RECORD_LEN (8 + 4 + 4 + 4*8)
+
+/** Helper: skip the header and event table of the dump in <b>body</b>, and
+ * return a pointer to its first ring. */
+static const char *
+skip_to_rings(const char *body, uint32_t *n_rings_out)
+{
+  const char *cp = body + 8 + 4 + 4;
+  uint32_t n_events, i;
+  memcpy(&n_events, cp, 4);
+  memcpy(n_rings_out, cp + 4, 4);
+  cp += 8;
+  for (i = 0; i < n_events; ++i) {
+    uint32_t len;
+    memcpy(&len, cp, 4);
+    cp += 4 + len;
+  }
+  return cp;
+}
+
+static void
+test_trace_ring_dump(void *arg)
+{
+  char *fname = tor_strdup(get_fname("trace-dump"));
+  char *body = NULL;
+  const char *cp;
+  uint32_t u32, n_rings, n_records, event;
+  uint64_t args[4];
+  (void)arg;
+
+  /* Nothing to dump before the tracer is set up, and events are ignored. */
+  tor_trace_ring_emit(TOR_TRACE_RING_EV_cell_recv, 1, 2, 3, 0);
+  tt_int_op(-1, OP_EQ, tor_trace_ring_dump(fname));
+
+  tor_trace_ring_init();
+  tor_trace_ring_emit(TOR_TRACE_RING_EV_cell_recv, 9, 1000, 77, 0);
+  tor_trace_ring_emit(TOR_TRACE_RING_EV_scheduler_kist_run_begin,
+                      3, 0, 0, 0);
+  tt_int_op(0, OP_EQ, tor_trace_ring_dump(fname));
+
+  body = read_file_to_str(fname, RFTS_BIN, NULL);
+  tt_assert(body);
+  tt_mem_op(body, OP_EQ, TOR_TRACE_DUMP_MAGIC, 8);
+  memcpy(&u32, body + 8, 4);
+  tt_int_op(u32, OP_EQ, TOR_TRACE_DUMP_VERSION);
+  memcpy(&u32, body + 12, 4);
+  tt_int_op(u32, OP_EQ, 0x01020304);
+  memcpy(&u32, body + 16, 4);
+  tt_int_op(u32, OP_EQ, TOR_TRACE_RING_N_EVENTS);
+  /* The event table describes each event and its arguments. */
+  memcpy(&u32, body + DUMP_HEADER_LEN, 4);
+  tt_int_op(u32, OP_EQ, strlen("cell:recv:command,circ_id,chan"));
+  tt_mem_op(body + DUMP_HEADER_LEN + 4, OP_EQ,
+            "cell:recv:command,circ_id,chan", u32);
+
+  /* One thread, with both of its events. */
+  cp = skip_to_rings(body, &n_rings);
+  tt_int_op(n_rings, OP_EQ, 1);
+  memcpy(&u32, cp, 4);
+  tt_int_op(u32, OP_EQ, 0);
+  memcpy(&n_records, cp + 4, 4);
+  tt_int_op(n_records, OP_EQ, 2);
+  cp += 16;
+  memcpy(&event, cp + 8, 4);
+  memcpy(args, cp + 16, sizeof(args));
+  tt_int_op(event, OP_EQ, TOR_TRACE_RING_EV_cell_recv);
+  tt_u64_op(args[0], OP_EQ, 9);
+  tt_u64_op(args[1], OP_EQ, 1000);
+  tt_u64_op(args[2], OP_EQ, 77);
+  tt_u64_op(args[3], OP_EQ, 0);
+  cp += DUMP_RECORD_LEN;
+  memcpy(&event, cp + 8, 4);
+  memcpy(args, cp + 16, sizeof(args));
+  tt_int_op(event, OP_EQ, TOR_TRACE_RING_EV_scheduler_kist_run_begin);
+  tt_u64_op(args[0], OP_EQ, 3);
+
+ done:
+  tor_trace_ring_free_all();
+  tor_free(body);
+  tor_free(fname);
+}
+
+static void
+test_trace_ring_wrap(void *arg)
+{
+  char *fname = tor_strdup(get_fname("trace-dump"));
+  char *body = NULL;
+  const char *cp;
+  uint32_t n_rings, n_records, i;
+  uint64_t ts, prev_ts = 0, a0;
+  (void)arg;
+
+  tor_trace_ring_init();
+  /* Write more events than fit; only the newest ones should survive. */
+  for (i = 0; i < TOR_TRACE_RING_RECORDS + 100; ++i)
+    tor_trace_ring_emit(TOR_TRACE_RING_EV_buffer_flush, i, 0, 0, 0);
+  tt_int_op(0, OP_EQ, tor_trace_ring_dump(fname));
+
+  body = read_file_to_str(fname, RFTS_BIN, NULL);
+  tt_assert(body);
+  cp = skip_to_rings(body, &n_rings);
+  tt_int_op(n_rings, OP_EQ, 1);
+  memcpy(&n_records, cp + 4, 4);
+  tt_int_op(n_records, OP_EQ, TOR_TRACE_RING_RECORDS);
+  cp += 16;
+  for (i = 0; i < n_records; ++i) {
+    memcpy(&ts, cp, 8);
+    memcpy(&a0, cp + 16, 8);
+    tt_u64_op(a0, OP_EQ, i + 100);
+    tt_u64_op(ts, OP_GE, prev_ts);
+    prev_ts = ts;
+    cp += DUMP_RECORD_LEN;
+  }
+
+ done:
+  tor_trace_ring_free_all();
+  tor_free(body);
+  tor_free(fname);
+}
+
+struct testcase_t trace_tests[] = {
+  { "ring_dump", test_trace_ring_dump, TT_FORK, NULL, NULL },
+  { "ring_wrap", test_trace_ring_wrap, TT_FORK, NULL, NULL },
+  END_OF_TESTCASES
+};
@@ -14,6 +14,7 @@
 #include "control.h"
 #include "test.h"
 #include "memarea.h"
+#include "objpool.h"
 #include "util_process.h"
 #include "log_test_helpers.h"
 
@@ -3715,6 +3716,94 @@ test_util_memarea(void *arg)
   tor_free(malloced_ptr);
 }
 
+/** Run unit tests for the fixed-size object pool allocator. */
+static void
+test_util_objpool(void *arg)
+{
+  objpool_t *pool = objpool_new("test", 100, 8);
+  objpool_t *other = objpool_new("other", 100, 8);
+  objpool_stats_t st;
+  char *items[20];
+  char *p;
+  int i;
+  (void)arg;
+
+  tt_assert(smartlist_contains(objpool_get_all(), pool));
+  tt_assert(smartlist_contains(objpool_get_all(), other));
+
+  /* Objects are zeroed, aligned, and carved from a chunk in order. */
+  for (i = 0; i < 20; ++i) {
+    items[i] = objpool_alloc_zero(pool);
+    tt_assert(tor_mem_is_zero(items[i], 100));
+    tt_int_op(((uintptr_t)items[i]) % 16, OP_EQ, 0);
+    memset(items[i], 0x5a, 100);
+  }
+  tt_assert(items[0] + 100 <= items[1]);
+  tt_assert(items[1] - items[0] < 200);
+  objpool_assert_ok(pool);
+  objpool_get_stats(pool, &st);
+  tt_str_op(st.name, OP_EQ, "test");
+  tt_int_op(st.item_size, OP_EQ, 100);
+  tt_int_op(st.n_chunks, OP_EQ, 3);
+  tt_int_op(st.n_empty_chunks, OP_EQ, 0);
+  tt_int_op(st.n_items_in_use, OP_EQ, 20);
+  tt_u64_op(st.n_allocs_total, OP_EQ, 20);
+
+  /* A freed object is the next one handed out, zeroed again. */
+  p = items[3];
+  objpool_free(pool, items[3]);
+  tt_ptr_op(items[3], OP_EQ, NULL);
+  objpool_assert_ok(pool);
+  items[3] = objpool_alloc_zero(pool);
+  tt_ptr_op(items[3], OP_EQ, p);
+  tt_assert(tor_mem_is_zero(items[3], 100));
+
+  /* Emptying the first chunk leaves it cached until we trim. */
+  for (i = 0; i < 8; ++i)
+    objpool_free(pool, items[i]);
+  objpool_assert_ok(pool);
+  objpool_get_stats(pool, &st);
+  tt_int_op(st.n_chunks, OP_EQ, 3);
+  tt_int_op(st.n_empty_chunks, OP_EQ, 1);
+  tt_int_op(st.n_items_in_use, OP_EQ, 12);
+  tt_int_op(st.bytes_idle, OP_GT, 800);
+  tt_int_op(objpool_trim(pool, st.bytes_idle), OP_EQ, 0);
+  tt_int_op(objpool_trim(pool, 0), OP_EQ, st.bytes_idle);
+  objpool_assert_ok(pool);
+  objpool_get_stats(pool, &st);
+  tt_int_op(st.n_chunks, OP_EQ, 2);
+  tt_int_op(st.n_empty_chunks, OP_EQ, 0);
+  tt_u64_op(st.n_chunks_released_total, OP_EQ, 1);
+
+  /* Free the rest.  Pools created first get the first claim on a shared
+   * budget, so a budget of one chunk keeps at most one of ours and none of
+   * the other pool's. */
+  for (i = 8; i < 20; ++i)
+    objpool_free(pool, items[i]);
+  items[0] = objpool_alloc_zero(other);
+  objpool_free(other, items[0]);
+  objpool_get_stats(pool, &st);
+  tt_int_op(st.n_empty_chunks, OP_EQ, 2);
+  objpool_trim_all(st.bytes_idle / 2);
+  objpool_get_stats(pool, &st);
+  tt_int_op(st.n_empty_chunks, OP_LE, 1);
+  tt_int_op(st.n_items_in_use, OP_EQ, 0);
+  objpool_get_stats(other, &st);
+  tt_int_op(st.n_chunks, OP_EQ, 0);
+  objpool_assert_ok(pool);
+  objpool_assert_ok(other);
+
+  i = smartlist_len(objpool_get_all());
+  objpool_destroy(other);
+  other = NULL;
+  tt_int_op(smartlist_len(objpool_get_all()), OP_EQ, i - 1);
+  tt_assert(smartlist_contains(objpool_get_all(), pool));
+
+ done:
+  objpool_destroy(pool);
+  objpool_destroy(other);
+}
+
 /** Run unit tests for utility functions to get file names relative to
  * the data directory. */
 static void
@@ -6091,6 +6180,7 @@ struct testcase_t util_tests[] = {
   UTIL_TEST(gzip_compression_bomb, TT_FORK),
   UTIL_LEGACY(datadir),
   UTIL_LEGACY(memarea),
+  UTIL_TEST(objpool, TT_FORK),
   UTIL_LEGACY(control_formats),
   UTIL_LEGACY(mmap),
   UTIL_TEST(sscanf, TT_FORK),
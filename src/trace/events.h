@@ -34,6 +34,17 @@
 #include "trace/debug.h"
 #endif
 
+/* Enable event tracing for the ring buffer framework, where every trace
+ * event is recorded in a per-thread binary ring buffer that can be dumped
+ * to disk. Every event must be listed in TOR_TRACE_RING_EVENTS, and take at
+ * least one and at most four integer arguments. */
+#ifdef USE_EVENT_TRACING_RING
+#include "trace/ring.h"
+#undef tor_trace
+#define tor_trace(subsystem, name, ...) \
+  TOR_TRACE_RING_EMIT(subsystem, name, __VA_ARGS__)
+#endif
+
 #else /* TOR_EVENT_TRACING_ENABLED */
 
 /* Reaching this point, we NOP every event declaration because event tracing
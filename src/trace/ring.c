@@ -0,0 +1,324 @@
+/* Copyright (c) 2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file ring.c
+ * \brief An in-process event tracer that records binary trace events in
+ * per-thread ring buffers.
+ *
+ * Each thread that hits a tracepoint gets its own fixed-size ring of
+ * records.  Only that thread ever writes to it, so recording an event
+ * takes no locks: we read the clock, fill in the next slot, and bump a
+ * counter.  Once a ring is full, new records overwrite the oldest ones, so
+ * the rings always hold the most recent history of every thread.
+ *
+ * tor_trace_ring_dump() copies the rings out to a file.  It can run while
+ * other threads are still recording: every record carries a sequence
+ * number that its writer clears before filling it in and sets afterwards,
+ * and the dumper skips any record whose sequence number changed while it
+ * was being copied.
+ *
+ * The dump file holds, in host byte order:
+ *   - the 8 bytes of TOR_TRACE_DUMP_MAGIC;
+ *   - a uint32 format version (TOR_TRACE_DUMP_VERSION);
+ *   - a uint32 byte order mark (0x01020304);
+ *   - a uint32 count of event types, then a uint32 count of rings;
+ *   - for each event type, a uint32 length and that many bytes of
+ *     "subsystem:name:argname,argname,...";
+ *   - for each ring, a uint32 thread number, a uint32 record count, and a
+ *     uint64 OS thread ID, followed by the records from oldest to newest.
+ *     Each record is a uint64 timestamp in nanoseconds (from
+ *     monotime_absolute_nsec()), a uint32 event type, four bytes of
+ *     padding, and four uint64 arguments.
+ *
+ * scripts/maint/decode_trace.py converts a dump into the Chrome trace event
+ * format.
+ **/
+
+#include "orconfig.h"
+#include "compat.h"
+#include "compat_threads.h"
+#include "compat_time.h"
+#include "container.h"
+#include "torlog.h"
+#include "util.h"
+
+#include "trace/ring.h"
+
+#include <string.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#if (TOR_TRACE_RING_RECORDS & (TOR_TRACE_RING_RECORDS - 1)) != 0
+#error "TOR_TRACE_RING_RECORDS must be a power of two."
+#endif
+
+/* The sequence numbers and write counters are shared between the thread
+ * that records events and the one that dumps them.  Use the compiler's
+ * atomics where we have them, so that the dumper sees a record's sequence
+ * number change only after (or before) the rest of the record. */
+#if defined(__GNUC__) || defined(__clang__)
+#define RING_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define RING_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#define RING_LOAD(p) (*(volatile uint64_t *)(p))
+#define RING_STORE(p, v) STMT_BEGIN *(volatile uint64_t *)(p) = (v); STMT_END
+#define RING_FENCE() STMT_NIL
+#endif
+
+/** One recorded trace event. */
+typedef struct trace_record_t {
+  /** One more than this record's position in the ring's history, or 0 if
+   * the record is being written. */
+  uint64_t seq;
+  /** When was the event recorded? In nanoseconds since monotime_init(). */
+  uint64_t timestamp_ns;
+  /** What kind of event is this? A tor_trace_ring_event_t. */
+  uint32_t event;
+  /** The tracepoint's arguments. Unused arguments are zero. */
+  uint64_t args[4];
+} trace_record_t;
+
+/** The records of one thread. */
+typedef struct trace_ring_t {
+  /** The next ring in all_rings. */
+  struct trace_ring_t *next;
+  /** Number for this thread, in the order they first recorded an event. */
+  uint32_t thread_num;
+  /** The value of tor_get_thread_id() for this thread. */
+  uint64_t thread_id;
+  /** How many records has this thread ever written? The next record goes
+   * in records[n_written % TOR_TRACE_RING_RECORDS]. */
+  uint64_t n_written;
+  trace_record_t records[TOR_TRACE_RING_RECORDS];
+} trace_ring_t;
+
+/** True iff tor_trace_ring_init() has been called. */
+static int trace_ring_initialized = 0;
+/** Holds the current thread's trace_ring_t, once it has one. */
+static tor_threadlocal_t trace_ring_key;
+/** Protects all_rings and n_rings. */
+static tor_mutex_t trace_ring_lock;
+/** Every ring that any thread has created, newest first. Rings live until
+ * tor_trace_ring_free_all().
+ *
+ * (This is a plain linked list rather than a smartlist, and we write dumps
+ * with start_writing_to_file() rather than write_bytes_to_file(), because
+ * libor-trace is linked into the unit tests without being rebuilt with
+ * TOR_UNIT_TESTS: it can't call any function that the tests may mock.) */
+static trace_ring_t *all_rings = NULL;
+/** How many rings are in all_rings? */
+static uint32_t n_rings = 0;
+
+/** Descriptions of every event type, in the format used in dumps. */
+#define TOR_TRACE_RING_DESC_(subsystem, name, argnames) \
+  #subsystem ":" #name ":" argnames,
+static const char *event_descriptions[] = {
+  TOR_TRACE_RING_EVENTS(TOR_TRACE_RING_DESC_)
+};
+
+/** Set up the ring buffer tracer. Until this is called, all trace events
+ * are ignored. */
+void
+tor_trace_ring_init(void)
+{
+  if (trace_ring_initialized)
+    return;
+  tor_threadlocal_init(&trace_ring_key);
+  tor_mutex_init(&trace_ring_lock);
+  trace_ring_initialized = 1;
+}
+
+/** Release every ring buffer. No other thread may be recording events when
+ * this is called. */
+void
+tor_trace_ring_free_all(void)
+{
+  if (!trace_ring_initialized)
+    return;
+  trace_ring_initialized = 0;
+  while (all_rings) {
+    trace_ring_t *next = all_rings->next;
+    tor_free(all_rings);
+    all_rings = next;
+  }
+  n_rings = 0;
+  tor_threadlocal_set(&trace_ring_key, NULL);
+  tor_threadlocal_destroy(&trace_ring_key);
+  tor_mutex_uninit(&trace_ring_lock);
+}
+
+/** Create and register a ring for the current thread. */
+static trace_ring_t *
+trace_ring_new_for_thread(void)
+{
+  trace_ring_t *ring = tor_malloc_zero(sizeof(trace_ring_t));
+  ring->thread_id = tor_get_thread_id();
+  tor_mutex_acquire(&trace_ring_lock);
+  ring->thread_num = n_rings++;
+  ring->next = all_rings;
+  all_rings = ring;
+  tor_mutex_release(&trace_ring_lock);
+  tor_threadlocal_set(&trace_ring_key, ring);
+  return ring;
+}
+
+/** Record an <b>event</b> with arguments <b>a0</b> through <b>a3</b> in the
+ * current thread's ring. Called by tor_trace(). */
+void
+tor_trace_ring_emit(tor_trace_ring_event_t event,
+                    uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3)
+{
+  trace_ring_t *ring;
+  trace_record_t *rec;
+  uint64_t n;
+
+  if (PREDICT_UNLIKELY(!trace_ring_initialized))
+    return;
+  ring = tor_threadlocal_get(&trace_ring_key);
+  if (PREDICT_UNLIKELY(ring == NULL))
+    ring = trace_ring_new_for_thread();
+
+  n = ring->n_written;
+  rec = &ring->records[n & (TOR_TRACE_RING_RECORDS - 1)];
+  RING_STORE(&rec->seq, 0);
+  RING_FENCE();
+  rec->timestamp_ns = monotime_absolute_nsec();
+  rec->event = (uint32_t) event;
+  rec->args[0] = a0;
+  rec->args[1] = a1;
+  rec->args[2] = a2;
+  rec->args[3] = a3;
+  RING_STORE(&rec->seq, n + 1);
+  RING_STORE(&ring->n_written, n + 1);
+}
+
+/** A growable buffer that we build a dump in. */
+typedef struct dump_buf_t {
+  char *mem;
+  size_t len;
+  size_t cap;
+} dump_buf_t;
+
+/** Append <b>n</b> bytes from <b>data</b> to <b>db</b>. */
+static void
+dump_add(dump_buf_t *db, const void *data, size_t n)
+{
+  if (db->len + n > db->cap) {
+    size_t cap = db->cap ? db->cap : 4096;
+    while (cap < db->len + n)
+      cap *= 2;
+    db->mem = tor_realloc(db->mem, cap);
+    db->cap = cap;
+  }
+  memcpy(db->mem + db->len, data, n);
+  db->len += n;
+}
+
+/** Append the uint32 <b>v</b> to <b>db</b>. */
+static void
+dump_add_u32(dump_buf_t *db, uint32_t v)
+{
+  dump_add(db, &v, sizeof(v));
+}
+
+/** Append the uint64 <b>v</b> to <b>db</b>. */
+static void
+dump_add_u64(dump_buf_t *db, uint64_t v)
+{
+  dump_add(db, &v, sizeof(v));
+}
+
+/** Append the complete records of <b>ring</b>, oldest first, to <b>db</b>,
+ * preceded by the ring's header. */
+static void
+dump_add_ring(dump_buf_t *db, trace_ring_t *ring)
+{
+  const uint64_t n_written = RING_LOAD(&ring->n_written);
+  const uint64_t first = n_written > TOR_TRACE_RING_RECORDS ?
+    n_written - TOR_TRACE_RING_RECORDS : 0;
+  size_t count_offset;
+  uint64_t pos;
+  uint32_t n = 0;
+
+  dump_add_u32(db, ring->thread_num);
+  count_offset = db->len;
+  dump_add_u32(db, 0); /* Filled in below. */
+  dump_add_u64(db, ring->thread_id);
+
+  for (pos = first; pos < n_written; ++pos) {
+    trace_record_t *rec = &ring->records[pos & (TOR_TRACE_RING_RECORDS-1)];
+    trace_record_t copy;
+    if (RING_LOAD(&rec->seq) != pos + 1)
+      continue; /* Overwritten, or being overwritten. */
+    memcpy(&copy, rec, sizeof(copy));
+    RING_FENCE();
+    if (RING_LOAD(&rec->seq) != pos + 1)
+      continue; /* Overwritten while we were copying it. */
+
+    dump_add_u64(db, copy.timestamp_ns);
+    dump_add_u32(db, copy.event);
+    dump_add_u32(db, 0);
+    dump_add(db, copy.args, sizeof(copy.args));
+    ++n;
+  }
+
+  memcpy(db->mem + count_offset, &n, sizeof(n));
+}
+
+/** Write every ring's records to <b>fname</b>, in the format described at
+ * the top of this file. Return 0 on success, -1 on failure. */
+int
+tor_trace_ring_dump(const char *fname)
+{
+  dump_buf_t db;
+  trace_ring_t *rings, *ring;
+  uint32_t rings_len;
+  open_file_t *open_file = NULL;
+  int fd, i;
+
+  if (!trace_ring_initialized)
+    return -1;
+
+  /* Rings are only ever added at the head of the list, and never freed
+   * until shutdown, so it's safe to walk the list after we release the
+   * lock. */
+  tor_mutex_acquire(&trace_ring_lock);
+  rings = all_rings;
+  rings_len = n_rings;
+  tor_mutex_release(&trace_ring_lock);
+
+  memset(&db, 0, sizeof(db));
+  dump_add(&db, TOR_TRACE_DUMP_MAGIC, strlen(TOR_TRACE_DUMP_MAGIC));
+  dump_add_u32(&db, TOR_TRACE_DUMP_VERSION);
+  dump_add_u32(&db, 0x01020304);
+  dump_add_u32(&db, TOR_TRACE_RING_N_EVENTS);
+  dump_add_u32(&db, rings_len);
+  for (i = 0; i < TOR_TRACE_RING_N_EVENTS; ++i) {
+    const char *desc = event_descriptions[i];
+    dump_add_u32(&db, (uint32_t) strlen(desc));
+    dump_add(&db, desc, strlen(desc));
+  }
+  for (ring = rings; ring; ring = ring->next)
+    dump_add_ring(&db, ring);
+
+  fd = start_writing_to_file(fname, OPEN_FLAGS_REPLACE|O_BINARY, 0600,
+                             &open_file);
+  if (fd < 0)
+    goto err;
+  if (write_all(fd, db.mem, db.len, 0) != (ssize_t)db.len) {
+    log_warn(LD_FS, "Error writing trace dump to \"%s\": %s", fname,
+             strerror(errno));
+    goto err;
+  }
+  tor_free(db.mem);
+  return finish_writing_to_file(open_file);
+
+ err:
+  tor_free(db.mem);
+  if (open_file)
+    abort_writing_to_file(open_file);
+  return -1;
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) 2017, The Tor Project, Inc. */
+/* See LICENSE for licensing information */
+
+/**
+ * \file ring.h
+ * \brief Header file for the in-process ring buffer tracer.
+ **/
+
+#ifndef TOR_TRACE_RING_H
+#define TOR_TRACE_RING_H
+
+#include "torint.h"
+
+/* Every trace event that the ring buffer tracer knows how to record.  Each
+ * entry gives the subsystem and name used in the tor_trace() call, followed
+ * by a comma-separated list of names for its (at most four) integer
+ * arguments.  The names are copied into every dump so that the decoder in
+ * scripts/maint/decode_trace.py doesn't need its own copy of this list.
+ *
+ * Events whose names end in "_begin" and "_end" are shown by the decoder as
+ * the start and end of a duration. */
+#define TOR_TRACE_RING_EVENTS(E)                                        \
+  E(cell, recv, "command,circ_id,chan")                                 \
+  E(cell, queue, "command,circ_id,direction,queue_len")                 \
+  E(cell, flush, "chan,n_flushed")                                      \
+  E(relay, recv, "circ_id,direction")                                   \
+  E(circuitmux, pick, "n_active_circuits,n_cells,destroy")              \
+  E(scheduler, kist_run_begin, "n_pending")                             \
+  E(scheduler, kist_run_end, "n_waiting_to_write")                      \
+  E(cpuworker, queue, "handshake_type,n_pending_jobs")                  \
+  E(cpuworker, job_begin, "handshake_type")                             \
+  E(cpuworker, job_end, "handshake_type,ok")                            \
+  E(cpuworker, reply, "handshake_type,ok,usec")                         \
+  E(buffer, flush, "conn,n_written,n_left")                             \
+  E(tmodel, viterbi_queue, "n_outstanding")                             \
+  E(tmodel, viterbi_begin, "n_observations")                            \
+  E(tmodel, viterbi_end, "ok")
+
+#define TOR_TRACE_RING_ENUM_(subsystem, name, argnames) \
+  TOR_TRACE_RING_EV_ ## subsystem ## _ ## name,
+
+/** Identifier for one kind of event in the ring buffer tracer. */
+typedef enum tor_trace_ring_event_t {
+  TOR_TRACE_RING_EVENTS(TOR_TRACE_RING_ENUM_)
+  TOR_TRACE_RING_N_EVENTS
+} tor_trace_ring_event_t;
+
+/** Helper for tor_trace(): take the first four of its arguments. Callers
+ * pad the argument list with zeros. */
+#define TOR_TRACE_RING_ARGS_(a, b, c, d, ...) (a), (b), (c), (d)
+
+/** Record the event <b>subsystem</b>:<b>name</b>, with up to four integer
+ * arguments, in the current thread's ring buffer. */
+#define TOR_TRACE_RING_EMIT(subsystem, name, ...)                      \
+  tor_trace_ring_emit(TOR_TRACE_RING_EV_ ## subsystem ## _ ## name,     \
+                      TOR_TRACE_RING_ARGS_(__VA_ARGS__, 0, 0, 0, 0))
+
+/** How many records does each thread's ring hold?  Must be a power of
+ * two. */
+#ifndef TOR_TRACE_RING_RECORDS
+#define TOR_TRACE_RING_RECORDS 8192
+#endif
+
+void tor_trace_ring_init(void);
+void tor_trace_ring_free_all(void);
+void tor_trace_ring_emit(tor_trace_ring_event_t event,
+                         uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3);
+int tor_trace_ring_dump(const char *fname);
+
+/** Magic bytes at the start of every trace dump. */
+#define TOR_TRACE_DUMP_MAGIC "TORTRACE"
+/** Version of the trace dump format. */
+#define TOR_TRACE_DUMP_VERSION 1
+
+#endif /* !defined(TOR_TRACE_RING_H) */
@@ -1,11 +1,27 @@
 /* Copyright (c) 2017, The Tor Project, Inc. */
 /* See LICENSE for licensing information */
 
+#include "orconfig.h"
 #include "trace.h"
 
+#ifdef USE_EVENT_TRACING_RING
+#include "trace/ring.h"
+#endif
+
 /** Initialize the tracing library. */
 void
 tor_trace_init(void)
 {
+#ifdef USE_EVENT_TRACING_RING
+  tor_trace_ring_init();
+#endif
 }
 
+/** Free all the memory held by the tracing library. */
+void
+tor_trace_free_all(void)
+{
+#ifdef USE_EVENT_TRACING_RING
+  tor_trace_ring_free_all();
+#endif
+}
@@ -5,6 +5,7 @@
 #define TOR_TRACE_TRACE_H
 
 void tor_trace_init(void);
+void tor_trace_free_all(void);
 
 #endif // TOR_TRACE_TRACE_H
 